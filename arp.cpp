@@ -1,22 +1,52 @@
 #include "arp.h"
+#include "arppresent.h"
+#include "arpthread.h"
+#include "arpring.h"
+#include "arptrace.h"
+#include "arpreplay.h"
+#include "arpstate.h"
+#include "arpcapture.h"
+#include "arpstats.h"
+#include "arpjobs.h"
+#include "arppose.h"
+#include "arparena.h"
+#include "arppower.h"
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include "glm/glm.hpp"
+#include "cyBVH.h"
+#define STBRP_STATIC
+#define STB_RECT_PACK_IMPLEMENTATION
+#include "imstb_rectpack.h"
+#ifndef ARP_NO_OVERLAY
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
+#endif
 
 #include <thread>
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
 #include <mutex>
 #include <iostream>
-#include <unordered_map>
-#include <unordered_set>
+#include <fstream>
+#include <filesystem>
+#include <string>
 #include <vector>
-#include <list>
+#include <deque>
+#include <unordered_map>
 #include <cmath>
+#include <cstring>
+#include <algorithm>
+
+// from glfw3native.h, declared here so EGL headers aren't needed. GLFW builds
+// its EGL backend on every platform
+extern "C" {
+void* glfwGetEGLDisplay(void);
+void* glfwGetEGLContext(GLFWwindow* window);
+}
 
 using std::uint32_t;
 
@@ -24,735 +54,11454 @@ namespace arp {
 
 /// Forward declarations ///
 
+struct DepthPyramid;
+struct LayerTiles;
+struct LayerCamera;
+struct TemporalHistory;
+struct LayerProgram;
+struct GridMesh;
+struct PendingProgram;
+struct CompactColor;
+struct RetainedFrame;
+struct PyramidBuilder;
+
 static void appThreadStarter(ApplicationCallback callback);
+static ThreadPriority applyThreadConfig(const char* name, ThreadPriority priority, int core);
+static ContextPriority queryContextPriority(GLFWwindow* context);
+static void notifySettingsChanged();
+#ifndef ARP_NO_OVERLAY
+static void buildOverlayWindow();
+#endif
+static void updateOverlay(double time);
+static void drawOverlay();
+static void drawCursor();
+static int cursorInputMode();
+static void drawFullscreenTexture(GLuint texture, const FrameLayer* layer = nullptr, bool distort = false,
+                                  bool alphaMasked = false);
 static void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
+static void cursorPosCallback(GLFWwindow* window, double x, double y);
 static void framebufferSizeCallback(GLFWwindow* window, int width, int height);
+static void windowPosCallback(GLFWwindow* window, int x, int y);
+static void monitorCallback(GLFWmonitor* monitor, int event);
 static void setupGL();
-static void drawLayer(const FrameLayer& layer);
-static void drawLayerParallaxEnabled(const FrameLayer& layer);
+static void drawViews();
+static void drawSplitViewports();
+static void splitViewportRect(const GLint whole[4], int viewports, int index, GLint rect[4]);
+static void drawLayerPlane();
+static void buildDistortionMesh(int cells);
+static void drawLayers();
+static Pose eyePose(const Pose& head, int eye, float ipd);
+static void drawLayer(const FrameLayer& layer, int layerIndex);
+static bool layerTranslated(const FrameLayer& layer, int layerIndex);
+static int layerBatchLength(int first, int step, int splatBefore);
+static void drawLayerBatch(int first, int step, int count);
+static void drawLayerParallaxEnabled(const FrameLayer& layer, int layerIndex);
+static void bindLayerImage(const LayerProgram& program, const FrameLayer& layer);
+static void bindReshading(const LayerProgram& program, const FrameLayer& layer, const LayerCamera& camera);
+static void layerViewport(const FrameLayer& layer, int viewport[4]);
+static void layerRect(const FrameLayer& layer, float rect[4], float clamp[4]);
+static void setLayerRect(GLint rectLoc, GLint clampLoc, const FrameLayer* layer);
+static const TemporalHistory* resolvedHistory(const FrameLayer& layer);
+static int checkerboardParity(const FrameLayer& layer);
+static void resolveTemporalHistory(TemporalHistory& history, const FrameLayer& layer, const LayerCamera& camera);
+static float motionTime(const FrameLayer& layer);
+static bool extrapolatingMotion();
+static bool layerPassesThrough(const FrameLayer& layer, const LayerCamera& camera, bool translated);
+static void drawLayerCopy(const FrameLayer& layer, int layerIndex);
+static bool sparseTiles(const FrameLayer& layer);
+static void classifyLayerTiles(LayerTiles& tiles, const FrameLayer& layer);
+static void drawParallaxCompute(const FrameLayer& layer, const LayerCamera& camera, const DepthPyramid& pyramid,
+                                bool fillDisocclusions, const CompactColor* compact);
+static void updateVoxelCache();
+static void insertVoxels(const FrameLayer& layer, const LayerCamera& camera, const DepthPyramid& pyramid);
+static void readVoxelCache();
+static void drawVoxelSplat();
+static void trimTransientTextures(int maxIdle);
+static void updateSceneGeometry();
+static void updateReshadingLights();
+static void drawSceneTrace();
+static void dispatchLinear(GLuint count);
+static void drawParallax(const FrameLayer& layer, const LayerCamera& camera, const DepthPyramid& pyramid,
+                         bool fillDisocclusions, const CompactColor* compact = nullptr);
+static void bindCompactColor(const LayerProgram& program, const CompactColor& compact);
+static bool compactable(const FrameLayer& layer, const DepthPyramid& pyramid);
+static void compactRetainedLayer(const FrameLayer& layer, const DepthPyramid& pyramid, CompactColor& color,
+                                 DepthPyramid& compactPyramid);
+static void releaseRetainedImages(RetainedFrame& frame);
+static void allocateDepthPyramid(DepthPyramid& pyramid, int width, int height);
+static void drawLayerGridWarp(const FrameLayer& layer, int layerIndex);
+static void drawLayerCubeMap(const FrameLayer& layer, int layerIndex);
+static void buildDepthPyramid(DepthPyramid& pyramid, const FrameLayer& layer, const LayerProjection& projection,
+                              bool damaged);
+static void drawDepthPyramid(const PyramidBuilder& builder, DepthPyramid& pyramid, GLuint depth, const int origin[2],
+                             int checkerboardParity, const LayerProjection& projection, const int (*rects)[4],
+                             int rectCount);
+static void setUpPyramidBuilder(PyramidBuilder& builder, GLuint copyProgram, GLuint reduceProgram);
+static void readDepthRange(int layerIndex, const DepthPyramid& pyramid, const LayerProjection& projection);
+static void collectDepthRanges();
+static void setDepthMapping(GLint mappingLoc, GLint rangeLoc, const LayerProjection& projection);
+static void gridAxis(int pixels, int cellSize, float fovea, float radius, float peripheralQuality,
+                     std::vector<float>& lines);
+static void buildGridMesh(GridMesh& grid, const std::vector<float>& xs, const std::vector<float>& ys);
+static bool latchPendingFrame();
+static bool latchThreadLayers();
+static SwapchainCreateInfo cpuSwapchainInfo(int width, int height);
+static void reportJank(const JankEvent& event);
+static void reportSwapchainWait(double time, double wait);
+static void placeThreadLayers(FrameSubmitInfo& frame, bool newFrame);
+static void resolveFrameLayers();
+static bool refreshIdle(bool changed);
+static bool samePose(const Pose& a, const Pose& b);
+static void updateLayerCameraMatrices(LayerCamera& camera);
+static bool moveReferenceSpaces(double time);
+static void updateReprojectionUniforms();
+static glm::mat4 viewMatrix(const Pose& pose);
+static glm::mat4 cameraMatrix(const Pose& pose);
+static glm::mat4 projectionMatrix(const LayerProjection& p);
+static glm::mat4 frustumPlane(const LayerProjection& p, float distance);
+static glm::mat3 rotationHomography(const LayerProjection& layerProjection, const glm::quat& layerOrientation);
+static void retireFrame(FrameSubmitInfo& frame);
+static void retainFrame(FrameSubmitInfo& frame, int historyLength);
+static void updateReprojectionCost(double cpuCost);
+static void publishReprojectionSubmit();
+static void updateQualityGovernor(double gpuTime);
+static void updateDisplayTiming(double latchTime, double swapEnd, bool variable);
+static double drawBeamRaced(bool latencyFlash, double& vblank);
+static void updateBeamRacedTiming();
+static void recordLatency(double latency, bool presentFeedback);
+static void drawLatencyMarker(bool flash);
+static void compareGroundTruth();
+static void collectQualityResult();
+static double getPredictedSubmitTime();
+static void beginAppFrameTiming();
+static void endAppFrameTiming();
+static int retireAppFrameFences(int limit);
+static void sleepUntil(double time);
+static void updateGpuMemory(double time);
+static void updatePowerState(double time);
+static int pacedFramerate();
+static int retainedHistoryLength();
+static void waitEventsUntil(double time);
+static void waitForFrameUntil(double time);
+static void followMonitor();
+static void applyReprojectionThreadConfig();
+static void renderThreadMain();
+static void pumpWindowEvents();
+static void runRefreshLoop();
+static void processInputEvents(double time);
+static void restartKeyTimesAfterSubmit();
+static void addKeyTime(int key, double time);
+static const RefreshRecord* beginReplayRefresh();
+static bool latchReplayedFrame(const RefreshRecord& refresh);
+static bool getReplayedPose(Pose& pose, PoseInfo& poseInfo);
 static GLuint compileProgram(const char* vertShaderSrc, const char* fragShaderSrc);
-static void compileShader(GLuint shader, const char* source);
+static PendingProgram startProgram(const char* vertShaderSrc, const char* fragShaderSrc,
+                                   const std::string& defines = "");
+static PendingProgram startComputeProgram(const char* computeShaderSrc, const std::string& defines = "");
+static GLuint finishProgram(PendingProgram& pending);
+static void buildFromSource(PendingProgram& pending);
+static void startShaderCompilation();
+static bool computeParallaxSupported();
+static void compileShader(GLuint shader, const char* source, const std::string& defines);
+static void printShaderLog(GLuint shader);
 static double keyTimeFunction(int key);
+static double predictSamples(int predictor, const double* t, const double* x, int count,
+                             double at, double measurementNoise, double processNoise);
+static void measurePrediction(const Pose& from, const Pose& predicted, const Pose& actual);
+static void interpolateCameraPose(double time, bool latched, bool input);
+
+/**
+ * Single producer, single consumer triple buffer. The producer fills back()
+ * and publishes it, the consumer takes the newest published slot as front().
+ * Neither side ever waits on the other.
+ */
+template<typename T>
+class Mailbox {
+private:
+    static const uint32_t NEW_BIT = 4;
+    static const uint32_t INDEX_MASK = 3;
+
+    T slots[3];
+    uint32_t backIndex = 0;
+    uint32_t frontIndex = 1;
+    std::atomic<uint32_t> readyIndex{2};
+
+public:
+    T& back() { return slots[backIndex]; }
+    T& front() { return slots[frontIndex]; }
+
+    /**
+     * Publishes back() to the consumer. Returns true if the slot that becomes
+     * the new back() holds a value the consumer never took.
+     */
+    bool publish() {
+        uint32_t previous = readyIndex.exchange(backIndex | NEW_BIT, std::memory_order_acq_rel);
+        backIndex = previous & INDEX_MASK;
+        return previous & NEW_BIT;
+    }
+
+    /**
+     * Returns true if something was published since the last consume(). Only
+     * the consumer clears the flag, so this stays true until it consumes.
+     */
+    bool hasNew() const {
+        return readyIndex.load(std::memory_order_acquire) & NEW_BIT;
+    }
+
+    /**
+     * Makes the newest published value front(). The old front() is handed
+     * back to the producer, so the consumer must be done with it.
+     */
+    bool consume() {
+        if(!hasNew())
+            return false;
+        uint32_t previous = readyIndex.exchange(frontIndex, std::memory_order_acq_rel);
+        frontIndex = previous & INDEX_MASK;
+        return true;
+    }
+};
+
+/**
+ * Mouse position sampled by reprojection
+ */
+struct InputSample {
+    double time;
+    double mouseX;
+    double mouseY;
+};
+
+enum InputEventType {
+    INPUT_EVENT_KEY,
+    INPUT_EVENT_CURSOR,
+};
+
+/**
+ * Window input recorded by the GLFW callbacks, with the time it was received
+ */
+struct InputEvent {
+    double time;
+    InputEventType type;
+    // GLFW key and action of key events
+    int key;
+    int action;
+    // cursor position of cursor events
+    double x;
+    double y;
+};
+
+// key state is kept in arrays indexed by GLFW key code
+static const int KEY_COUNT = GLFW_KEY_LAST + 1;
+
+static bool validKey(int key) {
+    return key >= 0 && key < KEY_COUNT;
+}
+
+/**
+ * Reprojection's view of the camera, published every refresh for the app
+ */
+struct CameraState {
+    Pose pose;
+    PoseInfo poseInfo;
+    // input of the frame reprojection was displaying when this was published
+    PoseInfo framePoseInfo;
+    // keys held when pose was evaluated, 1 if held
+    std::uint8_t heldKeys[KEY_COUNT];
+};
+
+/**
+ * Framebuffer with a color texture other contexts of the share group can
+ * read, drawn in place of a window's
+ */
+struct OffscreenTarget {
+    GLuint fbo = 0;
+    GLuint color = 0;
+    GLuint depth = 0;
+    int width = 0;
+    int height = 0;
+};
+
+/**
+ * A window added with addOutputWindow
+ */
+struct OutputWindow {
+    GLFWwindow* window;
+    // guarded by outputWindowsMutex
+    OutputView view;
+    // framebuffer size, kept by the event thread with a render thread
+    int width = 0;
+    int height = 0;
+    // drawn by reprojection's context
+    OffscreenTarget target;
+    // reads target.color, made in the window's own context
+    GLuint readFbo = 0;
+};
 
 /// Reprojection variables ///
 
 static bool initialized = false;
 
+// only one of these is set
 static PoseFunction poseFunction = nullptr;
+static ContextPoseFunction contextPoseFunction = nullptr;
+static BatchPoseFunction batchPoseFunction = nullptr;
+// replaces window input and the pose function when set, see setPoseSource
+static std::atomic<PoseSource*> poseSource{nullptr};
+// see setReferenceSpace
+static std::atomic<PoseSource*> referenceSpaces[MAX_REFERENCE_SPACES] = {};
+// see setPoseFunctionBudget, 0 to wait for the pose function
+static std::atomic<double> poseFunctionBudget{0};
+static InputOverrideFunction inputOverride = nullptr;
+static const int maxOverrideKeys = 16;
 static float projectionNear = -1;
 static float projectionFar = -1;
 static float projectionFovY = -1;
 static float projectionAspect = -1;
 static GLFWwindow* window = nullptr;
 static GLFWwindow* hiddenWindow = nullptr;
+// shares objects with hiddenWindow, for uploads from another thread
+static GLFWwindow* uploadWindow = nullptr;
+// contexts of threads that submitLayer, see setAppContexts
+static int appContextCount = 0;
+static GLFWwindow* appContexts[MAX_FRAME_LAYERS] = {};
+// hintContextPriority asked for a high-priority window context
+static bool contextPriorityRequested = false;
+static bool contextPriorityWarned = false;
+
+static std::thread appThread;
+static ThreadConfig threadConfig;
+// see ThreadConfig::renderThread. The calling thread then pumps window events
+// and makes every GLFW call that has to be on the main thread
+static bool renderThreadEnabled = false;
+static std::thread renderThread;
+static std::atomic<bool> renderThreadDone{false};
+static const double eventPumpInterval = 0.0005;
+// held by the event thread while GLFW handles events, and by the render
+// thread around the GLFW calls the overlay makes, which it skips for a
+// refresh rather than wait for a slow poll
+static std::mutex windowEventMutex;
+// cursor position the event thread read after each poll
+static HistoryRing<InputSample, 4> polledCursor;
 
-static std::thread reprojectionThread;
-
-static std::mutex posesMutex;
 static bool frameValid = false;
-static FrameSubmitInfo lastFrame;
+// submitFrame publishes here, reprojection takes the newest frame
+static Mailbox<FrameSubmitInfo> frameMailbox;
+// frame currently used by reprojection, always frameMailbox.front()
+static FrameSubmitInfo* lastFrame = &frameMailbox.front();
+// latest image of every layer index, owned by the app thread. Each entry
+// holds a reference to its image so KEEP_PREVIOUS_IMAGE can resubmit it
+// after the frames that carried it are retired
+static FrameLayers submittedLayers;
+static std::uint64_t submissionCount = 0;
+
+/**
+ * Layers of a submitted frame kept by the frame cache, each holding a
+ * reference to its image like submittedLayers. Each layer is keyed by the
+ * pose it was rendered with, so kept layers keep their older pose
+ */
+struct CachedFrame {
+    std::uint64_t sceneVersion = 0;
+    FrameLayers layers;
+    std::int64_t bytes = 0;
+};
+
+// see setFrameCache. Application thread only, most recently used first
+static FrameCacheSettings frameCacheSettings;
+static std::deque<CachedFrame> frameCache;
+static std::int64_t frameCacheBytes = 0;
+// images of a swapchain the cache always leaves to acquire: one rendered,
+// one shown and one waiting
+static const int frameCacheFreeImages = 3;
+// submitLayer publishes a layer index's newest layer here, each with an
+// image reference and a fence of its own
+static Mailbox<FrameLayer> threadLayerMailboxes[MAX_FRAME_LAYERS];
+// newest layer taken from each mailbox, owned by reprojection, which holds
+// a reference to its image. Unused without a swapchain
+static FrameLayer threadLayers[MAX_FRAME_LAYERS];
+// every CpuSwapchain, latched with the thread layers
+static std::mutex cpuSwapchainMutex;
+static std::vector<CpuSwapchain*> cpuSwapchains;
+// thread layer index of each layer of lastFrame, or -1
+static int lastFrameThreadLayers[MAX_FRAME_LAYERS];
+// numbers the thread layers' submissions apart from submitFrame's
+static std::atomic<std::uint64_t> threadSubmissionCount{ std::uint64_t(1) << 62 };
+// reprojection publishes here, getCameraPose reads the newest state
+static Mailbox<CameraState> cameraMailbox;
+static std::mutex cameraStateMutex;
 
 // used for prediction
-static const int historySize = 10;
-static std::list<PoseInfo> poseHistory;
+static const int historySize = 16;
+// input time of each submitted frame, written by submitFrame
+static HistoryRing<double, historySize> frameHistory;
+// mouse positions, written by reprojection. Holds every cursor event, so it
+// is longer than the frame history
+static const int inputHistorySize = 64;
+static HistoryRing<InputSample, inputHistorySize> inputHistory;
+// events from the window callbacks, read by processInputEvents
+static HistoryRing<InputEvent, 256> inputEvents;
+static uint64_t inputEventsRead = 0;
+// camera pose of each refresh, written by reprojection
+static HistoryRing<PoseSample, historySize> cameraPoseHistory;
+// refreshes the camera's velocity is fitted to
+static const int poseVelocitySamples = 4;
+static std::atomic<int> posePredictor{PREDICTOR_CONSTANT_VELOCITY};
+// see setPredictionTuning
+static std::atomic<bool> predictionTuning{false};
+// scales of the extrapolated mouse movement and of held key time
+static std::atomic<double> predictionRotationGain{1.0};
+static std::atomic<double> predictionTranslationGain{1.0};
+// decaying least squares sums of actual against unscaled predicted motion,
+// dot(actual, predicted) and dot(predicted, predicted). Reprojection only
+static double rotationFitSums[2] = {};
+static double translationFitSums[2] = {};
+// weight each frame's fit and error keep of the ones before
+static const double predictionTuningDecay = 0.95;
+static const double minPredictionGain = 0.5;
+static const double maxPredictionGain = 1.5;
 
 static Pose cameraPose;
 static PoseInfo cameraPoseInfo{0};
 
-static bool cursorCaptured = false;
-static std::mutex keyTimesMutex;
-static std::unordered_map<int, double> keyTimes;
-static std::unordered_set<int> pressedKeys;
+static std::atomic<bool> cursorCaptured{false};
+// time each key was held since the last submitFrame. Only reprojection
+// writes it, atomic so keyTimeFunction can be called from any thread
+static std::atomic<double> keyTimes[KEY_COUNT];
+// bumped by submitFrame, reprojection restarts keyTimes when it changes
+static std::atomic<uint64_t> submitEpoch{0};
+static uint64_t keyTimesEpoch = 0;
+// keys held at the last refresh and the time each held key was last added
+// to keyTimes, only used by reprojection
+static std::uint8_t keysHeld[KEY_COUNT];
+static double keyHeldSince[KEY_COUNT];
+// set when a key went down since the last refresh, for the latency marker
+static bool keyPressArrived = false;
+// whether the last refresh restarted keyTimes, for input recording
+static bool keyTimesRestarted = false;
+
+// log written by startInputRecording
+static InputLogWriter inputRecording;
+static FrameCapture frameCapture;
+// added to by the refresh loop and the app thread, read by statsExporter
+static StatsCounters statsCounters;
+static StatsExporter statsExporter;
+static std::mutex statsExportMutex;
+// see setJankDetection, set before reprojection starts
+static JankDetection jankDetection;
+static BoundedQueue<JankEvent, 256> jankEvents;
+static std::atomic<std::uint64_t> droppedJankEvents{0};
+// frame and pose each presented refresh showed, written by reprojection
+static HistoryRing<PresentedRefresh, 512> presentedRefreshes;
+static std::uint64_t presentedRefreshCount = 0;
+static std::atomic<bool> recordingInput{false};
+// buffered records are written out after the swap once there are this many
+// bytes of them
+static const std::size_t recordingFlushSize = 64 * 1024;
+// log read by startInputReplay, not modified once reprojection starts
+static InputLog inputReplay;
+static bool replayingInput = false;
+// replay time minus recording time, set before the app thread starts
+static double replayTimeOffset = 0;
+// next refresh and event of the log, only used by reprojection
+static std::size_t replayRefresh = 0;
+static std::size_t replayEvent = 0;
+// next submit of the log, only used by the app thread
+static std::size_t replaySubmit = 0;
+// how long a replayed refresh waits for the app to submit the frame the
+// recording latched
+static const double replayLatchTimeout = 0.25;
+// refresh of the log being replayed, read by restartKeyTimesAfterSubmit
+static const RefreshRecord* replayedRefresh = nullptr;
 
 static GLFWkeyfun originalKeyCallback;
+static GLFWcursorposfun originalCursorPosCallback;
 static GLFWframebuffersizefun originalFramebufferSizeCallback;
+static GLFWwindowposfun originalWindowPosCallback;
+static GLFWmonitorfun originalMonitorCallback;
 
 const char* glsl_version = "#version 330";
 bool showUI = true;
 
 
-bool reprojectionToggle = true;
-bool backgroundToggle = false;
-bool parallaxToggle = false;
-bool predictionToggle = false;
-bool freezeRendering = false;
+// runtime options, read by the app thread while the overlay writes them
+static std::atomic<bool> reprojectionToggle{true};
+static std::atomic<bool> backgroundToggle{false};
+static std::atomic<bool> parallaxToggle{false};
+static std::atomic<bool> gridWarpToggle{false};
+static std::atomic<bool> predictionToggle{false};
+static std::atomic<bool> freezeRendering{false};
+static std::atomic<int> targetFPS{15};
+
+// bumped under settingsMutex after every change of the options above
+static std::uint64_t settingsVersion = 0;
+static std::mutex settingsMutex;
+static std::condition_variable settingsChanged;
+
+static std::atomic<int> reprojectionSchedule{SCHEDULE_IMMEDIATE};
+static std::atomic<double> scheduleSafetyMargin{0.002};
+// slices SCHEDULE_BEAM_RACING draws a refresh in
+static std::atomic<int> beamRacingSlices{4};
+// how long before its scanout a beam raced slice starts drawing
+static double beamRacingLead = 0;
+// whether the platform reports vblanks without a swap, see queryLastVblank,
+// which keeps the refresh fit measuring while beam racing. Without it a
+// whole refresh is swapped every beamRacingSwapInterval instead
+static bool beamRacingVblankFeedback = true;
+static double lastBeamRacingSwap = 0;
+static const double beamRacingSwapInterval = 1.0;
+static double refreshInterval = 1.0 / 60.0;
+// time glfwSwapBuffers last returned, used as an estimate of the last vblank.
+// also read by waitForNextAppFrame on the application thread
+static std::atomic<double> lastSwapTime{0};
+
+static std::atomic<bool> latencyMeasurement{false};
+static std::atomic<bool> latencyMarker{false};
+static std::mutex latencyMutex;
+static LatencyHistogram latencyHistogram{};
+
+// parallax rays march half resolution depth, see setHalfResolutionMarch
+static std::atomic<bool> halfResolutionMarch{false};
+
+static std::atomic<bool> idleDetection{true};
+// late swaps tear instead of waiting for the next vblank, see setAdaptiveVsync
+static std::atomic<bool> adaptiveVsync{false};
+static std::atomic<bool> adaptiveVsyncSupported{false};
+// see setVariableRefresh
+static std::atomic<bool> variableRefresh{false};
+static std::atomic<double> variableRefreshMinRate{40};
+// set when the window may have moved to another monitor, or monitors changed.
+// With a render thread, the event thread looks the monitor up first
+static std::atomic<bool> monitorCheckPending{false};
+static std::atomic<bool> monitorQueryPending{false};
+// refresh interval of the monitor the event thread found, 0 until known
+static std::atomic<double> monitorInterval{0};
+// size of the window's framebuffer, kept by framebufferSizeCallback, and
+// whether the viewport has yet to follow it
+static std::atomic<int> framebufferWidth{0};
+static std::atomic<int> framebufferHeight{0};
+static std::atomic<bool> viewportPending{false};
+// see setHeadless. The target stands in for the window's framebuffer
+static HeadlessOutput headless;
+static OffscreenTarget headlessTarget;
+// simulated time of the last vblank
+static double headlessVblank = 0;
+// see addOutputWindow. Only views change once reprojection has started
+static std::vector<OutputWindow> outputWindows;
+static std::mutex outputWindowsMutex;
+// refreshes still drawn after the last change, so hover highlights and other
+// overlay reactions settle before drawing stops
+static const int idleSettleRefreshes = 3;
+static int idleCountdown = idleSettleRefreshes;
+// set by the window callbacks, cleared every refresh
+static std::atomic<bool> windowEventArrived{false};
+// what the last presented refresh showed
+static Pose presentedPose;
+static glm::mat4 presentedProjection;
+// fit of the display's vblanks, fed after every swap
+static RefreshClock refreshClock;
+// copy of the fit and of the time from latching a frame to the vblank that
+// shows it, for the application thread
+static std::mutex displayTimingMutex;
+static RefreshModel displayRefresh{0, 1.0 / 60.0};
+static double displayLatchLead = 1.0 / 60.0;
+// conservative estimate of the CPU + GPU time of one reprojection refresh
+static double reprojectionCost = 0;
+static bool timerQueriesSupported = false;
+// double buffered so reading a result never waits on the GPU
+static GLuint reprojectionTimerQueries[2];
+static bool reprojectionTimerStarted[2] = {false, false};
+static int reprojectionTimerIndex = 0;
+static double reprojectionGpuTime = 0;
+// GPU timestamps of the start of each refresh's draws, double buffered with
+// the timer queries, and the GPU clock when they were issued
+static GLuint reprojectionStartQueries[2];
+static GLint64 reprojectionIssueTimes[2];
+static double reprojectionGpuDelay = 0;
+// bumped once reprojection has submitted or skipped a refresh, along with
+// the time it is expected to start drawing the next one. Read by yieldPoint
+static std::atomic<uint64_t> reprojectionSubmits{0};
+static std::atomic<double> nextReprojectionDraw{0};
+
+// quality levels the governor steps through, each one cheaper than the last
+static const ReprojectionQuality qualityLevels[] = {
+    { 48, 0, true, 1 },
+    { 24, 0, true, 1 },
+    { 24, 1, true, 1 },
+    { 24, 1, false, 1 },
+    { 24, 1, false, 2 },
+    { 16, 2, false, 4 },
+};
+static const int qualityLevelCount = sizeof(qualityLevels) / sizeof(qualityLevels[0]);
+// refreshes to wait after a change before judging it, as GPU times arrive a
+// refresh late
+static const int governorSettleRefreshes = 8;
+// quality is raised after this many refreshes under governorRaiseFraction of
+// the budget
+static const int governorRaiseRefreshes = 120;
+static const double governorRaiseFraction = 0.6;
+static std::atomic<double> reprojectionBudget{0.5};
+static int qualityLevel = 0;
+static int governorSettle = 0;
+static int governorHeadroom = 0;
+static std::uint64_t qualityChanges = 0;
+static ReprojectionQuality quality = qualityLevels[0];
+
+static std::mutex frameStatsMutex;
+static FrameStats frameStats{};
+
+// app frame timing, only touched by the application thread
+static bool appFrameStarted = false;
+static double appFrameStartTime = 0;
+static double appSwapchainWait = 0;
+// conservative estimate of the CPU + GPU time of one application frame
+static double appFrameCost = 0;
+// display time returned by the last waitForNextAppFrame and its frame period
+static double pacerDisplayTime = 0;
+static double pacerPeriod = 0;
+// start and end timestamps, double buffered like the reprojection timers.
+// these belong to the application context
+static GLuint appTimestampQueries[2][2];
+static bool appTimestampStarted[2] = {false, false};
+static int appTimestampIndex = 0;
+// GPU time of the last measured app frame and the number of passes
+// yieldPoint split it into
+static double appGpuCost = 0;
+static int appFramePasses = 1;
+static int appYieldPoints = 0;
+static double appYieldWait = 0;
+static std::uint64_t appYields = 0;
+// longest yieldPoint waits past the expected reprojection draw, in case
+// reprojection is late or stopped drawing
+static const double yieldTimeout = 0.002;
+
+// see setFramesInFlight
+static const int maxFramesInFlight = 4;
+static std::atomic<int> framesInFlight{1};
+// fences after the GPU work of submitted frames that may not be done yet,
+// oldest first. Application thread only
+static GLsync appFrameFences[maxFramesInFlight];
+static int appFrameFenceCount = 0;
+// CPU part of appFrameCost, which frames in flight overlap with the GPU
+static double appCpuCost = 0;
+// GPU time of the last app frames, and how long after its submitFrame each
+// finished on the GPU. Pushed by the application thread, read by any
+static const int appGpuHistorySize = 32;
+static HistoryRing<double, appGpuHistorySize> appGpuHistory;
+static HistoryRing<double, appGpuHistorySize> appGpuTailHistory;
+// GPU clock when each timestamp query's frame was submitted, to measure its
+// tail against
+static GLint64 appSubmitGpuClock[2];
+// see setAppGpuTimePercentile
+static std::atomic<double> appGpuPercentile{0.9};
+static double estimateAppGpuTime(const HistoryRing<double, appGpuHistorySize>& history, double fallback);
+static double appInFlightWait = 0;
+// longest waitForNextAppFrame waits for the oldest frame in flight, so a
+// lost context can't hang the app
+static const double inFlightTimeout = 1.0;
+
+/**
+ * Fixed length history of a value for ImGui::PlotLines
+ */
+struct PlotHistory {
+    static const int size = 120;
+    float values[size] = {0};
+    int offset = 0;
+
+    void push(float value) {
+        values[offset] = value;
+        offset = (offset + 1) % size;
+    }
+
+#ifndef ARP_NO_OVERLAY
+    void plot(const char* label, float scaleMax) const {
+        char overlay[32];
+        snprintf(overlay, sizeof(overlay), "%.2f ms", values[(offset + size - 1) % size]);
+        ImGui::PlotLines(label, values, size, offset, overlay, 0.f, scaleMax, ImVec2(0, 40));
+    }
+#endif
+};
 
-int targetFPS = 15;
+// in milliseconds, only touched by reprojection
+static PlotHistory reprojectionCpuPlot;
+static PlotHistory reprojectionGpuPlot;
+static PlotHistory reprojectionGpuDelayPlot;
+static PlotHistory poseEvaluationPlot;
+static PlotHistory swapPlot;
+static PlotHistory appFramePlot;
+static PlotHistory appGpuPlot;
+static PlotHistory swapchainWaitPlot;
+static std::uint64_t plottedAppFrames = 0;
+
+static std::atomic<bool> overlayEnabled{true};
+static std::atomic<double> overlayRate{30};
+// premultiplied RGBA8 image of the overlay, redrawn at most overlayRate
+// times a second after a swap and composited over the layers every refresh
+static GLuint overlayFbo = 0;
+static GLuint overlayTexture = 0;
+static int overlayWidth = 0;
+static int overlayHeight = 0;
+static double lastOverlayTime = -1;
+static bool overlayDrawn = false;
+// whether the last rebuild saw the overlay being interacted with
+static bool overlayActive = false;
+
+// the pointer from setCursorSprite, rows flipped to bottom first. Replaced
+// under cursorSpriteMutex and uploaded by the next refresh to see a new
+// version
+static std::mutex cursorSpriteMutex;
+static std::vector<unsigned char> cursorSpritePixels;
+static CursorSprite cursorSprite;
+static std::uint64_t cursorSpriteVersion = 0;
+static std::atomic<bool> cursorSpriteEnabled{false};
+static GLuint cursorTexture = 0;
+static std::uint64_t cursorTextureVersion = 0;
+static int cursorTextureWidth = 0;
+static int cursorTextureHeight = 0;
+static int cursorHotspotX = 0;
+static int cursorHotspotY = 0;
+// newest cursor position in framebuffer pixels from the top left, written
+// by the cursor callback
+static std::atomic<double> cursorPixelX{0};
+static std::atomic<double> cursorPixelY{0};
 
 
 /// Rendering variables ///
 
-static const char* vertSrc =
+/**
+ * Per-refresh constants shared by every layer, see ReprojectionUniforms:
+ * view - current camera pose view
+ * projection - this refresh's projection, with its far extended so the far
+ *              planes of translated layers fit
+ * cameraPos - current camera translation in world space
+ * foveation - center of the fovea in window pixels, then the radii in pixels
+ *             where quality starts and stops dropping, see setFoveation
+ * peripheralQuality - share of the full quality spent outside the fovea
+ * viewportRect - origin and size in pixels of the viewport being drawn
+ * lensDistortion - radial coefficients k1 and k2, then the lens center in
+ *                  the viewport's NDC, see setLensDistortion
+ * chromaticAberration - red and blue scales of the distortion, then 1 in w
+ *                       when the output is distorted at all
+ */
+#define REPROJECTION_UNIFORMS_SRC \
+    "layout(std140) uniform ReprojectionUniforms {\n" \
+    "    mat4 view;\n" \
+    "    mat4 projection;\n" \
+    "    vec3 cameraPos;\n" \
+    "    vec4 foveation;\n" \
+    "    float peripheralQuality;\n" \
+    "    vec4 viewportRect;\n" \
+    "    vec4 lensDistortion;\n" \
+    "    vec4 chromaticAberration;\n" \
+    "};\n"
+
+/**
+ * Lens distortion and chromatic aberration, drawn straight into the output
+ * by every reprojection program instead of in a pass of its own. Needs
+ * REPROJECTION_UNIFORMS_SRC.
+ *
+ * undistort maps a point of the display, in the viewport's NDC, to the
+ * point of this refresh's projection the lens shows there, scaled by a
+ * channel's scale. Programs that work per fragment call it for each
+ * channel. Programs that draw meshes move their vertices to the display
+ * with distortClip, its inverse, and shift red and blue by the display
+ * pixels between where green and the other channel show a point, through
+ * the screen space derivatives of their texture coordinates, see
+ * LENS_CHROMATIC_SAMPLE_SRC. That is exact to first order in the channel's scale,
+ * which is within a percent of 1 for real lenses.
+ */
+#define LENS_DISTORTION_SRC \
+    "#define LENS_DISTORTION_ITERATIONS 6\n" \
+    "bool lensDistorted() {\n" \
+    "    return chromaticAberration.w != 0.0;\n" \
+    "}\n" \
+    "\n" \
+    "vec2 undistort(vec2 ndc, float channelScale) {\n" \
+    "    vec2 offset = ndc - lensDistortion.zw;\n" \
+    "    vec2 radial = offset * vec2(viewportRect.z / viewportRect.w, 1.0);\n" \
+    "    float r2 = dot(radial, radial);\n" \
+    "    return lensDistortion.zw + offset * (1.0 + r2 * (lensDistortion.x + r2 * lensDistortion.y)) * channelScale;\n" \
+    "}\n" \
+    "\n" \
+    "// solves r (1 + k1 r^2 + k2 r^4) = radius with Newton's method, which\n" \
+    "// converges from above for positive coefficients\n" \
+    "vec4 distortClip(vec4 clip) {\n" \
+    "    if(!lensDistorted() || clip.w <= 0.0)\n" \
+    "        return clip;\n" \
+    "    vec2 offset = clip.xy / clip.w - lensDistortion.zw;\n" \
+    "    float radius = length(offset * vec2(viewportRect.z / viewportRect.w, 1.0));\n" \
+    "    if(radius == 0.0)\n" \
+    "        return clip;\n" \
+    "    float r = radius;\n" \
+    "    for(int i = 0; i < LENS_DISTORTION_ITERATIONS; i++) {\n" \
+    "        float r2 = r * r;\n" \
+    "        float f = r * (1.0 + r2 * (lensDistortion.x + r2 * lensDistortion.y)) - radius;\n" \
+    "        r = max(r - f / (1.0 + r2 * (3.0 * lensDistortion.x + 5.0 * r2 * lensDistortion.y)), 0.0);\n" \
+    "    }\n" \
+    "    return vec4((lensDistortion.zw + offset * (r / radius)) * clip.w, clip.zw);\n" \
+    "}\n"
+
+/**
+ * Samples the layer at layer coordinates interpolated over a mesh moved by
+ * distortClip, with red and blue shifted by the chromatic aberration. Needs
+ * LAYER_SAMPLE_SRC and LENS_DISTORTION_SRC
+ */
+#define LENS_CHROMATIC_SAMPLE_SRC \
+    "vec2 chromaticPixelOffset(float channelScale) {\n" \
+    "    vec2 ndc = (gl_FragCoord.xy - viewportRect.xy) / viewportRect.zw * 2.0 - 1.0;\n" \
+    "    return (ndc - lensDistortion.zw) * (channelScale - 1.0) * viewportRect.zw * 0.5;\n" \
+    "}\n" \
+    "\n" \
+    "vec2 chromaticCoords(vec2 coords, vec2 dx, vec2 dy, float channelScale) {\n" \
+    "    vec2 offset = chromaticPixelOffset(channelScale);\n" \
+    "    return coords + dx * offset.x + dy * offset.y;\n" \
+    "}\n" \
+    "\n" \
+    "vec4 sampleChromatic(vec2 coords) {\n" \
+    "    vec2 dx = dFdx(coords);\n" \
+    "    vec2 dy = dFdy(coords);\n" \
+    "    vec4 green = sampleLayer(coords);\n" \
+    "    if(!lensDistorted())\n" \
+    "        return green;\n" \
+    "    float red = sampleLayer(chromaticCoords(coords, dx, dy, chromaticAberration.x)).r;\n" \
+    "    float blue = sampleLayer(chromaticCoords(coords, dx, dy, chromaticAberration.y)).b;\n" \
+    "    return vec4(red, green.g, blue, green.a);\n" \
+    "}\n"
+
+/**
+ * Pixels of ALPHA_MASKED layers with alpha under half are left to the layers
+ * below. Permutation define, see layerProgram:
+ * ALPHA_MASKED - true for ALPHA_MASKED layers
+ */
+#define ALPHA_MASK_SRC \
+    "#ifndef ALPHA_MASKED\n" \
+    "#define ALPHA_MASKED false\n" \
+    "#endif\n" \
+    "bool maskedOut(vec4 texel) {\n" \
+    "    return ALPHA_MASKED && texel.a < 0.5;\n" \
+    "}\n"
+
+/**
+ * Part of a layer's image the application rendered to, see
+ * FrameLayer::viewport:
+ * layerRect - offset and scale from the layer's texture coordinates to the
+ *             image's
+ * layerClamp - image coordinates of the outermost texel centers of the part,
+ *              so filtering never reads texels outside it
+ *
+ * Layer coordinates go from 0 to 1 over the part, the depth pyramid is
+ * built from the part alone and uses them as they are.
+ */
+#define LAYER_RECT_SRC \
+    "uniform vec4 layerRect;\n" \
+    "uniform vec4 layerClamp;\n" \
+    "vec2 imageCoords(vec2 coords) {\n" \
+    "    return clamp(layerRect.xy + coords * layerRect.zw, layerClamp.xy, layerClamp.zw);\n" \
+    "}\n"
+
+/**
+ * Distance from the camera of a window space depth of the layer's pyramid:
+ * depthRange - near and far plane of the layer's projection
+ */
+#define LINEAR_DEPTH_SRC \
+    "uniform vec2 depthRange;\n" \
+    "float linearDepth(float depth) {\n" \
+    "    float z = depth * 2.0 - 1.0;\n" \
+    "    return 2.0 * depthRange.x * depthRange.y / (depthRange.y + depthRange.x - z * (depthRange.y - depthRange.x));\n" \
+    "}\n"
+
+/**
+ * Color of the layer at layer coordinates, from tex. Needs LAYER_RECT_SRC.
+ *
+ * DEPTH_AWARE_UPSAMPLING layers are rendered at a lower resolution than they
+ * are drawn at, so filtering them bilinearly blends foreground and
+ * background into halos around edges. Their permutations define
+ * DEPTH_UPSAMPLING and weight each of the four texels around the point by
+ * how close its depth, in level 0 of hizTex, is to sampleDepth, the window
+ * space depth of the surface the pixel shows. That is a joint bilateral
+ * filter guided by the full resolution depth parallax finds along each
+ * pixel's ray. Where nothing sets sampleDepth the depth of the nearest texel
+ * guides, which keeps edges as sharp as the texels and smooth surfaces
+ * filtered. Those permutations also need hizTex and LINEAR_DEPTH_SRC.
+ * sampleLayerLod samples level 0 of tex, for shaders without derivatives
+ */
+#define LAYER_SAMPLE_SRC \
+    "// depth difference, relative to the guide's distance, a texel's weight\n" \
+    "// falls off over\n" \
+    "#define UPSAMPLING_DEPTH_SIGMA 0.02\n" \
+    "// window space depth the next samples are guided by, negative for none\n" \
+    "float sampleDepth = -1.0;\n" \
+    "#ifdef DEPTH_UPSAMPLING\n" \
+    "vec4 sampleLayer(vec2 coords) {\n" \
+    "    ivec2 size = textureSize(hizTex, 0);\n" \
+    "    vec2 texel = coords * vec2(size) - 0.5;\n" \
+    "    vec2 base = floor(texel);\n" \
+    "    vec2 f = texel - base;\n" \
+    "    float guide = sampleDepth >= 0.0 ? sampleDepth\n" \
+    "        : texelFetch(hizTex, clamp(ivec2(floor(coords * vec2(size))), ivec2(0), size - 1), 0).r;\n" \
+    "    float guideDistance = linearDepth(guide);\n" \
+    "    vec4 sum = vec4(0);\n" \
+    "    float total = 0.0;\n" \
+    "    for(int i = 0; i < 4; i++) {\n" \
+    "        ivec2 offset = ivec2(i & 1, i >> 1);\n" \
+    "        ivec2 corner = clamp(ivec2(base) + offset, ivec2(0), size - 1);\n" \
+    "        vec2 bilinear = mix(1.0 - f, f, vec2(offset));\n" \
+    "        float difference = (linearDepth(texelFetch(hizTex, corner, 0).r) - guideDistance)\n" \
+    "                           / (UPSAMPLING_DEPTH_SIGMA * guideDistance);\n" \
+    "        // never quite 0, so texels all unlike the guide still filter\n" \
+    "        float weight = bilinear.x * bilinear.y * max(exp(-difference * difference), 1e-4);\n" \
+    "        sum += weight * textureLod(tex, imageCoords((vec2(corner) + 0.5) / vec2(size)), 0.0);\n" \
+    "        total += weight;\n" \
+    "    }\n" \
+    "    return sum / total;\n" \
+    "}\n" \
+    "vec4 sampleLayerLod(vec2 coords) {\n" \
+    "    return sampleLayer(coords);\n" \
+    "}\n" \
+    "#else\n" \
+    "vec4 sampleLayer(vec2 coords) {\n" \
+    "    return texture(tex, imageCoords(coords));\n" \
+    "}\n" \
+    "vec4 sampleLayerLod(vec2 coords) {\n" \
+    "    return textureLod(tex, imageCoords(coords), 0.0);\n" \
+    "}\n" \
+    "#endif\n"
+
+/**
+ * Specular term of a VIEW_DEPENDENT_RESHADING layer for this refresh's
+ * camera, added to its view independent color. Permutations that define
+ * RESHADING need:
+ * materialTex - the layer's material image, see SwapchainMaterialFormat
+ * inverseFrameViewProjection - from the layer's clip space to world space
+ * lightPositions, lightColors, lightCount - see ReshadingLight, with the
+ *                                           radius in lightColors.w
+ * Also needs LAYER_SAMPLE_SRC's sampleDepth, hizTex and
+ * REPROJECTION_UNIFORMS_SRC. Others return 0
+ */
+#define RESHADING_SRC \
+    "#ifdef RESHADING\n" \
+    "#define MAX_RESHADING_LIGHTS 8\n" \
+    "uniform sampler2D materialTex;\n" \
+    "uniform mat4 inverseFrameViewProjection;\n" \
+    "uniform vec4 lightPositions[MAX_RESHADING_LIGHTS];\n" \
+    "uniform vec4 lightColors[MAX_RESHADING_LIGHTS];\n" \
+    "uniform int lightCount;\n" \
+    "vec3 decodeMaterialNormal(vec2 encoded) {\n" \
+    "    encoded = encoded * 2.0 - 1.0;\n" \
+    "    vec3 n = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));\n" \
+    "    if(n.z < 0.0)\n" \
+    "        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);\n" \
+    "    return normalize(n);\n" \
+    "}\n" \
+    "vec3 reshade(vec2 coords) {\n" \
+    "    vec4 material = textureLod(materialTex, imageCoords(coords), 0.0);\n" \
+    "    if(material.a <= 0.0)\n" \
+    "        return vec3(0);\n" \
+    "    float depth = sampleDepth >= 0.0 ? sampleDepth : textureLod(hizTex, coords, 0.0).r;\n" \
+    "    vec4 world = inverseFrameViewProjection * vec4(vec3(coords, depth) * 2.0 - 1.0, 1);\n" \
+    "    vec3 position = world.xyz / world.w;\n" \
+    "    vec3 normal = decodeMaterialNormal(material.rg);\n" \
+    "    vec3 toCamera = normalize(cameraPos - position);\n" \
+    "    // roughness squared is the usual alpha, mapped to a Phong exponent\n" \
+    "    float alpha = max(material.b * material.b, 0.01);\n" \
+    "    float shininess = 2.0 / (alpha * alpha) - 2.0;\n" \
+    "    vec3 specular = vec3(0);\n" \
+    "    for(int i = 0; i < lightCount; i++) {\n" \
+    "        vec3 toLight = lightPositions[i].xyz - position * lightPositions[i].w;\n" \
+    "        float distanceSquared = max(dot(toLight, toLight), 1e-8);\n" \
+    "        vec3 l = toLight * inversesqrt(distanceSquared);\n" \
+    "        float falloff = lightPositions[i].w == 0.0 ? 1.0\n" \
+    "            : max(1.0 - distanceSquared / (lightColors[i].w * lightColors[i].w), 0.0);\n" \
+    "        float nl = max(dot(normal, l), 0.0);\n" \
+    "        float nh = max(dot(normal, normalize(l + toCamera)), 0.0);\n" \
+    "        specular += lightColors[i].rgb * (falloff * falloff * nl * (shininess + 8.0) / 25.13274 * pow(nh, shininess));\n" \
+    "    }\n" \
+    "    return specular * material.a;\n" \
+    "}\n" \
+    "#else\n" \
+    "vec3 reshade(vec2 coords) {\n" \
+    "    return vec3(0);\n" \
+    "}\n" \
+    "#endif\n"
+
+/**
+ * Object motion for MOTION_EXTRAPOLATION_ENABLED layers:
+ * velocityTex - motion of each pixel of the layer in layer coordinates per
+ *               second
+ * motionTime - seconds from the layer's time to the refresh, 0 when the
+ *              layer has no motion to extrapolate
+ * velocityRect, velocityClamp - LAYER_RECT_SRC's uniforms for velocityTex,
+ *                               which differ from the color's when the color
+ *                               comes from a temporal history
+ *
+ * The velocity is stored where objects were, so the pixel that moves onto
+ * coords is found by fixed point iteration from coords itself. Only
+ * permutations with MOTION_EXTRAPOLATION defined sample velocityTex.
+ */
+#define MOTION_EXTRAPOLATION_SRC \
+    "#ifdef MOTION_EXTRAPOLATION\n" \
+    "#define MOTION_ITERATIONS 3\n" \
+    "uniform sampler2D velocityTex;\n" \
+    "uniform float motionTime;\n" \
+    "uniform vec4 velocityRect;\n" \
+    "uniform vec4 velocityClamp;\n" \
+    "vec2 extrapolateMotion(vec2 coords) {\n" \
+    "    if(motionTime == 0.0)\n" \
+    "        return coords;\n" \
+    "    vec2 source = coords;\n" \
+    "    for(int i = 0; i < MOTION_ITERATIONS; i++) {\n" \
+    "        vec2 velocityCoords = clamp(velocityRect.xy + source * velocityRect.zw, velocityClamp.xy, velocityClamp.zw);\n" \
+    "        source = coords - textureLod(velocityTex, velocityCoords, 0.0).xy * motionTime;\n" \
+    "    }\n" \
+    "    return source;\n" \
+    "}\n" \
+    "#else\n" \
+    "vec2 extrapolateMotion(vec2 coords) {\n" \
+    "    return coords;\n" \
+    "}\n" \
+    "#endif\n"
+
+/**
+ * Layers only reprojected by rotation, drawn as one triangle over the
+ * viewport. Uniforms that need to be set besides ReprojectionUniforms:
+ * homography - from this refresh's NDC to the layer's coordinates,
+ *              homogeneous, see rotationHomography
+ * tex, layerRect, layerClamp, velocityTex, motionTime - see fragSrc
+ *
+ * Pixels that see past the layer's frustum, its guard band included, or
+ * behind its camera are left to the layers below. With lens distortion the
+ * point the lens shows is undistorted before it is mapped
+ */
+static const char* homographyVertSrc =
     "#version 330 core\n"
-    "layout(location = 0) in vec3 pos;\n"
-    "uniform mat4 model;\n"
-    "uniform mat4 view;\n"
-    "uniform mat4 projection;\n"
-    "out vec2 texCoords;\n"
+    "out vec2 ndc;\n"
+    "void main() {\n"
+    "    ndc = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2.0 - 1.0;\n"
+    "    gl_Position = vec4(ndc, 0, 1);\n"
+    "}\n"
+    ;
+
+static const char* homographyFragSrc =
+    "#version 330 core\n"
+    "layout(location = 0) out vec4 color;\n"
+    REPROJECTION_UNIFORMS_SRC
+    "uniform sampler2D tex;\n"
+    "uniform mat3 homography;\n"
+    "#ifdef DEPTH_UPSAMPLING\n"
+    "uniform sampler2D hizTex;\n"
+    LINEAR_DEPTH_SRC
+    "#endif\n"
+    LAYER_RECT_SRC
+    LAYER_SAMPLE_SRC
+    MOTION_EXTRAPOLATION_SRC
+    LENS_DISTORTION_SRC
+    LENS_CHROMATIC_SAMPLE_SRC
+    ALPHA_MASK_SRC
+    "in vec2 ndc;\n"
+    "void main() {\n"
+    "    vec3 mapped = homography * vec3(lensDistorted() ? undistort(ndc, 1.0) : ndc, 1);\n"
+    "    vec2 texCoords = mapped.xy / mapped.z;\n"
+    "    bool outside = mapped.z <= 0.0 || any(lessThan(texCoords, vec2(0))) || any(greaterThan(texCoords, vec2(1)));\n"
+    "    // sampled before discarding, so the derivatives stay defined\n"
+    "    color = sampleChromatic(extrapolateMotion(texCoords));\n"
+    "    if(outside || maskedOut(color))\n"
+    "        discard;\n"
+    "}\n"
+    ;
+
+/**
+ * Layers sharing an image, like those of a LayerAtlas, that would each be
+ * drawn with homographyFragSrc, drawn as one instance each. An instance is
+ * a quad over the part of the viewport its layer covers, or over all of it
+ * with lens distortion, which bends the layer's edges. Uniforms that need
+ * to be set besides ReprojectionUniforms, one element per instance:
+ * homographies - as homographyFragSrc's homography
+ * inverseHomographies - their inverses, from layer coordinates to NDC
+ * layerRects, layerClamps - as LAYER_RECT_SRC's layerRect and layerClamp
+ * tex - the shared image
+ */
+static const char* atlasVertSrc =
+    "#version 330 core\n"
+    REPROJECTION_UNIFORMS_SRC
+    LENS_DISTORTION_SRC
+    "uniform mat3 inverseHomographies[ATLAS_BATCH_SIZE];\n"
+    "flat out int layer;\n"
+    "void main() {\n"
+    "    layer = gl_InstanceID;\n"
+    "    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);\n"
+    "    if(lensDistorted()) {\n"
+    "        gl_Position = vec4(corner * 2.0 - 1.0, 0, 1);\n"
+    "        return;\n"
+    "    }\n"
+    "    // left homogeneous, so clipping keeps the part in front of the camera\n"
+    "    vec3 point = inverseHomographies[layer] * vec3(corner, 1);\n"
+    "    gl_Position = vec4(point.xy, 0, point.z);\n"
+    "}\n"
+    ;
+
+static const char* atlasFragSrc =
+    "#version 330 core\n"
+    "layout(location = 0) out vec4 color;\n"
+    REPROJECTION_UNIFORMS_SRC
+    "uniform sampler2D tex;\n"
+    "uniform mat3 homographies[ATLAS_BATCH_SIZE];\n"
+    "uniform vec4 layerRects[ATLAS_BATCH_SIZE];\n"
+    "uniform vec4 layerClamps[ATLAS_BATCH_SIZE];\n"
+    "flat in int layer;\n"
+    "vec2 imageCoords(vec2 coords) {\n"
+    "    vec4 rect = layerRects[layer];\n"
+    "    return clamp(rect.xy + coords * rect.zw, layerClamps[layer].xy, layerClamps[layer].zw);\n"
+    "}\n"
+    LAYER_SAMPLE_SRC
+    LENS_DISTORTION_SRC
+    LENS_CHROMATIC_SAMPLE_SRC
+    ALPHA_MASK_SRC
     "void main() {\n"
-    "    gl_Position = projection * view * model * vec4(pos, 1);\n"
-    "    texCoords = (pos.xy + vec2(1, 1)) * 0.5;\n"
+    "    vec2 ndc = (gl_FragCoord.xy - viewportRect.xy) / viewportRect.zw * 2.0 - 1.0;\n"
+    "    vec3 mapped = homographies[layer] * vec3(lensDistorted() ? undistort(ndc, 1.0) : ndc, 1);\n"
+    "    vec2 texCoords = mapped.xy / mapped.z;\n"
+    "    bool outside = mapped.z <= 0.0 || any(lessThan(texCoords, vec2(0))) || any(greaterThan(texCoords, vec2(1)));\n"
+    "    color = sampleChromatic(texCoords);\n"
+    "    if(outside || maskedOut(color))\n"
+    "        discard;\n"
     "}\n"
     ;
 
+/**
+ * Colors a layer drawn as a mesh from its texture coordinates, for
+ * gridWarpVertSrc:
+ * tex - color texture of last frame
+ * layerRect, layerClamp - see LAYER_RECT_SRC
+ * velocityTex, motionTime - see MOTION_EXTRAPOLATION_SRC
+ */
 static const char* fragSrc =
     "#version 330 core\n"
     "layout(location = 0) out vec4 color;\n"
     "in vec2 texCoords;\n"
+    REPROJECTION_UNIFORMS_SRC
     "uniform sampler2D tex;\n"
+    LAYER_RECT_SRC
+    LAYER_SAMPLE_SRC
+    MOTION_EXTRAPOLATION_SRC
+    LENS_DISTORTION_SRC
+    LENS_CHROMATIC_SAMPLE_SRC
+    ALPHA_MASK_SRC
     "void main() {\n"
-    "    color = texture(tex, texCoords);\n"
-    "    //color = vec4(texCoords, 0, 1);\n"
+    "    color = sampleChromatic(extrapolateMotion(texCoords));\n"
+    "    if(maskedOut(color))\n"
+    "        discard;\n"
     "}\n"
     ;
 
 /**
- * Uniforms that need to be set:
- * model - transform the radius-1 plane to last frame far plane
- * view - current camera pose view
- * projection - projection with extended far to fit plane
- * cameraPos - current camera translation in world space
- * frameView - the view matrix the last frame was rendered with
- * frameProjection - the projection matrix the last frame was rendered with
+ * Uniforms that need to be set besides ReprojectionUniforms:
+ * model - transform the radius-1 plane to the layer's far plane
+ * frameViewProjection - projection * view the layer was rendered with
+ * depthRange - near and far plane of the layer's projection
  * tex - color texture of last frame
- * depthTex - depth texture of last frame
+ * hizTex - min/max depth pyramid of last frame, see buildDepthPyramid
+ * hizLevels - number of mip levels in hizTex
+ * velocityTex, motionTime - see MOTION_EXTRAPOLATION_SRC
+ * layerRect, layerClamp - see LAYER_RECT_SRC
+ *
+ * Permutation defines, see layerProgram:
+ * FILL_DISOCCLUSIONS - true when there are layers below to show disoccluded
+ *                      pixels
+ * MAX_ITERATIONS, HIZ_MIN_LEVEL - ReprojectionQuality::parallaxIterations
+ *                                 and hizLevel
+ * HALF_RESOLUTION_MARCH - see setHalfResolutionMarch
+ * DEPTH_PEELED - true for DEPTH_PEELED layers
+ * ALPHA_MASKED - see ALPHA_MASK_SRC
  */
 static const char* parallaxVertSrc =
     "#version 330 core\n"
     "layout(location = 1) in vec3 pos;\n"
+    REPROJECTION_UNIFORMS_SRC
+    LENS_DISTORTION_SRC
     "uniform mat4 model;\n"
-    "uniform mat4 view;\n"
-    "uniform mat4 projection;\n"
-    "uniform vec3 cameraPos;\n"
     "out vec3 cameraToFrag;\n"
     "void main() {\n"
-    "    gl_Position = projection * view * model * vec4(pos, 1);\n"
+    "    gl_Position = distortClip(projection * view * model * vec4(pos, 1));\n"
     "    cameraToFrag = (model * vec4(pos, 1)).xyz - cameraPos;\n"
     "}\n"
     ;
 
+/**
+ * Ray march shared by the parallax fragment and compute shaders, see
+ * parallaxVertSrc for its uniforms. traceParallax returns false if the pixel
+ * is disoccluded and has to be left to the layers below.
+ *
+ * The ray from the camera to the far plane is projected into the last
+ * frame's window space, where it is a line, depth included. It is marched
+ * there with level 0 steps of one texel, so the step count follows how far
+ * the camera has moved since the frame was rendered. In world space the
+ * steps are densest near the camera, where the ray moves fastest across the
+ * image. A ray that stays within one texel samples it without marching.
+ *
+ * Only the part of the ray between the closest and farthest depth under it
+ * can hit anything, so the march is limited to that part. The bounds come
+ * from the pyramid level whose texels are as large as the ray's footprint.
+ * Steps grow while the ray stays in front of the closest depth of the
+ * current pyramid level and shrink when it might be behind it. A hit at
+ * level 0 is then refined with a binary search.
+ *
+ * With HALF_RESOLUTION_MARCH the steps don't change level. The ray is
+ * marched through the closest depth of pyramid level 1, half the layer's
+ * resolution, one of its texels per step, and a hit is moved onto the depth
+ * of level 0 found there with a single fetch. Half the steps read a quarter
+ * of the texels, with no branching between levels for GPUs where the
+ * hierarchical loop diverges.
+ *
+ * If the camera has moved behind the frame's camera, the ray doesn't project
+ * to a line, so it is marched in clip space with a fixed step instead.
+ *
+ * A hit far behind the surface it samples means the ray went behind a
+ * foreground edge, so the pixel shows something the last frame never saw.
+ * Those pixels are discarded when FILL_DISOCCLUSIONS is true, which leaves
+ * them to the layers below instead of smearing the foreground over them. *
+ * Those layers can be a DEPTH_PEELED layer of the same view, holding the
+ * surfaces behind the ones the ray went behind, which marches its own depth
+ * the same way. Its pixels with nothing behind are at the far plane, and
+ * peeledEmpty leaves them to the layers below it in turn.
+ */
+#define PARALLAX_TRACE_SRC \
+    "// level 0 step length as a fraction of rays marched in clip space\n" \
+    "#define HIZ_CLIP_FINE_STEPS 256.0\n" \
+    "#define HIZ_MAX_TRAVERSAL_LEVEL 4\n" \
+    "#define HIZ_REFINE_STEPS 6\n" \
+    "// how far behind the sampled surface, relative to its distance, a hit\n" \
+    "// has to be to count as disoccluded\n" \
+    "#define DISOCCLUSION_DEPTH_RATIO 0.1\n" \
+    "#ifndef FILL_DISOCCLUSIONS\n" \
+    "#define FILL_DISOCCLUSIONS false\n" \
+    "#endif\n" \
+    "#ifndef MAX_ITERATIONS\n" \
+    "#define MAX_ITERATIONS 48\n" \
+    "#endif\n" \
+    "#ifndef HIZ_MIN_LEVEL\n" \
+    "#define HIZ_MIN_LEVEL 0\n" \
+    "#endif\n" \
+    "#ifndef DEPTH_PEELED\n" \
+    "#define DEPTH_PEELED false\n" \
+    "#endif\n" \
+    "uniform mat4 frameViewProjection;\n" \
+    "uniform sampler2D hizTex;\n" \
+    "uniform int hizLevels;\n" \
+    LINEAR_DEPTH_SRC \
+    "\n" \
+    "vec4 rayStart;\n" \
+    "vec4 rayDir;\n" \
+    "// window space ends of the ray, used unless marching in clip space\n" \
+    "bool windowSpace;\n" \
+    "vec3 windowStart;\n" \
+    "vec3 windowEnd;\n" \
+    "// window space depth of the ray where the last trace ended, negative\n" \
+    "// when it stayed within one texel\n" \
+    "float hitDepth;\n" \
+    "\n" \
+    "vec3 project(float t) {\n" \
+    "    vec4 posProj = rayStart + t * rayDir;\n" \
+    "    return (posProj.xyz / posProj.w) * 0.5 + 0.5;\n" \
+    "}\n" \
+    "\n" \
+    "// point of the ray at parameter s of the current march\n" \
+    "vec3 rayPoint(float s) {\n" \
+    "    return windowSpace ? mix(windowStart, windowEnd, s) : project(s);\n" \
+    "}\n" \
+    "\n" \
+    "bool behindDepth(float s, int level) {\n" \
+    "    if(!windowSpace && rayStart.w + s * rayDir.w <= 0.0)\n" \
+    "        return false;\n" \
+    "    vec3 depthCoords = rayPoint(s);\n" \
+    "    return textureLod(hizTex, depthCoords.xy, float(level)).r < depthCoords.z;\n" \
+    "}\n" \
+    "\n" \
+    "bool disoccluded(vec3 hitCoords) {\n" \
+    "    float surface = linearDepth(textureLod(hizTex, hitCoords.xy, 0.0).r);\n" \
+    "    return linearDepth(hitCoords.z) - surface > DISOCCLUSION_DEPTH_RATIO * surface;\n" \
+    "}\n" \
+    "\n" \
+    "// closest and farthest depth in the texels of a level under a box no\n" \
+    "// larger than two of them\n" \
+    "vec2 depthBounds(vec2 lo, vec2 hi, int level) {\n" \
+    "    vec2 a = textureLod(hizTex, lo, float(level)).rg;\n" \
+    "    vec2 b = textureLod(hizTex, vec2(hi.x, lo.y), float(level)).rg;\n" \
+    "    vec2 c = textureLod(hizTex, vec2(lo.x, hi.y), float(level)).rg;\n" \
+    "    vec2 d = textureLod(hizTex, hi, float(level)).rg;\n" \
+    "    return vec2(min(min(a.x, b.x), min(c.x, d.x)), max(max(a.y, b.y), max(c.y, d.y)));\n" \
+    "}\n" \
+    "\n" \
+    "// whether a depth peeled layer has nothing behind the layer in front at\n" \
+    "// the hit, so the layers below show through\n" \
+    "bool peeledEmpty(vec2 hitCoords) {\n" \
+    "    return DEPTH_PEELED && textureLod(hizTex, hitCoords, 0.0).r >= 1.0;\n" \
+    "}\n" \
+    "\n" \
+    "// iterations a ray through a window position may take, fewer away\n" \
+    "// from the fovea\n" \
+    "int foveatedIterations(vec2 windowPos) {\n" \
+    "    float falloff = smoothstep(foveation.z, foveation.w, length(windowPos - foveation.xy));\n" \
+    "    return max(1, int(float(MAX_ITERATIONS) * mix(1.0, peripheralQuality, falloff)));\n" \
+    "}\n" \
+    "\n" \
+    "#ifdef HALF_RESOLUTION_MARCH\n" \
+    "// marches the closest depth of a level of at least half resolution one of\n" \
+    "// its texels per step, then moves a hit onto level 0's depth with one fetch\n" \
+    "bool marchHalfResolution(float sStart, float sEnd, float fineStep, int iterations, out vec2 hitCoords) {\n" \
+    "    int level = clamp(HIZ_MIN_LEVEL, 1, hizLevels - 1);\n" \
+    "    float step = exp2(float(level)) * fineStep;\n" \
+    "    float s = sStart;\n" \
+    "    for(int i = 0; i < iterations && s < sEnd; i++) {\n" \
+    "        float sNext = min(s + step, sEnd);\n" \
+    "        if(behindDepth(sNext, level)) {\n" \
+    "            float dz = windowEnd.z - windowStart.z;\n" \
+    "            float depth = textureLod(hizTex, rayPoint(sNext).xy, 0.0).r;\n" \
+    "            float sHit = dz > 0.0 ? clamp((depth - windowStart.z) / dz, s, sNext) : sNext;\n" \
+    "            vec3 coords = rayPoint(sHit);\n" \
+    "            hitCoords = coords.xy;\n" \
+    "            hitDepth = coords.z;\n" \
+    "            return !(FILL_DISOCCLUSIONS && disoccluded(coords));\n" \
+    "        }\n" \
+    "        s = sNext;\n" \
+    "    }\n" \
+    "    vec3 coords = rayPoint(s);\n" \
+    "    hitCoords = coords.xy;\n" \
+    "    hitDepth = coords.z;\n" \
+    "    return true;\n" \
+    "}\n" \
+    "#endif\n" \
+    "\n" \
+    "bool traceParallax(vec3 cameraToFrag, int iterations, out vec2 hitCoords) {\n" \
+    "    rayStart = frameViewProjection * vec4(cameraPos, 1);\n" \
+    "    rayDir = frameViewProjection * vec4(cameraToFrag, 0);\n" \
+    "    windowSpace = rayStart.w > 0.0;\n" \
+    "    windowEnd = project(1.0);\n" \
+    "    hitCoords = windowEnd.xy;\n" \
+    "    hitDepth = -1.0;\n" \
+    "\n" \
+    "    float sStart = 0.0;\n" \
+    "    float sEnd = 1.0;\n" \
+    "    float fineStep = 1.0 / HIZ_CLIP_FINE_STEPS;\n" \
+    "    if(windowSpace) {\n" \
+    "        windowStart = project(0.0);\n" \
+    "        vec2 size = vec2(textureSize(hizTex, 0));\n" \
+    "        float texels = length((windowEnd.xy - windowStart.xy) * size);\n" \
+    "        if(texels < 1.0)\n" \
+    "            return true;\n" \
+    "\n" \
+    "        // depth is linear along the line, so the bounds solve directly. Each\n" \
+    "        // gets a texel of slack for sampling at texel granularity\n" \
+    "        int boundLevel = clamp(int(ceil(log2(texels))), 0, hizLevels - 1);\n" \
+    "        vec2 lo = clamp(min(windowStart.xy, windowEnd.xy), 0.0, 1.0);\n" \
+    "        vec2 hi = clamp(max(windowStart.xy, windowEnd.xy), 0.0, 1.0);\n" \
+    "        vec2 bounds = depthBounds(lo, hi, boundLevel);\n" \
+    "        float dz = windowEnd.z - windowStart.z;\n" \
+    "        if(windowEnd.z <= bounds.x) {\n" \
+    "            hitDepth = windowEnd.z;\n" \
+    "            return true;\n" \
+    "        }\n" \
+    "        if(windowStart.z < bounds.x)\n" \
+    "            sStart = max((bounds.x - windowStart.z) / dz - 1.0 / texels, 0.0);\n" \
+    "        if(windowEnd.z > bounds.y)\n" \
+    "            sEnd = min(max((bounds.y - windowStart.z) / dz, 0.0) + 1.0 / texels, 1.0);\n" \
+    "        fineStep = 1.0 / texels;\n" \
+    "#ifdef HALF_RESOLUTION_MARCH\n" \
+    "        if(hizLevels > 1)\n" \
+    "            return marchHalfResolution(sStart, sEnd, fineStep, iterations, hitCoords);\n" \
+    "#endif\n" \
+    "    }\n" \
+    "\n" \
+    "    int maxLevel = min(HIZ_MAX_TRAVERSAL_LEVEL, hizLevels - 1);\n" \
+    "    int minLevel = min(HIZ_MIN_LEVEL, maxLevel);\n" \
+    "    int level = minLevel;\n" \
+    "    float s = sStart;\n" \
+    "    float sHit = sEnd;\n" \
+    "    bool hit = false;\n" \
+    "    for(int i = 0; i < iterations; i++) {\n" \
+    "        float sNext = min(s + exp2(float(level)) * fineStep, sEnd);\n" \
+    "        if(behindDepth(sNext, level)) {\n" \
+    "            if(level == minLevel) {\n" \
+    "                sHit = sNext;\n" \
+    "                hit = true;\n" \
+    "                break;\n" \
+    "            }\n" \
+    "            level--;\n" \
+    "        }\n" \
+    "        else {\n" \
+    "            s = sNext;\n" \
+    "            if(s >= sEnd)\n" \
+    "                break;\n" \
+    "            level = min(level + 1, maxLevel);\n" \
+    "        }\n" \
+    "    }\n" \
+    "\n" \
+    "    if(hit) {\n" \
+    "        for(int i = 0; i < HIZ_REFINE_STEPS; i++) {\n" \
+    "            float mid = 0.5 * (s + sHit);\n" \
+    "            if(behindDepth(mid, minLevel))\n" \
+    "                sHit = mid;\n" \
+    "            else\n" \
+    "                s = mid;\n" \
+    "        }\n" \
+    "    }\n" \
+    "    else {\n" \
+    "        sHit = s;\n" \
+    "    }\n" \
+    "\n" \
+    "    vec3 coords = rayPoint(sHit);\n" \
+    "    hitCoords = coords.xy;\n" \
+    "    hitDepth = coords.z;\n" \
+    "    return !(hit && FILL_DISOCCLUSIONS && disoccluded(coords));\n" \
+    "}\n"
+
 static const char* parallaxFragSrc =
     "#version 330 core\n"
-    "\n"
-    "#define MAX_PARALLAX_ITERATIONS 64\n"
     "layout(location = 0) out vec4 color;\n"
+    REPROJECTION_UNIFORMS_SRC
     "uniform sampler2D tex;\n"
-    "uniform sampler2D depthTex;\n"
-    "uniform mat4 frameView;\n"
-    "uniform mat4 frameProjection;\n"
-    "uniform vec3 cameraPos;\n"
+    PARALLAX_TRACE_SRC
+    LAYER_RECT_SRC
+    LAYER_SAMPLE_SRC
+    RESHADING_SRC
+    MOTION_EXTRAPOLATION_SRC
+    LENS_DISTORTION_SRC
+    LENS_CHROMATIC_SAMPLE_SRC
+    ALPHA_MASK_SRC
     "in vec3 cameraToFrag;\n"
     "\n"
-    "bool insideDepthMap(vec3 pos) {\n"
-    "    vec4 posProj = frameProjection * frameView * vec4(pos, 1);\n"
-    "    vec3 depthCoords = posProj.xyz / posProj.w;\n"
-    "    depthCoords = depthCoords * 0.5 + 0.5;\n"
-    "    return texture(depthTex, depthCoords.xy).r < depthCoords.z;\n"
+    "void main() {\n"
+    "    vec2 hitCoords;\n"
+    "    bool traced = traceParallax(cameraToFrag, foveatedIterations(gl_FragCoord.xy), hitCoords)\n"
+    "                  && !peeledEmpty(hitCoords);\n"
+    "    sampleDepth = hitDepth;\n"
+    "    vec2 coords = extrapolateMotion(hitCoords);\n"
+    "    // the derivatives are taken before any fragment of the quad discards\n"
+    "    vec4 texel = sampleChromatic(coords);\n"
+    "    if(!traced || maskedOut(texel))\n"
+    "        discard;\n"
+    "    color = vec4(texel.rgb + reshade(coords), texel.a);\n"
+    "}"
+    ;
+
+/**
+ * Compute version of the parallax pass for GL 4.3, writing each pixel of the
+ * viewport to the reprojected image, with alpha 0 where nothing was drawn.
+ * Uniforms that need to be set besides those of parallaxVertSrc:
+ * reprojected - rgba16f image the size of the viewport
+ * inverseViewProjection - inverse of this refresh's projection * view
+ * farPlane - normal and distance of the layer's far plane, the end of rays
+ * viewport - the viewport the image covers
+ *
+ * Neighboring rays cross nearly the same texels of the layer, so each tile
+ * of pixels loads the depth its rays cross into shared memory once. Nothing
+ * in front of the tile's closest depth or behind its farthest can be hit, so
+ * rays are only marched between the two, one step per texel. Tiles whose
+ * rays cross more than fits in shared memory march the pyramid like the
+ * fragment shader.
+ */
+static const char* parallaxComputeSrc =
+    "#version 430 core\n"
+    "#define TILE_SIZE 8\n"
+    "#define FOOTPRINT_SIZE 40\n"
+    "#define TILE_MAX_STEPS 64\n"
+    "layout(local_size_x = TILE_SIZE, local_size_y = TILE_SIZE) in;\n"
+    REPROJECTION_UNIFORMS_SRC
+    "uniform sampler2D tex;\n"
+    PARALLAX_TRACE_SRC
+    LAYER_RECT_SRC
+    LAYER_SAMPLE_SRC
+    RESHADING_SRC
+    MOTION_EXTRAPOLATION_SRC
+    ALPHA_MASK_SRC
+    "layout(rgba16f) uniform writeonly image2D reprojected;\n"
+    "uniform mat4 inverseViewProjection;\n"
+    "uniform vec4 farPlane;\n"
+    "uniform ivec4 viewport;\n"
+    "\n"
+    "shared uint footprintMinX;\n"
+    "shared uint footprintMinY;\n"
+    "shared uint footprintMaxX;\n"
+    "shared uint footprintMaxY;\n"
+    "shared uint footprintUnbounded;\n"
+    "// depths are positive, so their bits order like the floats\n"
+    "shared uint tileMinDepth;\n"
+    "shared uint tileMaxDepth;\n"
+    "shared float footprint[FOOTPRINT_SIZE * FOOTPRINT_SIZE];\n"
+    "\n"
+    "ivec2 footprintOrigin;\n"
+    "\n"
+    "bool behindFootprint(vec3 depthCoords) {\n"
+    "    ivec2 size = textureSize(hizTex, 0);\n"
+    "    ivec2 texel = clamp(ivec2(depthCoords.xy * vec2(size)), ivec2(0), size - 1) - footprintOrigin;\n"
+    "    return footprint[texel.y * FOOTPRINT_SIZE + texel.x] < depthCoords.z;\n"
+    "}\n"
+    "\n"
+    "// where the ray reaches a window space depth, with z(0) < depth\n"
+    "float rayDepthTime(float depth) {\n"
+    "    float z = depth * 2.0 - 1.0;\n"
+    "    return (z * rayStart.w - rayStart.z) / (rayDir.z - z * rayDir.w);\n"
+    "}\n"
+    "\n"
+    "// the projected ray is a line in window space, depth included, so it is\n"
+    "// marched there one texel at a time\n"
+    "bool traceFootprint(int iterations, out vec2 hitCoords) {\n"
+    "    float minDepth = uintBitsToFloat(tileMinDepth);\n"
+    "    float maxDepth = uintBitsToFloat(tileMaxDepth);\n"
+    "    vec3 start = project(0.0);\n"
+    "    vec3 end = project(1.0);\n"
+    "    hitCoords = end.xy;\n"
+    "    hitDepth = end.z;\n"
+    "    if(end.z <= minDepth)\n"
+    "        return true;\n"
+    "\n"
+    "    // the ray's depth only grows along it, as w stays positive. Both\n"
+    "    // bounds get a texel of slack for the precision of the solve\n"
+    "    float tStart = start.z < minDepth ? clamp(rayDepthTime(minDepth), 0.0, 1.0) : 0.0;\n"
+    "    float tEnd = end.z > maxDepth ? clamp(rayDepthTime(maxDepth), tStart, 1.0) : 1.0;\n"
+    "    vec2 size = vec2(textureSize(hizTex, 0));\n"
+    "    float texels = max(length((end.xy - start.xy) * size), 1.0);\n"
+    "    float sStart = max(length((project(tStart).xy - start.xy) * size) - 1.0, 0.0) / texels;\n"
+    "    float sEnd = min((length((project(tEnd).xy - start.xy) * size) + 1.0) / texels, 1.0);\n"
+    "    int steps = clamp(int(ceil((sEnd - sStart) * texels)), 1, min(TILE_MAX_STEPS, iterations));\n"
+    "    float sStep = (sEnd - sStart) / float(steps);\n"
+    "\n"
+    "    float s = sStart;\n"
+    "    for(int i = 0; i < steps; i++) {\n"
+    "        float sNext = s + sStep;\n"
+    "        if(behindFootprint(mix(start, end, sNext))) {\n"
+    "            for(int j = 0; j < HIZ_REFINE_STEPS; j++) {\n"
+    "                float mid = 0.5 * (s + sNext);\n"
+    "                if(behindFootprint(mix(start, end, mid)))\n"
+    "                    sNext = mid;\n"
+    "                else\n"
+    "                    s = mid;\n"
+    "            }\n"
+    "            vec3 coords = mix(start, end, sNext);\n"
+    "            hitCoords = coords.xy;\n"
+    "            hitDepth = coords.z;\n"
+    "            return !(FILL_DISOCCLUSIONS && disoccluded(coords));\n"
+    "        }\n"
+    "        s = sNext;\n"
+    "    }\n"
+    "    return true;\n"
     "}\n"
-    "    \n"
+    "\n"
     "void main() {\n"
-    "    vec3 pos = cameraPos;\n"
-    "    for(int i = 0; i < MAX_PARALLAX_ITERATIONS; i++) {\n"
-    "        pos = cameraPos + ((float(i) + 1.0) / MAX_PARALLAX_ITERATIONS) * cameraToFrag;\n"
-    "        if(insideDepthMap(pos))\n"
-    "            break;\n"
+    "    ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);\n"
+    "    if(gl_LocalInvocationIndex == 0u) {\n"
+    "        footprintMinX = 0xFFFFFFFFu;\n"
+    "        footprintMinY = 0xFFFFFFFFu;\n"
+    "        footprintMaxX = 0u;\n"
+    "        footprintMaxY = 0u;\n"
+    "        footprintUnbounded = 0u;\n"
+    "        tileMinDepth = floatBitsToUint(1.0);\n"
+    "        tileMaxDepth = 0u;\n"
     "    }\n"
+    "    barrier();\n"
     "\n"
-    "    //color = vec4(1 - length(pos - cameraPos) / length(cameraToFrag), 0, 0, 1);\n"
-    "    vec4 posProj = frameProjection * frameView * vec4(pos, 1);\n"
-    "    vec2 texCoords = (posProj.xy / posProj.w) * 0.5 + 0.5;\n"
-    "    color = texture(tex, texCoords);\n"
-    "}"
+    "    // this refresh's ray through the pixel, ending on the layer's far\n"
+    "    // plane like the rays of the fragment shader's quad\n"
+    "    vec2 ndc = (vec2(pixel) + 0.5) / vec2(viewport.zw) * 2.0 - 1.0;\n"
+    "    vec4 world = inverseViewProjection * vec4(ndc, 1, 1);\n"
+    "    vec3 direction = world.xyz / world.w - cameraPos;\n"
+    "    float facing = dot(direction, farPlane.xyz);\n"
+    "    vec3 cameraToFrag = direction * (farPlane.w - dot(cameraPos, farPlane.xyz)) / facing;\n"
+    "    rayStart = frameViewProjection * vec4(cameraPos, 1);\n"
+    "    rayDir = frameViewProjection * vec4(cameraToFrag, 0);\n"
+    "    vec3 end = project(1.0);\n"
+    "    bool covered = all(lessThan(pixel, viewport.zw)) && facing > 0.0 && dot(cameraToFrag, direction) > 0.0\n"
+    "                   && all(greaterThanEqual(end.xy, vec2(0))) && all(lessThanEqual(end.xy, vec2(1)));\n"
+    "\n"
+    "    ivec2 size = textureSize(hizTex, 0);\n"
+    "    if(covered) {\n"
+    "        if(rayStart.w <= 0.0) {\n"
+    "            atomicOr(footprintUnbounded, 1u);\n"
+    "        }\n"
+    "        else {\n"
+    "            vec2 a = project(0.0).xy * vec2(size);\n"
+    "            vec2 b = end.xy * vec2(size);\n"
+    "            uvec2 lo = uvec2(clamp(min(a, b), vec2(0), vec2(size - 1)));\n"
+    "            uvec2 hi = uvec2(clamp(max(a, b), vec2(0), vec2(size - 1)));\n"
+    "            atomicMin(footprintMinX, lo.x);\n"
+    "            atomicMin(footprintMinY, lo.y);\n"
+    "            atomicMax(footprintMaxX, hi.x);\n"
+    "            atomicMax(footprintMaxY, hi.y);\n"
+    "        }\n"
+    "    }\n"
+    "    barrier();\n"
+    "\n"
+    "    bool fits = footprintUnbounded == 0u && footprintMinX <= footprintMaxX\n"
+    "                && footprintMaxX - footprintMinX < uint(FOOTPRINT_SIZE)\n"
+    "                && footprintMaxY - footprintMinY < uint(FOOTPRINT_SIZE);\n"
+    "    footprintOrigin = ivec2(footprintMinX, footprintMinY);\n"
+    "    if(fits) {\n"
+    "        for(uint i = gl_LocalInvocationIndex; i < uint(FOOTPRINT_SIZE * FOOTPRINT_SIZE); i += uint(TILE_SIZE * TILE_SIZE)) {\n"
+    "            ivec2 offset = ivec2(i % uint(FOOTPRINT_SIZE), i / uint(FOOTPRINT_SIZE));\n"
+    "            float depth = texelFetch(hizTex, min(footprintOrigin + offset, size - 1), 0).r;\n"
+    "            footprint[i] = depth;\n"
+    "            atomicMin(tileMinDepth, floatBitsToUint(depth));\n"
+    "            atomicMax(tileMaxDepth, floatBitsToUint(depth));\n"
+    "        }\n"
+    "    }\n"
+    "    barrier();\n"
+    "\n"
+    "    if(!all(lessThan(pixel, viewport.zw)))\n"
+    "        return;\n"
+    "    vec4 result = vec4(0);\n"
+    "    vec2 hitCoords;\n"
+    "    int iterations = foveatedIterations(vec2(viewport.xy + pixel) + 0.5);\n"
+    "    if(covered && (fits ? traceFootprint(iterations, hitCoords) : traceParallax(cameraToFrag, iterations, hitCoords))\n"
+    "       && !peeledEmpty(hitCoords)) {\n"
+    "        sampleDepth = hitDepth;\n"
+    "        vec2 coords = extrapolateMotion(hitCoords);\n"
+    "        vec4 texel = sampleLayerLod(coords);\n"
+    "        if(!maskedOut(texel))\n"
+    "            result = vec4(texel.rgb + reshade(coords), 1);\n"
+    "    }\n"
+    "    imageStore(reprojected, pixel, result);\n"
+    "}\n"
     ;
 
-GLuint defaultProgram;
-GLuint parallaxProgram;
-glm::mat4 projection;
-
-Swapchain::Swapchain(int width, int height, int numImages)
-  : width(width),
-    height(height),
-    numImages(numImages),
-    index(0),
-    acquiredStatus(numImages),
-    fbos(numImages),
-    images(numImages),
-    depthImages(numImages)
-{
-    if(!initialized) {
-        std::cout << "Error: Attempting to create swapchain before initialization!" << std::endl;
-        return;
-    }
-
-    for(int i = 0; i < numImages; i++) {
-        acquiredStatus[i] = 0;
-    }
+/**
+ * Uniforms that need to be set:
+ * tileCount - columns and rows of a SPARSE_TILES layer's tiles, 0 to draw
+ *             the fullscreen triangle instead
+ * tileSize - size of a tile as a fraction of the viewport
+ * tiles - the layer's LayerTiles texture
+ *
+ * Tiles are drawn as instances of a quad. Empty ones collapse to a point,
+ * which rasterizes nothing
+ */
+static const char* copyVertSrc =
+    "#version 330 core\n"
+    "uniform ivec2 tileCount;\n"
+    "uniform vec2 tileSize;\n"
+    "uniform sampler2D tiles;\n"
+    "void main() {\n"
+    "    if(tileCount.x == 0) {\n"
+    "        vec2 pos = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);\n"
+    "        gl_Position = vec4(pos * 2.0 - 1.0, 0, 1);\n"
+    "        return;\n"
+    "    }\n"
+    "    ivec2 tile = ivec2(gl_InstanceID % tileCount.x, gl_InstanceID / tileCount.x);\n"
+    "    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);\n"
+    "    vec2 pos = min((vec2(tile) + corner) * tileSize, vec2(1));\n"
+    "    if(texelFetch(tiles, tile, 0).r == 0.0)\n"
+    "        pos = vec2(0);\n"
+    "    gl_Position = vec4(pos * 2.0 - 1.0, 0, 1);\n"
+    "}\n"
+    ;
 
-    glGenTextures(numImages, images.data());
-    for(int i = 0; i < numImages; i++) {
-        glBindTexture(GL_TEXTURE_2D, images[i]);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    }
+/**
+ * Shows a layer that needs no reprojection, see layerPassesThrough.
+ * Uniforms that need to be set:
+ * tex - color texture of the layer
+ * viewport - origin and size of the viewport the layer covers
+ * layerRect, layerClamp - see LAYER_RECT_SRC
+ * distort - whether to apply the lens distortion, which the overlay isn't
+ * alphaMasked - whether the layer is ALPHA_MASKED
+ */
+static const char* copyFragSrc =
+    "#version 330 core\n"
+    "layout(location = 0) out vec4 color;\n"
+    REPROJECTION_UNIFORMS_SRC
+    "uniform sampler2D tex;\n"
+    "uniform vec4 viewport;\n"
+    "uniform bool distort;\n"
+    "uniform bool alphaMasked;\n"
+    "#define ALPHA_MASKED alphaMasked\n"
+    LAYER_RECT_SRC
+    LENS_DISTORTION_SRC
+    ALPHA_MASK_SRC
+    "void main() {\n"
+    "    vec2 coords = (gl_FragCoord.xy - viewport.xy) / viewport.zw;\n"
+    "    if(!distort || !lensDistorted()) {\n"
+    "        color = texture(tex, imageCoords(coords));\n"
+    "    }\n"
+    "    else {\n"
+    "        vec2 ndc = coords * 2.0 - 1.0;\n"
+    "        color = texture(tex, imageCoords(undistort(ndc, 1.0) * 0.5 + 0.5));\n"
+    "        color.r = texture(tex, imageCoords(undistort(ndc, chromaticAberration.x) * 0.5 + 0.5)).r;\n"
+    "        color.b = texture(tex, imageCoords(undistort(ndc, chromaticAberration.y) * 0.5 + 0.5)).b;\n"
+    "    }\n"
+    "    if(maskedOut(color))\n"
+    "        discard;\n"
+    "}\n"
+    ;
 
-    glGenTextures(numImages, depthImages.data());
-    for(int i = 0; i < numImages; i++) {
-        glBindTexture(GL_TEXTURE_2D, depthImages[i]);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    }
+/**
+ * Writes 1 for each tile of a SPARSE_TILES layer with any pixel that isn't
+ * masked out, 0 for empty ones. Uniforms that need to be set:
+ * tex - color texture of the layer
+ * viewport - the layer's viewport in tex
+ * tileSize - LAYER_TILE_SIZE
+ *
+ * The texels just past a tile's edges are looked at too, as filtering
+ * blends them into the tile's pixels
+ */
+static const char* tileClassifyFragSrc =
+    "#version 330 core\n"
+    "layout(location = 0) out float covered;\n"
+    "uniform sampler2D tex;\n"
+    "uniform ivec4 viewport;\n"
+    "uniform int tileSize;\n"
+    "void main() {\n"
+    "    ivec2 tile = ivec2(gl_FragCoord.xy);\n"
+    "    ivec2 begin = max(tile * tileSize - 1, ivec2(0));\n"
+    "    ivec2 end = min(tile * tileSize + tileSize + 1, viewport.zw);\n"
+    "    covered = 0.0;\n"
+    "    for(int y = begin.y; y < end.y; y++) {\n"
+    "        for(int x = begin.x; x < end.x; x++) {\n"
+    "            if(texelFetch(tex, viewport.xy + ivec2(x, y), 0).a >= 0.5) {\n"
+    "                covered = 1.0;\n"
+    "                return;\n"
+    "            }\n"
+    "        }\n"
+    "    }\n"
+    "}\n"
+    ;
 
-    GLuint originalFramebuffer;
-    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, (GLint*)&originalFramebuffer);
+/**
+ * Uniforms that need to be set:
+ * reprojected - image written by parallaxComputeSrc
+ * viewportOrigin - corner of the viewport the image covers
+ *
+ * The compute pass reprojects the undistorted image, so with lens
+ * distortion each channel is filtered from where the lens shows it. Empty
+ * texels have a color of 0, so dividing by the filtered alpha keeps the
+ * edges of what was drawn from darkening
+ */
+static const char* parallaxCompositeFragSrc =
+    "#version 330 core\n"
+    "layout(location = 0) out vec4 color;\n"
+    REPROJECTION_UNIFORMS_SRC
+    "uniform sampler2D reprojected;\n"
+    "uniform ivec2 viewportOrigin;\n"
+    LENS_DISTORTION_SRC
+    "vec4 sampleReprojected(vec2 ndc) {\n"
+    "    vec4 texel = textureLod(reprojected, ndc * 0.5 + 0.5, 0.0);\n"
+    "    return texel.a == 0.0 ? texel : vec4(texel.rgb / texel.a, texel.a);\n"
+    "}\n"
+    "void main() {\n"
+    "    if(!lensDistorted()) {\n"
+    "        vec4 texel = texelFetch(reprojected, ivec2(gl_FragCoord.xy) - viewportOrigin, 0);\n"
+    "        if(texel.a == 0.0)\n"
+    "            discard;\n"
+    "        color = texel;\n"
+    "        return;\n"
+    "    }\n"
+    "    vec2 ndc = (gl_FragCoord.xy - viewportRect.xy) / viewportRect.zw * 2.0 - 1.0;\n"
+    "    vec4 green = sampleReprojected(undistort(ndc, 1.0));\n"
+    "    if(green.a == 0.0)\n"
+    "        discard;\n"
+    "    color = vec4(sampleReprojected(undistort(ndc, chromaticAberration.x)).r, green.g,\n"
+    "                 sampleReprojected(undistort(ndc, chromaticAberration.y)).b, 1);\n"
+    "}\n"
+    ;
 
-    glGenFramebuffers(numImages, fbos.data());
-    for(int i = 0; i < numImages; i++)  {
-        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbos[i]);
-        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, images[i], 0);
-        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthImages[i], 0);
-        if(glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-            std::cout << "Creating swapchain: Framebuffer incomplete! ";
-            std::cout << glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) << std::endl;
-        }
-    }
+/**
+ * Voxel cache, see setVoxelCache: an open addressing hash table of world
+ * space voxels in a shader storage buffer. A voxel goes in the first of
+ * VOXEL_PROBES slots from its hash that is empty, holds it already or
+ * wasn't seen for maxAge frames. Slots are claimed by swapping in the key,
+ * different voxels with the same key share a slot. Uniforms:
+ * voxelSize - edge length of a voxel
+ * submission - number of the newest submitted frame
+ * maxAge - frames a voxel lasts without being seen
+ */
+#define VOXEL_CACHE_SRC \
+    "#define VOXEL_PROBES 8\n" \
+    "struct Voxel {\n" \
+    "    // 0 for empty slots\n" \
+    "    uint key;\n" \
+    "    uint color;\n" \
+    "    uint submission;\n" \
+    "    uint padding;\n" \
+    "    ivec4 coords;\n" \
+    "};\n" \
+    "layout(std430, binding = 0) buffer VoxelCache {\n" \
+    "    Voxel voxels[];\n" \
+    "};\n" \
+    "uniform float voxelSize;\n" \
+    "uniform uint submission;\n" \
+    "uniform uint maxAge;\n" \
+    "\n" \
+    "uint voxelKey(ivec3 coords) {\n" \
+    "    uvec3 u = uvec3(coords);\n" \
+    "    uint h = (u.x * 73856093u) ^ (u.y * 19349663u) ^ (u.z * 83492791u);\n" \
+    "    h ^= h >> 16;\n" \
+    "    h *= 0x7feb352du;\n" \
+    "    h ^= h >> 15;\n" \
+    "    return max(h, 1u);\n" \
+    "}\n" \
+    "\n" \
+    "bool voxelExpired(uint slot) {\n" \
+    "    return submission - voxels[slot].submission > maxAge;\n" \
+    "}\n"
 
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, originalFramebuffer);
-}
+/**
+ * Inserts every strideth pixel of a submitted layer into the voxel cache.
+ * Uniforms that need to be set besides VOXEL_CACHE_SRC's:
+ * tex - color texture of the layer
+ * hizTex - depth pyramid of the layer, see buildDepthPyramid
+ * layerRect, layerClamp - see LAYER_RECT_SRC
+ * inverseViewProjection - inverse of the layer's projection * view
+ * stride - pixels between the inserted ones
+ */
+static const char* voxelInsertSrc =
+    "#version 430 core\n"
+    "layout(local_size_x = 8, local_size_y = 8) in;\n"
+    VOXEL_CACHE_SRC
+    "uniform sampler2D tex;\n"
+    "uniform sampler2D hizTex;\n"
+    LAYER_RECT_SRC
+    "uniform mat4 inverseViewProjection;\n"
+    "uniform int stride;\n"
+    "\n"
+    "void main() {\n"
+    "    ivec2 size = textureSize(hizTex, 0);\n"
+    "    ivec2 texel = ivec2(gl_GlobalInvocationID.xy) * stride;\n"
+    "    if(any(greaterThanEqual(texel, size)))\n"
+    "        return;\n"
+    "    float depth = texelFetch(hizTex, texel, 0).r;\n"
+    "    // nothing was drawn there\n"
+    "    if(depth >= 1.0)\n"
+    "        return;\n"
+    "    vec2 coords = (vec2(texel) + 0.5) / vec2(size);\n"
+    "    vec4 world = inverseViewProjection * vec4(vec3(coords, depth) * 2.0 - 1.0, 1);\n"
+    "    ivec3 voxel = ivec3(floor(world.xyz / (world.w * voxelSize)));\n"
+    "    uint color = packUnorm4x8(vec4(textureLod(tex, imageCoords(coords), 0.0).rgb, 1));\n"
+    "    uint key = voxelKey(voxel);\n"
+    "    uint capacity = uint(voxels.length());\n"
+    "    for(int i = 0; i < VOXEL_PROBES; i++) {\n"
+    "        uint slot = (key + uint(i)) % capacity;\n"
+    "        uint old = voxels[slot].key;\n"
+    "        if(old != key) {\n"
+    "            if(old != 0u && !voxelExpired(slot))\n"
+    "                continue;\n"
+    "            if(atomicCompSwap(voxels[slot].key, old, key) != old)\n"
+    "                continue;\n"
+    "        }\n"
+    "        voxels[slot].color = color;\n"
+    "        voxels[slot].submission = submission;\n"
+    "        voxels[slot].coords = ivec4(voxel, 0);\n"
+    "        return;\n"
+    "    }\n"
+    "}\n"
+    ;
 
-Swapchain::~Swapchain() {
-    glDeleteTextures(numImages, images.data());
-    glDeleteTextures(numImages, depthImages.data());
-    glDeleteFramebuffers(numImages, fbos.data());
-}
+/**
+ * Splats the voxel cache into the viewport sized reprojected image the
+ * parallax composite draws, in three passes picked by splatPass:
+ * 0 - one invocation per pixel clears the image and splatDepth
+ * 1 - one per slot keeps the nearest voxel distance of each pixel its
+ *     splat covers in splatDepth
+ * 2 - one per slot writes its color where it was the nearest
+ * Uniforms that need to be set besides VOXEL_CACHE_SRC's:
+ * viewProjection - this refresh's projection * view
+ * size - size of the viewport
+ * pixelScale - pixels covered by a unit at distance 1
+ *
+ * A splat covers the voxel's square on screen, capped at MAX_SPLAT_RADIUS
+ * pixels from its center, so voxels close up leave gaps between them.
+ */
+static const char* voxelSplatSrc =
+    "#version 430 core\n"
+    "#define MAX_SPLAT_RADIUS 4\n"
+    "layout(local_size_x = 64) in;\n"
+    VOXEL_CACHE_SRC
+    "layout(binding = 1, r32ui) uniform uimage2D splatDepth;\n"
+    "layout(binding = 0, rgba16f) uniform writeonly image2D reprojected;\n"
+    "uniform int splatPass;\n"
+    "uniform mat4 viewProjection;\n"
+    "uniform ivec2 size;\n"
+    "uniform float pixelScale;\n"
+    "\n"
+    "void main() {\n"
+    "    // dispatched as rows of groups, see dispatchLinear\n"
+    "    uint index = gl_GlobalInvocationID.x + gl_GlobalInvocationID.y * gl_NumWorkGroups.x * 64u;\n"
+    "    if(splatPass == 0) {\n"
+    "        if(index >= uint(size.x * size.y))\n"
+    "            return;\n"
+    "        ivec2 pixel = ivec2(index % uint(size.x), index / uint(size.x));\n"
+    "        imageStore(splatDepth, pixel, uvec4(0xFFFFFFFFu));\n"
+    "        imageStore(reprojected, pixel, vec4(0));\n"
+    "        return;\n"
+    "    }\n"
+    "    if(index >= uint(voxels.length()) || voxels[index].key == 0u || voxelExpired(index))\n"
+    "        return;\n"
+    "    vec3 center = (vec3(voxels[index].coords.xyz) + 0.5) * voxelSize;\n"
+    "    vec4 clip = viewProjection * vec4(center, 1);\n"
+    "    if(clip.w <= 0.0)\n"
+    "        return;\n"
+    "    ivec2 pixel = ivec2(floor((clip.xy / clip.w * 0.5 + 0.5) * vec2(size)));\n"
+    "    int radius = min(int(0.5 * voxelSize * pixelScale / clip.w), MAX_SPLAT_RADIUS);\n"
+    "    ivec2 lo = max(pixel - radius, ivec2(0));\n"
+    "    ivec2 hi = min(pixel + radius, size - 1);\n"
+    "    // distances are positive, so their bits order like the floats\n"
+    "    uint depth = floatBitsToUint(clip.w);\n"
+    "    vec4 color = vec4(unpackUnorm4x8(voxels[index].color).rgb, 1);\n"
+    "    for(int y = lo.y; y <= hi.y; y++) {\n"
+    "        for(int x = lo.x; x <= hi.x; x++) {\n"
+    "            if(splatPass == 1)\n"
+    "                imageAtomicMin(splatDepth, ivec2(x, y), depth);\n"
+    "            else if(imageLoad(splatDepth, ivec2(x, y)).r == depth)\n"
+    "                imageStore(reprojected, ivec2(x, y), color);\n"
+    "        }\n"
+    "    }\n"
+    "}\n"
+    ;
 
-void Swapchain::createTextures() {
+/**
+ * Traces the camera ray of each fragment through the BVH of
+ * setSceneGeometry, see flattenSceneBvh for the buffers, and shades the
+ * nearest triangle hit with its albedo facing the camera. Misses are
+ * discarded, so the stencil keeps them for the layers below. Uniforms that
+ * need to be set besides ReprojectionUniforms:
+ * inverseViewProjection - inverse of this refresh's projection * view
+ */
+static const char* sceneTraceFragSrc =
+    "#version 430 core\n"
+    "#define STACK_SIZE 64\n"
+    "layout(location = 0) out vec4 color;\n"
+    REPROJECTION_UNIFORMS_SRC
+    "struct SceneNode {\n"
+    "    vec3 lo;\n"
+    "    // first of two consecutive children, or first triangle of a leaf\n"
+    "    uint first;\n"
+    "    vec3 hi;\n"
+    "    // triangles of a leaf, 0 for inner nodes\n"
+    "    uint count;\n"
+    "};\n"
+    "struct SceneTriangle {\n"
+    "    vec3 a;\n"
+    "    uint albedo;\n"
+    "    vec3 ab;\n"
+    "    float padding0;\n"
+    "    vec3 ac;\n"
+    "    float padding1;\n"
+    "};\n"
+    "layout(std430, binding = 0) readonly buffer SceneNodes {\n"
+    "    SceneNode nodes[];\n"
+    "};\n"
+    "layout(std430, binding = 1) readonly buffer SceneTriangles {\n"
+    "    SceneTriangle triangles[];\n"
+    "};\n"
+    "uniform mat4 inverseViewProjection;\n"
+    LENS_DISTORTION_SRC
+    "\n"
+    "// distance the ray enters the box at, -1 if it misses it before nearest\n"
+    "float boxDistance(uint node, vec3 invDir, float nearest) {\n"
+    "    vec3 t0 = (nodes[node].lo - cameraPos) * invDir;\n"
+    "    vec3 t1 = (nodes[node].hi - cameraPos) * invDir;\n"
+    "    vec3 near = min(t0, t1);\n"
+    "    vec3 far = max(t0, t1);\n"
+    "    float enter = max(max(near.x, near.y), max(near.z, 0.0));\n"
+    "    float exit = min(min(far.x, far.y), min(far.z, nearest));\n"
+    "    return enter <= exit ? enter : -1.0;\n"
+    "}\n"
+    "\n"
+    "void main() {\n"
+    "    vec2 ndc = (gl_FragCoord.xy - viewportRect.xy) / viewportRect.zw * 2.0 - 1.0;\n"
+    "    if(lensDistorted())\n"
+    "        ndc = undistort(ndc, 1.0);\n"
+    "    vec4 point = inverseViewProjection * vec4(ndc, 0, 1);\n"
+    "    vec3 dir = normalize(point.xyz / point.w - cameraPos);\n"
+    "    // keeps axis aligned rays from multiplying 0 by infinity\n"
+    "    vec3 invDir = 1.0 / (dir + vec3(equal(dir, vec3(0))) * 1e-20);\n"
+    "    float nearest = 3.4e38;\n"
+    "    int hit = -1;\n"
+    "    uint stack[STACK_SIZE];\n"
+    "    int top = 0;\n"
+    "    if(boxDistance(0u, invDir, nearest) >= 0.0)\n"
+    "        stack[top++] = 0u;\n"
+    "    while(top > 0) {\n"
+    "        uint node = stack[--top];\n"
+    "        // the box may lie behind a hit found since it was pushed\n"
+    "        if(boxDistance(node, invDir, nearest) < 0.0)\n"
+    "            continue;\n"
+    "        uint first = nodes[node].first;\n"
+    "        uint count = nodes[node].count;\n"
+    "        if(count == 0u) {\n"
+    "            float d0 = boxDistance(first, invDir, nearest);\n"
+    "            float d1 = boxDistance(first + 1u, invDir, nearest);\n"
+    "            // the nearer child is pushed last to be visited first\n"
+    "            uint nearChild = d1 >= 0.0 && (d0 < 0.0 || d1 < d0) ? first + 1u : first;\n"
+    "            float nearDistance = nearChild == first ? d0 : d1;\n"
+    "            float farDistance = nearChild == first ? d1 : d0;\n"
+    "            if(farDistance >= 0.0 && top < STACK_SIZE)\n"
+    "                stack[top++] = nearChild == first ? first + 1u : first;\n"
+    "            if(nearDistance >= 0.0 && top < STACK_SIZE)\n"
+    "                stack[top++] = nearChild;\n"
+    "            continue;\n"
+    "        }\n"
+    "        for(uint i = first; i < first + count; i++) {\n"
+    "            vec3 ab = triangles[i].ab;\n"
+    "            vec3 ac = triangles[i].ac;\n"
+    "            vec3 p = cross(dir, ac);\n"
+    "            float det = dot(ab, p);\n"
+    "            if(abs(det) < 1e-12)\n"
+    "                continue;\n"
+    "            vec3 s = cameraPos - triangles[i].a;\n"
+    "            float u = dot(s, p) / det;\n"
+    "            vec3 q = cross(s, ab);\n"
+    "            float v = dot(dir, q) / det;\n"
+    "            float t = dot(ac, q) / det;\n"
+    "            if(u >= 0.0 && v >= 0.0 && u + v <= 1.0 && t > 0.0 && t < nearest) {\n"
+    "                nearest = t;\n"
+    "                hit = int(i);\n"
+    "            }\n"
+    "        }\n"
+    "    }\n"
+    "    if(hit < 0)\n"
+    "        discard;\n"
+    "    vec3 normal = normalize(cross(triangles[hit].ab, triangles[hit].ac));\n"
+    "    vec3 albedo = unpackUnorm4x8(triangles[hit].albedo).rgb;\n"
+    "    color = vec4(albedo * (0.25 + 0.75 * abs(dot(normal, dir))), 1);\n"
+    "}\n"
+    ;
 
-}
+/**
+ * Uniforms that need to be set besides ReprojectionUniforms:
+ * inverseFrameViewProjection - inverse of the layer's projection * view
+ * hizTex - min/max depth pyramid of last frame
+ * hizLevel - pyramid level whose texels match the grid cell size
+ *
+ * Each grid vertex is unprojected through the closest depth of its cell, so
+ * foreground edges are kept rather than eroded by the background.
+ */
+static const char* gridWarpVertSrc =
+    "#version 330 core\n"
+    "layout(location = 0) in vec2 gridPos;\n"
+    REPROJECTION_UNIFORMS_SRC
+    "uniform mat4 inverseFrameViewProjection;\n"
+    "uniform sampler2D hizTex;\n"
+    "uniform float hizLevel;\n"
+    LENS_DISTORTION_SRC
+    "out vec2 texCoords;\n"
+    "void main() {\n"
+    "    float depth = textureLod(hizTex, gridPos, hizLevel).r;\n"
+    "    vec4 world = inverseFrameViewProjection * vec4(vec3(gridPos, depth) * 2.0 - 1.0, 1);\n"
+    "    gl_Position = distortClip(projection * view * vec4(world.xyz / world.w, 1));\n"
+    "    texCoords = gridPos;\n"
+    "}\n"
+    ;
+
+/**
+ * Fullscreen triangle generated from gl_VertexID, used by passes that write
+ * every texel of their target
+ */
+static const char* fullscreenVertSrc =
+    "#version 330 core\n"
+    "void main() {\n"
+    "    vec2 pos = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);\n"
+    "    gl_Position = vec4(pos * 2.0 - 1.0, 0, 1);\n"
+    "}\n"
+    ;
+
+/**
+ * Uniforms that need to be set:
+ * clipToLayer - from this refresh's clip space to the cube map layer's
+ *               orientation, without translation
+ * tex - cube map color texture of the layer
+ *
+ * Clip space points on the far plane map to directions linearly, so the
+ * direction is interpolated from the three vertices. With lens distortion
+ * it isn't linear anymore, and each channel's direction is found per
+ * fragment instead
+ */
+static const char* cubeMapVertSrc =
+    "#version 330 core\n"
+    "uniform mat4 clipToLayer;\n"
+    "out vec3 direction;\n"
+    "out vec2 ndc;\n"
+    "void main() {\n"
+    "    vec2 pos = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2.0 - 1.0;\n"
+    "    gl_Position = vec4(pos, 0, 1);\n"
+    "    vec4 farPoint = clipToLayer * vec4(pos, 1, 1);\n"
+    "    direction = farPoint.xyz / farPoint.w;\n"
+    "    ndc = pos;\n"
+    "}\n"
+    ;
+
+static const char* cubeMapFragSrc =
+    "#version 330 core\n"
+    "layout(location = 0) out vec4 color;\n"
+    REPROJECTION_UNIFORMS_SRC
+    "uniform samplerCube tex;\n"
+    "uniform mat4 clipToLayer;\n"
+    "in vec3 direction;\n"
+    "in vec2 ndc;\n"
+    LENS_DISTORTION_SRC
+    "vec3 channelDirection(float channelScale) {\n"
+    "    vec4 farPoint = clipToLayer * vec4(undistort(ndc, channelScale), 1, 1);\n"
+    "    return farPoint.xyz / farPoint.w;\n"
+    "}\n"
+    "void main() {\n"
+    "    if(!lensDistorted()) {\n"
+    "        color = texture(tex, direction);\n"
+    "        return;\n"
+    "    }\n"
+    "    color = texture(tex, channelDirection(1.0));\n"
+    "    color.r = texture(tex, channelDirection(chromaticAberration.x)).r;\n"
+    "    color.b = texture(tex, channelDirection(chromaticAberration.y)).b;\n"
+    "}\n"
+    ;
+
+/**
+ * Pattern of CHECKERBOARD_ENABLED layers. GPUs shade pixels in 2x2 quads, so
+ * the checkerboard is of quads: a frame renders the quads of the viewport
+ * with (x / 2 + y / 2) % 2 == parity. checkerboardNeighbor returns the
+ * rendered pixels closest to a skipped one, to its left, right, bottom and
+ * top.
+ */
+#define CHECKERBOARD_SRC \
+    "bool checkerboardRendered(ivec2 coord, int parity) {\n" \
+    "    return (((coord.x >> 1) + (coord.y >> 1)) & 1) == parity;\n" \
+    "}\n" \
+    "ivec2 checkerboardNeighbor(ivec2 coord, int i) {\n" \
+    "    ivec2 low = coord - 1 - (coord & 1);\n" \
+    "    ivec2 high = coord + 2 - (coord & 1);\n" \
+    "    if(i == 0) return ivec2(low.x, coord.y);\n" \
+    "    if(i == 1) return ivec2(high.x, coord.y);\n" \
+    "    if(i == 2) return ivec2(coord.x, low.y);\n" \
+    "    return ivec2(coord.x, high.y);\n" \
+    "}\n"
+
+/**
+ * Layer depth in OpenGL's default mapping, which the depth pyramids and the
+ * passes reading layer depth work in, whatever the layer's DepthMapping:
+ * depthMapping - the layer's DepthMapping
+ * depthRange - near and far plane of the layer's projection
+ *
+ * Reversed depth is one minus the default. The pyramids are 32 bit floats,
+ * so the conversion keeps steps as fine as a 24 bit depth buffer's
+ */
+#define DEPTH_MAPPING_SRC \
+    "uniform int depthMapping;\n" \
+    "uniform vec2 depthRange;\n" \
+    "float standardDepth(float depth) {\n" \
+    "    if(depthMapping == 1)\n" \
+    "        return 1.0 - depth;\n" \
+    "    if(depthMapping == 2) {\n" \
+    "        float z = mix(depthRange.x, depthRange.y, depth);\n" \
+    "        return depthRange.y / (depthRange.y - depthRange.x) * (1.0 - depthRange.x / z);\n" \
+    "    }\n" \
+    "    return depth;\n" \
+    "}\n"
+
+/**
+ * Uniforms that need to be set:
+ * depthTex - depth texture of the submitted layer
+ * depthMapping, depthRange - see DEPTH_MAPPING_SRC
+ * origin - corner of the layer's viewport in depthTex
+ * size - size of the viewport
+ * checkerboardParity - which 2x2 blocks a CHECKERBOARD_ENABLED layer
+ *                      rendered, -1 for other layers
+ *
+ * Pixels a checkerboard layer skipped take the nearest and farthest depth
+ * of the four rendered pixels closest to them.
+ */
+static const char* hizCopyFragSrc =
+    "#version 330 core\n"
+    "layout(location = 0) out vec2 minMax;\n"
+    "uniform sampler2D depthTex;\n"
+    "uniform ivec2 origin;\n"
+    "uniform ivec2 size;\n"
+    "uniform int checkerboardParity;\n"
+    CHECKERBOARD_SRC
+    DEPTH_MAPPING_SRC
+    "void main() {\n"
+    "    ivec2 coord = ivec2(gl_FragCoord.xy);\n"
+    "    if(checkerboardParity < 0 || checkerboardRendered(coord, checkerboardParity)) {\n"
+    "        float depth = standardDepth(texelFetch(depthTex, coord + origin, 0).r);\n"
+    "        minMax = vec2(depth, depth);\n"
+    "        return;\n"
+    "    }\n"
+    "    vec2 result = vec2(1.0, 0.0);\n"
+    "    for(int i = 0; i < 4; i++) {\n"
+    "        ivec2 p = clamp(checkerboardNeighbor(coord, i), ivec2(0), size - 1);\n"
+    "        float depth = standardDepth(texelFetch(depthTex, p + origin, 0).r);\n"
+    "        result = vec2(min(result.x, depth), max(result.y, depth));\n"
+    "    }\n"
+    "    minMax = result;\n"
+    "}\n"
+    ;
+
+/**
+ * Uniforms that need to be set:
+ * hizTex - the pyramid, with base and max level set to the level being read
+ * sourceSize - size of the level being read
+ *
+ * When the source size is odd, the last texel of the row or column also
+ * covers the source texel that would otherwise be dropped.
+ */
+static const char* hizReduceFragSrc =
+    "#version 330 core\n"
+    "layout(location = 0) out vec2 minMax;\n"
+    "uniform sampler2D hizTex;\n"
+    "uniform ivec2 sourceSize;\n"
+    "void main() {\n"
+    "    ivec2 coord = ivec2(gl_FragCoord.xy);\n"
+    "    ivec2 base = coord * 2;\n"
+    "    ivec2 extent = ivec2(2, 2);\n"
+    "    if(base.x + 3 == sourceSize.x) extent.x = 3;\n"
+    "    if(base.y + 3 == sourceSize.y) extent.y = 3;\n"
+    "    vec2 result = vec2(1.0, 0.0);\n"
+    "    for(int y = 0; y < extent.y; y++) {\n"
+    "        for(int x = 0; x < extent.x; x++) {\n"
+    "            ivec2 p = min(base + ivec2(x, y), sourceSize - 1);\n"
+    "            vec2 texel = texelFetch(hizTex, p, 0).rg;\n"
+    "            result.x = min(result.x, texel.x);\n"
+    "            result.y = max(result.y, texel.y);\n"
+    "        }\n"
+    "    }\n"
+    "    minMax = result;\n"
+    "}\n"
+    ;
+
+/**
+ * Uniforms that need to be set:
+ * corners - clip space corners of the masked quad, in triangle strip order
+ */
+static const char* depthMaskVertSrc =
+    "#version 330 core\n"
+    "uniform vec4 corners[4];\n"
+    "void main() {\n"
+    "    gl_Position = corners[gl_VertexID];\n"
+    "}\n"
+    ;
+
+/**
+ * Uniforms that need to be set:
+ * depth - the window depth written, the nearest of the target's mapping
+ */
+static const char* depthMaskFragSrc =
+    "#version 330 core\n"
+    "uniform float depth;\n"
+    "void main() {\n"
+    "    gl_FragDepth = depth;\n"
+    "}\n"
+    ;
+
+/**
+ * Uniforms that need to be set:
+ * tex - color image of the submitted layer
+ * depthTex - its depth image, only read when hasDepth is set
+ * depthMapping, depthRange - see DEPTH_MAPPING_SRC
+ * history - the previous frame's result, only read when historyValid is set
+ * viewport - the layer's viewport in tex and depthTex
+ * outputSize - size of the result, which covers the whole layer
+ * inverseViewProjection - from the layer's clip space to world space
+ * historyViewProjection - from world space to the clip space of the layer
+ *                         the history was resolved for
+ * weight - share of a new sample landing on a pixel's center
+ *
+ * Each pixel of the result takes the layer's nearest sample, weighted by how
+ * far it is from the pixel center, and the history where the pixel's surface
+ * was. The history is clamped to the colors around the sample, so what has
+ * been uncovered or changed since is not smeared over it. Pixels the history
+ * didn't see start over from the bilinear layer.
+ */
+static const char* temporalResolveFragSrc =
+    "#version 330 core\n"
+    "layout(location = 0) out vec4 color;\n"
+    LAYER_RECT_SRC
+    "uniform sampler2D tex;\n"
+    "uniform sampler2D depthTex;\n"
+    "uniform sampler2D history;\n"
+    "uniform bool hasDepth;\n"
+    "uniform bool historyValid;\n"
+    "uniform ivec4 viewport;\n"
+    "uniform vec2 outputSize;\n"
+    "uniform mat4 inverseViewProjection;\n"
+    "uniform mat4 historyViewProjection;\n"
+    "uniform float weight;\n"
+    DEPTH_MAPPING_SRC
+    "void main() {\n"
+    "    vec2 coords = gl_FragCoord.xy / outputSize;\n"
+    "    vec2 samplePos = coords * vec2(viewport.zw);\n"
+    "    ivec2 nearest = clamp(ivec2(samplePos), ivec2(0), viewport.zw - 1);\n"
+    "    vec4 current = texelFetch(tex, viewport.xy + nearest, 0);\n"
+    "    vec4 low = current;\n"
+    "    vec4 high = current;\n"
+    "    for(int y = -1; y <= 1; y++) {\n"
+    "        for(int x = -1; x <= 1; x++) {\n"
+    "            ivec2 p = clamp(nearest + ivec2(x, y), ivec2(0), viewport.zw - 1);\n"
+    "            vec4 neighbor = texelFetch(tex, viewport.xy + p, 0);\n"
+    "            low = min(low, neighbor);\n"
+    "            high = max(high, neighbor);\n"
+    "        }\n"
+    "    }\n"
+    "    float depth = hasDepth ? standardDepth(texelFetch(depthTex, viewport.xy + nearest, 0).r) : 1.0;\n"
+    "    vec4 world = inverseViewProjection * vec4(vec3(coords, depth) * 2.0 - 1.0, 1);\n"
+    "    vec4 previous = historyViewProjection * vec4(world.xyz / world.w, 1);\n"
+    "    vec2 historyCoords = previous.xy / previous.w * 0.5 + 0.5;\n"
+    "    if(!historyValid || previous.w <= 0.0 || any(lessThan(historyCoords, vec2(0)))\n"
+    "       || any(greaterThan(historyCoords, vec2(1)))) {\n"
+    "        color = textureLod(tex, imageCoords(coords), 0.0);\n"
+    "        return;\n"
+    "    }\n"
+    "    vec4 past = clamp(textureLod(history, historyCoords, 0.0), low, high);\n"
+    "    vec2 offset = (samplePos - vec2(nearest) - 0.5) * outputSize / vec2(viewport.zw);\n"
+    "    color = mix(past, current, weight * exp(-2.0 * dot(offset, offset)));\n"
+    "}\n"
+    ;
+
+/**
+ * Uniforms that need to be set:
+ * tex - color image of the submitted layer
+ * depthTex - its depth image, only read when hasDepth is set
+ * depthMapping, depthRange - see DEPTH_MAPPING_SRC
+ * history - the previous frame's result, only read when historyValid is set
+ * viewport - the layer's viewport in tex and depthTex, the result's size
+ * inverseViewProjection - from the layer's clip space to world space
+ * historyViewProjection - from world space to the clip space of the layer
+ *                         the history was resolved for
+ * parity - which 2x2 blocks the layer rendered, see CHECKERBOARD_SRC
+ *
+ * Rendered pixels are copied. The others are found in the history through
+ * the nearest depth next to them, and clamped to the colors of the four
+ * rendered pixels around them, whose average they take where the history
+ * has nothing.
+ */
+static const char* checkerboardResolveFragSrc =
+    "#version 330 core\n"
+    "layout(location = 0) out vec4 color;\n"
+    "uniform sampler2D tex;\n"
+    "uniform sampler2D depthTex;\n"
+    "uniform sampler2D history;\n"
+    "uniform bool hasDepth;\n"
+    "uniform bool historyValid;\n"
+    "uniform ivec4 viewport;\n"
+    "uniform mat4 inverseViewProjection;\n"
+    "uniform mat4 historyViewProjection;\n"
+    "uniform int parity;\n"
+    CHECKERBOARD_SRC
+    DEPTH_MAPPING_SRC
+    "void main() {\n"
+    "    ivec2 coord = ivec2(gl_FragCoord.xy);\n"
+    "    if(checkerboardRendered(coord, parity)) {\n"
+    "        color = texelFetch(tex, viewport.xy + coord, 0);\n"
+    "        return;\n"
+    "    }\n"
+    "    vec4 low = vec4(1e30);\n"
+    "    vec4 high = vec4(-1e30);\n"
+    "    vec4 average = vec4(0);\n"
+    "    float depth = 1.0;\n"
+    "    for(int i = 0; i < 4; i++) {\n"
+    "        ivec2 p = viewport.xy + clamp(checkerboardNeighbor(coord, i), ivec2(0), viewport.zw - 1);\n"
+    "        vec4 neighbor = texelFetch(tex, p, 0);\n"
+    "        low = min(low, neighbor);\n"
+    "        high = max(high, neighbor);\n"
+    "        average += neighbor * 0.25;\n"
+    "        if(hasDepth)\n"
+    "            depth = min(depth, standardDepth(texelFetch(depthTex, p, 0).r));\n"
+    "    }\n"
+    "    vec2 coords = gl_FragCoord.xy / vec2(viewport.zw);\n"
+    "    vec4 world = inverseViewProjection * vec4(vec3(coords, depth) * 2.0 - 1.0, 1);\n"
+    "    vec4 previous = historyViewProjection * vec4(world.xyz / world.w, 1);\n"
+    "    vec2 historyCoords = previous.xy / previous.w * 0.5 + 0.5;\n"
+    "    if(!historyValid || previous.w <= 0.0 || any(lessThan(historyCoords, vec2(0)))\n"
+    "       || any(greaterThan(historyCoords, vec2(1)))) {\n"
+    "        color = average;\n"
+    "        return;\n"
+    "    }\n"
+    "    color = clamp(textureLod(history, historyCoords, 0.0), low, high);\n"
+    "}\n"
+    ;
+
+/**
+ * Uniforms that need to be set:
+ * tex, depthTex, velocityTex, materialTex - multisampled images the app
+ *                                          rendered into
+ * samples - their sample count
+ * hasDepth, hasVelocity, hasMaterial - whether depthTex, velocityTex and
+ *                                      materialTex are read
+ * encodeSrgb - whether tex is sRGB, whose samples are fetched linear
+ * depthMapping, depthRange - see DEPTH_MAPPING_SRC
+ *
+ * Color is the average of all samples, so edges stay antialiased. Depth,
+ * velocity and material can't be averaged without making up surfaces between foreground
+ * and background, so they are taken from the surface most of the pixel's
+ * samples lie on, the nearest on a tie, which parallax then moves the
+ * pixel with.
+ */
+static const char* multisampleResolveFragSrc =
+    "#version 330 core\n"
+    "layout(location = 0) out vec4 color;\n"
+    "layout(location = 1) out vec4 velocity;\n"
+    "layout(location = 2) out vec4 material;\n"
+    "uniform sampler2DMS tex;\n"
+    "uniform sampler2DMS depthTex;\n"
+    "uniform sampler2DMS velocityTex;\n"
+    "uniform sampler2DMS materialTex;\n"
+    "uniform int samples;\n"
+    "uniform bool hasDepth;\n"
+    "uniform bool hasVelocity;\n"
+    "uniform bool hasMaterial;\n"
+    "uniform bool encodeSrgb;\n"
+    DEPTH_MAPPING_SRC
+    "float viewDistance(float depth) {\n"
+    "    float z = standardDepth(depth) * 2.0 - 1.0;\n"
+    "    return 2.0 * depthRange.x * depthRange.y / (depthRange.y + depthRange.x - z * (depthRange.y - depthRange.x));\n"
+    "}\n"
+    "void main() {\n"
+    "    ivec2 coord = ivec2(gl_FragCoord.xy);\n"
+    "    vec4 sum = vec4(0);\n"
+    "    for(int i = 0; i < samples; i++)\n"
+    "        sum += texelFetch(tex, coord, i);\n"
+    "    color = sum / float(samples);\n"
+    "    if(encodeSrgb) {\n"
+    "        vec3 c = clamp(color.rgb, 0.0, 1.0);\n"
+    "        color.rgb = mix(c * 12.92, 1.055 * pow(c, vec3(1.0 / 2.4)) - 0.055, step(0.0031308, c));\n"
+    "    }\n"
+    "    int chosen = 0;\n"
+    "    if(hasDepth) {\n"
+    "        float distances[32];\n"
+    "        for(int i = 0; i < samples; i++)\n"
+    "            distances[i] = viewDistance(texelFetch(depthTex, coord, i).r);\n"
+    "        int bestCount = 0;\n"
+    "        for(int i = 0; i < samples; i++) {\n"
+    "            // samples within 2% of each other's distance are one surface\n"
+    "            int count = 0;\n"
+    "            for(int j = 0; j < samples; j++)\n"
+    "                count += abs(distances[j] - distances[i]) <= 0.02 * distances[i] ? 1 : 0;\n"
+    "            if(count > bestCount || (count == bestCount && distances[i] < distances[chosen])) {\n"
+    "                bestCount = count;\n"
+    "                chosen = i;\n"
+    "            }\n"
+    "        }\n"
+    "        gl_FragDepth = texelFetch(depthTex, coord, chosen).r;\n"
+    "    }\n"
+    "    velocity = hasVelocity ? texelFetch(velocityTex, coord, chosen) : vec4(0);\n"
+    "    material = hasMaterial ? texelFetch(materialTex, coord, chosen) : vec4(0);\n"
+    "}\n"
+    ;
+
+/**
+ * Uniforms that need to be set:
+ * reprojected - what reprojection drew for the ground truth's pose
+ * groundTruth - the image submitted with submitGroundTruth
+ * size - size of both images
+ *
+ * Each texel covers an 8x8 pixel block and holds the block's summed squared
+ * error, its SSIM of luma, the number of pixels off by more than
+ * ERROR_THRESHOLD in any channel and the number of pixels, for
+ * qualityReduceFragSrc to sum.
+ */
+static const char* qualityCompareFragSrc =
+    "#version 330 core\n"
+    "#define ERROR_THRESHOLD 0.1\n"
+    "// SSIM constants for values in [0, 1]\n"
+    "#define SSIM_C1 0.0001\n"
+    "#define SSIM_C2 0.0009\n"
+    "layout(location = 0) out vec4 result;\n"
+    "uniform sampler2D reprojected;\n"
+    "uniform sampler2D groundTruth;\n"
+    "uniform ivec2 size;\n"
+    "void main() {\n"
+    "    ivec2 base = ivec2(gl_FragCoord.xy) * 8;\n"
+    "    const vec3 lumaWeights = vec3(0.299, 0.587, 0.114);\n"
+    "    float squaredError = 0.0, errorPixels = 0.0, pixels = 0.0;\n"
+    "    float sumA = 0.0, sumB = 0.0, sumAA = 0.0, sumBB = 0.0, sumAB = 0.0;\n"
+    "    for(int y = 0; y < 8; y++) {\n"
+    "        for(int x = 0; x < 8; x++) {\n"
+    "            ivec2 p = base + ivec2(x, y);\n"
+    "            if(p.x >= size.x || p.y >= size.y)\n"
+    "                continue;\n"
+    "            vec3 a = texelFetch(reprojected, p, 0).rgb;\n"
+    "            vec3 b = texelFetch(groundTruth, p, 0).rgb;\n"
+    "            vec3 d = abs(a - b);\n"
+    "            squaredError += dot(d, d) / 3.0;\n"
+    "            if(max(d.r, max(d.g, d.b)) > ERROR_THRESHOLD)\n"
+    "                errorPixels += 1.0;\n"
+    "            float la = dot(a, lumaWeights);\n"
+    "            float lb = dot(b, lumaWeights);\n"
+    "            sumA += la;\n"
+    "            sumB += lb;\n"
+    "            sumAA += la * la;\n"
+    "            sumBB += lb * lb;\n"
+    "            sumAB += la * lb;\n"
+    "            pixels += 1.0;\n"
+    "        }\n"
+    "    }\n"
+    "    float meanA = sumA / pixels;\n"
+    "    float meanB = sumB / pixels;\n"
+    "    float varianceA = max(sumAA / pixels - meanA * meanA, 0.0);\n"
+    "    float varianceB = max(sumBB / pixels - meanB * meanB, 0.0);\n"
+    "    float covariance = sumAB / pixels - meanA * meanB;\n"
+    "    float ssim = (2.0 * meanA * meanB + SSIM_C1) * (2.0 * covariance + SSIM_C2)\n"
+    "               / ((meanA * meanA + meanB * meanB + SSIM_C1) * (varianceA + varianceB + SSIM_C2));\n"
+    "    result = vec4(squaredError, ssim, errorPixels, pixels);\n"
+    "}\n"
+    ;
+
+/**
+ * Uniforms that need to be set:
+ * sumTex - the reduction chain, with base and max level set to the level
+ *          being read
+ * sourceSize - size of the level being read
+ *
+ * Sums 2x2 texels, odd sizes are handled like in hizReduceFragSrc.
+ */
+static const char* qualityReduceFragSrc =
+    "#version 330 core\n"
+    "layout(location = 0) out vec4 result;\n"
+    "uniform sampler2D sumTex;\n"
+    "uniform ivec2 sourceSize;\n"
+    "void main() {\n"
+    "    ivec2 coord = ivec2(gl_FragCoord.xy);\n"
+    "    ivec2 base = coord * 2;\n"
+    "    ivec2 extent = ivec2(2, 2);\n"
+    "    if(base.x + 3 == sourceSize.x) extent.x = 3;\n"
+    "    if(base.y + 3 == sourceSize.y) extent.y = 3;\n"
+    "    vec4 sum = vec4(0.0);\n"
+    "    for(int y = 0; y < extent.y; y++) {\n"
+    "        for(int x = 0; x < extent.x; x++) {\n"
+    "            ivec2 p = base + ivec2(x, y);\n"
+    "            if(p.x < sourceSize.x && p.y < sourceSize.y)\n"
+    "                sum += texelFetch(sumTex, p, 0);\n"
+    "        }\n"
+    "    }\n"
+    "    result = sum;\n"
+    "}\n"
+    ;
+
+GLuint cubeMapProgram;
+GLuint copyProgram;
+glm::mat4 projection;
+
+/**
+ * std140 layout of REPROJECTION_UNIFORMS_SRC
+ */
+struct ReprojectionUniforms {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec4 cameraPos;
+    glm::vec4 foveation;
+    float peripheralQuality;
+    float padding[3];
+    glm::vec4 viewportRect;
+    glm::vec4 lensDistortion;
+    glm::vec4 chromaticAberration;
+};
+
+static const GLuint REPROJECTION_UNIFORMS_BINDING = 0;
+static GLuint reprojectionUniformBuffer;
+
+// uniform locations, resolved once by setupGL
+static GLint parallaxCompositeViewportOriginLoc;
+static GLint cubeMapClipToLayerLoc;
+static GLint copyViewportLoc;
+static GLint copyDistortLoc;
+static GLint copyAlphaMaskedLoc;
+static GLint copyLayerRectLoc;
+static GLint copyLayerClampLoc;
+static GLint copyTileCountLoc;
+static GLint copyTileSizeLoc;
+static GLint tileClassifyViewportLoc;
+static GLint tileClassifyTileSizeLoc;
+static GLint temporalHasDepthLoc;
+static GLint temporalHistoryValidLoc;
+static GLint temporalViewportLoc;
+static GLint temporalOutputSizeLoc;
+static GLint temporalInverseViewProjectionLoc;
+static GLint temporalHistoryViewProjectionLoc;
+static GLint temporalWeightLoc;
+static GLint temporalLayerRectLoc;
+static GLint temporalLayerClampLoc;
+static GLint temporalDepthMappingLoc;
+static GLint temporalDepthRangeLoc;
+static GLint checkerboardHasDepthLoc;
+static GLint checkerboardHistoryValidLoc;
+static GLint checkerboardViewportLoc;
+static GLint checkerboardInverseViewProjectionLoc;
+static GLint checkerboardHistoryViewProjectionLoc;
+static GLint checkerboardParityLoc;
+static GLint checkerboardDepthMappingLoc;
+static GLint checkerboardDepthRangeLoc;
+static GLint multisampleSamplesLoc;
+static GLint multisampleHasDepthLoc;
+static GLint multisampleHasVelocityLoc;
+static GLint multisampleHasMaterialLoc;
+static GLint multisampleEncodeSrgbLoc;
+static GLint multisampleDepthMappingLoc;
+static GLint multisampleDepthRangeLoc;
+static GLint qualityCompareSizeLoc;
+static GLint qualityReduceSourceSizeLoc;
+
+// VAO with the unit quad used for drawing layers, and its buffer, which
+// other contexts make VAOs of too
+static GLuint quadVao;
+static GLuint quadVbo;
+
+/**
+ * Grid of (cols + 1) x (rows + 1) vertices spanning [0, 1] in both axes,
+ * drawn as indexed triangles
+ */
+struct GridMesh {
+    GLuint vao = 0;
+    GLuint vbo = 0;
+    GLuint ibo = 0;
+    // positions of the vertex columns and rows, see gridAxis
+    std::vector<float> xs;
+    std::vector<float> ys;
+    int indexCount = 0;
+};
+
+static GridMesh gridMesh;
+// whether the window has a stencil buffer to composite layers front to back
+static bool stencilCompositing = false;
+static int gridCellSize = 8;
+// set from any thread by setFoveation, copied once per refresh
+static Foveation foveation;
+static std::mutex foveationMutex;
+// what this refresh is drawn with
+static Foveation refreshFoveation;
+// set from any thread by setStereo, copied once per refresh
+static StereoConfig stereo;
+static std::mutex stereoMutex;
+static StereoConfig refreshStereo;
+// eye drawLayers draws for, -1 without stereo
+static int currentEye = -1;
+// set from any thread by setSplitScreen, copied once per refresh
+static SplitScreen splitScreen;
+static std::mutex splitScreenMutex;
+static SplitScreen refreshSplitScreen;
+static std::atomic<ViewportPoseFunction> viewportPoseFunctions[MAX_SPLIT_VIEWPORTS];
+// split screen viewport drawLayers draws for, -1 without split screen
+static int currentViewport = -1;
+// set from any thread by setLensDistortion, copied once per refresh
+static LensDistortion lensDistortion;
+static std::mutex lensDistortionMutex;
+static LensDistortion refreshLensDistortion;
+// layer planes tessellated for lens distortion, see drawLayerPlane
+static GLuint distortionMeshVao = 0;
+static GLuint distortionMeshVbo = 0;
+static GLuint distortionMeshIbo = 0;
+static int distortionMeshCells = 0;
+static int distortionMeshIndexCount = 0;
+// longest a layer's objects are extrapolated for, in seconds
+static const double maxMotionExtrapolation = 0.2;
+
+/**
+ * Min/max depth mip chain built from a layer's depth image once per
+ * submitted frame. R holds the closest depth of each texel's footprint and G
+ * the farthest.
+ */
+struct DepthPyramid {
+    GLuint texture = 0;
+    // the layer viewport it covers
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+    int levels = 0;
+    // FrameLayer::submission of the image it was built from
+    std::uint64_t submission = 0;
+};
+
+// one pyramid per layer index of lastFrame
+static std::vector<DepthPyramid> layerPyramids;
+/**
+ * Readback of the top texels of a layer's pyramids, the nearest and the
+ * farthest depth of its image, for getRecommendedDepthRange. One is in
+ * flight per layer index
+ */
+struct DepthRangeReadback {
+    GLuint buffer = 0;
+    GLsync fence = nullptr;
+    // planes of the projection the depth is relative to
+    float nearPlane = 0;
+    float farPlane = 0;
+};
+static std::vector<DepthRangeReadback> depthRangeReadbacks;
+// near and far planes fitted per layer index, 0 until measured
+static std::mutex fittedDepthRangeMutex;
+static std::vector<glm::vec2> fittedDepthRanges;
+// fractions of the nearest and farthest distance the fitted planes are at
+static const float depthFitNearMargin = 0.5f;
+static const float depthFitFarMargin = 1.5f;
+/**
+ * Which tiles of a SPARSE_TILES layer's viewport have any pixel that isn't
+ * masked out, 1 in a texel per tile where they do
+ */
+struct LayerTiles {
+    GLuint texture = 0;
+    int columns = 0;
+    int rows = 0;
+    // image it was classified from
+    const Swapchain* swapchain = nullptr;
+    int swapchainIndex = -1;
+    std::uint64_t submission = 0;
+};
+
+// one per layer index of lastFrame
+static std::vector<LayerTiles> layerTiles;
+static GLuint tileClassifyProgram;
+static GLuint tileClassifyFbo;
+/**
+ * Camera a layer of lastFrame was rendered with, resolved once per frame
+ */
+struct LayerCamera {
+    Pose pose;
+    LayerProjection projection;
+    // projection * view and its inverse
+    glm::mat4 viewProjection;
+    glm::mat4 inverseViewProjection;
+    // reference space the pose moves with, -1 for the world, and the pose
+    // within the space
+    int referenceSpace = -1;
+    Pose spacePose;
+};
+
+// one camera per layer index of lastFrame
+static std::vector<LayerCamera> layerCameras;
+
+/**
+ * Accumulated image of a TEMPORAL_ACCUMULATION_ENABLED layer, or filled in
+ * image of a CHECKERBOARD_ENABLED one, resolved once per submitted frame.
+ * Reprojection draws the newest one in place of the layer's image
+ */
+struct TemporalHistory {
+    // rgba16f, written alternately so the previous one can be read
+    GLuint textures[2] = { 0, 0 };
+    int current = 0;
+    int width = 0;
+    int height = 0;
+    // camera and image of the frame textures[current] was resolved for
+    glm::mat4 viewProjection;
+    const Swapchain* swapchain = nullptr;
+    int swapchainIndex = 0;
+    std::uint64_t submission = 0;
+};
+
+// one history per layer index of lastFrame
+static std::vector<TemporalHistory> layerHistories;
+
+/**
+ * Half resolution copy of a retained layer's color, which stands in for its
+ * swapchain image once the image is released, see setCompactFrameHistory
+ */
+struct CompactColor {
+    GLuint texture = 0;
+    GLenum format = 0;
+    int width = 0;
+    int height = 0;
+    // the layer was copied and its image released
+    bool active = false;
+};
+
+/**
+ * Frame reprojection has moved on from, kept with its images, cameras and
+ * depth pyramids so parallax layers can take the pixels newer frames could
+ * not see. Compacted layers keep a half resolution pyramid and color
+ * instead of their images
+ */
+struct RetainedFrame {
+    FrameLayers layers;
+    std::vector<LayerCamera> cameras;
+    std::vector<DepthPyramid> pyramids;
+    // per layer index, stands in for the image of compacted layers
+    std::vector<CompactColor> colors;
+};
+
+static const int maxFrameHistory = 8;
+static std::atomic<int> frameHistoryLength{1};
+// see setCompactFrameHistory
+static std::atomic<bool> compactFrameHistory{false};
+// see setFrameInterpolation
+static std::atomic<bool> frameInterpolation{false};
+// interactive input switches back to extrapolation for this long
+static const double interpolationInputHold = 0.5;
+static double lastInteractiveInput = -1e9;
+// whether this refresh interpolates, and the time it shows if so
+static bool interpolating = false;
+static double interpolationShownTime = 0;
+// poses and times of the two newest frames, the older one first
+static Pose interpolationPoses[2];
+static double interpolationTimes[2] = {};
+// mouse position of the last refresh, movement counts as input
+static double interpolationMouseX = 0;
+static double interpolationMouseY = 0;
+// read and draw framebuffers of the copies into compact history
+static GLuint compactReadFbo;
+static GLuint compactDrawFbo;
+// see setGpuMemoryBudget. Categories arp allocates on other threads are
+// added up as they go, reprojection's own are recounted by updateGpuMemory
+static std::atomic<std::int64_t> gpuMemoryBytes[GPU_MEMORY_CATEGORY_COUNT];
+static std::atomic<std::int64_t> gpuDeviceBytes{-1};
+static std::atomic<std::int64_t> gpuDeviceAvailableBytes{-1};
+static std::atomic<std::int64_t> gpuMemoryBudget{0};
+static std::atomic<std::int64_t> gpuMinAvailable{0};
+static std::atomic<bool> gpuMemoryPressure{false};
+static double lastGpuMemoryUpdate = 0;
+static const double gpuMemoryUpdateInterval = 0.5;
+// see setPowerMode. powerMutex guards the settings and the state, the
+// reprojection thread only reads powerSaving
+static std::mutex powerMutex;
+static PowerSettings powerSettings;
+static PowerState powerState;
+static std::atomic<bool> powerSaving{false};
+static std::atomic<int> powerSavingFramerate{0};
+// -1 reads the power state on the next refresh
+static double lastPowerUpdate = -1;
+static std::atomic<bool> powerSettingsChanged{false};
+// newest first, at most frameHistoryLength - 1 frames
+static std::deque<RetainedFrame> retainedFrames;
+// draws the compute parallax pass, 0 without GL 4.3
+static GLuint parallaxCompositeProgram;
+// turned off to draw parallax layers with LAYER_PROGRAM_PARALLAX
+static bool computeParallax = false;
+
+/**
+ * Render target that only lives through one pass of a refresh, handed out
+ * by acquireTransientTexture. Passes that don't overlap get the same texture
+ * when they ask for the same format and size
+ */
+struct TransientTexture {
+    GLuint texture;
+    GLenum format;
+    int width;
+    int height;
+    bool acquired;
+    // refreshes since it was last released
+    int idleRefreshes;
+};
+static std::vector<TransientTexture> transientTextures;
+// refreshes a released transient texture is kept for, so a pass that runs
+// every other refresh or a resize back doesn't reallocate
+static const int transientTextureMaxIdle = 120;
+
+// set from any thread by setVoxelCache, taken up by latchPendingFrame
+static VoxelCache voxelCacheSettings;
+static std::mutex voxelCacheMutex;
+// what voxelCacheBuffer was made with, disabled while there is none
+static VoxelCache activeVoxelCache;
+static GLuint voxelCacheBuffer = 0;
+static GLuint voxelInsertProgram;
+static GLuint voxelSplatProgram;
+static GLint voxelInsertVoxelSizeLoc;
+static GLint voxelInsertSubmissionLoc;
+static GLint voxelInsertMaxAgeLoc;
+static GLint voxelInsertLayerRectLoc;
+static GLint voxelInsertLayerClampLoc;
+static GLint voxelInsertInverseViewProjectionLoc;
+static GLint voxelInsertStrideLoc;
+static GLint voxelSplatVoxelSizeLoc;
+static GLint voxelSplatSubmissionLoc;
+static GLint voxelSplatMaxAgeLoc;
+static GLint voxelSplatPassLoc;
+static GLint voxelSplatViewProjectionLoc;
+static GLint voxelSplatSizeLoc;
+static GLint voxelSplatPixelScaleLoc;
+// debugging copies of the cache, see getVoxelCachePoints
+static std::atomic<bool> voxelCacheReadbackRequested{false};
+static std::vector<VoxelCachePoint> voxelCacheReadback;
+static bool voxelCacheReadbackReady = false;
+// latched frames since the cache was made, what voxel ages count in
+static GLuint voxelCacheFrame = 0;
+// layer the splat is drawn under in this drawLayers, -1 for none
+static int voxelSplatLayer = -1;
+
+/**
+ * Node of the BVH of setSceneGeometry as sceneTraceFragSrc reads it, with
+ * the two children of an inner node next to each other
+ */
+struct SceneBvhNode {
+    float lo[3];
+    // first child, or first triangle of a leaf
+    uint32_t first;
+    float hi[3];
+    // 0 for inner nodes
+    uint32_t count;
+};
+
+/**
+ * Triangle of the scene as a corner and its two edges from it, in the
+ * order of the BVH's leaves
+ */
+struct SceneBvhTriangle {
+    float a[3];
+    uint32_t albedo;
+    float ab[3];
+    float padding0;
+    float ac[3];
+    float padding1;
+};
+
+// built by setSceneGeometry, uploaded by latchPendingFrame
+static std::vector<SceneBvhNode> pendingSceneNodes;
+static std::vector<SceneBvhTriangle> pendingSceneTriangles;
+static bool sceneGeometryPending = false;
+static std::mutex sceneGeometryMutex;
+// empty while no geometry is set
+static GLuint sceneNodeBuffer = 0;
+static GLuint sceneTriangleBuffer = 0;
+static std::int64_t sceneBvhBytes = 0;
+static GLuint sceneTraceProgram;
+static GLint sceneTraceInverseViewProjectionLoc;
+// off in the overlay to compare with the layers below
+static std::atomic<bool> sceneTraceToggle{true};
+// set by setReshadingLights, taken by latchPendingFrame
+static std::vector<ReshadingLight> pendingReshadingLights;
+static bool reshadingLightsPending = false;
+static std::mutex reshadingLightsMutex;
+// RESHADING_SRC uniforms of the latched lights
+static const int maxReshadingLights = 8;
+static glm::vec4 reshadingLightPositions[maxReshadingLights];
+static glm::vec4 reshadingLightColors[maxReshadingLights];
+static int reshadingLightCount = 0;
+/**
+ * Framebuffer, programs and uniform locations depth pyramids are built
+ * with, see drawDepthPyramid. One per context: framebuffers aren't shared,
+ * and uniform values belong to the program, so another context's draws
+ * would race reprojection's
+ */
+struct PyramidBuilder {
+    GLuint fbo = 0;
+    GLuint copyProgram = 0;
+    GLuint reduceProgram = 0;
+    GLint copyOriginLoc = -1;
+    GLint copySizeLoc = -1;
+    GLint copyCheckerboardParityLoc = -1;
+    GLint copyDepthMappingLoc = -1;
+    GLint copyDepthRangeLoc = -1;
+    GLint reduceSourceSizeLoc = -1;
+};
+// reprojection's
+static PyramidBuilder pyramidBuilder;
+static GLuint temporalResolveProgram;
+static GLuint checkerboardResolveProgram;
+static GLuint temporalFbo;
+static GLuint multisampleResolveProgram;
+static GLuint multisampleResolveFbo;
+// the resolve keeps one depth per sample in an array of this size
+static const int maxSwapchainSamples = 32;
+// acquires in a row that found an image to spare before an adapting
+// swapchain frees one
+static const int swapchainShrinkAcquires = 120;
+static float temporalWeight = 0.1f;
+
+/**
+ * Image submitted with submitGroundTruth, with a fence for the rendering
+ * of it
+ */
+struct GroundTruth {
+    Swapchain* swapchain = nullptr;
+    int swapchainIndex = 0;
+    Pose pose;
+    GLsync fence = nullptr;
+};
+
+// newest ground truth not compared yet, guarded by groundTruthMutex
+static GroundTruth pendingGroundTruth;
+static std::mutex groundTruthMutex;
+// compared ground truth whose result is still being read back, only used
+// by reprojection. One comparison is in flight at a time
+static GroundTruth comparedGroundTruth;
+static GLsync qualityResultFence = nullptr;
+static int qualityResultBlocks = 0;
+static GLuint qualityResultBuffer;
+// what reprojection drew for the ground truth's pose, sized to it
+static GLuint groundTruthFbo;
+static GLuint groundTruthColor;
+static GLuint groundTruthDepthStencil;
+static int groundTruthWidth = 0;
+static int groundTruthHeight = 0;
+// per block sums of the comparison, reduced down the levels to one texel
+static GLuint qualitySumTexture;
+static GLuint qualitySumFbo;
+static int qualitySumWidth = 0;
+static int qualitySumHeight = 0;
+static int qualitySumLevels = 0;
+static GLuint qualityCompareProgram;
+static GLuint qualityReduceProgram;
+static std::mutex qualityMutex;
+static QualityStats qualityStats{};
+
+/**
+ * Program whose compile and link have been issued but not checked, so the
+ * driver can work on it in the background
+ */
+struct PendingProgram {
+    const char* vertShaderSrc = nullptr;
+    const char* fragShaderSrc = nullptr;
+    // set instead of the other two for compute programs
+    const char* computeShaderSrc = nullptr;
+    // inserted after the #version line of every stage
+    std::string defines;
+    GLuint program = 0;
+    GLuint vertexShader = 0;
+    GLuint fragmentShader = 0;
+    GLuint computeShader = 0;
+    // binary cache file, empty when the cache is off
+    std::string cachePath;
+    bool fromCache = false;
+};
+
+// programs started by startReprojection and finished by setupGL
+static PendingProgram pendingCubeMapProgram;
+static PendingProgram pendingCopyProgram;
+static PendingProgram pendingHizCopyProgram;
+static PendingProgram pendingTileClassifyProgram;
+static PendingProgram pendingHizReduceProgram;
+static PendingProgram pendingTemporalResolveProgram;
+static PendingProgram pendingCheckerboardResolveProgram;
+static PendingProgram pendingMultisampleResolveProgram;
+static PendingProgram pendingQualityCompareProgram;
+static PendingProgram pendingQualityReduceProgram;
+static PendingProgram pendingParallaxCompositeProgram;
+static PendingProgram pendingVoxelInsertProgram;
+static PendingProgram pendingVoxelSplatProgram;
+static PendingProgram pendingSceneTraceProgram;
+
+enum LayerProgramKind {
+    LAYER_PROGRAM_DEFAULT,
+    LAYER_PROGRAM_PARALLAX,
+    LAYER_PROGRAM_PARALLAX_COMPUTE,
+    LAYER_PROGRAM_GRID_WARP,
+    LAYER_PROGRAM_ATLAS,
+};
+
+// options a layer program is specialized for, see layerPermutation
+enum LayerPermutation {
+    PERMUTATION_MOTION_EXTRAPOLATION = 1<<0,
+    PERMUTATION_FILL_DISOCCLUSIONS = 1<<1,
+    PERMUTATION_HALF_RESOLUTION_MARCH = 1<<2,
+    PERMUTATION_DEPTH_PEELED = 1<<3,
+    PERMUTATION_ALPHA_MASKED = 1<<4,
+    PERMUTATION_DEPTH_UPSAMPLING = 1<<5,
+    PERMUTATION_RESHADING = 1<<6,
+};
+static const unsigned layerPermutationCount = 128;
+// permutations only started once a latched frame has needed them
+static const unsigned lazyPermutations = PERMUTATION_DEPTH_PEELED | PERMUTATION_ALPHA_MASKED
+                                         | PERMUTATION_DEPTH_UPSAMPLING | PERMUTATION_RESHADING;
+
+/**
+ * One permutation of a layer program with its uniform locations, -1 for
+ * uniforms the permutation doesn't have
+ */
+struct LayerProgram {
+    PendingProgram pending;
+    GLuint program = 0;
+    bool finished = false;
+    GLint modelLoc = -1;
+    GLint frameViewProjectionLoc = -1;
+    GLint inverseFrameViewProjectionLoc = -1;
+    GLint depthRangeLoc = -1;
+    GLint hizLevelsLoc = -1;
+    GLint hizLevelLoc = -1;
+    GLint motionTimeLoc = -1;
+    GLint inverseViewProjectionLoc = -1;
+    GLint farPlaneLoc = -1;
+    GLint viewportLoc = -1;
+    GLint layerRectLoc = -1;
+    GLint layerClampLoc = -1;
+    GLint velocityRectLoc = -1;
+    GLint velocityClampLoc = -1;
+    GLint homographyLoc = -1;
+    GLint homographiesLoc = -1;
+    GLint inverseHomographiesLoc = -1;
+    GLint layerRectsLoc = -1;
+    GLint layerClampsLoc = -1;
+    GLint lightPositionsLoc = -1;
+    GLint lightColorsLoc = -1;
+    GLint lightCountLoc = -1;
+};
+
+// every permutation started so far, by layerProgramKey
+static std::unordered_map<std::uint32_t, LayerProgram> layerPrograms;
+// lazyPermutations latched frames have needed so far
+static unsigned neededPermutations = 0;
+
+// see setPipelineWarmUp
+static bool pipelineWarmUp = false;
+// color and depth formats of every swapchain created so far, of which the
+// first warmedUpFormats were warmed up. Guarded by warmUpFormatsMutex
+static std::vector<std::pair<SwapchainColorFormat, SwapchainDepthFormat>> warmUpFormats;
+static std::size_t warmedUpFormats = 0;
+static std::mutex warmUpFormatsMutex;
+// side of the target warm-up draws into
+static const int warmUpSize = 8;
+
+static LayerProgram& layerProgram(std::uint32_t key);
+static LayerProgram& layerProgram(LayerProgramKind kind, unsigned permutation);
+static unsigned layerPermutation(const FrameLayer& layer, bool fillDisocclusions);
+static bool depthUpsampled(const FrameLayer& layer);
+static bool reshaded(const FrameLayer& layer);
+static void startLayerPrograms();
+static void warmUpPipeline();
+
+// directory of cached program binaries, empty when caching is off
+static std::string shaderCacheDirectory;
+static const char shaderCacheMagic[8] = { 'A', 'R', 'P', 'P', 'R', 'O', 'G', '\0' };
+
+struct TextureFormat {
+    GLenum internalFormat;
+    GLenum format;
+    GLenum type;
+};
+
+// indexed by SwapchainColorFormat
+static const TextureFormat colorFormats[] = {
+    { GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE },
+    { GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE },
+    { GL_RGB10_A2, GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV },
+    { GL_R11F_G11F_B10F, GL_RGB, GL_UNSIGNED_INT_10F_11F_11F_REV },
+    { GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT },
+};
+
+// indexed by SwapchainDepthFormat, DEPTH_FORMAT_NONE is never allocated
+static const TextureFormat depthFormats[] = {
+    { GL_NONE, GL_NONE, GL_NONE },
+    { GL_DEPTH_COMPONENT16, GL_DEPTH_COMPONENT, GL_UNSIGNED_SHORT },
+    { GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT },
+    { GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT },
+};
+
+// indexed by SwapchainVelocityFormat, VELOCITY_FORMAT_NONE is never allocated
+static const TextureFormat velocityFormats[] = {
+    { GL_NONE, GL_NONE, GL_NONE },
+    { GL_RG16F, GL_RG, GL_HALF_FLOAT },
+    { GL_RG32F, GL_RG, GL_FLOAT },
+};
+
+// indexed by SwapchainMaterialFormat, MATERIAL_FORMAT_NONE is never allocated
+static const TextureFormat materialFormats[] = {
+    { GL_NONE, GL_NONE, GL_NONE },
+    { GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE },
+    { GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT },
+};
+
+/**
+ * Allocates one level of the bound texture. Uses immutable storage when the
+ * driver has it, so the driver never has to guess the final layout
+ */
+static void allocateTexture(const TextureFormat& format, GLenum target, int width, int height, int levels = 1) {
+    if(GLEW_VERSION_4_2 || GLEW_ARB_texture_storage) {
+        glTexStorage2D(target, levels, format.internalFormat, width, height);
+        return;
+    }
+    for(int level = 0; level < levels; level++) {
+        int levelWidth = std::max(1, width >> level);
+        int levelHeight = std::max(1, height >> level);
+        if(target == GL_TEXTURE_CUBE_MAP) {
+            for(int face = 0; face < 6; face++)
+                glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, format.internalFormat, levelWidth,
+                             levelHeight, 0, format.format, format.type, nullptr);
+        }
+        else {
+            glTexImage2D(target, level, format.internalFormat, levelWidth, levelHeight, 0, format.format,
+                         format.type, nullptr);
+        }
+    }
+}
+
+/**
+ * First virtual page size of sparse cube maps of internalFormat, false if
+ * the format can't be sparse
+ */
+static bool sparsePageSize(GLenum internalFormat, int& width, int& height) {
+    GLint sizes = 0;
+    glGetInternalformativ(GL_TEXTURE_CUBE_MAP, internalFormat, GL_NUM_VIRTUAL_PAGE_SIZES_ARB, 1, &sizes);
+    if(sizes <= 0)
+        return false;
+    GLint x = 0, y = 0;
+    glGetInternalformativ(GL_TEXTURE_CUBE_MAP, internalFormat, GL_VIRTUAL_PAGE_SIZE_X_ARB, 1, &x);
+    glGetInternalformativ(GL_TEXTURE_CUBE_MAP, internalFormat, GL_VIRTUAL_PAGE_SIZE_Y_ARB, 1, &y);
+    width = x;
+    height = y;
+    return x > 0 && y > 0;
+}
+
+/**
+ * Commits or frees the pages of a rectangle of one face of a sparse cube
+ * map
+ */
+static void commitCubeMapPages(GLuint texture, int face, int x0, int y0, int x1, int y1, bool commit) {
+    if(x1 <= x0 || y1 <= y0)
+        return;
+    glState().bindTexture(0, GL_TEXTURE_CUBE_MAP, texture);
+    glTexPageCommitmentARB(GL_TEXTURE_CUBE_MAP, 0, x0, y0, face, x1 - x0, y1 - y0, 1, commit ? GL_TRUE : GL_FALSE);
+}
+
+/**
+ * Allocates the bound GL_TEXTURE_2D_MULTISAMPLE texture
+ */
+static void allocateMultisampleTexture(const TextureFormat& format, int width, int height, int samples) {
+    if(GLEW_VERSION_4_3 || GLEW_ARB_texture_storage_multisample)
+        glTexStorage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, samples, format.internalFormat, width, height, GL_TRUE);
+    else
+        glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, samples, format.internalFormat, width, height, GL_TRUE);
+}
+
+/**
+ * Levels of a full mip chain down to 1x1
+ */
+static int mipLevelCount(int width, int height) {
+    int levels = 1;
+    while((std::max(width, height) >> levels) > 0)
+        levels++;
+    return levels;
+}
+
+/**
+ * Bytes per texel of the internal formats arp allocates
+ */
+static int formatBytes(GLenum internalFormat) {
+    switch(internalFormat) {
+    case GL_DEPTH_COMPONENT16:
+        return 2;
+    case GL_RG16F:
+    case GL_RGBA8:
+    case GL_SRGB8_ALPHA8:
+    case GL_RGB10_A2:
+    case GL_R11F_G11F_B10F:
+    case GL_DEPTH_COMPONENT24:
+    case GL_DEPTH_COMPONENT32F:
+    case GL_DEPTH24_STENCIL8:
+    case GL_R32UI:
+        return 4;
+    case GL_RGBA16F:
+    case GL_RG32F:
+        return 8;
+    case GL_RGBA32F:
+        return 16;
+    default:
+        return 4;
+    }
+}
+
+static std::int64_t textureBytes(GLenum internalFormat, int width, int height) {
+    return (std::int64_t)formatBytes(internalFormat) * width * height;
+}
+
+static std::int64_t mipChainBytes(GLenum internalFormat, int width, int height, int levels) {
+    std::int64_t bytes = 0;
+    for(int level = 0; level < levels; level++)
+        bytes += textureBytes(internalFormat, std::max(1, width >> level), std::max(1, height >> level));
+    return bytes;
+}
+
+Swapchain::Swapchain(int width, int height, int numImages)
+  : Swapchain(SwapchainCreateInfo{ width, height, numImages })
+{
+}
+
+Swapchain::Swapchain(const SwapchainCreateInfo& createInfo)
+  : Swapchain(createInfo, nullptr)
+{
+}
+
+Swapchain::Swapchain(const SwapchainCreateInfo& createInfo, const SwapchainImportedImage* importedImages)
+  : index(0),
+    imported(importedImages != nullptr),
+    acquiredStatus(createInfo.numImages),
+    fbos(createInfo.numImages),
+    imageWidths(createInfo.numImages),
+    imageHeights(createInfo.numImages),
+    imageEpochs(createInfo.numImages),
+    mipmapSubmissions(createInfo.numImages),
+    resolvedSubmissions(createInfo.numImages),
+    pendingWidth(createInfo.width),
+    pendingHeight(createInfo.height),
+    epoch(0),
+    committedRegions(createInfo.numImages),
+    activeImages(createInfo.numImages),
+    minImages(createInfo.numImages),
+    width(createInfo.width),
+    height(createInfo.height),
+    numImages(createInfo.numImages),
+    colorFormat(createInfo.colorFormat),
+    depthFormat(createInfo.depthFormat),
+    velocityFormat(createInfo.imageType == IMAGE_TYPE_CUBE_MAP ? VELOCITY_FORMAT_NONE : createInfo.velocityFormat),
+    materialFormat(createInfo.imageType == IMAGE_TYPE_CUBE_MAP ? MATERIAL_FORMAT_NONE : createInfo.materialFormat),
+    presentMode(createInfo.presentMode),
+    imageType(createInfo.imageType),
+    mipmapped(createInfo.mipmaps && importedImages == nullptr),
+    samples(createInfo.imageType == IMAGE_TYPE_CUBE_MAP || importedImages ? 1 : std::max(createInfo.samples, 1)),
+    sparse(createInfo.sparse && createInfo.imageType == IMAGE_TYPE_CUBE_MAP && !createInfo.mipmaps
+           && importedImages == nullptr),
+    images(createInfo.numImages),
+    depthImages(createInfo.depthFormat != DEPTH_FORMAT_NONE ? createInfo.numImages : 0),
+    velocityImages(velocityFormat != VELOCITY_FORMAT_NONE ? createInfo.numImages : 0),
+    materialImages(materialFormat != MATERIAL_FORMAT_NONE ? createInfo.numImages : 0)
+{
+    if(!initialized) {
+        std::cout << "Error: Attempting to create swapchain before initialization!" << std::endl;
+        return;
+    }
+
+    for(int i = 0; i < numImages; i++) {
+        acquiredStatus[i] = 0;
+    }
+    if(createInfo.minImages > 0 && !imported) {
+        minImages = std::max(2, std::min(createInfo.minImages, numImages));
+        activeImages = minImages;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(warmUpFormatsMutex);
+        auto format = std::make_pair(colorFormat, depthFormat);
+        if(std::find(warmUpFormats.begin(), warmUpFormats.end(), format) == warmUpFormats.end())
+            warmUpFormats.push_back(format);
+    }
+
+    if(velocityFormat != createInfo.velocityFormat)
+        std::cout << "Error: cube map swapchains can't have velocity images, creating it without" << std::endl;
+    if(materialFormat != createInfo.materialFormat)
+        std::cout << "Error: cube map swapchains can't have material images, creating it without" << std::endl;
+    if(samples != std::max(createInfo.samples, 1))
+        std::cout << "Error: cube map and imported swapchains can't be multisampled, creating it without" << std::endl;
+    if(samples > 1) {
+        GLint colorSamples, depthSamples;
+        glGetIntegerv(GL_MAX_COLOR_TEXTURE_SAMPLES, &colorSamples);
+        glGetIntegerv(GL_MAX_DEPTH_TEXTURE_SAMPLES, &depthSamples);
+        int supported = std::min(std::min(colorSamples, depthSamples), maxSwapchainSamples);
+        if(samples > supported) {
+            std::cout << "Swapchain: " << samples << " samples aren't supported, using " << supported << std::endl;
+            samples = supported;
+        }
+    }
+    if(samples > 1) {
+        multisampleImages.resize(numImages);
+        multisampleDepthImages.resize(depthImages.size());
+        multisampleVelocityImages.resize(velocityImages.size());
+        multisampleMaterialImages.resize(materialImages.size());
+    }
+
+    if(sparse && (!GLEW_ARB_sparse_texture || !(GLEW_VERSION_4_2 || GLEW_ARB_texture_storage)
+                  || !sparsePageSize(colorFormats[colorFormat].internalFormat, pageWidth, pageHeight))) {
+        std::cout << "Swapchain: sparse textures aren't supported, creating it without" << std::endl;
+        sparse = false;
+        pageWidth = 0;
+        pageHeight = 0;
+    }
+    // depth pages are committed with the color ones, so theirs have to fit
+    // in the same page grid. Page sizes are powers of two
+    int depthPageWidth, depthPageHeight;
+    if(sparse && hasDepth()
+       && sparsePageSize(depthFormats[depthFormat].internalFormat, depthPageWidth, depthPageHeight)) {
+        pageWidth = std::max(pageWidth, depthPageWidth);
+        pageHeight = std::max(pageHeight, depthPageHeight);
+        sparseDepth = true;
+    }
+
+    // cube map faces are square
+    if(isCubeMap()) {
+        height = width;
+        pendingHeight = width;
+    }
+
+    for(GLFramebuffer& fbo : fbos)
+        fbo = GLFramebuffer::create();
+    if(!imported) {
+        for(int i = 0; i < activeImages; i++)
+            createImage(i, width, height);
+        return;
+    }
+    for(int i = 0; i < numImages; i++) {
+        imageWidths[i] = width;
+        imageHeights[i] = height;
+        images[i] = importedImages[i].color;
+        if(hasDepth())
+            depthImages[i] = importedImages[i].depth;
+        if(hasVelocity())
+            velocityImages[i] = importedImages[i].velocity;
+        if(hasMaterial())
+            materialImages[i] = importedImages[i].material;
+        setUpImage(i);
+    }
+}
+
+Swapchain::~Swapchain() {
+    for(int i = 0; i < activeImages; i++)
+        deleteImage(i);
+}
+
+/**
+ * Allocates the color, depth and velocity textures of image i
+ */
+void Swapchain::createImage(int i, int imageWidth, int imageHeight) {
+    // sparse faces are whole pages
+    if(sparse) {
+        int page = std::max(pageWidth, pageHeight);
+        imageWidth = (imageWidth + page - 1) / page * page;
+    }
+    if(isCubeMap())
+        imageHeight = imageWidth;
+    imageWidths[i] = imageWidth;
+    imageHeights[i] = imageHeight;
+    GLenum target = isCubeMap() ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+
+    glGenTextures(1, &images[i]);
+    glState().bindTexture(0, target, images[i]);
+    // sparse textures start with no page committed
+    if(sparse)
+        glTexParameteri(target, GL_TEXTURE_SPARSE_ARB, GL_TRUE);
+    allocateTexture(colorFormats[colorFormat], target, imageWidth, imageHeight,
+                    mipmapped ? mipLevelCount(imageWidth, imageHeight) : 1);
+    mipmapSubmissions[i] = 0;
+    committedRegions[i] = CubeMapRegions();
+    if(hasDepth()) {
+        glGenTextures(1, &depthImages[i]);
+        glState().bindTexture(0, target, depthImages[i]);
+        if(sparseDepth)
+            glTexParameteri(target, GL_TEXTURE_SPARSE_ARB, GL_TRUE);
+        allocateTexture(depthFormats[depthFormat], target, imageWidth, imageHeight);
+    }
+    if(hasVelocity()) {
+        glGenTextures(1, &velocityImages[i]);
+        glState().bindTexture(0, GL_TEXTURE_2D, velocityImages[i]);
+        allocateTexture(velocityFormats[velocityFormat], GL_TEXTURE_2D, imageWidth, imageHeight);
+    }
+    if(hasMaterial()) {
+        glGenTextures(1, &materialImages[i]);
+        glState().bindTexture(0, GL_TEXTURE_2D, materialImages[i]);
+        allocateTexture(materialFormats[materialFormat], GL_TEXTURE_2D, imageWidth, imageHeight);
+    }
+    if(samples > 1) {
+        resolvedSubmissions[i] = 0;
+        glGenTextures(1, &multisampleImages[i]);
+        glState().bindTexture(0, GL_TEXTURE_2D_MULTISAMPLE, multisampleImages[i]);
+        allocateMultisampleTexture(colorFormats[colorFormat], imageWidth, imageHeight, samples);
+        if(hasDepth()) {
+            glGenTextures(1, &multisampleDepthImages[i]);
+            glState().bindTexture(0, GL_TEXTURE_2D_MULTISAMPLE, multisampleDepthImages[i]);
+            allocateMultisampleTexture(depthFormats[depthFormat], imageWidth, imageHeight, samples);
+        }
+        if(hasVelocity()) {
+            glGenTextures(1, &multisampleVelocityImages[i]);
+            glState().bindTexture(0, GL_TEXTURE_2D_MULTISAMPLE, multisampleVelocityImages[i]);
+            allocateMultisampleTexture(velocityFormats[velocityFormat], imageWidth, imageHeight, samples);
+        }
+        if(hasMaterial()) {
+            glGenTextures(1, &multisampleMaterialImages[i]);
+            glState().bindTexture(0, GL_TEXTURE_2D_MULTISAMPLE, multisampleMaterialImages[i]);
+            allocateMultisampleTexture(materialFormats[materialFormat], imageWidth, imageHeight, samples);
+        }
+    }
+    setUpImage(i);
+    trackGpuMemory(GPU_MEMORY_SWAPCHAINS, imageBytes(i));
+}
+
+/**
+ * Memory of image i's textures
+ */
+std::int64_t Swapchain::imageBytes(int i) const {
+    int faces = isCubeMap() ? 6 : 1;
+    // sparse faces only hold their committed pages
+    if(sparse) {
+        std::int64_t pixels = 0;
+        for(int face = 0; face < 6; face++) {
+            if(!committedRegions[i].isEmpty(face))
+                pixels += (std::int64_t)committedRegions[i].rects[face][2] * committedRegions[i].rects[face][3];
+        }
+        std::int64_t bytes = formatBytes(colorFormats[colorFormat].internalFormat) * pixels;
+        if(hasDepth() && sparseDepth)
+            bytes += formatBytes(depthFormats[depthFormat].internalFormat) * pixels;
+        else if(hasDepth())
+            bytes += textureBytes(depthFormats[depthFormat].internalFormat, imageWidths[i], imageHeights[i]) * faces;
+        return bytes;
+    }
+    int levels = mipmapped ? mipLevelCount(imageWidths[i], imageHeights[i]) : 1;
+    std::int64_t bytes = mipChainBytes(colorFormats[colorFormat].internalFormat, imageWidths[i], imageHeights[i],
+                                       levels) * faces;
+    if(hasDepth())
+        bytes += textureBytes(depthFormats[depthFormat].internalFormat, imageWidths[i], imageHeights[i]) * faces;
+    if(hasVelocity())
+        bytes += textureBytes(velocityFormats[velocityFormat].internalFormat, imageWidths[i], imageHeights[i]);
+    if(hasMaterial())
+        bytes += textureBytes(materialFormats[materialFormat].internalFormat, imageWidths[i], imageHeights[i]);
+    if(samples > 1) {
+        std::int64_t multisampleBytes = textureBytes(colorFormats[colorFormat].internalFormat, imageWidths[i],
+                                                     imageHeights[i]);
+        if(hasDepth())
+            multisampleBytes += textureBytes(depthFormats[depthFormat].internalFormat, imageWidths[i], imageHeights[i]);
+        if(hasVelocity())
+            multisampleBytes += textureBytes(velocityFormats[velocityFormat].internalFormat, imageWidths[i],
+                                             imageHeights[i]);
+        if(hasMaterial())
+            multisampleBytes += textureBytes(materialFormats[materialFormat].internalFormat, imageWidths[i],
+                                             imageHeights[i]);
+        bytes += multisampleBytes * samples;
+    }
+    return bytes;
+}
+
+/**
+ * Sets the sampling of image i's textures and attaches them to its
+ * framebuffer
+ */
+void Swapchain::setUpImage(int i) {
+    GLenum target = isCubeMap() ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+    // cube maps are attached one face at a time, starting with the first
+    GLenum attachTarget = isCubeMap() ? GL_TEXTURE_CUBE_MAP_POSITIVE_X : GL_TEXTURE_2D;
+
+    glState().bindTexture(0, target, images[i]);
+    if(mipmapped) {
+        glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, mipLevelCount(imageWidths[i], imageHeights[i]) - 1);
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    }
+    else {
+        glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    }
+    glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    if(colorFormat == COLOR_FORMAT_SRGB8_ALPHA8 && GLEW_EXT_texture_sRGB_decode)
+        glTexParameteri(target, GL_TEXTURE_SRGB_DECODE_EXT, GL_SKIP_DECODE_EXT);
+
+    if(hasDepth()) {
+        glState().bindTexture(0, target, depthImages[i]);
+        glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        // an imported shadow map style texture would return comparisons
+        glTexParameteri(target, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+    }
+
+    if(hasVelocity()) {
+        glState().bindTexture(0, GL_TEXTURE_2D, velocityImages[i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+
+    // normals of different surfaces don't filter into anything meaningful
+    if(hasMaterial()) {
+        glState().bindTexture(0, GL_TEXTURE_2D, materialImages[i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+
+    GLuint originalFramebuffer;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, (GLint*)&originalFramebuffer);
+
+    // the app renders into the multisampled textures, reprojection reads
+    // the others once it has resolved them
+    bool multisampled = samples > 1;
+    if(multisampled)
+        attachTarget = GL_TEXTURE_2D_MULTISAMPLE;
+    glState().bindFramebuffer(GL_DRAW_FRAMEBUFFER, fbos[i].get());
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, attachTarget,
+                           multisampled ? multisampleImages[i] : images[i], 0);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, attachTarget,
+                           !hasDepth() ? 0 : multisampled ? multisampleDepthImages[i] : depthImages[i], 0);
+    if(hasVelocity()) {
+        // fragment output 1 of the app's shaders writes the velocity
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, multisampled ? attachTarget : GL_TEXTURE_2D,
+                               multisampled ? multisampleVelocityImages[i] : velocityImages[i], 0);
+    }
+    if(hasMaterial()) {
+        // and output 2 the material
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, multisampled ? attachTarget : GL_TEXTURE_2D,
+                               multisampled ? multisampleMaterialImages[i] : materialImages[i], 0);
+    }
+    if(hasVelocity() || hasMaterial()) {
+        GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, (GLenum)(hasVelocity() ? GL_COLOR_ATTACHMENT1 : GL_NONE),
+                                 GL_COLOR_ATTACHMENT2 };
+        glDrawBuffers(hasMaterial() ? 3 : 2, drawBuffers);
+    }
+    if(glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cout << "Creating swapchain: Framebuffer incomplete! ";
+        std::cout << glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) << std::endl;
+    }
+
+    glState().bindFramebuffer(GL_DRAW_FRAMEBUFFER, originalFramebuffer);
+}
+
+void Swapchain::deleteImage(int i) {
+    // the app deletes imported textures, arp only stops caching them
+    if(imported) {
+        glState().forgetTexture(images[i]);
+        if(hasDepth())
+            glState().forgetTexture(depthImages[i]);
+        if(hasVelocity())
+            glState().forgetTexture(velocityImages[i]);
+        if(hasMaterial())
+            glState().forgetTexture(materialImages[i]);
+        return;
+    }
+    trackGpuMemory(GPU_MEMORY_SWAPCHAINS, -imageBytes(i));
+    glState().forgetTexture(images[i]);
+    glDeleteTextures(1, &images[i]);
+    images[i] = 0;
+    if(hasDepth()) {
+        glState().forgetTexture(depthImages[i]);
+        glDeleteTextures(1, &depthImages[i]);
+        depthImages[i] = 0;
+    }
+    if(hasVelocity()) {
+        glState().forgetTexture(velocityImages[i]);
+        glDeleteTextures(1, &velocityImages[i]);
+        velocityImages[i] = 0;
+    }
+    if(hasMaterial()) {
+        glState().forgetTexture(materialImages[i]);
+        glDeleteTextures(1, &materialImages[i]);
+        materialImages[i] = 0;
+    }
+    // multisampled textures are never cached
+    if(samples > 1) {
+        glDeleteTextures(1, &multisampleImages[i]);
+        multisampleImages[i] = 0;
+        if(hasDepth()) {
+            glDeleteTextures(1, &multisampleDepthImages[i]);
+            multisampleDepthImages[i] = 0;
+        }
+        if(hasVelocity()) {
+            glDeleteTextures(1, &multisampleVelocityImages[i]);
+            multisampleVelocityImages[i] = 0;
+        }
+        if(hasMaterial()) {
+            glDeleteTextures(1, &multisampleMaterialImages[i]);
+            multisampleMaterialImages[i] = 0;
+        }
+    }
+}
 
 int Swapchain::acquireImage() {
-    // block until image is not acquired
-    if(acquiredStatus[index]) {
+    return acquire(true, 0);
+}
+
+int Swapchain::acquireImage(double timeout) {
+    return acquire(false, timeout);
+}
+
+int Swapchain::tryAcquireImage() {
+    return acquire(false, 0);
+}
+
+/**
+ * Returns the image acquireImage should hand out next, or -1 if it has to
+ * wait. Called with mutex held
+ */
+int Swapchain::nextFreeImage() const {
+    if(presentMode == PRESENT_MODE_FIFO)
+        return acquiredStatus[index] ? -1 : index;
+
+    // images are released in the order they were submitted, so the first
+    // free one after index is the least recently used
+    for(int offset = 0; offset < activeImages; offset++) {
+        int i = (index + offset) % activeImages;
+        if(!acquiredStatus[i])
+            return i;
+    }
+    return -1;
+}
+
+int Swapchain::acquire(bool wait, double timeout) {
+    beginAppFrameTiming();
+
+    int i;
+    int newWidth, newHeight;
+    uint64_t currentEpoch;
+    // reported once the swapchain is unlocked
+    double jankTime = 0, jankWait = 0;
+    // image added or freed by an adapting swapchain, made once unlocked
+    int grown = -1, shrunk = -1;
+    {
         std::unique_lock<std::mutex> lock(mutex);
-        while(acquiredStatus[index]) {
-            cond.wait(lock);
+        i = nextFreeImage();
+        // rather than wait, an adapting swapchain takes another image
+        if(i < 0 && (wait || timeout > 0) && activeImages < numImages && minImages < numImages) {
+            i = grown = activeImages++;
+            spareAcquires = 0;
+        }
+        if(i < 0 && (wait || timeout > 0)) {
+            ARP_TRACE_SCOPE("acquireImage wait");
+            double waitStart = glfwGetTime();
+            auto deadline = std::chrono::steady_clock::now()
+                            + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                  std::chrono::duration<double>(timeout));
+            while((i = nextFreeImage()) < 0) {
+                if(wait)
+                    cond.wait(lock);
+                else if(cond.wait_until(lock, deadline) == std::cv_status::timeout) {
+                    i = nextFreeImage();
+                    break;
+                }
+            }
+            double waitEnd = glfwGetTime();
+            appSwapchainWait += waitEnd - waitStart;
+            if(jankDetection.enabled && waitEnd - waitStart > jankDetection.maxSwapchainWait) {
+                jankTime = waitEnd;
+                jankWait = waitEnd - waitStart;
+            }
+        }
+        if(i < 0) {
+            lock.unlock();
+            if(jankWait > 0)
+                reportSwapchainWait(jankTime, jankWait);
+            return -1;
+        }
+
+        acquiredStatus[i] = 1;
+        newWidth = pendingWidth;
+        newHeight = pendingHeight;
+        currentEpoch = epoch;
+
+        // an image that was free at every acquire for a while only adds
+        // latency. The last one goes, once nothing holds it
+        if(activeImages > minImages && grown < 0) {
+            bool spare = false;
+            for(int j = 0; j < activeImages; j++)
+                spare = spare || (j != i && !acquiredStatus[j]);
+            spareAcquires = spare ? spareAcquires + 1 : 0;
+            if(spareAcquires >= swapchainShrinkAcquires && i != activeImages - 1
+               && !acquiredStatus[activeImages - 1]) {
+                shrunk = --activeImages;
+                spareAcquires = 0;
+            }
+        }
+    }
+    if(jankWait > 0)
+        reportSwapchainWait(jankTime, jankWait);
+    if(shrunk >= 0)
+        deleteImage(shrunk);
+    index = (i + 1) % activeImages;
+
+    if(grown >= 0) {
+        createImage(i, newWidth, newHeight);
+        imageEpochs[i] = currentEpoch;
+    }
+    // reprojection no longer holds this image, so it can be replaced. Frames
+    // already submitted keep their own images until they are retired
+    if(imageEpochs[i] != currentEpoch) {
+        if(imageWidths[i] != newWidth || imageHeights[i] != newHeight) {
+            deleteImage(i);
+            createImage(i, newWidth, newHeight);
+        }
+        imageEpochs[i] = currentEpoch;
+    }
+    width = imageWidths[i];
+    height = imageHeights[i];
+    return i;
+}
+
+void Swapchain::bindFramebuffer(int index) {
+    glState().bindFramebuffer(GL_FRAMEBUFFER, fbos[index].get());
+}
+
+void Swapchain::bindFramebuffer(int index, int face) {
+    glState().bindFramebuffer(GL_FRAMEBUFFER, fbos[index].get());
+    GLenum target = GL_TEXTURE_CUBE_MAP_POSITIVE_X + face;
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, target, images[index], 0);
+    if(hasDepth())
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, target, depthImages[index], 0);
+}
+
+void Swapchain::commitRegions(int index, CubeMapRegions& regions) {
+    if(!sparse)
+        return;
+    int size = imageWidths[index];
+    for(int face = 0; face < 6; face++) {
+        int* rect = regions.rects[face];
+        int x0 = std::max(rect[0], 0) / pageWidth * pageWidth;
+        int y0 = std::max(rect[1], 0) / pageHeight * pageHeight;
+        int x1 = std::min((rect[0] + rect[2] + pageWidth - 1) / pageWidth * pageWidth, size);
+        int y1 = std::min((rect[1] + rect[3] + pageHeight - 1) / pageHeight * pageHeight, size);
+        if(regions.isEmpty(face) || x1 <= x0 || y1 <= y0)
+            x0 = y0 = x1 = y1 = 0;
+        rect[0] = x0;
+        rect[1] = y0;
+        rect[2] = x1 - x0;
+        rect[3] = y1 - y0;
+    }
+
+    trackGpuMemory(GPU_MEMORY_SWAPCHAINS, -imageBytes(index));
+    CubeMapRegions& committed = committedRegions[index];
+    for(int face = 0; face < 6; face++) {
+        const int* rect = regions.rects[face];
+        const int* old = committed.rects[face];
+        // frees the bands of the old rectangle around the part the new one
+        // keeps, then commits the new one, which leaves pages already
+        // committed alone
+        if(!committed.isEmpty(face)) {
+            int ox0 = old[0], oy0 = old[1], ox1 = old[0] + old[2], oy1 = old[1] + old[3];
+            int ix0 = std::max(ox0, rect[0]), iy0 = std::max(oy0, rect[1]);
+            int ix1 = std::min(ox1, rect[0] + rect[2]), iy1 = std::min(oy1, rect[1] + rect[3]);
+            if(regions.isEmpty(face) || ix1 <= ix0 || iy1 <= iy0) {
+                ix0 = ix1 = ox0;
+                iy0 = iy1 = oy0;
+            }
+            int bands[4][4] = {
+                { ox0, oy0, ox1, iy0 }, { ox0, iy1, ox1, oy1 }, { ox0, iy0, ix0, iy1 }, { ix1, iy0, ox1, iy1 },
+            };
+            for(const int* band : bands) {
+                commitCubeMapPages(images[index], face, band[0], band[1], band[2], band[3], false);
+                if(sparseDepth)
+                    commitCubeMapPages(depthImages[index], face, band[0], band[1], band[2], band[3], false);
+            }
+        }
+        if(!regions.isEmpty(face)) {
+            commitCubeMapPages(images[index], face, rect[0], rect[1], rect[0] + rect[2], rect[1] + rect[3], true);
+            if(sparseDepth)
+                commitCubeMapPages(depthImages[index], face, rect[0], rect[1], rect[0] + rect[2], rect[1] + rect[3],
+                                   true);
+        }
+    }
+    committed = regions;
+    trackGpuMemory(GPU_MEMORY_SWAPCHAINS, imageBytes(index));
+}
+
+void CubeMapRegions::merge(const CubeMapRegions& other) {
+    for(int face = 0; face < 6; face++) {
+        if(other.isEmpty(face))
+            continue;
+        int* rect = rects[face];
+        const int* add = other.rects[face];
+        if(isEmpty(face)) {
+            std::copy(add, add + 4, rect);
+            continue;
+        }
+        int x1 = std::max(rect[0] + rect[2], add[0] + add[2]);
+        int y1 = std::max(rect[1] + rect[3], add[1] + add[3]);
+        rect[0] = std::min(rect[0], add[0]);
+        rect[1] = std::min(rect[1], add[1]);
+        rect[2] = x1 - rect[0];
+        rect[3] = y1 - rect[1];
+    }
+}
+
+bool CubeMapRegions::contains(const CubeMapRegions& other) const {
+    for(int face = 0; face < 6; face++) {
+        if(other.isEmpty(face))
+            continue;
+        const int* rect = rects[face];
+        const int* inner = other.rects[face];
+        if(isEmpty(face) || inner[0] < rect[0] || inner[1] < rect[1] || inner[0] + inner[2] > rect[0] + rect[2]
+           || inner[1] + inner[3] > rect[1] + rect[3])
+            return false;
+    }
+    return true;
+}
+
+glm::quat cubeMapFaceOrientation(int face) {
+    // the usual cube map cameras, whose faces come out upside down as
+    // texture lookups expect
+    static const glm::vec3 forward[6] = {
+        { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 },
+    };
+    static const glm::vec3 up[6] = {
+        { 0, -1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 }, { 0, -1, 0 }, { 0, -1, 0 },
+    };
+    glm::mat3 view = glm::mat3(glm::lookAt(glm::vec3(0), forward[face], up[face]));
+    return glm::quat_cast(glm::transpose(view));
+}
+
+void Swapchain::resize(int newWidth, int newHeight) {
+    if(imported) {
+        std::cout << "Error: imported swapchains can't be resized" << std::endl;
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    pendingWidth = newWidth;
+    pendingHeight = isCubeMap() ? newWidth : newHeight;
+    epoch++;
+}
+
+void Swapchain::retainImage(int i) {
+    std::lock_guard<std::mutex> lock(mutex);
+    acquiredStatus[i]++;
+}
+
+void Swapchain::releaseImage(int i) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(--acquiredStatus[i] == 0)
+        cond.notify_all();
+}
+
+void Swapchain::generateMipmaps(int i, std::uint64_t submission) {
+    if(!mipmapped || mipmapSubmissions[i] == submission)
+        return;
+    GLenum target = isCubeMap() ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+    glState().bindTexture(0, target, images[i]);
+    glGenerateMipmap(target);
+    mipmapSubmissions[i] = submission;
+}
+
+void Swapchain::resolveSamples(int i, std::uint64_t submission, const LayerProjection& projection) {
+    if(samples == 1 || resolvedSubmissions[i] == submission)
+        return;
+    ARP_TRACE_GPU_SCOPE("resolveSamples");
+    GLint originalFramebuffer;
+    GLint originalViewport[4];
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &originalFramebuffer);
+    glGetIntegerv(GL_VIEWPORT, originalViewport);
+
+    glState().bindFramebuffer(GL_DRAW_FRAMEBUFFER, multisampleResolveFbo);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, images[i], 0);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D,
+                           hasVelocity() ? velocityImages[i] : 0, 0);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D,
+                           hasMaterial() ? materialImages[i] : 0, 0);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
+                           hasDepth() ? depthImages[i] : 0, 0);
+    GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, (GLenum)(hasVelocity() ? GL_COLOR_ATTACHMENT1 : GL_NONE),
+                             GL_COLOR_ATTACHMENT2 };
+    glDrawBuffers(hasMaterial() ? 3 : 2, drawBuffers);
+    glState().viewport(0, 0, imageWidths[i], imageHeights[i]);
+
+    glState().useProgram(multisampleResolveProgram);
+    glUniform1i(multisampleSamplesLoc, samples);
+    glUniform1i(multisampleHasDepthLoc, hasDepth());
+    glUniform1i(multisampleHasVelocityLoc, hasVelocity());
+    glUniform1i(multisampleHasMaterialLoc, hasMaterial());
+    glUniform1i(multisampleEncodeSrgbLoc, colorFormat == COLOR_FORMAT_SRGB8_ALPHA8);
+    setDepthMapping(multisampleDepthMappingLoc, multisampleDepthRangeLoc, projection);
+    glState().bindTexture(0, GL_TEXTURE_2D_MULTISAMPLE, multisampleImages[i]);
+    if(hasDepth())
+        glState().bindTexture(1, GL_TEXTURE_2D_MULTISAMPLE, multisampleDepthImages[i]);
+    if(hasVelocity())
+        glState().bindTexture(2, GL_TEXTURE_2D_MULTISAMPLE, multisampleVelocityImages[i]);
+    if(hasMaterial())
+        glState().bindTexture(3, GL_TEXTURE_2D_MULTISAMPLE, multisampleMaterialImages[i]);
+
+    // the resolved depth is written whatever was there
+    glState().setEnabled(GL_DEPTH_TEST, true);
+    glDepthFunc(GL_ALWAYS);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glDepthFunc(GL_LESS);
+    glState().setEnabled(GL_DEPTH_TEST, false);
+
+    glState().bindFramebuffer(GL_DRAW_FRAMEBUFFER, originalFramebuffer);
+    glState().viewport(originalViewport[0], originalViewport[1], originalViewport[2], originalViewport[3]);
+    resolvedSubmissions[i] = submission;
+}
+
+int LayerScheduler::addLayer(double rate) {
+    intervals.push_back(0);
+    nextTimes.push_back(-INFINITY);
+    setRate((int)intervals.size() - 1, rate);
+    return (int)intervals.size() - 1;
+}
+
+void LayerScheduler::setRate(int layer, double rate) {
+    intervals[layer] = rate > 0 ? 1.0 / rate : 0;
+}
+
+bool LayerScheduler::isDue(int layer, double displayTime) const {
+    // the same tolerance as vblank snapping, so a 30 Hz layer on a 60 Hz
+    // display is due on every other frame despite jitter
+    return displayTime >= nextTimes[layer] - 0.05 * intervals[layer];
+}
+
+void LayerScheduler::markSubmitted(int layer, double displayTime) {
+    double next = nextTimes[layer] + intervals[layer];
+    // keep the cadence unless the layer fell more than an interval behind
+    if(next < displayTime || next > displayTime + intervals[layer])
+        next = displayTime + intervals[layer];
+    nextTimes[layer] = next;
+}
+
+void LayerScheduler::invalidate(int layer) {
+    nextTimes[layer] = -INFINITY;
+}
+
+// share of the budget the scaler aims for, leaving room for spikes
+static const double resolutionHeadroom = 0.9;
+// the scale only grows below this share, so it doesn't oscillate
+static const double resolutionGrowThreshold = 0.75;
+// most the scale grows by per frame
+static const double resolutionGrowStep = 1.05;
+// scales are multiples of this, so the viewport doesn't change every frame
+static const double resolutionScaleStep = 1.0 / 64;
+
+ResolutionScaler::ResolutionScaler(double minScale, double maxScale)
+    : minScale(minScale), maxScale(maxScale), scale(maxScale) {}
+
+double ResolutionScaler::update(double gpuTime, double budget) {
+    if(gpuTime <= 0 || budget <= 0)
+        return scale;
+
+    // pixels, and so GPU time, go with the square of the scale
+    double target = budget * resolutionHeadroom;
+    double ideal = scale * std::sqrt(target / gpuTime);
+    double next = scale;
+    if(gpuTime > target)
+        next = std::floor(ideal / resolutionScaleStep) * resolutionScaleStep;
+    else if(gpuTime < budget * resolutionGrowThreshold)
+        next = std::max(scale, std::floor(std::min(ideal, scale * resolutionGrowStep) / resolutionScaleStep)
+                               * resolutionScaleStep);
+    scale = std::min(std::max(next, minScale), maxScale);
+    return scale;
+}
+
+void ResolutionScaler::getViewport(int width, int height, int viewport[4]) const {
+    viewport[0] = 0;
+    viewport[1] = 0;
+    viewport[2] = std::max(1, (int)std::lround(width * scale));
+    viewport[3] = std::max(1, (int)std::lround(height * scale));
+}
+
+DepthSplit::DepthSplit(double travel, double pixels)
+    : travel(travel), pixels(pixels) {}
+
+float DepthSplit::update(const LayerProjection& projection, int height) {
+    // a point at distance d seen from travel to the side moves by about
+    // travel / d radians, and the bounds are tangents at unit distance
+    double pixelsPerRadian = height / (projection.top - projection.bottom);
+    float split = (float)(travel * pixelsPerRadian / pixels);
+    split = std::min(std::max(split, projection.nearPlane), projection.farPlane);
+    if(split != distance)
+        farRendered = false;
+    distance = split;
+    return distance;
+}
+
+LayerProjection DepthSplit::nearProjection(const LayerProjection& projection) const {
+    LayerProjection result = projection;
+    result.farPlane = distance;
+    return result;
+}
+
+LayerProjection DepthSplit::farProjection(const LayerProjection& projection) const {
+    LayerProjection result = projection;
+    result.nearPlane = distance;
+    return result;
+}
+
+bool DepthSplit::isFarDue(const glm::vec3& position) const {
+    return !farRendered || glm::distance(position, farPosition) > travel;
+}
+
+void DepthSplit::markFarRendered(const glm::vec3& position) {
+    farRendered = true;
+    farPosition = position;
+}
+
+// time the camera's measured speeds take to decay to a third
+static const double framerateSpeedDecay = 0.5;
+// fraction of the frame period the GPU time may fill
+static const double framerateGpuHeadroom = 0.9;
+// fraction of wrong pixels above which disocclusion raises the rate
+static const double framerateDisocclusionTarget = 0.01;
+
+FramerateController::FramerateController(double depth, double pixels, double turnPixels, int minFramerate)
+    : depth(depth), pixels(pixels), turnPixels(turnPixels), minFramerate(minFramerate), framerate(minFramerate) {}
+
+int FramerateController::update(const Pose& pose, double time, const LayerProjection& projection, int height,
+                                double gpuTime, int maxFramerate, double disocclusion) {
+    double dt = time - lastTime;
+    if(hasPose && dt > 0) {
+        double moved = glm::distance(pose.position, lastPose.position) / dt;
+        double cosHalf = std::min(std::abs((double)glm::dot(pose.orientation, lastPose.orientation)), 1.0);
+        double turned = 2 * std::acos(cosHalf) / dt;
+        double decay = std::exp(-dt / framerateSpeedDecay);
+        speed = std::max(moved, speed * decay);
+        turnSpeed = std::max(turned, turnSpeed * decay);
+    }
+    hasPose = true;
+    lastPose = pose;
+    lastTime = time;
+
+    // a point at depth moves by speed / depth radians a second
+    double pixelsPerRadian = height / (projection.top - projection.bottom);
+    double rate = std::max(speed / depth * pixelsPerRadian / pixels, turnSpeed * pixelsPerRadian / turnPixels);
+    if(disocclusion > framerateDisocclusionTarget)
+        rate = std::max(rate, framerate * disocclusion / framerateDisocclusionTarget);
+    if(gpuTime > 0)
+        rate = std::min(rate, framerateGpuHeadroom / gpuTime);
+    int low = std::min(minFramerate, maxFramerate);
+    framerate = std::min(std::max((int)std::ceil(rate), low), maxFramerate);
+    return framerate;
+}
+
+void hintContextPriority() {
+    glfwWindowHint(GLFW_CONTEXT_PRIORITY, GLFW_PRIORITY_HIGH);
+    contextPriorityRequested = true;
+}
+
+int initialize() {
+    if(!glfwGetCurrentContext()) {
+        std::cout << "Error: cannot initialize ARP with no valid OpenGL context" << std::endl;
+        return -1;
+    }
+    GLenum glewErr = glewInit();
+    if(glewErr != GLEW_OK) {
+        std::cout << "Error initializing GLEW: " << glewErr << std::endl;
+        return -1;
+    }
+    initialized = true;
+    return 0;
+}
+
+void registerPoseFunction(PoseFunction func) {
+    poseFunction = func;
+    contextPoseFunction = nullptr;
+    batchPoseFunction = nullptr;
+}
+
+void registerPoseFunction(ContextPoseFunction func) {
+    contextPoseFunction = func;
+    poseFunction = nullptr;
+    batchPoseFunction = nullptr;
+}
+
+void registerPoseFunction(BatchPoseFunction func) {
+    batchPoseFunction = func;
+    poseFunction = nullptr;
+    contextPoseFunction = nullptr;
+}
+
+/**
+ * The pose function's predictions from window input, as a pose source
+ */
+class InputPoseSource : public PoseSource {
+public:
+    bool getPose(double time, Pose& pose) override {
+        if(!poseFunction && !contextPoseFunction && !batchPoseFunction)
+            return false;
+        PoseQuery query = { time };
+        evaluatePoses(&query, &pose, 1);
+        return true;
+    }
+};
+
+static InputPoseSource inputPoseSource;
+
+void setReferenceSpace(int space, PoseSource* source) {
+    if(space < 0 || space >= MAX_REFERENCE_SPACES) {
+        std::cout << "Error: there is no reference space " << space << std::endl;
+        return;
+    }
+    referenceSpaces[space].store(source, std::memory_order_release);
+}
+
+void setPoseSource(PoseSource* source) {
+    // the loop integrates window input itself, without predicting it
+    poseSource.store(source == &inputPoseSource ? nullptr : source, std::memory_order_release);
+}
+
+PoseSource* getInputPoseSource() {
+    return &inputPoseSource;
+}
+
+// key times of the PoseFunction evaluation running on this thread, which a
+// plain function pointer can't carry
+static thread_local const KeyTime* currentKeyTime = nullptr;
+
+/**
+ * Evaluates the registered pose function with the given key times
+ */
+static Pose evaluatePose(const Pose& lastPose, double dx, double dy, double dt, const KeyTime& keyTime) {
+    ARP_TRACE_SCOPE("pose function");
+    if(contextPoseFunction)
+        return contextPoseFunction(lastPose, dx, dy, dt, keyTime);
+
+    if(batchPoseFunction) {
+        PoseBatch batch;
+        batch.lastPose = lastPose;
+        batch.count = 1;
+        batch.dx = &dx;
+        batch.dy = &dy;
+        batch.dt = &dt;
+        batch.keyTimes = [](const void* context, int key, double* out) {
+            *out = (*(const KeyTime*)context)(key);
+        };
+        batch.context = &keyTime;
+        Pose pose;
+        batchPoseFunction(batch, &pose);
+        return pose;
+    }
+
+    const KeyTime* outer = currentKeyTime;
+    currentKeyTime = &keyTime;
+    Pose pose = poseFunction(lastPose, dx, dy, dt, [](int key) {
+        return (*currentKeyTime)(key);
+    });
+    currentKeyTime = outer;
+    return pose;
+}
+
+/**
+ * Thread the pose function runs on when it has a budget, see
+ * setPoseFunctionBudget. One evaluation runs at a time, a late one keeps it
+ * busy until it returns and its result is dropped
+ */
+struct PoseHelper {
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cond;
+    // the fields below are guarded by mutex
+    bool stopping = false;
+    // set from handing over an evaluation until it has returned
+    bool busy = false;
+    // set when the evaluation handed over last has returned
+    bool done = false;
+    Pose lastPose;
+    double dx = 0;
+    double dy = 0;
+    double dt = 0;
+    // key times as of handing over, input keeps changing the live ones
+    double keyTimes[KEY_COUNT];
+    Pose result;
+};
+
+static PoseHelper poseHelper;
+
+static void runPoseHelper() {
+    ARP_TRACE_THREAD("pose function");
+    std::unique_lock<std::mutex> lock(poseHelper.mutex);
+    while(true) {
+        poseHelper.cond.wait(lock, []() { return poseHelper.stopping || (poseHelper.busy && !poseHelper.done); });
+        if(poseHelper.stopping)
+            return;
+        Pose lastPose = poseHelper.lastPose;
+        double dx = poseHelper.dx, dy = poseHelper.dy, dt = poseHelper.dt;
+        lock.unlock();
+        KeyTime keyTime = { [](const void*, int key) {
+            return validKey(key) ? poseHelper.keyTimes[key] : 0.0;
+        }, nullptr };
+        Pose pose = evaluatePose(lastPose, dx, dy, dt, keyTime);
+        lock.lock();
+        poseHelper.result = pose;
+        poseHelper.done = true;
+        poseHelper.busy = false;
+        poseHelper.cond.notify_all();
+    }
+}
+
+static void stopPoseHelper() {
+    if(!poseHelper.thread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(poseHelper.mutex);
+        poseHelper.stopping = true;
+    }
+    poseHelper.cond.notify_all();
+    poseHelper.thread.join();
+    poseHelper.stopping = false;
+    poseHelper.busy = false;
+}
+
+/**
+ * Evaluates the pose function on the helper thread, waiting for it until
+ * deadline. Returns false if it hasn't returned by then, or is still busy
+ * with an earlier evaluation that was late
+ */
+static bool evaluatePoseBy(double deadline, const Pose& lastPose, double dx, double dy, double dt, Pose& pose) {
+    if(!poseHelper.thread.joinable())
+        poseHelper.thread = std::thread(runPoseHelper);
+    std::unique_lock<std::mutex> lock(poseHelper.mutex);
+    if(poseHelper.busy)
+        return false;
+    poseHelper.lastPose = lastPose;
+    poseHelper.dx = dx;
+    poseHelper.dy = dy;
+    poseHelper.dt = dt;
+    for(int key = 0; key < KEY_COUNT; key++)
+        poseHelper.keyTimes[key] = keyTimeFunction(key);
+    poseHelper.busy = true;
+    poseHelper.done = false;
+    poseHelper.cond.notify_all();
+    double wait = std::max(deadline - glfwGetTime(), 0.0);
+    if(!poseHelper.cond.wait_for(lock, std::chrono::duration<double>(wait), []() { return poseHelper.done; }))
+        return false;
+    pose = poseHelper.result;
+    return true;
+}
+
+/**
+ * Continues the camera's motion over the last refreshes to time, at most
+ * maxAhead seconds past the newest. False before the first refresh
+ */
+static bool extrapolateCameraPose(double time, double maxAhead, Pose& pose) {
+    PoseSample samples[poseVelocitySamples];
+    int count = cameraPoseHistory.snapshot(samples, poseVelocitySamples);
+    if(count == 0)
+        return false;
+    const PoseSample& newest = samples[count - 1];
+    double ahead = std::min(std::max(time - newest.time, 0.0), maxAhead);
+    pose = extrapolatePose(newest.pose, estimatePoseVelocity(samples, count), ahead);
+    return true;
+}
+
+void setPoseFunctionBudget(double seconds) {
+    poseFunctionBudget = std::max(seconds, 0.0);
+}
+
+void setInputOverride(InputOverrideFunction function) {
+    inputOverride = function;
+}
+
+bool startInputRecording(const char* path) {
+    if(!inputRecording.open(path))
+        return false;
+    recordingInput = true;
+    return true;
+}
+
+void stopInputRecording() {
+    recordingInput = false;
+    inputRecording.close();
+}
+
+bool startCapture(const char* path, const CaptureSettings& settings) {
+    return frameCapture.start(path, settings);
+}
+
+void stopCapture() {
+    frameCapture.stop();
+}
+
+CaptureStats getCaptureStats() {
+    return frameCapture.getStats();
+}
+
+bool startStatsExport(const StatsExportSettings& settings) {
+    std::lock_guard<std::mutex> lock(statsExportMutex);
+    return statsExporter.start(settings, statsCounters);
+}
+
+void stopStatsExport() {
+    std::lock_guard<std::mutex> lock(statsExportMutex);
+    statsExporter.stop();
+}
+
+void setJankDetection(const JankDetection& settings) {
+    jankDetection = settings;
+}
+
+int readJankEvents(JankEvent* events, int max) {
+    int count = 0;
+    while(count < max && jankEvents.pop(events[count]))
+        count++;
+    return count;
+}
+
+std::uint64_t getDroppedJankEvents() {
+    return droppedJankEvents.load(std::memory_order_relaxed);
+}
+
+int readPresentedRefreshes(PresentedRefresh* refreshes, int max, std::uint64_t& position) {
+    return presentedRefreshes.readSince(position, refreshes, max);
+}
+
+static void reportJank(const JankEvent& event) {
+    if(!jankEvents.push(event))
+        droppedJankEvents.fetch_add(1, std::memory_order_relaxed);
+    if(jankDetection.callback)
+        jankDetection.callback(event, jankDetection.userData);
+}
+
+/**
+ * Reports an acquireImage wait with the latest refresh's timings
+ */
+static void reportSwapchainWait(double time, double wait) {
+    JankEvent event = {};
+    event.type = JANK_SWAPCHAIN_WAIT;
+    event.time = time;
+    event.duration = wait;
+    {
+        std::lock_guard<std::mutex> lock(frameStatsMutex);
+        event.poseEvaluationTime = frameStats.poseEvaluationTime;
+        event.reprojectionCpuTime = frameStats.reprojectionCpuTime;
+        event.reprojectionGpuTime = frameStats.reprojectionGpuTime;
+        event.reprojectionGpuDelay = frameStats.reprojectionGpuDelay;
+        event.swapTime = frameStats.swapTime;
+        event.refreshPeriod = frameStats.refreshPeriod;
+    }
+    // reprojection holds on to images until it has drawn them, so it is
+    // behind on the GPU or in the swap
+    bool gpuBehind = event.reprojectionGpuDelay > event.refreshPeriod * 0.25
+                     || event.reprojectionGpuTime > event.refreshPeriod * 0.5;
+    event.cause = gpuBehind ? JANK_CAUSE_GPU_CONTENTION : JANK_CAUSE_SWAP_BLOCKING;
+    reportJank(event);
+}
+
+/**
+ * Cause of a stutter from the timings of the refresh it happened on,
+ * checked in the order they would hold up the refresh
+ */
+static JankCause refreshJankCause(const JankEvent& event, bool latePose) {
+    double period = event.refreshPeriod;
+    if(latePose || event.poseEvaluationTime > period * 0.5)
+        return JANK_CAUSE_LATE_POSE_FUNCTION;
+    if(event.reprojectionGpuDelay > period * 0.25 || event.reprojectionGpuTime > period * 0.5)
+        return JANK_CAUSE_GPU_CONTENTION;
+    if(event.swapTime > period)
+        return JANK_CAUSE_SWAP_BLOCKING;
+    return JANK_CAUSE_UNKNOWN;
+}
+
+bool startInputReplay(const char* path) {
+    if(!inputReplay.load(path))
+        return false;
+    if(inputReplay.refreshes.empty()) {
+        std::cout << "Error: input log " << path << " has no refreshes to replay" << std::endl;
+        return false;
+    }
+    replayingInput = true;
+    replayRefresh = 0;
+    replayEvent = 0;
+    replaySubmit = 0;
+    return true;
+}
+
+void captureCursor() {
+    cursorCaptured = true;
+}
+
+void releaseCursor() {
+    cursorCaptured = false;
+}
+
+void setCursorSprite(const CursorSprite* sprite) {
+    std::lock_guard<std::mutex> lock(cursorSpriteMutex);
+    cursorSpriteVersion++;
+    if(!sprite || sprite->width <= 0 || sprite->height <= 0 || !sprite->pixels) {
+        cursorSpritePixels.clear();
+        cursorSprite = CursorSprite{};
+        cursorSpriteEnabled = false;
+        return;
+    }
+    // GL textures start at the bottom row
+    std::size_t rowSize = (std::size_t)sprite->width * 4;
+    cursorSpritePixels.resize(rowSize * sprite->height);
+    for(int row = 0; row < sprite->height; row++)
+        std::memcpy(&cursorSpritePixels[rowSize * (sprite->height - 1 - row)], sprite->pixels + rowSize * row,
+                    rowSize);
+    cursorSprite = *sprite;
+    cursorSprite.pixels = nullptr;
+    cursorSpriteEnabled = true;
+}
+
+/**
+ * The cursor mode for the main window: disabled while captured, hidden while
+ * reprojection draws the pointer itself
+ */
+static int cursorInputMode() {
+    if(cursorCaptured)
+        return GLFW_CURSOR_DISABLED;
+    return cursorSpriteEnabled ? GLFW_CURSOR_HIDDEN : GLFW_CURSOR_NORMAL;
+}
+
+void setThreadConfig(const ThreadConfig& config) {
+    threadConfig = config;
+}
+
+JobSystem& getJobSystem() {
+    static JobSystem system([]() {
+        JobSystemSettings settings;
+        if(threadConfig.reprojectionCore >= 0)
+            settings.avoidCores.push_back(threadConfig.reprojectionCore);
+        if(threadConfig.appCore >= 0)
+            settings.avoidCores.push_back(threadConfig.appCore);
+        // unpinned, the reprojection and app threads still need cores
+        if(settings.avoidCores.empty())
+            settings.workers = std::max(1, (int)std::thread::hardware_concurrency() - 2);
+        return settings;
+    }());
+    return system;
+}
+
+/**
+ * Applies a thread's part of ThreadConfig to the calling thread and returns
+ * the priority it got
+ */
+static ThreadPriority applyThreadConfig(const char* name, ThreadPriority priority, int core) {
+    ThreadPriority applied = PRIORITY_DEFAULT;
+    if(priority != PRIORITY_DEFAULT) {
+        applied = setCurrentThreadPriority(priority);
+        if(applied != priority)
+            std::cout << "Error: could not raise the " << name << " thread to priority " << priority
+                      << ", running at " << applied << std::endl;
+    }
+    if(core >= 0 && !pinCurrentThread(core))
+        std::cout << "Error: could not pin the " << name << " thread to core " << core << std::endl;
+    return applied;
+}
+
+/**
+ * Reads the GPU priority of a context through EGL_IMG_context_priority. The
+ * requested priority is only a hint, so this reports what the driver gave the
+ * context. Must be called with a context current
+ */
+static ContextPriority queryContextPriority(GLFWwindow* context) {
+    const int EGL_EXTENSIONS = 0x3055;
+    const int EGL_CONTEXT_PRIORITY_LEVEL_IMG = 0x3100;
+    const int EGL_CONTEXT_PRIORITY_HIGH_IMG = 0x3101;
+    const int EGL_CONTEXT_PRIORITY_MEDIUM_IMG = 0x3102;
+    const int EGL_CONTEXT_PRIORITY_LOW_IMG = 0x3103;
+    typedef const char* (*QueryString)(void* display, int name);
+    typedef unsigned int (*QueryContext)(void* display, void* context, int attribute, int* value);
+
+    if(glfwGetWindowAttrib(context, GLFW_CONTEXT_CREATION_API) != GLFW_EGL_CONTEXT_API)
+        return CONTEXT_PRIORITY_UNAVAILABLE;
+    void* display = glfwGetEGLDisplay();
+    void* eglContext = glfwGetEGLContext(context);
+    QueryString queryString = (QueryString)glfwGetProcAddress("eglQueryString");
+    QueryContext queryContext = (QueryContext)glfwGetProcAddress("eglQueryContext");
+    if(!display || !eglContext || !queryString || !queryContext)
+        return CONTEXT_PRIORITY_UNAVAILABLE;
+    const char* extensions = queryString(display, EGL_EXTENSIONS);
+    if(!extensions || !std::strstr(extensions, "EGL_IMG_context_priority"))
+        return CONTEXT_PRIORITY_UNAVAILABLE;
+
+    int level = 0;
+    if(!queryContext(display, eglContext, EGL_CONTEXT_PRIORITY_LEVEL_IMG, &level))
+        return CONTEXT_PRIORITY_UNAVAILABLE;
+    switch(level) {
+        case EGL_CONTEXT_PRIORITY_HIGH_IMG: return CONTEXT_PRIORITY_HIGH;
+        case EGL_CONTEXT_PRIORITY_MEDIUM_IMG: return CONTEXT_PRIORITY_MEDIUM;
+        case EGL_CONTEXT_PRIORITY_LOW_IMG: return CONTEXT_PRIORITY_LOW;
+        default: return CONTEXT_PRIORITY_UNAVAILABLE;
+    }
+}
+
+void setIdleDetection(bool enabled) {
+    idleDetection = enabled;
+}
+
+void setAdaptiveVsync(bool enabled) {
+    adaptiveVsync = enabled;
+}
+
+bool isAdaptiveVsyncSupported() {
+    return adaptiveVsyncSupported;
+}
+
+void setVariableRefresh(bool enabled, double minRefreshRate) {
+    if(minRefreshRate > 0)
+        variableRefreshMinRate = minRefreshRate;
+    variableRefresh = enabled;
+}
+
+/**
+ * The monitor showing most of the window, which decides its refresh rate
+ */
+static GLFWmonitor* getWindowMonitor() {
+    GLFWmonitor* fullscreen = glfwGetWindowMonitor(window);
+    if(fullscreen)
+        return fullscreen;
+    int x, y, width, height;
+    glfwGetWindowPos(window, &x, &y);
+    glfwGetWindowSize(window, &width, &height);
+    int count;
+    GLFWmonitor** monitors = glfwGetMonitors(&count);
+    GLFWmonitor* best = glfwGetPrimaryMonitor();
+    long bestArea = 0;
+    for(int i = 0; i < count; i++) {
+        const GLFWvidmode* mode = glfwGetVideoMode(monitors[i]);
+        if(!mode)
+            continue;
+        int monitorX, monitorY;
+        glfwGetMonitorPos(monitors[i], &monitorX, &monitorY);
+        long overlapX = std::min(x + width, monitorX + mode->width) - std::max(x, monitorX);
+        long overlapY = std::min(y + height, monitorY + mode->height) - std::max(y, monitorY);
+        if(overlapX > 0 && overlapY > 0 && overlapX * overlapY > bestArea) {
+            best = monitors[i];
+            bestArea = overlapX * overlapY;
+        }
+    }
+    return best;
+}
+
+/**
+ * Refresh interval of the monitor the window is on, 0 if it has none. Main
+ * thread only
+ */
+static double queryMonitorInterval() {
+    GLFWmonitor* monitor = getWindowMonitor();
+    const GLFWvidmode* videoMode = monitor ? glfwGetVideoMode(monitor) : nullptr;
+    if(!videoMode || videoMode->refreshRate <= 0)
+        return 0;
+    return 1.0 / videoMode->refreshRate;
+}
+
+/**
+ * Takes the refresh rate of the monitor the window is on, restarting the
+ * refresh fit when it changed. With a render thread, the rate the event
+ * thread last found
+ */
+static void followMonitor() {
+    monitorCheckPending = false;
+    if(headless.enabled)
+        return;
+    double interval = renderThreadEnabled ? monitorInterval.load() : queryMonitorInterval();
+    if(interval <= 0 || std::abs(interval - refreshInterval) < 1e-6)
+        return;
+    refreshInterval = interval;
+    refreshClock.reset(interval);
+
+    std::lock_guard<std::mutex> lock(displayTimingMutex);
+    displayRefresh = { lastSwapTime, interval };
+    displayLatchLead = interval;
+}
+
+void setHeadless(const HeadlessOutput& output) {
+    headless = output;
+    headless.width = std::max(headless.width, 1);
+    headless.height = std::max(headless.height, 1);
+    if(headless.refreshRate <= 0)
+        headless.refreshRate = 60;
+}
+
+/**
+ * Size of what reprojection presents, the window's framebuffer or the
+ * headless target
+ */
+static void getOutputSize(int& width, int& height) {
+    if(headless.enabled) {
+        width = headless.width;
+        height = headless.height;
+    }
+    else {
+        width = framebufferWidth.load(std::memory_order_relaxed);
+        height = framebufferHeight.load(std::memory_order_relaxed);
+    }
+}
+
+/**
+ * Framebuffer size of an output window. With a render thread, the size the
+ * event thread last read
+ */
+static void getOutputWindowSize(OutputWindow& output, int& width, int& height) {
+    if(!renderThreadEnabled) {
+        glfwGetFramebufferSize(output.window, &width, &height);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(outputWindowsMutex);
+    width = output.width;
+    height = output.height;
+}
+
+static GLuint outputFramebuffer() {
+    return headless.enabled ? headlessTarget.fbo : 0;
+}
+
+/**
+ * Creates an RGBA8 color texture and depth stencil renderbuffer of the given
+ * size and a framebuffer drawing to them
+ */
+static void createOffscreenTarget(OffscreenTarget& target, int width, int height) {
+    glGenTextures(1, &target.color);
+    glState().bindTexture(0, GL_TEXTURE_2D, target.color);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glGenRenderbuffers(1, &target.depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, target.depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &target.fbo);
+    glState().bindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target.color, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, target.depth);
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cout << "Error: offscreen target incomplete" << std::endl;
+    target.width = width;
+    target.height = height;
+}
+
+static void deleteOffscreenTarget(OffscreenTarget& target) {
+    glState().forgetFramebuffer(target.fbo);
+    glDeleteFramebuffers(1, &target.fbo);
+    glState().forgetTexture(target.color);
+    glDeleteTextures(1, &target.color);
+    glDeleteRenderbuffers(1, &target.depth);
+    target = OffscreenTarget();
+}
+
+int addOutputWindow(GLFWwindow* outputWindow, const OutputView& view) {
+    if(!outputWindow) {
+        std::cout << "Error: no output window given" << std::endl;
+        return -1;
+    }
+    std::lock_guard<std::mutex> lock(outputWindowsMutex);
+    OutputWindow output;
+    output.window = outputWindow;
+    output.view = view;
+    outputWindows.push_back(output);
+    return (int)outputWindows.size() - 1;
+}
+
+void setOutputView(int index, const OutputView& view) {
+    std::lock_guard<std::mutex> lock(outputWindowsMutex);
+    if(index < 0 || index >= (int)outputWindows.size())
+        return;
+    outputWindows[index].view = view;
+}
+
+/**
+ * Reprojects the frame for every output window into its target, at the
+ * size of the main output so intermediate targets sized by the viewport
+ * aren't reallocated between them. The presented images are scaled to the
+ * windows. Leaves the main output bound
+ */
+static void drawOutputWindows() {
+    if(outputWindows.empty())
+        return;
+    ARP_TRACE_GPU_SCOPE("drawOutputWindows");
+    int width, height;
+    getOutputSize(width, height);
+    if(width <= 0 || height <= 0)
+        return;
+    GLint viewport[4];
+    if(!glState().getViewport(viewport))
+        glGetIntegerv(GL_VIEWPORT, viewport);
+    Pose head = cameraPose;
+    glm::mat4 headProjection = projection;
+    for(OutputWindow& output : outputWindows) {
+        if(output.target.width != width || output.target.height != height) {
+            deleteOffscreenTarget(output.target);
+            createOffscreenTarget(output.target, width, height);
+        }
+        OutputView view;
+        {
+            std::lock_guard<std::mutex> lock(outputWindowsMutex);
+            view = output.view;
+        }
+        int windowWidth, windowHeight;
+        getOutputWindowSize(output, windowWidth, windowHeight);
+        float aspect = windowHeight > 0 ? (float)windowWidth / windowHeight : projectionAspect;
+
+        glState().bindFramebuffer(GL_FRAMEBUFFER, output.target.fbo);
+        glState().viewport(0, 0, width, height);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+        cameraPose.orientation = head.orientation * view.orientation;
+        cameraPose.position = head.position + head.orientation * view.position;
+        projection = glm::perspective(projectionFovY, aspect, projectionNear, projectionFar * 3);
+        if(frameValid)
+            drawViews();
+    }
+    cameraPose = head;
+    projection = headProjection;
+    glState().bindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer());
+    glState().viewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    updateReprojectionUniforms();
+}
+
+/**
+ * Shows what drawOutputWindows drew, each window blitting its target in
+ * its own context. The windows swap without waiting for vblank, the main
+ * window's swap paces them all
+ */
+static void presentOutputWindows() {
+    if(outputWindows.empty())
+        return;
+    ARP_TRACE_SCOPE("presentOutputWindows");
+    // the other contexts read what this one drew
+    GLsync drawn = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    for(OutputWindow& output : outputWindows) {
+        if(!output.target.fbo)
+            continue;
+        glfwMakeContextCurrent(output.window);
+        if(!output.readFbo) {
+            glfwSwapInterval(0);
+            glGenFramebuffers(1, &output.readFbo);
+        }
+        glWaitSync(drawn, 0, GL_TIMEOUT_IGNORED);
+        // the target is recreated when the main output's size changes
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, output.readFbo);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, output.target.color, 0);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        int width, height;
+        getOutputWindowSize(output, width, height);
+        glBlitFramebuffer(0, 0, output.target.width, output.target.height, 0, 0, width, height,
+                          GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        glfwSwapBuffers(output.window);
+    }
+    glfwMakeContextCurrent(window);
+    glDeleteSync(drawn);
+}
+
+/**
+ * Deletes what the output windows used, in their contexts and this one
+ */
+static void deleteOutputWindows() {
+    for(OutputWindow& output : outputWindows) {
+        if(output.readFbo) {
+            glfwMakeContextCurrent(output.window);
+            glDeleteFramebuffers(1, &output.readFbo);
+            output.readFbo = 0;
+        }
+    }
+    glfwMakeContextCurrent(window);
+    for(OutputWindow& output : outputWindows)
+        deleteOffscreenTarget(output.target);
+}
+
+/**
+ * Stands in for the swap of a headless refresh: waits for its draws, as a
+ * swap throttles the GPU, then for the next simulated vblank
+ */
+static void presentHeadless() {
+    glFinish();
+    double period = 1.0 / headless.refreshRate;
+    double now = glfwGetTime();
+    // a late refresh misses vblanks, like a window's would
+    headlessVblank += period * std::max(1.0, std::ceil((now - headlessVblank) / period));
+    sleepUntil(headlessVblank);
+}
+
+void setHalfResolutionMarch(bool enabled) {
+    halfResolutionMarch = enabled;
+}
+
+void setReprojectionBudget(double fraction) {
+    reprojectionBudget = std::max(fraction, 0.0);
+}
+
+void setReprojectionSchedule(ReprojectionSchedule schedule, double safetyMargin) {
+    reprojectionSchedule = schedule;
+    scheduleSafetyMargin = safetyMargin;
+}
+
+void setBeamRacingSlices(int slices) {
+    beamRacingSlices = std::max(slices, 2);
+}
+
+void updateProjection(float near_, float far_, float fovY_, float aspectRatio_) {
+    projectionNear = near_;
+    projectionFar = far_;
+    projectionFovY = fovY_;
+    projectionAspect = aspectRatio_;
+
+    projection = glm::perspective(projectionFovY, projectionAspect, projectionNear, projectionFar * 3);
+}
+
+int startReprojection(ApplicationCallback callback) {
+    if(!poseFunction && !contextPoseFunction && !batchPoseFunction && !poseSource.load()) {
+        std::cout << "Error: No pose function provided! Not starting reprojection." << std::endl;
+        return -1;
+    }
+
+    window = glfwGetCurrentContext();
+    glfwSwapInterval(1);
+    // GLFW passes a negative interval on to the platform, which rejects it
+    // without the tear control extension
+    adaptiveVsyncSupported = glfwExtensionSupported("WGL_EXT_swap_control_tear")
+                             || glfwExtensionSupported("GLX_EXT_swap_control_tear");
+    renderThreadEnabled = threadConfig.renderThread;
+    if(!renderThreadEnabled) {
+        ARP_TRACE_THREAD("reprojection");
+        applyReprojectionThreadConfig();
+    }
+    int width, height;
+    glfwGetFramebufferSize(window, &width, &height);
+    framebufferWidth = width;
+    framebufferHeight = height;
+
+    // compiles in the background while the rest of the setup runs
+    startShaderCompilation();
+
+    if(headless.enabled) {
+        refreshInterval = 1.0 / headless.refreshRate;
+        refreshClock.reset(refreshInterval);
+    }
+    else {
+        monitorInterval = queryMonitorInterval();
+        followMonitor();
+    }
+
+    cameraPose.position = glm::vec3(0, 0, 0);
+    cameraPose.orientation = glm::quat(1, 0, 0, 0);
+    lastFrame->pose = cameraPose;
+    cameraMailbox.back().pose = cameraPose;
+    cameraMailbox.publish();
+
+    
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    // application contexts keep the default priority so reprojection preempts them
+    glfwWindowHint(GLFW_CONTEXT_PRIORITY, GLFW_ANY_PRIORITY);
+    hiddenWindow = glfwCreateWindow(1, 1, "", NULL, window);
+    uploadWindow = glfwCreateWindow(1, 1, "", NULL, window);
+    for(int i = 0; i < appContextCount; i++)
+        appContexts[i] = glfwCreateWindow(1, 1, "", NULL, window);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+
+    ContextPriority reprojectionContextPriority = queryContextPriority(window);
+    ContextPriority appContextPriority = queryContextPriority(hiddenWindow);
+    // UNAVAILABLE means the platform couldn't express the request at all
+    if(contextPriorityRequested && !contextPriorityWarned
+       && reprojectionContextPriority != CONTEXT_PRIORITY_UNAVAILABLE
+       && reprojectionContextPriority != CONTEXT_PRIORITY_HIGH) {
+        contextPriorityWarned = true;
+        std::cout << "Warning: high GPU context priority was denied, reprojection can be delayed by application GPU work"
+                  << std::endl;
+    }
+    {
+        std::lock_guard<std::mutex> lock(frameStatsMutex);
+        frameStats.reprojectionContextPriority = reprojectionContextPriority;
+        frameStats.appContextPriority = appContextPriority;
+    }
+    
+#ifndef ARP_NO_OVERLAY
+    IMGUI_CHECKVERSION();
+    ImGui::CreateContext();
+    ImGuiIO& io = ImGui::GetIO(); (void)io;
+    io.ConfigFlags |= ImGuiConfigFlags_NavEnableKeyboard;     // Enable Keyboard Controls
+    io.ConfigFlags |= ImGuiConfigFlags_NavEnableGamepad;      // Enable Gamepad Controls
+
+    // Setup Dear ImGui style
+    ImGui::StyleColorsDark();
+
+    // Setup Platform/Renderer backends
+    ImGui_ImplGlfw_InitForOpenGL(window, true);
+    ImGui_ImplOpenGL3_Init(glsl_version);
+#endif
+    
+    // the first refresh of a replay runs now, later ones at their
+    // recorded distance from it
+    if(replayingInput)
+        replayTimeOffset = glfwGetTime() - inputReplay.refreshes[0].time;
+
+    // start app thread
+    appThread = std::thread(appThreadStarter, callback);
+
+    originalKeyCallback = glfwSetKeyCallback(window, keyCallback);
+    originalCursorPosCallback = glfwSetCursorPosCallback(window, cursorPosCallback);
+    // unaccelerated motion while the cursor is captured
+    if(glfwRawMouseMotionSupported())
+        glfwSetInputMode(window, GLFW_RAW_MOUSE_MOTION, GLFW_TRUE);
+    originalFramebufferSizeCallback = glfwSetFramebufferSizeCallback(window, framebufferSizeCallback);
+    originalWindowPosCallback = glfwSetWindowPosCallback(window, windowPosCallback);
+    originalMonitorCallback = glfwSetMonitorCallback(monitorCallback);
+
+    setupGL();
+    if(headless.enabled) {
+        glfwHideWindow(window);
+        createOffscreenTarget(headlessTarget, headless.width, headless.height);
+        glState().viewport(0, 0, headless.width, headless.height);
+    }
+
+    if(!renderThreadEnabled) {
+        runRefreshLoop();
+        return 0;
+    }
+    // the window's context moves to the render thread, this one keeps
+    // handling events until the render thread is done
+    glfwMakeContextCurrent(nullptr);
+    renderThread = std::thread(renderThreadMain);
+    pumpWindowEvents();
+    renderThread.join();
+    glfwMakeContextCurrent(window);
+
+    return 0;
+}
+
+/**
+ * Applies ThreadConfig's reprojection priority and core to the calling
+ * thread
+ */
+static void applyReprojectionThreadConfig() {
+    ThreadPriority priority = applyThreadConfig("reprojection", threadConfig.reprojectionPriority,
+                                                threadConfig.reprojectionCore);
+    std::lock_guard<std::mutex> lock(frameStatsMutex);
+    frameStats.reprojectionPriority = priority;
+}
+
+static void renderThreadMain() {
+    ARP_TRACE_THREAD("reprojection");
+    applyReprojectionThreadConfig();
+    glfwMakeContextCurrent(window);
+    runRefreshLoop();
+    glfwMakeContextCurrent(nullptr);
+    renderThreadDone = true;
+    glfwPostEmptyEvent();
+}
+
+/**
+ * Handles window events every eventPumpInterval until the render thread is
+ * done, and makes the GLFW calls that have to be on the main thread for it:
+ * the cursor mode, the cursor position, the monitor and output window sizes
+ */
+static void pumpWindowEvents() {
+    int cursorMode = -1;
+    while(!renderThreadDone.load(std::memory_order_acquire)) {
+        {
+            std::lock_guard<std::mutex> lock(windowEventMutex);
+            glfwPollEvents();
+            int mode = cursorInputMode();
+            if(mode != cursorMode) {
+                glfwSetInputMode(window, GLFW_CURSOR, mode);
+                cursorMode = mode;
+            }
+            double x, y;
+            glfwGetCursorPos(window, &x, &y);
+            polledCursor.push({glfwGetTime(), x, y});
+            if(monitorQueryPending.exchange(false)) {
+                monitorInterval = queryMonitorInterval();
+                monitorCheckPending = true;
+            }
+            std::lock_guard<std::mutex> outputLock(outputWindowsMutex);
+            for(OutputWindow& output : outputWindows)
+                glfwGetFramebufferSize(output.window, &output.width, &output.height);
+        }
+        std::this_thread::sleep_for(std::chrono::duration<double>(eventPumpInterval));
+    }
+}
+
+/**
+ * Reprojects a refresh at a time until the window closes, then stops the
+ * app thread and frees what reprojection used. Runs on the thread the
+ * window's context is current on
+ */
+static void runRefreshLoop() {
+    // the swap interval last set, -1 being adaptive
+    int swapInterval = 1;
+    bool adaptiveVsyncReported = false;
+    // absolute time value used for tracking frame time
+    double frameStartTime = glfwGetTime();
+    lastSwapTime = frameStartTime;
+    std::uint64_t latePoseEvaluations = 0;
+    // refreshes since the last new frame was latched
+    int staleRefreshes = 0;
+    headlessVblank = frameStartTime;
+    {
+        // until the first refreshes are measured, a frame is predicted to
+        // be shown a refresh after it is latched
+        std::lock_guard<std::mutex> lock(displayTimingMutex);
+        displayRefresh = { frameStartTime, refreshInterval };
+        displayLatchLead = refreshInterval;
+    }
+    
+    bool resumingFromIdle = false;
+
+    while(!glfwWindowShouldClose(window)) {
+        
+        // a render thread's event thread sets the cursor mode
+        if(!renderThreadEnabled)
+            glfwSetInputMode(window, GLFW_CURSOR, cursorInputMode());
+        if(viewportPending.exchange(false) && !headless.enabled)
+            glState().viewport(0, 0, framebufferWidth, framebufferHeight);
+
+        if(monitorCheckPending)
+            followMonitor();
+        bool variable = variableRefresh.load(std::memory_order_relaxed) && !headless.enabled && !replayingInput;
+        // only a fixed refresh scans the front buffer out at known times.
+        // Replays evaluate one pose per refresh
+        bool beamRaced = reprojectionSchedule == SCHEDULE_BEAM_RACING && !variable && !headless.enabled
+                         && !replayingInput
+                         && (beamRacingVblankFeedback || glfwGetTime() - lastBeamRacingSwap < beamRacingSwapInterval);
+        if(variable) {
+            // a new frame is shown as soon as it arrives, without one the
+            // refresh is drawn when the app is late, or right away when the
+            // camera is being moved
+            bool steering = cursorCaptured || inputOverride
+                            || std::any_of(keysHeld, keysHeld + KEY_COUNT, [](std::uint8_t held) { return held; });
+            double period = steering ? refreshInterval : 1.0 / variableRefreshMinRate.load(std::memory_order_relaxed);
+            ARP_TRACE_SCOPE("variable refresh wait");
+            waitForFrameUntil(lastSwapTime + period);
+        }
+        else if(reprojectionSchedule == SCHEDULE_JUST_IN_TIME) {
+            // leave just enough time before the next vblank to reproject
+            const RefreshModel& refresh = refreshClock.model();
+            double nextVblank = refresh.nearestVblank(lastSwapTime + refresh.period);
+            // input arriving while waiting is timestamped as it comes in
+            ARP_TRACE_SCOPE("just-in-time wait");
+            waitEventsUntil(nextVblank - reprojectionCost - scheduleSafetyMargin);
+            if(!renderThreadEnabled)
+                glfwPollEvents();
+        }
+
+        double time = glfwGetTime();
+        const RefreshRecord* replayed = nullptr;
+        if(replayingInput) {
+            replayed = beginReplayRefresh();
+            if(!replayed) {
+                glfwSetWindowShouldClose(window, GLFW_TRUE);
+                break;
+            }
+            time = replayed->time + replayTimeOffset;
+        }
+        double poseEvaluationTime = 0;
+        bool latePose = false;
+        double lastFrameDuration = time - frameStartTime;
+        frameStartTime = time;
+        double overrideMouseX = 0, overrideMouseY = 0;
+        if(inputOverride && !replayed) {
+            int heldKeys[maxOverrideKeys];
+            int heldCount = inputOverride(time, overrideMouseX, overrideMouseY, heldKeys, maxOverrideKeys);
+            restartKeyTimesAfterSubmit();
+            std::uint8_t previouslyHeld[KEY_COUNT];
+            std::copy(keysHeld, keysHeld + KEY_COUNT, previouslyHeld);
+            std::fill(keysHeld, keysHeld + KEY_COUNT, 0);
+            for(int i = 0; i < std::min(heldCount, maxOverrideKeys); i++) {
+                if(validKey(heldKeys[i])) {
+                    keysHeld[heldKeys[i]] = 1;
+                    keyPressArrived |= !previouslyHeld[heldKeys[i]];
+                }
+            }
+            for(int key = 0; key < KEY_COUNT; key++) {
+                if(keysHeld[key])
+                    addKeyTime(key, lastFrameDuration);
+            }
+        }
+        else {
+            processInputEvents(time);
+        }
+        bool latencyFlash = latencyMarker && keyPressArrived;
+        bool keyPressed = keyPressArrived;
+        keyPressArrived = false;
+        {
+            // pick up the newest submitted frame, if any
+            bool latched = replayed ? latchReplayedFrame(*replayed) : latchPendingFrame();
+            staleRefreshes = latched ? 0 : staleRefreshes + 1;
+
+            double poseStart = glfwGetTime();
+            double mouseX = overrideMouseX, mouseY = overrideMouseY;
+            if(replayed) {
+                mouseX = replayed->mouseX;
+                mouseY = replayed->mouseY;
+            }
+            else if(!inputOverride && renderThreadEnabled) {
+                InputSample cursor;
+                if(polledCursor.snapshot(&cursor, 1) == 1) {
+                    mouseX = cursor.mouseX;
+                    mouseY = cursor.mouseY;
+                }
+            }
+            else if(!inputOverride) {
+                glfwGetCursorPos(window, &mouseX, &mouseY);
+            }
+            cameraPoseInfo.mouseX = mouseX;
+            cameraPoseInfo.mouseY = mouseY;
+            cameraPoseInfo.time = time;
+            // also tells prediction when the cursor stopped moving
+            inputHistory.push({time, mouseX, mouseY});
+
+            double dx = cameraPoseInfo.mouseX - lastFrame->poseInfo.mouseX;
+            double dy = cameraPoseInfo.mouseY - lastFrame->poseInfo.mouseY;
+            double dt = cameraPoseInfo.time   - lastFrame->poseInfo.time;
+
+            bool mouseActive = replayed ? replayed->mouseActive : cursorCaptured || inputOverride;
+            if(!mouseActive) {
+                dx = 0;
+                dy = 0;
+            }
+
+            if(recordingInput.load(std::memory_order_relaxed)) {
+                RefreshRecord record{};
+                record.time = time;
+                record.mouseX = mouseX;
+                record.mouseY = mouseY;
+                record.keyTimesRestarted = keyTimesRestarted;
+                record.mouseActive = mouseActive;
+                record.latchedSubmission = latched ? lastFrame->submission : 0;
+                inputRecording.write(INPUT_RECORD_REFRESH, record);
+            }
+
+            PoseSource* source = replayed ? nullptr : poseSource.load(std::memory_order_acquire);
+            if(source) {
+                // sampled for the exact latch time, the last pose stays
+                // while the source has none
+                Pose sourced;
+                if(source->getPose(time, sourced))
+                    cameraPose = sourced;
+            }
+            else {
+                // replays evaluate every refresh, or they would depend on timing
+                double budget = replayed ? 0 : poseFunctionBudget.load(std::memory_order_relaxed);
+                if(budget > 0) {
+                    if(!evaluatePoseBy(poseStart + budget, lastFrame->poseInfo.realPose, dx, dy, dt, cameraPose)) {
+                        // a few refreshes on, the motion is more guess than not
+                        extrapolateCameraPose(time, refreshClock.model().period * 4, cameraPose);
+                        latePoseEvaluations++;
+                        latePose = true;
+                    }
+                }
+                else {
+                    KeyTime keyTime = { [](const void*, int key) { return keyTimeFunction(key); }, nullptr };
+                    cameraPose = evaluatePose(lastFrame->poseInfo.realPose, dx, dy, dt, keyTime);
+                }
+            }
+            cameraPoseInfo.realPose = cameraPose;
+            cameraPoseHistory.push({ time, cameraPose });
+            // layers in moving spaces move without the camera
+            bool spacesMoved = !replayed && moveReferenceSpaces(time);
+            // what's left to correct on a frame's first refresh is what its
+            // predicted pose missed by
+            if(latched)
+                measurePrediction(lastFrame->poseInfo.realPose, lastFrame->pose, cameraPose);
+
+            CameraState& state = cameraMailbox.back();
+            state.pose = cameraPose;
+            state.poseInfo = cameraPoseInfo;
+            state.framePoseInfo = lastFrame->poseInfo;
+            std::copy(keysHeld, keysHeld + KEY_COUNT, state.heldKeys);
+            cameraMailbox.publish();
+            poseEvaluationTime = glfwGetTime() - poseStart;
+
+            // only what is shown moves back, the application keeps its pose
+            bool mouseMoved = mouseActive && (mouseX != interpolationMouseX || mouseY != interpolationMouseY);
+            interpolationMouseX = mouseX;
+            interpolationMouseY = mouseY;
+            bool input = keyPressed || mouseMoved || std::any_of(keysHeld, keysHeld + KEY_COUNT,
+                                                                  [](std::uint8_t held) { return held != 0; });
+            interpolateCameraPose(time, latched, input);
+
+            // the other viewports' cameras move without input reaching arp,
+            // and extrapolated objects move until maxMotionExtrapolation
+            bool changed = latched || windowEventArrived || overlayActive || inputOverride || latencyFlash
+                           || refreshSplitScreen.viewports > 1 || spacesMoved || extrapolatingMotion()
+                           || !samePose(cameraPose, presentedPose) || projection != presentedProjection;
+            windowEventArrived = false;
+            if(refreshIdle(changed)) {
+                {
+                    std::lock_guard<std::mutex> lock(frameStatsMutex);
+                    frameStats.idleRefreshes++;
+                }
+                // nothing to present, so the refresh is waited out on the
+                // CPU, waking early for input
+                resumingFromIdle = true;
+                publishReprojectionSubmit();
+                if(recordingInput.load(std::memory_order_relaxed))
+                    inputRecording.flush(recordingFlushSize);
+                if(variable)
+                    waitForFrameUntil(time + refreshClock.model().period);
+                else
+                    waitEventsUntil(time + refreshClock.model().period);
+                continue;
+            }
+            presentedPose = cameraPose;
+            presentedProjection = projection;
+            
+            // orientationDifference: camera - lastFrame
+
+            // beam raced slices wait for the raster between draws, which
+            // the query would count
+            if(timerQueriesSupported && !beamRaced) {
+                glGetInteger64v(GL_TIMESTAMP, &reprojectionIssueTimes[reprojectionTimerIndex]);
+                glQueryCounter(reprojectionStartQueries[reprojectionTimerIndex], GL_TIMESTAMP);
+                glBeginQuery(GL_TIME_ELAPSED, reprojectionTimerQueries[reprojectionTimerIndex]);
+                reprojectionTimerStarted[reprojectionTimerIndex] = true;
+            }
+
+            // the app context deletes textures drawn here, and a texture it
+            // creates next can reuse the name of one still bound
+            glState().invalidateTextures();
+            glState().bindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer());
+            if(!beamRaced) {
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+                if(frameValid)
+                    drawViews();
+            }
+            drawOutputWindows();
+        }
+        
+        double beamRacingWait = 0;
+        double beamRacedVblank = 0;
+        if(beamRaced) {
+            beamRacingWait = drawBeamRaced(latencyFlash, beamRacedVblank);
+        }
+        else {
+            drawOverlay();
+            drawCursor();
+            if(latencyMarker)
+                drawLatencyMarker(latencyFlash);
+        }
+
+        if(timerQueriesSupported && !beamRaced)
+            glEndQuery(GL_TIME_ELAPSED);
+        if(!beamRaced) {
+            // outside the timer query, the copy is the capture's own cost.
+            // Beam raced refreshes never have a whole image in one buffer
+            int width, height;
+            getOutputSize(width, height);
+            frameCapture.capture(outputFramebuffer(), width, height);
+        }
+        if(GLEW_ARB_invalidate_subdata) {
+            // only color is presented, tiled GPUs can drop the rest
+            static const GLenum unpresented[] = { GL_DEPTH, GL_STENCIL };
+            static const GLenum unpresentedAttachments[] = { GL_DEPTH_STENCIL_ATTACHMENT };
+            glState().bindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer());
+            if(headless.enabled)
+                glInvalidateFramebuffer(GL_FRAMEBUFFER, 1, unpresentedAttachments);
+            else
+                glInvalidateFramebuffer(GL_FRAMEBUFFER, 2, unpresented);
+        }
+        double reprojectionCpuTime = glfwGetTime() - time - beamRacingWait;
+        updateReprojectionCost(reprojectionCpuTime);
+        // the swap can block, so the draws are flushed first to let
+        // yieldPoint release the app as soon as they are on the GPU
+        glFlush();
+        publishReprojectionSubmit();
+
+        bool adaptive = adaptiveVsync.load(std::memory_order_relaxed);
+        if(adaptive && !adaptiveVsyncSupported && !adaptiveVsyncReported) {
+            std::cout << "Adaptive vsync: swap_control_tear isn't supported, swaps stay synchronized" << std::endl;
+            adaptiveVsyncReported = true;
+        }
+        // beam racing doesn't swap, so the interval is left for after it
+        int interval = adaptive && adaptiveVsyncSupported ? -1 : 1;
+        if(interval != swapInterval && !beamRaced) {
+            glfwSwapInterval(interval);
+            swapInterval = interval;
+        }
+        double swapStart = beamRaced ? beamRacedVblank : glfwGetTime();
+        presentedRefreshCount++;
+        {
+            // tagged with the refresh number, as submitFrame is with the frame's
+            ARP_TRACE_INDEXED_SCOPE("swap", (int)presentedRefreshCount);
+            if(headless.enabled)
+                presentHeadless();
+            else if(!beamRaced)
+                glfwSwapBuffers(window);
+        }
+        // a beam raced refresh is on screen from its vblank on
+        double swapEnd = beamRaced ? beamRacedVblank : glfwGetTime();
+        presentOutputWindows();
+        if(beamRaced) {
+            updateBeamRacedTiming();
+        }
+        else {
+            updateDisplayTiming(time, swapEnd, variable);
+            lastBeamRacingSwap = swapEnd;
+        }
+        transientArena().reset();
+        trimTransientTextures(gpuMemoryPressure ? 0 : transientTextureMaxIdle);
+        // reported once frameStatsMutex is unlocked
+        JankEvent refreshJank[2];
+        int jankCount = 0;
+        {
+            std::lock_guard<std::mutex> lock(frameStatsMutex);
+            frameStats.reprojectionCpuTime = reprojectionCpuTime;
+            frameStats.reprojectionGpuTime = reprojectionGpuTime;
+            frameStats.reprojectionGpuDelay = reprojectionGpuDelay;
+            frameStats.poseEvaluationTime = poseEvaluationTime;
+            frameStats.latePoseEvaluations = latePoseEvaluations;
+            frameStats.swapTime = swapEnd - swapStart;
+            // swaps are paced by vblank, a longer gap means one was missed,
+            // unless the refreshes in between were idle or the display has
+            // no fixed cadence
+            bool missed = swapEnd - lastSwapTime > refreshClock.model().period * 1.5 && !resumingFromIdle
+                          && !variable;
+            if(missed)
+                frameStats.missedRefreshes++;
+            // a swap issued after the vblank it was drawn for doesn't wait
+            // for the next one with adaptive vsync, it tears
+            const RefreshModel& refresh = refreshClock.model();
+            bool torn = swapInterval == -1 && !beamRaced && !variable && !headless.enabled && !resumingFromIdle
+                        && swapStart > refresh.nearestVblank(lastSwapTime + refresh.period);
+            if(torn)
+                frameStats.tornRefreshes++;
+            frameStats.refreshPeriod = refreshClock.model().period;
+            frameStats.presentLatency = displayLatchLead;
+            frameStats.qualityLevel = qualityLevel;
+            frameStats.quality = quality;
+            frameStats.qualityChanges = qualityChanges;
+
+            statsCounters.refreshes.fetch_add(1, std::memory_order_relaxed);
+            if(missed)
+                statsCounters.missedRefreshes.fetch_add(1, std::memory_order_relaxed);
+            if(torn)
+                statsCounters.tornRefreshes.fetch_add(1, std::memory_order_relaxed);
+
+            PresentedRefresh presented;
+            presented.refresh = presentedRefreshCount;
+            presented.latchTime = time;
+            presented.presentTime = swapEnd;
+            presented.frame = lastFrame->submission;
+            presented.staleRefreshes = staleRefreshes;
+            presented.framePose = lastFrame->pose;
+            presented.pose = cameraPose;
+            presented.frameAge = lastFrame->submission ? swapEnd - lastFrame->submitTime : 0;
+            presented.poseAge = lastFrame->submission ? swapEnd - lastFrame->poseInfo.time : 0;
+            presented.inputAge = swapEnd - time;
+            presented.missed = missed;
+            presentedRefreshes.push(presented);
+
+            // reported once, when the frame first goes stale
+            bool stale = staleRefreshes == jankDetection.staleRefreshes + 1 && lastFrame;
+            if(jankDetection.enabled && (missed || stale)) {
+                JankEvent event = {};
+                event.time = swapEnd;
+                event.poseEvaluationTime = poseEvaluationTime;
+                event.reprojectionCpuTime = reprojectionCpuTime;
+                event.reprojectionGpuTime = reprojectionGpuTime;
+                event.reprojectionGpuDelay = reprojectionGpuDelay;
+                event.swapTime = frameStats.swapTime;
+                event.refreshPeriod = frameStats.refreshPeriod;
+                event.staleRefreshes = staleRefreshes;
+                if(missed) {
+                    event.type = JANK_MISSED_VBLANK;
+                    event.duration = swapEnd - lastSwapTime;
+                    event.cause = refreshJankCause(event, latePose);
+                    refreshJank[jankCount++] = event;
+                }
+                if(stale) {
+                    event.type = JANK_STALE_FRAME;
+                    event.duration = staleRefreshes * event.refreshPeriod;
+                    event.cause = JANK_CAUSE_APP_LATE;
+                    refreshJank[jankCount++] = event;
+                }
+            }
+            statsCounters.addGpuTime(reprojectionGpuTime);
+            statsCounters.refreshPeriod.store(frameStats.refreshPeriod, std::memory_order_relaxed);
+
+            reprojectionCpuPlot.push(reprojectionCpuTime * 1000.0);
+            reprojectionGpuPlot.push(reprojectionGpuTime * 1000.0);
+            reprojectionGpuDelayPlot.push(reprojectionGpuDelay * 1000.0);
+            poseEvaluationPlot.push(poseEvaluationTime * 1000.0);
+            swapPlot.push(frameStats.swapTime * 1000.0);
+            if(frameStats.submittedFrames != plottedAppFrames) {
+                plottedAppFrames = frameStats.submittedFrames;
+                appFramePlot.push(frameStats.appFrameTime * 1000.0);
+                appGpuPlot.push(frameStats.appGpuTime * 1000.0);
+                swapchainWaitPlot.push(frameStats.swapchainWaitTime * 1000.0);
+            }
+        }
+        for(int i = 0; i < jankCount; i++)
+            reportJank(refreshJank[i]);
+        lastSwapTime = swapEnd;
+        resumingFromIdle = false;
+        if(recordingInput.load(std::memory_order_relaxed))
+            inputRecording.flush(recordingFlushSize);
+        if(!renderThreadEnabled)
+            glfwPollEvents();
+
+        // like the overlay, ground truth comparisons run right after the
+        // swap, outside the measured reprojection time
+        compareGroundTruth();
+        updateGpuMemory(swapEnd);
+        updatePowerState(swapEnd);
+        // right after the swap the overlay's cost stays out of the time
+        // between latching a pose and presenting it
+        updateOverlay(glfwGetTime());
+    }
+
+    glfwSetWindowShouldClose(hiddenWindow, GLFW_TRUE);
+    // an app waiting for a state change has to see the window close
+    notifySettingsChanged();
+
+    appThread.join();
+    stopPoseHelper();
+    stopInputRecording();
+    frameCapture.shutdown();
+    stopStatsExport();
+    if(headless.enabled)
+        deleteOffscreenTarget(headlessTarget);
+    deleteOutputWindows();
+}
+
+int getTargetFramerate()
+{
+    return pacedFramerate();
+}
+
+/**
+ * The target framerate, capped while saving power
+ */
+static int pacedFramerate() {
+    int framerate = targetFPS;
+    int savingFramerate = powerSavingFramerate.load(std::memory_order_relaxed);
+    if(powerSaving.load(std::memory_order_relaxed) && savingFramerate > 0)
+        framerate = framerate > 0 ? std::min(framerate, savingFramerate) : savingFramerate;
+    return framerate;
+}
+
+static void notifySettingsChanged() {
+    {
+        std::lock_guard<std::mutex> lock(settingsMutex);
+        settingsVersion++;
+    }
+    settingsChanged.notify_all();
+}
+
+void setOverlayEnabled(bool enabled) {
+    overlayEnabled = enabled;
+}
+
+void setOverlayRate(double rate) {
+    overlayRate = std::max(rate, 1.0);
+}
+
+#ifndef ARP_NO_OVERLAY
+static bool settingsCheckbox(const char* label, std::atomic<bool>& option) {
+    bool value = option;
+    if(!ImGui::Checkbox(label, &value))
+        return false;
+    option = value;
+    notifySettingsChanged();
+    return true;
+}
+
+static void buildOverlayWindow() {
+    ImGui::Begin("Options");
+
+    ImGui::Text("so many choices");
+    settingsCheckbox("Reprojection", reprojectionToggle);
+    settingsCheckbox("Prediction", predictionToggle);
+    int predictor = posePredictor;
+    if(ImGui::Combo("Predictor", &predictor, "Constant velocity\0Constant acceleration\0Kalman\0Pose extrapolation\0"))
+        posePredictor = predictor;
+    settingsCheckbox("Background", backgroundToggle);
+    settingsCheckbox("Parallax", parallaxToggle);
+    settingsCheckbox("Grid warp", gridWarpToggle);
+    settingsCheckbox("Half resolution march", halfResolutionMarch);
+    if(sceneNodeBuffer)
+        settingsCheckbox("Ray traced disocclusions", sceneTraceToggle);
+    if(adaptiveVsyncSupported)
+        settingsCheckbox("Adaptive vsync", adaptiveVsync);
+    settingsCheckbox("Variable refresh", variableRefresh);
+    
+    if (ImGui::Button("Freeze")) {
+        freezeRendering = !freezeRendering;
+        notifySettingsChanged();
+    }
+
+    int framerate = targetFPS;
+    if(ImGui::SliderInt("target framerate", &framerate, 0, 240)) {
+        targetFPS = framerate;
+        notifySettingsChanged();
+    }
+
+    bool justInTime = reprojectionSchedule == SCHEDULE_JUST_IN_TIME;
+    if(ImGui::Checkbox("Just-in-time", &justInTime))
+        reprojectionSchedule = justInTime ? SCHEDULE_JUST_IN_TIME : SCHEDULE_IMMEDIATE;
+    float marginMs = scheduleSafetyMargin * 1000.0;
+    if(ImGui::SliderFloat("JIT margin (ms)", &marginMs, 0.f, 8.f))
+        scheduleSafetyMargin = marginMs / 1000.0;
+    bool beamRacing = reprojectionSchedule == SCHEDULE_BEAM_RACING;
+    if(ImGui::Checkbox("Beam racing", &beamRacing))
+        reprojectionSchedule = beamRacing ? SCHEDULE_BEAM_RACING : SCHEDULE_IMMEDIATE;
+    int slices = beamRacingSlices;
+    if(ImGui::SliderInt("beam racing slices", &slices, 2, 16))
+        beamRacingSlices = slices;
+    ImGui::Text("Reprojection cost %.3f ms", reprojectionCost * 1000.0);
+    ImGui::Text("Reprojection quality level %d", qualityLevel);
+
+    double refreshPeriod = refreshClock.model().period;
+    ImGui::Text("Display refresh %.3f ms (%.1f Hz)", refreshPeriod * 1000.0, 1.0 / refreshPeriod);
+    GLStateCounters stateCounters = getGLStateCounters();
+    ImGui::Text("GL state calls issued %llu, elided %llu", (unsigned long long)stateCounters.issued,
+                (unsigned long long)stateCounters.elided);
+
+    if(ImGui::CollapsingHeader("GPU memory")) {
+        static const char* categoryNames[GPU_MEMORY_CATEGORY_COUNT] = {
+            "Swapchains", "Depth pyramids", "History", "Reprojection", "Application",
+        };
+        const double megabyte = 1024.0 * 1024.0;
+        GpuMemoryStats memory = getGpuMemoryStats();
+        for(int i = 0; i < GPU_MEMORY_CATEGORY_COUNT; i++)
+            ImGui::Text("%s %.1f MB", categoryNames[i], memory.bytes[i] / megabyte);
+        ImGui::Text("Tracked %.1f MB%s", memory.trackedBytes / megabyte, memory.underPressure ? ", under pressure" : "");
+        if(memory.deviceAvailableBytes >= 0)
+            ImGui::Text("Device available %.1f MB", memory.deviceAvailableBytes / megabyte);
+        if(memory.deviceBytes >= 0)
+            ImGui::Text("Device total %.1f MB", memory.deviceBytes / megabyte);
+    }
+
+    if(ImGui::CollapsingHeader("Frame timing")) {
+        FrameStats stats = getFrameStats();
+        float refreshMs = refreshInterval * 1000.0;
+        ImGui::Text("Missed refreshes %llu", (unsigned long long)stats.missedRefreshes);
+        if(adaptiveVsync && adaptiveVsyncSupported)
+            ImGui::Text("Torn refreshes %llu", (unsigned long long)stats.tornRefreshes);
+        if(poseFunctionBudget.load(std::memory_order_relaxed) > 0)
+            ImGui::Text("Late pose evaluations %llu", (unsigned long long)stats.latePoseEvaluations);
+        ImGui::Text("Prediction error %.3f deg, %.4f units", stats.predictionAngleError,
+                    stats.predictionPositionError);
+        if(predictionTuning)
+            ImGui::Text("Prediction gains %.2f turn, %.2f move", stats.predictionRotationGain,
+                        stats.predictionTranslationGain);
+        ImGui::Text("App GPU estimate %.2f ms, %.2f ms after submit", stats.appGpuTimeEstimate * 1000.0,
+                    stats.appGpuTailEstimate * 1000.0);
+        GpuZoneTiming zones[16];
+        int zoneCount = getGpuZoneTimings(zones, 16);
+        int framerate = getTargetFramerate();
+        for(int i = 0; i < zoneCount; i++) {
+            // share of the app's frame budget, to tell the pass that overran
+            double share = framerate > 0 ? zones[i].lastFrame * framerate * 100.0 : 0;
+            ImGui::Text("  %s %.2f ms, mean %.2f ms, %.0f%% of budget", zones[i].name, zones[i].lastFrame * 1000.0,
+                        zones[i].mean * 1000.0, share);
+        }
+        if(framesInFlight.load(std::memory_order_relaxed) > 1)
+            ImGui::Text("%d frames in flight, waited %.2f ms", framesInFlight.load(std::memory_order_relaxed),
+                        stats.inFlightWaitTime * 1000.0);
+        // drawn on the reprojection thread, so this is its arena
+        const TransientArena& arena = transientArena();
+        ImGui::Text("Transient arena %.0f KB, peak %.0f KB, %llu blocks allocated", arena.getCapacity() / 1024.0,
+                    arena.getHighWater() / 1024.0, (unsigned long long)arena.getBlockAllocations());
+        reprojectionCpuPlot.plot("Reprojection CPU", refreshMs);
+        reprojectionGpuPlot.plot("Reprojection GPU", refreshMs);
+        reprojectionGpuDelayPlot.plot("Reprojection GPU delay", refreshMs);
+        poseEvaluationPlot.plot("Pose evaluation", refreshMs * 0.25f);
+        swapPlot.plot("Swap", refreshMs);
+        appFramePlot.plot("App CPU", refreshMs * 4);
+        appGpuPlot.plot("App GPU", refreshMs * 4);
+        swapchainWaitPlot.plot("Swapchain wait", refreshMs * 4);
+    }
+    ImGui::End();
+}
+
+/**
+ * Rebuilds the overlay into overlayTexture when it is enabled and due
+ */
+static void updateOverlay(double time) {
+    if(!overlayEnabled) {
+        overlayDrawn = false;
+        overlayActive = false;
+        return;
+    }
+    if(overlayDrawn && time - lastOverlayTime < 1.0 / overlayRate)
+        return;
+    // the GLFW backend reads the window and ImGui's input, which the event
+    // thread's callbacks write
+    std::unique_lock<std::mutex> eventLock(windowEventMutex, std::defer_lock);
+    if(renderThreadEnabled && !eventLock.try_lock())
+        return;
+    ARP_TRACE_GPU_SCOPE("updateOverlay");
+    lastOverlayTime = time;
+
+    ImGui_ImplOpenGL3_NewFrame();
+    ImGui_ImplGlfw_NewFrame();
+    ImGui::NewFrame();
+    buildOverlayWindow();
+    ImGuiIO& io = ImGui::GetIO();
+    overlayActive = io.MouseDelta.x != 0 || io.MouseDelta.y != 0 || io.MouseWheel != 0 || io.MouseWheelH != 0
+                    || ImGui::IsAnyMouseDown() || ImGui::IsAnyItemActive();
+    ImGui::Render();
+
+    int width, height;
+    getOutputSize(width, height);
+    if(width <= 0 || height <= 0)
+        return;
+    if(!overlayFbo)
+        glGenFramebuffers(1, &overlayFbo);
+    if(width != overlayWidth || height != overlayHeight) {
+        // immutable storage can't be resized, so the texture is replaced
+        glState().forgetTexture(overlayTexture);
+        glDeleteTextures(1, &overlayTexture);
+        glGenTextures(1, &overlayTexture);
+        glState().bindTexture(0, GL_TEXTURE_2D, overlayTexture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+        glState().bindFramebuffer(GL_FRAMEBUFFER, overlayFbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, overlayTexture, 0);
+        overlayWidth = width;
+        overlayHeight = height;
+    }
+
+    // ImGui's blending leaves premultiplied color and coverage in alpha
+    // when drawn over transparent black
+    glState().bindFramebuffer(GL_FRAMEBUFFER, overlayFbo);
+    glState().viewport(0, 0, width, height);
+    glClearColor(0, 0, 0, 0);
+    glClear(GL_COLOR_BUFFER_BIT);
+    ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+    glState().bindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer());
+    glState().viewport(0, 0, width, height);
+    overlayDrawn = true;
+}
+
+/**
+ * Composites the cached overlay over the layers, like a camera locked layer
+ * that passes through
+ */
+static void drawOverlay() {
+    if(!overlayEnabled || !overlayDrawn)
+        return;
+    glState().setEnabled(GL_BLEND, true);
+    glState().blendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    drawFullscreenTexture(overlayTexture);
+    glState().setEnabled(GL_BLEND, false);
+}
+#else
+static void updateOverlay(double time) {}
+static void drawOverlay() {}
+#endif
+
+/**
+ * Draws the cursor sprite over the output at the newest cursor position, or
+ * at the center of the window while the cursor is captured, uploading it
+ * first if it was replaced
+ */
+static void drawCursor() {
+    if(headless.enabled)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(cursorSpriteMutex);
+        if(cursorSpriteVersion != cursorTextureVersion) {
+            cursorTextureVersion = cursorSpriteVersion;
+            if(cursorSprite.width != cursorTextureWidth || cursorSprite.height != cursorTextureHeight) {
+                glState().forgetTexture(cursorTexture);
+                glDeleteTextures(1, &cursorTexture);
+                cursorTexture = 0;
+                if(!cursorSpritePixels.empty()) {
+                    glGenTextures(1, &cursorTexture);
+                    glState().bindTexture(0, GL_TEXTURE_2D, cursorTexture);
+                    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, cursorSprite.width, cursorSprite.height);
+                    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+                    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+                }
+                cursorTextureWidth = cursorSprite.width;
+                cursorTextureHeight = cursorSprite.height;
+            }
+            if(cursorTexture) {
+                glState().bindTexture(0, GL_TEXTURE_2D, cursorTexture);
+                glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, cursorTextureWidth, cursorTextureHeight, GL_RGBA,
+                                GL_UNSIGNED_BYTE, cursorSpritePixels.data());
+            }
+            cursorHotspotX = cursorSprite.hotspotX;
+            cursorHotspotY = cursorSprite.hotspotY;
+        }
+    }
+    if(!cursorTexture)
+        return;
+
+    int width, height;
+    getOutputSize(width, height);
+    double x = width * 0.5, y = height * 0.5;
+    if(!cursorCaptured) {
+        x = cursorPixelX.load(std::memory_order_relaxed);
+        y = cursorPixelY.load(std::memory_order_relaxed);
+    }
+    int left = (int)std::floor(x) - cursorHotspotX;
+    int bottom = height - ((int)std::floor(y) - cursorHotspotY) - cursorTextureHeight;
+
+    GLint viewport[4];
+    if(!glState().getViewport(viewport))
+        glGetIntegerv(GL_VIEWPORT, viewport);
+    glState().viewport(left, bottom, cursorTextureWidth, cursorTextureHeight);
+    glState().setEnabled(GL_BLEND, true);
+    glState().blendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    drawFullscreenTexture(cursorTexture);
+    glState().setEnabled(GL_BLEND, false);
+    glState().viewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+RuntimeSettings getRuntimeSettings() {
+    std::lock_guard<std::mutex> lock(settingsMutex);
+    RuntimeSettings settings;
+    settings.reprojection = reprojectionToggle;
+    settings.background = backgroundToggle;
+    settings.parallax = parallaxToggle;
+    settings.gridWarp = gridWarpToggle;
+    settings.prediction = predictionToggle;
+    settings.frozen = freezeRendering;
+    settings.targetFramerate = targetFPS;
+    settings.version = settingsVersion;
+    return settings;
+}
+
+void setRuntimeSettings(const RuntimeSettings& settings) {
+    {
+        std::lock_guard<std::mutex> lock(settingsMutex);
+        reprojectionToggle = settings.reprojection;
+        backgroundToggle = settings.background;
+        parallaxToggle = settings.parallax;
+        gridWarpToggle = settings.gridWarp;
+        predictionToggle = settings.prediction;
+        freezeRendering = settings.frozen;
+        targetFPS = settings.targetFramerate;
+        settingsVersion++;
+    }
+    settingsChanged.notify_all();
+}
+
+RuntimeSettings waitForStateChange(std::uint64_t version, double timeout) {
+    {
+        std::unique_lock<std::mutex> lock(settingsMutex);
+        auto changed = [version] { return settingsVersion != version; };
+        if(timeout < 0)
+            settingsChanged.wait(lock, changed);
+        else
+            settingsChanged.wait_for(lock, std::chrono::duration<double>(timeout), changed);
+    }
+    return getRuntimeSettings();
+}
+
+bool getParallaxToggle()
+{
+    return parallaxToggle;
+}
+
+bool getGridWarpToggle()
+{
+    return gridWarpToggle;
+}
+
+bool getPredictionToggle()
+{
+    return predictionToggle;
+}
+
+bool getReprojectionToggle()
+{
+    return reprojectionToggle;
+}
+
+bool getBackgroundToggle()
+{
+    return backgroundToggle;
+}
+
+bool getFrozen()
+{
+    return freezeRendering;
+}
+
+/**
+ * Draws every layer of lastFrame. Layers are opaque, so with a stencil
+ * buffer they are drawn front to back and each one marks the pixels it
+ * covers, leaving lower layers to shade only what is still uncovered.
+ * Expects a cleared stencil buffer
+ */
+/**
+ * Draws the latched frame into the viewport, or with stereo into each half
+ * of it from its eye's pose. The halves don't overlap, so the stencil of
+ * one eye doesn't get in the way of the other
+ */
+static void drawViews() {
+    {
+        std::lock_guard<std::mutex> lock(stereoMutex);
+        refreshStereo = stereo;
+    }
+    {
+        std::lock_guard<std::mutex> lock(lensDistortionMutex);
+        refreshLensDistortion = lensDistortion;
+    }
+    if(refreshLensDistortion.enabled && refreshLensDistortion.meshCells != distortionMeshCells)
+        buildDistortionMesh(refreshLensDistortion.meshCells);
+    {
+        std::lock_guard<std::mutex> lock(splitScreenMutex);
+        refreshSplitScreen = splitScreen;
+    }
+    if(refreshSplitScreen.viewports > 1) {
+        drawSplitViewports();
+        return;
+    }
+    if(!refreshStereo.enabled) {
+        currentEye = -1;
+        updateReprojectionUniforms();
+        drawLayers();
+        return;
+    }
+
+    GLint viewport[4];
+    if(!glState().getViewport(viewport))
+        glGetIntegerv(GL_VIEWPORT, viewport);
+    Pose head = cameraPose;
+    int halfWidth = viewport[2] / 2;
+    for(int eye = 0; eye < 2; eye++) {
+        ARP_TRACE_INDEXED_SCOPE("drawEye", eye);
+        glState().viewport(viewport[0] + eye * halfWidth, viewport[1], halfWidth, viewport[3]);
+        currentEye = eye;
+        cameraPose = eyePose(head, eye, refreshStereo.ipd);
+        updateReprojectionUniforms();
+        drawLayers();
+    }
+    currentEye = -1;
+    cameraPose = head;
+    glState().viewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    updateReprojectionUniforms();
+}
+
+/**
+ * Draws every split screen viewport from its camera. The frame's per
+ * refresh work is shared, only the layers are drawn per viewport
+ */
+static void drawSplitViewports() {
+    GLint viewport[4];
+    if(!glState().getViewport(viewport))
+        glGetIntegerv(GL_VIEWPORT, viewport);
+    Pose camera = cameraPose;
+    double displayTime = refreshClock.model().nextVblank(glfwGetTime());
+    currentEye = -1;
+    for(int i = 0; i < refreshSplitScreen.viewports; i++) {
+        ARP_TRACE_INDEXED_SCOPE("drawSplitViewport", i);
+        GLint rect[4];
+        splitViewportRect(viewport, refreshSplitScreen.viewports, i, rect);
+        glState().viewport(rect[0], rect[1], rect[2], rect[3]);
+        currentViewport = i;
+        ViewportPoseFunction function = i > 0 ? viewportPoseFunctions[i].load() : nullptr;
+        cameraPose = function ? function(i, displayTime) : camera;
+        updateReprojectionUniforms();
+        drawLayers();
+    }
+    currentViewport = -1;
+    cameraPose = camera;
+    glState().viewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    updateReprojectionUniforms();
+}
+
+/**
+ * Whether a layer is drawn for currentEye and currentViewport
+ */
+static bool layerVisible(const FrameLayer& layer) {
+    return (currentEye < 0 || layer.eye < 0 || layer.eye == currentEye)
+           && (currentViewport < 0 || layer.splitViewport < 0 || layer.splitViewport == currentViewport);
+}
+
+static void drawLayers() {
+    ARP_TRACE_GPU_SCOPE("drawLayers");
+    // the voxel cache and the traced scene go under the first layer this
+    // eye sees and the layers peeled from it, where their disocclusions are
+    voxelSplatLayer = -1;
+    int splatBefore = -1;
+    bool sceneTrace = sceneNodeBuffer && sceneTraceProgram && sceneTraceToggle;
+    if(activeVoxelCache.enabled || sceneTrace) {
+        for(size_t i = 0; i < lastFrame->layers.size(); i++) {
+            if(!layerVisible(lastFrame->layers[i]))
+                continue;
+            if(layerCameras[i].pose.position != cameraPose.position)
+                voxelSplatLayer = i;
+            break;
+        }
+    }
+    if(voxelSplatLayer >= 0) {
+        splatBefore = voxelSplatLayer + 1;
+        while(splatBefore < (int)lastFrame->layers.size() && (lastFrame->layers[splatBefore].flags & DEPTH_PEELED))
+            splatBefore++;
+    }
+
+    if(!stencilCompositing) {
+        for(int i = lastFrame->layers.size() - 1; i >= 0; i--) {
+            if(i + 1 == splatBefore) {
+                if(sceneTrace)
+                    drawSceneTrace();
+                if(activeVoxelCache.enabled)
+                    drawVoxelSplat();
+            }
+            if(!layerVisible(lastFrame->layers[i]))
+                continue;
+            int count = layerBatchLength(i, -1, splatBefore);
+            if(count > 1) {
+                drawLayerBatch(i, -1, count);
+                i -= count - 1;
+            }
+            else {
+                drawLayer(lastFrame->layers[i], i);
+            }
+        }
+        return;
+    }
+
+    // the splat's surfaces were seen and shaded by the app, so it goes
+    // first and rays are only traced where it left holes
+    glState().setEnabled(GL_STENCIL_TEST, true);
+    glStencilFunc(GL_NOTEQUAL, 1, 0xFF);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+    for(size_t i = 0; i <= lastFrame->layers.size(); i++) {
+        if((int)i == splatBefore) {
+            if(activeVoxelCache.enabled)
+                drawVoxelSplat();
+            if(sceneTrace)
+                drawSceneTrace();
+        }
+        if(i == lastFrame->layers.size() || !layerVisible(lastFrame->layers[i]))
+            continue;
+        int count = layerBatchLength(i, 1, splatBefore);
+        if(count > 1) {
+            drawLayerBatch(i, 1, count);
+            i += count - 1;
+        }
+        else {
+            drawLayer(lastFrame->layers[i], i);
+        }
+    }
+    glState().setEnabled(GL_STENCIL_TEST, false);
+}
+
+/**
+ * Index of the layer a DEPTH_PEELED layer was peeled from, through any
+ * peeled layers between them, or the index itself for other layers
+ */
+static int peeledFrom(int layerIndex) {
+    while(layerIndex > 0 && (lastFrame->layers[layerIndex].flags & DEPTH_PEELED))
+        layerIndex--;
+    return layerIndex;
+}
+
+static void drawLayer(const FrameLayer& layer, int layerIndex) {
+    ARP_TRACE_INDEXED_SCOPE("drawLayer", layerIndex);
+    if(layer.swapchain->isCubeMap()) {
+        drawLayerCubeMap(layer, layerIndex);
+        return;
+    }
+    const LayerCamera& camera = layerCameras[layerIndex];
+    bool translated = layerTranslated(layer, layerIndex);
+    if(layer.flags & DEPTH_PEELED) {
+        // only seen where the layer in front leaves disocclusions, which
+        // only parallax does
+        if((layer.flags & PARALLAX_ENABLED) && !(layer.flags & CAMERA_LOCKED) && translated)
+            drawLayerParallaxEnabled(layer, layerIndex);
+        return;
+    }
+    if(layerPassesThrough(layer, camera, translated)) {
+        drawLayerCopy(layer, layerIndex);
+        return;
+    }
+    if((layer.flags & GRID_WARP_ENABLED) && !(layer.flags & CAMERA_LOCKED) && translated) {
+        drawLayerGridWarp(layer, layerIndex);
+        return;
+    }
+    // reshaded layers' color lacks the specular term only parallax adds
+    if((layer.flags & PARALLAX_ENABLED) && !(layer.flags & CAMERA_LOCKED) && (translated || reshaded(layer))) {
+        drawLayerParallaxEnabled(layer, layerIndex);
+        return;
+    }
+    // only the rotation is reprojected, which maps this refresh's image to
+    // the layer's by a homography
+    glm::quat layerOrientation = camera.pose.orientation;
+    if(layer.flags & CAMERA_LOCKED)
+        layerOrientation = cameraPose.orientation;
+    glm::mat3 homography = rotationHomography(camera.projection, layerOrientation);
+
+    const LayerProgram& program = layerProgram(LAYER_PROGRAM_DEFAULT, layerPermutation(layer, false));
+    glState().useProgram(program.program);
+    glUniformMatrix3fv(program.homographyLoc, 1, GL_FALSE, &homography[0][0]);
+    bindLayerImage(program, layer);
+    if(depthUpsampled(layer)) {
+        glUniform2f(program.depthRangeLoc, camera.projection.nearPlane, camera.projection.farPlane);
+        glState().bindTexture(1, GL_TEXTURE_2D, layerPyramids[layerIndex].texture);
+    }
+
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+}
+
+/**
+ * Whether drawLayer reprojects the layer's change in position. That needs
+ * the layer's depth, and layers behind the first only get it at full enough
+ * quality. Peeled layers go with the layer they were peeled from. Saving
+ * power, every layer is only rotated
+ */
+static bool layerTranslated(const FrameLayer& layer, int layerIndex) {
+    return layerCameras[layerIndex].pose.position != cameraPose.position && layer.swapchain->hasDepth()
+           && (peeledFrom(layerIndex) == 0 || quality.backgroundParallax)
+           && !powerSaving.load(std::memory_order_relaxed);
+}
+
+/**
+ * Whether drawLayer would draw the layer with the homography alone and
+ * nothing but its image and alpha mask, so it can share drawLayerBatch's
+ * draw with other layers
+ */
+static bool batchableLayer(const FrameLayer& layer, int layerIndex) {
+    if(layer.swapchain->isCubeMap() || (layer.flags & DEPTH_PEELED) || resolvedHistory(layer)
+       || motionTime(layer) != 0 || depthUpsampled(layer))
+        return false;
+    bool translated = layerTranslated(layer, layerIndex);
+    if(layerPassesThrough(layer, layerCameras[layerIndex], translated))
+        return false;
+    if(layer.flags & CAMERA_LOCKED)
+        return true;
+    if((layer.flags & GRID_WARP_ENABLED) && translated)
+        return false;
+    return !(layer.flags & PARALLAX_ENABLED) || (!translated && !reshaded(layer));
+}
+
+/**
+ * Number of layers from first on, stepping by step through draw order,
+ * that drawLayerBatch can draw at once: visible, batchable and showing the
+ * same image with the same alpha mask. A batch never spans the splat drawn
+ * between splatBefore - 1 and splatBefore
+ */
+static int layerBatchLength(int first, int step, int splatBefore) {
+    const FrameLayer& head = lastFrame->layers[first];
+    if(!batchableLayer(head, first))
+        return 1;
+    int count = 1;
+    for(int i = first + step; i >= 0 && i < (int)lastFrame->layers.size(); i += step) {
+        const FrameLayer& layer = lastFrame->layers[i];
+        if(std::min(i, i - step) == splatBefore - 1 || !layerVisible(layer) || layer.swapchain != head.swapchain
+           || layer.swapchainIndex != head.swapchainIndex
+           || (layer.flags & ALPHA_MASKED) != (head.flags & ALPHA_MASKED) || !batchableLayer(layer, i))
+            break;
+        count++;
+    }
+    return count;
+}
+
+/**
+ * Draws count batchable layers sharing an image, from first on stepping by
+ * step, in one instanced draw in that order, so later ones still cover or
+ * are stenciled out by earlier ones as with drawLayer
+ */
+static void drawLayerBatch(int first, int step, int count) {
+    ARP_TRACE_INDEXED_SCOPE("drawLayerBatch", first);
+    const FrameLayer& head = lastFrame->layers[first];
+    glm::mat3 homographies[MAX_FRAME_LAYERS];
+    glm::mat3 inverseHomographies[MAX_FRAME_LAYERS];
+    float rects[MAX_FRAME_LAYERS][4];
+    float clamps[MAX_FRAME_LAYERS][4];
+    for(int i = 0; i < count; i++) {
+        int layerIndex = first + i * step;
+        const FrameLayer& layer = lastFrame->layers[layerIndex];
+        const LayerCamera& camera = layerCameras[layerIndex];
+        glm::quat layerOrientation = camera.pose.orientation;
+        if(layer.flags & CAMERA_LOCKED)
+            layerOrientation = cameraPose.orientation;
+        homographies[i] = rotationHomography(camera.projection, layerOrientation);
+        inverseHomographies[i] = glm::inverse(homographies[i]);
+        layerRect(layer, rects[i], clamps[i]);
+    }
+
+    const LayerProgram& program = layerProgram(LAYER_PROGRAM_ATLAS, layerPermutation(head, false));
+    glState().useProgram(program.program);
+    glUniformMatrix3fv(program.homographiesLoc, count, GL_FALSE, &homographies[0][0][0]);
+    glUniformMatrix3fv(program.inverseHomographiesLoc, count, GL_FALSE, &inverseHomographies[0][0][0]);
+    glUniform4fv(program.layerRectsLoc, count, &rects[0][0]);
+    glUniform4fv(program.layerClampsLoc, count, &clamps[0][0]);
+    glState().bindTexture(0, GL_TEXTURE_2D, head.swapchain->images[head.swapchainIndex]);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
+}
+
+static void drawLayerParallaxEnabled(const FrameLayer& layer, int layerIndex) {
+    struct Source {
+        const FrameLayer* layer;
+        const LayerCamera* camera;
+        const DepthPyramid* pyramid;
+        const CompactColor* compact;
+    };
+
+    // frames that saw this layer, newest first. A kept layer is the same
+    // image in several frames and only counts once
+    Source sources[maxFrameHistory];
+    int count = 0;
+    sources[count++] = { &layer, &layerCameras[layerIndex], &layerPyramids[layerIndex], nullptr };
+    for(const RetainedFrame& retained : retainedFrames) {
+        if(count == maxFrameHistory || layerIndex >= (int)retained.layers.size())
+            break;
+        const FrameLayer& old = retained.layers[layerIndex];
+        const DepthPyramid& pyramid = retained.pyramids[layerIndex];
+        if(old.submission == sources[count - 1].layer->submission || pyramid.submission != old.submission)
+            continue;
+        const CompactColor& compact = retained.colors[layerIndex];
+        sources[count++] = { &old, &retained.cameras[layerIndex], &pyramid, compact.active ? &compact : nullptr };
+    }
+
+    // with stencil compositing the newest frame is drawn first and older
+    // ones only shade what it discarded. Back to front, older frames go
+    // underneath. Either way a frame may leave disocclusions to whatever
+    // is drawn under it
+    bool layersBelow = layerIndex + 1 < (int)lastFrame->layers.size()
+                       || (voxelSplatLayer >= 0 && peeledFrom(layerIndex) == voxelSplatLayer);
+    for(int i = 0; i < count; i++) {
+        const Source& source = sources[stencilCompositing ? i : count - 1 - i];
+        int age = stencilCompositing ? i : count - 1 - i;
+        drawParallax(*source.layer, *source.camera, *source.pyramid, layersBelow || age + 1 < count, source.compact);
+    }
+}
+
+/**
+ * Draws one frame's image of a parallax layer, from compact's color instead
+ * of the layer's image if given
+ */
+static void drawParallax(const FrameLayer& layer, const LayerCamera& camera, const DepthPyramid& pyramid,
+                         bool fillDisocclusions, const CompactColor* compact) {
+    if(computeParallax) {
+        drawParallaxCompute(layer, camera, pyramid, fillDisocclusions, compact);
+        return;
+    }
+
+    // rays end on the far plane of the layer's frustum
+    glm::mat4 model = cameraMatrix(camera.pose) * frustumPlane(camera.projection, camera.projection.farPlane);
+
+    // update uniforms
+    const LayerProgram& program = layerProgram(LAYER_PROGRAM_PARALLAX, layerPermutation(layer, fillDisocclusions));
+    glState().useProgram(program.program);
+
+    glUniformMatrix4fv(program.modelLoc, 1, GL_FALSE, &model[0][0]);
+    glUniformMatrix4fv(program.frameViewProjectionLoc, 1, GL_FALSE, &camera.viewProjection[0][0]);
+    glUniform1i(program.hizLevelsLoc, pyramid.levels);
+    glUniform2f(program.depthRangeLoc, camera.projection.nearPlane, camera.projection.farPlane);
+    bindLayerImage(program, layer);
+    if(compact)
+        bindCompactColor(program, *compact);
+    bindReshading(program, layer, camera);
+    glState().bindTexture(1, GL_TEXTURE_2D, pyramid.texture);
+
+    drawLayerPlane();
+}
+
+/**
+ * Binds a compacted layer's color in place of the image bindLayerImage
+ * bound, the copy covering the whole texture
+ */
+static void bindCompactColor(const LayerProgram& program, const CompactColor& compact) {
+    glUniform4f(program.layerRectLoc, 0, 0, 1, 1);
+    glUniform4f(program.layerClampLoc, 0.5f / compact.width, 0.5f / compact.height, 1 - 0.5f / compact.width,
+                1 - 0.5f / compact.height);
+    glState().bindTexture(0, GL_TEXTURE_2D, compact.texture);
+}
+/**
+ * Draws the radius-1 plane of quadVao. Lens distortion only moves vertices,
+ * so with it the plane is drawn as a mesh fine enough for the distortion to
+ * look smooth instead
+ */
+static void drawLayerPlane() {
+    if(!refreshLensDistortion.enabled) {
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        return;
+    }
+    glState().bindVertexArray(distortionMeshVao);
+    glDrawElements(GL_TRIANGLES, distortionMeshIndexCount, GL_UNSIGNED_INT, (GLvoid*)0);
+    glState().bindVertexArray(quadVao);
+}
+
+/**
+ * (Re)builds the plane drawLayerPlane draws with lens distortion, cells by
+ * cells quads over the same square as quadVao
+ */
+static void buildDistortionMesh(int cells) {
+    cells = std::max(1, cells);
+    if(!distortionMeshVao) {
+        glGenVertexArrays(1, &distortionMeshVao);
+        glGenBuffers(1, &distortionMeshVbo);
+        glGenBuffers(1, &distortionMeshIbo);
+    }
+
+    std::vector<float> vertices;
+    vertices.reserve((cells + 1) * (cells + 1) * 3);
+    for(int y = 0; y <= cells; y++) {
+        for(int x = 0; x <= cells; x++) {
+            vertices.push_back(x * 2.f / cells - 1);
+            vertices.push_back(y * 2.f / cells - 1);
+            vertices.push_back(0);
+        }
+    }
+    std::vector<uint32_t> indices;
+    indices.reserve(cells * cells * 6);
+    for(int y = 0; y < cells; y++) {
+        for(int x = 0; x < cells; x++) {
+            uint32_t i0 = y * (cells + 1) + x;
+            uint32_t i1 = i0 + 1;
+            uint32_t i2 = i0 + cells + 1;
+            uint32_t i3 = i2 + 1;
+            indices.insert(indices.end(), {i0, i1, i2, i2, i1, i3});
+        }
+    }
+    distortionMeshCells = cells;
+    distortionMeshIndexCount = indices.size();
+
+    glState().bindVertexArray(distortionMeshVao);
+    glBindBuffer(GL_ARRAY_BUFFER, distortionMeshVbo);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, distortionMeshIbo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint32_t), indices.data(), GL_STATIC_DRAW);
+    // pos of parallaxVertSrc, like the quad
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (GLvoid*)0);
+    glState().bindVertexArray(quadVao);
+}
+
+/**
+ * Returns a texture of the given format and size no other pass holds, made
+ * if none is free. Hand it back with releaseTransientTexture once the pass
+ * that draws into it has been issued, what it held is undefined after that
+ */
+static GLuint acquireTransientTexture(GLenum format, int width, int height) {
+    for(TransientTexture& transient : transientTextures) {
+        if(!transient.acquired && transient.format == format && transient.width == width
+           && transient.height == height) {
+            transient.acquired = true;
+            return transient.texture;
+        }
+    }
+    TransientTexture transient;
+    transient.format = format;
+    transient.width = width;
+    transient.height = height;
+    transient.acquired = true;
+    transient.idleRefreshes = 0;
+    glGenTextures(1, &transient.texture);
+    glState().bindTexture(0, GL_TEXTURE_2D, transient.texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, format, width, height);
+    // integer formats are only complete with nearest filtering, the others
+    // are filtered by the composite with lens distortion
+    GLint filter = format == GL_R32UI ? GL_NEAREST : GL_LINEAR;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    transientTextures.push_back(transient);
+    return transient.texture;
+}
+
+static void releaseTransientTexture(GLuint texture) {
+    for(TransientTexture& transient : transientTextures) {
+        if(transient.texture == texture) {
+            transient.acquired = false;
+            transient.idleRefreshes = 0;
+            return;
+        }
+    }
+}
+
+/**
+ * Frees transient textures no pass asked for in maxIdle refreshes. Called
+ * after each refresh, with 0 under memory pressure
+ */
+static void trimTransientTextures(int maxIdle) {
+    std::size_t kept = 0;
+    for(TransientTexture& transient : transientTextures) {
+        if(!transient.acquired && transient.idleRefreshes++ >= maxIdle) {
+            glState().forgetTexture(transient.texture);
+            glDeleteTextures(1, &transient.texture);
+            continue;
+        }
+        transientTextures[kept++] = transient;
+    }
+    transientTextures.resize(kept);
+}
+
+static std::int64_t transientTextureBytes() {
+    std::int64_t bytes = 0;
+    for(const TransientTexture& transient : transientTextures)
+        bytes += textureBytes(transient.format, transient.width, transient.height);
+    return bytes;
+}
+
+/**
+ * drawParallax with the compute pass. The pass writes the viewport into an
+ * rgba16f transient texture, which is then drawn like any other layer so the
+ * stencil still applies
+ */
+static void drawParallaxCompute(const FrameLayer& layer, const LayerCamera& camera, const DepthPyramid& pyramid,
+                                bool fillDisocclusions, const CompactColor* compact) {
+    GLint viewport[4];
+    if(!glState().getViewport(viewport))
+        glGetIntegerv(GL_VIEWPORT, viewport);
+    GLuint reprojected = acquireTransientTexture(GL_RGBA16F, viewport[2], viewport[3]);
+
+    glm::vec3 forward = camera.pose.orientation * glm::vec3(0, 0, -1);
+    glm::vec3 farPoint = camera.pose.position + forward * camera.projection.farPlane;
+    glm::mat4 inverseViewProjection = glm::inverse(projection * viewMatrix(cameraPose));
+
+    const LayerProgram& program = layerProgram(LAYER_PROGRAM_PARALLAX_COMPUTE,
+                                               layerPermutation(layer, fillDisocclusions));
+    glState().useProgram(program.program);
+    glUniformMatrix4fv(program.frameViewProjectionLoc, 1, GL_FALSE, &camera.viewProjection[0][0]);
+    glUniform1i(program.hizLevelsLoc, pyramid.levels);
+    glUniform2f(program.depthRangeLoc, camera.projection.nearPlane, camera.projection.farPlane);
+    bindLayerImage(program, layer);
+    if(compact)
+        bindCompactColor(program, *compact);
+    bindReshading(program, layer, camera);
+    glUniformMatrix4fv(program.inverseViewProjectionLoc, 1, GL_FALSE, &inverseViewProjection[0][0]);
+    glUniform4f(program.farPlaneLoc, forward.x, forward.y, forward.z, glm::dot(farPoint, forward));
+    glUniform4i(program.viewportLoc, viewport[0], viewport[1], viewport[2], viewport[3]);
+
+    glState().bindTexture(1, GL_TEXTURE_2D, pyramid.texture);
+    glBindImageTexture(0, reprojected, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+    glDispatchCompute((viewport[2] + 7) / 8, (viewport[3] + 7) / 8, 1);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+    glState().useProgram(parallaxCompositeProgram);
+    glUniform2i(parallaxCompositeViewportOriginLoc, viewport[0], viewport[1]);
+    glState().bindTexture(0, GL_TEXTURE_2D, reprojected);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    releaseTransientTexture(reprojected);
+}
+
+/**
+ * Dispatches the bound compute program with local_size_x 64 over count
+ * invocations, in rows of at most 65535 groups
+ */
+static void dispatchLinear(GLuint count) {
+    GLuint groups = std::max((count + 63) / 64, 1u);
+    GLuint rows = (groups + 65534) / 65535;
+    glDispatchCompute((groups + rows - 1) / rows, rows, 1);
+}
+
+/**
+ * Takes up setVoxelCache's settings, making or emptying the cache's buffer
+ * when they changed how it is laid out
+ */
+static void updateVoxelCache() {
+    VoxelCache settings;
+    {
+        std::lock_guard<std::mutex> lock(voxelCacheMutex);
+        settings = voxelCacheSettings;
+    }
+    settings.capacity = std::max(settings.capacity, 1);
+    settings.stride = std::max(settings.stride, 1);
+    if(!settings.enabled || !voxelInsertProgram || !voxelSplatProgram) {
+        if(voxelCacheBuffer) {
+            glDeleteBuffers(1, &voxelCacheBuffer);
+            voxelCacheBuffer = 0;
+        }
+        activeVoxelCache.enabled = false;
+        return;
+    }
+    if(!voxelCacheBuffer || settings.capacity != activeVoxelCache.capacity
+       || settings.voxelSize != activeVoxelCache.voxelSize) {
+        // voxels of another size would be found under the wrong keys
+        if(!voxelCacheBuffer)
+            glGenBuffers(1, &voxelCacheBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, voxelCacheBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)settings.capacity * 8 * sizeof(GLuint),
+                     nullptr, GL_DYNAMIC_COPY);
+        GLuint zero = 0;
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    }
+    activeVoxelCache = settings;
+    voxelCacheFrame++;
+}
+
+/**
+ * Inserts the pixels of a parallax layer's new image into the voxel cache,
+ * after its depth pyramid is built
+ */
+static void insertVoxels(const FrameLayer& layer, const LayerCamera& camera, const DepthPyramid& pyramid) {
+    ARP_TRACE_GPU_SCOPE("insertVoxels");
+    glState().useProgram(voxelInsertProgram);
+    glUniform1f(voxelInsertVoxelSizeLoc, activeVoxelCache.voxelSize);
+    glUniform1ui(voxelInsertSubmissionLoc, voxelCacheFrame);
+    glUniform1ui(voxelInsertMaxAgeLoc, activeVoxelCache.maxAge);
+    setLayerRect(voxelInsertLayerRectLoc, voxelInsertLayerClampLoc, &layer);
+    glUniformMatrix4fv(voxelInsertInverseViewProjectionLoc, 1, GL_FALSE, &camera.inverseViewProjection[0][0]);
+    glUniform1i(voxelInsertStrideLoc, activeVoxelCache.stride);
+    glState().bindTexture(0, GL_TEXTURE_2D, layer.swapchain->images[layer.swapchainIndex]);
+    glState().bindTexture(1, GL_TEXTURE_2D, pyramid.texture);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, voxelCacheBuffer);
+    int stride = activeVoxelCache.stride;
+    glDispatchCompute(((pyramid.width + stride - 1) / stride + 7) / 8,
+                      ((pyramid.height + stride - 1) / stride + 7) / 8, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+/**
+ * Copies the live voxels of the cache for getVoxelCachePoints if it asked
+ * for them
+ */
+static void readVoxelCache() {
+    if(!voxelCacheReadbackRequested.exchange(false))
+        return;
+    struct Voxel {
+        GLuint key;
+        GLuint color;
+        GLuint submission;
+        GLuint padding;
+        GLint coords[4];
+    };
+    std::vector<VoxelCachePoint> points;
+    if(activeVoxelCache.enabled) {
+        std::vector<Voxel> voxels(activeVoxelCache.capacity);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, voxelCacheBuffer);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, voxels.size() * sizeof(Voxel), voxels.data());
+        for(const Voxel& voxel : voxels) {
+            if(voxel.key == 0 || voxelCacheFrame - voxel.submission > (GLuint)activeVoxelCache.maxAge)
+                continue;
+            glm::vec3 position = (glm::vec3(voxel.coords[0], voxel.coords[1], voxel.coords[2]) + 0.5f)
+                                 * activeVoxelCache.voxelSize;
+            points.push_back({ position, voxel.color });
+        }
+    }
+    std::lock_guard<std::mutex> lock(voxelCacheMutex);
+    voxelCacheReadback = std::move(points);
+    voxelCacheReadbackReady = true;
+}
+
+/**
+ * Draws the voxel cache as seen from cameraPose into the viewport, through
+ * the parallax composite so the stencil and lens distortion apply
+ */
+static void drawVoxelSplat() {
+    ARP_TRACE_GPU_SCOPE("drawVoxelSplat");
+    GLint viewport[4];
+    if(!glState().getViewport(viewport))
+        glGetIntegerv(GL_VIEWPORT, viewport);
+    GLuint reprojected = acquireTransientTexture(GL_RGBA16F, viewport[2], viewport[3]);
+    // r32ui nearest voxel distances of the splat
+    GLuint splatDepth = acquireTransientTexture(GL_R32UI, viewport[2], viewport[3]);
+
+    glm::mat4 viewProjection = projection * viewMatrix(cameraPose);
+    glState().useProgram(voxelSplatProgram);
+    glUniform1f(voxelSplatVoxelSizeLoc, activeVoxelCache.voxelSize);
+    glUniform1ui(voxelSplatSubmissionLoc, voxelCacheFrame);
+    glUniform1ui(voxelSplatMaxAgeLoc, activeVoxelCache.maxAge);
+    glUniformMatrix4fv(voxelSplatViewProjectionLoc, 1, GL_FALSE, &viewProjection[0][0]);
+    glUniform2i(voxelSplatSizeLoc, viewport[2], viewport[3]);
+    glUniform1f(voxelSplatPixelScaleLoc, projection[1][1] * viewport[3] * 0.5f);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, voxelCacheBuffer);
+    glBindImageTexture(0, reprojected, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+    glBindImageTexture(1, splatDepth, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+    for(int pass = 0; pass < 3; pass++) {
+        glUniform1i(voxelSplatPassLoc, pass);
+        dispatchLinear(pass == 0 ? viewport[2] * viewport[3] : activeVoxelCache.capacity);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    }
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+    glState().useProgram(parallaxCompositeProgram);
+    glUniform2i(parallaxCompositeViewportOriginLoc, viewport[0], viewport[1]);
+    glState().bindTexture(0, GL_TEXTURE_2D, reprojected);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    releaseTransientTexture(splatDepth);
+    releaseTransientTexture(reprojected);
+}
+
+/**
+ * Takes the lights setReshadingLights last set, if it was called since
+ */
+static void updateReshadingLights() {
+    std::lock_guard<std::mutex> lock(reshadingLightsMutex);
+    if(!reshadingLightsPending)
+        return;
+    reshadingLightCount = (int)pendingReshadingLights.size();
+    for(int i = 0; i < reshadingLightCount; i++) {
+        const ReshadingLight& light = pendingReshadingLights[i];
+        reshadingLightPositions[i] = light.position;
+        reshadingLightColors[i] = glm::vec4(light.color, light.radius);
+    }
+    reshadingLightsPending = false;
+}
+
+/**
+ * Uploads the BVH setSceneGeometry last built, if it built one since
+ */
+static void updateSceneGeometry() {
+    std::vector<SceneBvhNode> nodes;
+    std::vector<SceneBvhTriangle> triangles;
+    {
+        std::lock_guard<std::mutex> lock(sceneGeometryMutex);
+        if(!sceneGeometryPending)
+            return;
+        nodes.swap(pendingSceneNodes);
+        triangles.swap(pendingSceneTriangles);
+        sceneGeometryPending = false;
+    }
+    if(nodes.empty() || !sceneTraceProgram) {
+        glDeleteBuffers(1, &sceneNodeBuffer);
+        glDeleteBuffers(1, &sceneTriangleBuffer);
+        sceneNodeBuffer = 0;
+        sceneTriangleBuffer = 0;
+        sceneBvhBytes = 0;
+        return;
+    }
+    if(!sceneNodeBuffer) {
+        glGenBuffers(1, &sceneNodeBuffer);
+        glGenBuffers(1, &sceneTriangleBuffer);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, sceneNodeBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, nodes.size() * sizeof(SceneBvhNode), nodes.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, sceneTriangleBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, triangles.size() * sizeof(SceneBvhTriangle), triangles.data(),
+                 GL_STATIC_DRAW);
+    sceneBvhBytes = nodes.size() * sizeof(SceneBvhNode) + triangles.size() * sizeof(SceneBvhTriangle);
+}
+
+/**
+ * Traces the scene geometry into the viewport from cameraPose. Drawn with
+ * the stencil test of drawLayers, so covered pixels are rejected before
+ * their rays are traced
+ */
+static void drawSceneTrace() {
+    ARP_TRACE_GPU_SCOPE("drawSceneTrace");
+    glm::mat4 inverseViewProjection = glm::inverse(projection * viewMatrix(cameraPose));
+    glState().useProgram(sceneTraceProgram);
+    glUniformMatrix4fv(sceneTraceInverseViewProjectionLoc, 1, GL_FALSE, &inverseViewProjection[0][0]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, sceneNodeBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, sceneTriangleBuffer);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+}
+
+static void drawLayerGridWarp(const FrameLayer& layer, int layerIndex) {
+    const DepthPyramid& pyramid = layerPyramids[layerIndex];
+    int cellSize = gridCellSize * quality.gridWarpCellScale;
+    // the fovea is placed by where the layer is in the window, which it
+    // about covers. Snapping it keeps small eye movements from rebuilding
+    // the grid
+    float peripheralQuality = 1;
+    glm::vec2 fovea(0.5f);
+    float radius = 0;
+    if(refreshFoveation.enabled) {
+        peripheralQuality = refreshFoveation.peripheralQuality;
+        fovea = glm::round(refreshFoveation.center * 32.f) / 32.f;
+        radius = refreshFoveation.outerRadius;
+    }
+    static std::vector<float> xs;
+    static std::vector<float> ys;
+    gridAxis(pyramid.width, cellSize, fovea.x, radius * pyramid.height / pyramid.width, peripheralQuality, xs);
+    gridAxis(pyramid.height, cellSize, fovea.y, radius, peripheralQuality, ys);
+    if(gridMesh.xs != xs || gridMesh.ys != ys) {
+        buildGridMesh(gridMesh, xs, ys);
+    }
+
+    // pyramid texel closest to one grid cell
+    float hizLevel = std::min(std::log2((float)cellSize), (float)(pyramid.levels - 1));
+
+    const LayerProgram& program = layerProgram(LAYER_PROGRAM_GRID_WARP, layerPermutation(layer, false));
+    glState().useProgram(program.program);
+
+    glUniformMatrix4fv(program.inverseFrameViewProjectionLoc, 1, GL_FALSE,
+                       &layerCameras[layerIndex].inverseViewProjection[0][0]);
+    glUniform1f(program.hizLevelLoc, hizLevel);
+    bindLayerImage(program, layer);
+    glState().bindTexture(1, GL_TEXTURE_2D, pyramid.texture);
+
+    // where the grid folds over itself the nearest surface has to win
+    glClear(GL_DEPTH_BUFFER_BIT);
+    glState().setEnabled(GL_DEPTH_TEST, true);
+    glState().bindVertexArray(gridMesh.vao);
+    glDrawElements(GL_TRIANGLES, gridMesh.indexCount, GL_UNSIGNED_INT, (GLvoid*)0);
+    glState().bindVertexArray(quadVao);
+    glState().setEnabled(GL_DEPTH_TEST, false);
+}
+
+/**
+ * Binds the color texture reprojection draws the layer from to texture unit
+ * 0, its temporal history if it has one and otherwise its swapchain image,
+ * and sets the program's LAYER_RECT_SRC uniforms for it. Also binds the
+ * layer's velocity image to unit 2 and sets the program's
+ * MOTION_EXTRAPOLATION_SRC uniforms, with the time to extrapolate by 0 if
+ * the layer has no motion to extrapolate. A stale layer's objects are held at
+ * maxMotionExtrapolation rather than sent off screen
+ */
+static void bindLayerImage(const LayerProgram& program, const FrameLayer& layer) {
+    float rect[4];
+    float clamp[4];
+    const TemporalHistory* history = resolvedHistory(layer);
+    if(history) {
+        glUniform4f(program.layerRectLoc, 0, 0, 1, 1);
+        glUniform4f(program.layerClampLoc, 0, 0, 1, 1);
+        glState().bindTexture(0, GL_TEXTURE_2D, history->textures[history->current]);
+    }
+    else {
+        layerRect(layer, rect, clamp);
+        glUniform4fv(program.layerRectLoc, 1, rect);
+        glUniform4fv(program.layerClampLoc, 1, clamp);
+        glState().bindTexture(0, GL_TEXTURE_2D, layer.swapchain->images[layer.swapchainIndex]);
+    }
+
+    float time = motionTime(layer);
+    glUniform1f(program.motionTimeLoc, time);
+    if(time == 0)
+        return;
+    layerRect(layer, rect, clamp);
+    glUniform4fv(program.velocityRectLoc, 1, rect);
+    glUniform4fv(program.velocityClampLoc, 1, clamp);
+    glState().bindTexture(2, GL_TEXTURE_2D, layer.swapchain->velocityImages[layer.swapchainIndex]);
+}
+
+/**
+ * Binds a VIEW_DEPENDENT_RESHADING layer's material image to unit 3 and sets
+ * the program's RESHADING_SRC uniforms. Does nothing for other layers
+ */
+static void bindReshading(const LayerProgram& program, const FrameLayer& layer, const LayerCamera& camera) {
+    if(!reshaded(layer))
+        return;
+    glUniformMatrix4fv(program.inverseFrameViewProjectionLoc, 1, GL_FALSE, &camera.inverseViewProjection[0][0]);
+    glUniform4fv(program.lightPositionsLoc, reshadingLightCount, &reshadingLightPositions[0][0]);
+    glUniform4fv(program.lightColorsLoc, reshadingLightCount, &reshadingLightColors[0][0]);
+    glUniform1i(program.lightCountLoc, reshadingLightCount);
+    glState().bindTexture(3, GL_TEXTURE_2D, layer.swapchain->materialImages[layer.swapchainIndex]);
+}
+
+/**
+ * The layer's viewport in its image, the whole image if it has none
+ */
+static void layerViewport(const FrameLayer& layer, int viewport[4]) {
+    if(layer.hasViewport) {
+        std::copy(layer.viewport, layer.viewport + 4, viewport);
+        return;
+    }
+    viewport[0] = 0;
+    viewport[1] = 0;
+    viewport[2] = layer.swapchain->getImageWidth(layer.swapchainIndex);
+    viewport[3] = layer.swapchain->getImageHeight(layer.swapchainIndex);
+}
+
+/**
+ * Values of LAYER_RECT_SRC's uniforms for the layer's viewport
+ */
+static void layerRect(const FrameLayer& layer, float rect[4], float clamp[4]) {
+    int viewport[4];
+    layerViewport(layer, viewport);
+    float width = layer.swapchain->getImageWidth(layer.swapchainIndex);
+    float height = layer.swapchain->getImageHeight(layer.swapchainIndex);
+    rect[0] = viewport[0] / width;
+    rect[1] = viewport[1] / height;
+    rect[2] = viewport[2] / width;
+    rect[3] = viewport[3] / height;
+    clamp[0] = (viewport[0] + 0.5f) / width;
+    clamp[1] = (viewport[1] + 0.5f) / height;
+    clamp[2] = (viewport[0] + viewport[2] - 0.5f) / width;
+    clamp[3] = (viewport[1] + viewport[3] - 0.5f) / height;
+}
+
+/**
+ * Sets the uniforms of LAYER_RECT_SRC for the layer's viewport, or for the
+ * whole texture without a layer
+ */
+static void setLayerRect(GLint rectLoc, GLint clampLoc, const FrameLayer* layer) {
+    if(!layer) {
+        glUniform4f(rectLoc, 0, 0, 1, 1);
+        glUniform4f(clampLoc, 0, 0, 1, 1);
+        return;
+    }
+    float rect[4];
+    float clamp[4];
+    layerRect(*layer, rect, clamp);
+    glUniform4fv(rectLoc, 1, rect);
+    glUniform4fv(clampLoc, 1, clamp);
+}
+
+/**
+ * The history resolved from the layer's image, null if it has none
+ */
+static const TemporalHistory* resolvedHistory(const FrameLayer& layer) {
+    if(!(layer.flags & (TEMPORAL_ACCUMULATION_ENABLED | CHECKERBOARD_ENABLED)))
+        return nullptr;
+    for(const TemporalHistory& history : layerHistories) {
+        if(history.submission == layer.submission && history.swapchain == layer.swapchain
+           && history.swapchainIndex == layer.swapchainIndex)
+            return &history;
+    }
+    return nullptr;
+}
+
+static float motionTime(const FrameLayer& layer) {
+    if(!(layer.flags & MOTION_EXTRAPOLATION_ENABLED) || !layer.swapchain->hasVelocity())
+        return 0;
+    // back along the newest frame's motion, forward along older ones'
+    if(interpolating) {
+        double dt = interpolationShownTime - layer.time;
+        return (float)std::min(std::max(dt, -maxMotionExtrapolation), maxMotionExtrapolation);
+    }
+    double dt = cameraPoseInfo.time - layer.time;
+    return (float)std::min(std::max(dt, 0.0), maxMotionExtrapolation);
+}
+
+/**
+ * Whether a layer of lastFrame still moves its objects along their motion
+ * vectors, so refreshes can't go idle yet
+ */
+static bool extrapolatingMotion() {
+    for(const FrameLayer& layer : lastFrame->layers) {
+        if(layer.swapchain && (layer.flags & MOTION_EXTRAPOLATION_ENABLED) && layer.swapchain->hasVelocity()
+           && motionTime(layer) < maxMotionExtrapolation)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Keeps the poses of the two newest frames and, while interpolating, moves
+ * the camera to where it was one frame interval before time, between the
+ * two. Without two frames, or within interpolationInputHold of input, the
+ * camera stays where the pose function put it
+ */
+static void interpolateCameraPose(double time, bool latched, bool input) {
+    if(latched) {
+        interpolationPoses[0] = interpolationPoses[1];
+        interpolationTimes[0] = interpolationTimes[1];
+        interpolationPoses[1] = lastFrame->pose;
+        interpolationTimes[1] = lastFrame->poseInfo.time;
+    }
+    if(input)
+        lastInteractiveInput = time;
+
+    double interval = interpolationTimes[1] - interpolationTimes[0];
+    interpolating = frameInterpolation.load(std::memory_order_relaxed) && interval > 0 && interpolationTimes[0] > 0
+                    && time - lastInteractiveInput >= interpolationInputHold;
+    if(!interpolating)
+        return;
+    // a late frame holds the newest pose rather than running past it
+    double alpha = std::min(std::max((time - interval - interpolationTimes[0]) / interval, 0.0), 1.0);
+    interpolationShownTime = interpolationTimes[0] + alpha * interval;
+    cameraPose.position = glm::mix(interpolationPoses[0].position, interpolationPoses[1].position, (float)alpha);
+    cameraPose.orientation = glm::slerp(interpolationPoses[0].orientation, interpolationPoses[1].orientation,
+                                        (float)alpha);
+}
+
+/**
+ * Whether the layer would be drawn unchanged over the whole viewport: it was
+ * rendered with this refresh's orientation, or is camera locked, with the
+ * frustum of the display's projection, and has no translation or motion to
+ * reproject
+ */
+static bool layerPassesThrough(const FrameLayer& layer, const LayerCamera& camera, bool translated) {
+    bool locked = layer.flags & CAMERA_LOCKED;
+    if(!locked && camera.pose.orientation != cameraPose.orientation)
+        return false;
+    if(!locked && translated && (layer.flags & (PARALLAX_ENABLED | GRID_WARP_ENABLED)))
+        return false;
+    if(motionTime(layer) != 0)
+        return false;
+    // a copy filters the layer's image without its depth, and adds no
+    // specular term
+    if(depthUpsampled(layer) || reshaded(layer))
+        return false;
+
+    // the plane is at any distance, so only the frustum's sides matter
+    LayerProjection display = LayerProjection::perspective(projectionFovY, projectionAspect, 1, 2);
+    const float tolerance = 1e-5f;
+    return std::abs(camera.projection.left - display.left) <= tolerance
+        && std::abs(camera.projection.right - display.right) <= tolerance
+        && std::abs(camera.projection.bottom - display.bottom) <= tolerance
+        && std::abs(camera.projection.top - display.top) <= tolerance;
+}
+
+/**
+ * Draws a layer that passes through with one texture read per pixel. Unlike
+ * a blit, this keeps the stencil test of the other layers
+ */
+static void drawLayerCopy(const FrameLayer& layer, int layerIndex) {
+    bool alphaMasked = layer.flags & ALPHA_MASKED;
+    if(const TemporalHistory* history = resolvedHistory(layer)) {
+        drawFullscreenTexture(history->textures[history->current], nullptr, true, alphaMasked);
+        return;
+    }
+    GLuint image = layer.swapchain->images[layer.swapchainIndex];
+    const LayerTiles& tiles = layerTiles[layerIndex];
+    // lens distortion bends the tiles' edges, so distorted layers are drawn whole
+    if(!sparseTiles(layer) || tiles.submission != layer.submission || tiles.swapchain != layer.swapchain
+       || tiles.swapchainIndex != layer.swapchainIndex || refreshLensDistortion.enabled) {
+        drawFullscreenTexture(image, &layer, true, alphaMasked);
+        return;
+    }
+
+    GLint viewport[4];
+    if(!glState().getViewport(viewport))
+        glGetIntegerv(GL_VIEWPORT, viewport);
+    int layerViewportSize[4];
+    layerViewport(layer, layerViewportSize);
+
+    glState().useProgram(copyProgram);
+    glUniform4f(copyViewportLoc, viewport[0], viewport[1], viewport[2], viewport[3]);
+    glUniform1i(copyDistortLoc, false);
+    glUniform1i(copyAlphaMaskedLoc, true);
+    setLayerRect(copyLayerRectLoc, copyLayerClampLoc, &layer);
+    glUniform2i(copyTileCountLoc, tiles.columns, tiles.rows);
+    glUniform2f(copyTileSizeLoc, (float)LAYER_TILE_SIZE / layerViewportSize[2],
+                (float)LAYER_TILE_SIZE / layerViewportSize[3]);
+    glState().bindTexture(0, GL_TEXTURE_2D, image);
+    glState().bindTexture(1, GL_TEXTURE_2D, tiles.texture);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, tiles.columns * tiles.rows);
+}
+
+static bool sparseTiles(const FrameLayer& layer) {
+    return (layer.flags & SPARSE_TILES) && (layer.flags & ALPHA_MASKED) && !layer.swapchain->isCubeMap()
+           && !(layer.flags & (TEMPORAL_ACCUMULATION_ENABLED | CHECKERBOARD_ENABLED));
+}
+
+/**
+ * Classifies the tiles of a SPARSE_TILES layer's new image, one fragment
+ * per tile
+ */
+static void classifyLayerTiles(LayerTiles& tiles, const FrameLayer& layer) {
+    ARP_TRACE_GPU_SCOPE("classifyLayerTiles");
+    int viewport[4];
+    layerViewport(layer, viewport);
+    int columns = (viewport[2] + LAYER_TILE_SIZE - 1) / LAYER_TILE_SIZE;
+    int rows = (viewport[3] + LAYER_TILE_SIZE - 1) / LAYER_TILE_SIZE;
+    if(tiles.texture == 0 || tiles.columns != columns || tiles.rows != rows) {
+        if(tiles.texture == 0)
+            glGenTextures(1, &tiles.texture);
+        tiles.columns = columns;
+        tiles.rows = rows;
+        glState().bindTexture(0, GL_TEXTURE_2D, tiles.texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, columns, rows, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    }
+
+    GLint originalFramebuffer;
+    GLint originalViewport[4];
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &originalFramebuffer);
+    glGetIntegerv(GL_VIEWPORT, originalViewport);
+
+    glState().bindFramebuffer(GL_DRAW_FRAMEBUFFER, tileClassifyFbo);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tiles.texture, 0);
+    glState().viewport(0, 0, columns, rows);
+    glState().useProgram(tileClassifyProgram);
+    glUniform4i(tileClassifyViewportLoc, viewport[0], viewport[1], viewport[2], viewport[3]);
+    glUniform1i(tileClassifyTileSizeLoc, LAYER_TILE_SIZE);
+    glState().bindTexture(0, GL_TEXTURE_2D, layer.swapchain->images[layer.swapchainIndex]);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glState().bindFramebuffer(GL_DRAW_FRAMEBUFFER, originalFramebuffer);
+    glState().viewport(originalViewport[0], originalViewport[1], originalViewport[2], originalViewport[3]);
+    tiles.swapchain = layer.swapchain;
+    tiles.swapchainIndex = layer.swapchainIndex;
+    tiles.submission = layer.submission;
+}
+
+/**
+ * Draws a 2D texture stretched over the viewport, only the layer's viewport
+ * of it if a layer is given. distort applies the lens distortion, if any,
+ * and alphaMasked leaves pixels with alpha under half to what is below
+ */
+static void drawFullscreenTexture(GLuint texture, const FrameLayer* layer, bool distort, bool alphaMasked) {
+    GLint viewport[4];
+    if(!glState().getViewport(viewport))
+        glGetIntegerv(GL_VIEWPORT, viewport);
+
+    glState().useProgram(copyProgram);
+    glUniform4f(copyViewportLoc, viewport[0], viewport[1], viewport[2], viewport[3]);
+    glUniform1i(copyDistortLoc, distort);
+    glUniform1i(copyAlphaMaskedLoc, alphaMasked);
+    setLayerRect(copyLayerRectLoc, copyLayerClampLoc, layer);
+    glUniform2i(copyTileCountLoc, 0, 0);
+    glState().bindTexture(0, GL_TEXTURE_2D, texture);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+}
+
+static void drawLayerCubeMap(const FrameLayer& layer, int layerIndex) {
+    glm::quat layerOrientation = layerCameras[layerIndex].pose.orientation;
+    if(layer.flags & CAMERA_LOCKED)
+        layerOrientation = cameraPose.orientation;
+    glm::mat4 clipToLayer = glm::mat4(glm::conjugate(layerOrientation) * cameraPose.orientation)
+                          * glm::inverse(projection);
+
+    glState().useProgram(cubeMapProgram);
+    glUniformMatrix4fv(cubeMapClipToLayerLoc, 1, GL_FALSE, &clipToLayer[0][0]);
+    glState().bindTexture(0, GL_TEXTURE_CUBE_MAP, layer.swapchain->images[layer.swapchainIndex]);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+}
+
+/**
+ * Positions from 0 to 1 of the grid lines along one axis of a layer pixels
+ * long. Lines are cellSize pixels apart within radius of the fovea and
+ * cellSize / peripheralQuality apart outside of it, so the grid only follows
+ * the depth closely where the eye can tell. Without foveation, a
+ * peripheralQuality of 1, the lines are evenly spaced
+ */
+static void gridAxis(int pixels, int cellSize, float fovea, float radius, float peripheralQuality,
+                     std::vector<float>& lines) {
+    float a = std::min(std::max(fovea - radius, 0.f), 1.f);
+    float b = std::min(std::max(fovea + radius, 0.f), 1.f);
+    float p = std::min(std::max(peripheralQuality, 0.01f), 1.f);
+    // lines are spread evenly over the integral of the density, 1 in the
+    // fovea and p outside
+    float total = p * a + (b - a) + p * (1 - b);
+    int cells = std::max(1, (int)std::ceil(pixels * total / cellSize));
+    lines.resize(cells + 1);
+    for(int i = 0; i < cells; i++) {
+        float target = total * i / cells;
+        if(target < p * a)
+            lines[i] = target / p;
+        else if(target < p * a + (b - a))
+            lines[i] = a + target - p * a;
+        else
+            lines[i] = b + (target - p * a - (b - a)) / p;
+    }
+    lines[cells] = 1;
+}
+
+static void buildGridMesh(GridMesh& grid, const std::vector<float>& xs, const std::vector<float>& ys) {
+    if(grid.vao == 0) {
+        glGenVertexArrays(1, &grid.vao);
+        glGenBuffers(1, &grid.vbo);
+        glGenBuffers(1, &grid.ibo);
+    }
+    grid.xs = xs;
+    grid.ys = ys;
+    int cols = xs.size() - 1;
+    int rows = ys.size() - 1;
+
+    std::vector<float> vertices;
+    vertices.reserve((cols + 1) * (rows + 1) * 2);
+    for(int y = 0; y <= rows; y++) {
+        for(int x = 0; x <= cols; x++) {
+            vertices.push_back(xs[x]);
+            vertices.push_back(ys[y]);
+        }
+    }
+
+    std::vector<uint32_t> indices;
+    indices.reserve(cols * rows * 6);
+    for(int y = 0; y < rows; y++) {
+        for(int x = 0; x < cols; x++) {
+            uint32_t i0 = y * (cols + 1) + x;
+            uint32_t i1 = i0 + 1;
+            uint32_t i2 = i0 + cols + 1;
+            uint32_t i3 = i2 + 1;
+            indices.insert(indices.end(), {i0, i1, i2, i2, i1, i3});
+        }
+    }
+    grid.indexCount = indices.size();
+
+    glState().bindVertexArray(grid.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, grid.vbo);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, grid.ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint32_t), indices.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (GLvoid*)0);
+    glState().bindVertexArray(quadVao);
+}
+
+void setGridWarpCellSize(int pixels) {
+    gridCellSize = std::max(1, pixels);
+}
+
+void setFoveation(const Foveation& settings) {
+    std::lock_guard<std::mutex> lock(foveationMutex);
+    foveation = settings;
+    foveation.peripheralQuality = std::min(std::max(settings.peripheralQuality, 0.f), 1.f);
+}
+
+void setLensDistortion(const LensDistortion& distortion) {
+    std::lock_guard<std::mutex> lock(lensDistortionMutex);
+    lensDistortion = distortion;
+}
+
+void setVoxelCache(const VoxelCache& cache) {
+    std::lock_guard<std::mutex> lock(voxelCacheMutex);
+    voxelCacheSettings = cache;
+}
+
+bool getVoxelCachePoints(std::vector<VoxelCachePoint>& points) {
+    voxelCacheReadbackRequested = true;
+    std::lock_guard<std::mutex> lock(voxelCacheMutex);
+    if(!voxelCacheReadbackReady)
+        return false;
+    points = std::move(voxelCacheReadback);
+    voxelCacheReadback.clear();
+    voxelCacheReadbackReady = false;
+    return true;
+}
+
+/**
+ * cy::BVH over the triangles of a SceneGeometry
+ */
+class SceneGeometryBVH : public cy::BVH {
+private:
+    const SceneGeometry& geometry;
+
+    const glm::vec3& corner(unsigned int triangle, int i) const {
+        return geometry.positions[geometry.indices[triangle * 3 + i]];
+    }
+
+public:
+    explicit SceneGeometryBVH(const SceneGeometry& geometry) : geometry(geometry) {}
+
+    void GetElementBounds(unsigned int i, float box[6]) const override {
+        glm::vec3 lo = glm::min(glm::min(corner(i, 0), corner(i, 1)), corner(i, 2));
+        glm::vec3 hi = glm::max(glm::max(corner(i, 0), corner(i, 1)), corner(i, 2));
+        for(int axis = 0; axis < 3; axis++) {
+            box[axis] = lo[axis];
+            box[axis + 3] = hi[axis];
+        }
+    }
+
+    float GetElementCenter(unsigned int i, int dimension) const override {
+        return (corner(i, 0)[dimension] + corner(i, 1)[dimension] + corner(i, 2)[dimension]) / 3.f;
+    }
+};
+
+/**
+ * Writes node id of the BVH into nodes[index], placing the children of
+ * inner nodes next to each other and the triangles of leaves in order
+ */
+static void flattenSceneBvh(const SceneGeometryBVH& bvh, const SceneGeometry& geometry, unsigned int id,
+                            std::size_t index, std::vector<SceneBvhNode>& nodes,
+                            std::vector<SceneBvhTriangle>& triangles) {
+    const float* bounds = bvh.GetNodeBounds(id);
+    SceneBvhNode& node = nodes[index];
+    std::memcpy(node.lo, bounds, sizeof(node.lo));
+    std::memcpy(node.hi, bounds + 3, sizeof(node.hi));
+    if(!bvh.IsLeafNode(id)) {
+        unsigned int child1, child2;
+        bvh.GetChildNodes(id, child1, child2);
+        std::size_t first = nodes.size();
+        nodes[index].first = first;
+        nodes[index].count = 0;
+        // node is invalidated by the resize
+        nodes.resize(first + 2);
+        flattenSceneBvh(bvh, geometry, child1, first, nodes, triangles);
+        flattenSceneBvh(bvh, geometry, child2, first + 1, nodes, triangles);
+        return;
+    }
+    node.first = triangles.size();
+    node.count = bvh.GetNodeElementCount(id);
+    const unsigned int* elements = bvh.GetNodeElements(id);
+    for(unsigned int i = 0; i < node.count; i++) {
+        unsigned int element = elements[i];
+        glm::vec3 a = geometry.positions[geometry.indices[element * 3]];
+        glm::vec3 ab = geometry.positions[geometry.indices[element * 3 + 1]] - a;
+        glm::vec3 ac = geometry.positions[geometry.indices[element * 3 + 2]] - a;
+        SceneBvhTriangle triangle = {};
+        std::memcpy(triangle.a, &a[0], sizeof(triangle.a));
+        std::memcpy(triangle.ab, &ab[0], sizeof(triangle.ab));
+        std::memcpy(triangle.ac, &ac[0], sizeof(triangle.ac));
+        triangle.albedo = geometry.colors ? geometry.colors[element] : 0xFFFFFFFFu;
+        triangles.push_back(triangle);
+    }
+}
+
+void setSceneGeometry(const SceneGeometry& geometry) {
+    std::vector<SceneBvhNode> nodes;
+    std::vector<SceneBvhTriangle> triangles;
+    if(geometry.triangleCount > 0) {
+        SceneGeometryBVH bvh(geometry);
+        bvh.Build(geometry.triangleCount);
+        nodes.resize(1);
+        triangles.reserve(geometry.triangleCount);
+        flattenSceneBvh(bvh, geometry, bvh.GetRootNodeID(), 0, nodes, triangles);
+    }
+    std::lock_guard<std::mutex> lock(sceneGeometryMutex);
+    pendingSceneNodes.swap(nodes);
+    pendingSceneTriangles.swap(triangles);
+    sceneGeometryPending = true;
+}
+
+void setReshadingLights(const ReshadingLight* lights, int count) {
+    if(count > maxReshadingLights) {
+        std::cout << "Error: " << count << " reshading lights, only the first " << maxReshadingLights
+                  << " are used" << std::endl;
+        count = maxReshadingLights;
+    }
+    std::vector<ReshadingLight> copy(lights, lights + std::max(count, 0));
+    std::lock_guard<std::mutex> lock(reshadingLightsMutex);
+    pendingReshadingLights.swap(copy);
+    reshadingLightsPending = true;
+}
+
+void setStereo(const StereoConfig& config) {
+    std::lock_guard<std::mutex> lock(stereoMutex);
+    stereo = config;
+}
+
+/**
+ * Pose of an eye with the given ipd, see getEyePose
+ */
+static Pose eyePose(const Pose& head, int eye, float ipd) {
+    Pose result = head;
+    float offset = (eye == 0 ? -0.5f : 0.5f) * ipd;
+    result.position += head.orientation * glm::vec3(offset, 0, 0);
+    return result;
+}
+
+Pose getEyePose(const Pose& head, int eye) {
+    std::lock_guard<std::mutex> lock(stereoMutex);
+    if(!stereo.enabled)
+        return head;
+    return eyePose(head, eye, stereo.ipd);
+}
+
+void setSplitScreen(const SplitScreen& config) {
+    std::lock_guard<std::mutex> lock(splitScreenMutex);
+    splitScreen = config;
+    if(splitScreen.viewports != 2 && splitScreen.viewports != MAX_SPLIT_VIEWPORTS)
+        splitScreen.viewports = 1;
+}
+
+void registerViewportPoseFunction(int viewport, ViewportPoseFunction function) {
+    if(viewport < 1 || viewport >= MAX_SPLIT_VIEWPORTS) {
+        std::cout << "Error: no split screen viewport " << viewport << " to register a pose function for" << std::endl;
+        return;
+    }
+    viewportPoseFunctions[viewport] = function;
+}
+
+/**
+ * Rectangle of a split screen viewport within the given one, viewport 0
+ * being the top left
+ */
+static void splitViewportRect(const GLint whole[4], int viewports, int index, GLint rect[4]) {
+    int columns = viewports == MAX_SPLIT_VIEWPORTS ? 2 : 1;
+    int rows = viewports / columns;
+    int width = whole[2] / columns;
+    int height = whole[3] / rows;
+    int row = index / columns;
+    rect[0] = whole[0] + (index % columns) * width;
+    // GL's origin is the bottom left
+    rect[1] = whole[1] + (rows - 1 - row) * height;
+    rect[2] = width;
+    rect[3] = height;
+}
+
+LayerProjection LayerProjection::inset(glm::vec2 center, glm::vec2 size) const {
+    LayerProjection result = *this;
+    float width = right - left;
+    float height = top - bottom;
+    result.left = left + (center.x - 0.5f * size.x) * width;
+    result.right = left + (center.x + 0.5f * size.x) * width;
+    result.bottom = bottom + (center.y - 0.5f * size.y) * height;
+    result.top = bottom + (center.y + 0.5f * size.y) * height;
+    return result;
+}
+
+/**
+ * Element index of the radical inverse sequence in base
+ */
+static float halton(int index, int base) {
+    float result = 0;
+    float fraction = 1;
+    while(index > 0) {
+        fraction /= base;
+        result += fraction * (index % base);
+        index /= base;
+    }
+    return result;
+}
+
+glm::vec2 getJitterOffset() {
+    // the sequence starts at 1, 0 would sample the pixel centers
+    int index = (int)((submissionCount + 1) % 8) + 1;
+    return glm::vec2(halton(index, 2), halton(index, 3)) - 0.5f;
+}
+
+int getCheckerboardParity() {
+    return (int)((submissionCount + 1) & 1);
+}
+
+void setTemporalAccumulationWeight(float weight) {
+    temporalWeight = std::min(std::max(weight, 0.f), 1.f);
+}
+
+void setFrameHistoryLength(int frames) {
+    frameHistoryLength = std::min(std::max(frames, 1), maxFrameHistory);
+}
+
+void setCompactFrameHistory(bool enabled) {
+    compactFrameHistory = enabled;
+}
+
+void setFrameInterpolation(bool enabled) {
+    frameInterpolation = enabled;
+}
+
+void FrameLayers::reportFull(const FrameLayer& layer) {
+    std::cout << "Error: a frame has at most " << MAX_FRAME_LAYERS << " layers, dropping another";
+    if(layer.swapchain && !(layer.flags & (KEEP_PREVIOUS_IMAGE | SUBMITTED_BY_THREAD)))
+        std::cout << " whose image " << layer.swapchainIndex << " stays acquired";
+    std::cout << std::endl;
+}
+
+FrameSubmitInfo& acquireFrameSubmitInfo() {
+    // frames are retired or retained before their slot comes back, so this
+    // only drops layers of a frame that was filled and never submitted
+    FrameSubmitInfo& frame = frameMailbox.back();
+    frame.layers.clear();
+    return frame;
+}
+
+/**
+ * Lets tiled GPUs drop the depth, velocity and material of a new layer that
+ * reprojection won't read instead of writing them out to memory. The app is
+ * done with them until acquireImage hands the image out again. Imported
+ * images are the app's, so they're left alone
+ */
+static void invalidateUnreadImages(const FrameLayer& layer) {
+    if(!GLEW_ARB_invalidate_subdata || layer.swapchain->isImported())
+        return;
+    const std::uint32_t depthFlags = PARALLAX_ENABLED | GRID_WARP_ENABLED | MOTION_EXTRAPOLATION_ENABLED
+                                     | TEMPORAL_ACCUMULATION_ENABLED | CHECKERBOARD_ENABLED | DEPTH_PEELED;
+    int i = layer.swapchainIndex;
+    // cube maps are reprojected by rotation only
+    if(layer.swapchain->hasDepth() && (layer.swapchain->isCubeMap() || !(layer.flags & depthFlags)))
+        glInvalidateTexImage(layer.swapchain->depthImages[i], 0);
+    if(layer.swapchain->hasVelocity() && !(layer.flags & MOTION_EXTRAPOLATION_ENABLED))
+        glInvalidateTexImage(layer.swapchain->velocityImages[i], 0);
+    if(layer.swapchain->hasMaterial() && !reshaded(layer))
+        glInvalidateTexImage(layer.swapchain->materialImages[i], 0);
+}
+
+bool canSubmitDamage(int layerIndex, const Swapchain* swapchain, int swapchainIndex) {
+    if(!(GLEW_VERSION_4_3 || GLEW_ARB_copy_image) || swapchain->isCubeMap()
+       || layerIndex < 0 || layerIndex >= (int)submittedLayers.size())
+        return false;
+    const FrameLayer& previous = submittedLayers[layerIndex];
+    return previous.swapchain == swapchain && previous.swapchainIndex != swapchainIndex
+           && swapchain->getImageWidth(previous.swapchainIndex) == swapchain->getImageWidth(swapchainIndex)
+           && swapchain->getImageHeight(previous.swapchainIndex) == swapchain->getImageHeight(swapchainIndex);
+}
+
+/**
+ * Calls visit with x, y, width and height of rectangles covering the part of
+ * a width by height image outside the layer's damage, in bands between the
+ * damage's top and bottom edges
+ */
+template<typename Visit>
+static void forEachUndamagedRect(const FrameLayer& layer, int width, int height, Visit visit) {
+    int edges[2 * MAX_LAYER_DAMAGE + 2];
+    int edgeCount = 0;
+    edges[edgeCount++] = 0;
+    edges[edgeCount++] = height;
+    for(int i = 0; i < layer.damageCount; i++) {
+        edges[edgeCount++] = std::min(std::max(layer.damage[i][1], 0), height);
+        edges[edgeCount++] = std::min(std::max(layer.damage[i][1] + layer.damage[i][3], 0), height);
+    }
+    std::sort(edges, edges + edgeCount);
+    edgeCount = std::unique(edges, edges + edgeCount) - edges;
+    for(int band = 0; band + 1 < edgeCount; band++) {
+        int y0 = edges[band];
+        int y1 = edges[band + 1];
+        // damage covering the band, which spans it whole since no edge is
+        // inside it
+        std::pair<int, int> spans[MAX_LAYER_DAMAGE];
+        int spanCount = 0;
+        for(int i = 0; i < layer.damageCount; i++) {
+            const int* rect = layer.damage[i];
+            if(rect[1] <= y0 && rect[1] + rect[3] >= y1 && rect[2] > 0)
+                spans[spanCount++] = { std::min(std::max(rect[0], 0), width), std::min(rect[0] + rect[2], width) };
+        }
+        std::sort(spans, spans + spanCount);
+        int x = 0;
+        for(int i = 0; i < spanCount; i++) {
+            if(spans[i].first > x)
+                visit(x, y0, spans[i].first - x, y1 - y0);
+            x = std::max(x, spans[i].second);
+        }
+        if(x < width)
+            visit(x, y0, width - x, y1 - y0);
+    }
+}
+
+/**
+ * Copies the images of the previous layer at the same index outside the
+ * layer's damage into the layer's
+ */
+static void copyUndamaged(const FrameLayer& previous, const FrameLayer& layer) {
+    ARP_TRACE_GPU_SCOPE("copyUndamaged");
+    const Swapchain* swapchain = layer.swapchain;
+    int from = previous.swapchainIndex;
+    int to = layer.swapchainIndex;
+    // multisampled images are resolved whole, so the samples are copied
+    bool multisampled = swapchain->samples > 1;
+    GLenum target = multisampled ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D;
+    const std::vector<std::uint32_t>& colors = multisampled ? swapchain->multisampleImages : swapchain->images;
+    const std::vector<std::uint32_t>& depths = multisampled ? swapchain->multisampleDepthImages
+                                                            : swapchain->depthImages;
+    const std::vector<std::uint32_t>& velocities = multisampled ? swapchain->multisampleVelocityImages
+                                                                : swapchain->velocityImages;
+    const std::vector<std::uint32_t>& materials = multisampled ? swapchain->multisampleMaterialImages
+                                                               : swapchain->materialImages;
+    forEachUndamagedRect(layer, swapchain->getImageWidth(to), swapchain->getImageHeight(to),
+                         [&](int x, int y, int width, int height) {
+        glCopyImageSubData(colors[from], target, 0, x, y, 0, colors[to], target, 0, x, y, 0, width, height, 1);
+        if(swapchain->hasDepth())
+            glCopyImageSubData(depths[from], target, 0, x, y, 0, depths[to], target, 0, x, y, 0, width, height, 1);
+        if(swapchain->hasVelocity()) {
+            glCopyImageSubData(velocities[from], target, 0, x, y, 0, velocities[to], target, 0, x, y, 0,
+                               width, height, 1);
+        }
+        if(swapchain->hasMaterial()) {
+            glCopyImageSubData(materials[from], target, 0, x, y, 0, materials[to], target, 0, x, y, 0,
+                               width, height, 1);
+        }
+    });
+}
+
+/**
+ * Drops submittedLayers' reference to a layer's image, thread layers have
+ * none
+ */
+static void releaseSubmittedLayer(const FrameLayer& layer) {
+    if(layer.swapchain)
+        layer.swapchain->releaseImage(layer.swapchainIndex);
+}
+
+std::uint64_t submitFrame(const FrameSubmitInfo& submitInfo) {
+    FrameSubmitInfo& frame = frameMailbox.back();
+    if(&submitInfo != &frame)
+        frame = submitInfo;
+    return submitFrame();
+}
+
+std::uint64_t submitFrame() {
+    ARP_TRACE_INDEXED_SCOPE("submitFrame", (int)(submissionCount + 1));
+    FrameSubmitInfo& frame = frameMailbox.back();
+    frameHistory.push(frame.poseInfo.time);
+    endAppFrameTiming();
+    markGpuZoneFrame();
+
+    if(replayingInput && replaySubmit < inputReplay.submits.size()) {
+        // frames are submitted no earlier than they were in the recording
+        sleepUntil(inputReplay.submits[replaySubmit].time + replayTimeOffset);
+        replaySubmit++;
+    }
+
+    submissionCount++;
+    frame.submission = submissionCount;
+    frame.submitTime = glfwGetTime();
+    if(recordingInput.load(std::memory_order_relaxed)) {
+        SubmitRecord record{};
+        record.time = glfwGetTime();
+        record.submission = submissionCount;
+        record.pose = frame.pose;
+        record.poseInfo = frame.poseInfo;
+        inputRecording.write(INPUT_RECORD_SUBMIT, record);
+    }
+    // layers are resolved in place, kept layers replaced by their image
+    size_t layerCount = frame.layers.size();
+    for(size_t i = 0; i < layerCount; i++) {
+        FrameLayer& layer = frame.layers[i];
+        if((layer.flags & SUBMITTED_BY_THREAD)
+           || ((layer.flags & KEEP_PREVIOUS_IMAGE) && i < submittedLayers.size()
+               && (submittedLayers[i].flags & SUBMITTED_BY_THREAD))) {
+            // reprojection puts the thread's newest image in its place
+            layer = FrameLayer();
+            layer.flags = SUBMITTED_BY_THREAD;
+            layer.swapchain = nullptr;
+            layer.fence = nullptr;
+            if(i < submittedLayers.size()) {
+                releaseSubmittedLayer(submittedLayers[i]);
+                submittedLayers[i] = layer;
+            }
+            else {
+                submittedLayers.push_back(layer);
+            }
+            continue;
+        }
+        if(layer.flags & KEEP_PREVIOUS_IMAGE) {
+            if(i >= submittedLayers.size()) {
+                std::cout << "Error: layer " << i << " has no previous image to keep, dropping it and the layers after it" << std::endl;
+                // nobody else is going to release the images of those layers
+                for(size_t j = i + 1; j < layerCount; j++) {
+                    const FrameLayer& dropped = frame.layers[j];
+                    if(!(dropped.flags & (KEEP_PREVIOUS_IMAGE | SUBMITTED_BY_THREAD)))
+                        dropped.swapchain->releaseImage(dropped.swapchainIndex);
+                }
+                frame.layers.resize(i);
+                break;
+            }
+            layer = submittedLayers[i];
+        }
+        else {
+            // the frame's pose stays with the image while it is kept
+            if(!layer.hasPose) {
+                layer.hasPose = true;
+                layer.pose = frame.pose;
+                layer.time = frame.poseInfo.time;
+            }
+            layer.submission = submissionCount;
+            // the rest of the image is the previous one's
+            layer.damageBase = 0;
+            if(layer.damageCount > 0) {
+                if(!(layer.flags & (CHECKERBOARD_ENABLED | TEMPORAL_ACCUMULATION_ENABLED))
+                   && canSubmitDamage(i, layer.swapchain, layer.swapchainIndex)) {
+                    copyUndamaged(submittedLayers[i], layer);
+                    layer.damageBase = submittedLayers[i].submission;
+                }
+                else {
+                    layer.damageCount = 0;
+                }
+            }
+            invalidateUnreadImages(layer);
+            // the acquired reference moves to submittedLayers
+            if(i < submittedLayers.size()) {
+                releaseSubmittedLayer(submittedLayers[i]);
+                submittedLayers[i] = layer;
+            }
+            else {
+                submittedLayers.push_back(layer);
+            }
+        }
+        layer.swapchain->retainImage(layer.swapchainIndex);
+        // covers earlier rendering too, so kept layers get one as well
+        layer.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    for(size_t i = frame.layers.size(); i < submittedLayers.size(); i++)
+        releaseSubmittedLayer(submittedLayers[i]);
+    submittedLayers.resize(frame.layers.size());
+    // marks when the GPU is done with the whole frame, for waitForNextAppFrame
+    if(glfwGetCurrentContext() == hiddenWindow) {
+        if(appFrameFenceCount == maxFramesInFlight)
+            retireAppFrameFences(maxFramesInFlight);
+        appFrameFences[appFrameFenceCount++] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    // fences must be flushed before another context can wait on them
+    glFlush();
+
+    if(frameMailbox.publish()) {
+        // reprojection never picked up the frame we got back, so nobody else
+        // is going to release its images
+        retireFrame(frameMailbox.back());
+    }
+    // a variable refresh display shows the frame without waiting for a
+    // refresh, see waitForFrameUntil
+    if(variableRefresh.load(std::memory_order_relaxed))
+        glfwPostEmptyEvent();
+
+    {
+        submitEpoch.fetch_add(1, std::memory_order_release);
+    }
+    return submissionCount;
+}
+
+void submitLayer(int layerIndex, const FrameLayer& submitted) {
+    if(layerIndex < 0 || layerIndex >= (int)MAX_FRAME_LAYERS || !submitted.hasPose
+       || (submitted.flags & (KEEP_PREVIOUS_IMAGE | SUBMITTED_BY_THREAD))) {
+        std::cout << "Error: layer " << layerIndex << " can't be submitted by a thread without its pose or with "
+                  << "KEEP_PREVIOUS_IMAGE, dropping it" << std::endl;
+        submitted.swapchain->releaseImage(submitted.swapchainIndex);
+        return;
+    }
+    Mailbox<FrameLayer>& mailbox = threadLayerMailboxes[layerIndex];
+    FrameLayer& layer = mailbox.back();
+    layer = submitted;
+    layer.submission = threadSubmissionCount.fetch_add(1, std::memory_order_relaxed) + 1;
+    layer.damageCount = 0;
+    layer.damageBase = 0;
+    invalidateUnreadImages(layer);
+    // the acquired reference moves to the mailbox
+    layer.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // fences must be flushed before another context can wait on them
+    glFlush();
+    if(mailbox.publish()) {
+        // reprojection never took the layer we got back
+        FrameLayer& replaced = mailbox.back();
+        glDeleteSync(replaced.fence);
+        replaced.swapchain->releaseImage(replaced.swapchainIndex);
+    }
+    // a variable refresh display shows the layer without waiting for a
+    // refresh, as it does frames
+    if(variableRefresh.load(std::memory_order_relaxed))
+        glfwPostEmptyEvent();
+}
+
+void resubmitFrame(const Pose& pose, const PoseInfo& poseInfo) {
+    if(submittedLayers.empty())
+        return;
+    FrameSubmitInfo& frame = acquireFrameSubmitInfo();
+    frame.pose = pose;
+    frame.poseInfo = poseInfo;
+    FrameLayer kept;
+    kept.flags = KEEP_PREVIOUS_IMAGE;
+    for(size_t i = 0; i < submittedLayers.size(); i++)
+        frame.layers.push_back(kept);
+    submitFrame();
+}
+
+static bool frameCachePoseMatch(const Pose& a, const Pose& b) {
+    if(glm::distance(a.position, b.position) > frameCacheSettings.positionTolerance)
+        return false;
+    float cosHalf = std::min(std::abs(glm::dot(a.orientation, b.orientation)), 1.f);
+    return 2 * std::acos(cosHalf) <= frameCacheSettings.angleTolerance;
+}
+
+/**
+ * Whether every layer of the cached frame was rendered within the
+ * tolerances of pose. Layers of other threads have no pose of their own
+ * and are left out
+ */
+static bool frameCacheMatch(const CachedFrame& cached, const Pose& pose, std::uint64_t sceneVersion) {
+    if(cached.sceneVersion != sceneVersion)
+        return false;
+    bool posed = false;
+    for(const FrameLayer& layer : cached.layers) {
+        if(!layer.hasPose || (layer.flags & SUBMITTED_BY_THREAD))
+            continue;
+        if(!frameCachePoseMatch(layer.pose, pose))
+            return false;
+        posed = true;
+    }
+    return posed;
+}
+
+/**
+ * Whether entry would be found wherever cached is, layer by layer, so it
+ * replaces cached
+ */
+static bool frameCacheSupersedes(const CachedFrame& entry, const CachedFrame& cached) {
+    if(cached.sceneVersion != entry.sceneVersion || cached.layers.size() != entry.layers.size())
+        return false;
+    for(size_t i = 0; i < entry.layers.size(); i++) {
+        const FrameLayer& a = entry.layers[i];
+        const FrameLayer& b = cached.layers[i];
+        if(a.hasPose != b.hasPose || (a.flags & SUBMITTED_BY_THREAD) != (b.flags & SUBMITTED_BY_THREAD))
+            return false;
+        if(a.hasPose && !(a.flags & SUBMITTED_BY_THREAD) && !frameCachePoseMatch(a.pose, b.pose))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Whether layer's image is one an earlier of the first count layers
+ * already holds, so it is only counted once
+ */
+static bool sharedImage(const FrameLayers& layers, size_t count, const FrameLayer& layer) {
+    for(size_t i = 0; i < count; i++) {
+        if(layers[i].swapchain == layer.swapchain && layers[i].swapchainIndex == layer.swapchainIndex)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Images of the swapchain the cache holds
+ */
+static int frameCacheImages(const Swapchain* swapchain) {
+    int count = 0;
+    for(const CachedFrame& cached : frameCache) {
+        for(size_t i = 0; i < cached.layers.size(); i++) {
+            const FrameLayer& layer = cached.layers[i];
+            if(layer.swapchain == swapchain && !sharedImage(cached.layers, i, layer))
+                count++;
+        }
+    }
+    return count;
+}
+
+static void releaseCachedFrame(const CachedFrame& cached) {
+    for(const FrameLayer& layer : cached.layers)
+        releaseSubmittedLayer(layer);
+    frameCacheBytes -= cached.bytes;
+}
+
+/**
+ * Whether the cache can take entry without going over its budget or
+ * holding too many images of a swapchain
+ */
+static bool frameCacheFits(const CachedFrame& entry) {
+    if(frameCacheBytes + entry.bytes > frameCacheSettings.budgetBytes)
+        return false;
+    for(size_t i = 0; i < entry.layers.size(); i++) {
+        const Swapchain* swapchain = entry.layers[i].swapchain;
+        if(!swapchain)
+            continue;
+        int added = 0;
+        for(size_t j = 0; j < entry.layers.size(); j++) {
+            if(entry.layers[j].swapchain == swapchain && !sharedImage(entry.layers, j, entry.layers[j]))
+                added++;
+        }
+        if(frameCacheImages(swapchain) + added > swapchain->numImages - frameCacheFreeImages)
+            return false;
+    }
+    return true;
+}
+
+void setFrameCache(const FrameCacheSettings& settings) {
+    frameCacheSettings = settings;
+    while(!frameCache.empty() && frameCacheBytes > settings.budgetBytes) {
+        releaseCachedFrame(frameCache.back());
+        frameCache.pop_back();
+    }
+}
+
+bool cacheSubmittedFrame(std::uint64_t sceneVersion) {
+    if(frameCacheSettings.budgetBytes <= 0 || submittedLayers.empty())
+        return false;
+    CachedFrame entry;
+    entry.sceneVersion = sceneVersion;
+    entry.layers = submittedLayers;
+    for(size_t i = 0; i < entry.layers.size(); i++) {
+        FrameLayer& layer = entry.layers[i];
+        // the fence belongs to the frame, and the image is reused whole
+        layer.fence = nullptr;
+        layer.damageCount = 0;
+        if(layer.swapchain && !sharedImage(entry.layers, i, layer))
+            entry.bytes += layer.swapchain->getImageBytes(layer.swapchainIndex);
+    }
+    for(auto it = frameCache.begin(); it != frameCache.end();) {
+        if(frameCacheSupersedes(entry, *it)) {
+            releaseCachedFrame(*it);
+            it = frameCache.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+    // least recently used frames make room
+    while(!frameCacheFits(entry)) {
+        if(frameCache.empty())
+            return false;
+        releaseCachedFrame(frameCache.back());
+        frameCache.pop_back();
+    }
+    for(const FrameLayer& layer : entry.layers) {
+        if(layer.swapchain)
+            layer.swapchain->retainImage(layer.swapchainIndex);
+    }
+    frameCacheBytes += entry.bytes;
+    frameCache.push_front(entry);
+    return true;
+}
+
+bool submitCachedFrame(const Pose& pose, const PoseInfo& poseInfo, std::uint64_t sceneVersion) {
+    if(frameCacheSettings.budgetBytes <= 0)
+        return false;
+    auto it = std::find_if(frameCache.begin(), frameCache.end(), [&](const CachedFrame& cached) {
+        return frameCacheMatch(cached, pose, sceneVersion);
+    });
+    if(it == frameCache.end())
+        return false;
+    if(it != frameCache.begin()) {
+        CachedFrame hit = *it;
+        frameCache.erase(it);
+        frameCache.push_front(hit);
+    }
+
+    // the cached images become the latest of their layer indices, which a
+    // frame of kept layers then resubmits
+    const CachedFrame& cached = frameCache.front();
+    FrameSubmitInfo& frame = acquireFrameSubmitInfo();
+    frame.pose = pose;
+    frame.poseInfo = poseInfo;
+    FrameLayer kept;
+    kept.flags = KEEP_PREVIOUS_IMAGE;
+    for(size_t i = 0; i < cached.layers.size(); i++) {
+        const FrameLayer& layer = cached.layers[i];
+        if(layer.swapchain)
+            layer.swapchain->retainImage(layer.swapchainIndex);
+        if(i < submittedLayers.size()) {
+            releaseSubmittedLayer(submittedLayers[i]);
+            submittedLayers[i] = layer;
+        }
+        else {
+            submittedLayers.push_back(layer);
+        }
+        frame.layers.push_back(kept);
+    }
+    submitFrame();
+    return true;
+}
+
+void clearFrameCache() {
+    for(const CachedFrame& cached : frameCache)
+        releaseCachedFrame(cached);
+    frameCache.clear();
+}
+
+/**
+ * Images CPU swapchain buffers are copied into, which reprojection only
+ * samples the color of
+ */
+static SwapchainCreateInfo cpuSwapchainInfo(int width, int height) {
+    SwapchainCreateInfo info{ width, height, 3 };
+    info.depthFormat = DEPTH_FORMAT_NONE;
+    return info;
+}
+
+CpuSwapchain::CpuSwapchain(int layerIndex, int width, int height, int numBuffers)
+  : layerIndex(layerIndex),
+    images(cpuSwapchainInfo(width, height)),
+    buffers(std::max(numBuffers, 1)),
+    width(width),
+    height(height)
+{
+    std::size_t size = (std::size_t)width * height * 4;
+    for(Buffer& buffer : buffers) {
+        if(GLEW_ARB_buffer_storage) {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glGenBuffers(1, &buffer.pixelBuffer);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.pixelBuffer);
+            glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, nullptr, flags);
+            buffer.pixels = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            if(buffer.pixels) {
+                trackGpuMemory(GPU_MEMORY_SWAPCHAINS, (std::int64_t)size);
+            }
+            else {
+                std::cout << "Error: could not map a CPU swapchain buffer, uploading from memory" << std::endl;
+                glDeleteBuffers(1, &buffer.pixelBuffer);
+                buffer.pixelBuffer = 0;
+            }
+        }
+        if(!buffer.pixels) {
+            buffer.memory.resize(size);
+            buffer.pixels = buffer.memory.data();
+        }
+    }
+    std::lock_guard<std::mutex> lock(cpuSwapchainMutex);
+    cpuSwapchains.push_back(this);
+}
+
+CpuSwapchain::~CpuSwapchain() {
+    {
+        std::lock_guard<std::mutex> lock(cpuSwapchainMutex);
+        cpuSwapchains.erase(std::find(cpuSwapchains.begin(), cpuSwapchains.end(), this));
+    }
+    std::size_t size = (std::size_t)width * height * 4;
+    for(Buffer& buffer : buffers) {
+        if(buffer.fence)
+            glDeleteSync(buffer.fence);
+        if(buffer.pixelBuffer) {
+            glDeleteBuffers(1, &buffer.pixelBuffer);
+            trackGpuMemory(GPU_MEMORY_SWAPCHAINS, -(std::int64_t)size);
+        }
+    }
+}
+
+int CpuSwapchain::acquire(bool wait, double timeout) {
+    std::unique_lock<std::mutex> lock(mutex);
+    auto freeBuffer = [this]() {
+        for(std::size_t i = 0; i < buffers.size(); i++) {
+            if(buffers[i].state == BUFFER_FREE)
+                return (int)i;
+        }
+        return -1;
+    };
+    int index = freeBuffer();
+    if(index < 0 && wait) {
+        auto ready = [&]() { return (index = freeBuffer()) >= 0; };
+        if(timeout < 0)
+            cond.wait(lock, ready);
+        else
+            cond.wait_for(lock, std::chrono::duration<double>(timeout), ready);
+    }
+    if(index >= 0)
+        buffers[index].state = BUFFER_WRITING;
+    return index;
+}
+
+int CpuSwapchain::acquireBuffer() {
+    return acquire(true, -1);
+}
+
+int CpuSwapchain::acquireBuffer(double timeout) {
+    return acquire(true, timeout);
+}
+
+void CpuSwapchain::submitBuffer(int index, const FrameLayer& layer, double presentationTime) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Buffer& buffer = buffers[index];
+        if(!layer.hasPose || (layer.flags & (KEEP_PREVIOUS_IMAGE | SUBMITTED_BY_THREAD))) {
+            std::cout << "Error: CPU swapchain buffers can't be submitted without a pose or with "
+                      << "KEEP_PREVIOUS_IMAGE, dropping it" << std::endl;
+            buffer.state = BUFFER_FREE;
+            cond.notify_all();
+            return;
+        }
+        buffer.layer = layer;
+        buffer.presentationTime = presentationTime;
+        buffer.order = ++submissions;
+        buffer.state = BUFFER_QUEUED;
+    }
+    if(variableRefresh.load(std::memory_order_relaxed))
+        glfwPostEmptyEvent();
+}
+
+bool CpuSwapchain::latch(double displayTime, FrameLayer& layer) {
+    std::lock_guard<std::mutex> lock(mutex);
+    bool freed = false;
+    Buffer* due = nullptr;
+    for(Buffer& buffer : buffers) {
+        if(buffer.state == BUFFER_UPLOADING
+           && glClientWaitSync(buffer.fence, 0, 0) != GL_TIMEOUT_EXPIRED) {
+            glDeleteSync(buffer.fence);
+            buffer.fence = nullptr;
+            buffer.state = BUFFER_FREE;
+            freed = true;
+        }
+        if(buffer.state == BUFFER_QUEUED && buffer.presentationTime <= displayTime
+           && (!due || buffer.order > due->order))
+            due = &buffer;
+    }
+    int image = due ? images.tryAcquireImage() : -1;
+    if(image >= 0) {
+        // older buffers due by now would never be shown
+        for(Buffer& buffer : buffers) {
+            if(buffer.state == BUFFER_QUEUED && buffer.order < due->order && buffer.presentationTime <= displayTime) {
+                buffer.state = BUFFER_FREE;
+                freed = true;
+            }
+        }
+        glState().bindTexture(0, GL_TEXTURE_2D, images.images[image]);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        if(due->pixelBuffer) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, due->pixelBuffer);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            due->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            due->state = BUFFER_UPLOADING;
+        }
+        else {
+            // the driver has copied client memory by the time this returns
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, due->pixels);
+            due->state = BUFFER_FREE;
+            freed = true;
+        }
+        layer = due->layer;
+        layer.flags = FrameLayerFlags(layer.flags & ~SUBMITTED_BY_THREAD);
+        layer.swapchain = &images;
+        layer.swapchainIndex = image;
+        layer.damageCount = 0;
+        layer.damageBase = 0;
+        layer.fence = nullptr;
+    }
+    if(freed)
+        cond.notify_all();
+    return image >= 0;
+}
+
+struct LayerAtlas::Packer {
+    stbrp_context context;
+    std::vector<stbrp_node> nodes;
+};
+
+LayerAtlas::LayerAtlas(const SwapchainCreateInfo& createInfo)
+  : images(createInfo),
+    packer(new Packer)
+{
+    // a node per column packs any rectangles that fit
+    packer->nodes.resize(createInfo.width);
+    stbrp_init_target(&packer->context, createInfo.width, createInfo.height, packer->nodes.data(),
+                      (int)packer->nodes.size());
+}
+
+LayerAtlas::~LayerAtlas() {}
+
+int LayerAtlas::allocateRegion(int width, int height) {
+    if(width <= 0 || height <= 0)
+        return -1;
+    int best = -1;
+    for(std::size_t i = 0; i < regions.size(); i++) {
+        const Region& region = regions[i];
+        if(region.used || region.space[2] < width || region.space[3] < height)
+            continue;
+        if(best < 0 || region.space[2] * region.space[3] < regions[best].space[2] * regions[best].space[3])
+            best = (int)i;
+    }
+    if(best < 0) {
+        // the skyline packer can't give space back, released regions are
+        // only ever reused whole
+        stbrp_rect rect = {};
+        rect.w = width;
+        rect.h = height;
+        if(!stbrp_pack_rects(&packer->context, &rect, 1))
+            return -1;
+        Region region = { { 0, 0, 0, 0 }, { rect.x, rect.y, width, height }, false };
+        regions.push_back(region);
+        best = (int)regions.size() - 1;
+    }
+    Region& region = regions[best];
+    region.rect[0] = region.space[0];
+    region.rect[1] = region.space[1];
+    region.rect[2] = width;
+    region.rect[3] = height;
+    region.used = true;
+    return best;
+}
+
+void LayerAtlas::releaseRegion(int region) {
+    regions[region].used = false;
+}
+
+void LayerAtlas::bindFramebuffer(int index, int region) {
+    images.bindFramebuffer(index);
+    const int* rect = regions[region].rect;
+    glState().viewport(rect[0], rect[1], rect[2], rect[3]);
+    glState().setEnabled(GL_SCISSOR_TEST, true);
+    glScissor(rect[0], rect[1], rect[2], rect[3]);
+}
+
+FrameLayer LayerAtlas::layer(int region, int index, FrameLayerFlags flags) {
+    FrameLayer result = FrameLayer();
+    result.flags = flags;
+    result.swapchain = &images;
+    result.swapchainIndex = index;
+    result.hasViewport = true;
+    std::copy(regions[region].rect, regions[region].rect + 4, result.viewport);
+    return result;
+}
+
+/**
+ * Called by the reprojection thread. Makes the newest submitted frame
+ * lastFrame and releases the images of the frame it replaces.
+ */
+/**
+ * Takes the newest layer of every thread layer index that has one, and of
+ * every CPU swapchain with a buffer due at the coming refresh. Returns
+ * whether there was any
+ */
+static bool latchThreadLayers() {
+    bool latched = false;
+    {
+        std::lock_guard<std::mutex> lock(cpuSwapchainMutex);
+        double displayTime = cpuSwapchains.empty() ? 0 : refreshClock.model().nextVblank(glfwGetTime());
+        for(CpuSwapchain* cpuSwapchain : cpuSwapchains) {
+            int i = cpuSwapchain->getLayerIndex();
+            FrameLayer layer;
+            if(i < 0 || i >= (int)MAX_FRAME_LAYERS || !cpuSwapchain->latch(displayTime, layer))
+                continue;
+            layer.submission = threadSubmissionCount.fetch_add(1, std::memory_order_relaxed) + 1;
+            if(threadLayers[i].swapchain)
+                threadLayers[i].swapchain->releaseImage(threadLayers[i].swapchainIndex);
+            threadLayers[i] = layer;
+            latched = true;
+        }
+    }
+    for(std::size_t i = 0; i < MAX_FRAME_LAYERS; i++) {
+        Mailbox<FrameLayer>& mailbox = threadLayerMailboxes[i];
+        if(!mailbox.hasNew())
+            continue;
+        mailbox.consume();
+        FrameLayer& newest = mailbox.front();
+        // GPU-side wait, the frames the layer goes into don't wait again
+        glWaitSync(newest.fence, 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync(newest.fence);
+        newest.fence = nullptr;
+        if(threadLayers[i].swapchain)
+            threadLayers[i].swapchain->releaseImage(threadLayers[i].swapchainIndex);
+        threadLayers[i] = newest;
+        latched = true;
+    }
+    return latched;
+}
+
+/**
+ * Puts the newest thread layers in the frame's SUBMITTED_BY_THREAD layers,
+ * each holding a reference to its image. A new frame's layers without a
+ * thread layer yet are left out
+ */
+static void placeThreadLayers(FrameSubmitInfo& frame, bool newFrame) {
+    if(newFrame) {
+        std::size_t kept = 0;
+        for(std::size_t i = 0; i < frame.layers.size(); i++) {
+            bool threaded = frame.layers[i].flags & SUBMITTED_BY_THREAD;
+            if(threaded && !threadLayers[i].swapchain)
+                continue;
+            lastFrameThreadLayers[kept] = threaded ? (int)i : -1;
+            frame.layers[kept++] = frame.layers[i];
+        }
+        frame.layers.resize(kept);
+    }
+    for(std::size_t i = 0; i < frame.layers.size(); i++) {
+        int index = lastFrameThreadLayers[i];
+        FrameLayer& layer = frame.layers[i];
+        if(index < 0 || (layer.swapchain && layer.submission == threadLayers[index].submission))
+            continue;
+        if(layer.swapchain)
+            layer.swapchain->releaseImage(layer.swapchainIndex);
+        layer = threadLayers[index];
+        layer.flags = FrameLayerFlags(layer.flags | SUBMITTED_BY_THREAD);
+        layer.swapchain->retainImage(layer.swapchainIndex);
+    }
+}
+
+/**
+ * Returns whether a new frame or thread layer was latched
+ */
+static bool latchPendingFrame() {
+    bool threadLayersChanged = latchThreadLayers();
+    if(!frameMailbox.hasNew()) {
+        if(!threadLayersChanged || !frameValid)
+            return false;
+        ARP_TRACE_GPU_SCOPE("latchThreadLayers");
+        placeThreadLayers(*lastFrame, false);
+        resolveFrameLayers();
+        return true;
+    }
+    ARP_TRACE_GPU_SCOPE("latchPendingFrame");
+
+    // the old front slot goes back to the app thread, so it has to be
+    // released before the swap
+    int historyLength = retainedHistoryLength();
+    if(frameValid) {
+        if(historyLength > 1)
+            retainFrame(*lastFrame, historyLength);
+        else
+            retireFrame(*lastFrame);
+    }
+    while((int)retainedFrames.size() > historyLength - 1) {
+        RetainedFrame& oldest = retainedFrames.back();
+        releaseRetainedImages(oldest);
+        for(DepthPyramid& pyramid : oldest.pyramids) {
+            glState().forgetTexture(pyramid.texture);
+            glDeleteTextures(1, &pyramid.texture);
+        }
+        for(CompactColor& color : oldest.colors) {
+            glState().forgetTexture(color.texture);
+            glDeleteTextures(1, &color.texture);
+        }
+        retainedFrames.pop_back();
+    }
+    frameMailbox.consume();
+    lastFrame = &frameMailbox.front();
+    frameValid = true;
+    placeThreadLayers(*lastFrame, true);
+
+    // GPU-side wait, nothing blocks on the CPU here
+    for(FrameLayer& layer : lastFrame->layers) {
+        if(layer.fence)
+            glWaitSync(layer.fence, 0, GL_TIMEOUT_IGNORED);
+    }
+
+    warmUpPipeline();
+    updateVoxelCache();
+    updateSceneGeometry();
+    updateReshadingLights();
+    resolveFrameLayers();
+    return true;
+}
+
+/**
+ * Resolves the cameras of lastFrame's layers and builds what they need
+ * drawn from their images, once per image
+ */
+static void resolveFrameLayers() {
+    collectDepthRanges();
+    // depth pyramids are built once here instead of on every refresh
+    if(layerPyramids.size() < lastFrame->layers.size())
+        layerPyramids.resize(lastFrame->layers.size());
+    layerCameras.resize(lastFrame->layers.size());
+    if(layerHistories.size() < lastFrame->layers.size())
+        layerHistories.resize(lastFrame->layers.size());
+    if(layerTiles.size() < lastFrame->layers.size())
+        layerTiles.resize(lastFrame->layers.size());
+    for(size_t i = 0; i < lastFrame->layers.size(); i++) {
+        const FrameLayer& layer = lastFrame->layers[i];
+        LayerCamera& camera = layerCameras[i];
+        camera.pose = layer.hasPose ? layer.pose : lastFrame->pose;
+        camera.projection = layer.hasProjection ? layer.projection
+            : LayerProjection::perspective((float)layer.fov, projectionAspect, projectionNear, projectionFar);
+        updateLayerCameraMatrices(camera);
+        camera.referenceSpace = -1;
+        PoseSource* space = layer.referenceSpace >= 0 && layer.referenceSpace < MAX_REFERENCE_SPACES
+                            && !(layer.flags & CAMERA_LOCKED)
+                            ? referenceSpaces[layer.referenceSpace].load(std::memory_order_acquire) : nullptr;
+        Pose spaceAtLayer;
+        if(space && space->getPose(layer.time, spaceAtLayer)) {
+            camera.referenceSpace = layer.referenceSpace;
+            camera.spacePose = camera.pose;
+            glm::quat toSpace = glm::conjugate(spaceAtLayer.orientation);
+            camera.spacePose.position = toSpace * (camera.pose.position - spaceAtLayer.position);
+            camera.spacePose.orientation = toSpace * camera.pose.orientation;
+        }
+
+        // everything below reads the resolved images
+        layer.swapchain->resolveSamples(layer.swapchainIndex, layer.submission, camera.projection);
+
+        unsigned needed = neededPermutations;
+        if(layer.flags & DEPTH_PEELED)
+            needed |= PERMUTATION_DEPTH_PEELED;
+        if(layer.flags & ALPHA_MASKED)
+            needed |= PERMUTATION_ALPHA_MASKED;
+        if(depthUpsampled(layer))
+            needed |= PERMUTATION_DEPTH_UPSAMPLING;
+        if(reshaded(layer))
+            needed |= PERMUTATION_RESHADING;
+        if(needed != neededPermutations) {
+            neededPermutations = needed;
+            startLayerPrograms();
+        }
+
+        // kept layers already have theirs
+        bool reprojected = (layer.flags & (PARALLAX_ENABLED | GRID_WARP_ENABLED)) && !(layer.flags & CAMERA_LOCKED);
+        if((reprojected || depthUpsampled(layer)) && layer.swapchain->hasDepth() && !layer.swapchain->isCubeMap()
+           && layerPyramids[i].submission != layer.submission) {
+            // a pyramid of the image the damage is relative to only needs the
+            // damage rebuilt
+            bool damaged = layer.damageBase != 0 && layerPyramids[i].submission == layer.damageBase;
+            buildDepthPyramid(layerPyramids[i], layer, camera.projection, damaged);
+            layerPyramids[i].submission = layer.submission;
+            readDepthRange((int)i, layerPyramids[i], camera.projection);
+            // checkerboard images are missing half their pixels
+            if(activeVoxelCache.enabled && reprojected && (layer.flags & PARALLAX_ENABLED)
+               && !(layer.flags & CHECKERBOARD_ENABLED))
+                insertVoxels(layer, camera, layerPyramids[i]);
+        }
+
+        // layers sharing an image, like the eyes of a stereo swapchain, only
+        // generate its mips once
+        layer.swapchain->generateMipmaps(layer.swapchainIndex, layer.submission);
+
+        // kept layers keep their tiles, like their pyramids
+        LayerTiles& tiles = layerTiles[i];
+        if(sparseTiles(layer) && (tiles.submission != layer.submission || tiles.swapchain != layer.swapchain
+                                  || tiles.swapchainIndex != layer.swapchainIndex))
+            classifyLayerTiles(tiles, layer);
+
+        // like the pyramids, kept layers were resolved when they were new
+        if((layer.flags & (TEMPORAL_ACCUMULATION_ENABLED | CHECKERBOARD_ENABLED)) && !layer.swapchain->isCubeMap()
+           && layerHistories[i].submission != layer.submission) {
+            resolveTemporalHistory(layerHistories[i], layer, camera);
+        }
+    }
+    readVoxelCache();
+}
+
+LayerProjection LayerProjection::perspective(float fovY, float aspectRatio, float nearPlane, float farPlane) {
+    float top = tanf(fovY / 2.f);
+    float right = aspectRatio * top;
+    return { -right, right, -top, top, nearPlane, farPlane };
+}
+
+LayerProjection LayerProjection::jittered(glm::vec2 offset, int width, int height) const {
+    LayerProjection result = *this;
+    float dx = offset.x * (right - left) / width;
+    float dy = offset.y * (top - bottom) / height;
+    result.left += dx;
+    result.right += dx;
+    result.bottom += dy;
+    result.top += dy;
+    return result;
+}
+
+/**
+ * Returns the inverse of a pose's camera matrix. Poses are rigid, so this is
+ * the conjugate rotation after the negated translation
+ */
+static glm::mat4 viewMatrix(const Pose& pose) {
+    return glm::mat4(glm::conjugate(pose.orientation)) * glm::translate(glm::mat4(1), -pose.position);
+}
+
+/**
+ * Returns the matrix from a pose's camera space to world space
+ */
+static glm::mat4 cameraMatrix(const Pose& pose) {
+    return glm::translate(glm::mat4(1), pose.position) * glm::mat4(pose.orientation);
+}
+
+/**
+ * Returns the OpenGL projection matrix of a layer frustum with the default
+ * depth mapping, which reprojection works in whatever the layer's is
+ */
+static glm::mat4 projectionMatrix(const LayerProjection& p) {
+    float n = p.nearPlane;
+    return glm::frustum(p.left * n, p.right * n, p.bottom * n, p.top * n, n, p.farPlane);
+}
+
+glm::mat4 LayerProjection::matrix() const {
+    glm::mat4 result = projectionMatrix(*this);
+    if(depthMapping != DEPTH_REVERSED)
+        return result;
+    // z' = (w - z) / 2 takes window depth d to 1 - d with a 0 to 1 clip range
+    glm::mat4 reverse(1);
+    reverse[2][2] = -0.5f;
+    reverse[3][2] = 0.5f;
+    return reverse * result;
+}
+
+/**
+ * Sets the uniforms of DEPTH_MAPPING_SRC for a layer's projection
+ */
+static void setDepthMapping(GLint mappingLoc, GLint rangeLoc, const LayerProjection& projection) {
+    glUniform1i(mappingLoc, projection.depthMapping);
+    glUniform2f(rangeLoc, projection.nearPlane, projection.farPlane);
+}
+
+/**
+ * Returns the transform from the unit quad to the plane at distance in front
+ * of a layer frustum, in the layer's camera space
+ */
+static glm::mat4 frustumPlane(const LayerProjection& p, float distance) {
+    glm::vec3 center(0.5f * (p.left + p.right) * distance, 0.5f * (p.bottom + p.top) * distance, -distance);
+    glm::vec3 extent(0.5f * (p.right - p.left) * distance, 0.5f * (p.top - p.bottom) * distance, 1);
+    return glm::scale(glm::translate(glm::mat4(1), center), extent);
+}
+
+/**
+ * Returns the homography from this refresh's NDC to the coordinates of a
+ * layer rendered with layerProjection from layerOrientation, both
+ * homogeneous, for points infinitely far away. The x, y and w rows of a
+ * perspective projection take view space directions to homogeneous points
+ * on their own, so the far plane never comes into it
+ */
+static glm::mat3 rotationHomography(const LayerProjection& layerProjection, const glm::quat& layerOrientation) {
+    glm::mat3 displayFromView;
+    for(int column = 0; column < 3; column++)
+        displayFromView[column] = glm::vec3(projection[column][0], projection[column][1], projection[column][3]);
+    // layer coordinates go from 0 at the left and bottom tangent to 1 at
+    // the right and top one, and w is the distance in front of the camera
+    const LayerProjection& p = layerProjection;
+    glm::mat3 layerFromView(glm::vec3(1 / (p.right - p.left), 0, 0),
+                            glm::vec3(0, 1 / (p.top - p.bottom), 0),
+                            glm::vec3(p.left / (p.right - p.left), p.bottom / (p.top - p.bottom), -1));
+    glm::mat3 rotation = glm::mat3_cast(glm::conjugate(layerOrientation) * cameraPose.orientation);
+    return layerFromView * rotation * glm::inverse(displayFromView);
+}
+
+/**
+ * Writes this refresh's camera to the block every layer program reads
+ */
+static void updateReprojectionUniforms() {
+    ReprojectionUniforms uniforms;
+    uniforms.view = viewMatrix(cameraPose);
+    uniforms.projection = projection;
+    uniforms.cameraPos = glm::vec4(cameraPose.position, 1);
+
+    {
+        std::lock_guard<std::mutex> lock(foveationMutex);
+        refreshFoveation = foveation;
+    }
+    GLint viewport[4];
+    if(!glState().getViewport(viewport))
+        glGetIntegerv(GL_VIEWPORT, viewport);
+    uniforms.viewportRect = glm::vec4(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+    // no fovea: nothing is farther than the inner radius
+    uniforms.foveation = glm::vec4(0, 0, 1e9f, 2e9f);
+    uniforms.peripheralQuality = 1;
+    if(refreshFoveation.enabled) {
+        float inner = refreshFoveation.innerRadius * viewport[3];
+        float outer = std::max(refreshFoveation.outerRadius * viewport[3], inner + 1);
+        uniforms.foveation = glm::vec4(viewport[0] + refreshFoveation.center.x * viewport[2],
+                                       viewport[1] + refreshFoveation.center.y * viewport[3], inner, outer);
+        uniforms.peripheralQuality = refreshFoveation.peripheralQuality;
+    }
+
+    // the right eye's lens is the left one's mirrored
+    uniforms.lensDistortion = glm::vec4(0);
+    uniforms.chromaticAberration = glm::vec4(1, 1, 0, 0);
+    if(refreshLensDistortion.enabled) {
+        glm::vec2 center = refreshLensDistortion.center;
+        if(currentEye == 1)
+            center.x = -center.x;
+        uniforms.lensDistortion = glm::vec4(refreshLensDistortion.k1, refreshLensDistortion.k2, center);
+        uniforms.chromaticAberration = glm::vec4(refreshLensDistortion.redScale, refreshLensDistortion.blueScale, 0, 1);
+    }
+
+    glBindBuffer(GL_UNIFORM_BUFFER, reprojectionUniformBuffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(uniforms), &uniforms);
+}
+
+/**
+ * Fills the pyramid from the layer's depth image, (re)allocating it if the
+ * layer size changed. Level 0 is a copy of the depth, every further level
+ * reduces the one below it until a single texel is left. When damaged is
+ * set the pyramid was built from the image the layer's damage is relative
+ * to, and only the texels the damage reaches are rebuilt, as long as the
+ * viewport is the same
+ */
+static void buildDepthPyramid(DepthPyramid& pyramid, const FrameLayer& layer, const LayerProjection& projection,
+                              bool damaged) {
+    // the pyramid covers the layer's viewport, so it is in layer coordinates
+    int viewport[4];
+    layerViewport(layer, viewport);
+    int width = viewport[2];
+    int height = viewport[3];
+    damaged = damaged && pyramid.x == viewport[0] && pyramid.y == viewport[1] && !(layer.flags & CHECKERBOARD_ENABLED);
+    pyramid.x = viewport[0];
+    pyramid.y = viewport[1];
+    if(pyramid.texture == 0 || pyramid.width != width || pyramid.height != height) {
+        damaged = false;
+        allocateDepthPyramid(pyramid, width, height);
+    }
+
+    // texels of a level the damage reaches, in viewport coordinates at
+    // level 0 and halved per level. A level's last texel also covers the
+    // odd one out of the level below, which clamping to it includes
+    int rects[MAX_LAYER_DAMAGE][4];
+    int rectCount = 0;
+    for(int i = 0; damaged && i < layer.damageCount; i++) {
+        const int* rect = layer.damage[i];
+        int x0 = std::max(rect[0] - viewport[0], 0);
+        int y0 = std::max(rect[1] - viewport[1], 0);
+        int x1 = std::min(rect[0] + rect[2] - viewport[0], width);
+        int y1 = std::min(rect[1] + rect[3] - viewport[1], height);
+        if(x0 < x1 && y0 < y1) {
+            int* damagedRect = rects[rectCount++];
+            damagedRect[0] = x0;
+            damagedRect[1] = y0;
+            damagedRect[2] = x1;
+            damagedRect[3] = y1;
         }
-        lock.unlock();
     }
+    drawDepthPyramid(pyramidBuilder, pyramid, layer.swapchain->depthImages[layer.swapchainIndex], viewport,
+                     checkerboardParity(layer), projection, damaged ? rects : nullptr, rectCount);
+}
+
+/**
+ * Draws the pyramid's levels from a depth texture with the builder's
+ * programs. origin is where the pyramid's level 0 starts in the depth
+ * texture, parity the checkerboard one or -1. rects are the damaged texels
+ * as x0, y0, x1, y1, without them every texel is drawn
+ */
+static void drawDepthPyramid(const PyramidBuilder& builder, DepthPyramid& pyramid, GLuint depth, const int origin[2],
+                             int checkerboardParity, const LayerProjection& projection, const int (*rects)[4],
+                             int rectCount) {
+    int width = pyramid.width;
+    int height = pyramid.height;
+    GLint originalFramebuffer;
+    GLint originalViewport[4];
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &originalFramebuffer);
+    glGetIntegerv(GL_VIEWPORT, originalViewport);
+
+    glState().bindFramebuffer(GL_DRAW_FRAMEBUFFER, builder.fbo);
+
+    // level 0: copy depth
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pyramid.texture, 0);
+    glState().viewport(0, 0, width, height);
+    glState().useProgram(builder.copyProgram);
+    glUniform2i(builder.copyOriginLoc, origin[0], origin[1]);
+    glUniform2i(builder.copySizeLoc, width, height);
+    glUniform1i(builder.copyCheckerboardParityLoc, checkerboardParity);
+    setDepthMapping(builder.copyDepthMappingLoc, builder.copyDepthRangeLoc, projection);
+
+    // draws a level's fullscreen triangle, only over the damage if there is
+    auto drawLevel = [&](int level) {
+        if(!rects) {
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            return;
+        }
+        int levelWidth = std::max(1, width >> level);
+        int levelHeight = std::max(1, height >> level);
+        glState().setEnabled(GL_SCISSOR_TEST, true);
+        for(int i = 0; i < rectCount; i++) {
+            int x0 = std::min(rects[i][0] >> level, levelWidth - 1);
+            int y0 = std::min(rects[i][1] >> level, levelHeight - 1);
+            int x1 = std::min(((rects[i][2] - 1) >> level) + 1, levelWidth);
+            int y1 = std::min(((rects[i][3] - 1) >> level) + 1, levelHeight);
+            glScissor(x0, y0, x1 - x0, y1 - y0);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+        glState().setEnabled(GL_SCISSOR_TEST, false);
+    };
+
+    glState().bindTexture(0, GL_TEXTURE_2D, depth);
+    drawLevel(0);
+
+    // remaining levels: reduce the previous one. Restricting the sampled
+    // levels keeps the level being written out of the texture's sampled range
+    glState().useProgram(builder.reduceProgram);
+
+    glState().bindTexture(0, GL_TEXTURE_2D, pyramid.texture);
+    for(int level = 1; level < pyramid.levels; level++) {
+        int sourceWidth = std::max(1, width >> (level - 1));
+        int sourceHeight = std::max(1, height >> (level - 1));
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pyramid.texture, level);
+        glState().viewport(0, 0, std::max(1, width >> level), std::max(1, height >> level));
+        glUniform2i(builder.reduceSourceSizeLoc, sourceWidth, sourceHeight);
+        drawLevel(level);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, pyramid.levels - 1);
+
+    glState().bindFramebuffer(GL_DRAW_FRAMEBUFFER, originalFramebuffer);
+    glState().viewport(originalViewport[0], originalViewport[1], originalViewport[2], originalViewport[3]);
+}
+
+/**
+ * Makes the builder's framebuffer on the current context and reads the
+ * finished programs' locations
+ */
+static void setUpPyramidBuilder(PyramidBuilder& builder, GLuint copyProgram, GLuint reduceProgram) {
+    builder.copyProgram = copyProgram;
+    builder.reduceProgram = reduceProgram;
+    glGenFramebuffers(1, &builder.fbo);
+
+    glState().useProgram(copyProgram);
+    glUniform1i(glGetUniformLocation(copyProgram, "depthTex"), 0);
+    glState().useProgram(reduceProgram);
+    glUniform1i(glGetUniformLocation(reduceProgram, "hizTex"), 0);
+    glState().useProgram(0);
+
+    builder.copyOriginLoc = glGetUniformLocation(copyProgram, "origin");
+    builder.copySizeLoc = glGetUniformLocation(copyProgram, "size");
+    builder.copyCheckerboardParityLoc = glGetUniformLocation(copyProgram, "checkerboardParity");
+    builder.copyDepthMappingLoc = glGetUniformLocation(copyProgram, "depthMapping");
+    builder.copyDepthRangeLoc = glGetUniformLocation(copyProgram, "depthRange");
+    builder.reduceSourceSizeLoc = glGetUniformLocation(reduceProgram, "sourceSize");
+}
+
+/**
+ * (Re)allocates the pyramid's textures for a width by height level 0, with
+ * every level down to a single texel
+ */
+static void allocateDepthPyramid(DepthPyramid& pyramid, int width, int height) {
+    if(pyramid.texture == 0)
+        glGenTextures(1, &pyramid.texture);
+    pyramid.width = width;
+    pyramid.height = height;
+    pyramid.levels = 1;
+    while((std::max(width, height) >> pyramid.levels) > 0)
+        pyramid.levels++;
+
+    glState().bindTexture(0, GL_TEXTURE_2D, pyramid.texture);
+    for(int level = 0; level < pyramid.levels; level++) {
+        int levelWidth = std::max(1, width >> level);
+        int levelHeight = std::max(1, height >> level);
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RG32F, levelWidth, levelHeight, 0, GL_RG, GL_FLOAT, nullptr);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+/**
+ * Starts reading back the single texel at the top of the pyramid, the
+ * layer's nearest and farthest depth, unless the layer index still has a
+ * readback in flight
+ */
+static void readDepthRange(int layerIndex, const DepthPyramid& pyramid, const LayerProjection& projection) {
+    if(depthRangeReadbacks.size() <= (size_t)layerIndex)
+        depthRangeReadbacks.resize(layerIndex + 1);
+    DepthRangeReadback& readback = depthRangeReadbacks[layerIndex];
+    if(readback.fence)
+        return;
+    if(readback.buffer == 0) {
+        glGenBuffers(1, &readback.buffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, 2 * sizeof(float), nullptr, GL_STREAM_READ);
+    }
+    else {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    }
+    glState().bindTexture(0, GL_TEXTURE_2D, pyramid.texture);
+    glGetTexImage(GL_TEXTURE_2D, pyramid.levels - 1, GL_RG, GL_FLOAT, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    readback.nearPlane = projection.nearPlane;
+    readback.farPlane = projection.farPlane;
+}
+
+/**
+ * Fits the planes of every layer index whose readback the GPU has finished
+ */
+static void collectDepthRanges() {
+    for(size_t i = 0; i < depthRangeReadbacks.size(); i++) {
+        DepthRangeReadback& readback = depthRangeReadbacks[i];
+        if(!readback.fence || glClientWaitSync(readback.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+            continue;
+        glDeleteSync(readback.fence);
+        readback.fence = nullptr;
+
+        // the pyramids hold depth in the default mapping, see
+        // DEPTH_MAPPING_SRC, which this inverts to distances
+        float depth[2];
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        glGetBufferSubData(GL_PIXEL_PACK_BUFFER, 0, sizeof(depth), depth);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        float n = readback.nearPlane;
+        float f = readback.farPlane;
+        glm::vec2 range;
+        for(int bound = 0; bound < 2; bound++) {
+            float d = glm::clamp(depth[bound], 0.f, 1.f);
+            range[bound] = n * f / (f - d * (f - n));
+        }
+        range *= glm::vec2(depthFitNearMargin, depthFitFarMargin);
+
+        std::lock_guard<std::mutex> lock(fittedDepthRangeMutex);
+        if(fittedDepthRanges.size() <= i)
+            fittedDepthRanges.resize(i + 1, glm::vec2(0));
+        fittedDepthRanges[i] = range;
+    }
+}
+
+bool getRecommendedDepthRange(int layerIndex, float& nearPlane, float& farPlane) {
+    std::lock_guard<std::mutex> lock(fittedDepthRangeMutex);
+    if(layerIndex < 0 || (size_t)layerIndex >= fittedDepthRanges.size() || fittedDepthRanges[layerIndex].y <= 0)
+        return false;
+    nearPlane = fittedDepthRanges[layerIndex].x;
+    farPlane = fittedDepthRanges[layerIndex].y;
+    return true;
+}
+
+/**
+ * Which quads of its viewport a CHECKERBOARD_ENABLED layer rendered, see
+ * CHECKERBOARD_SRC, or -1 for other layers. Flips with every submission, as
+ * getCheckerboardParity does
+ */
+static int checkerboardParity(const FrameLayer& layer) {
+    if(!(layer.flags & CHECKERBOARD_ENABLED))
+        return -1;
+    return (int)(layer.submission & 1);
+}
+
+/**
+ * Resolves the layer's image into its history, (re)allocating the history
+ * at the size it needs: the layer's viewport for CHECKERBOARD_ENABLED layers,
+ * which are filled in, and the layer's whole swapchain image for
+ * TEMPORAL_ACCUMULATION_ENABLED layers, which are blended in. The previous
+ * result is reprojected with the camera it was resolved for, so a history
+ * whose layer changed size or was just turned on starts over from the layer.
+ */
+static void resolveTemporalHistory(TemporalHistory& history, const FrameLayer& layer, const LayerCamera& camera) {
+    int viewport[4];
+    layerViewport(layer, viewport);
+    bool checkerboard = layer.flags & CHECKERBOARD_ENABLED;
+    int width = checkerboard ? viewport[2] : layer.swapchain->getImageWidth(layer.swapchainIndex);
+    int height = checkerboard ? viewport[3] : layer.swapchain->getImageHeight(layer.swapchainIndex);
+    bool historyValid = history.submission != 0;
+    if(history.textures[0] == 0 || history.width != width || history.height != height) {
+        for(GLuint& texture : history.textures) {
+            if(texture == 0)
+                glGenTextures(1, &texture);
+            glState().bindTexture(0, GL_TEXTURE_2D, texture);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_HALF_FLOAT, nullptr);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        }
+        history.width = width;
+        history.height = height;
+        historyValid = false;
+    }
+
+    GLuint previous = history.textures[history.current];
+    history.current = 1 - history.current;
+
+    GLint originalFramebuffer;
+    GLint originalViewport[4];
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &originalFramebuffer);
+    glGetIntegerv(GL_VIEWPORT, originalViewport);
+
+    glState().bindFramebuffer(GL_DRAW_FRAMEBUFFER, temporalFbo);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                           history.textures[history.current], 0);
+    glState().viewport(0, 0, width, height);
+    if(checkerboard) {
+        glState().useProgram(checkerboardResolveProgram);
+        glUniform1i(checkerboardHasDepthLoc, layer.swapchain->hasDepth());
+        glUniform1i(checkerboardHistoryValidLoc, historyValid);
+        glUniform4i(checkerboardViewportLoc, viewport[0], viewport[1], viewport[2], viewport[3]);
+        glUniformMatrix4fv(checkerboardInverseViewProjectionLoc, 1, GL_FALSE, &camera.inverseViewProjection[0][0]);
+        glUniformMatrix4fv(checkerboardHistoryViewProjectionLoc, 1, GL_FALSE, &history.viewProjection[0][0]);
+        glUniform1i(checkerboardParityLoc, checkerboardParity(layer));
+        setDepthMapping(checkerboardDepthMappingLoc, checkerboardDepthRangeLoc, camera.projection);
+    }
+    else {
+        glState().useProgram(temporalResolveProgram);
+        glUniform1i(temporalHasDepthLoc, layer.swapchain->hasDepth());
+        glUniform1i(temporalHistoryValidLoc, historyValid);
+        glUniform4i(temporalViewportLoc, viewport[0], viewport[1], viewport[2], viewport[3]);
+        glUniform2f(temporalOutputSizeLoc, width, height);
+        glUniformMatrix4fv(temporalInverseViewProjectionLoc, 1, GL_FALSE, &camera.inverseViewProjection[0][0]);
+        glUniformMatrix4fv(temporalHistoryViewProjectionLoc, 1, GL_FALSE, &history.viewProjection[0][0]);
+        glUniform1f(temporalWeightLoc, temporalWeight);
+        setLayerRect(temporalLayerRectLoc, temporalLayerClampLoc, &layer);
+        setDepthMapping(temporalDepthMappingLoc, temporalDepthRangeLoc, camera.projection);
+    }
+
+    glState().bindTexture(0, GL_TEXTURE_2D, layer.swapchain->images[layer.swapchainIndex]);
+    if(layer.swapchain->hasDepth())
+        glState().bindTexture(1, GL_TEXTURE_2D, layer.swapchain->depthImages[layer.swapchainIndex]);
+    glState().bindTexture(2, GL_TEXTURE_2D, previous);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glState().bindFramebuffer(GL_DRAW_FRAMEBUFFER, originalFramebuffer);
+    glState().viewport(originalViewport[0], originalViewport[1], originalViewport[2], originalViewport[3]);
+
+    history.viewProjection = camera.viewProjection;
+    history.swapchain = layer.swapchain;
+    history.swapchainIndex = layer.swapchainIndex;
+    history.submission = layer.submission;
+}
+
+/**
+ * Moves frame into the history instead of releasing it. The newest history
+ * frame takes over the depth pyramids, reusing the oldest frame's textures
+ * once the history is full. Layers compacted into the history copy theirs
+ * instead and release their images
+ */
+static void retainFrame(FrameSubmitInfo& frame, int historyLength) {
+    for(FrameLayer& layer : frame.layers) {
+        if(layer.fence) {
+            glDeleteSync(layer.fence);
+            layer.fence = nullptr;
+        }
+    }
+
+    // once the history is full the oldest frame's entry is reused, so its
+    // vectors keep their storage and nothing is allocated
+    if((int)retainedFrames.size() >= historyLength - 1 && !retainedFrames.empty()) {
+        RetainedFrame& oldest = retainedFrames.back();
+        releaseRetainedImages(oldest);
+        for(DepthPyramid& pyramid : oldest.pyramids)
+            pyramid.submission = 0;
+        std::rotate(retainedFrames.begin(), retainedFrames.end() - 1, retainedFrames.end());
+    }
+    else {
+        retainedFrames.emplace_front();
+    }
+
+    RetainedFrame& retained = retainedFrames.front();
+    retained.layers = frame.layers;
+    frame.layers.clear();
+    retained.cameras = layerCameras;
+    if(retained.pyramids.size() < layerPyramids.size())
+        retained.pyramids.resize(layerPyramids.size());
+    if(retained.colors.size() < retained.layers.size())
+        retained.colors.resize(retained.layers.size());
+    bool compact = compactFrameHistory.load(std::memory_order_relaxed);
+    bool compacted = false;
+    for(size_t i = 0; i < layerPyramids.size(); i++) {
+        if(compact && i < retained.layers.size() && compactable(retained.layers[i], layerPyramids[i])) {
+            // the newest pyramid stays for the next frame to rebuild in
+            // place, the entry's own is reused for the copy
+            const FrameLayer& layer = retained.layers[i];
+            compactRetainedLayer(layer, layerPyramids[i], retained.colors[i], retained.pyramids[i]);
+            layer.swapchain->releaseImage(layer.swapchainIndex);
+            compacted = true;
+        }
+        else {
+            // the reused entry's pyramid becomes the texture the next frame
+            // builds
+            std::swap(retained.pyramids[i], layerPyramids[i]);
+        }
+    }
+    // the copies reach the GPU before the app renders into the images again
+    if(compacted)
+        glFlush();
+}
+
+/**
+ * Releases the images of a retained frame's layers that weren't compacted,
+ * the others released theirs when they were
+ */
+static void releaseRetainedImages(RetainedFrame& frame) {
+    for(size_t i = 0; i < frame.layers.size(); i++) {
+        if(i < frame.colors.size() && frame.colors[i].active)
+            frame.colors[i].active = false;
+        else
+            frame.layers[i].swapchain->releaseImage(frame.layers[i].swapchainIndex);
+    }
+}
+
+/**
+ * Whether a retained layer only needs its color and depth pyramid to be
+ * drawn from the history, so it can be compacted. Kept layers were already
+ * reprojected from the same image
+ */
+static bool compactable(const FrameLayer& layer, const DepthPyramid& pyramid) {
+    return (layer.flags & PARALLAX_ENABLED) && pyramid.submission == layer.submission && pyramid.levels > 1
+           && !(layer.flags & (CAMERA_LOCKED | DEPTH_PEELED | DEPTH_AWARE_UPSAMPLING | TEMPORAL_ACCUMULATION_ENABLED
+                               | CHECKERBOARD_ENABLED))
+           && motionTime(layer) == 0 && !reshaded(layer) && !layer.swapchain->isCubeMap();
+}
+
+/**
+ * Copies the layer's viewport at half resolution into color, and levels 1
+ * and up of its pyramid into compactPyramid, (re)allocating both at the
+ * size they need
+ */
+static void compactRetainedLayer(const FrameLayer& layer, const DepthPyramid& pyramid, CompactColor& color,
+                                 DepthPyramid& compactPyramid) {
+    ARP_TRACE_GPU_SCOPE("compactRetainedLayer");
+    if(!compactReadFbo) {
+        glGenFramebuffers(1, &compactReadFbo);
+        glGenFramebuffers(1, &compactDrawFbo);
+    }
+    int viewport[4];
+    layerViewport(layer, viewport);
+    int width = std::max(1, viewport[2] / 2);
+    int height = std::max(1, viewport[3] / 2);
+    GLenum format = colorFormats[layer.swapchain->colorFormat].internalFormat;
+    if(!color.texture || color.width != width || color.height != height || color.format != format) {
+        if(!color.texture)
+            glGenTextures(1, &color.texture);
+        glState().bindTexture(0, GL_TEXTURE_2D, color.texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, colorFormats[layer.swapchain->colorFormat].format,
+                     colorFormats[layer.swapchain->colorFormat].type, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        color.width = width;
+        color.height = height;
+        color.format = format;
+    }
+    int pyramidWidth = std::max(1, pyramid.width >> 1);
+    int pyramidHeight = std::max(1, pyramid.height >> 1);
+    if(!compactPyramid.texture || compactPyramid.width != pyramidWidth || compactPyramid.height != pyramidHeight)
+        allocateDepthPyramid(compactPyramid, pyramidWidth, pyramidHeight);
+
+    GLint originalReadFramebuffer;
+    GLint originalDrawFramebuffer;
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &originalReadFramebuffer);
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &originalDrawFramebuffer);
+    glState().bindFramebuffer(GL_READ_FRAMEBUFFER, compactReadFbo);
+    glState().bindFramebuffer(GL_DRAW_FRAMEBUFFER, compactDrawFbo);
+
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                           layer.swapchain->images[layer.swapchainIndex], 0);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color.texture, 0);
+    glBlitFramebuffer(viewport[0], viewport[1], viewport[0] + viewport[2], viewport[1] + viewport[3], 0, 0, width,
+                      height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+
+    // level by level, the levels below already being reductions of level 0
+    for(int level = 1; level < pyramid.levels; level++) {
+        int levelWidth = std::max(1, pyramid.width >> level);
+        int levelHeight = std::max(1, pyramid.height >> level);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pyramid.texture, level);
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, compactPyramid.texture,
+                               level - 1);
+        glBlitFramebuffer(0, 0, levelWidth, levelHeight, 0, 0, levelWidth, levelHeight, GL_COLOR_BUFFER_BIT,
+                          GL_NEAREST);
+    }
+    // the framebuffers don't keep the app's image attached
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+    glState().bindFramebuffer(GL_READ_FRAMEBUFFER, originalReadFramebuffer);
+    glState().bindFramebuffer(GL_DRAW_FRAMEBUFFER, originalDrawFramebuffer);
+
+    compactPyramid.x = pyramid.x;
+    compactPyramid.y = pyramid.y;
+    compactPyramid.submission = pyramid.submission;
+    color.active = true;
+}
+
+static void retireFrame(FrameSubmitInfo& frame) {
+    for(FrameLayer& layer : frame.layers) {
+        if(layer.fence) {
+            glDeleteSync(layer.fence);
+            layer.fence = nullptr;
+        }
+        // thread layers that were never latched have no image yet
+        if(layer.swapchain)
+            layer.swapchain->releaseImage(layer.swapchainIndex);
+    }
+    frame.layers.clear();
+}
+
+/**
+ * Copies the newest camera state. cameraMailbox has a single consumer, the
+ * lock only orders callers on different threads, reprojection never takes it
+ */
+static void takeCameraState(CameraState& state) {
+    std::lock_guard<std::mutex> lock(cameraStateMutex);
+    cameraMailbox.consume();
+    state = cameraMailbox.front();
+}
+
+void getCameraPose(Pose& pose, PoseInfo& poseInfo) {
+    if(getReplayedPose(pose, poseInfo))
+        return;
+    CameraState state;
+    takeCameraState(state);
+    pose = state.pose;
+    poseInfo = state.poseInfo;
+}
+
+double getPredictedDisplayTime() {
+    RefreshModel refresh;
+    double latchLead;
+    {
+        std::lock_guard<std::mutex> lock(displayTimingMutex);
+        refresh = displayRefresh;
+        latchLead = displayLatchLead;
+    }
+
+    // the frame is shown by the first refresh that latches after the GPU
+    // finishes it
+    double tail = estimateAppGpuTime(appGpuTailHistory, 0);
+    return refresh.nextVblank(getPredictedSubmitTime() + tail + latchLead);
+}
+
+/**
+ * Returns the estimated time that the next frame will be submitted based on
+ * previous frames
+ */
+static double getPredictedSubmitTime() {
+    double times[historySize];
+    int count = frameHistory.snapshot(times, historySize);
+    if(count < 2) {
+        // no way to guess without a history, assume it is submitted now
+        return glfwGetTime();
+    }
+
+    // fit frame times against frame index and extrapolate one frame ahead.
+    // times are relative to the newest frame to keep the fit well conditioned
+    double index[historySize];
+    double relative[historySize];
+    for(int i = 0; i < count; i++) {
+        index[i] = i;
+        relative[i] = times[i] - times[count - 1];
+    }
+    double next = predictSamples(posePredictor, index, relative, count, count, 1e-6, 1e-6);
+    // never predict a frame before the newest one
+    return times[count - 1] + std::max(next, 0.0);
+}
+
+/**
+ * Context of the key times of a prediction: held keys count as held for the
+ * whole predicted interval, scaled by setPredictionTuning's gain
+ */
+struct PredictedKeyTimes {
+    const CameraState* state;
+    double dt;
+};
+
+void getPredictedCameraPose(double time, Pose& pose, PoseInfo& poseInfo) {
+    if(getReplayedPose(pose, poseInfo))
+        return;
+    PoseQuery query = { time };
+    evaluatePoses(&query, &pose, 1, &poseInfo);
+}
+
+// past this the mouse's extrapolation runs away, trajectories keep the
+// direction predicted for it
+static const double trajectoryTurnHorizon = 0.25;
+
+void getPredictedTrajectory(double time, double horizon, Pose* poses, int count) {
+    TransientScope scope;
+    TransientVector<PoseQuery> queries(2 * count);
+    for(int i = 0; i < count; i++) {
+        double t = time + horizon * (i + 1) / count;
+        queries[i].time = t;
+        queries[count + i].time = std::min(t, time + trajectoryTurnHorizon);
+    }
+    TransientVector<Pose> evaluated(2 * count);
+    evaluatePoses(queries.data(), evaluated.data(), 2 * count);
+    for(int i = 0; i < count; i++) {
+        poses[i] = evaluated[i];
+        poses[i].orientation = evaluated[count + i].orientation;
+    }
+}
+
+// poses sampled over a frame's lifetime by getGuardBandProjection
+static const int guardBandSamples = 4;
+// the predicted rotation is widened by this much for prediction error
+static const float guardBandMargin = 1.25f;
+// edges never move past about 76 degrees from the view direction
+static const float guardBandMaxTangent = 4.f;
+
+/**
+ * Evaluates the predicted poses at guardBandSamples times over the
+ * lifetime of a frame shown at displayTime
+ */
+static void predictFrameLifetime(double displayTime, Pose poses[guardBandSamples]) {
+    // the frame stays on screen until the next one replaces it, which can
+    // be a refresh late
+    double refreshPeriod;
+    {
+        std::lock_guard<std::mutex> lock(displayTimingMutex);
+        refreshPeriod = displayRefresh.period;
+    }
+    double lifetime = (pacerPeriod > 0 ? pacerPeriod : 1.0 / std::max(pacedFramerate(), 1)) + refreshPeriod;
+
+    PoseQuery queries[guardBandSamples];
+    for(int i = 0; i < guardBandSamples; i++)
+        queries[i].time = displayTime + lifetime * (i + 1) / guardBandSamples;
+    evaluatePoses(queries, poses, guardBandSamples);
+}
+
+LayerProjection getGuardBandProjection(const Pose& pose, double displayTime, const LayerProjection& view) {
+    Pose poses[guardBandSamples];
+    predictFrameLifetime(displayTime, poses);
+
+    LayerProjection result = view;
+    glm::quat toLayer = glm::conjugate(pose.orientation);
+    for(const Pose& future : poses) {
+        glm::quat rotation = toLayer * future.orientation;
+        if(rotation.w < 0)
+            rotation = -rotation;
+        float rotationAngle = glm::angle(rotation);
+        if(!(rotationAngle > 0))
+            continue;
+        // the part of the turn that is added to the prediction
+        rotation = glm::angleAxis(rotationAngle * guardBandMargin, glm::axis(rotation));
+        for(float x : { view.left, view.right }) {
+            for(float y : { view.bottom, view.top }) {
+                // corner of the future view in this layer's camera space
+                glm::vec3 corner = rotation * glm::vec3(x, y, -1);
+                glm::vec2 tangent = corner.z < -1e-3f
+                    ? glm::vec2(corner) / -corner.z
+                    : glm::vec2(corner) * 1e3f;
+                result.left = std::min(result.left, tangent.x);
+                result.right = std::max(result.right, tangent.x);
+                result.bottom = std::min(result.bottom, tangent.y);
+                result.top = std::max(result.top, tangent.y);
+            }
+        }
+    }
+    result.left = std::max(result.left, -guardBandMaxTangent);
+    result.right = std::min(result.right, guardBandMaxTangent);
+    result.bottom = std::max(result.bottom, -guardBandMaxTangent);
+    result.top = std::min(result.top, guardBandMaxTangent);
+    return result;
+}
+
+LayerProjection getCoveredProjection(const Pose& pose, double displayTime, const LayerProjection& projection) {
+    Pose poses[guardBandSamples];
+    predictFrameLifetime(displayTime, poses);
+
+    LayerProjection result = projection;
+    glm::quat toLayer = glm::conjugate(pose.orientation);
+    for(const Pose& future : poses) {
+        glm::quat rotation = toLayer * future.orientation;
+        if(rotation.w < 0)
+            rotation = -rotation;
+        float rotationAngle = glm::angle(rotation);
+        if(!(rotationAngle > 0))
+            continue;
+        rotation = glm::angleAxis(rotationAngle * guardBandMargin, glm::axis(rotation));
+        // the future frustum in this layer's camera space. Each edge moves
+        // in to the innermost of its two corners, which keeps the result
+        // inside both frusta
+        auto tangent = [&](float x, float y) {
+            glm::vec3 corner = rotation * glm::vec3(x, y, -1);
+            return corner.z < -1e-3f ? glm::vec2(corner) / -corner.z : glm::vec2(corner) * 1e3f;
+        };
+        glm::vec2 leftBottom = tangent(projection.left, projection.bottom);
+        glm::vec2 rightBottom = tangent(projection.right, projection.bottom);
+        glm::vec2 leftTop = tangent(projection.left, projection.top);
+        glm::vec2 rightTop = tangent(projection.right, projection.top);
+        result.left = std::max(result.left, std::max(leftBottom.x, leftTop.x));
+        result.right = std::min(result.right, std::min(rightBottom.x, rightTop.x));
+        result.bottom = std::max(result.bottom, std::max(leftBottom.y, rightBottom.y));
+        result.top = std::min(result.top, std::min(leftTop.y, rightTop.y));
+    }
+    return result;
+}
+
+/**
+ * Clips a polygon of directions to those on the negative side of the
+ * plane through the origin with the given normal, the same as clipping
+ * the cone they span. Returns the new vertex count, polygon holds at
+ * least count + 1 vertices
+ */
+static int clipCone(glm::vec3* polygon, int count, const glm::vec3& normal) {
+    glm::vec3 clipped[12];
+    int clippedCount = 0;
+    for(int i = 0; i < count; i++) {
+        glm::vec3 a = polygon[i];
+        glm::vec3 b = polygon[(i + 1) % count];
+        float da = glm::dot(a, normal);
+        float db = glm::dot(b, normal);
+        if(da <= 0)
+            clipped[clippedCount++] = a;
+        if((da < 0 && db > 0) || (da > 0 && db < 0))
+            clipped[clippedCount++] = a + (b - a) * (da / (da - db));
+    }
+    std::copy(clipped, clipped + clippedCount, polygon);
+    return clippedCount;
+}
+
+CubeMapRegions getCubeMapRegions(const Pose& layerPose, const Pose& pose, double displayTime,
+                                 const LayerProjection& view, int size) {
+    LayerProjection band = getGuardBandProjection(pose, displayTime, view);
+    // the frustum is a cone under 180 degrees, its corner rays lie in one
+    // plane so clipping them as a polygon clips the cone
+    glm::quat toLayer = glm::conjugate(layerPose.orientation) * pose.orientation;
+    glm::vec3 corners[4] = {
+        toLayer * glm::vec3(band.left, band.bottom, -1), toLayer * glm::vec3(band.right, band.bottom, -1),
+        toLayer * glm::vec3(band.right, band.top, -1), toLayer * glm::vec3(band.left, band.top, -1),
+    };
+    // each face's camera sees where x and y are within -z
+    static const glm::vec3 facePlanes[4] = { { 1, 0, 1 }, { -1, 0, 1 }, { 0, 1, 1 }, { 0, -1, 1 } };
+
+    CubeMapRegions regions;
+    for(int face = 0; face < 6; face++) {
+        glm::quat toFace = glm::conjugate(cubeMapFaceOrientation(face));
+        glm::vec3 polygon[12];
+        int count = 4;
+        for(int i = 0; i < 4; i++)
+            polygon[i] = toFace * corners[i];
+        for(const glm::vec3& plane : facePlanes)
+            count = clipCone(polygon, count, plane);
+        if(count < 3)
+            continue;
+
+        glm::vec2 low(1), high(-1);
+        for(int i = 0; i < count; i++) {
+            if(polygon[i].z > -1e-6f)
+                continue;
+            glm::vec2 tangent = glm::clamp(glm::vec2(polygon[i]) / -polygon[i].z, -1.f, 1.f);
+            low = glm::min(low, tangent);
+            high = glm::max(high, tangent);
+        }
+        if(low.x > high.x || low.y > high.y)
+            continue;
+        // a pixel more on each side for filtering across the edge
+        int x0 = std::max((int)std::floor((low.x + 1) / 2 * size) - 1, 0);
+        int y0 = std::max((int)std::floor((low.y + 1) / 2 * size) - 1, 0);
+        int x1 = std::min((int)std::ceil((high.x + 1) / 2 * size) + 1, size);
+        int y1 = std::min((int)std::ceil((high.y + 1) / 2 * size) + 1, size);
+        int* rect = regions.rects[face];
+        rect[0] = x0;
+        rect[1] = y0;
+        rect[2] = x1 - x0;
+        rect[3] = y1 - y0;
+    }
+    return regions;
+}
+
+/**
+ * Context of the key times of a batch of predictions
+ */
+struct PredictedKeyTimesBatch {
+    const CameraState* state;
+    const double* dt;
+    std::size_t count;
+};
+
+void evaluatePoses(const PoseQuery* queries, Pose* out, std::size_t n, PoseInfo* poseInfo) {
+    CameraState state;
+    takeCameraState(state);
+    if(poseInfo)
+        *poseInfo = state.poseInfo;
+
+    PoseSource* source = poseSource.load(std::memory_order_acquire);
+    if(source) {
+        for(std::size_t i = 0; i < n; i++) {
+            if(!source->getPose(queries[i].time, out[i]))
+                out[i] = state.pose;
+        }
+        return;
+    }
+
+    if(posePredictor == PREDICTOR_POSE_EXTRAPOLATION) {
+        PoseSample samples[poseVelocitySamples];
+        int count = cameraPoseHistory.snapshot(samples, poseVelocitySamples);
+        if(count > 0) {
+            const PoseSample& newest = samples[count - 1];
+            PoseVelocity velocity = estimatePoseVelocity(samples, count);
+            for(std::size_t i = 0; i < n; i++)
+                out[i] = extrapolatePose(newest.pose, velocity, std::max(queries[i].time - newest.time, 0.0));
+            return;
+        }
+    }
+
+    // called every refresh for every layer, the arrays come from the arena
+    TransientScope scope;
+    TransientVector<double> dx(n, 0.0), dy(n, 0.0), dt(n);
+    for(std::size_t i = 0; i < n; i++)
+        dt[i] = std::max(queries[i].time - state.poseInfo.time, 0.0);
+
+    // extrapolate the mouse from where reprojection last sampled it
+    InputSample samples[inputHistorySize];
+    int count = inputHistory.snapshot(samples, inputHistorySize);
+    if((cursorCaptured || inputOverride) && count >= 2) {
+        double t[inputHistorySize];
+        double x[inputHistorySize];
+        double y[inputHistorySize];
+        for(int i = 0; i < count; i++) {
+            t[i] = samples[i].time - state.poseInfo.time;
+            x[i] = samples[i].mouseX - state.poseInfo.mouseX;
+            y[i] = samples[i].mouseY - state.poseInfo.mouseY;
+        }
+        int predictor = posePredictor;
+        double gain = predictionRotationGain.load(std::memory_order_relaxed);
+        for(std::size_t i = 0; i < n; i++) {
+            dx[i] = predictSamples(predictor, t, x, count, dt[i], 1.0, 1e6) * gain;
+            dy[i] = predictSamples(predictor, t, y, count, dt[i], 1.0, 1e6) * gain;
+        }
+    }
+
+    TransientVector<double> heldTime(n);
+    double translationGain = predictionTranslationGain.load(std::memory_order_relaxed);
+    for(std::size_t i = 0; i < n; i++)
+        heldTime[i] = dt[i] * translationGain;
+
+    if(batchPoseFunction) {
+        PredictedKeyTimesBatch predicted = { &state, heldTime.data(), n };
+        PoseBatch batch;
+        batch.lastPose = state.pose;
+        batch.count = n;
+        batch.dx = dx.data();
+        batch.dy = dy.data();
+        batch.dt = dt.data();
+        batch.keyTimes = [](const void* context, int key, double* out) {
+            const PredictedKeyTimesBatch& predicted = *(const PredictedKeyTimesBatch*)context;
+            bool held = validKey(key) && predicted.state->heldKeys[key];
+            for(std::size_t i = 0; i < predicted.count; i++)
+                out[i] = held ? predicted.dt[i] : 0.0;
+        };
+        batch.context = &predicted;
+        batchPoseFunction(batch, out);
+        return;
+    }
+
+    for(std::size_t i = 0; i < n; i++) {
+        PredictedKeyTimes predicted = { &state, heldTime[i] };
+        KeyTime keyTime = { [](const void* context, int key) {
+            const PredictedKeyTimes& predicted = *(const PredictedKeyTimes*)context;
+            return validKey(key) && predicted.state->heldKeys[key] ? predicted.dt : 0.0;
+        }, &predicted };
+        out[i] = evaluatePose(state.pose, dx[i], dy[i], dt[i], keyTime);
+    }
+}
+
+void setPosePredictor(PosePredictor predictor) {
+    posePredictor = predictor;
+}
+
+void setPredictionTuning(bool enabled) {
+    predictionTuning = enabled;
+}
+
+/**
+ * Axis times angle of a rotation, the shorter way round
+ */
+static glm::vec3 rotationVector(glm::quat rotation) {
+    if(rotation.w < 0)
+        rotation = -rotation;
+    float angle = glm::angle(rotation);
+    return angle > 1e-6f ? glm::axis(rotation) * angle : glm::vec3(0);
+}
+
+/**
+ * Fits gain to the scale that best maps the motion predicted before gain
+ * scaled it onto the actual motion, over the decaying sums
+ */
+static void fitPredictionGain(double* sums, std::atomic<double>& gain, const glm::vec3& predicted,
+                              const glm::vec3& actual) {
+    glm::dvec3 unscaled = glm::dvec3(predicted) / gain.load(std::memory_order_relaxed);
+    // standing still says nothing about the scale
+    if(glm::dot(unscaled, unscaled) < 1e-10)
+        return;
+    sums[0] = sums[0] * predictionTuningDecay + glm::dot(glm::dvec3(actual), unscaled);
+    sums[1] = sums[1] * predictionTuningDecay + glm::dot(unscaled, unscaled);
+    gain.store(glm::clamp(sums[0] / sums[1], minPredictionGain, maxPredictionGain), std::memory_order_relaxed);
+}
+
+/**
+ * Compares a new frame's pose, predicted from the pose from, to the pose
+ * of its first refresh, for the stats and setPredictionTuning
+ */
+static void measurePrediction(const Pose& from, const Pose& predicted, const Pose& actual) {
+    float cosine = std::min(std::abs(glm::dot(predicted.orientation, actual.orientation)), 1.f);
+    double degrees = glm::degrees(2.0 * std::acos((double)cosine));
+    double distance = glm::length(predicted.position - actual.position);
+    statsCounters.predictedFrames.fetch_add(1, std::memory_order_relaxed);
+    statsCounters.predictionErrorMicrodegrees.fetch_add((std::uint64_t)(degrees * 1e6), std::memory_order_relaxed);
+    statsCounters.predictionErrorMicrounits.fetch_add((std::uint64_t)(distance * 1e6), std::memory_order_relaxed);
+
+    if(predictionTuning && !poseSource.load(std::memory_order_relaxed)
+       && posePredictor != PREDICTOR_POSE_EXTRAPOLATION) {
+        glm::quat toFrom = glm::conjugate(from.orientation);
+        fitPredictionGain(rotationFitSums, predictionRotationGain, rotationVector(toFrom * predicted.orientation),
+                          rotationVector(toFrom * actual.orientation));
+        fitPredictionGain(translationFitSums, predictionTranslationGain, predicted.position - from.position,
+                          actual.position - from.position);
+    }
+    else {
+        rotationFitSums[0] = rotationFitSums[1] = 0;
+        translationFitSums[0] = translationFitSums[1] = 0;
+        predictionRotationGain = 1.0;
+        predictionTranslationGain = 1.0;
+    }
+
+    std::lock_guard<std::mutex> lock(frameStatsMutex);
+    frameStats.predictionAngleError = glm::mix(degrees, frameStats.predictionAngleError, predictionTuningDecay);
+    frameStats.predictionPositionError = glm::mix(distance, frameStats.predictionPositionError,
+                                                  predictionTuningDecay);
+    frameStats.predictionRotationGain = predictionRotationGain;
+    frameStats.predictionTranslationGain = predictionTranslationGain;
+}
+
+/**
+ * Evaluates the least squares polynomial of the given degree through the
+ * samples at time at. Falls back to lower degrees without enough samples
+ */
+static double fitPolynomial(int degree, const double* t, const double* x, int count, double at) {
+    degree = std::min(degree, count - 1);
+    if(degree <= 0) {
+        return count > 0 ? x[count - 1] : 0.0;
+    }
+
+    // normal equations, sums[k] = sum(t^k), rhs[k] = sum(x * t^k)
+    double sums[5] = {0};
+    double rhs[3] = {0};
+    for(int i = 0; i < count; i++) {
+        double power = 1;
+        for(int k = 0; k <= 2 * degree; k++) {
+            sums[k] += power;
+            if(k <= degree) {
+                rhs[k] += x[i] * power;
+            }
+            power *= t[i];
+        }
+    }
+
+    double coefficients[3] = {0};
+    if(degree == 1) {
+        double det = sums[0] * sums[2] - sums[1] * sums[1];
+        if(std::abs(det) < 1e-12) {
+            return x[count - 1];
+        }
+        coefficients[0] = (rhs[0] * sums[2] - rhs[1] * sums[1]) / det;
+        coefficients[1] = (sums[0] * rhs[1] - sums[1] * rhs[0]) / det;
+    } else {
+        glm::dmat3 normal(sums[0], sums[1], sums[2],
+                          sums[1], sums[2], sums[3],
+                          sums[2], sums[3], sums[4]);
+        if(std::abs(glm::determinant(normal)) < 1e-12) {
+            return fitPolynomial(1, t, x, count, at);
+        }
+        glm::dvec3 solution = glm::inverse(normal) * glm::dvec3(rhs[0], rhs[1], rhs[2]);
+        coefficients[0] = solution.x;
+        coefficients[1] = solution.y;
+        coefficients[2] = solution.z;
+    }
+    return coefficients[0] + coefficients[1] * at + coefficients[2] * at * at;
+}
+
+/**
+ * Runs a constant velocity Kalman filter over the samples and extrapolates
+ * the filtered state to time at. processNoise is the variance of the
+ * unmodelled acceleration
+ */
+static double kalmanPredict(const double* t, const double* x, int count, double at,
+                            double measurementNoise, double processNoise) {
+    if(count <= 0) {
+        return 0.0;
+    }
+
+    // state is position and velocity, p is its covariance
+    double position = x[0];
+    double velocity = 0;
+    double p00 = measurementNoise, p01 = 0, p11 = 1e6 * measurementNoise;
+    for(int i = 1; i < count; i++) {
+        double dt = t[i] - t[i - 1];
+
+        // predict
+        position += velocity * dt;
+        double dt2 = dt * dt;
+        double n00 = p00 + 2 * dt * p01 + dt2 * p11 + processNoise * dt2 * dt2 * 0.25;
+        double n01 = p01 + dt * p11 + processNoise * dt2 * dt * 0.5;
+        double n11 = p11 + processNoise * dt2;
+
+        // update
+        double s = n00 + measurementNoise;
+        double k0 = n00 / s;
+        double k1 = n01 / s;
+        double residual = x[i] - position;
+        position += k0 * residual;
+        velocity += k1 * residual;
+        p00 = (1 - k0) * n00;
+        p01 = (1 - k0) * n01;
+        p11 = n11 - k1 * n01;
+    }
+    return position + velocity * (at - t[count - 1]);
+}
+
+/**
+ * Predicts the value of the samples (t, x) at time at with the given
+ * PosePredictor. Noise values are only used by the Kalman filter
+ */
+static double predictSamples(int predictor, const double* t, const double* x, int count,
+                             double at, double measurementNoise, double processNoise) {
+    switch(predictor) {
+    case PREDICTOR_CONSTANT_ACCELERATION:
+        return fitPolynomial(2, t, x, count, at);
+    case PREDICTOR_KALMAN:
+        return kalmanPredict(t, x, count, at, measurementNoise, processNoise);
+    default:
+        return fitPolynomial(1, t, x, count, at);
+    }
+}
 
-    int i = index;
-    acquiredStatus[i] = 1;
-    index = (index + 1) % numImages;
-    return i;
+GLFWwindow* getUploadContext() {
+    return uploadWindow;
 }
 
-void Swapchain::bindFramebuffer(int index) {
-    glBindFramebuffer(GL_FRAMEBUFFER, fbos[index]);
+void setAppContexts(int count) {
+    appContextCount = std::min(std::max(count, 0), (int)MAX_FRAME_LAYERS);
 }
 
-void Swapchain::resize(int newWidth, int newHeight) {
-    std::lock_guard<std::mutex> lock(mutex);
-    this->width = newWidth;
-    this->height = newHeight;
-    for(int i = 0; i < numImages; i++) {
-        glBindTexture(GL_TEXTURE_2D, images[i]);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
-        glBindTexture(GL_TEXTURE_2D, depthImages[i]);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+GLFWwindow* getAppContext(int index) {
+    return index >= 0 && index < appContextCount ? appContexts[index] : nullptr;
+}
+
+void shutdown() {
+    glfwSetWindowShouldClose(window, GLFW_TRUE);
+    appThread.join();
+}
+
+static void appThreadStarter(ApplicationCallback callback) {
+    ARP_TRACE_THREAD("application");
+    ThreadPriority priority = applyThreadConfig("application", threadConfig.appPriority, threadConfig.appCore);
+    {
+        std::lock_guard<std::mutex> lock(frameStatsMutex);
+        frameStats.appPriority = priority;
     }
+    glfwMakeContextCurrent(hiddenWindow);
+    callback(hiddenWindow);
+
+    // application has finished at this point
+    glfwSetWindowShouldClose(window, GLFW_TRUE);
 }
 
-void Swapchain::releaseImage(int i) {
-    std::lock_guard<std::mutex> lock(mutex);
-    acquiredStatus[i] = 0;
-    cond.notify_all();
+static void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+    windowEventArrived = true;
+    // with an input override or replay held keys come from it, the app
+    // still sees the event
+    if(!inputOverride && !replayingInput && action != GLFW_REPEAT) {
+        inputEvents.push({glfwGetTime(), INPUT_EVENT_KEY, key, action, 0, 0});
+    }
+
+    if(originalKeyCallback)
+        originalKeyCallback(window, key, scancode, action, mods);
 }
 
-int initialize() {
-    if(!glfwGetCurrentContext()) {
-        std::cout << "Error: cannot initialize ARP with no valid OpenGL context" << std::endl;
-        return -1;
+static void cursorPosCallback(GLFWwindow* window, double x, double y) {
+    windowEventArrived = true;
+    {
+        // cursor positions are in screen coordinates, which differ from
+        // pixels on high DPI displays
+        int windowWidth, windowHeight;
+        glfwGetWindowSize(window, &windowWidth, &windowHeight);
+        cursorPixelX.store(windowWidth > 0 ? x * framebufferWidth / windowWidth : x, std::memory_order_relaxed);
+        cursorPixelY.store(windowHeight > 0 ? y * framebufferHeight / windowHeight : y, std::memory_order_relaxed);
     }
-    GLenum glewErr = glewInit();
-    if(glewErr != GLEW_OK) {
-        std::cout << "Error initializing GLEW: " << glewErr << std::endl;
-        return -1;
+    if(!inputOverride && !replayingInput) {
+        inputEvents.push({glfwGetTime(), INPUT_EVENT_CURSOR, 0, 0, x, y});
     }
-    initialized = true;
-    return 0;
+
+    if(originalCursorPosCallback)
+        originalCursorPosCallback(window, x, y);
 }
 
-void registerPoseFunction(PoseFunction func) {
-    poseFunction = func;
+/**
+ * Applies the window input received since the last refresh. Keys count as
+ * held from the time they were pressed to the time they were released, and
+ * every cursor position is added to the prediction history with the time it
+ * was received. time is the time the refresh sampled input at
+ */
+static void processInputEvents(double time) {
+    restartKeyTimesAfterSubmit();
+
+    InputEvent events[64];
+    int count;
+    // events handled in one poll share a time, only the last one is kept
+    InputSample cursor;
+    bool cursorPending = false;
+    while((count = inputEvents.readSince(inputEventsRead, events, 64)) > 0) {
+        for(int i = 0; i < count; i++) {
+            const InputEvent& event = events[i];
+            if(recordingInput.load(std::memory_order_relaxed)) {
+                EventRecord record{};
+                record.time = event.time;
+                record.type = event.type;
+                record.key = event.key;
+                record.action = event.action;
+                record.x = event.x;
+                record.y = event.y;
+                inputRecording.write(INPUT_RECORD_EVENT, record);
+            }
+            if(event.type == INPUT_EVENT_KEY) {
+                if(!validKey(event.key))
+                    continue;
+                bool held = keysHeld[event.key];
+                if(event.action == GLFW_PRESS && !held) {
+                    keysHeld[event.key] = 1;
+                    keyHeldSince[event.key] = event.time;
+                    keyPressArrived = true;
+                }
+                else if(event.action == GLFW_RELEASE && held) {
+                    addKeyTime(event.key, std::max(event.time - keyHeldSince[event.key], 0.0));
+                    keysHeld[event.key] = 0;
+                }
+            }
+            else {
+                if(cursorPending && event.time != cursor.time)
+                    inputHistory.push(cursor);
+                cursor = {event.time, event.x, event.y};
+                cursorPending = true;
+            }
+        }
+    }
+    if(cursorPending && cursor.time < time)
+        inputHistory.push(cursor);
+
+    for(int key = 0; key < KEY_COUNT; key++) {
+        if(!keysHeld[key])
+            continue;
+        addKeyTime(key, std::max(time - keyHeldSince[key], 0.0));
+        keyHeldSince[key] = time;
+    }
 }
 
-void captureCursor() {
-    cursorCaptured = true;
+/**
+ * Zeroes keyTimes if a frame was submitted since the last refresh, so key
+ * times count from the last submit. A replay zeroes them where the recording
+ * did instead
+ */
+static void restartKeyTimesAfterSubmit() {
+    uint64_t epoch = submitEpoch.load(std::memory_order_acquire);
+    keyTimesRestarted = replayedRefresh ? replayedRefresh->keyTimesRestarted : epoch != keyTimesEpoch;
+    keyTimesEpoch = epoch;
+    if(!keyTimesRestarted)
+        return;
+    for(int key = 0; key < KEY_COUNT; key++)
+        keyTimes[key].store(0, std::memory_order_relaxed);
 }
 
-void releaseCursor() {
-    cursorCaptured = false;
+static void addKeyTime(int key, double time) {
+    double total = keyTimes[key].load(std::memory_order_relaxed);
+    keyTimes[key].store(total + time, std::memory_order_relaxed);
 }
 
-void updateProjection(float near_, float far_, float fovY_, float aspectRatio_) {
-    projectionNear = near_;
-    projectionFar = far_;
-    projectionFovY = fovY_;
-    projectionAspect = aspectRatio_;
+/**
+ * Starts the next refresh of an input replay: waits for its recorded time
+ * and hands the events recorded before it to processInputEvents. Returns
+ * nullptr at the end of the log
+ */
+static const RefreshRecord* beginReplayRefresh() {
+    if(replayRefresh >= inputReplay.refreshes.size()) {
+        replayedRefresh = nullptr;
+        return nullptr;
+    }
+    replayedRefresh = &inputReplay.refreshes[replayRefresh++];
+    double recorded = replayedRefresh->time;
+    // a refresh that runs late is not waited for, the ones after it catch up
+    sleepUntil(recorded + replayTimeOffset);
+
+    const std::vector<EventRecord>& events = inputReplay.events;
+    for(; replayEvent < events.size() && events[replayEvent].time <= recorded; replayEvent++) {
+        const EventRecord& event = events[replayEvent];
+        inputEvents.push({event.time + replayTimeOffset, (InputEventType)event.type, event.key, event.action,
+                          event.x, event.y});
+    }
+    return replayedRefresh;
+}
 
-    projection = glm::perspective(projectionFovY, projectionAspect, projectionNear, projectionFar * 3);
+/**
+ * Latches the frame the recording latched on this refresh, waiting for the
+ * app to submit it. Returns whether a new frame was latched
+ */
+static bool latchReplayedFrame(const RefreshRecord& refresh) {
+    if(!refresh.latchedSubmission)
+        return false;
+    int index = inputReplay.findSubmit(refresh.latchedSubmission);
+    // submitted before the recording started, so the replay has no match
+    if(index < 0)
+        return latchPendingFrame();
+
+    // submissions of the replay count from 1, like those of the recording
+    uint64_t expected = (uint64_t)index + 1;
+    {
+        ARP_TRACE_SCOPE("replay latch wait");
+        double deadline = glfwGetTime() + replayLatchTimeout;
+        while(submitEpoch.load(std::memory_order_acquire) < expected && glfwGetTime() < deadline)
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    bool latched = latchPendingFrame();
+    if(!latched || lastFrame->submission != expected) {
+        std::lock_guard<std::mutex> lock(frameStatsMutex);
+        frameStats.replayDivergences++;
+    }
+    return latched;
 }
 
-int startReprojection(ApplicationCallback callback) {
-    if(!poseFunction) {
-        std::cout << "Error: No pose function provided! Not starting reprojection." << std::endl;
-        return -1;
+/**
+ * Pose of the next frame of an input replay, if the log has one. Called by
+ * the app thread
+ */
+static bool getReplayedPose(Pose& pose, PoseInfo& poseInfo) {
+    if(!replayingInput || replaySubmit >= inputReplay.submits.size())
+        return false;
+    const SubmitRecord& record = inputReplay.submits[replaySubmit];
+    pose = record.pose;
+    poseInfo = record.poseInfo;
+    poseInfo.time += replayTimeOffset;
+    return true;
+}
+
+static void windowPosCallback(GLFWwindow* window, int x, int y) {
+    if(renderThreadEnabled)
+        monitorQueryPending = true;
+    else
+        monitorCheckPending = true;
+    if(originalWindowPosCallback) {
+        originalWindowPosCallback(window, x, y);
+    }
+}
+
+static void monitorCallback(GLFWmonitor* monitor, int event) {
+    if(renderThreadEnabled)
+        monitorQueryPending = true;
+    else
+        monitorCheckPending = true;
+    if(originalMonitorCallback) {
+        originalMonitorCallback(monitor, event);
     }
+}
 
-    window = glfwGetCurrentContext();
-    glfwSwapInterval(1);
+static void framebufferSizeCallback(GLFWwindow* window, int width, int height) {
+    windowEventArrived = true;
+    // the viewport belongs to the context, which may be current on another
+    // thread, so the next refresh sets it
+    framebufferWidth = width;
+    framebufferHeight = height;
+    viewportPending = true;
+    if(originalFramebufferSizeCallback) {
+        originalFramebufferSizeCallback(window, width, height);
+    }
+}
 
-    cameraPose.position = glm::vec3(0, 0, 0);
-    cameraPose.orientation = glm::quat(1, 0, 0, 0);
-    lastFrame.pose = cameraPose;
+static void setupGL() {
+    // create VAO
+    glGenVertexArrays(1, &quadVao);
+    glState().bindVertexArray(quadVao);
 
     
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
-    hiddenWindow = glfwCreateWindow(1, 1, "", NULL, window);
-    glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+    float vertexData[] = {
+        -1, -1, 0, // bottom left
+        -1,  1, 0, // top left
+         1, -1, 0, // bottom right
+         1,  1, 0, // top right
+    };
+
+    glGenBuffers(1, &quadVbo);
+    glBindBuffer(GL_ARRAY_BUFFER, quadVbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertexData), vertexData, GL_STATIC_DRAW);
     
-    IMGUI_CHECKVERSION();
-    ImGui::CreateContext();
-    ImGuiIO& io = ImGui::GetIO(); (void)io;
-    io.ConfigFlags |= ImGuiConfigFlags_NavEnableKeyboard;     // Enable Keyboard Controls
-    io.ConfigFlags |= ImGuiConfigFlags_NavEnableGamepad;      // Enable Gamepad Controls
+    // the quad feeds pos of parallaxVertSrc
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (GLvoid*)0);
+
+    timerQueriesSupported = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+    if(timerQueriesSupported) {
+        glGenQueries(2, reprojectionTimerQueries);
+        glGenQueries(2, reprojectionStartQueries);
+    }
 
-    // Setup Dear ImGui style
-    ImGui::StyleColorsDark();
+    cubeMapProgram = finishProgram(pendingCubeMapProgram);
+    copyProgram = finishProgram(pendingCopyProgram);
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
+    GLint stencilType = GL_NONE;
+    GLint stencilBits = 0;
+    glGetFramebufferAttachmentParameteriv(GL_DRAW_FRAMEBUFFER, GL_STENCIL,
+                                          GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE, &stencilType);
+    if(stencilType != GL_NONE)
+        glGetFramebufferAttachmentParameteriv(GL_DRAW_FRAMEBUFFER, GL_STENCIL,
+                                              GL_FRAMEBUFFER_ATTACHMENT_STENCIL_SIZE, &stencilBits);
+    stencilCompositing = stencilBits > 0;
+
+    setUpPyramidBuilder(pyramidBuilder, finishProgram(pendingHizCopyProgram), finishProgram(pendingHizReduceProgram));
+    tileClassifyProgram = finishProgram(pendingTileClassifyProgram);
+    glGenFramebuffers(1, &tileClassifyFbo);
+    temporalResolveProgram = finishProgram(pendingTemporalResolveProgram);
+    checkerboardResolveProgram = finishProgram(pendingCheckerboardResolveProgram);
+    glGenFramebuffers(1, &temporalFbo);
+    multisampleResolveProgram = finishProgram(pendingMultisampleResolveProgram);
+    glGenFramebuffers(1, &multisampleResolveFbo);
+    qualityCompareProgram = finishProgram(pendingQualityCompareProgram);
+    qualityReduceProgram = finishProgram(pendingQualityReduceProgram);
+
+    for(auto& entry : layerPrograms)
+        layerProgram(entry.first);
+
+    if(computeParallaxSupported()) {
+        parallaxCompositeProgram = finishProgram(pendingParallaxCompositeProgram);
+        computeParallax = layerProgram(LAYER_PROGRAM_PARALLAX_COMPUTE, 0).program && parallaxCompositeProgram;
+        voxelInsertProgram = finishProgram(pendingVoxelInsertProgram);
+        voxelSplatProgram = finishProgram(pendingVoxelSplatProgram);
+        sceneTraceProgram = finishProgram(pendingSceneTraceProgram);
+    }
 
-    // Setup Platform/Renderer backends
-    ImGui_ImplGlfw_InitForOpenGL(window, true);
-    ImGui_ImplOpenGL3_Init(glsl_version);
-    
-    // start app thread
-    reprojectionThread = std::thread(appThreadStarter, callback);
+    // samplers never change units, so they are set once here
+    struct { GLuint program; const char* name; GLint unit; } samplers[] = {
+        { cubeMapProgram, "tex", 0 },
+        { copyProgram, "tex", 0 },
+        { copyProgram, "tiles", 1 },
+        { tileClassifyProgram, "tex", 0 },
+        { temporalResolveProgram, "tex", 0 },
+        { temporalResolveProgram, "depthTex", 1 },
+        { temporalResolveProgram, "history", 2 },
+        { checkerboardResolveProgram, "tex", 0 },
+        { checkerboardResolveProgram, "depthTex", 1 },
+        { checkerboardResolveProgram, "history", 2 },
+        { multisampleResolveProgram, "tex", 0 },
+        { multisampleResolveProgram, "depthTex", 1 },
+        { multisampleResolveProgram, "velocityTex", 2 },
+        { multisampleResolveProgram, "materialTex", 3 },
+        { parallaxCompositeProgram, "reprojected", 0 },
+        { voxelInsertProgram, "tex", 0 },
+        { voxelInsertProgram, "hizTex", 1 },
+        { qualityCompareProgram, "reprojected", 0 },
+        { qualityCompareProgram, "groundTruth", 1 },
+        { qualityReduceProgram, "sumTex", 0 },
+    };
+    for(const auto& sampler : samplers) {
+        if(!sampler.program)
+            continue;
+        glState().useProgram(sampler.program);
+        glUniform1i(glGetUniformLocation(sampler.program, sampler.name), sampler.unit);
+    }
+    glState().useProgram(0);
 
-    originalKeyCallback = glfwSetKeyCallback(window, keyCallback);
-    originalFramebufferSizeCallback = glfwSetFramebufferSizeCallback(window, framebufferSizeCallback);
+    // programs besides the layer programs that read ReprojectionUniforms
+    for(GLuint program : { cubeMapProgram, copyProgram, parallaxCompositeProgram, sceneTraceProgram }) {
+        if(!program)
+            continue;
+        GLuint blockIndex = glGetUniformBlockIndex(program, "ReprojectionUniforms");
+        if(blockIndex != GL_INVALID_INDEX)
+            glUniformBlockBinding(program, blockIndex, REPROJECTION_UNIFORMS_BINDING);
+    }
 
-    setupGL();
+    cubeMapClipToLayerLoc = glGetUniformLocation(cubeMapProgram, "clipToLayer");
+    copyViewportLoc = glGetUniformLocation(copyProgram, "viewport");
+    copyDistortLoc = glGetUniformLocation(copyProgram, "distort");
+    copyAlphaMaskedLoc = glGetUniformLocation(copyProgram, "alphaMasked");
+    copyLayerRectLoc = glGetUniformLocation(copyProgram, "layerRect");
+    copyLayerClampLoc = glGetUniformLocation(copyProgram, "layerClamp");
+    copyTileCountLoc = glGetUniformLocation(copyProgram, "tileCount");
+    copyTileSizeLoc = glGetUniformLocation(copyProgram, "tileSize");
+    tileClassifyViewportLoc = glGetUniformLocation(tileClassifyProgram, "viewport");
+    tileClassifyTileSizeLoc = glGetUniformLocation(tileClassifyProgram, "tileSize");
+    temporalHasDepthLoc = glGetUniformLocation(temporalResolveProgram, "hasDepth");
+    temporalHistoryValidLoc = glGetUniformLocation(temporalResolveProgram, "historyValid");
+    temporalViewportLoc = glGetUniformLocation(temporalResolveProgram, "viewport");
+    temporalOutputSizeLoc = glGetUniformLocation(temporalResolveProgram, "outputSize");
+    temporalInverseViewProjectionLoc = glGetUniformLocation(temporalResolveProgram, "inverseViewProjection");
+    temporalHistoryViewProjectionLoc = glGetUniformLocation(temporalResolveProgram, "historyViewProjection");
+    temporalWeightLoc = glGetUniformLocation(temporalResolveProgram, "weight");
+    temporalLayerRectLoc = glGetUniformLocation(temporalResolveProgram, "layerRect");
+    temporalLayerClampLoc = glGetUniformLocation(temporalResolveProgram, "layerClamp");
+    temporalDepthMappingLoc = glGetUniformLocation(temporalResolveProgram, "depthMapping");
+    temporalDepthRangeLoc = glGetUniformLocation(temporalResolveProgram, "depthRange");
+    checkerboardHasDepthLoc = glGetUniformLocation(checkerboardResolveProgram, "hasDepth");
+    checkerboardHistoryValidLoc = glGetUniformLocation(checkerboardResolveProgram, "historyValid");
+    checkerboardViewportLoc = glGetUniformLocation(checkerboardResolveProgram, "viewport");
+    checkerboardInverseViewProjectionLoc = glGetUniformLocation(checkerboardResolveProgram, "inverseViewProjection");
+    checkerboardHistoryViewProjectionLoc = glGetUniformLocation(checkerboardResolveProgram, "historyViewProjection");
+    checkerboardParityLoc = glGetUniformLocation(checkerboardResolveProgram, "parity");
+    checkerboardDepthMappingLoc = glGetUniformLocation(checkerboardResolveProgram, "depthMapping");
+    checkerboardDepthRangeLoc = glGetUniformLocation(checkerboardResolveProgram, "depthRange");
+    multisampleSamplesLoc = glGetUniformLocation(multisampleResolveProgram, "samples");
+    multisampleHasDepthLoc = glGetUniformLocation(multisampleResolveProgram, "hasDepth");
+    multisampleHasVelocityLoc = glGetUniformLocation(multisampleResolveProgram, "hasVelocity");
+    multisampleHasMaterialLoc = glGetUniformLocation(multisampleResolveProgram, "hasMaterial");
+    multisampleEncodeSrgbLoc = glGetUniformLocation(multisampleResolveProgram, "encodeSrgb");
+    multisampleDepthMappingLoc = glGetUniformLocation(multisampleResolveProgram, "depthMapping");
+    multisampleDepthRangeLoc = glGetUniformLocation(multisampleResolveProgram, "depthRange");
+    qualityCompareSizeLoc = glGetUniformLocation(qualityCompareProgram, "size");
+    qualityReduceSourceSizeLoc = glGetUniformLocation(qualityReduceProgram, "sourceSize");
+    if(computeParallax)
+        parallaxCompositeViewportOriginLoc = glGetUniformLocation(parallaxCompositeProgram, "viewportOrigin");
+    voxelInsertVoxelSizeLoc = glGetUniformLocation(voxelInsertProgram, "voxelSize");
+    voxelInsertSubmissionLoc = glGetUniformLocation(voxelInsertProgram, "submission");
+    voxelInsertMaxAgeLoc = glGetUniformLocation(voxelInsertProgram, "maxAge");
+    voxelInsertLayerRectLoc = glGetUniformLocation(voxelInsertProgram, "layerRect");
+    voxelInsertLayerClampLoc = glGetUniformLocation(voxelInsertProgram, "layerClamp");
+    voxelInsertInverseViewProjectionLoc = glGetUniformLocation(voxelInsertProgram, "inverseViewProjection");
+    voxelInsertStrideLoc = glGetUniformLocation(voxelInsertProgram, "stride");
+    voxelSplatVoxelSizeLoc = glGetUniformLocation(voxelSplatProgram, "voxelSize");
+    voxelSplatSubmissionLoc = glGetUniformLocation(voxelSplatProgram, "submission");
+    voxelSplatMaxAgeLoc = glGetUniformLocation(voxelSplatProgram, "maxAge");
+    voxelSplatPassLoc = glGetUniformLocation(voxelSplatProgram, "splatPass");
+    voxelSplatViewProjectionLoc = glGetUniformLocation(voxelSplatProgram, "viewProjection");
+    voxelSplatSizeLoc = glGetUniformLocation(voxelSplatProgram, "size");
+    voxelSplatPixelScaleLoc = glGetUniformLocation(voxelSplatProgram, "pixelScale");
+    sceneTraceInverseViewProjectionLoc = glGetUniformLocation(sceneTraceProgram, "inverseViewProjection");
+
+    // one block shared by every layer program, bound for the whole run
+    glGenBuffers(1, &reprojectionUniformBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, reprojectionUniformBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(ReprojectionUniforms), nullptr, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, REPROJECTION_UNIFORMS_BINDING, reprojectionUniformBuffer);
+
+}
+
+/**
+ * Folds the CPU time of this refresh and the GPU time of the previous one
+ * into reprojectionCost. The estimate rises immediately on a slow refresh and
+ * decays slowly, so just-in-time scheduling errs on the side of waking early.
+ */
+static void updateReprojectionCost(double cpuCost) {
+    double gpuCost = 0;
+    if(timerQueriesSupported) {
+        // the query from the previous refresh is read, this one is in flight
+        reprojectionTimerIndex = 1 - reprojectionTimerIndex;
+        GLuint query = reprojectionTimerQueries[reprojectionTimerIndex];
+        GLint available = GL_FALSE;
+        if(reprojectionTimerStarted[reprojectionTimerIndex])
+            glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if(available) {
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+            gpuCost = elapsed * 1e-9;
+            reprojectionGpuTime = gpuCost;
+            updateQualityGovernor(gpuCost);
+
+            // the start timestamp was issued first, so it is available too
+            GLuint64 start = 0;
+            glGetQueryObjectui64v(reprojectionStartQueries[reprojectionTimerIndex], GL_QUERY_RESULT, &start);
+            GLint64 delay = (GLint64)start - reprojectionIssueTimes[reprojectionTimerIndex];
+            reprojectionGpuDelay = std::max(delay * 1e-9, 0.0);
+        }
+    }
+
+    double cost = cpuCost + gpuCost;
+    reprojectionCost = std::max(cost, reprojectionCost * 0.95 + cost * 0.05);
+}
+
+/**
+ * Tells yieldPoint that this refresh's draws are submitted, or that there
+ * are none, and when the next refresh is expected to start drawing
+ */
+static void publishReprojectionSubmit() {
+    const RefreshModel& refresh = refreshClock.model();
+    // the swap returns at the vblank this refresh is shown at, which is when
+    // an immediate schedule draws the next one
+    double next = refresh.nextVblank(glfwGetTime());
+    if(reprojectionSchedule == SCHEDULE_JUST_IN_TIME)
+        next += refresh.period - reprojectionCost - scheduleSafetyMargin;
+    else if(reprojectionSchedule == SCHEDULE_BEAM_RACING)
+        next -= beamRacingLead;
+    nextReprojectionDraw.store(next, std::memory_order_relaxed);
+    reprojectionSubmits.fetch_add(1, std::memory_order_release);
+}
+
+/**
+ * Whether this refresh can be skipped: idle detection is on or power is
+ * being saved, and nothing has changed for idleSettleRefreshes refreshes
+ */
+static bool refreshIdle(bool changed) {
+    if(changed) {
+        idleCountdown = idleSettleRefreshes;
+        return false;
+    }
+    if(idleCountdown > 0) {
+        idleCountdown--;
+        return false;
+    }
+    return idleDetection || powerSaving.load(std::memory_order_relaxed);
+}
+
+static bool samePose(const Pose& a, const Pose& b) {
+    return a.position == b.position && a.orientation == b.orientation
+        && std::memcmp(a.dataRaw, b.dataRaw, sizeof(a.dataRaw)) == 0;
+}
+
+/**
+ * Sets a layer camera's matrices from its pose and projection
+ */
+static void updateLayerCameraMatrices(LayerCamera& camera) {
+    glm::mat4 frameProjection = projectionMatrix(camera.projection);
+    camera.viewProjection = frameProjection * viewMatrix(camera.pose);
+    // inverse(frameProjection * view) is cameraMatrix * inverse(frameProjection)
+    camera.inverseViewProjection = cameraMatrix(camera.pose) * glm::inverse(frameProjection);
+}
+
+/**
+ * Moves the cameras of layers fixed in a reference space to where the space
+ * is at time. Returns true if any of them moved
+ */
+static bool moveReferenceSpaces(double time) {
+    bool moved = false;
+    for(size_t i = 0; i < layerCameras.size() && i < lastFrame->layers.size(); i++) {
+        LayerCamera& camera = layerCameras[i];
+        if(camera.referenceSpace < 0)
+            continue;
+        PoseSource* space = referenceSpaces[camera.referenceSpace].load(std::memory_order_acquire);
+        Pose spaceNow;
+        // without a pose the layer stays where the space last was
+        if(!space || !space->getPose(time, spaceNow))
+            continue;
+        Pose pose = camera.spacePose;
+        pose.position = spaceNow.position + spaceNow.orientation * camera.spacePose.position;
+        pose.orientation = spaceNow.orientation * camera.spacePose.orientation;
+        if(samePose(pose, camera.pose))
+            continue;
+        camera.pose = pose;
+        updateLayerCameraMatrices(camera);
+        moved = true;
+    }
+    return moved;
+}
+
+/**
+ * Moves the quality level one step down as soon as a refresh's GPU time is
+ * over budget, and one step up after a long run of refreshes with headroom
+ */
+static void updateQualityGovernor(double gpuTime) {
+    double budget = reprojectionBudget * refreshClock.model().period;
+    int level = qualityLevel;
+    if(budget <= 0) {
+        level = 0;
+    }
+    else if(governorSettle > 0) {
+        governorSettle--;
+    }
+    else if(gpuTime > budget) {
+        level = std::min(level + 1, qualityLevelCount - 1);
+        governorHeadroom = 0;
+    }
+    else if(gpuTime < budget * governorRaiseFraction) {
+        if(++governorHeadroom >= governorRaiseRefreshes) {
+            level = std::max(level - 1, 0);
+            governorHeadroom = 0;
+        }
+    }
+    else {
+        governorHeadroom = 0;
+    }
+
+    if(level != qualityLevel) {
+        qualityLevel = level;
+        quality = qualityLevels[level];
+        governorSettle = governorSettleRefreshes;
+        qualityChanges++;
+        startLayerPrograms();
+    }
+}
+
+/**
+ * Feeds the refresh fit with this refresh's present time and publishes it.
+ * latchTime is when the refresh latched the newest frame, swapEnd when
+ * glfwSwapBuffers returned. variable is set on variable refresh displays
+ */
+static void updateDisplayTiming(double latchTime, double swapEnd, bool variable) {
+    double vblankTime;
+    std::int64_t vblankCount;
+    bool presentFeedback = queryLastVblank(window, vblankTime, vblankCount);
+    if(!presentFeedback) {
+        // swaps are paced by vblank, so the end of one is the best guess
+        vblankTime = swapEnd;
+        vblankCount = -1;
+    }
+    if(variable)
+        refreshClock.addVariableSample(vblankTime);
+    else
+        refreshClock.addSample(vblankTime, vblankCount);
+    const RefreshModel& refresh = refreshClock.model();
+
+    // a swap that returned before its vblank reports the previous one
+    double presentTime = std::max(vblankTime, refresh.nextVblank(latchTime));
+    double latchLead = presentTime - latchTime;
+    // the refresh sampled its input when it latched
+    if(latencyMeasurement)
+        recordLatency(latchLead, presentFeedback);
+
+    std::lock_guard<std::mutex> lock(displayTimingMutex);
+    displayRefresh = refresh;
+    displayLatchLead = std::max(latchLead, displayLatchLead * 0.95 + latchLead * 0.05);
+}
+
+/**
+ * Draws the refresh into the front buffer in beamRacingSlices horizontal
+ * slices from the top of the window down. Each slice starts drawing
+ * beamRacingLead before the raster reaches it, with the camera pose
+ * predicted for the middle of its scanout, and is flushed so the GPU
+ * finishes it first. The whole refresh period is taken as scanout, so the
+ * blanking interval makes the slices a little early. Sets vblank to the
+ * one the refresh is scanned out from and returns the time spent waiting
+ * for the raster
+ */
+static double drawBeamRaced(bool latencyFlash, double& vblank) {
+    const RefreshModel& refresh = refreshClock.model();
+    int slices = beamRacingSlices.load(std::memory_order_relaxed);
+    double sliceTime = refresh.period / slices;
+    // a slice is drawn while the one above it scans out, or earlier when
+    // its share of the reprojection doesn't fit in that
+    beamRacingLead = std::max(sliceTime, reprojectionCost / slices + scheduleSafetyMargin);
+    vblank = refresh.nextVblank(glfwGetTime() + beamRacingLead);
+
+    int width, height;
+    getOutputSize(width, height);
+    Pose latched = cameraPose;
+    double waited = 0;
+    glState().bindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDrawBuffer(GL_FRONT);
+    for(int slice = 0; slice < slices; slice++) {
+        ARP_TRACE_INDEXED_SCOPE("beamRacedSlice", slice);
+        double scanout = vblank + slice * sliceTime;
+        double waitStart = glfwGetTime();
+        waitEventsUntil(scanout - beamRacingLead);
+        waited += glfwGetTime() - waitStart;
+
+        PoseQuery query = { scanout + sliceTime / 2 };
+        evaluatePoses(&query, &cameraPose, 1);
+        // the raster goes down, window rows go up
+        int top = height - height * slice / slices;
+        int bottom = height - height * (slice + 1) / slices;
+        glState().setEnabled(GL_SCISSOR_TEST, true);
+        glScissor(0, bottom, width, top - bottom);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+        if(frameValid)
+            drawViews();
+        drawOverlay();
+        drawCursor();
+        glState().setEnabled(GL_SCISSOR_TEST, false);
+        // the marker scissors its own corner, which the last slice covers
+        if(latencyMarker && slice == slices - 1)
+            drawLatencyMarker(latencyFlash);
+        glFlush();
+    }
+    glDrawBuffer(GL_BACK);
+    cameraPose = latched;
+    updateReprojectionUniforms();
+    return waited;
+}
+
+/**
+ * Feeds the refresh fit after a beam raced refresh, which has no swap to
+ * time, from the platform's vblank report. Each slice's pose is predicted
+ * for its scanout, so the latch lead is about the slices' lead
+ */
+static void updateBeamRacedTiming() {
+    double vblankTime;
+    std::int64_t vblankCount;
+    beamRacingVblankFeedback = queryLastVblank(window, vblankTime, vblankCount);
+    if(beamRacingVblankFeedback)
+        refreshClock.addSample(vblankTime, vblankCount);
+    const RefreshModel& refresh = refreshClock.model();
+
+    double latchLead = beamRacingLead + refresh.period / beamRacingSlices.load(std::memory_order_relaxed) / 2;
+    if(latencyMeasurement)
+        recordLatency(latchLead, beamRacingVblankFeedback);
+
+    std::lock_guard<std::mutex> lock(displayTimingMutex);
+    displayRefresh = refresh;
+    displayLatchLead = std::max(latchLead, displayLatchLead * 0.95 + latchLead * 0.05);
+}
+
+static void recordLatency(double latency, bool presentFeedback) {
+    int bin = (int)(std::max(latency, 0.0) / LatencyHistogram::BIN_WIDTH);
+    bin = std::min(bin, LatencyHistogram::BIN_COUNT - 1);
+
+    std::lock_guard<std::mutex> lock(latencyMutex);
+    latencyHistogram.bins[bin]++;
+    latencyHistogram.count++;
+    latencyHistogram.total += latency;
+    latencyHistogram.max = std::max(latencyHistogram.max, latency);
+    if(presentFeedback)
+        latencyHistogram.presentFeedbackCount++;
+}
+
+/**
+ * Fills the bottom left corner white or black for a photodiode, see
+ * setLatencyMeasurement
+ */
+static void drawLatencyMarker(bool flash) {
+    int width, height;
+    getOutputSize(width, height);
+    int size = std::max(std::min(width, height) / 12, 16);
+    float value = flash ? 1.f : 0.f;
+
+    glState().setEnabled(GL_SCISSOR_TEST, true);
+    glScissor(0, 0, size, size);
+    glClearColor(value, value, value, 1);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glClearColor(0, 0, 0, 0);
+    glState().setEnabled(GL_SCISSOR_TEST, false);
+}
+
+void setLatencyMeasurement(bool enabled, bool marker) {
+    latencyMeasurement = enabled;
+    latencyMarker = enabled && marker;
+}
+
+LatencyHistogram getLatencyHistogram() {
+    std::lock_guard<std::mutex> lock(latencyMutex);
+    return latencyHistogram;
+}
+
+void resetLatencyHistogram() {
+    std::lock_guard<std::mutex> lock(latencyMutex);
+    latencyHistogram = LatencyHistogram{};
+}
+
+void submitGroundTruth(Swapchain* swapchain, int swapchainIndex, const Pose& pose) {
+    GroundTruth truth;
+    truth.swapchain = swapchain;
+    truth.swapchainIndex = swapchainIndex;
+    truth.pose = pose;
+    truth.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // fences must be flushed before another context can wait on them
+    glFlush();
+
+    GroundTruth replaced;
+    {
+        std::lock_guard<std::mutex> lock(groundTruthMutex);
+        replaced = pendingGroundTruth;
+        pendingGroundTruth = truth;
+    }
+    if(replaced.swapchain) {
+        glDeleteSync(replaced.fence);
+        replaced.swapchain->releaseImage(replaced.swapchainIndex);
+    }
+}
+
+QualityStats getQualityStats() {
+    std::lock_guard<std::mutex> lock(qualityMutex);
+    return qualityStats;
+}
+
+void resetQualityStats() {
+    std::lock_guard<std::mutex> lock(qualityMutex);
+    qualityStats = QualityStats{};
+}
+
+/**
+ * (Re)allocates the ground truth target and the reduction chain for images
+ * of the given size
+ */
+static void resizeGroundTruthTargets(int width, int height) {
+    if(groundTruthFbo == 0) {
+        glGenFramebuffers(1, &groundTruthFbo);
+        glGenFramebuffers(1, &qualitySumFbo);
+        glGenTextures(1, &groundTruthColor);
+        glGenRenderbuffers(1, &groundTruthDepthStencil);
+        glGenTextures(1, &qualitySumTexture);
+        glGenBuffers(1, &qualityResultBuffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, qualityResultBuffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, 4 * sizeof(float), nullptr, GL_STREAM_READ);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+    groundTruthWidth = width;
+    groundTruthHeight = height;
+
+    glState().bindTexture(0, GL_TEXTURE_2D, groundTruthColor);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindRenderbuffer(GL_RENDERBUFFER, groundTruthDepthStencil);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glState().bindFramebuffer(GL_DRAW_FRAMEBUFFER, groundTruthFbo);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, groundTruthColor, 0);
+    glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER,
+                              groundTruthDepthStencil);
+
+    qualitySumWidth = (width + 7) / 8;
+    qualitySumHeight = (height + 7) / 8;
+    qualitySumLevels = 1;
+    while((std::max(qualitySumWidth, qualitySumHeight) >> qualitySumLevels) > 0)
+        qualitySumLevels++;
+    glState().bindTexture(0, GL_TEXTURE_2D, qualitySumTexture);
+    for(int level = 0; level < qualitySumLevels; level++) {
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA32F, std::max(1, qualitySumWidth >> level),
+                     std::max(1, qualitySumHeight >> level), 0, GL_RGBA, GL_FLOAT, nullptr);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+}
+
+/**
+ * Called by reprojection after the swap. Draws lastFrame for the pending
+ * ground truth's pose and starts comparing the two, reading the result back
+ * once the GPU is done so nothing waits for it
+ */
+static void compareGroundTruth() {
+    collectQualityResult();
+    if(qualityResultFence || !frameValid || !qualityCompareProgram || !qualityReduceProgram)
+        return;
+    GroundTruth truth;
+    {
+        std::lock_guard<std::mutex> lock(groundTruthMutex);
+        if(!pendingGroundTruth.swapchain)
+            return;
+        truth = pendingGroundTruth;
+        pendingGroundTruth = GroundTruth();
+    }
+    ARP_TRACE_GPU_SCOPE("compareGroundTruth");
+    glWaitSync(truth.fence, 0, GL_TIMEOUT_IGNORED);
+    glDeleteSync(truth.fence);
+    truth.fence = nullptr;
+
+    int width = truth.swapchain->getImageWidth(truth.swapchainIndex);
+    int height = truth.swapchain->getImageHeight(truth.swapchainIndex);
+    if(width != groundTruthWidth || height != groundTruthHeight)
+        resizeGroundTruthTargets(width, height);
+
+    GLint originalFramebuffer;
+    GLint originalViewport[4];
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &originalFramebuffer);
+    glGetIntegerv(GL_VIEWPORT, originalViewport);
+
+    // reprojection as it would have looked at the ground truth's pose
+    glState().bindFramebuffer(GL_DRAW_FRAMEBUFFER, groundTruthFbo);
+    glState().viewport(0, 0, width, height);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+    Pose shownPose = cameraPose;
+    cameraPose = truth.pose;
+    updateReprojectionUniforms();
+    drawLayers();
+    cameraPose = shownPose;
+    updateReprojectionUniforms();
+
+    // per block sums at level 0, then reduced like a depth pyramid
+    glState().bindFramebuffer(GL_DRAW_FRAMEBUFFER, qualitySumFbo);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, qualitySumTexture, 0);
+    glState().viewport(0, 0, qualitySumWidth, qualitySumHeight);
+    glState().useProgram(qualityCompareProgram);
+    glUniform2i(qualityCompareSizeLoc, width, height);
+    glState().bindTexture(1, GL_TEXTURE_2D, truth.swapchain->images[truth.swapchainIndex]);
+    glState().bindTexture(0, GL_TEXTURE_2D, groundTruthColor);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glState().useProgram(qualityReduceProgram);
+    glState().bindTexture(0, GL_TEXTURE_2D, qualitySumTexture);
+    for(int level = 1; level < qualitySumLevels; level++) {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, qualitySumTexture, level);
+        glState().viewport(0, 0, std::max(1, qualitySumWidth >> level), std::max(1, qualitySumHeight >> level));
+        glUniform2i(qualityReduceSourceSizeLoc, std::max(1, qualitySumWidth >> (level - 1)),
+                    std::max(1, qualitySumHeight >> (level - 1)));
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, qualitySumLevels - 1);
+
+    // the single texel left goes into a buffer, read once the fence passes
+    glState().bindFramebuffer(GL_READ_FRAMEBUFFER, qualitySumFbo);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, qualitySumTexture,
+                           qualitySumLevels - 1);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, qualityResultBuffer);
+    glReadPixels(0, 0, 1, 1, GL_RGBA, GL_FLOAT, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glState().bindFramebuffer(GL_READ_FRAMEBUFFER, originalFramebuffer);
+    qualityResultFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    qualityResultBlocks = qualitySumWidth * qualitySumHeight;
+    // the image is read until the fence passes
+    comparedGroundTruth = truth;
+
+    glState().bindFramebuffer(GL_DRAW_FRAMEBUFFER, originalFramebuffer);
+    glState().viewport(originalViewport[0], originalViewport[1], originalViewport[2], originalViewport[3]);
+}
+
+/**
+ * Adds the result of the comparison in flight to qualityStats once the GPU
+ * has finished it
+ */
+static void collectQualityResult() {
+    if(!qualityResultFence)
+        return;
+    if(glClientWaitSync(qualityResultFence, 0, 0) == GL_TIMEOUT_EXPIRED)
+        return;
+    glDeleteSync(qualityResultFence);
+    qualityResultFence = nullptr;
+    comparedGroundTruth.swapchain->releaseImage(comparedGroundTruth.swapchainIndex);
+    comparedGroundTruth = GroundTruth();
+
+    // squared error, SSIM, pixels off and pixels, see qualityCompareFragSrc
+    float sums[4];
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, qualityResultBuffer);
+    glGetBufferSubData(GL_PIXEL_PACK_BUFFER, 0, sizeof(sums), sums);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if(!(sums[3] > 0))
+        return;
+    double meanSquaredError = sums[0] / sums[3];
+    double psnr = meanSquaredError > 1e-10 ? std::min(-10.0 * std::log10(meanSquaredError), 100.0) : 100.0;
+
+    std::lock_guard<std::mutex> lock(qualityMutex);
+    qualityStats.minPsnr = qualityStats.count ? std::min(qualityStats.minPsnr, psnr) : psnr;
+    qualityStats.count++;
+    qualityStats.psnrTotal += psnr;
+    qualityStats.ssimTotal += sums[1] / qualityResultBlocks;
+    qualityStats.disocclusionTotal += sums[2] / sums[3];
+}
+
+double LatencyHistogram::percentile(double fraction) const {
+    if(count == 0)
+        return 0;
+    std::uint64_t target = std::max<std::uint64_t>((std::uint64_t)std::ceil(fraction * count), 1);
+    std::uint64_t seen = 0;
+    for(int i = 0; i < BIN_COUNT - 1; i++) {
+        seen += bins[i];
+        if(seen >= target)
+            return (i + 1) * BIN_WIDTH;
+    }
+    return max;
+}
+
+/**
+ * Marks the start of an application frame on its first acquireImage
+ */
+static void beginAppFrameTiming() {
+    if(appFrameStarted) {
+        return;
+    }
+    appFrameStarted = true;
+    appFrameStartTime = glfwGetTime();
+    appSwapchainWait = 0;
+    appYieldWait = 0;
+
+    // queries belong to the context they are made in, only use the app's
+    if(glfwGetCurrentContext() != hiddenWindow || !(GLEW_VERSION_3_3 || GLEW_ARB_timer_query)) {
+        return;
+    }
+    if(appTimestampQueries[0][0] == 0) {
+        glGenQueries(4, &appTimestampQueries[0][0]);
+    }
+    glQueryCounter(appTimestampQueries[appTimestampIndex][0], GL_TIMESTAMP);
+}
+
+/**
+ * Ends the application frame started by beginAppFrameTiming, called by
+ * submitFrame
+ */
+static void endAppFrameTiming() {
+    double frameTime = appFrameStarted ? glfwGetTime() - appFrameStartTime : 0;
+    double gpuTime = -1;
+
+    double gpuTail = -1;
+
+    if(appFrameStarted && appTimestampQueries[0][0] != 0 && glfwGetCurrentContext() == hiddenWindow) {
+        glQueryCounter(appTimestampQueries[appTimestampIndex][1], GL_TIMESTAMP);
+        // the GPU's clock once the commands so far have reached it, which
+        // is when the CPU is done with the frame
+        glGetInteger64v(GL_TIMESTAMP, &appSubmitGpuClock[appTimestampIndex]);
+        appTimestampStarted[appTimestampIndex] = true;
+
+        // read the previous frame's timestamps, this frame's are in flight
+        appTimestampIndex = 1 - appTimestampIndex;
+        GLint available = GL_FALSE;
+        if(appTimestampStarted[appTimestampIndex])
+            glGetQueryObjectiv(appTimestampQueries[appTimestampIndex][1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if(available) {
+            GLuint64 start = 0, end = 0;
+            glGetQueryObjectui64v(appTimestampQueries[appTimestampIndex][0], GL_QUERY_RESULT, &start);
+            glGetQueryObjectui64v(appTimestampQueries[appTimestampIndex][1], GL_QUERY_RESULT, &end);
+            gpuTime = (end - start) * 1e-9;
+            gpuTail = std::max((GLint64)end - appSubmitGpuClock[appTimestampIndex], (GLint64)0) * 1e-9;
+        }
+    }
+    appFrameStarted = false;
+    if(gpuTime >= 0) {
+        appGpuCost = gpuTime;
+        appGpuHistory.push(gpuTime);
+        appGpuTailHistory.push(gpuTail);
+    }
+    appFramePasses = appYieldPoints + 1;
+    appYieldPoints = 0;
+
+    double cost = frameTime + std::max(gpuTime, 0.0);
+    appFrameCost = std::max(cost, appFrameCost * 0.95 + cost * 0.05);
+    appCpuCost = std::max(frameTime, appCpuCost * 0.95 + frameTime * 0.05);
+
+    std::lock_guard<std::mutex> lock(frameStatsMutex);
+    frameStats.appFrameTime = frameTime;
+    if(gpuTime >= 0)
+        frameStats.appGpuTime = gpuTime;
+    frameStats.swapchainWaitTime = appSwapchainWait;
+    frameStats.yieldWaitTime = appYieldWait;
+    frameStats.yields = appYields;
+    frameStats.inFlightWaitTime = appInFlightWait;
+    frameStats.appGpuTimeEstimate = estimateAppGpuTime(appGpuHistory, 0);
+    frameStats.appGpuTailEstimate = estimateAppGpuTime(appGpuTailHistory, 0);
+    frameStats.submittedFrames++;
+    statsCounters.appFrames.fetch_add(1, std::memory_order_relaxed);
+    statsCounters.swapchainWaitMicros.fetch_add((std::uint64_t)(appSwapchainWait * 1e6), std::memory_order_relaxed);
+}
 
-    // absolute time value used for tracking frame time
-    double frameStartTime = glfwGetTime();
-    
-    ImVec4 clear_color = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
+void yieldPoint() {
+    if(glfwGetCurrentContext() != hiddenWindow)
+        return;
+    appYieldPoints++;
+
+    uint64_t submits = reprojectionSubmits.load(std::memory_order_acquire);
+    double drawTime = nextReprojectionDraw.load(std::memory_order_relaxed);
+    double passCost = appGpuCost / appFramePasses;
+    double now = glfwGetTime();
+    // the next pass is done before reprojection draws, or the estimate is
+    // stale because reprojection has stopped
+    if(now + passCost < drawTime || now > drawTime + yieldTimeout)
+        return;
 
-    while(!glfwWindowShouldClose(window)) {
-        ImGui_ImplOpenGL3_NewFrame();
-        ImGui_ImplGlfw_NewFrame();
-        ImGui::NewFrame();
+    ARP_TRACE_SCOPE("yieldPoint wait");
+    glFlush();
+    double deadline = drawTime + yieldTimeout;
+    while(reprojectionSubmits.load(std::memory_order_acquire) == submits && glfwGetTime() < deadline) {
+        std::this_thread::yield();
+    }
+    appYieldWait += glfwGetTime() - now;
+    appYields++;
+}
 
-        {
-            ImGui::Begin("Options");
+void setAppGpuTimePercentile(double percentile) {
+    appGpuPercentile = std::min(std::max(percentile, 0.0), 1.0);
+}
 
-            ImGui::Text("so many choices");
-            ImGui::Checkbox("Reprojection", &reprojectionToggle);
-            ImGui::Checkbox("Prediction", &predictionToggle);
-            ImGui::Checkbox("Background", &backgroundToggle);
-            ImGui::Checkbox("Parallax", &parallaxToggle);
-            
-            if (ImGui::Button("Freeze"))
-                freezeRendering = !freezeRendering;
+/**
+ * Returns the setAppGpuTimePercentile percentile of the times in history,
+ * or fallback before any were measured
+ */
+static double estimateAppGpuTime(const HistoryRing<double, appGpuHistorySize>& history, double fallback) {
+    double times[appGpuHistorySize];
+    int count = history.snapshot(times, appGpuHistorySize);
+    if(count == 0)
+        return fallback;
+    int rank = std::min((int)(appGpuPercentile.load(std::memory_order_relaxed) * count), count - 1);
+    std::nth_element(times, times + rank, times + count);
+    return times[rank];
+}
 
-            ImGui::SliderInt("target framerate", &targetFPS, 0, 240);
+void setFramesInFlight(int frames) {
+    framesInFlight = std::min(std::max(frames, 1), maxFramesInFlight);
+}
 
-            ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / io.Framerate, io.Framerate);
-            ImGui::End();
-        }
-        //ImGui::ShowDemoWindow(&showUI);
-        
-        if(cursorCaptured) {
-            glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-        }
-        else {
-            glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
-        }
+/**
+ * Deletes the fences of frames the GPU has finished, oldest first, then
+ * waits for the oldest ones until fewer than limit are left. Returns how
+ * many frames are still on the GPU
+ */
+static int retireAppFrameFences(int limit) {
+    int retired = 0;
+    while(retired < appFrameFenceCount) {
+        bool wait = appFrameFenceCount - retired >= limit;
+        GLuint64 timeout = wait ? (GLuint64)(inFlightTimeout * 1e9) : 0;
+        GLenum status = glClientWaitSync(appFrameFences[retired], GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+        if(status == GL_TIMEOUT_EXPIRED && !wait)
+            break;
+        if(status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED)
+            std::cout << "Warning: a frame in flight did not finish in time, no longer waiting for it" << std::endl;
+        glDeleteSync(appFrameFences[retired]);
+        retired++;
+    }
+    appFrameFenceCount -= retired;
+    std::copy(appFrameFences + retired, appFrameFences + retired + appFrameFenceCount, appFrameFences);
+    return appFrameFenceCount;
+}
 
-        double time = glfwGetTime();
-        double lastFrameDuration = time - frameStartTime;
-        frameStartTime = time;
-        {
-            std::lock_guard<std::mutex> keyTimesLock(keyTimesMutex);
-            std::lock_guard<std::mutex> posesLock(posesMutex);
-            for(int key : pressedKeys) {
-                keyTimes[key] += lastFrameDuration;
-            }
-        
+double waitForNextAppFrame(int framerate) {
+    // the app's transient data of the previous frame is done
+    transientArena().reset();
+    if(framerate <= 0)
+        framerate = pacedFramerate();
+    double period = 1.0 / framerate;
+
+    // the frame can start once fewer than framesInFlight are left on the GPU
+    int inFlight = framesInFlight.load(std::memory_order_relaxed);
+    int pending = 0;
+    appInFlightWait = 0;
+    if(glfwGetCurrentContext() == hiddenWindow) {
+        ARP_TRACE_SCOPE("waitForNextAppFrame in flight");
+        double waitStart = glfwGetTime();
+        pending = retireAppFrameFences(inFlight);
+        appInFlightWait = glfwGetTime() - waitStart;
+    }
 
-            // submitFrame sets last* variables
-            double mouseX, mouseY;
-            glfwGetCursorPos(window, &mouseX, &mouseY);
-            cameraPoseInfo.mouseX = mouseX;
-            cameraPoseInfo.mouseY = mouseY;
-            cameraPoseInfo.time = time;
+    RefreshModel refresh;
+    double latchLead;
+    {
+        std::lock_guard<std::mutex> lock(displayTimingMutex);
+        refresh = displayRefresh;
+        latchLead = displayLatchLead;
+    }
 
-            double dx = cameraPoseInfo.mouseX - lastFrame.poseInfo.mouseX;
-            double dy = cameraPoseInfo.mouseY - lastFrame.poseInfo.mouseY;
-            double dt = cameraPoseInfo.time   - lastFrame.poseInfo.time;
+    // the refresh that displays a frame latches it latchLead earlier, and
+    // the frame has to be rendered by then, which is the GPU's tail after
+    // the CPU is done. With more than one frame in flight the CPU work
+    // overlaps what is still queued on the GPU, and the frame's own GPU work
+    // starts once both are done. Before the GPU is measured, the smoothed
+    // frame cost stands in
+    double lead = appCpuCost + estimateAppGpuTime(appGpuTailHistory, appFrameCost - appCpuCost) + latchLead;
+    if(inFlight > 1) {
+        double gpuTime = estimateAppGpuTime(appGpuHistory, appGpuCost);
+        lead = std::max(appCpuCost, gpuTime * pending) + gpuTime + latchLead;
+    }
+    double now = glfwGetTime();
+    // a late frame starts right away instead of bursting to catch up
+    double target = std::max(pacerDisplayTime + period, now + lead);
+
+    // round up to a vblank. The tolerance keeps a target that is on the
+    // grid from slipping a whole refresh because of timer noise
+    target = refresh.nextVblank(target - refresh.period * 0.05);
+
+    pacerDisplayTime = target;
+    pacerPeriod = period;
+    sleepUntil(target - lead);
+    return target;
+}
 
-            if(!cursorCaptured) {
-                dx = 0;
-                dy = 0;
-            }
+/**
+ * Frames latched frames are kept with, the newest included: the length set
+ * with setFrameHistoryLength, or just the newest under memory pressure
+ */
+static int retainedHistoryLength() {
+    return gpuMemoryPressure.load(std::memory_order_relaxed) ? 1 : frameHistoryLength.load();
+}
 
-            cameraPose = poseFunction(lastFrame.poseInfo.realPose, dx, dy, dt, keyTimeFunction);
-            cameraPoseInfo.realPose = cameraPose;
-            
-            // orientationDifference: camera - lastFrame
+static std::int64_t pyramidBytes(const DepthPyramid& pyramid) {
+    std::int64_t bytes = 0;
+    for(int level = 0; level < pyramid.levels; level++)
+        bytes += textureBytes(GL_RG32F, std::max(1, pyramid.width >> level), std::max(1, pyramid.height >> level));
+    return pyramid.texture ? bytes : 0;
+}
 
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+static std::int64_t offscreenTargetBytes(const OffscreenTarget& target) {
+    return target.fbo ? textureBytes(GL_RGBA8, target.width, target.height)
+                            + textureBytes(GL_DEPTH24_STENCIL8, target.width, target.height)
+                      : 0;
+}
 
-            if(frameValid)
-                for(int i = lastFrame.layers.size() - 1; i >= 0; i--)
-                    drawLayer(lastFrame.layers[i]);
+/**
+ * Recounts what reprojection allocated itself, reads what the driver
+ * reports and decides whether memory is under pressure. Reprojection thread
+ * only, every gpuMemoryUpdateInterval
+ */
+static void updateGpuMemory(double time) {
+    if(time - lastGpuMemoryUpdate < gpuMemoryUpdateInterval)
+        return;
+    lastGpuMemoryUpdate = time;
+
+    std::int64_t pyramids = 0;
+    for(const DepthPyramid& pyramid : layerPyramids)
+        pyramids += pyramidBytes(pyramid);
+    std::int64_t history = 0;
+    for(const RetainedFrame& frame : retainedFrames) {
+        for(const DepthPyramid& pyramid : frame.pyramids)
+            history += pyramidBytes(pyramid);
+        for(const CompactColor& color : frame.colors) {
+            if(color.texture)
+                history += textureBytes(color.format, color.width, color.height);
         }
-        
-        ImGui::Render();
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+    }
+    for(const TemporalHistory& temporal : layerHistories) {
+        if(temporal.textures[0])
+            history += 2 * textureBytes(GL_RGBA16F, temporal.width, temporal.height);
+    }
+    std::int64_t reprojection = textureBytes(GL_RGBA8, overlayWidth, overlayHeight)
+                                + transientTextureBytes()
+                                + offscreenTargetBytes(headlessTarget);
+    if(voxelCacheBuffer)
+        reprojection += (std::int64_t)activeVoxelCache.capacity * 8 * sizeof(GLuint);
+    reprojection += sceneBvhBytes;
+    for(const OutputWindow& output : outputWindows)
+        reprojection += offscreenTargetBytes(output.target);
+    gpuMemoryBytes[GPU_MEMORY_DEPTH_PYRAMIDS] = pyramids;
+    gpuMemoryBytes[GPU_MEMORY_HISTORY] = history;
+    gpuMemoryBytes[GPU_MEMORY_REPROJECTION] = reprojection;
+
+    // both extensions report kilobytes
+    if(GLEW_NVX_gpu_memory_info) {
+        GLint total = 0, available = 0;
+        glGetIntegerv(GL_GPU_MEMORY_INFO_TOTAL_AVAILABLE_MEMORY_NVX, &total);
+        glGetIntegerv(GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX, &available);
+        gpuDeviceBytes = (std::int64_t)total * 1024;
+        gpuDeviceAvailableBytes = (std::int64_t)available * 1024;
+    }
+    else if(GLEW_ATI_meminfo) {
+        // total free, largest free block, and the same for shared memory
+        GLint free[4] = {};
+        glGetIntegerv(GL_TEXTURE_FREE_MEMORY_ATI, free);
+        gpuDeviceAvailableBytes = (std::int64_t)free[0] * 1024;
     }
 
-    glfwSetWindowShouldClose(hiddenWindow, GLFW_TRUE);
-
-    reprojectionThread.join();
+    GpuMemoryStats stats = getGpuMemoryStats();
+    statsCounters.trackedGpuBytes.store(stats.trackedBytes, std::memory_order_relaxed);
+    statsCounters.deviceAvailableBytes.store(stats.deviceAvailableBytes, std::memory_order_relaxed);
+    std::int64_t budget = gpuMemoryBudget;
+    std::int64_t minAvailable = gpuMinAvailable;
+    gpuMemoryPressure = (budget > 0 && stats.trackedBytes > budget)
+                        || (minAvailable > 0 && stats.deviceAvailableBytes >= 0
+                            && stats.deviceAvailableBytes < minAvailable);
+}
 
-    return 0;
+/**
+ * Reads the battery and thermal zones and decides whether to save power.
+ * Reprojection thread only, every PowerSettings::pollInterval or right
+ * after the settings change
+ */
+static void updatePowerState(double time) {
+    PowerSettings settings;
+    {
+        std::lock_guard<std::mutex> lock(powerMutex);
+        settings = powerSettings;
+    }
+    if(!powerSettingsChanged.exchange(false) && lastPowerUpdate >= 0
+       && time - lastPowerUpdate < settings.pollInterval)
+        return;
+    lastPowerUpdate = time;
+
+    // only the automatic mode has to look
+    PowerReading reading;
+    if(settings.mode == POWER_MODE_AUTO)
+        reading = readPowerState();
+
+    std::lock_guard<std::mutex> lock(powerMutex);
+    PowerState& state = powerState;
+    state.onBattery = reading.onBattery;
+    state.batteryPercent = reading.batteryPercent;
+    state.temperature = reading.temperature;
+    // the margin again on the way down, so a zone hovering at the margin
+    // doesn't flip the mode every poll
+    if(reading.tripHeadroom < 0)
+        state.hot = false;
+    else if(reading.tripHeadroom < settings.thermalMargin)
+        state.hot = true;
+    else if(reading.tripHeadroom > 2 * settings.thermalMargin)
+        state.hot = false;
+    state.saving = settings.mode == POWER_MODE_SAVING
+                   || (settings.mode == POWER_MODE_AUTO
+                       && (reading.onBattery || reading.batterySaver || state.hot));
+    state.backgroundScale = state.saving ? settings.backgroundScale : 1;
+    powerSavingFramerate = settings.savingFramerate;
+    powerSaving = state.saving;
 }
 
-int arp::getTargetFramerate()
-{
-    return targetFPS;
+void setPowerMode(const PowerSettings& settings) {
+    {
+        std::lock_guard<std::mutex> lock(powerMutex);
+        powerSettings = settings;
+        powerSettings.savingFramerate = std::max(settings.savingFramerate, 1);
+        powerSettings.backgroundScale = glm::clamp(settings.backgroundScale, 0.05f, 1.0f);
+        powerSettings.thermalMargin = std::max(settings.thermalMargin, 0.0);
+    }
+    powerSettingsChanged = true;
 }
 
-bool arp::getParallaxToggle()
-{
-    return parallaxToggle;
+PowerState getPowerState() {
+    PowerState state;
+    {
+        std::lock_guard<std::mutex> lock(powerMutex);
+        state = powerState;
+    }
+    state.recommendedFramerate = pacedFramerate();
+    return state;
 }
 
-bool arp::getPredictionToggle()
-{
-    return predictionToggle;
+void trackGpuMemory(GpuMemoryCategory category, std::int64_t bytes) {
+    if(category < 0 || category >= GPU_MEMORY_CATEGORY_COUNT)
+        return;
+    gpuMemoryBytes[category].fetch_add(bytes, std::memory_order_relaxed);
 }
 
-bool arp::getReprojectionToggle()
-{
-    return reprojectionToggle;
+GpuMemoryStats getGpuMemoryStats() {
+    GpuMemoryStats stats;
+    for(int i = 0; i < GPU_MEMORY_CATEGORY_COUNT; i++) {
+        stats.bytes[i] = gpuMemoryBytes[i].load(std::memory_order_relaxed);
+        stats.trackedBytes += stats.bytes[i];
+    }
+    stats.deviceBytes = gpuDeviceBytes;
+    stats.deviceAvailableBytes = gpuDeviceAvailableBytes;
+    stats.underPressure = gpuMemoryPressure;
+    return stats;
 }
 
-bool arp::getBackgroundToggle()
-{
-    return backgroundToggle;
+void setGpuMemoryBudget(std::int64_t budgetBytes, std::int64_t minAvailableBytes) {
+    gpuMemoryBudget = std::max<std::int64_t>(budgetBytes, 0);
+    gpuMinAvailable = std::max<std::int64_t>(minAvailableBytes, 0);
 }
 
-bool arp::getFrozen()
-{
-    return freezeRendering;
+FrameStats getFrameStats() {
+    std::lock_guard<std::mutex> lock(frameStatsMutex);
+    return frameStats;
 }
 
-static void drawLayer(const FrameLayer& layer) {
-    if((layer.flags & PARALLAX_ENABLED) && !(layer.flags & CAMERA_LOCKED) &&
-        lastFrame.pose.position != cameraPose.position) {
-        drawLayerParallaxEnabled(layer);
+/**
+ * Like sleepUntil, but handles window events while waiting, so the input
+ * callbacks see them as they arrive. With a render thread, the event thread
+ * handles them and this only sleeps
+ */
+static void waitEventsUntil(double time) {
+    if(renderThreadEnabled) {
+        sleepUntil(time);
         return;
     }
-    float fovY = layer.fov;
-    // TODO: allow layers with different aspect ratios
-    float yScale = projectionFar * tanf(fovY / 2.f);
-    float xScale = projectionAspect * yScale;
-
-    glm::mat4 scale = glm::scale(glm::mat4(1), glm::vec3(xScale, yScale, 1));
-    glm::mat4 farPlaneOffset = glm::translate(glm::mat4(1), glm::vec3(0, 0, -projectionFar));
-    glm::mat4 translation = glm::translate(glm::mat4(1), lastFrame.pose.position);
-    glm::mat4 rotation;
-    if(!(layer.flags & CAMERA_LOCKED)) {
-        rotation = glm::mat4(lastFrame.pose.orientation);
+    const double spinTime = 0.002;
+    double remaining;
+    while((remaining = time - glfwGetTime()) > spinTime) {
+        glfwWaitEventsTimeout(remaining - spinTime);
     }
-    else {
-        rotation = glm::mat4(cameraPose.orientation);
+    while(glfwGetTime() < time) {
+        std::this_thread::yield();
     }
+}
 
-    glm::mat4 model = translation * rotation * farPlaneOffset * scale;
+/**
+ * Returns whether the app has submitted a frame or a thread layer
+ * reprojection hasn't latched
+ */
+static bool submissionPending() {
+    if(frameMailbox.hasNew())
+        return true;
+    for(const Mailbox<FrameLayer>& mailbox : threadLayerMailboxes) {
+        if(mailbox.hasNew())
+            return true;
+    }
+    return false;
+}
 
-    glm::mat4 camera = glm::translate(glm::mat4(1), lastFrame.pose.position) * glm::mat4(cameraPose.orientation);
-    glm::mat4 view = glm::inverse(camera);
+/**
+ * Like waitEventsUntil, but returns as soon as the app has submitted a
+ * frame or thread layer reprojection hasn't latched. submitFrame and
+ * submitLayer wake the wait when variable refresh is enabled. A render
+ * thread checks for them every eventPumpInterval instead
+ */
+static void waitForFrameUntil(double time) {
+    double remaining;
+    while(!submissionPending() && (remaining = time - glfwGetTime()) > 0) {
+        if(renderThreadEnabled)
+            std::this_thread::sleep_for(std::chrono::duration<double>(std::min(remaining, eventPumpInterval)));
+        else
+            glfwWaitEventsTimeout(remaining);
+    }
+}
 
-    glUseProgram(defaultProgram);
+/**
+ * Sleeps until the given glfwGetTime() value. The OS sleep is only used for
+ * the bulk of the wait, the rest is spun to avoid timer granularity.
+ */
+static void sleepUntil(double time) {
+    const double spinTime = 0.002;
+    double remaining = time - glfwGetTime();
+    if(remaining > spinTime) {
+        std::this_thread::sleep_for(std::chrono::duration<double>(remaining - spinTime));
+    }
+    while(glfwGetTime() < time) {
+        std::this_thread::yield();
+    }
+}
 
-    // setup uniforms
-    GLuint modelLoc = glGetUniformLocation(defaultProgram, "model");
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, &model[0][0]);
-    GLuint viewLoc = glGetUniformLocation(defaultProgram, "view");
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, &view[0][0]);
-    GLuint projLoc = glGetUniformLocation(defaultProgram, "projection");
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, &projection[0][0]);
+static GLuint compileProgram(const char* vertShaderSrc, const char* fragShaderSrc) {
+    PendingProgram pending = startProgram(vertShaderSrc, fragShaderSrc);
+    return finishProgram(pending);
+}
 
-    // draw quad
-    GLuint texture = layer.swapchain->images[layer.swapchainIndex];
-    glBindTexture(GL_TEXTURE_2D, texture);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+void setShaderCacheDirectory(const char* path) {
+    shaderCacheDirectory = path ? path : "";
 }
 
-static void drawLayerParallaxEnabled(const FrameLayer& layer) {
-    // setup transformation matrices
-    float fovY = layer.fov;
-    float yScale = projectionFar * tanf(fovY / 2.f);
-    float xScale = projectionAspect * yScale;
+void setPipelineWarmUp(bool enabled) {
+    pipelineWarmUp = enabled;
+}
 
-    glm::mat4 scale = glm::scale(glm::mat4(1), glm::vec3(xScale, yScale, 1));
-    glm::mat4 farPlaneOffset = glm::translate(glm::mat4(1), glm::vec3(0, 0, -projectionFar));
-    glm::mat4 translation = glm::translate(glm::mat4(1), lastFrame.pose.position);
-    glm::mat4 rotation = glm::mat4(lastFrame.pose.orientation);
+/**
+ * Starts every internal program. With GL_KHR_parallel_shader_compile the
+ * driver compiles them on its own threads
+ */
+static void startShaderCompilation() {
+    if(GLEW_KHR_parallel_shader_compile)
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+
+    startLayerPrograms();
+    pendingCubeMapProgram = startProgram(cubeMapVertSrc, cubeMapFragSrc);
+    pendingCopyProgram = startProgram(copyVertSrc, copyFragSrc);
+    pendingTileClassifyProgram = startProgram(fullscreenVertSrc, tileClassifyFragSrc);
+    pendingHizCopyProgram = startProgram(fullscreenVertSrc, hizCopyFragSrc);
+    pendingHizReduceProgram = startProgram(fullscreenVertSrc, hizReduceFragSrc);
+    pendingTemporalResolveProgram = startProgram(fullscreenVertSrc, temporalResolveFragSrc);
+    pendingCheckerboardResolveProgram = startProgram(fullscreenVertSrc, checkerboardResolveFragSrc);
+    pendingMultisampleResolveProgram = startProgram(fullscreenVertSrc, multisampleResolveFragSrc);
+    pendingQualityCompareProgram = startProgram(fullscreenVertSrc, qualityCompareFragSrc);
+    pendingQualityReduceProgram = startProgram(fullscreenVertSrc, qualityReduceFragSrc);
+    if(computeParallaxSupported()) {
+        pendingParallaxCompositeProgram = startProgram(fullscreenVertSrc, parallaxCompositeFragSrc);
+        pendingVoxelInsertProgram = startComputeProgram(voxelInsertSrc);
+        pendingVoxelSplatProgram = startComputeProgram(voxelSplatSrc);
+        pendingSceneTraceProgram = startProgram(fullscreenVertSrc, sceneTraceFragSrc);
+    }
+}
 
-    glm::mat4 model = translation * rotation * farPlaneOffset * scale;
+static bool parallaxKind(LayerProgramKind kind) {
+    return kind == LAYER_PROGRAM_PARALLAX || kind == LAYER_PROGRAM_PARALLAX_COMPUTE;
+}
 
-    glm::mat4 camera = glm::translate(glm::mat4(1), cameraPose.position) * glm::mat4(cameraPose.orientation);
-    glm::mat4 view = glm::inverse(camera);
+/**
+ * Permutation of a layer's programs. Disocclusions can only be filled and
+ * the march only changed by parallax programs. Layers are only upsampled
+ * from their own image, with the depth pyramid of it
+ */
+static unsigned layerPermutation(const FrameLayer& layer, bool fillDisocclusions) {
+    unsigned permutation = 0;
+    if((layer.flags & MOTION_EXTRAPOLATION_ENABLED) && layer.swapchain->hasVelocity())
+        permutation |= PERMUTATION_MOTION_EXTRAPOLATION;
+    if(fillDisocclusions)
+        permutation |= PERMUTATION_FILL_DISOCCLUSIONS;
+    if(halfResolutionMarch)
+        permutation |= PERMUTATION_HALF_RESOLUTION_MARCH;
+    if(layer.flags & DEPTH_PEELED)
+        permutation |= PERMUTATION_DEPTH_PEELED;
+    if(layer.flags & ALPHA_MASKED)
+        permutation |= PERMUTATION_ALPHA_MASKED;
+    if(depthUpsampled(layer))
+        permutation |= PERMUTATION_DEPTH_UPSAMPLING;
+    if(reshaded(layer))
+        permutation |= PERMUTATION_RESHADING;
+    return permutation;
+}
 
-    glm::mat4 frameCamera = glm::translate(glm::mat4(1), lastFrame.pose.position) * glm::mat4(lastFrame.pose.orientation);
-    glm::mat4 frameView = glm::inverse(frameCamera);
-    glm::mat4 frameProjection = glm::perspective(projectionFovY, projectionAspect, projectionNear, projectionFar);
+/**
+ * Whether the layer is drawn with VIEW_DEPENDENT_RESHADING, which only
+ * parallax programs do
+ */
+static bool reshaded(const FrameLayer& layer) {
+    return (layer.flags & VIEW_DEPENDENT_RESHADING) && (layer.flags & PARALLAX_ENABLED)
+           && !(layer.flags & (CAMERA_LOCKED | TEMPORAL_ACCUMULATION_ENABLED | CHECKERBOARD_ENABLED))
+           && layer.swapchain->hasDepth() && layer.swapchain->hasMaterial() && !layer.swapchain->isCubeMap();
+}
 
-    // update uniforms
-    glUseProgram(parallaxProgram);
-
-    GLuint modelLoc = glGetUniformLocation(parallaxProgram, "model");
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, &model[0][0]);
-    GLuint viewLoc = glGetUniformLocation(parallaxProgram, "view");
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, &view[0][0]);
-    GLuint projectionLoc = glGetUniformLocation(parallaxProgram, "projection");
-    glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, &projection[0][0]);
-    GLuint cameraPosLoc = glGetUniformLocation(parallaxProgram, "cameraPos");
-    glUniform3fv(cameraPosLoc, 1, &cameraPose.position[0]);
-    GLuint frameViewLoc = glGetUniformLocation(parallaxProgram, "frameView");
-    glUniformMatrix4fv(frameViewLoc, 1, GL_FALSE, &frameView[0][0]);
-    GLuint frameProjectionLoc = glGetUniformLocation(parallaxProgram, "frameProjection");
-    glUniformMatrix4fv(frameProjectionLoc, 1, GL_FALSE, &frameProjection[0][0]);
-    GLuint texLoc = glGetUniformLocation(parallaxProgram, "tex");
-    glUniform1i(texLoc, 0);
-    GLuint depthTexLoc = glGetUniformLocation(parallaxProgram, "depthTex");
-    glUniform1i(depthTexLoc, 1);
-
-    // bind textures
-    GLuint tex = layer.swapchain->images[layer.swapchainIndex];
-    GLuint depthTex = layer.swapchain->depthImages[layer.swapchainIndex];
-
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, tex);
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, depthTex);
-    glActiveTexture(GL_TEXTURE0);
-
-    // draw
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+/**
+ * Whether the layer is drawn with DEPTH_AWARE_UPSAMPLING, which needs a
+ * depth pyramid of its own image
+ */
+static bool depthUpsampled(const FrameLayer& layer) {
+    return (layer.flags & DEPTH_AWARE_UPSAMPLING) && layer.swapchain->hasDepth() && !layer.swapchain->isCubeMap()
+           && !(layer.flags & (TEMPORAL_ACCUMULATION_ENABLED | CHECKERBOARD_ENABLED));
 }
 
-void submitFrame(const FrameSubmitInfo& submitInfo) {
-    glFlush();
+/**
+ * Parallax programs bake in a quality, the current one unless another is
+ * given, so a quality change keys new permutations. Grid warped layers are never upsampled
+ */
+static std::uint32_t layerProgramKey(LayerProgramKind kind, unsigned permutation,
+                                     const ReprojectionQuality& programQuality) {
+    unsigned shared = PERMUTATION_MOTION_EXTRAPOLATION | PERMUTATION_ALPHA_MASKED;
+    if(kind == LAYER_PROGRAM_DEFAULT)
+        shared |= PERMUTATION_DEPTH_UPSAMPLING;
+    // batched layers never extrapolate motion
+    if(kind == LAYER_PROGRAM_ATLAS)
+        shared = PERMUTATION_ALPHA_MASKED;
+    if(!parallaxKind(kind))
+        return kind | (permutation & shared) << 4;
+    return kind | permutation << 4 | programQuality.hizLevel << 12 | programQuality.parallaxIterations << 16;
+}
 
-    // keep cycling list of historySize last frames
-    poseHistory.push_back(submitInfo.poseInfo);
-    while(poseHistory.size() > historySize) {
-        poseHistory.pop_front();
-    }
+static std::uint32_t layerProgramKey(LayerProgramKind kind, unsigned permutation) {
+    return layerProgramKey(kind, permutation, quality);
+}
 
-    for(arp::FrameLayer& layer : lastFrame.layers) {
-        layer.swapchain->releaseImage(layer.swapchainIndex);
+/**
+ * Issues the compile of the permutation the key describes into program
+ */
+static void startLayerProgram(std::uint32_t key, LayerProgram& program) {
+    LayerProgramKind kind = (LayerProgramKind)(key & 0xF);
+    unsigned permutation = (key >> 4) & 0xFF;
+    std::string defines;
+    if(permutation & PERMUTATION_MOTION_EXTRAPOLATION)
+        defines += "#define MOTION_EXTRAPOLATION\n";
+    if(permutation & PERMUTATION_FILL_DISOCCLUSIONS)
+        defines += "#define FILL_DISOCCLUSIONS true\n";
+    if(permutation & PERMUTATION_HALF_RESOLUTION_MARCH)
+        defines += "#define HALF_RESOLUTION_MARCH\n";
+    if(permutation & PERMUTATION_DEPTH_PEELED)
+        defines += "#define DEPTH_PEELED true\n";
+    if(permutation & PERMUTATION_ALPHA_MASKED)
+        defines += "#define ALPHA_MASKED true\n";
+    if(permutation & PERMUTATION_DEPTH_UPSAMPLING)
+        defines += "#define DEPTH_UPSAMPLING\n";
+    if(permutation & PERMUTATION_RESHADING)
+        defines += "#define RESHADING\n";
+    if(parallaxKind(kind)) {
+        defines += "#define HIZ_MIN_LEVEL " + std::to_string((key >> 12) & 0xF) + "\n";
+        defines += "#define MAX_ITERATIONS " + std::to_string(key >> 16) + "\n";
     }
+    if(kind == LAYER_PROGRAM_ATLAS)
+        defines += "#define ATLAS_BATCH_SIZE " + std::to_string(MAX_FRAME_LAYERS) + "\n";
+
+    switch(kind) {
+    case LAYER_PROGRAM_DEFAULT:
+        program.pending = startProgram(homographyVertSrc, homographyFragSrc, defines);
+        break;
+    case LAYER_PROGRAM_PARALLAX:
+        program.pending = startProgram(parallaxVertSrc, parallaxFragSrc, defines);
+        break;
+    case LAYER_PROGRAM_PARALLAX_COMPUTE:
+        program.pending = startComputeProgram(parallaxComputeSrc, defines);
+        break;
+    case LAYER_PROGRAM_GRID_WARP:
+        program.pending = startProgram(gridWarpVertSrc, fragSrc, defines);
+        break;
+    case LAYER_PROGRAM_ATLAS:
+        program.pending = startProgram(atlasVertSrc, atlasFragSrc, defines);
+        break;
+    }
+}
 
-    {
-        std::lock_guard<std::mutex> posesLock(posesMutex);
-        lastFrame = submitInfo;
+/**
+ * Starts every permutation of the current quality and march that hasn't been
+ * started, so they compile in the background before a layer needs them.
+ * lazyPermutations are only started once a frame has needed them
+ */
+static void startLayerPrograms() {
+    unsigned march = halfResolutionMarch ? PERMUTATION_HALF_RESOLUTION_MARCH : 0;
+    for(LayerProgramKind kind : { LAYER_PROGRAM_DEFAULT, LAYER_PROGRAM_PARALLAX,
+                                  LAYER_PROGRAM_PARALLAX_COMPUTE, LAYER_PROGRAM_GRID_WARP, LAYER_PROGRAM_ATLAS }) {
+        if(kind == LAYER_PROGRAM_PARALLAX_COMPUTE && !computeParallaxSupported())
+            continue;
+        for(unsigned permutation = 0; permutation < layerPermutationCount; permutation++) {
+            if((permutation & PERMUTATION_HALF_RESOLUTION_MARCH) != march)
+                continue;
+            if(permutation & lazyPermutations & ~neededPermutations)
+                continue;
+            std::uint32_t key = layerProgramKey(kind, permutation);
+            if(layerPrograms.count(key))
+                continue;
+            startLayerProgram(key, layerPrograms[key]);
+        }
     }
+}
 
+/**
+ * With setPipelineWarmUp, draws every layer program of every quality level
+ * and march with images of each swapchain format not warmed up yet, then
+ * waits for the GPU so the driver's compiles all happen here. Lazy
+ * permutations are included, a warm-up is for the features not used yet
+ */
+static void warmUpPipeline() {
+    if(!pipelineWarmUp)
+        return;
+    std::vector<std::pair<SwapchainColorFormat, SwapchainDepthFormat>> formats;
     {
-        std::lock_guard<std::mutex> lock(keyTimesMutex);
-        keyTimes.clear();
+        std::lock_guard<std::mutex> lock(warmUpFormatsMutex);
+        formats.assign(warmUpFormats.begin() + warmedUpFormats, warmUpFormats.end());
+        warmedUpFormats = warmUpFormats.size();
+    }
+    if(formats.empty())
+        return;
+    ARP_TRACE_GPU_SCOPE("warmUpPipeline");
+    double start = glfwGetTime();
+
+    // all started before the first is finished, so they compile in parallel
+    std::vector<std::uint32_t> keys;
+    for(LayerProgramKind kind : { LAYER_PROGRAM_DEFAULT, LAYER_PROGRAM_PARALLAX,
+                                  LAYER_PROGRAM_PARALLAX_COMPUTE, LAYER_PROGRAM_GRID_WARP, LAYER_PROGRAM_ATLAS }) {
+        if(kind == LAYER_PROGRAM_PARALLAX_COMPUTE && !computeParallax)
+            continue;
+        for(const ReprojectionQuality& level : qualityLevels) {
+            for(unsigned permutation = 0; permutation < layerPermutationCount; permutation++) {
+                std::uint32_t key = layerProgramKey(kind, permutation, level);
+                if(std::find(keys.begin(), keys.end(), key) != keys.end())
+                    continue;
+                keys.push_back(key);
+                if(!layerPrograms.count(key))
+                    startLayerProgram(key, layerPrograms[key]);
+            }
+        }
     }
 
-    frameValid = true;
-}
+    GLint originalFramebuffer;
+    GLint originalViewport[4];
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &originalFramebuffer);
+    glGetIntegerv(GL_VIEWPORT, originalViewport);
+
+    // the inputs every layer program may read, contents don't matter
+    OffscreenTarget target;
+    createOffscreenTarget(target, warmUpSize, warmUpSize);
+    GLuint hiz, velocity, material;
+    glGenTextures(1, &hiz);
+    glState().bindTexture(1, GL_TEXTURE_2D, hiz);
+    allocateTexture({ GL_RG32F, GL_RG, GL_FLOAT }, GL_TEXTURE_2D, warmUpSize, warmUpSize);
+    glGenTextures(1, &velocity);
+    glState().bindTexture(2, GL_TEXTURE_2D, velocity);
+    allocateTexture(velocityFormats[VELOCITY_FORMAT_RG16F], GL_TEXTURE_2D, warmUpSize, warmUpSize);
+    glGenTextures(1, &material);
+    glState().bindTexture(3, GL_TEXTURE_2D, material);
+    allocateTexture(materialFormats[MATERIAL_FORMAT_RGBA8], GL_TEXTURE_2D, warmUpSize, warmUpSize);
+    GLuint reprojected = computeParallax ? acquireTransientTexture(GL_RGBA16F, warmUpSize, warmUpSize) : 0;
+
+    for(const auto& format : formats) {
+        GLuint color, depth = 0;
+        glGenTextures(1, &color);
+        glState().bindTexture(0, GL_TEXTURE_2D, color);
+        allocateTexture(colorFormats[format.first], GL_TEXTURE_2D, warmUpSize, warmUpSize);
+        // the depth is only read when the pyramid is built
+        if(format.second != DEPTH_FORMAT_NONE) {
+            glGenTextures(1, &depth);
+            glState().bindTexture(0, GL_TEXTURE_2D, depth);
+            allocateTexture(depthFormats[format.second], GL_TEXTURE_2D, warmUpSize, warmUpSize);
+            glState().bindFramebuffer(GL_DRAW_FRAMEBUFFER, pyramidBuilder.fbo);
+            glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, hiz, 0);
+            glState().viewport(0, 0, warmUpSize, warmUpSize);
+            glState().useProgram(pyramidBuilder.copyProgram);
+            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        }
 
-void getCameraPose(Pose& pose, PoseInfo& poseInfo) {
-    std::lock_guard<std::mutex> posesLock(posesMutex);
-    pose = cameraPose;
-    poseInfo = cameraPoseInfo;
-}
+        glState().bindFramebuffer(GL_DRAW_FRAMEBUFFER, target.fbo);
+        glState().viewport(0, 0, warmUpSize, warmUpSize);
+        glState().bindTexture(0, GL_TEXTURE_2D, color);
+        glState().bindTexture(1, GL_TEXTURE_2D, hiz);
+        glState().bindTexture(2, GL_TEXTURE_2D, velocity);
+        glState().bindTexture(3, GL_TEXTURE_2D, material);
+        glState().useProgram(copyProgram);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        for(std::uint32_t key : keys) {
+            const LayerProgram& program = layerProgram(key);
+            if(!program.program)
+                continue;
+            glState().useProgram(program.program);
+            if((key & 0xF) == LAYER_PROGRAM_PARALLAX_COMPUTE) {
+                glBindImageTexture(0, reprojected, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+                glDispatchCompute(1, 1, 1);
+            }
+            else {
+                drawLayerPlane();
+            }
+        }
 
-double getPredictedDisplayTime() {
-    if(poseHistory.size() < 2) {
-        // no way to guess if the history is empty, just return 60fps interval
-        return 1.0 / 60.0;
-    }
-
-    // calculate average interval over frame history
-    int numIntervals = poseHistory.size() - 1;
-    double lastTime = -1.0;
-    double intervalsTotal = 0;
-    for(const PoseInfo& poseInfo : poseHistory) {
-        if(lastTime == -1.0) {
-            lastTime = poseInfo.time;
-            continue;
+        glState().forgetTexture(color);
+        glDeleteTextures(1, &color);
+        if(depth) {
+            glState().forgetTexture(depth);
+            glDeleteTextures(1, &depth);
         }
+    }
 
-        intervalsTotal += poseInfo.time - lastTime;
-        lastTime = poseInfo.time;
+    if(reprojected)
+        releaseTransientTexture(reprojected);
+    for(GLuint texture : { hiz, velocity, material }) {
+        glState().forgetTexture(texture);
+        glDeleteTextures(1, &texture);
     }
-    return lastFrame.poseInfo.time + intervalsTotal / numIntervals;
+    deleteOffscreenTarget(target);
+    glState().bindFramebuffer(GL_DRAW_FRAMEBUFFER, originalFramebuffer);
+    glState().viewport(originalViewport[0], originalViewport[1], originalViewport[2], originalViewport[3]);
+    glFinish();
+
+    double elapsed = glfwGetTime() - start;
+    std::cout << "Pipeline warm-up: " << keys.size() << " programs with " << formats.size()
+              << " swapchain formats in " << elapsed * 1000 << " ms" << std::endl;
+    std::lock_guard<std::mutex> lock(frameStatsMutex);
+    frameStats.pipelineWarmUpTime += elapsed;
 }
 
-static std::mutex predictionMutex;
-static double predictedDt = 0;
-void getPredictedCameraPose(double time, Pose& pose, PoseInfo& poseInfo) {
-    std::lock_guard<std::mutex> posesLock(posesMutex);
-    poseInfo = cameraPoseInfo;
-    
-    // halving these differences to put prediction between last and next frame
-    double dt = time - glfwGetTime();
-    dt *= 0.5;
-
-    // assume the mouse will continue most recent movement
-    double dx = cameraPoseInfo.mouseX - lastFrame.poseInfo.mouseX;
-    double dy = cameraPoseInfo.mouseY - lastFrame.poseInfo.mouseY;
-    dx *= 0.5;
-    dy *= 0.5;
-
-    // unfortunately can't get away with doing this without a global variable
-    // so we set a global variable and lock this portion to make thread safe
-    std::lock_guard<std::mutex> lock(predictionMutex);
-    predictedDt = dt;
-
-    pose = poseFunction(cameraPose, dx, dy, dt, [](int key){
-        return pressedKeys.count(key) ? predictedDt : 0.0;
-    });
+/**
+ * Finishes the program and resolves its uniform locations. Samplers never
+ * change units, so they are set once here
+ */
+static void finishLayerProgram(LayerProgram& program) {
+    program.program = finishProgram(program.pending);
+    program.finished = true;
+    GLuint id = program.program;
+    if(!id)
+        return;
+
+    glState().useProgram(id);
+    struct { const char* name; GLint unit; } samplers[] = {
+        { "tex", 0 },
+        { "hizTex", 1 },
+        { "velocityTex", 2 },
+        { "materialTex", 3 },
+        { "reprojected", 0 },
+    };
+    for(const auto& sampler : samplers)
+        glUniform1i(glGetUniformLocation(id, sampler.name), sampler.unit);
+
+    GLuint blockIndex = glGetUniformBlockIndex(id, "ReprojectionUniforms");
+    if(blockIndex != GL_INVALID_INDEX)
+        glUniformBlockBinding(id, blockIndex, REPROJECTION_UNIFORMS_BINDING);
+
+    program.modelLoc = glGetUniformLocation(id, "model");
+    program.frameViewProjectionLoc = glGetUniformLocation(id, "frameViewProjection");
+    program.inverseFrameViewProjectionLoc = glGetUniformLocation(id, "inverseFrameViewProjection");
+    program.depthRangeLoc = glGetUniformLocation(id, "depthRange");
+    program.hizLevelsLoc = glGetUniformLocation(id, "hizLevels");
+    program.hizLevelLoc = glGetUniformLocation(id, "hizLevel");
+    program.motionTimeLoc = glGetUniformLocation(id, "motionTime");
+    program.inverseViewProjectionLoc = glGetUniformLocation(id, "inverseViewProjection");
+    program.farPlaneLoc = glGetUniformLocation(id, "farPlane");
+    program.viewportLoc = glGetUniformLocation(id, "viewport");
+    program.layerRectLoc = glGetUniformLocation(id, "layerRect");
+    program.layerClampLoc = glGetUniformLocation(id, "layerClamp");
+    program.velocityRectLoc = glGetUniformLocation(id, "velocityRect");
+    program.velocityClampLoc = glGetUniformLocation(id, "velocityClamp");
+    program.homographyLoc = glGetUniformLocation(id, "homography");
+    program.homographiesLoc = glGetUniformLocation(id, "homographies");
+    program.inverseHomographiesLoc = glGetUniformLocation(id, "inverseHomographies");
+    program.layerRectsLoc = glGetUniformLocation(id, "layerRects");
+    program.layerClampsLoc = glGetUniformLocation(id, "layerClamps");
+    program.lightPositionsLoc = glGetUniformLocation(id, "lightPositions");
+    program.lightColorsLoc = glGetUniformLocation(id, "lightColors");
+    program.lightCountLoc = glGetUniformLocation(id, "lightCount");
 }
 
-void shutdown() {
-    glfwSetWindowShouldClose(window, GLFW_TRUE);
-    reprojectionThread.join();
+static LayerProgram& layerProgram(std::uint32_t key) {
+    LayerProgram& program = layerPrograms[key];
+    if(!program.finished) {
+        if(!program.pending.program)
+            startLayerProgram(key, program);
+        finishLayerProgram(program);
+    }
+    return program;
 }
 
-static void appThreadStarter(ApplicationCallback callback) {
-    glfwMakeContextCurrent(hiddenWindow);
-    callback(hiddenWindow);
+/**
+ * Returns the layer program specialized for the permutation and the current
+ * quality, compiling it first if it wasn't started ahead
+ */
+static LayerProgram& layerProgram(LayerProgramKind kind, unsigned permutation) {
+    return layerProgram(layerProgramKey(kind, permutation));
+}
 
-    // application has finished at this point
-    glfwSetWindowShouldClose(window, GLFW_TRUE);
+/**
+ * What reprojectTexture draws with on one thread's context. Programs,
+ * framebuffers and vertex arrays of reprojection's context can't be used:
+ * the last two aren't shared, and uniforms set here would race its draws
+ */
+struct TextureReprojector {
+    bool ready = false;
+    PyramidBuilder builder;
+    DepthPyramid pyramid;
+    LayerProgram program;
+    GLuint vao = 0;
+    GLuint fbo = 0;
+    GLuint uniformBuffer = 0;
+};
+
+static thread_local TextureReprojector textureReprojector;
+
+void reprojectTexture(const TextureReprojectInfo& info) {
+    // the application's own GL calls went around this thread's cache
+    glState().invalidate();
+    TextureReprojector& reprojector = textureReprojector;
+    if(!reprojector.ready) {
+        reprojector.ready = true;
+        PendingProgram copy = startProgram(fullscreenVertSrc, hizCopyFragSrc);
+        PendingProgram reduce = startProgram(fullscreenVertSrc, hizReduceFragSrc);
+        // the best quality, without filling disocclusions
+        startLayerProgram(layerProgramKey(LAYER_PROGRAM_PARALLAX, 0, qualityLevels[0]), reprojector.program);
+        setUpPyramidBuilder(reprojector.builder, finishProgram(copy), finishProgram(reduce));
+        finishLayerProgram(reprojector.program);
+
+        glGenVertexArrays(1, &reprojector.vao);
+        glState().bindVertexArray(reprojector.vao);
+        glBindBuffer(GL_ARRAY_BUFFER, quadVbo);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (GLvoid*)0);
+        glGenFramebuffers(1, &reprojector.fbo);
+        glGenBuffers(1, &reprojector.uniformBuffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, reprojector.uniformBuffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(ReprojectionUniforms), nullptr, GL_DYNAMIC_DRAW);
+    }
+    if(!reprojector.builder.copyProgram || !reprojector.builder.reduceProgram || !reprojector.program.program)
+        return;
+
+    GLint originalFramebuffer, originalProgram, originalVertexArray;
+    GLint originalViewport[4];
+    GLint originalUniformBuffer, originalUniformStart, originalUniformSize;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &originalFramebuffer);
+    glGetIntegerv(GL_CURRENT_PROGRAM, &originalProgram);
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &originalVertexArray);
+    glGetIntegerv(GL_VIEWPORT, originalViewport);
+    glGetIntegeri_v(GL_UNIFORM_BUFFER_BINDING, REPROJECTION_UNIFORMS_BINDING, &originalUniformBuffer);
+    glGetIntegeri_v(GL_UNIFORM_BUFFER_START, REPROJECTION_UNIFORMS_BINDING, &originalUniformStart);
+    glGetIntegeri_v(GL_UNIFORM_BUFFER_SIZE, REPROJECTION_UNIFORMS_BINDING, &originalUniformSize);
+    GLboolean originalCapabilities[4];
+    const GLenum capabilities[4] = { GL_BLEND, GL_DEPTH_TEST, GL_STENCIL_TEST, GL_SCISSOR_TEST };
+    for(int i = 0; i < 4; i++) {
+        originalCapabilities[i] = glIsEnabled(capabilities[i]);
+        glState().setEnabled(capabilities[i], false);
+    }
+    glState().bindVertexArray(reprojector.vao);
+
+    // the pyramid is the application's memory, it lives on its context
+    DepthPyramid& pyramid = reprojector.pyramid;
+    if(pyramid.texture == 0 || pyramid.width != info.width || pyramid.height != info.height) {
+        std::int64_t previousBytes = pyramidBytes(pyramid);
+        allocateDepthPyramid(pyramid, info.width, info.height);
+        trackGpuMemory(GPU_MEMORY_APP, pyramidBytes(pyramid) - previousBytes);
+    }
+    const int origin[2] = { 0, 0 };
+    drawDepthPyramid(reprojector.builder, pyramid, info.sourceDepth, origin, -1, info.sourceProjection, nullptr, 0);
+
+    // a single view without fovea or lens
+    ReprojectionUniforms uniforms;
+    uniforms.view = viewMatrix(info.pose);
+    uniforms.projection = projectionMatrix(info.projection);
+    uniforms.cameraPos = glm::vec4(info.pose.position, 1);
+    uniforms.foveation = glm::vec4(0, 0, 1e9f, 2e9f);
+    uniforms.peripheralQuality = 1;
+    uniforms.viewportRect = glm::vec4(0, 0, info.destinationWidth, info.destinationHeight);
+    uniforms.lensDistortion = glm::vec4(0);
+    uniforms.chromaticAberration = glm::vec4(1, 1, 0, 0);
+    glBindBuffer(GL_UNIFORM_BUFFER, reprojector.uniformBuffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(uniforms), &uniforms);
+    glBindBufferBase(GL_UNIFORM_BUFFER, REPROJECTION_UNIFORMS_BINDING, reprojector.uniformBuffer);
+
+    glState().bindFramebuffer(GL_DRAW_FRAMEBUFFER, reprojector.fbo);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, info.destination, 0);
+    glState().viewport(0, 0, info.destinationWidth, info.destinationHeight);
+    glClearColor(0, 0, 0, 0);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    // as drawParallax, with the source's whole texture as the layer image
+    const LayerProgram& program = reprojector.program;
+    glm::mat4 model = cameraMatrix(info.sourcePose) * frustumPlane(info.sourceProjection,
+                                                                   info.sourceProjection.farPlane);
+    glm::mat4 viewProjection = projectionMatrix(info.sourceProjection) * viewMatrix(info.sourcePose);
+    glState().useProgram(program.program);
+    glUniformMatrix4fv(program.modelLoc, 1, GL_FALSE, &model[0][0]);
+    glUniformMatrix4fv(program.frameViewProjectionLoc, 1, GL_FALSE, &viewProjection[0][0]);
+    glUniform1i(program.hizLevelsLoc, pyramid.levels);
+    glUniform2f(program.depthRangeLoc, info.sourceProjection.nearPlane, info.sourceProjection.farPlane);
+    glUniform4f(program.layerRectLoc, 0, 0, 1, 1);
+    glUniform4f(program.layerClampLoc, 0.5f / info.width, 0.5f / info.height, 1 - 0.5f / info.width,
+                1 - 0.5f / info.height);
+    glUniform1f(program.motionTimeLoc, 0);
+    glState().bindTexture(0, GL_TEXTURE_2D, info.source);
+    glState().bindTexture(1, GL_TEXTURE_2D, pyramid.texture);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+
+    // put back what the application had, the cache forgets it all again
+    glBindBufferRange(GL_UNIFORM_BUFFER, REPROJECTION_UNIFORMS_BINDING, originalUniformBuffer, originalUniformStart,
+                      originalUniformSize);
+    if(!originalUniformSize)
+        glBindBufferBase(GL_UNIFORM_BUFFER, REPROJECTION_UNIFORMS_BINDING, originalUniformBuffer);
+    for(int i = 0; i < 4; i++)
+        glState().setEnabled(capabilities[i], originalCapabilities[i]);
+    glState().bindFramebuffer(GL_DRAW_FRAMEBUFFER, originalFramebuffer);
+    glState().viewport(originalViewport[0], originalViewport[1], originalViewport[2], originalViewport[3]);
+    glState().useProgram(originalProgram);
+    glState().bindVertexArray(originalVertexArray);
+    glState().invalidate();
 }
 
-static void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
-    if(action == GLFW_PRESS) {
-        pressedKeys.insert(key);
+/**
+ * What maskCoveredDepth draws with on one thread's context
+ */
+struct DepthMasker {
+    bool ready = false;
+    GLuint program = 0;
+    GLuint vao = 0;
+    GLint cornersLoc = -1;
+    GLint depthLoc = -1;
+};
+
+static thread_local DepthMasker depthMasker;
+
+void maskCoveredDepth(const Pose& layerPose, const LayerProjection& layerProjection, const Pose& coveringPose,
+                      const LayerProjection& covering) {
+    if(covering.left >= covering.right || covering.bottom >= covering.top)
+        return;
+    DepthMasker& masker = depthMasker;
+    if(!masker.ready) {
+        masker.ready = true;
+        PendingProgram pending = startProgram(depthMaskVertSrc, depthMaskFragSrc);
+        masker.program = finishProgram(pending);
+        masker.cornersLoc = glGetUniformLocation(masker.program, "corners");
+        masker.depthLoc = glGetUniformLocation(masker.program, "depth");
+        // the corners come from a uniform, but a vertex array has to be bound
+        glGenVertexArrays(1, &masker.vao);
     }
-    else if(action == GLFW_RELEASE) {
-        pressedKeys.erase(key);
+    if(!masker.program)
+        return;
+
+    // corner directions through the layer's projection, as points at
+    // infinity. Clip depth 0 keeps them from the far plane, the fragment
+    // shader writes the depth
+    glm::mat4 projection = projectionMatrix(layerProjection);
+    glm::quat toLayer = glm::conjugate(layerPose.orientation) * coveringPose.orientation;
+    glm::vec4 corners[4];
+    const float xs[4] = { covering.left, covering.right, covering.left, covering.right };
+    const float ys[4] = { covering.bottom, covering.bottom, covering.top, covering.top };
+    for(int i = 0; i < 4; i++) {
+        corners[i] = projection * glm::vec4(toLayer * glm::vec3(xs[i], ys[i], -1), 0);
+        corners[i].z = 0;
     }
 
-    if(originalKeyCallback)
-        originalKeyCallback(window, key, scancode, action, mods);
+    GLint originalProgram, originalVertexArray, originalDepthFunc;
+    GLboolean originalDepthMask, originalColorMask[4];
+    glGetIntegerv(GL_CURRENT_PROGRAM, &originalProgram);
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &originalVertexArray);
+    glGetIntegerv(GL_DEPTH_FUNC, &originalDepthFunc);
+    glGetBooleanv(GL_DEPTH_WRITEMASK, &originalDepthMask);
+    glGetBooleanv(GL_COLOR_WRITEMASK, originalColorMask);
+    bool depthTest = glIsEnabled(GL_DEPTH_TEST);
+
+    glState().setEnabled(GL_DEPTH_TEST, true);
+    glDepthFunc(GL_ALWAYS);
+    glDepthMask(GL_TRUE);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glState().useProgram(masker.program);
+    glUniform4fv(masker.cornersLoc, 4, &corners[0][0]);
+    glUniform1f(masker.depthLoc, layerProjection.depthMapping == DEPTH_REVERSED ? 1.f : 0.f);
+    glState().bindVertexArray(masker.vao);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+    glState().bindVertexArray(originalVertexArray);
+    glState().useProgram(originalProgram);
+    glColorMask(originalColorMask[0], originalColorMask[1], originalColorMask[2], originalColorMask[3]);
+    glDepthMask(originalDepthMask);
+    glDepthFunc(originalDepthFunc);
+    glState().setEnabled(GL_DEPTH_TEST, depthTest);
 }
 
-static void framebufferSizeCallback(GLFWwindow* window, int width, int height) {
-    glViewport(0, 0, width, height);
-    if(originalFramebufferSizeCallback) {
-        originalFramebufferSizeCallback(window, width, height);
-    }
+static bool computeParallaxSupported() {
+    return GLEW_VERSION_4_3;
 }
 
-static void setupGL() {
-    // create VAO
-    GLuint vao;
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
+static bool programBinariesSupported() {
+    if(!(GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary))
+        return false;
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+}
 
-    
-    float vertexData[] = {
-        -1, -1, 0, // bottom left
-        -1,  1, 0, // top left
-         1, -1, 0, // bottom right
-         1,  1, 0, // top right
+/**
+ * Binaries only load on the driver that made them, so the driver strings are
+ * part of the key along with the sources
+ */
+static std::string programCachePath(const char* vertShaderSrc, const char* fragShaderSrc,
+                                    const std::string& defines) {
+    const char* parts[] = {
+        vertShaderSrc, fragShaderSrc, defines.c_str(),
+        (const char*)glGetString(GL_VENDOR),
+        (const char*)glGetString(GL_RENDERER),
+        (const char*)glGetString(GL_VERSION),
     };
 
-    GLuint vbo;
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertexData), vertexData, GL_STATIC_DRAW);
-    
-    defaultProgram = compileProgram(vertSrc, fragSrc);
+    // FNV-1a, with a separator so moving text between parts changes the key
+    std::uint64_t hash = 14695981039346656037ull;
+    for(const char* part : parts) {
+        for(const char* c = part ? part : ""; *c; c++)
+            hash = (hash ^ (unsigned char)*c) * 1099511628211ull;
+        hash = (hash ^ 0xFF) * 1099511628211ull;
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)hash);
+    return (std::filesystem::path(shaderCacheDirectory) / name).string();
+}
+
+/**
+ * Loads a cached binary into program. The file holds the magic, the binary
+ * format and the binary
+ */
+static bool loadProgramBinary(GLuint program, const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if(!file)
+        return false;
+
+    char magic[sizeof(shaderCacheMagic)];
+    GLenum format;
+    file.read(magic, sizeof(magic));
+    file.read((char*)&format, sizeof(format));
+    if(!file || !std::equal(magic, magic + sizeof(magic), shaderCacheMagic))
+        return false;
+    std::vector<char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if(binary.empty())
+        return false;
+
+    glProgramBinary(program, format, binary.data(), binary.size());
+    return true;
+}
 
-    GLint posLoc = glGetAttribLocation(defaultProgram, "pos");
-    glEnableVertexAttribArray(posLoc);
-    glVertexAttribPointer(posLoc, 3, GL_FLOAT, GL_FALSE, 0, (GLvoid*)0);
+static void saveProgramBinary(GLuint program, const std::string& path) {
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if(length <= 0)
+        return;
 
-    parallaxProgram = compileProgram(parallaxVertSrc, parallaxFragSrc);
-    posLoc = glGetAttribLocation(parallaxProgram, "pos");
-    glEnableVertexAttribArray(posLoc);
-    glVertexAttribPointer(posLoc, 3, GL_FLOAT, GL_FALSE, 0, (GLvoid*)0);
+    std::vector<char> binary(length);
+    GLenum format;
+    glGetProgramBinary(program, length, &length, &format, binary.data());
 
+    std::error_code error;
+    std::filesystem::create_directories(shaderCacheDirectory, error);
+    // written under a temporary name so a crash never leaves half a binary
+    std::string temporaryPath = path + ".tmp";
+    {
+        std::ofstream file(temporaryPath, std::ios::binary);
+        file.write(shaderCacheMagic, sizeof(shaderCacheMagic));
+        file.write((const char*)&format, sizeof(format));
+        file.write(binary.data(), length);
+        if(!file) {
+            std::cout << "Error: could not write shader cache " << temporaryPath << std::endl;
+            return;
+        }
+    }
+    std::filesystem::rename(temporaryPath, path, error);
 }
 
-static GLuint compileProgram(const char* vertShaderSrc, const char* fragShaderSrc) {
-    GLuint program = glCreateProgram();
+static PendingProgram startProgram(const char* vertShaderSrc, const char* fragShaderSrc,
+                                   const std::string& defines) {
+    PendingProgram pending;
+    pending.vertShaderSrc = vertShaderSrc;
+    pending.fragShaderSrc = fragShaderSrc;
+    pending.defines = defines;
+    pending.program = glCreateProgram();
+
+    if(!shaderCacheDirectory.empty() && programBinariesSupported()) {
+        pending.cachePath = programCachePath(vertShaderSrc, fragShaderSrc, defines);
+        if(loadProgramBinary(pending.program, pending.cachePath)) {
+            pending.fromCache = true;
+            return pending;
+        }
+    }
+
+    buildFromSource(pending);
+    return pending;
+}
+
+static PendingProgram startComputeProgram(const char* computeShaderSrc, const std::string& defines) {
+    PendingProgram pending;
+    pending.computeShaderSrc = computeShaderSrc;
+    pending.defines = defines;
+    pending.program = glCreateProgram();
+
+    if(!shaderCacheDirectory.empty() && programBinariesSupported()) {
+        pending.cachePath = programCachePath(computeShaderSrc, nullptr, defines);
+        if(loadProgramBinary(pending.program, pending.cachePath)) {
+            pending.fromCache = true;
+            return pending;
+        }
+    }
+
+    buildFromSource(pending);
+    return pending;
+}
+
+/**
+ * Issues the compile and link of the pending program's sources
+ */
+static void buildFromSource(PendingProgram& pending) {
+    if(!pending.cachePath.empty())
+        glProgramParameteri(pending.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+    if(pending.computeShaderSrc) {
+        pending.computeShader = glCreateShader(GL_COMPUTE_SHADER);
+        compileShader(pending.computeShader, pending.computeShaderSrc, pending.defines);
+        glAttachShader(pending.program, pending.computeShader);
+        glLinkProgram(pending.program);
+        return;
+    }
+
+    pending.vertexShader = glCreateShader(GL_VERTEX_SHADER);
+    compileShader(pending.vertexShader, pending.vertShaderSrc, pending.defines);
 
-    GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-    compileShader(vertexShader, vertShaderSrc);
+    pending.fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+    compileShader(pending.fragmentShader, pending.fragShaderSrc, pending.defines);
 
-    GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    compileShader(fragmentShader, fragShaderSrc);
+    glAttachShader(pending.program, pending.vertexShader);
+    glAttachShader(pending.program, pending.fragmentShader);
+    glLinkProgram(pending.program);
+}
 
-    glAttachShader(program, vertexShader);
-    glAttachShader(program, fragmentShader);
-    glLinkProgram(program);
+/**
+ * Waits for the program to link and returns it, or 0 if it failed. A cached
+ * binary the driver rejects is rebuilt from source
+ */
+static GLuint finishProgram(PendingProgram& pending) {
+    GLuint program = pending.program;
 
     GLint isLinked = GL_FALSE;
     glGetProgramiv(program, GL_LINK_STATUS, &isLinked);
+    if(!isLinked && pending.fromCache) {
+        // rebuilt in a fresh program, then saved over the stale binary
+        glDeleteProgram(program);
+        pending.program = glCreateProgram();
+        pending.fromCache = false;
+        buildFromSource(pending);
+        return finishProgram(pending);
+    }
+
     if(!isLinked) {
+        for(GLuint shader : { pending.vertexShader, pending.fragmentShader, pending.computeShader }) {
+            if(shader)
+                printShaderLog(shader);
+        }
+
         GLint maxLength = 0;
         glGetProgramiv(program, GL_INFO_LOG_LENGTH, &maxLength);
 
-        std::vector<GLchar> infoLog(maxLength);
+        TransientScope scope;
+        TransientVector<GLchar> infoLog(maxLength + 1);
         glGetProgramInfoLog(program, maxLength, &maxLength, infoLog.data());
 
         std::cout << "Error: failed to link program" << std::endl;
         std::cout << infoLog.data() << std::endl;
         return 0;
     }
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
+    glDeleteShader(pending.vertexShader);
+    glDeleteShader(pending.fragmentShader);
+    glDeleteShader(pending.computeShader);
+
+    if(!pending.fromCache && !pending.cachePath.empty())
+        saveProgramBinary(program, pending.cachePath);
 
     return program;
 }
 
-static void compileShader(GLuint shader, const char* source) {
-    glShaderSource(shader, 1, &source, nullptr);
+/**
+ * Issues the compile, with defines inserted after the source's #version
+ * line. Errors are reported by finishProgram so the compile isn't waited on
+ * here
+ */
+static void compileShader(GLuint shader, const char* source, const std::string& defines) {
+    const char* body = std::strchr(source, '\n');
+    body = body ? body + 1 : source;
+    const char* parts[] = { source, defines.c_str(), body };
+    GLint lengths[] = { (GLint)(body - source), (GLint)defines.size(), -1 };
+    glShaderSource(shader, 3, parts, lengths);
     glCompileShader(shader);
+}
+
+static void printShaderLog(GLuint shader) {
     GLint isCompiled = GL_FALSE;
     glGetShaderiv(shader, GL_COMPILE_STATUS, &isCompiled);
     if(!isCompiled) {
         GLint maxLength = 0;
         glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &maxLength);
 
-        std::vector<GLchar> infoLog(maxLength);
+        TransientScope scope;
+        TransientVector<GLchar> infoLog(maxLength + 1);
         glGetShaderInfoLog(shader, maxLength, &maxLength, infoLog.data());
 
         std::cout << "Error: failed to compile shader" << std::endl;
@@ -761,7 +11510,7 @@ static void compileShader(GLuint shader, const char* source) {
 }
 
 static double keyTimeFunction(int key) {
-    return keyTimes[key];
+    return validKey(key) ? keyTimes[key].load(std::memory_order_relaxed) : 0.0;
 }
 
 };
@@ -5,33 +5,70 @@
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
+#include "arpgl.h"
 
 #include <unordered_map>
+#include <cstddef>
 #include <cstdint>
 #include <thread>
 #include <condition_variable>
 #include <mutex>
+#include <memory>
+#include <type_traits>
 #include <vector>
 
+// bytes of app data every Pose carries, a multiple of 8. Set for the library
+// and everything including arp.h alike, through the ARP_POSE_DATA_SIZE cmake
+// variable
+#ifndef ARP_POSE_DATA_SIZE
+#define ARP_POSE_DATA_SIZE 16
+#endif
+
+// matches the GL declaration so arp.h does not need to include GL headers
+typedef struct __GLsync* GLsync;
+
 namespace arp {
 
+static_assert(ARP_POSE_DATA_SIZE > 0 && ARP_POSE_DATA_SIZE % 8 == 0,
+              "ARP_POSE_DATA_SIZE must be a positive multiple of 8");
+
 /**
  * Represents the position and orientation of a camera
  *
- * If you would like to specify custom info to track with poses (such as pitch/
- * yaw), define a struct called PoseData that is less than 64 bytes in size and
- * define ARP_CUSTOM_POSE_DATA before including
+ * Custom info to track with poses (such as pitch/yaw) goes in the payload,
+ * ARP_POSE_DATA_SIZE bytes that arp copies along with the pose without
+ * looking at them. Read and write it as a trivially copyable struct with
+ * payload<T>(), which checks at compile time that it fits. Every pose is
+ * copied many times a refresh, into frames, histories and predictions, so
+ * the payload is best sized to the struct.
+ *
+ * Defining a struct called PoseData and ARP_CUSTOM_POSE_DATA before
+ * including still adds it as the member data, but changes Pose between
+ * translation units that don't define it, which payload<T>() doesn't
  */
 struct Pose {
     union {
-        unsigned char dataRaw[64];
+        alignas(8) unsigned char dataRaw[ARP_POSE_DATA_SIZE];
         #ifdef ARP_CUSTOM_POSE_DATA
-        static_assert(sizeof(PoseData) <= 64, "Custom PoseData must be smaller than 64 bytes");
+        static_assert(sizeof(PoseData) <= ARP_POSE_DATA_SIZE, "PoseData must fit in ARP_POSE_DATA_SIZE bytes");
         PoseData data;
         #endif
     };
     glm::vec3 position;
     glm::quat orientation;
+
+    template<typename T>
+    T& payload() {
+        static_assert(sizeof(T) <= ARP_POSE_DATA_SIZE, "the payload must fit in ARP_POSE_DATA_SIZE bytes");
+        static_assert(alignof(T) <= 8, "the payload must align to at most 8 bytes");
+        static_assert(std::is_trivially_copyable<T>::value, "the payload must be trivially copyable");
+        return *reinterpret_cast<T*>(dataRaw);
+    }
+
+    template<typename T>
+    const T& payload() const {
+        return const_cast<Pose*>(this)->payload<T>();
+    }
 };
 
 /**
@@ -47,38 +84,315 @@ struct PoseInfo {
     Pose realPose;
 };
 
+/**
+ * Internal format of a swapchain's color images
+ */
+enum SwapchainColorFormat {
+    COLOR_FORMAT_RGBA8 = 0,
+    // sampled by reprojection without decoding, so the encoded values reach
+    // the window unchanged
+    COLOR_FORMAT_SRGB8_ALPHA8 = 1,
+    COLOR_FORMAT_RGB10_A2 = 2,
+    COLOR_FORMAT_R11F_G11F_B10F = 3,
+    COLOR_FORMAT_RGBA16F = 4,
+};
+
+/**
+ * Internal format of a swapchain's depth images
+ */
+enum SwapchainDepthFormat {
+    // no depth attachment. Layers using this swapchain are reprojected by
+    // rotation only, whatever their flags
+    DEPTH_FORMAT_NONE = 0,
+    DEPTH_FORMAT_16 = 1,
+    DEPTH_FORMAT_24 = 2,
+    DEPTH_FORMAT_32F = 3,
+};
+
+/**
+ * Internal format of a swapchain's velocity images
+ */
+enum SwapchainVelocityFormat {
+    // no velocity attachment. MOTION_EXTRAPOLATION_ENABLED has no effect
+    VELOCITY_FORMAT_NONE = 0,
+    VELOCITY_FORMAT_RG16F = 1,
+    VELOCITY_FORMAT_RG32F = 2,
+};
+
+/**
+ * Format of a swapchain's material images, read by VIEW_DEPENDENT_RESHADING
+ * layers. Fragment output 2 of the app's shaders writes, all in [0, 1], the
+ * world space normal octahedral encoded and scaled to [0, 1] in rg, the
+ * roughness in b and the specular intensity in a, 0 where a surface has no
+ * view dependent term
+ */
+enum SwapchainMaterialFormat {
+    // no material attachment. VIEW_DEPENDENT_RESHADING has no effect
+    MATERIAL_FORMAT_NONE = 0,
+    MATERIAL_FORMAT_RGBA8 = 1,
+    MATERIAL_FORMAT_RGBA16F = 2,
+};
+
+/**
+ * How acquireImage picks the next image of a swapchain
+ */
+enum PresentMode {
+    // images are handed out strictly in order, so acquireImage waits while
+    // reprojection holds the next one. Throttles the app to reprojection
+    PRESENT_MODE_FIFO = 0,
+    // the least recently used free image is handed out. Frames reprojection
+    // never picked up are released by the next submitFrame, so with three or
+    // more images acquireImage never waits
+    PRESENT_MODE_MAILBOX = 1,
+};
+
+/**
+ * Kind of texture a swapchain's images are
+ */
+enum SwapchainImageType {
+    IMAGE_TYPE_2D = 0,
+    // six square faces of width x width texels, rendered one at a time with
+    // bindFramebuffer(index, face). Layers using this swapchain cover every
+    // direction and are reprojected by rotation only, whatever their flags
+    // and projection
+    IMAGE_TYPE_CUBE_MAP = 1,
+};
+
+struct SwapchainCreateInfo {
+    int width;
+    int height;
+    int numImages;
+    SwapchainColorFormat colorFormat = COLOR_FORMAT_RGBA8;
+    // only PARALLAX_ENABLED and GRID_WARP_ENABLED layers read depth, other
+    // layers only need it for depth testing while rendering
+    SwapchainDepthFormat depthFormat = DEPTH_FORMAT_24;
+    // second color attachment holding the motion of each pixel, read by
+    // MOTION_EXTRAPOLATION_ENABLED layers. Not available for cube maps
+    SwapchainVelocityFormat velocityFormat = VELOCITY_FORMAT_NONE;
+    // third color attachment holding the surface of each pixel, read by
+    // VIEW_DEPENDENT_RESHADING layers. Not available for cube maps
+    SwapchainMaterialFormat materialFormat = MATERIAL_FORMAT_NONE;
+    PresentMode presentMode = PRESENT_MODE_FIFO;
+    SwapchainImageType imageType = IMAGE_TYPE_2D;
+    // color images get a full mip chain, generated by reprojection once
+    // per submitted image, so layers shown smaller than they were rendered,
+    // like wide field of view backgrounds, are filtered from the level that
+    // fits. Costs a third more color memory. With a layer viewport the
+    // coarse levels blend in what lies outside it. Ignored when importing
+    bool mipmaps = false;
+    // samples per pixel of the images the app renders into. Above 1 they are
+    // multisampled, and reprojection resolves each submitted image into
+    // images, depthImages, velocityImages and materialImages, keeping each
+    // pixel's depth, velocity and material to the surface most of its
+    // samples see, so the app only
+    // renders into and reads the multisampled ones. Lowered to what
+    // the GL supports, ignored for cube maps and when importing. The remote
+    // server and submitGroundTruth read images before reprojection
+    // resolves them, so they need single sampled swapchains
+    int samples = 1;
+    // above 0 the swapchain keeps between this many images, at least 2, and
+    // numImages. It starts with the fewest and adds an image whenever
+    // acquireImage would otherwise wait, and frees one after a run of
+    // acquires that each found an image to spare, so the app runs with the
+    // shallowest queue that doesn't block it. Ignored when importing
+    int minImages = 0;
+    // cube maps only: color and depth are ARB_sparse_texture textures that
+    // start without memory, and only the pages commitRegions covers get
+    // any. Faces are rounded up to whole pages. Ignored without the
+    // extension, for mipmapped swapchains and when importing
+    bool sparse = false;
+};
+
+/**
+ * Rectangle of each face of a cube map image that needs rendering, in
+ * pixels from the face's bottom left corner as for glScissor. See
+ * getCubeMapRegions
+ */
+struct CubeMapRegions {
+    // x, y, width and height, all 0 for a face that isn't needed
+    int rects[6][4] = {};
+
+    bool isEmpty(int face) const { return rects[face][2] <= 0 || rects[face][3] <= 0; }
+
+    /**
+     * Grows each face's rectangle to also cover other's
+     */
+    void merge(const CubeMapRegions& other);
+
+    /**
+     * Whether each of other's rectangles lies within this one's
+     */
+    bool contains(const CubeMapRegions& other) const;
+};
+
+/**
+ * Textures the app already owns, wrapped as one image of a swapchain
+ */
+struct SwapchainImportedImage {
+    std::uint32_t color;
+    // 0 when the swapchain has no depth, velocity or material images
+    std::uint32_t depth = 0;
+    std::uint32_t velocity = 0;
+    std::uint32_t material = 0;
+};
+
+struct LayerProjection;
+
 /**
  * Texture swapchain that allows main thread to render while reprojection is
- * still accessing the last frame
+ * still accessing the last frame. Submitted frames refer to their swapchain
+ * by address, so it can be neither copied nor moved; hold it by pointer to
+ * pass it around
  */
 class Swapchain {
 private:
     int index;
+    // the images are the app's, see the importing constructor
+    bool imported = false;
+    // number of holders of each image: the app while it renders, and every
+    // submitted frame that references it. 0 means free
     std::vector<std::uint8_t> acquiredStatus;
-    std::vector<std::uint32_t> fbos;
+    std::vector<GLFramebuffer> fbos;
+
+    // size of each image, written only while the image is acquired
+    std::vector<int> imageWidths;
+    std::vector<int> imageHeights;
+    // resize epoch each image was allocated in
+    std::vector<std::uint64_t> imageEpochs;
+    // submission each image's mip chain was last generated for
+    std::vector<std::uint64_t> mipmapSubmissions;
+    // submission each multisampled image was last resolved for
+    std::vector<std::uint64_t> resolvedSubmissions;
+
+    // guarded by mutex
+    int pendingWidth;
+    int pendingHeight;
+    std::uint64_t epoch;
 
     std::condition_variable cond;
     std::mutex mutex;
 
-    void createTextures();
+    // pages of sparse images, 0 when the swapchain isn't sparse
+    int pageWidth = 0;
+    int pageHeight = 0;
+    // the depth images are sparse too, their format may not support it
+    bool sparseDepth = false;
+    // committed pages of each sparse image
+    std::vector<CubeMapRegions> committedRegions;
+
+    void createImage(int i, int imageWidth, int imageHeight);
+    void setUpImage(int i);
+    void deleteImage(int i);
+    std::int64_t imageBytes(int i) const;
+    // images in use, the first activeImages of the vectors, which are
+    // sized for numImages. Changed only by acquire
+    int activeImages;
+    // see SwapchainCreateInfo::minImages, numImages when not adapting
+    int minImages;
+    // acquires in a row that left another image free
+    int spareAcquires = 0;
+
+    int nextFreeImage() const;
+    int acquire(bool wait, double timeout);
 
 public:
+    // size of the image last returned by acquireImage. Only the application
+    // thread should read these
     int width;
     int height;
+    // the most images, see getImageCount for how many are allocated
     int numImages;
+    SwapchainColorFormat colorFormat;
+    SwapchainDepthFormat depthFormat;
+    SwapchainVelocityFormat velocityFormat;
+    SwapchainMaterialFormat materialFormat;
+    PresentMode presentMode;
+    SwapchainImageType imageType;
+    // color images have mip chains, see SwapchainCreateInfo::mipmaps
+    bool mipmapped;
+    // see SwapchainCreateInfo::samples
+    int samples;
+    // color images are sparse, see SwapchainCreateInfo::sparse
+    bool sparse;
     std::vector<std::uint32_t> images;
+    // empty when depthFormat is DEPTH_FORMAT_NONE
     std::vector<std::uint32_t> depthImages;
+    // empty when velocityFormat is VELOCITY_FORMAT_NONE
+    std::vector<std::uint32_t> velocityImages;
+    // empty when materialFormat is MATERIAL_FORMAT_NONE
+    std::vector<std::uint32_t> materialImages;
+    // GL_TEXTURE_2D_MULTISAMPLE textures the framebuffers draw into, resolved
+    // into the images above by reprojection. Empty when samples is 1
+    std::vector<std::uint32_t> multisampleImages;
+    std::vector<std::uint32_t> multisampleDepthImages;
+    std::vector<std::uint32_t> multisampleVelocityImages;
+    std::vector<std::uint32_t> multisampleMaterialImages;
 
+    Swapchain(const SwapchainCreateInfo& createInfo);
+    // RGBA8 color with 24 bit depth
     Swapchain(int width, int height, int numImages);
+
+    /**
+     * Wraps textures the app already renders into as the swapchain's
+     * images, so reprojection samples them directly instead of the app
+     * copying them into images of arp's. importedImages holds numImages
+     * entries, whose textures must have the type, size and formats of
+     * createInfo and a single level. Textures imported from another API's
+     * memory with GL_EXT_memory_object work the same, as long as the app
+     * waits on that API's semaphore with glWaitSemaphoreEXT before
+     * submitFrame, whose fence then covers it.
+     *
+     * The app still only renders into an image after acquireImage returns
+     * it. The textures' filtering, wrapping and depth comparison are set to
+     * what reprojection samples with, and they are never deleted by arp, so
+     * the app deletes them after the swapchain. Imported swapchains can't be
+     * resized, make a new one instead
+     */
+    Swapchain(const SwapchainCreateInfo& createInfo, const SwapchainImportedImage* importedImages);
     ~Swapchain();
+    Swapchain(const Swapchain&) = delete;
+    Swapchain& operator=(const Swapchain&) = delete;
+
+    bool hasDepth() const { return depthFormat != DEPTH_FORMAT_NONE; }
+    bool hasVelocity() const { return velocityFormat != VELOCITY_FORMAT_NONE; }
+    bool hasMaterial() const { return materialFormat != MATERIAL_FORMAT_NONE; }
+    bool isCubeMap() const { return imageType == IMAGE_TYPE_CUBE_MAP; }
+    bool isImported() const { return imported; }
 
     /**
      * Use this method to reserve an image on the swapchain for rendering.
      * Do not use an image in this swapchain without calling this first.
-     * This method will block if there are no images available.
+     * This method will block if there are no images available. An image
+     * older than the last resize is reallocated at the new size here, and
+     * width and height are set to the returned image's size.
      */
     int acquireImage();
 
+    /**
+     * Same as acquireImage, but waits at most timeout seconds. Returns -1 if
+     * no image became available in time
+     */
+    int acquireImage(double timeout);
+
+    /**
+     * Same as acquireImage, but returns -1 instead of waiting
+     */
+    int tryAcquireImage();
+
+    /**
+     * Size of the image of the given index. After a resize, images keep
+     * their old size until they are acquired again
+     */
+    int getImageWidth(int index) const { return imageWidths[index]; }
+    int getImageHeight(int index) const { return imageHeights[index]; }
+
+    /**
+     * Number of images allocated, numImages unless SwapchainCreateInfo::
+     * minImages let the swapchain shrink. Indices returned by acquireImage
+     * are below it. Only the application thread should call this
+     */
+    int getImageCount() const { return activeImages; }
+
     /**
      * This method binds the framebuffer to draw on the image of the specified
      * index and sets the glViewport accordingly
@@ -86,120 +400,1820 @@ public:
     void bindFramebuffer(int index);
 
     /**
-     * Resizes the texture images in the swapchain
+     * Binds the framebuffer to draw on one face of a cube map image. Faces
+     * are numbered in GL_TEXTURE_CUBE_MAP_POSITIVE_X order, render each
+     * with the orientation from cubeMapFaceOrientation
+     */
+    void bindFramebuffer(int index, int face);
+
+    /**
+     * Commits the pages of an acquired image that regions covers and
+     * frees the rest, so a sparse cube map only holds memory for what the
+     * view can reach. regions is rounded out to whole pages, which are the
+     * rectangles to scissor rendering to. The other pages read as black
+     * until committed and rendered again. Does nothing when the swapchain
+     * isn't sparse, so the app can still scissor to regions
+     */
+    void commitRegions(int index, CubeMapRegions& regions);
+
+    /**
+     * Resizes the texture images in the swapchain. Only the new size is
+     * recorded here, so this makes no GL calls and can be called from any
+     * thread. Each image is replaced by a new texture of the new size the
+     * next time acquireImage hands it out, while reprojection keeps using
+     * the images it holds at their old size. Does nothing for imported
+     * swapchains
      */
     void resize(int width, int height);
 
     /**
-     * Used by reprojection when it is finished with an image.
+     * Adds a holder to an acquired image. Used by submitFrame for every
+     * frame that references the image, so a layer kept by later frames
+     * outlives the frame it was submitted with.
+     * The application should NOT use this, it will be done automatically.
+     */
+    void retainImage(int index);
+
+    /**
+     * Used by reprojection when it is finished with an image. Reprojection
+     * releases an image as soon as it has moved on to a newer frame.
      * The application should NOT use this, it will be done automatically.
      */
     void releaseImage(int index);
+
+    /**
+     * Bytes of GPU memory an image's textures take
+     */
+    std::int64_t getImageBytes(int index) const { return imageBytes(index); }
+
+    /**
+     * Used by reprojection to generate the mip chain of a mipmapped image
+     * the first time it sees the submission using it.
+     * The application should NOT use this, it will be done automatically.
+     */
+    void generateMipmaps(int index, std::uint64_t submission);
+
+    /**
+     * Used by reprojection to resolve a multisampled image into images,
+     * depthImages and velocityImages the first time it sees the submission
+     * using it. projection is the one the image was rendered with.
+     * The application should NOT use this, it will be done automatically.
+     */
+    void resolveSamples(int index, std::uint64_t submission, const LayerProjection& projection);
 };
 
 enum FrameLayerFlags : std::uint32_t {
     NONE = 0,
-    // Changes in position are approximated by parallax mapping
+    // Changes in position are approximated by parallax mapping. Pixels
+    // revealed from behind foreground edges are left to the layers below
     PARALLAX_ENABLED = 1 << 0,
     // Layer is not reprojected, always drawn in screen space
     CAMERA_LOCKED = 1 << 1,
+    // Changes in position are approximated by warping a grid mesh through
+    // the layer's depth. Cheaper than PARALLAX_ENABLED, takes precedence
+    GRID_WARP_ENABLED = 1 << 2,
+    // Layer is not rendered this frame. Reprojection keeps drawing the image
+    // last submitted at this layer index, from the pose it was rendered
+    // with. All other fields are ignored
+    KEEP_PREVIOUS_IMAGE = 1 << 3,
+    // Moving objects are extrapolated from the layer's time to the time of
+    // each refresh with the swapchain's velocity images, on top of the
+    // camera reprojection. Layers whose swapchain has no velocity images
+    // are drawn as if this was not set
+    MOTION_EXTRAPOLATION_ENABLED = 1 << 4,
+    // Each submitted image is blended into a history at the size of the
+    // layer's whole swapchain image, which reprojection draws in its place.
+    // Rendered at a lower resolution into the layer's viewport with the
+    // offsets of getJitterOffset, the history gathers more detail than a
+    // single frame has. Ignored for cube map layers
+    TEMPORAL_ACCUMULATION_ENABLED = 1 << 5,
+    // The application only rendered half the pixels of the layer's
+    // viewport, in a checkerboard of 2x2 quads that flips with every
+    // submitted frame, see getCheckerboardParity. The other half is filled from the previous
+    // frame, reprojected through the layer's depth, so every pixel is at
+    // most a frame old. Takes precedence over TEMPORAL_ACCUMULATION_ENABLED.
+    // Ignored for cube map layers
+    CHECKERBOARD_ENABLED = 1 << 6,
+    // The layer holds the surfaces right behind those of the layer before
+    // it, as rendered by depth peeling with the same pose, projection and
+    // viewport, with the far depth where nothing is behind. Where parallax
+    // reveals what the layer in front has no pixels for, its march
+    // continues in this layer, and where this one has nothing either, in
+    // the layers below. Several layers in a row peel one surface deeper
+    // each. Needs PARALLAX_ENABLED and a swapchain with depth, and is only
+    // drawn when the camera has moved since the layer was rendered
+    DEPTH_PEELED = 1 << 7,
+    // Pixels with alpha under half are left to the layers below, so a layer
+    // cleared to alpha 0 only covers what was drawn into it, e.g. the near
+    // layer of a DepthSplit. Ignored for cube map layers
+    ALPHA_MASKED = 1 << 8,
+    // The layer's image comes from submitLayer on another thread.
+    // Reprojection draws the newest image submitted at this layer index, or
+    // leaves the layer out until there is one. All other fields are ignored
+    SUBMITTED_BY_THREAD = 1 << 9,
+    // The layer is rendered at a lower resolution than it is shown at, like
+    // half or a quarter. Instead of filtering it bilinearly, which blends
+    // foreground and background into halos around edges, reprojection
+    // weights the texels around each pixel by how close their depth is to
+    // the surface the pixel shows, as parallax finds it along the pixel's
+    // ray or else as the nearest texel has it. Needs a swapchain with depth.
+    // Ignored for cube map and grid warped layers and with
+    // TEMPORAL_ACCUMULATION_ENABLED or CHECKERBOARD_ENABLED
+    DEPTH_AWARE_UPSAMPLING = 1 << 10,
+    // The layer's color holds only the view independent part of its
+    // shading, like diffuse and ambient light. Reprojection adds the
+    // specular term of the lights set with setReshadingLights for each
+    // refresh's camera position, from the surfaces in the swapchain's
+    // material images, so highlights stay where they belong between frames
+    // of a slow app. Needs PARALLAX_ENABLED and a swapchain with depth and
+    // material images. Ignored for camera locked and cube map layers and
+    // with TEMPORAL_ACCUMULATION_ENABLED or CHECKERBOARD_ENABLED, where the
+    // color should include the specular term as usual
+    VIEW_DEPENDENT_RESHADING = 1 << 11,
+    // The layer is mostly empty, like a HUD, and ALPHA_MASKED. Each new
+    // image is classified into tiles of LAYER_TILE_SIZE pixels on the GPU,
+    // and where the layer passes through without reprojection, as camera
+    // locked layers do, only the tiles with something drawn are drawn.
+    // Ignored without ALPHA_MASKED, for cube map layers and with
+    // TEMPORAL_ACCUMULATION_ENABLED or CHECKERBOARD_ENABLED
+    SPARSE_TILES = 1 << 12,
+};
+
+/**
+ * Size in pixels of the square tiles of SPARSE_TILES layers
+ */
+const int LAYER_TILE_SIZE = 32;
+
+/**
+ * How a layer's depth image maps to distance from the camera
+ */
+enum DepthMapping {
+    // OpenGL's default, 0 at the near plane and 1 at the far plane
+    DEPTH_STANDARD = 0,
+    // 1 at the near plane and 0 at the far plane, as rendered with
+    // glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE) and LayerProjection::matrix.
+    // With DEPTH_FORMAT_32F this keeps its precision at any distance
+    DEPTH_REVERSED = 1,
+    // linear in the distance along the view direction, 0 at the near plane
+    // and 1 at the far plane, e.g. written to gl_FragDepth
+    DEPTH_LINEAR = 2,
+};
+
+/**
+ * Perspective frustum a layer was rendered with. Its edges are given as the
+ * tangents of their angles from the view direction, so they can be off
+ * center. A symmetric frustum with vertical fov f has top = -bottom =
+ * tan(f / 2) and right = -left = aspectRatio * top.
+ */
+struct LayerProjection {
+    float left;
+    float right;
+    float bottom;
+    float top;
+    float nearPlane;
+    float farPlane;
+    // how the layer's depth image was written
+    DepthMapping depthMapping = DEPTH_STANDARD;
+
+    /**
+     * Symmetric frustum, same parameters as updateProjection
+     */
+    static LayerProjection perspective(float fovY, float aspectRatio, float nearPlane, float farPlane);
+
+    /**
+     * The frustum moved by offset pixels of a width by height viewport, so
+     * every pixel is sampled that far off its center, e.g. by
+     * getJitterOffset()
+     */
+    LayerProjection jittered(glm::vec2 offset, int width, int height) const;
+
+    /**
+     * Part of the frustum around center, both center and size in fractions
+     * of the frustum's width and height. Rendering the fovea into a layer of
+     * its own with this over a low resolution layer of the whole frustum
+     * keeps full resolution only where the eye sees it, with reprojection
+     * drawing the inset over the rest
+     */
+    LayerProjection inset(glm::vec2 center, glm::vec2 size) const;
+
+    /**
+     * OpenGL projection matrix of the frustum. With DEPTH_REVERSED it is
+     * meant for a 0 to 1 clip range (glClipControl) and writes 1 at the near
+     * plane, otherwise it is glm::frustum's
+     */
+    glm::mat4 matrix() const;
 };
 
+/**
+ * Most damage rectangles a layer can have
+ */
+const int MAX_LAYER_DAMAGE = 8;
+
 struct FrameLayer {
     double fov;
     FrameLayerFlags flags;
 
     Swapchain* swapchain;
     int swapchainIndex;
+
+    // Pose the layer was rendered with if hasPose is set, otherwise the
+    // frame's pose. Lets layers be rendered at different times.
+    bool hasPose = false;
+    Pose pose;
+    // Time the layer's scene was rendered at, the time velocities are
+    // extrapolated from. Set by submitFrame to the frame's poseInfo.time
+    // unless hasPose is set, in which case the application sets it too
+    double time = 0;
+
+    // Projection the layer was rendered with if hasProjection is set,
+    // otherwise fov with the projection given to updateProjection
+    bool hasProjection = false;
+    LayerProjection projection;
+
+    // Part of the swapchain image the layer was rendered to if hasViewport
+    // is set, otherwise the whole image: x, y, width and height in pixels.
+    // Reprojection stretches it over the layer's projection, so a smaller
+    // viewport lowers the layer's resolution without changing what it
+    // shows. Velocities are in texture coordinates of the viewport. Ignored
+    // for cube map layers
+    bool hasViewport = false;
+    int viewport[4];
+
+    // Eye the layer is shown to with setStereo, 0 for the left and 1 for
+    // the right, or -1 for both, e.g. for a distant background. Ignored
+    // without stereo
+    int eye = -1;
+
+    // Split screen viewport the layer is shown in, see setSplitScreen, or
+    // -1 for all of them. Ignored without split screen
+    int splitViewport = -1;
+
+    // Reference space the layer's content is fixed in, see
+    // setReferenceSpace, or -1 for the world. Reprojection carries the
+    // layer's pose along as the space moves from the layer's time to each
+    // refresh, so e.g. a cockpit rendered rarely still stays put around a
+    // turning vehicle. Ignored for camera locked layers, which are fixed to
+    // the head, and while the space has no source
+    int referenceSpace = -1;
+
+    // Parts of the image that changed since the image last submitted at this
+    // layer index if damageCount is above 0: x, y, width and height in
+    // pixels of the image. submitFrame copies the rest of that image into
+    // this one, so the application only renders inside them, e.g. with
+    // glScissor, and the layer's depth pyramid is only rebuilt there. Check
+    // canSubmitDamage first, submitFrame ignores damage where it is false
+    int damageCount = 0;
+    int damage[MAX_LAYER_DAMAGE][4];
+
+    // Fence signaled when the app's rendering to this layer has finished.
+    // This is created by submitFrame, the application should not set it.
+    GLsync fence;
+
+    // Number of the submitFrame call that provided the image, kept layers
+    // carry their original one. Set by submitFrame, the application should
+    // not set it.
+    std::uint64_t submission;
+    // Submission the damage is relative to, 0 without damage. Set by
+    // submitFrame, the application should not set it.
+    std::uint64_t damageBase = 0;
+};
+
+/**
+ * Most layers a frame can have
+ */
+const std::size_t MAX_FRAME_LAYERS = 8;
+
+/**
+ * Layers of a frame, stored inline so building and submitting a frame never
+ * allocates. Has the parts of std::vector's interface frames need
+ */
+class FrameLayers {
+private:
+    FrameLayer items[MAX_FRAME_LAYERS];
+    std::size_t count = 0;
+
+    // out of line so the header needs no iostream
+    static void reportFull(const FrameLayer& layer);
+
+public:
+    /**
+     * Appends a layer. Returns false, prints an error and leaves the layers
+     * unchanged if there are already MAX_FRAME_LAYERS. An image acquired
+     * for the layer then stays acquired by the application
+     */
+    bool push_back(const FrameLayer& layer) {
+        if(count == MAX_FRAME_LAYERS) {
+            reportFull(layer);
+            return false;
+        }
+        items[count++] = layer;
+        return true;
+    }
+
+    /**
+     * Drops the layers after the first n, or appends default layers up to n
+     */
+    void resize(std::size_t n) {
+        if(n > MAX_FRAME_LAYERS)
+            n = MAX_FRAME_LAYERS;
+        for(std::size_t i = count; i < n; i++)
+            items[i] = FrameLayer();
+        count = n;
+    }
+
+    void clear() { count = 0; }
+    std::size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    bool full() const { return count == MAX_FRAME_LAYERS; }
+
+    FrameLayer& operator[](std::size_t i) { return items[i]; }
+    const FrameLayer& operator[](std::size_t i) const { return items[i]; }
+    FrameLayer* begin() { return items; }
+    FrameLayer* end() { return items + count; }
+    const FrameLayer* begin() const { return items; }
+    const FrameLayer* end() const { return items + count; }
 };
 
 struct FrameSubmitInfo {
     Pose pose;
     PoseInfo poseInfo;
-    std::vector<FrameLayer> layers;
+    FrameLayers layers;
+    // number of the submitFrame call that submitted it, counting from 1,
+    // which identifies the frame in PresentedRefresh. Set by submitFrame
+    std::uint64_t submission = 0;
+    // glfwGetTime() of that call, set by submitFrame
+    double submitTime = 0;
 };
 
 /**
- * Function pointer type used by PoseFunction. Returns the amount of time the
- * given key has been pressed since the last frame
+ * Orientation of the camera that renders a face of a cube map layer whose
+ * pose has the identity orientation, so a face is rendered with
+ * layer.pose.orientation * cubeMapFaceOrientation(face). Faces have a 90
+ * degree fov and an aspect ratio of 1
  */
-typedef double (*KeyTimeFunction)(int key);
+glm::quat cubeMapFaceOrientation(int face);
 
 /**
- * Function pointer type used by the application to specify how camera pose
- * responds to user input. This function MUST have no side effects, as it may
- * be called by reprojection many times for each frame
- *
- * mouseX - Net movement of mouse in the X direction. A value of zero does not
- *          necessarily correspond to any specific position
- * mouseY - Net movement of mouse in the Y direction
- * time - A monotonically increasing timer in seconds. Note that the value may
- *        not be monotonic from the perspective of this function, as this
- *        function may be used for different times in any order. The time
- *        should never be before the most recently submitted frame.
- * keyTime - A function that gets the total time a certain key (GLFW int key
- *           code) has been pressed, returned as a double in seconds
- *
- * Returns the position and orientation of the camera with the given input
+ * Tells the application which layers have to be rendered when layers are
+ * updated at their own rates, e.g. the HUD every frame and a distant
+ * background a few times per second. Layers that are not due are submitted
+ * with KEEP_PREVIOUS_IMAGE. Layer indices are positions in
+ * FrameSubmitInfo::layers. Used by the application thread only.
  */
-typedef Pose (*PoseFunction)(const Pose& lastPose, double dx, double dy,
-                             double dt, KeyTimeFunction keyTime);
+class LayerScheduler {
+private:
+    std::vector<double> intervals;
+    std::vector<double> nextTimes;
+
+public:
+    /**
+     * Adds a layer updated rate times per second, or every frame if rate is
+     * 0. Returns its index
+     */
+    int addLayer(double rate = 0);
+
+    void setRate(int layer, double rate);
+
+    /**
+     * Returns whether the layer has to be rendered for the frame shown at
+     * displayTime, as returned by waitForNextAppFrame
+     */
+    bool isDue(int layer, double displayTime) const;
+
+    /**
+     * Records that the layer was rendered and submitted for displayTime
+     */
+    void markSubmitted(int layer, double displayTime);
+
+    /**
+     * Makes the layer due on the next frame, e.g. when it was not submitted
+     * at all and has no previous image to keep
+     */
+    void invalidate(int layer);
+};
 
 /**
- * Applications should implement their main loops in this thread. When
- * startReprojection is called, reprojection takes over the main thread, and
- * the application must run on a secondary thread. The provided window argument
- * is a hidden window with a shared context with the main window.
+ * Picks the scale a layer is rendered at from the application's GPU time, so
+ * frames stay within their budget while reprojection keeps the display rate
+ * smooth. Render into the viewport it gives and submit that as the layer's
+ * viewport. Used by the application thread only.
  */
-typedef void (*ApplicationCallback)(GLFWwindow* window);
+class ResolutionScaler {
+private:
+    double minScale;
+    double maxScale;
+    double scale;
+
+public:
+    /**
+     * Scales are of the width and height, the GPU time of a frame is about
+     * proportional to their square
+     */
+    ResolutionScaler(double minScale = 0.5, double maxScale = 1);
+
+    /**
+     * Adjusts the scale for a frame's GPU time, e.g. FrameStats::appGpuTime,
+     * and the budget of a frame, usually one over the target framerate.
+     * Drops at once when over budget and grows a little per frame when well
+     * under it. Times of 0, which mean no measurement, are ignored. Returns
+     * the new scale
+     */
+    double update(double gpuTime, double budget);
+
+    double getScale() const { return scale; }
+
+    /**
+     * Viewport of the current scale in an image of the given size, anchored
+     * at its lower left corner
+     */
+    void getViewport(int width, int height, int viewport[4]) const;
+};
 
 /**
- * Inititalizes the ARP library. Returns 0 on success
+ * Splits a view by depth into a near layer and a far layer, each with a
+ * swapchain, resolution and update rate of its own. Distant scenery barely
+ * moves as the camera does, so the far layer is reprojected by rotation
+ * only and rendered again once the camera has moved far enough for that to
+ * show. The near layer ends at the split and is rendered every frame with
+ * PARALLAX_ENABLED. It is submitted before the far layer with ALPHA_MASKED
+ * and cleared to alpha 0, so the far layer shows wherever it has nothing.
+ * Combine with a LayerScheduler rate for the far layer to also cap how
+ * often it is rendered. Used by the application thread only.
  */
-int initialize();
+class DepthSplit {
+private:
+    double travel;
+    double pixels;
+    float distance = 0;
+    bool farRendered = false;
+    glm::vec3 farPosition;
+
+public:
+    /**
+     * travel is how far the camera may move from where the far layer was
+     * rendered before it is rendered again, pixels is how far points at the
+     * split may then be off in the far layer's rotation only reprojection
+     */
+    DepthSplit(double travel = 0.25, double pixels = 2);
+
+    /**
+     * Moves the split to the nearest distance where moving the camera by
+     * travel shifts points by at most pixels, for a view with the projection
+     * and an image height pixels high. Stays between the projection's near
+     * and far plane. A change makes the far layer due. Returns the distance
+     */
+    float update(const LayerProjection& projection, int height);
+
+    float getDistance() const { return distance; }
+
+    /**
+     * The projection from its near plane to the split, and from the split to
+     * its far plane
+     */
+    LayerProjection nearProjection(const LayerProjection& projection) const;
+    LayerProjection farProjection(const LayerProjection& projection) const;
+
+    /**
+     * Returns whether the far layer has to be rendered for a camera at the
+     * position: it never was, the split changed or the camera has moved by
+     * travel since
+     */
+    bool isFarDue(const glm::vec3& position) const;
+
+    /**
+     * Records that the far layer was rendered from the position
+     */
+    void markFarRendered(const glm::vec3& position);
+};
 
 /**
- * After creating a GLFW window, this function hands it off to the reprojection
- * thread. The window will be replaced with with a hidden window that shares a
- * context with the original window. Use this window for rendering.
- *
- * This new window is meant to be essentially an offscreen context. The default
- * framebuffer should not be drawn to, as it will have no effect. Only FBOs
- * should be used in this context.
- *
- * Returns 0 on success
+ * Recommends the rate to render at from how fast the camera moves, for
+ * waitForNextAppFrame. Reprojection turns the camera without error inside
+ * the guard band, but moving by d between frames shifts points at distance
+ * z by about d / z radians, which parallax only approximates and which
+ * reveals what no frame saw. The rate keeps that shift within pixels at the
+ * nearest distance the scene is usually seen from, and the turn between
+ * frames within turnPixels, so a still or turning camera gets a few frames
+ * a second and fast movement the most the GPU time allows. Used by the
+ * application thread only.
  */
-int startReprojection(ApplicationCallback callback);
+class FramerateController {
+private:
+    double depth;
+    double pixels;
+    double turnPixels;
+    int minFramerate;
+    int framerate;
+    // speeds of the camera, decaying over a fraction of a second once it
+    // slows down so a pause in a movement doesn't drop the rate
+    double speed = 0;
+    double turnSpeed = 0;
+    bool hasPose = false;
+    Pose lastPose;
+    double lastTime = 0;
+
+public:
+    FramerateController(double depth = 1, double pixels = 1, double turnPixels = 16, int minFramerate = 5);
+
+    /**
+     * Adjusts the rate for the camera's pose at a frame's display time,
+     * predicted by getPredictedCameraPose, and a view with the projection and
+     * an image height pixels high. gpuTime is a frame's GPU time, e.g.
+     * FrameStats::appGpuTime, the rate stays below what it allows unless it
+     * is 0. disocclusion is the fraction of pixels reprojection got wrong
+     * recently if known, e.g. from QualityStats, which raises the rate while
+     * above a percent. Stays between minFramerate and maxFramerate and
+     * returns the new rate
+     */
+    int update(const Pose& pose, double time, const LayerProjection& projection, int height, double gpuTime,
+               int maxFramerate, double disocclusion = -1);
+
+    int getFramerate() const { return framerate; }
+};
 
 /**
- * Registers the function used to determine poses by input
+ * Scheduling priority of an ARP thread
  */
-void registerPoseFunction(PoseFunction function);
+enum ThreadPriority {
+    PRIORITY_DEFAULT = 0,
+    // above normal threads, without special rights where possible
+    PRIORITY_HIGH = 1,
+    // real-time scheduling: SCHED_FIFO on POSIX, MMCSS on Windows. Usually
+    // needs CAP_SYS_NICE or an rtprio limit on Linux
+    PRIORITY_TIME_CRITICAL = 2,
+};
 
 /**
- * Causes the main window to capture the mouse cursor
+ * Priority the GPU schedules a context's work with. Contexts without a
+ * priority compete with each other in submission order
  */
-void captureCursor();
+enum ContextPriority {
+    // the platform exposes no context priority (GLX, WGL, EGL without
+    // EGL_IMG_context_priority)
+    CONTEXT_PRIORITY_UNAVAILABLE = 0,
+    CONTEXT_PRIORITY_LOW = 1,
+    CONTEXT_PRIORITY_MEDIUM = 2,
+    CONTEXT_PRIORITY_HIGH = 3,
+};
 
 /**
- * Causes the main window to release the mouse cursor
+ * Priorities and cores of the thread that runs reprojection and the thread
+ * ARP starts for the application callback
  */
-void releaseCursor();
+struct ThreadConfig {
+    ThreadPriority reprojectionPriority = PRIORITY_DEFAULT;
+    // logical core to pin to, -1 leaves placement to the OS
+    int reprojectionCore = -1;
+    ThreadPriority appPriority = PRIORITY_DEFAULT;
+    int appCore = -1;
+    // reprojects on a thread of its own, with the window's context current
+    // there, while the thread that calls startReprojection only handles
+    // window events, polling them every half millisecond. A slow event poll
+    // then can't make a refresh miss its vblank, and input is timestamped
+    // closer to when it arrived. Otherwise the calling thread reprojects and
+    // handles events between refreshes. Window callbacks run on the calling
+    // thread either way. Not for macOS, where the overlay's window queries
+    // have to stay on the main thread
+    bool renderThread = false;
+};
 
 /**
- * Specify features of the projection
- * The reprojection needs to know this to accurately reproject the scene
+ * Quality knobs of reprojection. When reprojection's GPU time goes over its
+ * budget, see setReprojectionBudget, they are turned down in the order they
+ * are listed here, and back up once there is enough headroom.
  */
-void updateProjection(float near, float far, float fovY, float aspectRatio);
+struct ReprojectionQuality {
+    // most hierarchical march iterations of a parallax ray
+    int parallaxIterations;
+    // finest depth pyramid level parallax rays are marched at
+    int hizLevel;
+    // whether layers behind the first one get parallax and grid warp, or
+    // are reprojected by rotation only
+    bool backgroundParallax;
+    // grid warp cells are this many times the size set with
+    // setGridWarpCellSize
+    int gridWarpCellScale;
+};
 
 /**
- * Returns the pose that should be used to render the next frame
+ * Timing of the most recent reprojection refresh and application frame.
+ * All times are in seconds.
  */
-void getCameraPose(Pose& pose, PoseInfo& poseInfo);
+struct FrameStats {
+    // CPU time from sampling input to the end of reprojection draw calls
+    double reprojectionCpuTime;
+    // GPU time of reprojection, one refresh behind
+    double reprojectionGpuTime;
+    // time reprojection's GPU work waited behind other work, mostly the
+    // application's, before it started. One refresh behind
+    double reprojectionGpuDelay;
+    // CPU time spent evaluating the camera pose
+    double poseEvaluationTime;
+    // refreshes whose pose function missed setPoseFunctionBudget, which
+    // extrapolated the pose instead
+    std::uint64_t latePoseEvaluations;
+    // time spent blocked in glfwSwapBuffers
+    double swapTime;
+    // refreshes where reprojection did not present in time
+    std::uint64_t missedRefreshes;
+    // refreshes swapped after their vblank with setAdaptiveVsync, shown at
+    // once with a tear instead of a refresh late
+    std::uint64_t tornRefreshes;
+    // display refresh period fitted to present timestamps
+    double refreshPeriod;
+    // conservative estimate of the time from latching a frame to the vblank
+    // that shows it
+    double presentLatency;
+    // quality the governor picked, level 0 being full quality
+    int qualityLevel;
+    ReprojectionQuality quality;
+    // times the governor changed the quality level
+    std::uint64_t qualityChanges;
+    // refreshes skipped because nothing on screen would have changed, see
+    // setIdleDetection
+    std::uint64_t idleRefreshes;
+    // priorities the threads got, lower than ThreadConfig asked for when
+    // the OS refused
+    ThreadPriority reprojectionPriority;
+    ThreadPriority appPriority;
+    // GPU priorities of the window's context and the application context.
+    // Unless reprojection's is higher, a long application frame can delay the
+    // reprojection draw past vblank
+    ContextPriority reprojectionContextPriority;
+    ContextPriority appContextPriority;
+
+    // CPU time from the first acquireImage of a frame to its submitFrame
+    double appFrameTime;
+    // GPU time between the first acquireImage and submitFrame, one frame behind
+    double appGpuTime;
+    // estimates of the app's GPU time, and of how long after submitFrame
+    // the GPU finishes a frame, at the percentile of setAppGpuTimePercentile
+    double appGpuTimeEstimate;
+    double appGpuTailEstimate;
+    // time acquireImage spent waiting for images held by reprojection
+    double swapchainWaitTime;
+    // time yieldPoint spent waiting for reprojection in the last frame, and
+    // the number of yieldPoint calls that waited so far
+    double yieldWaitTime;
+    std::uint64_t yields;
+    // time waitForNextAppFrame waited for the GPU to finish an earlier frame
+    // in the last frame, see setFramesInFlight
+    double inFlightWaitTime;
+    std::uint64_t submittedFrames;
+    // refreshes of an input replay that latched a different frame than the
+    // recording did, see startInputReplay
+    std::uint64_t replayDivergences;
+    // time spent in pipeline warm-ups so far, see setPipelineWarmUp
+    double pipelineWarmUpTime;
+    // how far each new frame's pose was from the pose of its first refresh,
+    // in degrees and units, averaged over the last frames. The prediction
+    // error when frames are rendered for their predicted pose
+    double predictionAngleError;
+    double predictionPositionError;
+    // scales setPredictionTuning settled on for the predicted mouse movement
+    // and held key time, 1 while not tuning
+    double predictionRotationGain;
+    double predictionTranslationGain;
+};
 
 /**
- * Returns the estimated time that the next frame will be submitted based on
- * previous frames
+ * What the GPU memory tracked by arp is spent on, see GpuMemoryStats
+ */
+enum GpuMemoryCategory {
+    // color, depth and velocity images of every swapchain, including the
+    // ones kept for frame history
+    GPU_MEMORY_SWAPCHAINS = 0,
+    // depth pyramids of the latched frame's layers
+    GPU_MEMORY_DEPTH_PYRAMIDS = 1,
+    // what reprojection keeps of earlier frames: the retained frames' depth
+    // pyramids and temporal accumulation
+    GPU_MEMORY_HISTORY = 2,
+    // reprojection's own targets: the overlay, parallax and voxel cache
+    // images and offscreen outputs
+    GPU_MEMORY_REPROJECTION = 3,
+    // reported by the application with trackGpuMemory, e.g. its assets
+    GPU_MEMORY_APP = 4,
+    GPU_MEMORY_CATEGORY_COUNT = 5,
+};
+
+/**
+ * GPU memory in bytes. Tracked sizes are what the allocations need without
+ * the driver's padding and alignment
+ */
+struct GpuMemoryStats {
+    std::int64_t bytes[GPU_MEMORY_CATEGORY_COUNT] = {};
+    std::int64_t trackedBytes = 0;
+    // from GL_NVX_gpu_memory_info or GL_ATI_meminfo, -1 where the driver
+    // doesn't report it. ATI only reports what is available
+    std::int64_t deviceBytes = -1;
+    std::int64_t deviceAvailableBytes = -1;
+    // over the budget of setGpuMemoryBudget, frame history is dropped
+    bool underPressure = false;
+};
+
+enum PowerMode {
+    POWER_MODE_NORMAL,
+    // always saves power
+    POWER_MODE_SAVING,
+    // saves power on battery, in the OS's battery saver, or when a thermal
+    // zone comes within thermalMargin of throttling
+    POWER_MODE_AUTO
+};
+
+struct PowerSettings {
+    PowerMode mode = POWER_MODE_NORMAL;
+    // the target framerate is capped at this while saving
+    int savingFramerate = 10;
+    // resolution scale recommended for background layers while saving
+    float backgroundScale = 0.5f;
+    // degrees Celsius before the nearest trip point that count as hot, and
+    // as many again below it to cool down
+    double thermalMargin = 10;
+    // seconds between reads of the battery and thermal zones
+    double pollInterval = 5;
+};
+
+/**
+ * The power supply and temperature as last read, and what reprojection does
+ * about them. -1 where the platform doesn't report a value
+ */
+struct PowerState {
+    bool onBattery = false;
+    int batteryPercent = -1;
+    double temperature = -1;
+    bool hot = false;
+    // reprojection is saving power: rotation only, idle refreshes skipped,
+    // and the framerate below capped
+    bool saving = false;
+    // what the app should render at, getTargetFramerate() capped while saving
+    int recommendedFramerate = 0;
+    // 1, or PowerSettings::backgroundScale while saving. Reprojection
+    // doesn't render the layers, so scaling them is up to the app
+    float backgroundScale = 1;
+};
+
+/**
+ * Motion-to-photon latencies of presented refreshes, from sampling the input
+ * a refresh was reprojected with to the vblank that showed it. All times are
+ * in seconds.
+ */
+struct LatencyHistogram {
+    static const int BIN_COUNT = 200;
+    // the last bin also counts every longer latency
+    static constexpr double BIN_WIDTH = 0.0005;
+
+    std::uint64_t bins[BIN_COUNT];
+    std::uint64_t count;
+    double total;
+    double max;
+    // refreshes whose vblank came from the platform's present feedback, the
+    // others use swap completion as their vblank
+    std::uint64_t presentFeedbackCount;
+
+    double mean() const { return count ? total / count : 0; }
+
+    /**
+     * Returns the upper edge of the bin holding the given fraction of
+     * latencies, e.g. 0.99 for the 99th percentile
+     */
+    double percentile(double fraction) const;
+};
+
+/**
+ * Comparisons of reprojected refreshes with ground truth images, see
+ * submitGroundTruth. Totals are over every comparison.
+ */
+struct QualityStats {
+    std::uint64_t count;
+    // PSNR in dB, 100 for identical images
+    double psnrTotal;
+    double minPsnr;
+    // SSIM of luma, averaged over 8x8 pixel blocks
+    double ssimTotal;
+    // fraction of pixels off by more than a tenth in any channel, which is
+    // where disocclusions and stretched edges show
+    double disocclusionTotal;
+
+    double meanPsnr() const { return count ? psnrTotal / count : 0; }
+    double meanSsim() const { return count ? ssimTotal / count : 0; }
+    double meanDisocclusion() const { return count ? disocclusionTotal / count : 0; }
+};
+
+/**
+ * Controls when in a display refresh the reprojection loop samples input and
+ * draws
+ */
+enum ReprojectionSchedule {
+    // sample and draw right after the previous swap returns
+    SCHEDULE_IMMEDIATE = 0,
+    // sleep until the measured reprojection cost plus a safety margin before
+    // the next vblank, then sample and draw
+    SCHEDULE_JUST_IN_TIME = 1,
+    // experimental: draw each refresh straight into the front buffer in
+    // horizontal slices from the top down, each just before the raster
+    // reaches it and with the pose predicted for its own scanout, see
+    // setBeamRacingSlices. Only on fixed refresh displays without headless
+    // output. Slices tear unless the driver scans out the front buffer as
+    // it is drawn, as in exclusive fullscreen without a compositor
+    SCHEDULE_BEAM_RACING = 2,
+};
+
+/**
+ * Model used to extrapolate input and frame timing for prediction
+ */
+enum PosePredictor {
+    // least squares line through recent samples
+    PREDICTOR_CONSTANT_VELOCITY = 0,
+    // least squares parabola through recent samples
+    PREDICTOR_CONSTANT_ACCELERATION = 1,
+    // constant velocity Kalman filter, smooths out noisy samples
+    PREDICTOR_KALMAN = 2,
+    // continues the camera's linear and angular velocity over the last
+    // refreshes (arppose.h) without calling the pose function, so it's cheap
+    // but misses input that hasn't moved the camera yet. Display times are
+    // predicted as with PREDICTOR_CONSTANT_VELOCITY
+    PREDICTOR_POSE_EXTRAPOLATION = 3,
+};
+
+/**
+ * Function pointer type used by PoseFunction. Returns the amount of time the
+ * given key has been pressed since the last frame
+ */
+typedef double (*KeyTimeFunction)(int key);
+
+/**
+ * Function pointer type used by the application to specify how camera pose
+ * responds to user input. This function MUST have no side effects, as it may
+ * be called by reprojection many times for each frame
+ *
+ * mouseX - Net movement of mouse in the X direction. A value of zero does not
+ *          necessarily correspond to any specific position
+ * mouseY - Net movement of mouse in the Y direction
+ * time - A monotonically increasing timer in seconds. Note that the value may
+ *        not be monotonic from the perspective of this function, as this
+ *        function may be used for different times in any order. The time
+ *        should never be before the most recently submitted frame.
+ * keyTime - A function that gets the total time a certain key (GLFW int key
+ *           code) has been pressed, returned as a double in seconds
+ *
+ * Returns the position and orientation of the camera with the given input
+ */
+typedef Pose (*PoseFunction)(const Pose& lastPose, double dx, double dy,
+                             double dt, KeyTimeFunction keyTime);
+
+/**
+ * Key time lookup that carries its own context, so every evaluation of a
+ * pose function can see different key times without shared state
+ */
+struct KeyTime {
+    double (*function)(const void* context, int key);
+    const void* context;
+
+    double operator()(int key) const { return function(context, key); }
+};
+
+/**
+ * Same as PoseFunction, but keyTime carries the state of the evaluation.
+ * Pose functions of this type can be evaluated by any number of threads at
+ * once, for example to predict a pose for each eye or layer
+ */
+typedef Pose (*ContextPoseFunction)(const Pose& lastPose, double dx, double dy,
+                                    double dt, const KeyTime& keyTime);
+
+/**
+ * Inputs of many pose function evaluations in structure of arrays layout.
+ * Entry i moves lastPose by dx[i], dy[i] over dt[i]
+ */
+struct PoseBatch {
+    Pose lastPose;
+    std::size_t count;
+    const double* dx;
+    const double* dy;
+    const double* dt;
+
+    // fills out[0..count) with the time key was pressed in each entry
+    void (*keyTimes)(const void* context, int key, double* out);
+    const void* context;
+
+    void getKeyTimes(int key, double* out) const { keyTimes(context, key, out); }
+};
+
+/**
+ * Pose function that evaluates a whole batch at once, writing poses[i] for
+ * entry i, so it can vectorize across entries. Same contract as
+ * ContextPoseFunction otherwise. Single evaluations are passed as batches
+ * of one
+ */
+typedef void (*BatchPoseFunction)(const PoseBatch& batch, Pose* poses);
+
+/**
+ * Display time to predict a pose for, see evaluatePoses
+ */
+struct PoseQuery {
+    double time;
+};
+
+/**
+ * Pose of a tracker at a glfwGetTime() value
+ */
+struct PoseSample {
+    double time;
+    Pose pose;
+};
+
+/**
+ * Where the camera pose comes from. By default reprojection integrates
+ * window input with the registered pose function every refresh, which
+ * getInputPoseSource stands for. setPoseSource replaces it, for example
+ * with a TrackerPoseSource (arppose.h) fed by a headset or motion capture
+ * at a higher rate than the display's
+ */
+class PoseSource {
+public:
+    virtual ~PoseSource() = default;
+
+    /**
+     * Sets pose to the pose at time, interpolated between samples or
+     * extrapolated past the newest. Called by reprojection with each
+     * refresh's latch time and by predictions (evaluatePoses) with display
+     * times, from any thread. Returns false while there is no pose, the
+     * camera keeps its last one then
+     */
+    virtual bool getPose(double time, Pose& pose) = 0;
+};
+
+/**
+ * Function pointer type used to replace window input with scripted input,
+ * for example for benchmarks. Called by reprojection once per refresh.
+ *
+ * time - glfwGetTime() of the sample
+ * mouseX, mouseY - set to the absolute mouse position at time
+ * heldKeys - filled with the GLFW key codes held at time, at most maxHeldKeys
+ *
+ * Returns the number of keys written to heldKeys
+ */
+typedef int (*InputOverrideFunction)(double time, double& mouseX, double& mouseY,
+                                     int* heldKeys, int maxHeldKeys);
+
+/**
+ * Applications should implement their main loops in this thread. When
+ * startReprojection is called, reprojection takes over the main thread, and
+ * the application must run on a secondary thread. The provided window argument
+ * is a hidden window with a shared context with the main window.
+ */
+typedef void (*ApplicationCallback)(GLFWwindow* window);
+
+/**
+ * Asks GLFW for a high-priority GPU context for the next window it creates.
+ * Call before creating the window ARP reprojects to, so its draw isn't queued
+ * behind application GPU work. Only EGL contexts (GLFW_CONTEXT_CREATION_API
+ * set to GLFW_EGL_CONTEXT_API) on drivers with EGL_IMG_context_priority can
+ * get one, elsewhere the hint is ignored
+ */
+void hintContextPriority();
+
+/**
+ * Inititalizes the ARP library. Returns 0 on success
+ */
+int initialize();
+
+/**
+ * After creating a GLFW window, this function hands it off to the reprojection
+ * thread. The window will be replaced with with a hidden window that shares a
+ * context with the original window. Use this window for rendering.
+ *
+ * This new window is meant to be essentially an offscreen context. The default
+ * framebuffer should not be drawn to, as it will have no effect. Only FBOs
+ * should be used in this context.
+ *
+ * Returns 0 on success
+ */
+int startReprojection(ApplicationCallback callback);
+
+/**
+ * Returns a hidden window whose context shares objects with the application's
+ * context, for uploading buffers and textures from a loader thread. Created by
+ * startReprojection. Make it current on one thread only, and keep in mind that
+ * VAOs and FBOs made in it are not visible to the application's context
+ */
+GLFWwindow* getUploadContext();
+
+/**
+ * Number of extra application contexts startReprojection creates for
+ * threads that render and submitLayer layers of their own, at most
+ * MAX_FRAME_LAYERS. 0 by default. Call before startReprojection
+ */
+void setAppContexts(int count);
+
+/**
+ * Returns a hidden window whose context shares objects with the
+ * application's context, one of setAppContexts, or null. Make each current
+ * on one thread only
+ */
+GLFWwindow* getAppContext(int index);
+
+/**
+ * Submits a layer rendered on the calling thread, with one of
+ * getAppContext's contexts current, for the frame layer at layerIndex that
+ * the application thread submits with SUBMITTED_BY_THREAD. The layer needs
+ * hasPose and its time set, as there is no frame pose to take, and can't
+ * have damage or be KEEP_PREVIOUS_IMAGE. Each layer index is submitted from
+ * one thread only, but threads submit different indices at the same time
+ * and at their own rates without locking: reprojection takes the newest
+ * layer of each index when it latches, whether or not the application
+ * thread submitted a frame since, and a layer replaced before it was taken
+ * gives its image back
+ */
+void submitLayer(int layerIndex, const FrameLayer& layer);
+
+/**
+ * Layer source whose images are written by the CPU rather than rendered,
+ * like software rendered panels, camera feeds and video. Each buffer is a
+ * persistently mapped pixel buffer that any thread writes RGBA8 pixels into,
+ * bottom row first, without a GL context. Reprojection copies a submitted
+ * buffer into an image of its own when it latches and shows it as the
+ * thread layer at layerIndex, see submitLayer: the application thread
+ * submits that frame layer with SUBMITTED_BY_THREAD, and nothing calls
+ * submitLayer at the index.
+ *
+ * A buffer goes back to the writer once the GPU has read it, so
+ * acquireBuffer never hands out memory still being copied. A buffer
+ * submitted with a presentation time waits for the first refresh shown at
+ * or after it, and one due by then replaces the older ones, which are
+ * dropped, so video plays at its own rate whatever the display's.
+ * Without ARB_buffer_storage the buffers are plain memory that the
+ * reprojection thread uploads from.
+ *
+ * Create and delete it with a context sharing objects with the app's
+ * current, and delete it only after stopReprojection, as reprojection may
+ * still show its images
+ */
+class CpuSwapchain {
+private:
+    enum BufferState {
+        BUFFER_FREE,
+        BUFFER_WRITING,
+        BUFFER_QUEUED,
+        BUFFER_UPLOADING
+    };
+
+    struct Buffer {
+        std::uint32_t pixelBuffer = 0;
+        // the mapping, or memory when there is no pixel buffer
+        unsigned char* pixels = nullptr;
+        std::vector<unsigned char> memory;
+        BufferState state = BUFFER_FREE;
+        FrameLayer layer;
+        double presentationTime = -1;
+        // submission order, to tell the newest due buffer
+        std::uint64_t order = 0;
+        // signaled once the copy out of the buffer has executed
+        GLsync fence = nullptr;
+    };
+
+    int layerIndex;
+    Swapchain images;
+    std::vector<Buffer> buffers;
+    std::uint64_t submissions = 0;
+    std::mutex mutex;
+    std::condition_variable cond;
+
+    int acquire(bool wait, double timeout);
+
+public:
+    const int width;
+    const int height;
+
+    CpuSwapchain(int layerIndex, int width, int height, int numBuffers = 3);
+    ~CpuSwapchain();
+    CpuSwapchain(const CpuSwapchain&) = delete;
+    CpuSwapchain& operator=(const CpuSwapchain&) = delete;
+
+    int getLayerIndex() const { return layerIndex; }
+
+    /**
+     * Reserves a buffer for writing, blocking until one is free. Can be
+     * called from any thread
+     */
+    int acquireBuffer();
+
+    /**
+     * Same as acquireBuffer, but waits at most timeout seconds. Returns -1
+     * if no buffer became free in time
+     */
+    int acquireBuffer(double timeout);
+
+    /**
+     * width * height * 4 bytes of the acquired buffer to write the pixels to
+     */
+    unsigned char* getPixels(int index) { return buffers[index].pixels; }
+
+    /**
+     * Hands a written buffer to reprojection, to show with layer's pose,
+     * time, flags and projection; its swapchain fields are ignored. The
+     * layer needs hasPose as submitLayer's do. presentationTime is the
+     * glfwGetTime() to show the buffer at, below 0 as soon as possible. Can
+     * be called from any thread
+     */
+    void submitBuffer(int index, const FrameLayer& layer, double presentationTime = -1);
+
+    /**
+     * Used by reprojection every latch: frees the buffers whose copies have
+     * finished, and copies the newest buffer due by displayTime into an
+     * image, which layer is set to show with a reference held. Returns
+     * false if no buffer was due or no image was free.
+     * The application should NOT use this, it will be done automatically.
+     */
+    bool latch(double displayTime, FrameLayer& layer);
+};
+
+/**
+ * Many small layers, like picture in picture views, HUD panels and sprites,
+ * packed into regions of one swapchain's images instead of a swapchain of
+ * their own each, so their memory doesn't grow with their number. Each
+ * frame the app acquires one image, renders every region it submits into
+ * it and submits each region's layer from layer(). Regions of a layer that
+ * isn't due can be kept with KEEP_PREVIOUS_IMAGE like any other layer, as
+ * long as the swapchain has images enough for every image still shown.
+ *
+ * Reprojection draws consecutive layers that share an image and are only
+ * reprojected by rotation in one instanced draw, each covering only its
+ * part of the screen. Used by the application thread only
+ */
+class LayerAtlas {
+private:
+    struct Packer;
+    struct Region {
+        // x, y, width and height of the region, and of the space packed for
+        // it, which a region reusing a released one may not fill
+        int rect[4];
+        int space[4];
+        bool used;
+    };
+
+    Swapchain images;
+    std::unique_ptr<Packer> packer;
+    std::vector<Region> regions;
+
+public:
+    /**
+     * createInfo describes the shared images, which can't be cube maps.
+     * numImages bounds how many frames' worth of regions can be shown and
+     * rendered at once
+     */
+    LayerAtlas(const SwapchainCreateInfo& createInfo);
+    ~LayerAtlas();
+    LayerAtlas(const LayerAtlas&) = delete;
+    LayerAtlas& operator=(const LayerAtlas&) = delete;
+
+    /**
+     * Reserves a width by height region of every image, in the smallest
+     * released region it fits or else packed next to the others. Returns
+     * the region's number, or -1 if there is no room left
+     */
+    int allocateRegion(int width, int height);
+
+    /**
+     * Frees a region for a later allocateRegion. Layers already submitted
+     * with it keep showing it until they are replaced
+     */
+    void releaseRegion(int region);
+
+    /**
+     * x, y, width and height of the region in pixels of the images
+     */
+    const int* getRegion(int region) const { return regions[region].rect; }
+
+    Swapchain* getSwapchain() { return &images; }
+
+    /**
+     * Binds the framebuffer of an acquired image and sets the viewport and
+     * the scissor test to the region, so clears stay inside it. The scissor
+     * test is left enabled
+     */
+    void bindFramebuffer(int index, int region);
+
+    /**
+     * Layer showing the region of the image of the given index, with
+     * flags. The app fills in its pose and projection as for any layer
+     */
+    FrameLayer layer(int region, int index, FrameLayerFlags flags = NONE);
+};
+
+/**
+ * Caches linked binaries of ARP's internal shaders in the given directory,
+ * which is created if needed. Binaries are keyed by shader source and driver,
+ * so a driver update rebuilds them. Caching is off by default or when path is
+ * nullptr. Call before startReprojection
+ */
+void setShaderCacheDirectory(const char* path);
+
+/**
+ * Draws every permutation of ARP's layer programs, for every quality level,
+ * once into a small offscreen target before the first frame is reprojected,
+ * sampling images of each color and depth format of the swapchains created
+ * so far. Drivers finish compiling the state a program and format combine
+ * into on its first draw, which otherwise happens on the refresh a feature
+ * is first turned on and misses vblanks. Swapchains with new formats created
+ * later are warmed up when the next frame is latched. Takes a while without
+ * a shader cache, see setShaderCacheDirectory, and the time is reported in
+ * FrameStats::pipelineWarmUpTime. Off by default. Call before
+ * startReprojection
+ */
+void setPipelineWarmUp(bool enabled);
+
+/**
+ * Registers the function used to determine poses by input
+ */
+void registerPoseFunction(PoseFunction function);
+void registerPoseFunction(ContextPoseFunction function);
+void registerPoseFunction(BatchPoseFunction function);
+
+/**
+ * Bounds how long reprojection waits for the pose function each refresh.
+ * With a budget above 0 the function runs on a helper thread, and a refresh
+ * it hasn't returned for within budget seconds of sampling input continues
+ * the motion of the last refreshes' poses instead, counted in
+ * FrameStats::latePoseEvaluations. Refreshes keep extrapolating until a late
+ * evaluation has returned. 0, the default, calls it on the reprojection
+ * thread however long it takes. Replays always wait. Can be called at any
+ * time from any thread
+ */
+void setPoseFunctionBudget(double seconds);
+
+/**
+ * Takes camera poses from source instead of window input, or goes back to
+ * window input with nullptr or getInputPoseSource(). The source has to stay
+ * alive until it is replaced or reprojection has stopped. Replayed input
+ * (startInputReplay) takes precedence. Can be called at any time from any
+ * thread, a source set before startReprojection stands in for the pose
+ * function
+ */
+void setPoseSource(PoseSource* source);
+
+/**
+ * The default source: poses of the registered pose function predicted from
+ * window input, what getPredictedCameraPose returns without a source
+ */
+PoseSource* getInputPoseSource();
+
+/**
+ * Most reference spaces, see setReferenceSpace
+ */
+const int MAX_REFERENCE_SPACES = 4;
+
+/**
+ * Gives a reference space, 0 to MAX_REFERENCE_SPACES - 1, the pose stream
+ * of where it is in the world, e.g. a vehicle's transform. Layers whose
+ * FrameLayer::referenceSpace is the space are reprojected as fixed in it:
+ * the source is asked for the space's pose at the layer's time when its
+ * frame is latched and at each refresh's latch time, and the layer's pose
+ * moves by the difference. nullptr removes the source, and the space's
+ * layers are reprojected in the world again. The source has to stay alive
+ * until it is replaced or reprojection has stopped. Can be called at any
+ * time from any thread
+ */
+void setReferenceSpace(int space, PoseSource* source);
+
+/**
+ * Replaces mouse and keyboard input with the given function, or restores
+ * window input when nullptr. Call before startReprojection
+ */
+void setInputOverride(InputOverrideFunction function);
+
+/**
+ * Records window input, the input every refresh evaluated the pose function
+ * with and the pose of every submitted frame to a log at path, until
+ * stopInputRecording or the end of startReprojection. Returns false if the
+ * file can't be written. Can be called from any thread
+ */
+bool startInputRecording(const char* path);
+void stopInputRecording();
+
+/**
+ * Replays a log written by startInputRecording instead of window input.
+ * Refreshes run at the recorded times with the recorded input and latch the
+ * frames the recording latched, getCameraPose and getPredictedCameraPose
+ * return the poses the recorded frames were rendered with, and submitFrame
+ * waits for the time each frame was submitted at. getFrameStats counts the
+ * refreshes that still latched a different frame. The window closes at the
+ * end of the log. Takes precedence over setInputOverride. Returns false if
+ * the log can't be read. Call before startReprojection
+ */
+bool startInputReplay(const char* path);
+
+/**
+ * Causes the main window to capture the mouse cursor
+ */
+void captureCursor();
+
+/**
+ * Causes the main window to release the mouse cursor
+ */
+void releaseCursor();
+
+/**
+ * A pointer image reprojection draws over the output every refresh at the
+ * newest cursor position, so the pointer keeps up with the mouse however
+ * slowly the application renders. pixels are width * height premultiplied
+ * RGBA8 texels, top row first. The hotspot is the pixel, from the top left,
+ * placed on the cursor position
+ */
+struct CursorSprite {
+    int width = 0;
+    int height = 0;
+    const unsigned char* pixels = nullptr;
+    int hotspotX = 0;
+    int hotspotY = 0;
+};
+
+/**
+ * Draws sprite as the pointer in place of the system cursor, which is hidden
+ * over the main window. While the cursor is captured the sprite stays at the
+ * center of the window as a crosshair. The pixels are copied, nullptr goes
+ * back to the system cursor. Call from any thread
+ */
+void setCursorSprite(const CursorSprite* sprite);
+
+/**
+ * Specify features of the projection
+ * The reprojection needs to know this to accurately reproject the scene
+ */
+void updateProjection(float near, float far, float fovY, float aspectRatio);
+
+/**
+ * Sets the spacing in pixels between grid vertices for GRID_WARP_ENABLED
+ * layers. Smaller cells follow depth edges more closely but cost more
+ * vertices. Defaults to 8
+ */
+void setGridWarpCellSize(int pixels);
+
+/**
+ * Offset in pixels, from -0.5 to 0.5, to render the next submitted frame's
+ * TEMPORAL_ACCUMULATION_ENABLED layers with, see LayerProjection::jittered.
+ * Steps through 8 points of the Halton (2, 3) sequence, one per submitFrame.
+ * Used by the application thread only
+ */
+glm::vec2 getJitterOffset();
+
+/**
+ * Which pixels to render of the next submitted frame's CHECKERBOARD_ENABLED
+ * layers. GPUs shade 2x2 quads, so the checkerboard is of quads: the pixels
+ * with x / 2 + y / 2 even for 0 and odd for 1, counted from the corner of the
+ * layer's viewport. Alternates with every submitFrame. Used by the
+ * application thread only
+ */
+int getCheckerboardParity();
+
+/**
+ * Sets how much a new frame's sample counts against the history of
+ * TEMPORAL_ACCUMULATION_ENABLED layers where it lands on a pixel's center.
+ * Lower values resolve more detail and converge slower. Defaults to 0.1
+ */
+void setTemporalAccumulationWeight(float weight);
+
+/**
+ * Where reprojection spends its full quality, for headsets and eye tracked
+ * displays. Away from the fovea parallax rays take fewer iterations and grid
+ * warp cells grow, by the peripheral quality
+ */
+struct Foveation {
+    bool enabled = false;
+    // in window coordinates from 0 to 1, (0.5, 0.5) is the middle. Update it
+    // with the gaze for eye tracking
+    glm::vec2 center = glm::vec2(0.5f);
+    // fractions of the window height, full quality inside innerRadius
+    // fading to the peripheral quality at outerRadius
+    float innerRadius = 0.2f;
+    float outerRadius = 0.4f;
+    // share of parallax iterations and grid warp vertices per pixel in the
+    // periphery, from 0 to 1
+    float peripheralQuality = 0.25f;
+};
+
+/**
+ * Sets the foveation of reprojection, taken up on the next refresh. Can be
+ * called from any thread, e.g. whenever the eye tracker reports a gaze
+ */
+void setFoveation(const Foveation& foveation);
+
+/**
+ * Stereo output for headsets: reprojection draws the window's left half for
+ * the left eye and its right half for the right eye, each from its own eye
+ * pose. Prediction and the frame's per submission work happen once per
+ * refresh, only the layers are drawn per eye
+ */
+struct StereoConfig {
+    bool enabled = false;
+    // distance between the eyes in world units
+    float ipd = 0.064f;
+};
+
+/**
+ * Sets the stereo output, taken up on the next refresh. The projection
+ * given to updateProjection is then that of one eye, with half the window's
+ * aspect ratio. Can be called from any thread
+ */
+void setStereo(const StereoConfig& config);
+
+/**
+ * Pose of an eye, 0 for the left and 1 for the right, of a head at the
+ * given pose: half the ipd along the head's x axis. Render each eye's layer
+ * with it and submit it as the layer's pose. Returns head unchanged without
+ * stereo
+ */
+Pose getEyePose(const Pose& head, int eye);
+
+/**
+ * Most viewports of a split screen
+ */
+const int MAX_SPLIT_VIEWPORTS = 4;
+
+/**
+ * Pose of a split screen viewport's camera at the given time, driven by
+ * whatever input the app gives that player, e.g. a gamepad. Called by
+ * reprojection once per refresh and viewport, with the time the refresh is
+ * expected to be shown, so extrapolating to it is the function's
+ * prediction. Must be safe to call from the reprojection thread
+ */
+typedef Pose (*ViewportPoseFunction)(int viewport, double time);
+
+/**
+ * Split screen for local multiplayer: the window is divided into viewports,
+ * each with a camera of its own, reprojected in the same refresh from the
+ * same latched frame. Viewport 0 is the top left one and its camera is the
+ * one driven by the registered pose function and window input, the others
+ * take their poses from registerViewportPoseFunction. With two viewports
+ * the window is split into a top and a bottom half, with four into
+ * quadrants. Each viewport's layers are rendered from its camera, submitted
+ * with hasPose and splitViewport set. Stereo is ignored while the window is
+ * split
+ */
+struct SplitScreen {
+    // 1 for the whole window, 2 or 4
+    int viewports = 1;
+};
+
+/**
+ * Sets the split screen, taken up on the next refresh. The projection given
+ * to updateProjection is then that of one viewport. Can be called from any
+ * thread
+ */
+void setSplitScreen(const SplitScreen& config);
+
+/**
+ * Registers the function giving the poses of a split screen viewport other
+ * than 0, or removes it with nullptr, in which case the viewport shows
+ * viewport 0's camera. Can be called from any thread
+ */
+void registerViewportPoseFunction(int viewport, ViewportPoseFunction function);
+
+/**
+ * Distortion of a headset's lenses, corrected in the reprojection draw
+ * itself so no pass of its own reads and writes the window again. A point
+ * of the display at NDC p of an eye's viewport, relative to the lens center,
+ * shows the point p * (1 + k1 r^2 + k2 r^4) of the projection given to
+ * updateProjection, with r the distance in units of the viewport's half
+ * height. Red and blue are further scaled by their scales, which corrects
+ * lateral chromatic aberration. Barrel distortion shows more than the
+ * projection toward the edges, so apps should render with a guard band or a
+ * wider fov
+ */
+struct LensDistortion {
+    bool enabled = false;
+    float k1 = 0.22f;
+    float k2 = 0.24f;
+    // lens center of the left eye in NDC of its viewport, mirrored for the
+    // right eye
+    glm::vec2 center = glm::vec2(0);
+    float redScale = 0.994f;
+    float blueScale = 1.008f;
+    // reprojection meshes without a vertex per grid cell of their own,
+    // like the rotation only plane, are drawn as this many cells across
+    int meshCells = 32;
+};
+
+/**
+ * Sets the lens distortion, taken up on the next refresh. Can be called from
+ * any thread
+ */
+void setLensDistortion(const LensDistortion& distortion);
+
+/**
+ * World space cache of what submitted frames have seen, to fill what
+ * parallax reveals that the last frames never saw. Needs GL 4.3
+ */
+struct VoxelCache {
+    bool enabled = false;
+    // edge length of a voxel in world units
+    float voxelSize = 0.05f;
+    // slots of the hash table on the GPU, 32 bytes each
+    int capacity = 1 << 19;
+    // submitted frames a voxel is shown and kept for after it was last seen,
+    // after which its slot can be reused
+    int maxAge = 600;
+    // every strideth pixel of a layer in each direction is inserted
+    int stride = 2;
+};
+
+/**
+ * Sets up the voxel cache, taken up with the next submitted frame. Each
+ * submitted PARALLAX_ENABLED layer inserts the world space position and
+ * color of its pixels into a voxel hash table on the GPU. Reprojection
+ * splats the voxels under the first layer, so where its parallax leaves a
+ * disocclusion the surface is shown as any earlier frame saw it instead of
+ * the layers below. Voxels don't move with the scene, so moving objects
+ * leave stale voxels behind for up to maxAge frames. Changing the capacity
+ * or voxel size empties the cache. Can be called from any thread
+ */
+void setVoxelCache(const VoxelCache& cache);
+
+/**
+ * A voxel of the cache, for debugging
+ */
+struct VoxelCachePoint {
+    // center of the voxel
+    glm::vec3 position;
+    // RGBA8, red in the low byte
+    std::uint32_t color;
+};
+
+/**
+ * Copies the voxels of the cache, e.g. to look them up on the CPU with a
+ * cy::PointCloud. The reprojection thread reads the cache back when it
+ * latches the next frame after a call, stalling on the GPU, so this returns
+ * false until a copy has arrived and each call asks for a newer one. For
+ * debugging only. Can be called from any thread
+ */
+bool getVoxelCachePoints(std::vector<VoxelCachePoint>& points);
+
+/**
+ * Static world space triangles ray traced into disocclusions, see
+ * setSceneGeometry. Only read during the call
+ */
+struct SceneGeometry {
+    const glm::vec3* positions = nullptr;
+    std::size_t vertexCount = 0;
+    // three indices into positions per triangle
+    const std::uint32_t* indices = nullptr;
+    std::size_t triangleCount = 0;
+    // RGBA8 albedo of each triangle, red in the low byte. White when null
+    const std::uint32_t* colors = nullptr;
+};
+
+/**
+ * Builds a BVH over the triangles on the calling thread and hands it to
+ * reprojection, which uploads it with the next latched frame. Where the
+ * first layer's parallax leaves a disocclusion that neither it nor the
+ * voxel cache fills, the camera ray of each pixel is traced through the BVH
+ * on the GPU and the triangle hit is shaded with its albedo. With a stencil
+ * buffer only the uncovered pixels are traced, without one every pixel
+ * under the first layer is. Geometry that moves isn't followed, call again
+ * to replace it or with no triangles to stop tracing. Needs GL 4.3. Can be
+ * called from any thread
+ */
+void setSceneGeometry(const SceneGeometry& geometry);
+
+/**
+ * Light VIEW_DEPENDENT_RESHADING layers are shaded with, see
+ * setReshadingLights
+ */
+struct ReshadingLight {
+    // world space position, or with w 0 the direction towards the light
+    glm::vec4 position = glm::vec4(0, 1, 0, 0);
+    glm::vec3 color = glm::vec3(1);
+    // distance a point light's falloff reaches 0 at
+    float radius = 10;
+};
+
+/**
+ * Sets the lights, at most 8, whose normalized Blinn-Phong specular term
+ * reprojection adds to VIEW_DEPENDENT_RESHADING layers. The lights take
+ * effect with the next latched frame, so set them before submitting the
+ * frame they were rendered with. Only read during the call, can be called
+ * from any thread
+ */
+void setReshadingLights(const ReshadingLight* lights, int count);
+
+/**
+ * Sets how many submitted frames PARALLAX_ENABLED layers can take pixels
+ * from. Each pixel comes from the newest frame that saw its surface, so
+ * older frames fill in what moving past a foreground edge reveals. Every
+ * extra frame holds on to its swapchain images, so swapchains need that
+ * many more images, unless setCompactFrameHistory lets them go. Defaults
+ * to 1, at most 8
+ */
+void setFrameHistoryLength(int frames);
+
+/**
+ * When enabled, frames moving into the history keep their parallax layers
+ * as a copy of the color at half resolution, in the swapchain's format,
+ * and of the depth pyramid from its half resolution level up. The
+ * swapchain images go back to the application at once, and a history
+ * frame takes about a quarter of the memory. Layers whose older frames
+ * need more than color and depth keep their images: motion extrapolated,
+ * reshaded, depth peeled, depth-aware upsampled, temporally accumulated and
+ * checkerboarded ones. Disabled by default. Can be called at any time from
+ * any thread, and applies to frames retained afterwards
+ */
+void setCompactFrameHistory(bool enabled);
+
+/**
+ * For content nobody is steering, such as cutscenes and replays, where
+ * latency doesn't matter. When enabled, reprojection shows the submitted
+ * frames one frame interval late and interpolates between the two newest:
+ * the camera moves between their poses, and motion extrapolated layers
+ * move their objects back along the newest frame's velocities, and forward
+ * along a history frame's, to the shown time. With a frame history of 2
+ * or more, what the newest frame disoccludes comes from the one before.
+ * Key presses and mouse movement switch back to extrapolating from the
+ * newest frame until input has stopped for half a second. Disabled by
+ * default. Can be called from any thread
+ */
+void setFrameInterpolation(bool enabled);
+
+/**
+ * Sets the priorities and cores of ARP's threads. Takes effect in
+ * startReprojection, so it has to be called before it. A priority or core
+ * the OS refuses is reported with an error and in FrameStats
+ */
+void setThreadConfig(const ThreadConfig& config);
+
+/**
+ * Selects when reprojection samples input within a refresh. safetyMargin is
+ * the time in seconds that just-in-time scheduling leaves between the
+ * expected end of reprojection and the next vblank. Can be called at any
+ * time from any thread.
+ */
+void setReprojectionSchedule(ReprojectionSchedule schedule, double safetyMargin = 0.002);
+
+/**
+ * Sets how many slices SCHEDULE_BEAM_RACING draws a refresh in. More
+ * slices latch each pose closer to its scanout, at the cost of drawing the
+ * layers once per slice. Defaults to 4, at least 2. Can be called at any
+ * time from any thread.
+ */
+void setBeamRacingSlices(int slices);
+
+/**
+ * Sets the fraction of the refresh period reprojection's GPU time should stay
+ * under. Going over lowers the quality of reprojection one level at a time,
+ * see ReprojectionQuality, and it is raised again after a while well under
+ * budget. 0 keeps full quality. Defaults to 0.5. Can be called at any time
+ * from any thread.
+ */
+void setReprojectionBudget(double fraction);
+
+/**
+ * When enabled, refreshes where no frame was submitted, the camera pose did
+ * not change, no layer is still extrapolating motion and no input arrived
+ * are not drawn or presented, so the display keeps showing the last image
+ * and the GPU can idle. Drawing resumes on the
+ * next change. Enabled by default. Can be called at any time from any
+ * thread.
+ */
+void setIdleDetection(bool enabled);
+
+/**
+ * When enabled, a refresh whose swap comes in after its vblank is shown at
+ * once, tearing near the top of the display, instead of being held back a
+ * whole refresh, so a late refresh only adds the time it was late by.
+ * Needs WGL_EXT_swap_control_tear or GLX_EXT_swap_control_tear. Without
+ * them swaps stay synchronized and getFrameStats counts no torn refreshes.
+ * Disabled by default. Can be called at any time from any thread.
+ */
+void setAdaptiveVsync(bool enabled);
+
+/**
+ * Whether the window's context has adaptive vsync, false until
+ * startReprojection has checked
+ */
+bool isAdaptiveVsyncSupported();
+
+/**
+ * For G-Sync, FreeSync and other variable refresh displays. When enabled,
+ * reprojection stops refreshing on a fixed cadence: a frame the app submits
+ * is reprojected and presented as soon as it arrives, and refreshes without
+ * a new frame are only drawn when the app is late, once minRefreshRate's
+ * period has passed since the last present, or at the display's full rate
+ * while the cursor is captured or keys are held. The display has to be in
+ * its variable refresh mode, usually by the window covering it, which GL
+ * can't query, so this is the app's call. Disabled by default. Can be
+ * called at any time from any thread.
+ */
+void setVariableRefresh(bool enabled, double minRefreshRate = 40);
+
+/**
+ * Where an output window looks, relative to the camera pose
+ */
+struct OutputView {
+    glm::quat orientation = glm::quat(1, 0, 0, 0);
+    glm::vec3 position = glm::vec3(0);
+};
+
+/**
+ * Adds a window that reprojection also presents to, besides the one
+ * current when startReprojection is called, for example the side monitors
+ * of a simulator. Every refresh reprojects the same latched frame for each
+ * window from the camera pose offset by its view, with the window's aspect
+ * ratio and the vertical field of view of updateProjection, so the pose is
+ * evaluated once for all of them. The window has to be created sharing
+ * objects with the main window (glfwCreateWindow's share argument), and
+ * only shows what the submitted layers cover, so side views need wide or
+ * cube map layers. Windows swap right after the main one without waiting
+ * for their own vblank, the main window paces them all. Returns the index
+ * for setOutputView, or -1. Call from the main thread before
+ * startReprojection
+ */
+int addOutputWindow(GLFWwindow* outputWindow, const OutputView& view);
+
+/**
+ * Changes where an output window looks. Can be called at any time from any
+ * thread
+ */
+void setOutputView(int index, const OutputView& view);
+
+/**
+ * Output of a reprojection run that shows nothing, see setHeadless
+ */
+struct HeadlessOutput {
+    bool enabled = false;
+    int width = 1920;
+    int height = 1080;
+    // refreshes are paced to this rate, as if a display's vblanks did
+    double refreshRate = 60;
+};
+
+/**
+ * Runs reprojection without showing anything, for benchmarks and
+ * regression runs on machines nobody watches. The window is hidden and each
+ * refresh is drawn into an offscreen target of the output's size, then
+ * waited on and held until the next simulated vblank in place of the swap.
+ * The app thread gets its context from arp as usual, and captures
+ * (startCapture) read the offscreen target. GLFW still needs a display
+ * server to make the context, a virtual one like Xvfb will do. Call before
+ * startReprojection
+ */
+void setHeadless(const HeadlessOutput& output);
+
+/**
+ * When enabled, parallax rays are marched through the closest depth of each
+ * layer at half its resolution, built with the depth pyramid once per
+ * submitted frame, and a hit is refined with one fetch of the full
+ * resolution depth. It reads a quarter of the texels and doesn't branch
+ * between pyramid levels, which suits GPUs where the hierarchical march
+ * diverges, at the cost of skipping empty space less. Color is still
+ * sampled at full resolution. Disabled by default. Can be called at any
+ * time from any thread.
+ */
+void setHalfResolutionMarch(bool enabled);
+
+/**
+ * Shows or hides the options overlay. Hidden, it costs reprojection nothing.
+ * Builds with ARP_NO_OVERLAY defined have no overlay and ignore this. Can be
+ * called at any time from any thread.
+ */
+void setOverlayEnabled(bool enabled);
+
+/**
+ * Sets how many times a second the overlay is rebuilt, 30 by default. In
+ * between, its last image is composited over the layers. Can be called at
+ * any time from any thread.
+ */
+void setOverlayRate(double rate);
+
+/**
+ * Selects the model used by getPredictedDisplayTime and
+ * getPredictedCameraPose. Can be called at any time from any thread.
+ */
+void setPosePredictor(PosePredictor predictor);
+
+/**
+ * Tunes prediction online, off by default. On each new frame's first
+ * refresh, the rotation and movement the frame's pose predicted since the
+ * pose it was predicted from are compared to the camera's actual ones. Two
+ * gains are then fitted by least squares over the recent frames: one scales
+ * the extrapolated mouse movement, the other the time held keys count as
+ * held. Predictions that keep falling short or overshooting are scaled to
+ * match, so reprojection has less to correct. Frames must be rendered for
+ * their predicted pose. Pose sources and PREDICTOR_POSE_EXTRAPOLATION aren't
+ * tuned. The errors and gains are in FrameStats. Can be called at any time
+ * from any thread
+ */
+void setPredictionTuning(bool enabled);
+
+/**
+ * Returns the pose that should be used to render the next frame
+ */
+void getCameraPose(Pose& pose, PoseInfo& poseInfo);
+
+/**
+ * Returns the estimated time that the next frame will reach the display.
+ * The submit time is extrapolated from previous frames, the GPU's measured
+ * tail after a submit is added, see setAppGpuTimePercentile, then it is
+ * moved to the vblank of the first refresh to latch it. Vblanks are fitted to present
+ * timestamps from the platform where it reports them, otherwise to the
+ * times swaps complete
  */
 double getPredictedDisplayTime();
 
@@ -207,22 +2221,646 @@ double getPredictedDisplayTime();
  * Returns the pose that should be used to render the next frame
  * 
  * ARP will attempt to predict where the user-controlled pose will be by the
- * time rendering is done. 
+ * time rendering is done. Each call predicts from its own copy of
+ * reprojection's latest state, so threads can predict at the same time
  */
 void getPredictedCameraPose(double time, Pose& pose, PoseInfo& poseInfo);
 
 /**
- * Submits frame
+ * Poses count evenly spaced steps along the predicted path from time until
+ * horizon seconds later, for loading what the camera will see before it
+ * sees it. Held keys are taken to stay held for the whole horizon, but the
+ * mouse's extrapolation only holds for a fraction of a second, after which
+ * the view keeps its last predicted direction
+ */
+void getPredictedTrajectory(double time, double horizon, Pose* poses, int count);
+
+/**
+ * Predicts the pose at each query's time, like n calls of
+ * getPredictedCameraPose, but from one copy of reprojection's state and
+ * with one call of a BatchPoseFunction. poseInfo, if given, is set to the
+ * info every pose was predicted from
+ */
+void evaluatePoses(const PoseQuery* queries, Pose* out, std::size_t n, PoseInfo* poseInfo = nullptr);
+
+/**
+ * Widens view, the frustum the user sees, into the frustum a layer rendered
+ * at pose should cover. The camera's predicted rotation from displayTime
+ * until the next app frame is shown decides how far each edge moves, so a
+ * still camera gets view back unchanged and a turning one gets an
+ * off-center frustum that extends in the direction of the turn. Pass the
+ * result as the layer's projection
+ */
+LayerProjection getGuardBandProjection(const Pose& pose, double displayTime, const LayerProjection& view);
+
+/**
+ * Parts of each face of a size by size cube map layer at layerPose that
+ * the guard band projection of view at pose covers, as
+ * getGuardBandProjection widens it. Render and commit only these and the
+ * layer still shows everything reprojection can turn to before the next
+ * frame. Merge the regions of each eye for stereo
+ */
+CubeMapRegions getCubeMapRegions(const Pose& layerPose, const Pose& pose, double displayTime,
+                                 const LayerProjection& view, int size);
+
+/**
+ * Narrows the frustum of a layer rendered at pose to the part that layers
+ * rendered with the same projection keep covering while the camera turns
+ * as predicted until the next app frame is shown. Each edge moves in by the
+ * turn, so a still camera gets projection back unchanged. Pass the result
+ * to maskCoveredDepth. The result has left >= right or bottom >= top when
+ * nothing stays covered
+ */
+LayerProjection getCoveredProjection(const Pose& pose, double displayTime, const LayerProjection& projection);
+
+/**
+ * Writes the nearest depth into the bound framebuffer wherever the
+ * covering frustum at coveringPose lies in front. The framebuffer belongs
+ * to a layer rendered at layerPose with layerProjection. Only directions
+ * count, as if both layers were rendered from the same point. Call it after
+ * clearing depth and before drawing. With the depth test on, early depth
+ * testing then rejects what the covering layer hides, and only the rest is
+ * shaded. Color is left as cleared. Runs on the context current on the
+ * calling thread and compiles its program there on the first call. The
+ * program, vertex array, depth function and write masks are put back
+ */
+void maskCoveredDepth(const Pose& layerPose, const LayerProjection& layerProjection, const Pose& coveringPose,
+                      const LayerProjection& covering);
+
+/**
+ * Near and far planes fitted to the depth of the layer last submitted at
+ * the layer index, for the layer's next projection: half the distance of
+ * its nearest pixel and one and a half times that of its farthest, for
+ * what moves in or out until the next frame. Measured from the top of the
+ * layer's depth pyramid and read back without waiting for the GPU, so a
+ * frame or two late, and only for layers with depth that reprojection
+ * builds a pyramid for. Pixels at the far plane, such as a cleared
+ * background, push far out and clipped geometry is not seen, so clamp the
+ * result to the range the scene may need. Returns false until a layer at
+ * the index has been measured. Can be called from any thread
+ */
+bool getRecommendedDepthRange(int layerIndex, float& nearPlane, float& farPlane);
+
+/**
+ * Sets the percentile of the app's last 32 measured GPU frame times that
+ * getPredictedDisplayTime and waitForNextAppFrame plan with, 0.9 by
+ * default. Higher is later but safer when the scene's load changes. Can be
+ * called at any time from any thread
+ */
+void setAppGpuTimePercentile(double percentile);
+
+/**
+ * Sets how many submitted frames the GPU can still be rendering when
+ * waitForNextAppFrame lets the next one start, so a CPU-bound app can build
+ * a frame while the GPU renders the ones before it. Each frame is aimed at
+ * a display time of its own, further ahead the more frames are queued
+ * before it, and predicts its pose for that time. Defaults to 1, at most
+ * 4. Can be called at any time from any thread
+ */
+void setFramesInFlight(int frames);
+
+/**
+ * Paces the application loop at getTargetFramerate(), or at framerate when
+ * it is positive. Sleeps until the next frame has to start to finish
+ * rendering just in time for its display, using ARP's estimate of the app's
+ * frame cost and the display's vblanks. Returns the display time the frame
+ * is aimed at, for getPredictedCameraPose. Waits for the GPU to finish
+ * earlier frames first while setFramesInFlight of them are unfinished. Call
+ * once per frame, before getting the pose
+ */
+double waitForNextAppFrame(int framerate = 0);
+
+/**
+ * Marks a point between render passes of an application frame where its GPU
+ * work can be split, for drivers that can't preempt a long submission. If
+ * the next pass would still be on the GPU when reprojection submits its next
+ * refresh, going by the app's GPU time per pass in the last frame, the work
+ * so far is flushed and this waits until reprojection has submitted, so the
+ * reprojection draw doesn't queue behind the app's. Returns right away
+ * otherwise. Call from the application context
+ */
+void yieldPoint();
+
+/**
+ * Submits frame. Copies it into the frame acquireFrameSubmitInfo would
+ * return, then submits that like submitFrame()
+ */
+std::uint64_t submitFrame(const FrameSubmitInfo& submitInfo);
+
+/**
+ * Returns the frame the next submitFrame() submits, with no layers, for the
+ * application to fill in place. Its pose and poseInfo are left over from an
+ * earlier frame. Application thread only
+ */
+FrameSubmitInfo& acquireFrameSubmitInfo();
+
+/**
+ * Submits the frame returned by acquireFrameSubmitInfo, handing it to
+ * reprojection without copying or allocating. The application must not
+ * touch it afterwards. Depth and velocity images the layers' flags don't
+ * have reprojection read are invalidated, so tiled GPUs never write them
+ * out, and hold undefined contents when acquired again. Returns the frame's
+ * FrameSubmitInfo::submission
+ */
+std::uint64_t submitFrame();
+
+/**
+ * Returns whether a layer at the layer index rendered into the swapchain's
+ * image of the given index can be submitted with damage: the image last
+ * submitted at that index is another image of the same swapchain and size,
+ * to copy the undamaged rest from, and glCopyImageSubData is supported.
+ * Otherwise the whole image has to be rendered, as it does for cube maps
+ * and CHECKERBOARD_ENABLED or TEMPORAL_ACCUMULATION_ENABLED layers, whose
+ * damage submitFrame ignores. Application thread only
+ */
+bool canSubmitDamage(int layerIndex, const Swapchain* swapchain, int swapchainIndex);
+
+/**
+ * Submits a frame with the given pose that keeps every layer of the last
+ * submitted frame, as if each was KEEP_PREVIOUS_IMAGE, for frames where
+ * nothing the application would render has changed, e.g. a still camera
+ * over a static scene. The application renders nothing and reprojection
+ * goes on from the poses the kept images were rendered with. Like any
+ * submitFrame it resets reprojection's input deltas to poseInfo, so pass
+ * the pose the frame would have been rendered with. Does nothing before the
+ * first submitFrame. Application thread only
+ */
+void resubmitFrame(const Pose& pose, const PoseInfo& poseInfo);
+
+/**
+ * See setFrameCache
+ */
+struct FrameCacheSettings {
+    // bytes of swapchain images the cache may hold on to, 0 turns it off
+    std::int64_t budgetBytes = 0;
+    // how far, in units and radians, a pose may be from the pose each layer
+    // of a cached frame was rendered with for the frame to be reused.
+    // Caching a frame replaces the cached frames of its scene version whose
+    // layers are all this close to its own
+    float positionTolerance = 0.01f;
+    float angleTolerance = 0.005f;
+};
+
+/**
+ * Keeps submitted frames for viewpoints that come back, as menus, orbit
+ * and turntable cameras and attract loops do. cacheSubmittedFrame adds the
+ * last submitted frame under its layers' poses and the application's scene
+ * version, and submitCachedFrame resubmits a cached frame near the pose
+ * instead of a new one. A cached frame holds its swapchain images, which count
+ * against budgetBytes; the least recently used frames go first. At least
+ * three images of every swapchain are left to acquire, so swapchains need
+ * one more image per frame they should be able to cache. Turning the cache
+ * off releases every frame. Application thread only
+ */
+void setFrameCache(const FrameCacheSettings& settings);
+
+/**
+ * Caches the frame last submitted under the pose each of its layers was
+ * rendered with, kept layers included, and sceneVersion, which the
+ * application bumps whenever what it renders changes other than by the
+ * camera. Layers submitted by other threads are left to those threads
+ * when the frame is reused. Returns false if the cache is off or can't hold
+ * the frame. Application thread only
+ */
+bool cacheSubmittedFrame(std::uint64_t sceneVersion);
+
+/**
+ * If a frame of sceneVersion was cached within the tolerances of pose,
+ * submits it like resubmitFrame would the last frame and returns true, so
+ * the application can skip rendering. Returns false otherwise. Application
+ * thread only
+ */
+bool submitCachedFrame(const Pose& pose, const PoseInfo& poseInfo, std::uint64_t sceneVersion);
+
+/**
+ * Releases every cached frame, for example before deleting swapchains
+ * they hold images of. Application thread only
  */
-void submitFrame(const FrameSubmitInfo& submitInfo);
+void clearFrameCache();
 
 /**
  * Stops the reprojection thread and cleans up any resources used.
  */
 void shutdown();
 
+/**
+ * Returns the latest timing measurements. Can be called from any thread
+ */
+FrameStats getFrameStats();
+
+/**
+ * Adds bytes, or removes them if negative, to what the application uses in
+ * a category, so GpuMemoryStats covers its allocations too. Can be called
+ * from any thread
+ */
+void trackGpuMemory(GpuMemoryCategory category, std::int64_t bytes);
+
+/**
+ * Returns the GPU memory tracked per category and what the driver reports,
+ * updated a few times a second by reprojection. Can be called from any
+ * thread
+ */
+GpuMemoryStats getGpuMemoryStats();
+
+/**
+ * Puts reprojection under memory pressure while the tracked total is over
+ * budgetBytes, or the driver reports less than minAvailableBytes available.
+ * Under pressure frame history beyond the latched frame is dropped first,
+ * which frees the retained depth pyramids and hands the images back to the
+ * swapchains; an app watching GpuMemoryStats::underPressure can shrink its
+ * swapchains next. 0 turns either limit off, both are off by default. Can
+ * be called at any time from any thread
+ */
+void setGpuMemoryBudget(std::int64_t budgetBytes, std::int64_t minAvailableBytes = 0);
+
+/**
+ * Sets how reprojection saves power, by default it doesn't. While saving,
+ * layers are reprojected for rotation only, refreshes where nothing changed
+ * are skipped as with idle detection, and waitForNextAppFrame paces the app
+ * at most at savingFramerate. Every refresh is still reprojected while
+ * anything moves, so head rotation stays at the display rate. Can be called
+ * at any time from any thread
+ */
+void setPowerMode(const PowerSettings& settings);
+
+/**
+ * Returns the last power reading and what reprojection does about it. Can
+ * be called from any thread
+ */
+PowerState getPowerState();
+
+/**
+ * Turns latency measurement on or off, see getLatencyHistogram. With marker
+ * set, every refresh draws a square in the bottom left corner, white on
+ * refreshes whose input has a new key press and black otherwise, so a
+ * photodiode on the corner can check the measurement against the display.
+ * Works with scripted input from setInputOverride too. Can be called at any
+ * time from any thread.
+ */
+void setLatencyMeasurement(bool enabled, bool marker = false);
+
+/**
+ * Returns the latencies measured since measurement was turned on or the
+ * histogram was last reset. Can be called from any thread
+ */
+LatencyHistogram getLatencyHistogram();
+
+void resetLatencyHistogram();
+
+/**
+ * Compares what reprojection shows for pose with an image the application
+ * rendered at pose with the projection given to updateProjection, such as
+ * a ground truth rendered at the display rate next to a lower rate frame
+ * stream. On its next refresh reprojection draws its current frame for pose
+ * off screen and compares the two on the GPU, without delaying the refresh,
+ * see getQualityStats. The acquired image is handed over and released once
+ * compared, and a newer call replaces an image still waiting. Called by the
+ * application thread
+ */
+void submitGroundTruth(Swapchain* swapchain, int swapchainIndex, const Pose& pose);
+
+/**
+ * Returns the comparisons made since the last reset. Can be called from any
+ * thread
+ */
+QualityStats getQualityStats();
+
+void resetQualityStats();
+
+/**
+ * What reprojectTexture warps, and where to
+ */
+struct TextureReprojectInfo {
+    // color and depth of an image rendered at sourcePose, both width by
+    // height 2D textures. The depth is read as sourceProjection.depthMapping
+    // says
+    std::uint32_t source = 0;
+    std::uint32_t sourceDepth = 0;
+    int width = 0;
+    int height = 0;
+    Pose sourcePose;
+    LayerProjection sourceProjection;
+    // RGBA texture written with the image as seen from pose through
+    // projection
+    std::uint32_t destination = 0;
+    int destinationWidth = 0;
+    int destinationHeight = 0;
+    Pose pose;
+    LayerProjection projection;
+};
+
+/**
+ * Reprojects a texture to another pose with the same depth pyramid march
+ * as parallax layers, for reusing an earlier image in the application's
+ * own temporal techniques. Texels the source doesn't cover, such as
+ * disocclusions, are left 0, alpha included. Runs on the context current on
+ * the calling thread and leaves its framebuffer, viewport, program, vertex
+ * array and uniform buffer binding as they were; texture bindings of units
+ * 0, 1 and 4 are changed. The first call on a thread compiles its own copies
+ * of the programs, from the same sources and permutations reprojection uses
+ */
+void reprojectTexture(const TextureReprojectInfo& info);
+
+/**
+ * How startCapture saves frames
+ */
+enum CaptureFormat {
+    // a PNG file per frame, named path followed by the frame's number
+    CAPTURE_FORMAT_PNG = 0,
+    // one file of RGBA8 frames, top row first with no header, at the size of
+    // the first frame. Frames of another size are dropped. ffmpeg reads it
+    // with -f rawvideo -pixel_format rgba -video_size <width>x<height>
+    CAPTURE_FORMAT_RAW = 1,
+};
+
+struct CaptureSettings {
+    CaptureFormat format = CAPTURE_FORMAT_PNG;
+    // one in this many presented frames is captured
+    int interval = 1;
+};
+
+struct CaptureStats {
+    // frames written since the capture started
+    std::uint64_t captured = 0;
+    // frames skipped because every readback buffer was in flight, or the
+    // writer couldn't save them
+    std::uint64_t dropped = 0;
+    bool active = false;
+};
+
+/**
+ * Saves the frames reprojection presents, overlay included, to path. Each
+ * refresh only issues a copy of the window into a pixel buffer, which is
+ * read back a few refreshes later and saved by a thread of its own, so
+ * capturing barely adds to the refresh's latency. Frames are dropped
+ * rather than waited for when the writer falls behind, PNG encoding easily
+ * does at full resolution. Refreshes that present nothing new aren't
+ * captured. Takes effect on the next refresh, replacing a capture in
+ * progress. Returns false if a raw capture's file can't be written. Can be
+ * called from any thread
+ */
+bool startCapture(const char* path, const CaptureSettings& settings = CaptureSettings());
+
+/**
+ * Stops capturing on the next refresh, after saving the frames in flight
+ */
+void stopCapture();
+
+CaptureStats getCaptureStats();
+
+enum StatsExportTarget {
+    // gauges sent as StatsD lines, one UDP datagram per interval
+    STATS_EXPORT_STATSD = 0,
+    // the Prometheus text format, served over HTTP to any path on port
+    STATS_EXPORT_PROMETHEUS = 1,
+};
+
+struct StatsExportSettings {
+    StatsExportTarget target = STATS_EXPORT_STATSD;
+    // StatsD server, Prometheus listens on every interface instead
+    const char* host = "127.0.0.1";
+    // UDP port of the StatsD server, or the TCP port Prometheus scrapes
+    int port = 8125;
+    // seconds rates and percentiles are measured over, and between StatsD
+    // updates
+    double interval = 10;
+    // start of every metric name
+    const char* prefix = "arp";
+};
+
+/**
+ * Publishes reprojection health for fleet monitoring, each metric measured
+ * over the last interval: the presented refresh rate and display rate in
+ * Hz, missed vblanks, the 50th, 99th and max reprojection GPU time in ms,
+ * app frames per second, the mean swapchain wait per app frame in ms, the
+ * mean rotation in degrees reprojection corrected on each new frame's first
+ * refresh, which is the prediction error when frames are rendered for their
+ * predicted display pose, the mean distance its position was off by on those
+ * refreshes, and the GPU memory tracked and available in
+ * bytes. Reprojection only adds to atomic counters, a thread of the
+ * exporter reads and publishes them. Replaces an export in progress.
+ * Returns false if the socket can't be made. Can be called from any thread
+ */
+bool startStatsExport(const StatsExportSettings& settings = StatsExportSettings());
+
+void stopStatsExport();
+
+/**
+ * Kind of stutter a JankEvent reports
+ */
+enum JankType {
+    // a refresh was presented a vblank or more late
+    JANK_MISSED_VBLANK = 0,
+    // one app frame was reprojected for more than
+    // JankDetection::staleRefreshes refreshes
+    JANK_STALE_FRAME = 1,
+    // acquireImage waited longer than JankDetection::maxSwapchainWait
+    JANK_SWAPCHAIN_WAIT = 2,
+};
+
+/**
+ * What the timing instrumentation points to as the reason for a JankEvent
+ */
+enum JankCause {
+    JANK_CAUSE_UNKNOWN = 0,
+    // the pose function took over half the refresh, or missed its budget
+    JANK_CAUSE_LATE_POSE_FUNCTION = 1,
+    // reprojection's GPU work started late or ran long, behind other work
+    // on the GPU
+    JANK_CAUSE_GPU_CONTENTION = 2,
+    // the swap blocked for longer than a refresh
+    JANK_CAUSE_SWAP_BLOCKING = 3,
+    // the app didn't submit a new frame in time
+    JANK_CAUSE_APP_LATE = 4,
+};
+
+struct JankEvent {
+    JankType type;
+    JankCause cause;
+    // glfwGetTime() of the swap or the end of the wait
+    double time;
+    // seconds since the previous swap, the app frame was shown or the wait
+    // took
+    double duration;
+    // of the refresh, or the latest one for swapchain waits. GPU times are
+    // a refresh behind, as their queries are read a refresh later
+    double poseEvaluationTime;
+    double reprojectionCpuTime;
+    double reprojectionGpuTime;
+    double reprojectionGpuDelay;
+    double swapTime;
+    double refreshPeriod;
+    // refreshes the newest app frame has been reprojected for
+    int staleRefreshes;
+};
+
+/**
+ * Called with each JankEvent on the thread that detected it, the
+ * reprojection thread or the one that acquired, so it should return quickly
+ */
+typedef void (*JankCallback)(const JankEvent& event, void* userData);
+
+struct JankDetection {
+    bool enabled = false;
+    int staleRefreshes = 8;
+    double maxSwapchainWait = 0.004;
+    JankCallback callback = nullptr;
+    void* userData = nullptr;
+};
+
+/**
+ * Detects the stutters averages hide: missed vblanks, app frames
+ * reprojected for too many refreshes and long acquireImage waits. Each
+ * event is attributed to a cause from the refresh's timings and pushed to a
+ * lock free queue of a few hundred events, dropping events while it is
+ * full, and passed to the callback. Detection only compares timings that
+ * are measured anyway, so it costs nothing while nothing is wrong. Off by
+ * default. Call before startReprojection
+ */
+void setJankDetection(const JankDetection& settings);
+
+/**
+ * Moves up to max of the oldest queued jank events into events and returns
+ * how many. Can be called from any thread
+ */
+int readJankEvents(JankEvent* events, int max);
+
+/**
+ * Jank events dropped because the queue was full
+ */
+std::uint64_t getDroppedJankEvents();
+
+/**
+ * Which app frame a presented refresh showed, and with which pose. All times
+ * are glfwGetTime() values, ages are in seconds
+ */
+struct PresentedRefresh {
+    // counts presented refreshes from 1. Idle refreshes present nothing and
+    // get no number, see setIdleDetection
+    std::uint64_t refresh;
+    // when the refresh sampled input and latched, and when its swap returned
+    double latchTime;
+    double presentTime;
+    // FrameSubmitInfo::submission of the app frame reprojected, 0 before
+    // the first frame
+    std::uint64_t frame;
+    // refreshes the frame was reprojected for before this one, 0 on the
+    // refresh that latched it
+    int staleRefreshes;
+    // the pose the frame was rendered with and the camera pose it was
+    // reprojected to
+    Pose framePose;
+    Pose pose;
+    // from the frame's submitFrame, and from its PoseInfo::time, to
+    // presentTime
+    double frameAge;
+    double poseAge;
+    // from sampling input to presentTime
+    double inputAge;
+    // whether the swap came late enough to have missed a vblank
+    bool missed;
+};
+
+/**
+ * Copies up to max of the presented refreshes recorded since position into
+ * refreshes, oldest first, and advances position past them. Start with
+ * position 0. The newest few hundred are kept, older ones are skipped. Can
+ * be called from any thread
+ */
+int readPresentedRefreshes(PresentedRefresh* refreshes, int max, std::uint64_t& position);
+
+/**
+ * Writes the trace markers ARP's threads recorded, the newest few thousand
+ * of each thread, to path as Chrome trace JSON, which chrome://tracing and
+ * Perfetto open. Every thread gets a CPU track and a GPU track. Only builds
+ * with ARP_TRACE defined record markers, others return false. Returns false
+ * if the file could not be written. Can be called from any thread
+ */
+bool writeTrace(const char* path);
+
+/**
+ * Scoped GPU profiling zone for the application's own passes. Times the GL
+ * commands issued while it lives, in the current context, with a pair of
+ * timestamp queries from a pool of the calling thread's, and wraps them in
+ * a KHR_debug group of the same name for RenderDoc, Nsight and the like.
+ * Zones nest. Results are read back without waiting, once the GPU has them,
+ * summed per app frame, as submitFrame delimits them, for getGpuZoneTimings
+ * and the overlay, and with ARP_TRACE recorded on the thread's GPU track
+ * for writeTrace next to reprojection's. name must be a string literal,
+ * only its pointer is kept:
+ *
+ *     {
+ *         arp::GpuZone zone("shadows");
+ *         renderShadows();
+ *     }
+ */
+class GpuZone {
+private:
+    // the pool's query pair, -1 when the zone isn't timed
+    int slot;
+    bool debugGroup;
+
+public:
+    explicit GpuZone(const char* name);
+    ~GpuZone();
+
+    GpuZone(const GpuZone&) = delete;
+    GpuZone& operator=(const GpuZone&) = delete;
+};
+
+struct GpuZoneTiming {
+    const char* name;
+    // GPU seconds of every zone of the name in the last app frame whose
+    // results are in, and their mean over recent frames
+    double lastFrame;
+    double mean;
+};
+
+/**
+ * Copies up to max of the GpuZone names seen so far with their times into
+ * timings, in the order first seen, and returns how many. Can be called
+ * from any thread
+ */
+int getGpuZoneTimings(GpuZoneTiming* timings, int max);
+
+/**
+ * Runtime options, set from the overlay or with setRuntimeSettings
+ */
+struct RuntimeSettings {
+    bool reprojection;
+    bool background;
+    bool parallax;
+    bool gridWarp;
+    bool prediction;
+    bool frozen;
+    int targetFramerate;
+    // grows with every change, see waitForStateChange
+    std::uint64_t version;
+};
+
+/**
+ * Returns a consistent copy of the runtime options. Can be called from any
+ * thread
+ */
+RuntimeSettings getRuntimeSettings();
+
+/**
+ * Replaces the runtime options, version is ignored. Can be called from any
+ * thread
+ */
+void setRuntimeSettings(const RuntimeSettings& settings);
+
+/**
+ * Blocks until the runtime options are no longer at the given version, or
+ * until timeout seconds have passed if it isn't negative, and returns them.
+ * Lets an application sleep while frozen instead of polling getFrozen.
+ * Shutdown also wakes waiting threads. Can be called from any thread
+ */
+RuntimeSettings waitForStateChange(std::uint64_t version, double timeout = -1);
+
 int getTargetFramerate();
 bool getParallaxToggle();
+bool getGridWarpToggle();
 bool getReprojectionToggle();
 bool getBackgroundToggle();
 bool getPredictionToggle();
@@ -0,0 +1,297 @@
+/**
+ * Times ARP's and the demo's hot paths. Run from the source directory, the
+ * assets and shaders are loaded from there
+ *
+ * Usage: arp_microbench [--filter <substring>] [--min-time <seconds>]
+ */
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include "cyTriMesh.h"
+#include "stb_image.h"
+
+struct PoseData {
+    double rotationX;
+    double rotationY;
+};
+#include "arp.h"
+#include "renderobject.h"
+#include "arpmesh.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * A timed operation. run does the operation the given number of times
+ */
+struct Benchmark {
+    std::string name;
+    std::function<void(std::uint64_t iterations)> run;
+};
+
+static std::vector<Benchmark> benchmarks;
+static double minTime = 0.2;
+static const int repetitions = 5;
+
+// results are written here so the compiler keeps the work that made them
+static volatile double sink;
+
+static void addBenchmark(const std::string& name, std::function<void(std::uint64_t)> run) {
+    benchmarks.push_back({ name, std::move(run) });
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * Grows the iteration count until a run takes minTime, then reports the
+ * median and fastest of several runs per iteration
+ */
+static void runBenchmark(const Benchmark& benchmark) {
+    std::uint64_t iterations = 1;
+    while(true) {
+        auto start = std::chrono::steady_clock::now();
+        benchmark.run(iterations);
+        double elapsed = secondsSince(start);
+        if(elapsed >= minTime || iterations >= (std::uint64_t)1 << 40)
+            break;
+        // aim a little past minTime so the next run is usually the last
+        double scale = elapsed > 0 ? minTime * 1.2 / elapsed : 10;
+        iterations = std::max(iterations + 1, (std::uint64_t)(iterations * std::min(scale, 10.0)));
+    }
+
+    std::vector<double> times;
+    for(int i = 0; i < repetitions; i++) {
+        auto start = std::chrono::steady_clock::now();
+        benchmark.run(iterations);
+        times.push_back(secondsSince(start) / iterations);
+    }
+    std::sort(times.begin(), times.end());
+    std::printf("%-48s %14.1f ns %14.1f ns %12llu\n", benchmark.name.c_str(), times[repetitions / 2] * 1e9,
+                times[0] * 1e9, (unsigned long long)iterations);
+}
+
+/**
+ * Same as the demo's, so prediction pays for a realistic pose function
+ */
+static arp::Pose poseFunction(const arp::Pose& lastPose, double dx, double dy, double dt,
+                              arp::KeyTimeFunction keyTime) {
+    arp::Pose result;
+    PoseData& angles = result.payload<PoseData>();
+    const PoseData& last = lastPose.payload<PoseData>();
+    angles.rotationX = last.rotationX - 0.001 * dy;
+    angles.rotationY = last.rotationY - 0.001 * dx;
+    result.orientation = glm::quat(glm::vec3(0, angles.rotationY, 0))
+                       * glm::quat(glm::vec3(angles.rotationX, 0, 0));
+
+    glm::vec3 movement(0);
+    movement.x += 10 * (keyTime(GLFW_KEY_D) - keyTime(GLFW_KEY_A));
+    movement.z += 10 * (keyTime(GLFW_KEY_S) - keyTime(GLFW_KEY_W));
+    movement = glm::rotate(glm::mat4(1), (float)angles.rotationY, glm::vec3(0.f, 1.f, 0.f))
+             * glm::vec4(movement, 1);
+    result.position = lastPose.position + movement;
+    return result;
+}
+
+static void addPoseBenchmarks() {
+    addBenchmark("pose function", [](std::uint64_t iterations) {
+        arp::Pose pose;
+        for(std::uint64_t i = 0; i < iterations; i++)
+            pose = poseFunction(pose, 1, 1, 1.0 / 60, [](int) { return 1.0 / 60; });
+        sink = pose.position.x;
+    });
+    addBenchmark("getPredictedCameraPose", [](std::uint64_t iterations) {
+        arp::Pose pose;
+        arp::PoseInfo poseInfo;
+        double time = glfwGetTime();
+        for(std::uint64_t i = 0; i < iterations; i++)
+            arp::getPredictedCameraPose(time + 0.016, pose, poseInfo);
+        sink = pose.position.x;
+    });
+    addBenchmark("evaluatePoses, 4 queries", [](std::uint64_t iterations) {
+        arp::PoseQuery queries[4];
+        arp::Pose poses[4];
+        double time = glfwGetTime();
+        for(int i = 0; i < 4; i++)
+            queries[i].time = time + 0.016 * (i + 1);
+        for(std::uint64_t i = 0; i < iterations; i++)
+            arp::evaluatePoses(queries, poses, 4);
+        sink = poses[3].position.x;
+    });
+    addBenchmark("getPredictedDisplayTime", [](std::uint64_t iterations) {
+        double total = 0;
+        for(std::uint64_t i = 0; i < iterations; i++)
+            total += arp::getPredictedDisplayTime();
+        sink = total;
+    });
+}
+
+static void addSwapchainBenchmarks() {
+    addBenchmark("Swapchain acquire/release", [](std::uint64_t iterations) {
+        static arp::Swapchain swapchain(256, 256, 3);
+        for(std::uint64_t i = 0; i < iterations; i++)
+            swapchain.releaseImage(swapchain.acquireImage());
+    });
+    // another thread retains and releases images the way reprojection does
+    // with the frames it holds, fighting over the swapchain's lock
+    addBenchmark("Swapchain acquire/release, contended", [](std::uint64_t iterations) {
+        static arp::Swapchain swapchain(256, 256, 3);
+        std::atomic<bool> done{false};
+        std::thread other([&]() {
+            while(!done.load(std::memory_order_relaxed)) {
+                for(int i = 0; i < swapchain.numImages; i++) {
+                    swapchain.retainImage(i);
+                    swapchain.releaseImage(i);
+                }
+            }
+        });
+        for(std::uint64_t i = 0; i < iterations; i++)
+            swapchain.releaseImage(swapchain.acquireImage());
+        done = true;
+        other.join();
+    });
+    // with nothing latching frames, every submit retires the unlatched frame
+    // it gets back, so images come free again
+    addBenchmark("submitFrame, 1 layer", [](std::uint64_t iterations) {
+        static arp::Swapchain swapchain(256, 256, 5);
+        for(std::uint64_t i = 0; i < iterations; i++) {
+            arp::FrameSubmitInfo& submitInfo = arp::acquireFrameSubmitInfo();
+            arp::FrameLayer layer;
+            layer.flags = arp::NONE;
+            layer.fov = M_PI / 2;
+            layer.swapchain = &swapchain;
+            layer.swapchainIndex = swapchain.acquireImage();
+            submitInfo.layers.push_back(layer);
+            arp::submitFrame();
+        }
+    });
+}
+
+static const char* objAssets[] = {
+    "crate.obj", "minecartTipW1.obj", "pileStone1.obj", "pileStone2.obj", "pileStone3.obj", "pileStone4.obj",
+    "teapot.obj", "tileFloor1W1.obj", "tileFloor2W1.obj", "tileFloor3W1.obj", "tileFloor4W1.obj",
+};
+
+static const char* pngAssets[] = {
+    "crate.png", "minecartTipW1.png", "pileStone1.png", "pileStone2.png", "pileStone3.png", "pileStone4.png",
+    "tileFloor1W1.png", "tileFloor2W1.png", "tileFloor3W1.png", "tileFloor4W1.png",
+};
+
+static void addAssetBenchmarks() {
+    for(const char* file : objAssets) {
+        addBenchmark(std::string("LoadFromFileObj ") + file, [file](std::uint64_t iterations) {
+            for(std::uint64_t i = 0; i < iterations; i++) {
+                cy::TriMesh mesh;
+                if(!mesh.LoadFromFileObj(file, false))
+                    std::cout << "Error: Unable to load " << file << std::endl;
+                sink = mesh.NF();
+            }
+        });
+        addBenchmark(std::string("loadObj ") + file, [file](std::uint64_t iterations) {
+            for(std::uint64_t i = 0; i < iterations; i++) {
+                cy::TriMesh mesh;
+                loadObj(file, mesh, false);
+                sink = mesh.NF();
+            }
+        });
+    }
+    for(const char* file : pngAssets) {
+        addBenchmark(std::string("stbi_load ") + file, [file](std::uint64_t iterations) {
+            for(std::uint64_t i = 0; i < iterations; i++) {
+                int width, height, channels;
+                unsigned char* pixels = stbi_load(file, &width, &height, &channels, 0);
+                if(!pixels)
+                    std::cout << "Error: Unable to load " << file << std::endl;
+                sink = width;
+                stbi_image_free(pixels);
+            }
+        });
+    }
+}
+
+static void addRenderObjectBenchmarks() {
+    addBenchmark("renderobject::updateMatrices", [](std::uint64_t iterations) {
+        static renderobject object((char*)"crate.obj", 0, 0, 0);
+        arp::Pose pose;
+        for(std::uint64_t i = 0; i < iterations; i++) {
+            pose.orientation = glm::quat(glm::vec3(0, i * 1e-3f, 0));
+            object.updateMatrices(pose, 16.0 / 9.0, M_PI / 2);
+        }
+    });
+    // the demo's tile floor, which is most of its objects
+    addBenchmark("renderbatch::update, 100 objects", [](std::uint64_t iterations) {
+        static std::vector<renderobject> objects;
+        static renderbatch batch;
+        if(objects.empty()) {
+            for(int i = 0; i < 100; i++)
+                objects.push_back(renderobject((char*)"tileFloor1W1.obj", (i % 10) * 6.2, -10, (i / 10) * 12.4));
+            for(renderobject& object : objects)
+                batch.add(object);
+        }
+        arp::Pose pose;
+        for(std::uint64_t i = 0; i < iterations; i++) {
+            pose.orientation = glm::quat(glm::vec3(0, i * 1e-3f, 0));
+            batch.update(pose);
+        }
+    });
+}
+
+int main(int argc, char *argv[]) {
+    std::string filter;
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(arg == "--filter" && i + 1 < argc)
+            filter = argv[++i];
+        else if(arg == "--min-time" && i + 1 < argc)
+            minTime = std::stod(argv[++i]);
+    }
+
+    if(!glfwInit()) {
+        std::cout << "Unable to initialize GLFW" << std::endl;
+        return -1;
+    }
+    // swapchains, submitFrame and renderobject need a context, nothing is
+    // ever shown
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow* window = glfwCreateWindow(256, 256, "arp_microbench", NULL, NULL);
+    if(!window) {
+        std::cout << "Unable to create window" << std::endl;
+        return -1;
+    }
+    glfwMakeContextCurrent(window);
+    if(arp::initialize() != 0) {
+        std::cout << "Unable to initialize arp" << std::endl;
+        return -1;
+    }
+    arp::registerPoseFunction(poseFunction);
+    arp::updateProjection(0.1, 100, M_PI / 2, 16.0 / 9.0);
+
+    addPoseBenchmarks();
+    addSwapchainBenchmarks();
+    addAssetBenchmarks();
+    addRenderObjectBenchmarks();
+
+    std::printf("%-48s %17s %17s %12s\n", "benchmark", "median", "fastest", "iterations");
+    for(const Benchmark& benchmark : benchmarks) {
+        if(benchmark.name.find(filter) != std::string::npos)
+            runBenchmark(benchmark);
+    }
+
+    glfwDestroyWindow(window);
+    glfwTerminate();
+    return 0;
+}
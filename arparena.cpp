@@ -0,0 +1,72 @@
+#include "arparena.h"
+
+#include <algorithm>
+
+namespace arp {
+
+// the first block, later ones are at least the size of all before them
+static const std::size_t MIN_BLOCK_SIZE = 64 * 1024;
+
+void TransientArena::addBlock(std::size_t size) {
+    Block added;
+    added.data.reset(new unsigned char[size]);
+    added.size = size;
+    blocks.push_back(std::move(added));
+    blockAllocations++;
+}
+
+void* TransientArena::allocate(std::size_t size, std::size_t alignment) {
+    if(blocks.empty())
+        addBlock(std::max(MIN_BLOCK_SIZE, size + alignment));
+    while(true) {
+        Block& current = blocks[block];
+        std::uintptr_t start = (std::uintptr_t)current.data.get() + offset;
+        std::size_t padding = (alignment - start % alignment) % alignment;
+        if(offset + padding + size <= current.size) {
+            offset += padding + size;
+            used += padding + size;
+            highWater = std::max(highWater, used);
+            return (void*)(start + padding);
+        }
+        // the rest of the block is skipped for the next one, which is added
+        // when there is none
+        used += current.size - offset;
+        if(block + 1 == blocks.size())
+            addBlock(std::max(getCapacity(), size + alignment));
+        block++;
+        offset = 0;
+    }
+}
+
+void TransientArena::rewind(const Marker& marker) {
+    block = marker.block;
+    offset = marker.offset;
+    used = marker.used;
+}
+
+void TransientArena::reset() {
+    // one block the size of them all serves the next frame without growing
+    if(blocks.size() > 1) {
+        std::size_t capacity = getCapacity();
+        blocks.clear();
+        block = 0;
+        addBlock(capacity);
+    }
+    block = 0;
+    offset = 0;
+    used = 0;
+}
+
+std::size_t TransientArena::getCapacity() const {
+    std::size_t capacity = 0;
+    for(const Block& current : blocks)
+        capacity += current.size;
+    return capacity;
+}
+
+TransientArena& transientArena() {
+    static thread_local TransientArena arena;
+    return arena;
+}
+
+};
@@ -0,0 +1,127 @@
+#ifndef ARPARENA_H
+#define ARPARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace arp {
+
+/**
+ * Linear allocator for data that doesn't outlive a frame. Allocations bump
+ * a pointer through blocks that are kept between frames, and are freed all
+ * at once by reset at the end of the frame, or by a TransientScope when the
+ * function that made them returns. Once the blocks cover a frame's peak,
+ * reset folds them into one and the arena stops allocating, which
+ * getBlockAllocations shows.
+ *
+ * Every thread has an arena of its own, see transientArena
+ */
+class TransientArena {
+private:
+    struct Block {
+        std::unique_ptr<unsigned char[]> data;
+        std::size_t size;
+    };
+
+    std::vector<Block> blocks;
+    // block and offset within it the next allocation starts at
+    std::size_t block = 0;
+    std::size_t offset = 0;
+    std::size_t used = 0;
+    std::size_t highWater = 0;
+    std::uint64_t blockAllocations = 0;
+
+    void addBlock(std::size_t size);
+
+public:
+    /**
+     * Where the arena is, to free what was allocated after it with rewind
+     */
+    struct Marker {
+        std::size_t block;
+        std::size_t offset;
+        std::size_t used;
+    };
+
+    TransientArena() = default;
+    TransientArena(const TransientArena&) = delete;
+    TransientArena& operator=(const TransientArena&) = delete;
+
+    /**
+     * Returns size bytes aligned to alignment, a power of two. Never null
+     */
+    void* allocate(std::size_t size, std::size_t alignment);
+
+    Marker mark() const { return { block, offset, used }; }
+    void rewind(const Marker& marker);
+
+    /**
+     * Frees everything. Call at the end of a frame, with no TransientScope
+     * open
+     */
+    void reset();
+
+    // bytes of every block
+    std::size_t getCapacity() const;
+    // most bytes in use at once, counting the skipped ends of blocks
+    std::size_t getHighWater() const { return highWater; }
+    // blocks allocated from the heap so far, constant in a steady state
+    std::uint64_t getBlockAllocations() const { return blockAllocations; }
+};
+
+/**
+ * The calling thread's arena. arp resets the reprojection thread's after
+ * each refresh and the app thread's in waitForNextAppFrame, other threads
+ * free theirs with TransientScope
+ */
+TransientArena& transientArena();
+
+/**
+ * Frees what the calling thread's arena allocated while the scope was open
+ */
+class TransientScope {
+private:
+    TransientArena& arena;
+    TransientArena::Marker marker;
+
+public:
+    TransientScope() : arena(transientArena()), marker(arena.mark()) {}
+    ~TransientScope() { arena.rewind(marker); }
+    TransientScope(const TransientScope&) = delete;
+    TransientScope& operator=(const TransientScope&) = delete;
+};
+
+/**
+ * STL allocator drawing from an arena, the calling thread's by default.
+ * deallocate does nothing, memory comes back when the arena rewinds or
+ * resets, so containers using it must not outlive that
+ */
+template<typename T>
+class TransientAllocator {
+public:
+    typedef T value_type;
+
+    TransientArena* arena;
+
+    TransientAllocator() : arena(&transientArena()) {}
+    explicit TransientAllocator(TransientArena& arena) : arena(&arena) {}
+    template<typename U>
+    TransientAllocator(const TransientAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(std::size_t n) { return (T*)arena->allocate(n * sizeof(T), alignof(T)); }
+    void deallocate(T*, std::size_t) {}
+
+    template<typename U>
+    bool operator==(const TransientAllocator<U>& other) const { return arena == other.arena; }
+    template<typename U>
+    bool operator!=(const TransientAllocator<U>& other) const { return arena != other.arena; }
+};
+
+template<typename T>
+using TransientVector = std::vector<T, TransientAllocator<T>>;
+
+};
+
+#endif // ARPARENA_H
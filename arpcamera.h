@@ -0,0 +1,213 @@
+#ifndef ARPCAMERA_H
+#define ARPCAMERA_H
+
+#include "arp.h"
+#include "arparena.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace arp {
+
+/**
+ * Built-in camera controllers. Each is a class template over a settings
+ * struct of static constexpr members, so speeds and keys are compile time
+ * constants, and has a static pose function giving the pose in closed form
+ * from the last pose, the mouse movement and how long each of its keys was
+ * held. No state lives outside the pose: yaw and pitch are read back from
+ * the orientation, so the controllers need no PoseData. Held keys and mouse
+ * movement add up linearly, so evaluating over dt once or as any number of
+ * steps gives the same pose, pitch limits aside.
+ *
+ * Register one with registerPoseFunction(cameraPoseFunction<Controller>),
+ * a BatchPoseFunction that evaluates every entry of a batch with the
+ * controller inlined. To change a setting, derive from the default settings
+ * and hide the member:
+ *
+ *     struct FastFly : FirstPersonCameraSettings {
+ *         static constexpr bool fly = true;
+ *         static constexpr float speed = 40;
+ *     };
+ *     registerPoseFunction(cameraPoseFunction<FirstPersonCamera<FastFly>>);
+ */
+
+// keeps pitch off the poles, where yaw can't be read back
+static constexpr float CAMERA_MAX_PITCH = 1.55f;
+
+/**
+ * Yaw about the vertical axis and pitch about the camera's horizontal one of
+ * an orientation without roll, as made by cameraOrientation
+ */
+inline void cameraYawPitch(const glm::quat& orientation, float& yaw, float& pitch) {
+    glm::vec3 forward = orientation * glm::vec3(0, 0, -1);
+    yaw = std::atan2(-forward.x, -forward.z);
+    pitch = std::asin(glm::clamp(forward.y, -1.0f, 1.0f));
+}
+
+inline glm::quat cameraOrientation(float yaw, float pitch) {
+    return glm::angleAxis(yaw, glm::vec3(0, 1, 0)) * glm::angleAxis(pitch, glm::vec3(1, 0, 0));
+}
+
+struct FirstPersonCameraSettings {
+    // moves along the view direction, pitch included, rather than level
+    static constexpr bool fly = false;
+    // units per second
+    static constexpr float speed = 10;
+    // radians per unit of mouse movement
+    static constexpr float turnRate = -0.001f;
+    static constexpr int forwardKey = GLFW_KEY_W;
+    static constexpr int backKey = GLFW_KEY_S;
+    static constexpr int leftKey = GLFW_KEY_A;
+    static constexpr int rightKey = GLFW_KEY_D;
+    static constexpr int upKey = GLFW_KEY_SPACE;
+    static constexpr int downKey = GLFW_KEY_LEFT_SHIFT;
+};
+
+/**
+ * Mouse look with WASD movement, level with the ground or along the view
+ * direction when flying, and straight up and down on two more keys
+ */
+template<class Settings = FirstPersonCameraSettings>
+struct FirstPersonCamera {
+    enum { KEY_COUNT = 6 };
+
+    static int key(int slot) {
+        const int keys[KEY_COUNT] = { Settings::forwardKey, Settings::backKey, Settings::leftKey,
+                                      Settings::rightKey, Settings::upKey, Settings::downKey };
+        return keys[slot];
+    }
+
+    /**
+     * keyTimes[slot] is how long key(slot) was held
+     */
+    static Pose pose(const Pose& lastPose, double dx, double dy, const double* keyTimes) {
+        float yaw, pitch;
+        cameraYawPitch(lastPose.orientation, yaw, pitch);
+        yaw += (float)(Settings::turnRate * dx);
+        pitch = glm::clamp(pitch + (float)(Settings::turnRate * dy), -CAMERA_MAX_PITCH, CAMERA_MAX_PITCH);
+
+        Pose result = lastPose;
+        result.orientation = cameraOrientation(yaw, pitch);
+        glm::vec3 movement((float)(keyTimes[3] - keyTimes[2]), 0, (float)(keyTimes[1] - keyTimes[0]));
+        movement = (Settings::fly ? result.orientation : glm::angleAxis(yaw, glm::vec3(0, 1, 0))) * movement;
+        movement.y += (float)(keyTimes[4] - keyTimes[5]);
+        result.position = lastPose.position + (float)Settings::speed * movement;
+        return result;
+    }
+};
+
+struct OrbitCameraSettings {
+    // the point orbited
+    static constexpr float targetX = 0;
+    static constexpr float targetY = 0;
+    static constexpr float targetZ = 0;
+    static constexpr float turnRate = -0.003f;
+    // the distance shrinks by a factor e every 1 / zoomRate seconds zooming in
+    static constexpr float zoomRate = 1;
+    static constexpr float minDistance = 0.5f;
+    static constexpr float maxDistance = 100;
+    static constexpr int inKey = GLFW_KEY_W;
+    static constexpr int outKey = GLFW_KEY_S;
+};
+
+/**
+ * Turns around a fixed target with the mouse, always facing it, and zooms
+ * exponentially toward and away from it on two keys
+ */
+template<class Settings = OrbitCameraSettings>
+struct OrbitCamera {
+    enum { KEY_COUNT = 2 };
+
+    static int key(int slot) {
+        return slot == 0 ? Settings::inKey : Settings::outKey;
+    }
+
+    static Pose pose(const Pose& lastPose, double dx, double dy, const double* keyTimes) {
+        glm::vec3 target(Settings::targetX, Settings::targetY, Settings::targetZ);
+        float yaw, pitch;
+        cameraYawPitch(lastPose.orientation, yaw, pitch);
+        yaw += (float)(Settings::turnRate * dx);
+        pitch = glm::clamp(pitch + (float)(Settings::turnRate * dy), -CAMERA_MAX_PITCH, CAMERA_MAX_PITCH);
+
+        float distance = glm::length(lastPose.position - target);
+        distance *= std::exp(-Settings::zoomRate * (float)(keyTimes[0] - keyTimes[1]));
+        distance = glm::clamp(distance, (float)Settings::minDistance, (float)Settings::maxDistance);
+
+        Pose result = lastPose;
+        result.orientation = cameraOrientation(yaw, pitch);
+        result.position = target + result.orientation * glm::vec3(0, 0, distance);
+        return result;
+    }
+};
+
+struct VehicleCameraSettings {
+    // units per second
+    static constexpr float speed = 15;
+    // radians per second of steering
+    static constexpr float steerRate = 1.2f;
+    // radians of pitch per unit of mouse movement
+    static constexpr float lookRate = -0.001f;
+    static constexpr int forwardKey = GLFW_KEY_W;
+    static constexpr int backKey = GLFW_KEY_S;
+    static constexpr int leftKey = GLFW_KEY_A;
+    static constexpr int rightKey = GLFW_KEY_D;
+};
+
+/**
+ * Drives level on two keys and steers on two others, the mouse only looks
+ * up and down. Driving and steering together trace a circular arc, which
+ * the pose follows exactly however long the step
+ */
+template<class Settings = VehicleCameraSettings>
+struct VehicleCamera {
+    enum { KEY_COUNT = 4 };
+
+    static int key(int slot) {
+        const int keys[KEY_COUNT] = { Settings::forwardKey, Settings::backKey, Settings::leftKey,
+                                      Settings::rightKey };
+        return keys[slot];
+    }
+
+    static Pose pose(const Pose& lastPose, double dx, double dy, const double* keyTimes) {
+        float heading, pitch;
+        cameraYawPitch(lastPose.orientation, heading, pitch);
+        pitch = glm::clamp(pitch + (float)(Settings::lookRate * dy), -CAMERA_MAX_PITCH, CAMERA_MAX_PITCH);
+
+        float distance = Settings::speed * (float)(keyTimes[0] - keyTimes[1]);
+        float turn = Settings::steerRate * (float)(keyTimes[2] - keyTimes[3]);
+        // the chord of the arc runs along the mean heading, sin(x) / x of
+        // its half angle shorter than the arc
+        float half = turn / 2;
+        float chord = std::abs(half) > 1e-4f ? distance * std::sin(half) / half : distance;
+        float direction = heading + half;
+
+        Pose result = lastPose;
+        result.position.x -= chord * std::sin(direction);
+        result.position.z -= chord * std::cos(direction);
+        result.orientation = cameraOrientation(heading + turn, pitch);
+        return result;
+    }
+};
+
+/**
+ * BatchPoseFunction evaluating Controller for every entry of the batch
+ */
+template<class Controller>
+void cameraPoseFunction(const PoseBatch& batch, Pose* poses) {
+    const int keyCount = Controller::KEY_COUNT;
+    TransientScope scope;
+    TransientVector<double> keyTimes(batch.count * keyCount);
+    for(int slot = 0; slot < keyCount; slot++)
+        batch.getKeyTimes(Controller::key(slot), keyTimes.data() + slot * batch.count);
+
+    double entryKeyTimes[keyCount];
+    for(std::size_t i = 0; i < batch.count; i++) {
+        for(int slot = 0; slot < keyCount; slot++)
+            entryKeyTimes[slot] = keyTimes[slot * batch.count + i];
+        poses[i] = Controller::pose(batch.lastPose, batch.dx[i], batch.dy[i], entryKeyTimes);
+    }
+}
+
+};
+
+#endif // ARPCAMERA_H
@@ -0,0 +1,271 @@
+#include "arpcapture.h"
+#include "arpstate.h"
+
+// GLFW ships stb_image_write with its tests, static so it can't clash with
+// an app's copy
+#define STB_IMAGE_WRITE_STATIC
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+namespace arp {
+
+FrameCapture::~FrameCapture() {
+    if(writer.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            writerStopping = true;
+            cond.notify_all();
+        }
+        writer.join();
+    }
+}
+
+bool FrameCapture::start(const char* path, const CaptureSettings& settings) {
+    if(settings.format == CAPTURE_FORMAT_RAW) {
+        std::ofstream file(path, std::ios::binary);
+        if(!file) {
+            std::cout << "Error: could not write the capture " << path << std::endl;
+            return false;
+        }
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    startPending = true;
+    stopPending = false;
+    pendingPath = path;
+    pendingSettings = settings;
+    pendingSettings.interval = std::max(pendingSettings.interval, 1);
+    return true;
+}
+
+void FrameCapture::stop() {
+    std::lock_guard<std::mutex> lock(mutex);
+    startPending = false;
+    stopPending = true;
+}
+
+void FrameCapture::begin() {
+    if(settings.format == CAPTURE_FORMAT_RAW) {
+        rawFile.open(path, std::ios::binary);
+        if(!rawFile) {
+            std::cout << "Error: could not write the capture " << path << std::endl;
+            return;
+        }
+        rawWidth = 0;
+        rawHeight = 0;
+    }
+    presentedFrames = 0;
+    captured = 0;
+    dropped = 0;
+    writerStopping = false;
+    writer = std::thread(&FrameCapture::writeLoop, this);
+    active = true;
+}
+
+void FrameCapture::end() {
+    if(!active)
+        return;
+    collect(true);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        writerStopping = true;
+        cond.notify_all();
+    }
+    writer.join();
+    if(rawFile.is_open())
+        rawFile.close();
+    active = false;
+}
+
+/**
+ * Hands the slots whose copy has finished to the writer, in the order they
+ * were copied. With wait, waits for all of them
+ */
+void FrameCapture::collect(bool wait) {
+    while(!inFlight.empty()) {
+        Slot& slot = slots[inFlight.front()];
+        GLenum status = glClientWaitSync(slot.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+                                         wait ? GL_TIMEOUT_IGNORED : 0);
+        if(status == GL_TIMEOUT_EXPIRED)
+            return;
+        glDeleteSync(slot.fence);
+        slot.fence = 0;
+        if(!slot.mapping) {
+            std::size_t size = (std::size_t)slot.width * slot.height * 4;
+            slot.pixels.resize(size);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+            const void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+            if(data) {
+                std::memcpy(slot.pixels.data(), data, size);
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        }
+        slot.writing = true;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queued.push_back(inFlight.front());
+            cond.notify_all();
+        }
+        inFlight.pop_front();
+    }
+}
+
+void FrameCapture::capture(GLuint framebuffer, int width, int height) {
+    bool starting, stopping;
+    std::string startPath;
+    CaptureSettings startSettings;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        starting = startPending;
+        stopping = startPending || stopPending;
+        startPath = pendingPath;
+        startSettings = pendingSettings;
+        startPending = false;
+        stopPending = false;
+    }
+    if(stopping)
+        end();
+    if(starting) {
+        // the writer of the capture that ended used these
+        path = startPath;
+        settings = startSettings;
+        begin();
+    }
+    if(!active || width <= 0 || height <= 0)
+        return;
+    collect(false);
+    std::uint64_t frame = presentedFrames++;
+    if(frame % settings.interval != 0)
+        return;
+
+    Slot* slot = nullptr;
+    for(Slot& candidate : slots) {
+        if(!candidate.fence && !candidate.writing.load(std::memory_order_acquire)) {
+            slot = &candidate;
+            break;
+        }
+    }
+    if(!slot) {
+        dropped++;
+        return;
+    }
+
+    std::size_t size = (std::size_t)width * height * 4;
+    if(slot->capacity < size) {
+        glDeleteBuffers(1, &slot->buffer);
+        slot->mapping = nullptr;
+        glGenBuffers(1, &slot->buffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->buffer);
+        if(GLEW_ARB_buffer_storage) {
+            GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_PIXEL_PACK_BUFFER, size, nullptr, flags);
+            slot->mapping = (const unsigned char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, flags);
+            if(!slot->mapping) {
+                // storage is immutable, reading it back needs a buffer of its own
+                glDeleteBuffers(1, &slot->buffer);
+                glGenBuffers(1, &slot->buffer);
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->buffer);
+            }
+        }
+        if(!slot->mapping)
+            glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+        slot->capacity = size;
+    }
+    else {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->buffer);
+    }
+
+    glState().bindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot->width = width;
+    slot->height = height;
+    slot->frame = frame;
+    inFlight.push_back((int)(slot - slots));
+}
+
+void FrameCapture::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        startPending = false;
+        stopPending = false;
+    }
+    end();
+    for(Slot& slot : slots) {
+        glDeleteBuffers(1, &slot.buffer);
+        slot.buffer = 0;
+        slot.capacity = 0;
+        slot.mapping = nullptr;
+        slot.pixels = std::vector<unsigned char>();
+    }
+}
+
+void FrameCapture::writeLoop() {
+    while(true) {
+        int index;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [&]() { return writerStopping || !queued.empty(); });
+            if(queued.empty())
+                return;
+            index = queued.front();
+            queued.pop_front();
+        }
+        write(slots[index]);
+        slots[index].writing.store(false, std::memory_order_release);
+    }
+}
+
+/**
+ * Writes a slot's frame top row first, as images and videos are stored
+ */
+void FrameCapture::write(Slot& slot) {
+    const unsigned char* pixels = slot.mapping ? slot.mapping : slot.pixels.data();
+    std::size_t row = (std::size_t)slot.width * 4;
+    flipped.resize(row * slot.height);
+    for(int y = 0; y < slot.height; y++)
+        std::memcpy(flipped.data() + row * y, pixels + row * (slot.height - 1 - y), row);
+    // the window's alpha is whatever reprojection left in it
+    for(std::size_t i = 3; i < flipped.size(); i += 4)
+        flipped[i] = 255;
+
+    if(settings.format == CAPTURE_FORMAT_RAW) {
+        if(rawWidth == 0) {
+            rawWidth = slot.width;
+            rawHeight = slot.height;
+        }
+        // a raw video has one size
+        if(slot.width != rawWidth || slot.height != rawHeight) {
+            dropped++;
+            return;
+        }
+        rawFile.write((const char*)flipped.data(), flipped.size());
+    }
+    else {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%06llu.png", (unsigned long long)slot.frame);
+        std::string file = path + name;
+        if(!stbi_write_png(file.c_str(), slot.width, slot.height, 4, flipped.data(), (int)row)) {
+            std::cout << "Error: could not write " << file << std::endl;
+            dropped++;
+            return;
+        }
+    }
+    captured++;
+}
+
+CaptureStats FrameCapture::getStats() const {
+    CaptureStats stats;
+    stats.captured = captured;
+    stats.dropped = dropped;
+    stats.active = active;
+    return stats;
+}
+
+};
@@ -0,0 +1,122 @@
+#ifndef ARPCAPTURE_H
+#define ARPCAPTURE_H
+
+#include "arp.h"
+
+#include <GL/glew.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace arp {
+
+/**
+ * Saves presented frames without stalling the thread presenting them. Each
+ * captured frame is copied from the back buffer into a pixel buffer of a
+ * small ring, and once its fence has signaled a few refreshes later, handed
+ * to a writer thread that encodes it. With ARB_buffer_storage the buffers
+ * stay mapped and the writer reads them directly, so a refresh only issues
+ * the copy. Without it the buffer is mapped and copied out on the
+ * presenting thread. Frames are dropped when every buffer is in flight.
+ *
+ * start and stop are called from any thread, capture from the thread
+ * presenting, with its context current
+ */
+class FrameCapture {
+private:
+    struct Slot {
+        GLuint buffer = 0;
+        std::size_t capacity = 0;
+        // persistent mapping, null without ARB_buffer_storage
+        const unsigned char* mapping = nullptr;
+        // the pixels copied out of an unmapped buffer
+        std::vector<unsigned char> pixels;
+        // set while the GPU copies into the buffer
+        GLsync fence = 0;
+        int width = 0;
+        int height = 0;
+        std::uint64_t frame = 0;
+        // set while the writer uses the slot
+        std::atomic<bool> writing{false};
+    };
+
+    static const int slotCount = 4;
+    Slot slots[slotCount];
+    // slots the GPU copies into, oldest first
+    std::deque<int> inFlight;
+
+    // guards the fields below, cond signals queued slots and stop
+    std::mutex mutex;
+    std::condition_variable cond;
+    // start or stop waiting for the presenting thread
+    bool startPending = false;
+    bool stopPending = false;
+    std::string pendingPath;
+    CaptureSettings pendingSettings;
+    // slots handed to the writer, oldest first
+    std::deque<int> queued;
+    bool writerStopping = false;
+
+    std::atomic<bool> active{false};
+    // used by the presenting thread and, while capturing, the writer
+    std::string path;
+    CaptureSettings settings;
+    std::ofstream rawFile;
+    int rawWidth = 0;
+    int rawHeight = 0;
+    std::thread writer;
+    std::uint64_t presentedFrames = 0;
+    std::vector<unsigned char> flipped;
+
+    std::atomic<std::uint64_t> captured{0};
+    std::atomic<std::uint64_t> dropped{0};
+
+    void begin();
+    void end();
+    void collect(bool wait);
+    void writeLoop();
+    void write(Slot& slot);
+
+public:
+    ~FrameCapture();
+
+    /**
+     * Starts capturing to path on the next capture call, replacing a
+     * capture in progress. Returns false if a raw capture's file can't be
+     * written
+     */
+    bool start(const char* path, const CaptureSettings& settings);
+
+    /**
+     * Stops on the next capture call, after writing the frames in flight
+     */
+    void stop();
+
+    /**
+     * Copies the framebuffer presented, 0 for the back buffer, of the given
+     * size if this frame is captured, and hands earlier copies that have
+     * finished to the writer. Call after drawing each presented frame,
+     * before the swap
+     */
+    void capture(GLuint framebuffer, int width, int height);
+
+    /**
+     * Writes the frames in flight and deletes the buffers. Call from the
+     * presenting thread before its context is destroyed
+     */
+    void shutdown();
+
+    CaptureStats getStats() const;
+};
+
+};
+
+#endif // ARPCAPTURE_H
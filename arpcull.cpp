@@ -0,0 +1,184 @@
+#include "arpcull.h"
+
+#include <algorithm>
+
+namespace arp {
+
+// hierarchy leaves hold at most this many boxes
+static const int LEAF_SIZE = 4;
+
+enum CullResult {
+    CULL_OUTSIDE,
+    CULL_INTERSECTING,
+    CULL_INSIDE,
+};
+
+Frustum extractFrustum(const glm::mat4& viewProjection) {
+    // rows of the matrix, glm stores columns
+    glm::vec4 rows[4];
+    for(int i = 0; i < 4; i++)
+        rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+
+    Frustum frustum;
+    for(int axis = 0; axis < 3; axis++) {
+        frustum.planes[axis * 2] = rows[3] + rows[axis];
+        frustum.planes[axis * 2 + 1] = rows[3] - rows[axis];
+    }
+    for(glm::vec4& plane : frustum.planes)
+        plane /= glm::length(glm::vec3(plane));
+    return frustum;
+}
+
+static CullResult classify(const Frustum& frustum, const AABB& box) {
+    CullResult result = CULL_INSIDE;
+    for(const glm::vec4& plane : frustum.planes) {
+        glm::vec3 normal(plane);
+        // corners furthest along and against the plane normal
+        glm::vec3 positive = glm::mix(box.min, box.max, glm::greaterThanEqual(normal, glm::vec3(0)));
+        glm::vec3 negative = glm::mix(box.max, box.min, glm::greaterThanEqual(normal, glm::vec3(0)));
+        if(glm::dot(normal, positive) + plane.w < 0)
+            return CULL_OUTSIDE;
+        if(glm::dot(normal, negative) + plane.w < 0)
+            result = CULL_INTERSECTING;
+    }
+    return result;
+}
+
+bool intersects(const Frustum& frustum, const AABB& box) {
+    return classify(frustum, box) != CULL_OUTSIDE;
+}
+
+static AABB merge(const AABB& a, const AABB& b) {
+    return { glm::min(a.min, b.min), glm::max(a.max, b.max) };
+}
+
+void CullingTree::build(const AABB* sourceBoxes, int count) {
+    nodes.clear();
+    boxes.assign(sourceBoxes, sourceBoxes + count);
+    indices.resize(count);
+    for(int i = 0; i < count; i++)
+        indices[i] = i;
+    if(count == 0)
+        return;
+
+    // leaves hold at least two boxes, so there are fewer nodes than boxes
+    nodes.reserve(count);
+    nodes.push_back(Node());
+    parents.assign(1, -1);
+    buildNode(0, 0, count);
+
+    slots.resize(count);
+    leaves.resize(count);
+    for(int i = 0; i < count; i++)
+        slots[indices[i]] = i;
+    for(int node = 0; node < (int)nodes.size(); node++) {
+        for(int i = nodes[node].first; nodes[node].count > 0 && i < nodes[node].first + nodes[node].count; i++)
+            leaves[i] = node;
+    }
+
+    // store the boxes in leaf order so leaves test contiguous memory
+    std::vector<AABB> ordered(count);
+    for(int i = 0; i < count; i++)
+        ordered[i] = boxes[indices[i]];
+    boxes.swap(ordered);
+}
+
+/**
+ * Fills in the node with the boxes indices[first, first + count) and splits
+ * it at the median of its longest axis until the leaves are small
+ */
+void CullingTree::buildNode(int node, int first, int count) {
+    AABB bounds = boxes[indices[first]];
+    AABB centers = { bounds.min + bounds.max, bounds.min + bounds.max };
+    for(int i = first + 1; i < first + count; i++) {
+        const AABB& box = boxes[indices[i]];
+        bounds = merge(bounds, box);
+        centers.min = glm::min(centers.min, box.min + box.max);
+        centers.max = glm::max(centers.max, box.min + box.max);
+    }
+    nodes[node].bounds = bounds;
+
+    if(count <= LEAF_SIZE) {
+        nodes[node].first = first;
+        nodes[node].count = count;
+        return;
+    }
+
+    glm::vec3 extent = centers.max - centers.min;
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+    int half = count / 2;
+    const std::vector<AABB>& all = boxes;
+    std::nth_element(indices.begin() + first, indices.begin() + first + half, indices.begin() + first + count,
+                     [&all, axis](int a, int b) {
+        return all[a].min[axis] + all[a].max[axis] < all[b].min[axis] + all[b].max[axis];
+    });
+
+    // children are stored next to each other
+    int children = nodes.size();
+    nodes[node].first = children;
+    nodes[node].count = 0;
+    nodes.resize(children + 2);
+    parents.resize(children + 2, node);
+    buildNode(children, first, half);
+    buildNode(children + 1, first + half, count - half);
+}
+
+void CullingTree::refit(const int* changed, int changedCount, const AABB* sourceBoxes) {
+    for(int k = 0; k < changedCount; k++) {
+        int slot = slots[changed[k]];
+        boxes[slot] = sourceBoxes[changed[k]];
+        for(int node = leaves[slot]; node >= 0; node = parents[node]) {
+            Node& n = nodes[node];
+            if(n.count > 0) {
+                AABB bounds = boxes[n.first];
+                for(int i = n.first + 1; i < n.first + n.count; i++)
+                    bounds = merge(bounds, boxes[i]);
+                n.bounds = bounds;
+            }
+            else {
+                n.bounds = merge(nodes[n.first].bounds, nodes[n.first + 1].bounds);
+            }
+        }
+    }
+}
+
+void CullingTree::collect(int node, std::vector<int>& visible) const {
+    const Node& n = nodes[node];
+    if(n.count > 0) {
+        visible.insert(visible.end(), indices.begin() + n.first, indices.begin() + n.first + n.count);
+        return;
+    }
+    collect(n.first, visible);
+    collect(n.first + 1, visible);
+}
+
+void CullingTree::cull(const Frustum& frustum, std::vector<int>& visible) const {
+    if(nodes.empty())
+        return;
+
+    int stack[64];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while(stackSize > 0) {
+        const Node& node = nodes[stack[--stackSize]];
+        CullResult result = classify(frustum, node.bounds);
+        if(result == CULL_OUTSIDE)
+            continue;
+        if(result == CULL_INSIDE) {
+            collect(&node - nodes.data(), visible);
+            continue;
+        }
+        if(node.count > 0) {
+            // the leaf straddles the frustum, so test its boxes
+            for(int i = node.first; i < node.first + node.count; i++) {
+                if(intersects(frustum, boxes[i]))
+                    visible.push_back(indices[i]);
+            }
+            continue;
+        }
+        stack[stackSize++] = node.first;
+        stack[stackSize++] = node.first + 1;
+    }
+}
+
+}
@@ -0,0 +1,92 @@
+#ifndef ARPCULL_H
+#define ARPCULL_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+namespace arp {
+
+/**
+ * Axis aligned bounding box
+ */
+struct AABB {
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+/**
+ * The six planes of a view frustum, with normals pointing inside. A point p
+ * is inside a plane when dot(plane, vec4(p, 1)) >= 0
+ */
+struct Frustum {
+    glm::vec4 planes[6];
+};
+
+/**
+ * Extracts the frustum of an OpenGL style view-projection matrix. Boxes in
+ * the space the matrix transforms from can then be tested against it, so
+ * pass projection * view for world space boxes
+ */
+Frustum extractFrustum(const glm::mat4& viewProjection);
+
+/**
+ * Returns false if the box is certainly outside the frustum. Boxes close to
+ * a frustum corner may be reported as visible
+ */
+bool intersects(const Frustum& frustum, const AABB& box);
+
+/**
+ * Bounding volume hierarchy over a set of boxes, for culling scenes with many
+ * objects. Whole subtrees outside the frustum are rejected with one test and
+ * subtrees fully inside are accepted without testing their boxes
+ */
+class CullingTree {
+private:
+    struct Node {
+        AABB bounds;
+        // first child for inner nodes, first entry of indices for leaves
+        int first;
+        // number of boxes in a leaf, 0 for inner nodes
+        int count;
+    };
+
+    std::vector<Node> nodes;
+    // box indices and boxes in leaf order
+    std::vector<int> indices;
+    std::vector<AABB> boxes;
+    // parent of each node, -1 for the root
+    std::vector<int> parents;
+    // position in leaf order of each box, and the leaf at each position
+    std::vector<int> slots;
+    std::vector<int> leaves;
+
+    void buildNode(int node, int first, int count);
+    void collect(int node, std::vector<int>& visible) const;
+
+public:
+    /**
+     * Rebuilds the tree over a copy of the given boxes
+     */
+    void build(const AABB* boxes, int count);
+
+    /**
+     * Copies the boxes of the given indices from boxes, the same array the
+     * tree was built over, and grows or shrinks the nodes above them to
+     * match. Only the changed paths are visited, but the tree keeps its
+     * shape, so culling slows as boxes move far from where it was built
+     */
+    void refit(const int* changed, int changedCount, const AABB* boxes);
+
+    /**
+     * Appends the index of every box that intersects the frustum to visible,
+     * in no particular order
+     */
+    void cull(const Frustum& frustum, std::vector<int>& visible) const;
+
+    int size() const { return indices.size(); }
+};
+
+}
+
+#endif
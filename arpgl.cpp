@@ -0,0 +1,57 @@
+#include "arpgl.h"
+#include "arpstate.h"
+
+namespace arp {
+
+std::uint32_t GLBufferTraits::create() {
+    GLuint name = 0;
+    glGenBuffers(1, &name);
+    return name;
+}
+
+void GLBufferTraits::destroy(std::uint32_t name) {
+    glDeleteBuffers(1, &name);
+}
+
+std::uint32_t GLTextureTraits::create() {
+    GLuint name = 0;
+    glGenTextures(1, &name);
+    return name;
+}
+
+void GLTextureTraits::destroy(std::uint32_t name) {
+    glState().forgetTexture(name);
+    glDeleteTextures(1, &name);
+}
+
+std::uint32_t GLVertexArrayTraits::create() {
+    GLuint name = 0;
+    glGenVertexArrays(1, &name);
+    return name;
+}
+
+void GLVertexArrayTraits::destroy(std::uint32_t name) {
+    glState().forgetVertexArray(name);
+    glDeleteVertexArrays(1, &name);
+}
+
+std::uint32_t GLFramebufferTraits::create() {
+    GLuint name = 0;
+    glGenFramebuffers(1, &name);
+    return name;
+}
+
+void GLFramebufferTraits::destroy(std::uint32_t name) {
+    glState().forgetFramebuffer(name);
+    glDeleteFramebuffers(1, &name);
+}
+
+std::uint32_t GLProgramTraits::create() {
+    return glCreateProgram();
+}
+
+void GLProgramTraits::destroy(std::uint32_t name) {
+    glDeleteProgram(name);
+}
+
+};
@@ -0,0 +1,97 @@
+#ifndef ARPGL_H
+#define ARPGL_H
+
+#include <cstdint>
+
+namespace arp {
+
+// create and delete one kind of GL object. Defined in arpgl.cpp, so this
+// header can be included without GL's
+struct GLBufferTraits {
+    static std::uint32_t create();
+    static void destroy(std::uint32_t name);
+};
+
+struct GLTextureTraits {
+    static std::uint32_t create();
+    static void destroy(std::uint32_t name);
+};
+
+struct GLVertexArrayTraits {
+    static std::uint32_t create();
+    static void destroy(std::uint32_t name);
+};
+
+struct GLFramebufferTraits {
+    static std::uint32_t create();
+    static void destroy(std::uint32_t name);
+};
+
+struct GLProgramTraits {
+    static std::uint32_t create();
+    static void destroy(std::uint32_t name);
+};
+
+/**
+ * Owns the name of a GL object and deletes it when destroyed, so classes
+ * holding GL objects can be moved but not copied into a second owner.
+ * Textures, vertex arrays and framebuffers are also forgotten by the
+ * calling thread's glState. Only create, reset and destroy a handle with
+ * the context it belongs to current
+ */
+template<typename Traits>
+class GLHandle {
+private:
+    std::uint32_t name = 0;
+
+public:
+    GLHandle() = default;
+    // takes ownership of an existing name
+    explicit GLHandle(std::uint32_t name) : name(name) {}
+    ~GLHandle() { reset(); }
+
+    GLHandle(const GLHandle&) = delete;
+    GLHandle& operator=(const GLHandle&) = delete;
+    GLHandle(GLHandle&& other) noexcept : name(other.release()) {}
+    GLHandle& operator=(GLHandle&& other) noexcept {
+        if(this != &other)
+            reset(other.release());
+        return *this;
+    }
+
+    /**
+     * Generates a new object of the handle's kind
+     */
+    static GLHandle create() { return GLHandle(Traits::create()); }
+
+    std::uint32_t get() const { return name; }
+    explicit operator bool() const { return name != 0; }
+
+    /**
+     * Gives up ownership without deleting the object, returning its name
+     */
+    std::uint32_t release() {
+        std::uint32_t released = name;
+        name = 0;
+        return released;
+    }
+
+    /**
+     * Deletes the object held, if any, and takes ownership of replacement
+     */
+    void reset(std::uint32_t replacement = 0) {
+        if(name)
+            Traits::destroy(name);
+        name = replacement;
+    }
+};
+
+typedef GLHandle<GLBufferTraits> GLBuffer;
+typedef GLHandle<GLTextureTraits> GLTexture;
+typedef GLHandle<GLVertexArrayTraits> GLVertexArray;
+typedef GLHandle<GLFramebufferTraits> GLFramebuffer;
+typedef GLHandle<GLProgramTraits> GLProgram;
+
+};
+
+#endif // ARPGL_H
@@ -0,0 +1,150 @@
+#include "arpjobs.h"
+#include "arpthread.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace arp {
+
+// the job system and worker the calling thread works for, if any
+static thread_local const JobSystem* workerSystem = nullptr;
+static thread_local int workerIndex = -1;
+// waits spin this many times before they start sleeping briefly
+static const int SPIN_WAITS = 64;
+
+JobSystem::JobSystem(const JobSystemSettings& settings) {
+    int cores = std::max(1, (int)std::thread::hardware_concurrency());
+    std::vector<int> allowed;
+    for(int core = 0; core < cores; core++) {
+        if(std::find(settings.avoidCores.begin(), settings.avoidCores.end(), core) == settings.avoidCores.end())
+            allowed.push_back(core);
+    }
+    int count = settings.workers > 0 ? settings.workers : std::max(1, (int)allowed.size());
+    for(int i = 0; i < count; i++)
+        workers.emplace_back(new Worker());
+    // only pinned when some cores are avoided, otherwise the OS knows best
+    bool pin = !settings.avoidCores.empty() && !allowed.empty();
+    for(int i = 0; i < count; i++)
+        workers[i]->thread = std::thread(&JobSystem::runWorker, this, i, pin ? allowed[i % allowed.size()] : -1);
+}
+
+JobSystem::~JobSystem() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    sleeping.notify_all();
+    for(std::unique_ptr<Worker>& worker : workers)
+        worker->thread.join();
+}
+
+int JobSystem::currentWorker() const {
+    return workerSystem == this ? workerIndex : -1;
+}
+
+/**
+ * Takes the newest job of a worker's own deque
+ */
+bool JobSystem::pop(int worker, Job& job) {
+    Worker& own = *workers[worker];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if(own.jobs.empty())
+        return false;
+    job = std::move(own.jobs.back());
+    own.jobs.pop_back();
+    queued--;
+    return true;
+}
+
+/**
+ * Takes the oldest job of another deque, starting after the thief's own so
+ * thieves spread over their victims
+ */
+bool JobSystem::steal(int thief, Job& job) {
+    int count = (int)workers.size();
+    for(int i = 1; i <= count; i++) {
+        Worker& victim = *workers[(thief + i) % count];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if(victim.jobs.empty())
+            continue;
+        job = std::move(victim.jobs.front());
+        victim.jobs.pop_front();
+        queued--;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Runs one queued job, the calling worker's own first. Returns false if
+ * there was none
+ */
+bool JobSystem::runOne() {
+    int worker = currentWorker();
+    Job job;
+    if(!(worker >= 0 && pop(worker, job)) && !steal(std::max(worker, 0), job))
+        return false;
+    job.function();
+    job.group->pending.fetch_sub(1, std::memory_order_release);
+    return true;
+}
+
+void JobSystem::runWorker(int index, int core) {
+    workerSystem = this;
+    workerIndex = index;
+    if(core >= 0)
+        pinCurrentThread(core);
+    while(true) {
+        if(runOne())
+            continue;
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleeping.wait(lock, [this]() { return stopping || queued.load() > 0; });
+        if(stopping && queued.load() == 0)
+            return;
+    }
+}
+
+void JobSystem::run(JobGroup& group, std::function<void()> job) {
+    group.pending.fetch_add(1, std::memory_order_relaxed);
+    int worker = currentWorker();
+    if(worker < 0)
+        worker = nextWorker.fetch_add(1, std::memory_order_relaxed) % workers.size();
+    {
+        std::lock_guard<std::mutex> lock(workers[worker]->mutex);
+        workers[worker]->jobs.push_back({ std::move(job), &group });
+        queued++;
+    }
+    // taking the lock orders the push before a sleeping worker's check
+    { std::lock_guard<std::mutex> lock(sleepMutex); }
+    sleeping.notify_one();
+}
+
+void JobSystem::wait(JobGroup& group) {
+    int idle = 0;
+    while(!group.isDone()) {
+        if(runOne()) {
+            idle = 0;
+            continue;
+        }
+        // the group's last jobs are running on other threads
+        if(idle++ < SPIN_WAITS)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+}
+
+void JobSystem::parallelFor(int count, int grain, const std::function<void(int begin, int end)>& body) {
+    grain = std::max(grain, 1);
+    JobGroup group;
+    // the calling thread takes the first range itself
+    for(int begin = grain; begin < count; begin += grain) {
+        int end = std::min(begin + grain, count);
+        run(group, [&body, begin, end]() { body(begin, end); });
+    }
+    if(count > 0)
+        body(0, std::min(grain, count));
+    wait(group);
+}
+
+};
@@ -0,0 +1,108 @@
+#ifndef ARPJOBS_H
+#define ARPJOBS_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace arp {
+
+/**
+ * Jobs forked together and joined with JobSystem::wait
+ */
+class JobGroup {
+private:
+    std::atomic<int> pending{ 0 };
+    friend class JobSystem;
+
+public:
+    bool isDone() const { return pending.load(std::memory_order_acquire) == 0; }
+};
+
+struct JobSystemSettings {
+    // worker threads, <= 0 for one per core not in avoidCores
+    int workers = 0;
+    // logical cores workers stay off, like reprojection's. Workers are
+    // pinned one per remaining core, and left to the OS if there is none
+    std::vector<int> avoidCores;
+};
+
+/**
+ * A small work-stealing scheduler for CPU work. Each worker keeps its jobs
+ * in a deque of its own, running the newest first, and takes the oldest
+ * job of another worker when it runs out, so forked jobs stay on the core
+ * that forked them while there's other work. Jobs forked from threads that
+ * aren't workers are spread over the workers' deques. A thread waiting for
+ * a group runs queued jobs instead of blocking, so jobs may fork and wait
+ * on jobs of their own.
+ *
+ * Every method can be called from any thread
+ */
+class JobSystem {
+private:
+    struct Job {
+        std::function<void()> function;
+        JobGroup* group;
+    };
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    // jobs in every deque, for idle workers to sleep on
+    std::atomic<int> queued{ 0 };
+    std::mutex sleepMutex;
+    std::condition_variable sleeping;
+    bool stopping = false;
+    // deque the next job forked from outside is pushed to
+    std::atomic<unsigned> nextWorker{ 0 };
+
+    void runWorker(int index, int core);
+    int currentWorker() const;
+    bool pop(int worker, Job& job);
+    bool steal(int thief, Job& job);
+    bool runOne();
+
+public:
+    explicit JobSystem(const JobSystemSettings& settings = JobSystemSettings());
+    // runs the jobs still queued before the workers exit
+    ~JobSystem();
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    /**
+     * Forks a job into group. The group must outlive the job
+     */
+    void run(JobGroup& group, std::function<void()> job);
+
+    /**
+     * Runs queued jobs until every job of group has finished
+     */
+    void wait(JobGroup& group);
+
+    /**
+     * Calls body on ranges of at most grain indices covering [0, count) on
+     * the workers and the calling thread, returning once all have run
+     */
+    void parallelFor(int count, int grain, const std::function<void(int begin, int end)>& body);
+
+    int getWorkerCount() const { return (int)workers.size(); }
+};
+
+/**
+ * ARP's job system, started on first use with a worker per core left over
+ * by the reprojection and application cores of setThreadConfig
+ */
+JobSystem& getJobSystem();
+
+};
+
+#endif // ARPJOBS_H
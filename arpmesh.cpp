@@ -0,0 +1,1307 @@
+#include "arpmesh.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+namespace {
+
+/**
+ * Hashes vertices bitwise, so only exactly equal vertices are welded
+ */
+struct VertexHash {
+    std::size_t operator()(const MeshVertex& vertex) const {
+        const std::uint32_t* words = (const std::uint32_t*)&vertex;
+        std::size_t hash = 2166136261u;
+        for(std::size_t i = 0; i < sizeof(MeshVertex) / sizeof(std::uint32_t); i++)
+            hash = (hash ^ words[i]) * 16777619u;
+        return hash;
+    }
+};
+
+struct VertexEqual {
+    bool operator()(const MeshVertex& a, const MeshVertex& b) const {
+        return memcmp(&a, &b, sizeof(MeshVertex)) == 0;
+    }
+};
+
+}
+
+void buildMeshData(cy::TriMesh& mesh, MeshData& data)
+{
+    data.vertices.clear();
+    data.indices.clear();
+    data.materials.clear();
+    data.indices.reserve(mesh.NF() * 3);
+
+    std::unordered_map<MeshVertex, std::uint32_t, VertexHash, VertexEqual> welded;
+    welded.reserve(mesh.NF() * 3);
+
+    for(unsigned int i = 0; i < mesh.NF(); i++) {
+        for(int j = 0; j < 3; j++) {
+            MeshVertex vertex = {};
+            memcpy(vertex.position, &mesh.V(mesh.F(i).v[j]).x, sizeof(vertex.position));
+            if(mesh.HasNormals())
+                memcpy(vertex.normal, &mesh.VN(mesh.FN(i).v[j]).x, sizeof(vertex.normal));
+            if(mesh.HasTextureVertices())
+                memcpy(vertex.uv, &mesh.VT(mesh.FT(i).v[j]).x, sizeof(vertex.uv));
+
+            auto inserted = welded.emplace(vertex, (std::uint32_t)data.vertices.size());
+            if(inserted.second)
+                data.vertices.push_back(vertex);
+            data.indices.push_back(inserted.first->second);
+        }
+    }
+
+    // faces of each material are stored consecutively
+    for(unsigned int i = 0; i < mesh.NM(); i++) {
+        cy::TriMesh::Mtl& mtl = mesh.M(i);
+        ArpMeshMaterial material = {};
+        material.firstIndex = mesh.GetMaterialFirstFace(i) * 3;
+        material.indexCount = mesh.GetMaterialFaceCount(i) * 3;
+        memcpy(material.diffuse, mtl.Kd, sizeof(material.diffuse));
+        if(mtl.map_Kd.data)
+            strncpy(material.diffuseMap, mtl.map_Kd.data, sizeof(material.diffuseMap) - 1);
+        data.materials.push_back(material);
+    }
+
+    // reorder within each material so the ranges stay valid
+    if(data.materials.empty()) {
+        optimizeVertexCache(data.indices.data(), data.indices.size(), data.vertices.size());
+    }
+    for(const ArpMeshMaterial& material : data.materials) {
+        optimizeVertexCache(&data.indices[material.firstIndex], material.indexCount, data.vertices.size());
+    }
+
+    // store vertices in the order they are first drawn
+    std::vector<std::uint32_t> remap(data.vertices.size(), UINT32_MAX);
+    std::vector<MeshVertex> ordered;
+    ordered.reserve(data.vertices.size());
+    for(std::uint32_t& index : data.indices) {
+        if(remap[index] == UINT32_MAX) {
+            remap[index] = ordered.size();
+            ordered.push_back(data.vertices[index]);
+        }
+        index = remap[index];
+    }
+    data.vertices.swap(ordered);
+
+    for(int k = 0; k < 3; k++) {
+        data.boundsMin[k] = data.vertices.empty() ? 0 : data.vertices[0].position[k];
+        data.boundsMax[k] = data.boundsMin[k];
+    }
+    for(const MeshVertex& vertex : data.vertices) {
+        for(int k = 0; k < 3; k++) {
+            data.boundsMin[k] = std::min(data.boundsMin[k], vertex.position[k]);
+            data.boundsMax[k] = std::max(data.boundsMax[k], vertex.position[k]);
+        }
+    }
+
+    data.lods.clear();
+    data.lods.push_back({ 0, (std::uint32_t)data.indices.size(), 0.f });
+}
+
+namespace {
+
+// levels with fewer triangles aren't worth a draw of their own
+const std::size_t MIN_LOD_TRIANGLES = 32;
+// a level has to drop at least this share of the previous level's triangles
+const float MIN_LOD_REDUCTION = 0.2f;
+
+/**
+ * Collapses the triangles of indices onto one vertex per cell of a grid with
+ * cells cellSize wide, each cluster's vertex being the one nearest to the
+ * cluster's mean position. Triangles that collapse to a line or point, and
+ * repeats of a triangle, are dropped
+ */
+void clusterTriangles(const MeshData& data, const std::uint32_t* indices, std::size_t indexCount,
+                      float cellSize, std::vector<std::uint32_t>& clustered)
+{
+    // cells are packed 21 bits per axis, a grid of at most 2^21 cells wide
+    auto cellOf = [&](std::uint32_t index) {
+        std::uint64_t key = 0;
+        for(int k = 0; k < 3; k++) {
+            float offset = (data.vertices[index].position[k] - data.boundsMin[k]) / cellSize;
+            key = key << 21 | std::min((std::uint64_t)offset, (std::uint64_t)0x1FFFFF);
+        }
+        return key;
+    };
+
+    struct Cluster {
+        float sum[3];
+        int count;
+        std::uint32_t vertex;
+        float distance;
+    };
+    std::unordered_map<std::uint64_t, Cluster> clusters;
+    std::vector<std::uint64_t> cells(data.vertices.size(), UINT64_MAX);
+    for(std::size_t i = 0; i < indexCount; i++) {
+        std::uint32_t index = indices[i];
+        if(cells[index] != UINT64_MAX)
+            continue;
+        cells[index] = cellOf(index);
+        Cluster& cluster = clusters.emplace(cells[index], Cluster{ { 0, 0, 0 }, 0, index, INFINITY }).first->second;
+        for(int k = 0; k < 3; k++)
+            cluster.sum[k] += data.vertices[index].position[k];
+        cluster.count++;
+    }
+    for(std::size_t index = 0; index < cells.size(); index++) {
+        if(cells[index] == UINT64_MAX)
+            continue;
+        Cluster& cluster = clusters[cells[index]];
+        float distance = 0;
+        for(int k = 0; k < 3; k++) {
+            float d = data.vertices[index].position[k] - cluster.sum[k] / cluster.count;
+            distance += d * d;
+        }
+        if(distance < cluster.distance) {
+            cluster.distance = distance;
+            cluster.vertex = index;
+        }
+    }
+
+    // rotated so the lowest index comes first, which keeps the winding
+    std::vector<std::array<std::uint32_t, 3>> triangles;
+    for(std::size_t i = 0; i + 2 < indexCount; i += 3) {
+        std::array<std::uint32_t, 3> triangle;
+        for(int j = 0; j < 3; j++)
+            triangle[j] = clusters[cells[indices[i + j]]].vertex;
+        if(triangle[0] == triangle[1] || triangle[1] == triangle[2] || triangle[0] == triangle[2])
+            continue;
+        std::rotate(triangle.begin(), std::min_element(triangle.begin(), triangle.end()), triangle.end());
+        triangles.push_back(triangle);
+    }
+    std::sort(triangles.begin(), triangles.end());
+    triangles.erase(std::unique(triangles.begin(), triangles.end()), triangles.end());
+
+    clustered.clear();
+    for(const std::array<std::uint32_t, 3>& triangle : triangles)
+        clustered.insert(clustered.end(), triangle.begin(), triangle.end());
+}
+
+}
+
+void buildMeshLods(MeshData& data, int maxLods)
+{
+    if(data.lods.size() != 1 || data.vertices.empty())
+        return;
+
+    float extent = 0;
+    for(int k = 0; k < 3; k++)
+        extent = std::max(extent, data.boundsMax[k] - data.boundsMin[k]);
+    if(extent <= 0)
+        return;
+
+    // every level is simplified from the full mesh, so errors don't add up
+    const ArpMeshLod full = data.lods[0];
+    std::vector<std::uint32_t> fullIndices(data.indices.begin() + full.firstIndex,
+                                           data.indices.begin() + full.firstIndex + full.indexCount);
+    std::size_t previousTriangles = full.indexCount / 3;
+    // finest grid tried, in cells along the longest side
+    int resolution = 1 << 10;
+    std::vector<std::uint32_t> clustered;
+    std::vector<std::uint32_t> best;
+    while((int)data.lods.size() < maxLods) {
+        std::size_t target = previousTriangles / 2;
+        if(target < MIN_LOD_TRIANGLES)
+            break;
+
+        // the finest grid that gets down to the target, coarser grids never
+        // keep more triangles
+        int low = 1;
+        int high = resolution;
+        int found = 0;
+        while(low <= high) {
+            int middle = (low + high) / 2;
+            clusterTriangles(data, fullIndices.data(), fullIndices.size(), extent / middle, clustered);
+            if(clustered.size() / 3 <= target) {
+                found = middle;
+                best.swap(clustered);
+                low = middle + 1;
+            } else {
+                high = middle - 1;
+            }
+        }
+        if(found == 0 || best.size() / 3 > previousTriangles * (1 - MIN_LOD_REDUCTION) || best.empty())
+            break;
+
+        optimizeVertexCache(best.data(), best.size(), data.vertices.size());
+        // a vertex is at most a cell diagonal from where it collapsed to
+        float cellSize = extent / found;
+        data.lods.push_back({ (std::uint32_t)data.indices.size(), (std::uint32_t)best.size(),
+                              cellSize * std::sqrt(3.f) });
+        data.indices.insert(data.indices.end(), best.begin(), best.end());
+        previousTriangles = best.size() / 3;
+        resolution = found - 1;
+        if(resolution < 1)
+            break;
+    }
+}
+
+namespace {
+
+/**
+ * Bounds and normal cone of the triangles of a meshlet
+ */
+void finishMeshlet(const MeshData& data, ArpMeshMeshlet& meshlet)
+{
+    const std::uint32_t* indices = &data.indices[meshlet.firstIndex];
+    float lo[3] = { INFINITY, INFINITY, INFINITY };
+    float hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+    for(std::uint32_t i = 0; i < meshlet.indexCount; i++) {
+        const float* position = data.vertices[indices[i]].position;
+        for(int k = 0; k < 3; k++) {
+            lo[k] = std::min(lo[k], position[k]);
+            hi[k] = std::max(hi[k], position[k]);
+        }
+    }
+    float radiusSquared = 0;
+    for(int k = 0; k < 3; k++)
+        meshlet.center[k] = (lo[k] + hi[k]) * 0.5f;
+    for(std::uint32_t i = 0; i < meshlet.indexCount; i++) {
+        const float* position = data.vertices[indices[i]].position;
+        float distanceSquared = 0;
+        for(int k = 0; k < 3; k++)
+            distanceSquared += (position[k] - meshlet.center[k]) * (position[k] - meshlet.center[k]);
+        radiusSquared = std::max(radiusSquared, distanceSquared);
+    }
+    meshlet.radius = std::sqrt(radiusSquared);
+
+    // face normals from the winding, degenerate triangles face nowhere
+    std::vector<std::array<float, 3>> normals;
+    float axis[3] = { 0, 0, 0 };
+    for(std::uint32_t i = 0; i + 2 < meshlet.indexCount; i += 3) {
+        const float* a = data.vertices[indices[i]].position;
+        const float* b = data.vertices[indices[i + 1]].position;
+        const float* c = data.vertices[indices[i + 2]].position;
+        float ab[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+        float ac[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+        std::array<float, 3> normal = { ab[1] * ac[2] - ab[2] * ac[1], ab[2] * ac[0] - ab[0] * ac[2],
+                                        ab[0] * ac[1] - ab[1] * ac[0] };
+        float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        if(length == 0)
+            continue;
+        for(int k = 0; k < 3; k++) {
+            normal[k] /= length;
+            axis[k] += normal[k];
+        }
+        normals.push_back(normal);
+    }
+    float axisLength = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+    meshlet.coneCutoff = 1;
+    for(int k = 0; k < 3; k++)
+        meshlet.coneAxis[k] = axisLength > 0 ? axis[k] / axisLength : 0;
+    if(axisLength == 0)
+        return;
+    float minCos = 1;
+    for(const std::array<float, 3>& normal : normals) {
+        minCos = std::min(minCos, normal[0] * meshlet.coneAxis[0] + normal[1] * meshlet.coneAxis[1]
+                                      + normal[2] * meshlet.coneAxis[2]);
+    }
+    // past 90 degrees some face always looks back at the camera
+    if(minCos > 0)
+        meshlet.coneCutoff = std::sqrt(1 - minCos * minCos);
+}
+
+}
+
+void buildMeshlets(MeshData& data)
+{
+    data.meshlets.clear();
+    if(data.lods.empty())
+        return;
+    const ArpMeshLod& full = data.lods[0];
+    // meshlet each vertex was last counted in
+    std::vector<std::uint32_t> lastMeshlet(data.vertices.size(), UINT32_MAX);
+    ArpMeshMeshlet meshlet = {};
+    meshlet.firstIndex = full.firstIndex;
+    int vertexCount = 0;
+    for(std::uint32_t i = full.firstIndex; i + 2 < full.firstIndex + full.indexCount; i += 3) {
+        std::uint32_t current = data.meshlets.size();
+        int added = 0;
+        for(int k = 0; k < 3; k++)
+            added += lastMeshlet[data.indices[i + k]] != current;
+        if(vertexCount + added > ARPMESH_MESHLET_VERTICES
+           || meshlet.indexCount / 3 == (std::uint32_t)ARPMESH_MESHLET_TRIANGLES) {
+            finishMeshlet(data, meshlet);
+            data.meshlets.push_back(meshlet);
+            meshlet = {};
+            meshlet.firstIndex = i;
+            vertexCount = 0;
+            current++;
+        }
+        for(int k = 0; k < 3; k++) {
+            std::uint32_t& last = lastMeshlet[data.indices[i + k]];
+            if(last != current) {
+                last = current;
+                vertexCount++;
+            }
+        }
+        meshlet.indexCount += 3;
+    }
+    if(data.meshlets.empty())
+        return;
+    finishMeshlet(data, meshlet);
+    data.meshlets.push_back(meshlet);
+}
+
+void optimizeVertexCache(std::uint32_t* indices, std::size_t indexCount, std::size_t vertexCount)
+{
+    const int CACHE_SIZE = 32;
+    std::size_t triangleCount = indexCount / 3;
+    if(triangleCount == 0)
+        return;
+
+    // triangles using each vertex, the first remaining[v] entries are unused
+    std::vector<std::uint32_t> offsets(vertexCount + 1, 0);
+    for(std::size_t i = 0; i < indexCount; i++)
+        offsets[indices[i] + 1]++;
+    for(std::size_t v = 0; v < vertexCount; v++)
+        offsets[v + 1] += offsets[v];
+    std::vector<std::uint32_t> remaining(vertexCount, 0);
+    std::vector<std::uint32_t> adjacency(indexCount);
+    for(std::size_t i = 0; i < indexCount; i++) {
+        std::uint32_t v = indices[i];
+        adjacency[offsets[v] + remaining[v]++] = i / 3;
+    }
+
+    std::vector<int> cachePosition(vertexCount, -1);
+    auto vertexScore = [&](std::uint32_t v) {
+        if(remaining[v] == 0)
+            return -1.0f;
+        float score = 0;
+        int position = cachePosition[v];
+        if(position >= 0) {
+            // the last triangle's vertices are scored equally
+            if(position < 3)
+                score = 0.75f;
+            else
+                score = std::pow(1.0f - (position - 3) / float(CACHE_SIZE - 3), 1.5f);
+        }
+        // prefer finishing off vertices with few triangles left
+        return score + 2.0f / std::sqrt((float)remaining[v]);
+    };
+
+    std::vector<float> score(vertexCount);
+    for(std::size_t v = 0; v < vertexCount; v++)
+        score[v] = vertexScore(v);
+    std::vector<float> triangleScore(triangleCount);
+    for(std::size_t t = 0; t < triangleCount; t++)
+        triangleScore[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+
+    std::vector<std::uint32_t> input(indices, indices + indexCount);
+    std::vector<bool> emitted(triangleCount, false);
+    std::uint32_t cache[CACHE_SIZE + 3];
+    int cacheCount = 0;
+    std::size_t scanCursor = 0;
+    std::int64_t best = -1;
+
+    for(std::size_t out = 0; out < triangleCount; out++) {
+        if(best < 0) {
+            // nothing in the cache is useful, start at the next unused triangle
+            while(emitted[scanCursor])
+                scanCursor++;
+            best = scanCursor;
+        }
+
+        const std::uint32_t* triangle = &input[best * 3];
+        memcpy(&indices[out * 3], triangle, sizeof(std::uint32_t) * 3);
+        emitted[best] = true;
+
+        // detach the triangle from its vertices
+        for(int k = 0; k < 3; k++) {
+            std::uint32_t v = triangle[k];
+            std::uint32_t* begin = &adjacency[offsets[v]];
+            std::uint32_t* end = begin + remaining[v];
+            std::uint32_t* found = std::find(begin, end, (std::uint32_t)best);
+            *found = *(end - 1);
+            remaining[v]--;
+        }
+
+        // most recent vertices go to the front, others shift back
+        std::uint32_t newCache[CACHE_SIZE + 3];
+        int newCount = 0;
+        for(int k = 0; k < 3; k++)
+            newCache[newCount++] = triangle[k];
+        for(int i = 0; i < cacheCount; i++) {
+            std::uint32_t v = cache[i];
+            if(v != triangle[0] && v != triangle[1] && v != triangle[2])
+                newCache[newCount++] = v;
+        }
+
+        for(int i = 0; i < newCount; i++) {
+            std::uint32_t v = newCache[i];
+            cachePosition[v] = i < CACHE_SIZE ? i : -1;
+            float newScore = vertexScore(v);
+            float delta = newScore - score[v];
+            score[v] = newScore;
+            for(std::uint32_t j = 0; j < remaining[v]; j++)
+                triangleScore[adjacency[offsets[v] + j]] += delta;
+        }
+
+        cacheCount = std::min(newCount, CACHE_SIZE);
+        memcpy(cache, newCache, sizeof(std::uint32_t) * cacheCount);
+
+        // the next triangle is the best one touching the cache
+        best = -1;
+        float bestScore = -1;
+        for(int i = 0; i < cacheCount; i++) {
+            std::uint32_t v = cache[i];
+            for(std::uint32_t j = 0; j < remaining[v]; j++) {
+                std::uint32_t t = adjacency[offsets[v] + j];
+                if(triangleScore[t] > bestScore) {
+                    bestScore = triangleScore[t];
+                    best = t;
+                }
+            }
+        }
+    }
+}
+
+float averageCacheMissRatio(const std::uint32_t* indices, std::size_t indexCount,
+                            std::size_t vertexCount, int cacheSize)
+{
+    if(indexCount < 3)
+        return 0;
+
+    // FIFO cache, a vertex is cached while its timestamp is recent enough
+    std::vector<std::size_t> cachedAt(vertexCount, 0);
+    std::size_t time = cacheSize + 1;
+    std::size_t misses = 0;
+    for(std::size_t i = 0; i < indexCount; i++) {
+        std::uint32_t v = indices[i];
+        if(time - cachedAt[v] > (std::size_t)cacheSize) {
+            cachedAt[v] = time++;
+            misses++;
+        }
+    }
+    return misses / float(indexCount / 3);
+}
+
+std::uint32_t packIndices(const std::vector<std::uint32_t>& indices, std::size_t vertexCount,
+                          std::vector<unsigned char>& packed)
+{
+    std::uint32_t indexSize = indexSizeFor(vertexCount);
+    packed.resize(indices.size() * indexSize);
+    if(indexSize == 4) {
+        memcpy(packed.data(), indices.data(), packed.size());
+        return indexSize;
+    }
+    std::uint16_t* shorts = (std::uint16_t*)packed.data();
+    for(std::size_t i = 0; i < indices.size(); i++)
+        shorts[i] = (std::uint16_t)indices[i];
+    return indexSize;
+}
+
+namespace {
+
+/**
+ * Rounds a float to the nearest half, ties to even
+ */
+std::uint16_t toHalf(float value)
+{
+    std::uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    std::uint32_t sign = (bits >> 16) & 0x8000;
+    std::uint32_t floatExponent = (bits >> 23) & 0xff;
+    std::uint32_t mantissa = bits & 0x7fffff;
+    if(floatExponent == 0xff)
+        return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+    int exponent = (int)floatExponent - 127 + 15;
+    if(exponent >= 31)
+        return sign | 0x7c00;
+    // subnormal halves keep fewer of the mantissa's bits
+    int shift = 13;
+    std::uint32_t half = 0;
+    if(exponent <= 0) {
+        if(exponent < -10)
+            return sign;
+        mantissa |= 0x800000;
+        shift = 14 - exponent;
+    }
+    else {
+        half = (std::uint32_t)exponent << 10;
+    }
+    half |= mantissa >> shift;
+    std::uint32_t rest = mantissa & ((1u << shift) - 1);
+    std::uint32_t halfway = 1u << (shift - 1);
+    // a carry out of the mantissa rounds up into the exponent, as it should
+    if(rest > halfway || (rest == halfway && (half & 1)))
+        half++;
+    return sign | half;
+}
+
+std::int16_t toSnorm16(float value)
+{
+    return (std::int16_t)std::lround(std::min(std::max(value, -1.f), 1.f) * 32767.f);
+}
+
+/**
+ * Projects a unit vector onto the octahedron and unfolds its lower half
+ * over the upper one, giving a point in [-1, 1]^2
+ */
+void encodeOctahedral(const float normal[3], float encoded[2])
+{
+    float length = std::abs(normal[0]) + std::abs(normal[1]) + std::abs(normal[2]);
+    if(length == 0) {
+        encoded[0] = 0;
+        encoded[1] = 0;
+        return;
+    }
+    float x = normal[0] / length;
+    float y = normal[1] / length;
+    if(normal[2] < 0) {
+        float foldedX = (1 - std::abs(y)) * (x >= 0 ? 1 : -1);
+        float foldedY = (1 - std::abs(x)) * (y >= 0 ? 1 : -1);
+        x = foldedX;
+        y = foldedY;
+    }
+    encoded[0] = x;
+    encoded[1] = y;
+}
+
+}
+
+void packVertices(const MeshData& data, std::vector<PackedMeshVertex>& packed)
+{
+    float scale[3];
+    for(int k = 0; k < 3; k++) {
+        float extent = data.boundsMax[k] - data.boundsMin[k];
+        scale[k] = extent > 0 ? 65535.f / extent : 0.f;
+    }
+    packed.resize(data.vertices.size());
+    for(std::size_t i = 0; i < data.vertices.size(); i++) {
+        const MeshVertex& vertex = data.vertices[i];
+        PackedMeshVertex& out = packed[i];
+        for(int k = 0; k < 3; k++) {
+            float quantized = (vertex.position[k] - data.boundsMin[k]) * scale[k];
+            out.position[k] = (std::uint16_t)std::lround(std::min(std::max(quantized, 0.f), 65535.f));
+        }
+        out.padding = 0;
+        float octahedral[2];
+        encodeOctahedral(vertex.normal, octahedral);
+        out.normal[0] = toSnorm16(octahedral[0]);
+        out.normal[1] = toSnorm16(octahedral[1]);
+        out.uv[0] = toHalf(vertex.uv[0]);
+        out.uv[1] = toHalf(vertex.uv[1]);
+    }
+}
+
+bool writeArpMesh(const char* fileName, const MeshData& data)
+{
+    std::vector<unsigned char> packed;
+    std::uint32_t indexSize = packIndices(data.indices, data.vertices.size(), packed);
+    std::vector<PackedMeshVertex> vertices;
+    packVertices(data, vertices);
+
+    ArpMeshHeader header = {};
+    memcpy(header.magic, ARPMESH_MAGIC, sizeof(header.magic));
+    header.version = ARPMESH_VERSION;
+    header.vertexCount = data.vertices.size();
+    header.indexCount = data.indices.size();
+    header.materialCount = data.materials.size();
+    header.indexSize = indexSize;
+    header.lodCount = data.lods.size();
+    header.meshletCount = data.meshlets.size();
+    header.materialOffset = sizeof(ArpMeshHeader);
+    header.lodOffset = header.materialOffset + sizeof(ArpMeshMaterial) * header.materialCount;
+    header.meshletOffset = header.lodOffset + sizeof(ArpMeshLod) * header.lodCount;
+    header.vertexOffset = header.meshletOffset + sizeof(ArpMeshMeshlet) * header.meshletCount;
+    header.indexOffset = header.vertexOffset + sizeof(PackedMeshVertex) * header.vertexCount;
+    memcpy(header.boundsMin, data.boundsMin, sizeof(header.boundsMin));
+    memcpy(header.boundsMax, data.boundsMax, sizeof(header.boundsMax));
+
+    FILE* file = fopen(fileName, "wb");
+    if(!file) {
+        std::cout << "Error: Unable to write " << fileName << std::endl;
+        return false;
+    }
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(data.materials.data(), sizeof(ArpMeshMaterial), data.materials.size(), file);
+    fwrite(data.lods.data(), sizeof(ArpMeshLod), data.lods.size(), file);
+    fwrite(data.meshlets.data(), sizeof(ArpMeshMeshlet), data.meshlets.size(), file);
+    fwrite(vertices.data(), sizeof(PackedMeshVertex), vertices.size(), file);
+    fwrite(packed.data(), 1, packed.size(), file);
+    bool success = !ferror(file);
+    fclose(file);
+    return success;
+}
+
+namespace {
+
+// chunks smaller than this aren't worth a thread
+const std::size_t MIN_OBJ_CHUNK = 256 * 1024;
+
+/**
+ * Runs task(0) to task(count - 1), all but the first on their own thread
+ */
+template<typename Task>
+void runParallel(int count, const Task& task)
+{
+    std::vector<std::thread> workers;
+    for(int i = 1; i < count; i++)
+        workers.emplace_back(task, i);
+    task(0);
+    for(std::thread& worker : workers)
+        worker.join();
+}
+
+inline bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline const char* skipSpace(const char* p, const char* end)
+{
+    while(p < end && isSpace(*p))
+        p++;
+    return p;
+}
+
+inline const char* skipToken(const char* p, const char* end)
+{
+    while(p < end && !isSpace(*p))
+        p++;
+    return p;
+}
+
+/**
+ * Rest of the line with surrounding space removed
+ */
+std::string restOfLine(const char* p, const char* end)
+{
+    p = skipSpace(p, end);
+    while(end > p && isSpace(end[-1]))
+        end--;
+    return std::string(p, end);
+}
+
+inline bool isKeyword(const char* begin, const char* end, const char* keyword)
+{
+    std::size_t length = strlen(keyword);
+    return (std::size_t)(end - begin) == length && memcmp(begin, keyword, length) == 0;
+}
+
+/**
+ * Parses a decimal float without the locale and terminator needs of strtof.
+ * Up to 18 significant digits are kept, which is plenty for a float. A
+ * missing or unreadable number is 0
+ */
+const char* parseFloat(const char* p, const char* end, float& value)
+{
+    static const double powersOf10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+    };
+
+    p = skipSpace(p, end);
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    std::uint64_t mantissa = 0;
+    int exponent = 0;
+    const std::uint64_t MAX_MANTISSA = 100000000000000000ull;
+    for(; p < end && *p >= '0' && *p <= '9'; p++) {
+        if(mantissa < MAX_MANTISSA)
+            mantissa = mantissa * 10 + (*p - '0');
+        else
+            exponent++;
+    }
+    if(p < end && *p == '.') {
+        for(p++; p < end && *p >= '0' && *p <= '9'; p++) {
+            if(mantissa < MAX_MANTISSA) {
+                mantissa = mantissa * 10 + (*p - '0');
+                exponent--;
+            }
+        }
+    }
+    if(p < end && (*p == 'e' || *p == 'E')) {
+        const char* q = p + 1;
+        bool negativeExponent = false;
+        if(q < end && (*q == '-' || *q == '+'))
+            negativeExponent = *q++ == '-';
+        if(q < end && *q >= '0' && *q <= '9') {
+            int e = 0;
+            for(; q < end && *q >= '0' && *q <= '9'; q++)
+                e = std::min(e * 10 + (*q - '0'), 10000);
+            exponent += negativeExponent ? -e : e;
+            p = q;
+        }
+    }
+
+    double result = (double)mantissa;
+    if(exponent < 0)
+        result /= -exponent <= 22 ? powersOf10[-exponent] : std::pow(10.0, -exponent);
+    else if(exponent > 0)
+        result *= exponent <= 22 ? powersOf10[exponent] : std::pow(10.0, exponent);
+    value = (float)(negative ? -result : result);
+    // nan, inf and other garbage
+    return skipToken(p, end);
+}
+
+/**
+ * Parses a vertex reference of a face. Positive references are 1 based,
+ * negative ones count back from the count elements parsed so far
+ */
+const char* parseIndex(const char* p, const char* end, std::uint32_t count, std::uint32_t& index, bool& relative)
+{
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+    std::uint32_t n = 0;
+    for(; p < end && *p >= '0' && *p <= '9'; p++)
+        n = n * 10 + (*p - '0');
+    relative = negative;
+    if(negative)
+        // wraps around when it reaches into an earlier chunk, adding the
+        // chunk's base wraps it back
+        index = count - n;
+    else
+        index = n > 0 ? n - 1 : 0;
+    return p;
+}
+
+/**
+ * Everything parsed from one chunk of an OBJ. Indices are relative to the
+ * start of the chunk only where relativeCorners says so
+ */
+struct ObjChunk {
+    std::vector<cy::Vec3f> v;
+    std::vector<cy::Vec3f> vt;
+    std::vector<cy::Vec3f> vn;
+    // texture and normal faces are kept even when they aren't used
+    std::vector<cy::TriMesh::TriFace> f;
+    std::vector<cy::TriMesh::TriFace> ft;
+    std::vector<cy::TriMesh::TriFace> fn;
+    // (triangle * 3 + corner) * 3 + 0 for f, 1 for ft and 2 for fn
+    std::vector<std::size_t> relativeCorners;
+    // triangle the material is first used at, and its name
+    std::vector<std::pair<std::uint32_t, std::string>> useMtl;
+    std::vector<std::string> mtlLibs;
+};
+
+void parseFace(const char* p, const char* end, ObjChunk& chunk)
+{
+    std::uint32_t counts[3] = { (std::uint32_t)chunk.v.size(), (std::uint32_t)chunk.vt.size(),
+                                (std::uint32_t)chunk.vn.size() };
+    std::vector<cy::TriMesh::TriFace>* faces[3] = { &chunk.f, &chunk.ft, &chunk.fn };
+
+    // polygons are triangulated as a fan around their first corner
+    std::uint32_t first[3] = {}, previous[3] = {};
+    bool firstRelative[3] = {}, previousRelative[3] = {};
+    int corner = 0;
+    while(true) {
+        p = skipSpace(p, end);
+        if(p >= end)
+            break;
+        std::uint32_t index[3] = {};
+        bool relative[3] = {};
+        for(int k = 0; k < 3; k++) {
+            if(k > 0) {
+                if(p >= end || *p != '/')
+                    break;
+                p++;
+            }
+            if(p < end && *p != '/' && !isSpace(*p))
+                p = parseIndex(p, end, counts[k], index[k], relative[k]);
+        }
+        p = skipToken(p, end);
+
+        if(corner >= 2) {
+            std::size_t triangle = chunk.f.size();
+            const std::uint32_t* corners[3] = { first, previous, index };
+            const bool* cornersRelative[3] = { firstRelative, previousRelative, relative };
+            for(int k = 0; k < 3; k++) {
+                cy::TriMesh::TriFace face;
+                for(int c = 0; c < 3; c++) {
+                    face.v[c] = corners[c][k];
+                    if(cornersRelative[c][k])
+                        chunk.relativeCorners.push_back((triangle * 3 + c) * 3 + k);
+                }
+                faces[k]->push_back(face);
+            }
+        }
+        if(corner == 0) {
+            memcpy(first, index, sizeof(first));
+            memcpy(firstRelative, relative, sizeof(firstRelative));
+        }
+        memcpy(previous, index, sizeof(previous));
+        memcpy(previousRelative, relative, sizeof(previousRelative));
+        corner++;
+    }
+}
+
+void parseVector(const char* p, const char* end, std::vector<cy::Vec3f>& vectors)
+{
+    cy::Vec3f vector;
+    p = parseFloat(p, end, vector.x);
+    p = parseFloat(p, end, vector.y);
+    parseFloat(p, end, vector.z);
+    vectors.push_back(vector);
+}
+
+/**
+ * Calls line(keyword, keywordEnd, lineEnd) for every line with a keyword in
+ * the given range, skipping blank lines and comments
+ */
+template<typename Line>
+void forEachLine(const char* p, const char* end, const Line& line)
+{
+    while(p < end) {
+        const char* lineEnd = (const char*)memchr(p, '\n', end - p);
+        if(!lineEnd)
+            lineEnd = end;
+        const char* keyword = skipSpace(p, lineEnd);
+        if(keyword < lineEnd && *keyword != '#') {
+            if(!line(keyword, skipToken(keyword, lineEnd), lineEnd))
+                return;
+        }
+        p = lineEnd + 1;
+    }
+}
+
+void parseObjChunk(const char* begin, const char* end, bool loadMtl, ObjChunk& chunk)
+{
+    forEachLine(begin, end, [&](const char* keyword, const char* keywordEnd, const char* lineEnd) {
+        // most lines are vertices and faces
+        std::size_t length = keywordEnd - keyword;
+        if(length == 1 && keyword[0] == 'v')
+            parseVector(keywordEnd, lineEnd, chunk.v);
+        else if(length == 1 && keyword[0] == 'f')
+            parseFace(keywordEnd, lineEnd, chunk);
+        else if(isKeyword(keyword, keywordEnd, "vt"))
+            parseVector(keywordEnd, lineEnd, chunk.vt);
+        else if(isKeyword(keyword, keywordEnd, "vn"))
+            parseVector(keywordEnd, lineEnd, chunk.vn);
+        else if(loadMtl && isKeyword(keyword, keywordEnd, "usemtl"))
+            chunk.useMtl.emplace_back((std::uint32_t)chunk.f.size(), restOfLine(keywordEnd, lineEnd));
+        else if(loadMtl && isKeyword(keyword, keywordEnd, "mtllib"))
+            chunk.mtlLibs.push_back(restOfLine(keywordEnd, lineEnd));
+        return true;
+    });
+}
+
+/**
+ * Material libraries named before the first vertex or face, which is where
+ * exporters put them
+ */
+std::vector<std::string> leadingMtlLibs(const char* begin, const char* end)
+{
+    std::vector<std::string> libs;
+    forEachLine(begin, end, [&](const char* keyword, const char* keywordEnd, const char* lineEnd) {
+        if(keyword[0] == 'v' || keyword[0] == 'f')
+            return false;
+        if(isKeyword(keyword, keywordEnd, "mtllib"))
+            libs.push_back(restOfLine(keywordEnd, lineEnd));
+        return true;
+    });
+    return libs;
+}
+
+void parseFloat3(const char* p, const char* end, float values[3])
+{
+    values[0] = values[1] = values[2] = 0;
+    p = skipSpace(p, end);
+    p = parseFloat(p, end, values[0]);
+    // a single value is used for all three
+    if(skipSpace(p, end) >= end) {
+        values[1] = values[2] = values[0];
+        return;
+    }
+    p = parseFloat(p, end, values[1]);
+    parseFloat(p, end, values[2]);
+}
+
+/**
+ * Appends the materials of an .mtl file
+ */
+void parseMtlLib(const std::string& fileName, std::vector<cy::TriMesh::Mtl>& materials)
+{
+    MappedFile file;
+    if(!file.open(fileName.c_str())) {
+        std::cout << "Error: Unable to open " << fileName << std::endl;
+        return;
+    }
+    const char* begin = (const char*)file.data();
+    cy::TriMesh::Mtl* mtl = nullptr;
+    forEachLine(begin, begin + file.size(), [&](const char* keyword, const char* keywordEnd, const char* lineEnd) {
+        auto copy = [&](cy::TriMesh::Str& str) { str = restOfLine(keywordEnd, lineEnd).c_str(); };
+        if(isKeyword(keyword, keywordEnd, "newmtl")) {
+            materials.emplace_back();
+            mtl = &materials.back();
+            copy(mtl->name);
+        } else if(!mtl) {
+            return true;
+        } else if(isKeyword(keyword, keywordEnd, "Ka")) {
+            parseFloat3(keywordEnd, lineEnd, mtl->Ka);
+        } else if(isKeyword(keyword, keywordEnd, "Kd")) {
+            parseFloat3(keywordEnd, lineEnd, mtl->Kd);
+        } else if(isKeyword(keyword, keywordEnd, "Ks")) {
+            parseFloat3(keywordEnd, lineEnd, mtl->Ks);
+        } else if(isKeyword(keyword, keywordEnd, "Tf")) {
+            parseFloat3(keywordEnd, lineEnd, mtl->Tf);
+        } else if(isKeyword(keyword, keywordEnd, "Ns")) {
+            parseFloat(keywordEnd, lineEnd, mtl->Ns);
+        } else if(isKeyword(keyword, keywordEnd, "Ni")) {
+            parseFloat(keywordEnd, lineEnd, mtl->Ni);
+        } else if(isKeyword(keyword, keywordEnd, "illum")) {
+            float illum;
+            parseFloat(keywordEnd, lineEnd, illum);
+            mtl->illum = (int)illum;
+        } else if(isKeyword(keyword, keywordEnd, "map_Ka")) {
+            copy(mtl->map_Ka);
+        } else if(isKeyword(keyword, keywordEnd, "map_Kd")) {
+            copy(mtl->map_Kd);
+        } else if(isKeyword(keyword, keywordEnd, "map_Ks")) {
+            copy(mtl->map_Ks);
+        } else if(isKeyword(keyword, keywordEnd, "map_Ns")) {
+            copy(mtl->map_Ns);
+        } else if(isKeyword(keyword, keywordEnd, "map_d")) {
+            copy(mtl->map_d);
+        } else if(isKeyword(keyword, keywordEnd, "map_bump") || isKeyword(keyword, keywordEnd, "bump")) {
+            copy(mtl->map_bump);
+        } else if(isKeyword(keyword, keywordEnd, "map_disp") || isKeyword(keyword, keywordEnd, "disp")) {
+            copy(mtl->map_disp);
+        }
+        return true;
+    });
+}
+
+/**
+ * Reaches TriMesh's material face counts, which only its own loader fills
+ */
+struct MaterialFaceCounts : cy::TriMesh {
+    static int* of(cy::TriMesh& mesh) { return mesh.*(&MaterialFaceCounts::mcfc); }
+};
+
+}
+
+bool loadObj(const char* fileName, cy::TriMesh& mesh, bool loadMtl, int threads)
+{
+    MappedFile file;
+    if(!file.open(fileName)) {
+        std::cout << "Error: Unable to open " << fileName << std::endl;
+        return false;
+    }
+    const char* begin = (const char*)file.data();
+    const char* end = begin + file.size();
+
+    // .mtl paths are relative to the OBJ
+    std::string directory = fileName;
+    std::size_t slash = directory.find_last_of("/\\");
+    directory = slash == std::string::npos ? "" : directory.substr(0, slash + 1);
+
+    std::vector<std::string> mtlLibs;
+    std::vector<cy::TriMesh::Mtl> libMaterials;
+    std::thread mtlThread;
+    if(loadMtl) {
+        mtlLibs = leadingMtlLibs(begin, end);
+        mtlThread = std::thread([&]() {
+            for(const std::string& lib : mtlLibs)
+                parseMtlLib(directory + lib, libMaterials);
+        });
+    }
+
+    if(threads <= 0)
+        threads = std::max(1, (int)std::thread::hardware_concurrency());
+    int chunkCount = (int)std::max<std::size_t>(1, std::min<std::size_t>(threads, file.size() / MIN_OBJ_CHUNK));
+    std::vector<const char*> bounds(chunkCount + 1, end);
+    bounds[0] = begin;
+    for(int i = 1; i < chunkCount; i++) {
+        const char* split = std::max(bounds[i - 1], begin + file.size() * i / chunkCount);
+        const char* newline = (const char*)memchr(split, '\n', end - split);
+        bounds[i] = newline ? newline + 1 : end;
+    }
+
+    std::vector<ObjChunk> chunks(chunkCount);
+    runParallel(chunkCount, [&](int i) {
+        parseObjChunk(bounds[i], bounds[i + 1], loadMtl, chunks[i]);
+    });
+
+    // where each chunk's elements start in the merged arrays
+    std::vector<std::array<std::uint32_t, 3>> bases(chunkCount);
+    std::uint32_t totals[3] = {};
+    std::size_t faceCount = 0;
+    for(int i = 0; i < chunkCount; i++) {
+        bases[i] = { totals[0], totals[1], totals[2] };
+        totals[0] += chunks[i].v.size();
+        totals[1] += chunks[i].vt.size();
+        totals[2] += chunks[i].vn.size();
+        faceCount += chunks[i].f.size();
+    }
+
+    // materials are numbered by first use, a chunk starts with the material
+    // the previous one ended with
+    std::vector<std::string> mtlNames;
+    std::unordered_map<std::string, int> mtlIndices;
+    // runs of triangles per chunk, as (first triangle, material) pairs
+    std::vector<std::vector<std::pair<std::uint32_t, int>>> mtlRuns(chunkCount);
+    int currentMtl = -1;
+    for(int i = 0; i < chunkCount; i++) {
+        mtlRuns[i].emplace_back(0, currentMtl);
+        for(const auto& use : chunks[i].useMtl) {
+            currentMtl = -1;
+            if(!use.second.empty()) {
+                auto inserted = mtlIndices.emplace(use.second, (int)mtlNames.size());
+                if(inserted.second)
+                    mtlNames.push_back(use.second);
+                currentMtl = inserted.first->second;
+            }
+            mtlRuns[i].emplace_back(use.first, currentMtl);
+        }
+    }
+    int mtlCount = mtlNames.size();
+
+    // faces of each material are stored consecutively, in material order,
+    // followed by the faces without one. Slot 0 counts those
+    std::vector<std::vector<std::uint32_t>> destinations(chunkCount, std::vector<std::uint32_t>(mtlCount + 1, 0));
+    for(int i = 0; i < chunkCount; i++) {
+        const auto& runs = mtlRuns[i];
+        for(std::size_t r = 0; r < runs.size(); r++) {
+            std::uint32_t runEnd = r + 1 < runs.size() ? runs[r + 1].first : (std::uint32_t)chunks[i].f.size();
+            destinations[i][runs[r].second + 1] += runEnd - runs[r].first;
+        }
+    }
+    std::vector<int> cumulativeCounts(mtlCount);
+    std::uint32_t next = 0;
+    for(int m = 0; m <= mtlCount; m++) {
+        int slot = (m + 1) % (mtlCount + 1);
+        for(int i = 0; i < chunkCount; i++) {
+            std::uint32_t count = destinations[i][slot];
+            destinations[i][slot] = next;
+            next += count;
+        }
+        if(m < mtlCount)
+            cumulativeCounts[m] = next;
+    }
+
+    mesh.Clear();
+    if(faceCount == 0) {
+        if(mtlThread.joinable())
+            mtlThread.join();
+        return true;
+    }
+    mesh.SetNumVertex(totals[0]);
+    mesh.SetNumFaces(faceCount);
+    mesh.SetNumTexVerts(totals[1]);
+    mesh.SetNumNormals(totals[2]);
+
+    runParallel(chunkCount, [&](int i) {
+        ObjChunk& chunk = chunks[i];
+        if(!chunk.v.empty())
+            memcpy(&mesh.V(bases[i][0]), chunk.v.data(), sizeof(cy::Vec3f) * chunk.v.size());
+        if(!chunk.vt.empty())
+            memcpy(&mesh.VT(bases[i][1]), chunk.vt.data(), sizeof(cy::Vec3f) * chunk.vt.size());
+        if(!chunk.vn.empty())
+            memcpy(&mesh.VN(bases[i][2]), chunk.vn.data(), sizeof(cy::Vec3f) * chunk.vn.size());
+
+        std::vector<cy::TriMesh::TriFace>* faces[3] = { &chunk.f, &chunk.ft, &chunk.fn };
+        for(std::size_t corner : chunk.relativeCorners) {
+            std::size_t k = corner % 3;
+            (*faces[k])[corner / 9].v[corner / 3 % 3] += bases[i][k];
+        }
+
+        const auto& runs = mtlRuns[i];
+        std::vector<std::uint32_t>& destination = destinations[i];
+        for(std::size_t r = 0; r < runs.size(); r++) {
+            std::uint32_t runEnd = r + 1 < runs.size() ? runs[r + 1].first : (std::uint32_t)chunk.f.size();
+            std::uint32_t& to = destination[runs[r].second + 1];
+            for(std::uint32_t t = runs[r].first; t < runEnd; t++, to++) {
+                mesh.F(to) = chunk.f[t];
+                if(mesh.HasTextureVertices())
+                    mesh.FT(to) = chunk.ft[t];
+                if(mesh.HasNormals())
+                    mesh.FN(to) = chunk.fn[t];
+            }
+        }
+    });
+
+    if(!loadMtl)
+        return true;
+    mtlThread.join();
+    // libraries named further into the file than the leading scan looked
+    for(const ObjChunk& chunk : chunks) {
+        for(const std::string& lib : chunk.mtlLibs) {
+            if(std::find(mtlLibs.begin(), mtlLibs.end(), lib) == mtlLibs.end()) {
+                mtlLibs.push_back(lib);
+                parseMtlLib(directory + lib, libMaterials);
+            }
+        }
+    }
+
+    mesh.SetNumMtls(mtlCount);
+    int* mcfc = MaterialFaceCounts::of(mesh);
+    for(int m = 0; m < mtlCount; m++) {
+        for(const cy::TriMesh::Mtl& mtl : libMaterials) {
+            if(mtl.name.data && mtlNames[m] == mtl.name.data) {
+                mesh.M(m) = mtl;
+                break;
+            }
+        }
+        mesh.M(m).name = mtlNames[m].c_str();
+        mcfc[m] = cumulativeCounts[m];
+    }
+    return true;
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const char* fileName)
+{
+    close();
+
+#ifdef _WIN32
+    fileHandle = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(fileHandle == INVALID_HANDLE_VALUE) {
+        fileHandle = nullptr;
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx(fileHandle, &fileSize);
+    length = fileSize.QuadPart;
+    mappingHandle = length > 0 ? CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+    if(mappingHandle)
+        bytes = (const unsigned char*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+#else
+    int fd = ::open(fileName, O_RDONLY);
+    if(fd < 0)
+        return false;
+    struct stat info;
+    if(fstat(fd, &info) == 0 && info.st_size > 0) {
+        length = info.st_size;
+        void* mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapping != MAP_FAILED)
+            bytes = (const unsigned char*)mapping;
+    }
+    // the mapping keeps the file alive
+    ::close(fd);
+#endif
+
+    if(!bytes) {
+        std::cout << "Error: Unable to map " << fileName << std::endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::view(const unsigned char* data, std::size_t size)
+{
+    close();
+    bytes = data;
+    length = size;
+    borrowed = true;
+}
+
+void MappedFile::prefetch(std::size_t offset, std::size_t size) const
+{
+    if(!bytes || offset >= length)
+        return;
+    size = std::min(size, length - offset);
+#ifdef _WIN32
+    #if _WIN32_WINNT >= 0x0602
+    WIN32_MEMORY_RANGE_ENTRY range = { (void*)(bytes + offset), size };
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+    #endif
+#else
+    // madvise wants the start on a page boundary
+    std::uintptr_t page = sysconf(_SC_PAGESIZE);
+    std::uintptr_t start = (std::uintptr_t)(bytes + offset);
+    std::uintptr_t aligned = start / page * page;
+    madvise((void*)aligned, size + (start - aligned), MADV_WILLNEED);
+#endif
+}
+
+void MappedFile::close()
+{
+    if(borrowed) {
+        bytes = nullptr;
+        length = 0;
+        borrowed = false;
+        return;
+    }
+#ifdef _WIN32
+    if(bytes)
+        UnmapViewOfFile(bytes);
+    if(mappingHandle)
+        CloseHandle(mappingHandle);
+    if(fileHandle)
+        CloseHandle(fileHandle);
+    mappingHandle = nullptr;
+    fileHandle = nullptr;
+#else
+    if(bytes)
+        munmap((void*)bytes, length);
+#endif
+    bytes = nullptr;
+    length = 0;
+}
+
+MappedArpMesh::~MappedArpMesh()
+{
+    close();
+}
+
+bool MappedArpMesh::open(const char* fileName)
+{
+    if(!file.open(fileName))
+        return false;
+    return validate(fileName);
+}
+
+bool MappedArpMesh::open(const char* fileName, const unsigned char* data, std::size_t size)
+{
+    file.view(data, size);
+    return validate(fileName);
+}
+
+bool MappedArpMesh::validate(const char* fileName)
+{
+    const ArpMeshHeader& h = header();
+    std::size_t size = file.size();
+    bool valid = size >= sizeof(ArpMeshHeader) &&
+        memcmp(h.magic, ARPMESH_MAGIC, sizeof(h.magic)) == 0 &&
+        h.version == ARPMESH_VERSION &&
+        (h.indexSize == 2 || h.indexSize == 4) &&
+        h.materialOffset + (std::size_t)sizeof(ArpMeshMaterial) * h.materialCount <= size &&
+        h.lodCount >= 1 && h.lodCount <= (std::uint32_t)ARPMESH_MAX_LODS &&
+        h.lodOffset + (std::size_t)sizeof(ArpMeshLod) * h.lodCount <= size &&
+        h.meshletOffset + (std::size_t)sizeof(ArpMeshMeshlet) * h.meshletCount <= size &&
+        h.vertexOffset + (std::size_t)sizeof(PackedMeshVertex) * h.vertexCount <= size &&
+        h.indexOffset + (std::size_t)h.indexSize * h.indexCount <= size;
+    for(std::uint32_t i = 0; valid && i < h.lodCount; i++)
+        valid = (std::size_t)lods()[i].firstIndex + lods()[i].indexCount <= h.indexCount;
+    for(std::uint32_t i = 0; valid && i < h.meshletCount; i++)
+        valid = (std::size_t)meshlets()[i].firstIndex + meshlets()[i].indexCount <= h.indexCount;
+    if(!valid) {
+        std::cout << "Error: " << fileName << " is not a valid version " << ARPMESH_VERSION << " .arpmesh" << std::endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+void MappedArpMesh::close()
+{
+    file.close();
+}
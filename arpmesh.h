@@ -0,0 +1,293 @@
+#ifndef arpmesh_h
+#define arpmesh_h
+
+#include "cyTriMesh.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * .arpmesh is an indexed, interleaved mesh that can be uploaded straight
+ * from a memory mapping. The file is laid out as
+ *
+ *   ArpMeshHeader
+ *   ArpMeshMaterial[materialCount]
+ *   ArpMeshLod[lodCount]
+ *   ArpMeshMeshlet[meshletCount]
+ *   PackedMeshVertex[vertexCount]
+ *   uint16_t or uint32_t[indexCount], see indexSize
+ *
+ * with every section starting at the offset given in the header. All values
+ * are little endian. The indices of every level of detail are stored one
+ * after another, all indexing the same vertices.
+ */
+
+static const char ARPMESH_MAGIC[8] = { 'A', 'R', 'P', 'M', 'E', 'S', 'H', '\0' };
+static const std::uint32_t ARPMESH_VERSION = 5;
+// levels of detail of a mesh, including the full one
+static const int ARPMESH_MAX_LODS = 4;
+// most vertices and triangles of a meshlet, see buildMeshlets
+static const int ARPMESH_MESHLET_VERTICES = 64;
+static const int ARPMESH_MESHLET_TRIANGLES = 124;
+
+/**
+ * Vertex as meshes are built and simplified
+ */
+struct MeshVertex {
+    float position[3];
+    float normal[3];
+    float uv[2];
+};
+
+/**
+ * Interleaved vertex as stored in .arpmesh files and read by shader4.vert,
+ * 16 bytes instead of MeshVertex's 32. The position is quantized to 16 bits
+ * per axis within the mesh's bounds, the unit normal is octahedral encoded
+ * into two signed 16 bit values, and the texture coordinate is half floats
+ */
+struct PackedMeshVertex {
+    // unorm16, 0 at boundsMin and 65535 at boundsMax
+    std::uint16_t position[3];
+    // keeps the normal 4 byte aligned
+    std::uint16_t padding;
+    // snorm16
+    std::int16_t normal[2];
+    // IEEE 754 half precision
+    std::uint16_t uv[2];
+};
+
+/**
+ * Range of indices drawn with one material
+ */
+struct ArpMeshMaterial {
+    std::uint32_t firstIndex;
+    std::uint32_t indexCount;
+    float diffuse[3];
+    // path of the diffuse texture as written in the .mtl, empty if none
+    char diffuseMap[244];
+};
+
+/**
+ * Range of indices drawn for one level of detail. Level 0 is the full mesh,
+ * the material ranges only apply to it
+ */
+struct ArpMeshLod {
+    std::uint32_t firstIndex;
+    std::uint32_t indexCount;
+    // object space distance the simplified surface may be off by, 0 for the
+    // full mesh
+    float error;
+};
+
+/**
+ * Run of the full level of detail's indices whose triangles lie close
+ * together, culled as one by its bounding sphere and by the cone its face
+ * normals lie in. Faces are front facing when wound counterclockwise
+ */
+struct ArpMeshMeshlet {
+    std::uint32_t firstIndex;
+    std::uint32_t indexCount;
+    // object space bounding sphere
+    float center[3];
+    float radius;
+    // unit average of the face normals, and the sine of the widest angle a
+    // face normal makes with it. 1 when the faces spread too far for all of
+    // them to ever face away
+    float coneAxis[3];
+    float coneCutoff;
+};
+
+struct ArpMeshHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t vertexCount;
+    std::uint32_t indexCount;
+    std::uint32_t materialCount;
+    // 2 when every index fits in 16 bits, otherwise 4
+    std::uint32_t indexSize;
+    // byte offsets from the start of the file
+    std::uint32_t materialOffset;
+    std::uint32_t vertexOffset;
+    std::uint32_t indexOffset;
+    float boundsMin[3];
+    float boundsMax[3];
+    // at least 1, at most ARPMESH_MAX_LODS, in order of increasing error
+    std::uint32_t lodCount;
+    std::uint32_t lodOffset;
+    // partition of level 0's indices, 0 meshlets for meshes too small to
+    // split
+    std::uint32_t meshletCount;
+    std::uint32_t meshletOffset;
+};
+
+/**
+ * Indexed mesh in memory, as written to and read from .arpmesh files
+ */
+struct MeshData {
+    std::vector<MeshVertex> vertices;
+    std::vector<std::uint32_t> indices;
+    std::vector<ArpMeshMaterial> materials;
+    std::vector<ArpMeshLod> lods;
+    std::vector<ArpMeshMeshlet> meshlets;
+    float boundsMin[3];
+    float boundsMax[3];
+};
+
+/**
+ * Builds an indexed mesh from a loaded OBJ. Corners with identical position,
+ * normal and texture coordinate are welded into one vertex, triangles are
+ * reordered for the post-transform vertex cache and vertices are reordered
+ * by first use. The result has a single level of detail
+ */
+void buildMeshData(cy::TriMesh& mesh, MeshData& data);
+
+/**
+ * Appends simplified levels of detail to a mesh with only its full level,
+ * each with about half the triangles of the one before. Vertices are
+ * clustered on a grid and every cluster collapses onto one of its vertices,
+ * so the levels share the mesh's vertices. Stops at maxLods levels or when
+ * simplifying further doesn't pay off
+ */
+void buildMeshLods(MeshData& data, int maxLods = ARPMESH_MAX_LODS);
+
+/**
+ * Splits the full level of detail into meshlets of at most
+ * ARPMESH_MESHLET_VERTICES vertices and ARPMESH_MESHLET_TRIANGLES triangles,
+ * taking triangles in index order, which the vertex cache optimization has
+ * already made local. Meshes that fit in one meshlet get none, they're
+ * culled whole anyway
+ */
+void buildMeshlets(MeshData& data);
+
+/**
+ * Reorders the triangles of the index range so consecutive triangles reuse
+ * recently transformed vertices (Forsyth's linear-speed optimization)
+ */
+void optimizeVertexCache(std::uint32_t* indices, std::size_t indexCount, std::size_t vertexCount);
+
+/**
+ * Average number of vertices transformed per triangle with a FIFO cache of
+ * the given size. 3 is the worst case, lower is better
+ */
+float averageCacheMissRatio(const std::uint32_t* indices, std::size_t indexCount,
+                            std::size_t vertexCount, int cacheSize = 16);
+
+/**
+ * Returns the size in bytes of the smallest index type that fits vertexCount
+ */
+inline std::uint32_t indexSizeFor(std::size_t vertexCount)
+{
+    return vertexCount <= 0xFFFF ? 2 : 4;
+}
+
+/**
+ * Copies indices into 16 bit storage if they fit, otherwise 32 bit.
+ * Returns the index size used
+ */
+std::uint32_t packIndices(const std::vector<std::uint32_t>& indices, std::size_t vertexCount,
+                          std::vector<unsigned char>& packed);
+
+/**
+ * Packs the mesh's vertices, quantizing positions within its bounds
+ */
+void packVertices(const MeshData& data, std::vector<PackedMeshVertex>& packed);
+
+/**
+ * Writes data as an .arpmesh file. Returns false if the file can't be written
+ */
+bool writeArpMesh(const char* fileName, const MeshData& data);
+
+/**
+ * Loads an OBJ the way cy::TriMesh::LoadFromFileObj does, but from a memory
+ * mapping split into chunks at line boundaries that are parsed in parallel.
+ * Faces are triangulated and grouped by material, and the .mtl files named
+ * before the first vertex are parsed while the geometry is. threads is the
+ * number of threads to parse with, 0 for one per core. Returns false and
+ * prints an error if the file can't be read
+ */
+bool loadObj(const char* fileName, cy::TriMesh& mesh, bool loadMtl = true, int threads = 0);
+
+/**
+ * Read-only memory mapping of a whole file. The data stays valid until the
+ * mapping is closed or destroyed
+ */
+class MappedFile {
+private:
+    const unsigned char* bytes = nullptr;
+    std::size_t length = 0;
+    // set by view, close then leaves the memory alone
+    bool borrowed = false;
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#endif
+
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    /**
+     * Returns false if the file doesn't exist, and prints an error if it
+     * does but can't be mapped. Empty files can't be mapped
+     */
+    bool open(const char* fileName);
+    /**
+     * Uses memory owned by something else in place of a file, like an entry
+     * of a mapped asset pack. It must outlive this
+     */
+    void view(const unsigned char* data, std::size_t size);
+    void close();
+
+    /**
+     * Hints the OS to start reading the range in, so the page faults of
+     * touching it later don't each wait on the disk
+     */
+    void prefetch(std::size_t offset, std::size_t size) const;
+
+    const unsigned char* data() const { return bytes; }
+    std::size_t size() const { return length; }
+};
+
+/**
+ * Read-only memory mapping of an .arpmesh file. The pointers stay valid
+ * until the mapping is closed or destroyed
+ */
+class MappedArpMesh {
+private:
+    MappedFile file;
+
+    bool validate(const char* fileName);
+
+public:
+    MappedArpMesh() = default;
+    MappedArpMesh(const MappedArpMesh&) = delete;
+    MappedArpMesh& operator=(const MappedArpMesh&) = delete;
+    ~MappedArpMesh();
+
+    /**
+     * Maps the file and validates its header. Returns false and prints an
+     * error if the file can't be used
+     */
+    bool open(const char* fileName);
+    /**
+     * Validates an .arpmesh already in memory, named fileName in errors. The
+     * memory must outlive the mapping and be 4 byte aligned
+     */
+    bool open(const char* fileName, const unsigned char* data, std::size_t size);
+    void close();
+
+    const ArpMeshHeader& header() const { return *(const ArpMeshHeader*)file.data(); }
+    const ArpMeshMaterial* materials() const { return (const ArpMeshMaterial*)(file.data() + header().materialOffset); }
+    const ArpMeshLod* lods() const { return (const ArpMeshLod*)(file.data() + header().lodOffset); }
+    const ArpMeshMeshlet* meshlets() const
+    {
+        return (const ArpMeshMeshlet*)(file.data() + header().meshletOffset);
+    }
+    const PackedMeshVertex* vertices() const { return (const PackedMeshVertex*)(file.data() + header().vertexOffset); }
+    const void* indices() const { return file.data() + header().indexOffset; }
+};
+
+#endif /* arpmesh_h */
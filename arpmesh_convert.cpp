@@ -0,0 +1,56 @@
+/**
+ * Bakes .obj files into .arpmesh files next to them, with their levels of
+ * detail
+ *
+ * Usage: arpmesh_convert <mesh.obj>...
+ */
+
+#include "arpmesh.h"
+
+#include <iostream>
+#include <string>
+
+int main(int argc, char *argv[]) {
+    if(argc < 2) {
+        std::cout << "Usage: arpmesh_convert <mesh.obj>..." << std::endl;
+        return -1;
+    }
+
+    int failures = 0;
+    for(int i = 1; i < argc; i++) {
+        std::string input = argv[i];
+        std::string output = input.substr(0, input.find_last_of('.')) + ".arpmesh";
+
+        cy::TriMesh mesh;
+        if(!loadObj(input.c_str(), mesh)) {
+            std::cout << "Error: Unable to load " << input << std::endl;
+            failures++;
+            continue;
+        }
+
+        // unrolled OBJ corners are what the old loader drew, one per index
+        std::vector<std::uint32_t> unrolled(mesh.NF() * 3);
+        for(std::size_t k = 0; k < unrolled.size(); k++)
+            unrolled[k] = k;
+        float unrolledRatio = averageCacheMissRatio(unrolled.data(), unrolled.size(), unrolled.size());
+
+        MeshData data;
+        buildMeshData(mesh, data);
+        buildMeshLods(data);
+        buildMeshlets(data);
+        if(!writeArpMesh(output.c_str(), data)) {
+            failures++;
+            continue;
+        }
+        std::cout << output << ": " << data.vertices.size() << " vertices, "
+                  << data.lods[0].indexCount / 3 << " triangles, ACMR "
+                  << unrolledRatio << " -> "
+                  << averageCacheMissRatio(data.indices.data(), data.lods[0].indexCount, data.vertices.size())
+                  << std::endl;
+        for(std::size_t lod = 1; lod < data.lods.size(); lod++) {
+            std::cout << "  LOD " << lod << ": " << data.lods[lod].indexCount / 3 << " triangles, error "
+                      << data.lods[lod].error << std::endl;
+        }
+    }
+    return failures == 0 ? 0 : -1;
+}
@@ -0,0 +1,154 @@
+#include "arppack.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+/**
+ * Name an entry of path is stored under
+ */
+static std::string entryName(const char* path)
+{
+    return std::filesystem::path(path).filename().string();
+}
+
+std::uint64_t arpPackHash(const char* name)
+{
+    std::uint64_t hash = 14695981039346656037ull;
+    for(; *name; name++)
+        hash = (hash ^ (unsigned char)*name) * 1099511628211ull;
+    return hash;
+}
+
+bool writeArpPack(const char* fileName, const std::vector<std::string>& files)
+{
+    std::vector<ArpPackEntry> entries(files.size());
+    std::vector<std::vector<char>> contents(files.size());
+    for(std::size_t i = 0; i < files.size(); i++) {
+        std::string name = entryName(files[i].c_str());
+        if(name.size() >= sizeof(entries[i].name)) {
+            std::cout << "Error: " << name << " is too long a name for a pack entry" << std::endl;
+            return false;
+        }
+        std::ifstream input(files[i], std::ios::binary);
+        if(!input) {
+            std::cout << "Error: Unable to read " << files[i] << std::endl;
+            return false;
+        }
+        contents[i].assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+        ArpPackEntry& entry = entries[i];
+        memset(&entry, 0, sizeof(entry));
+        entry.hash = arpPackHash(name.c_str());
+        entry.size = contents[i].size();
+        memcpy(entry.name, name.c_str(), name.size());
+    }
+
+    // contents follow the directory in the order the files were given, so
+    // an app reading the pack front to back meets them in that order
+    ArpPackHeader header;
+    memcpy(header.magic, ARPPACK_MAGIC, sizeof(header.magic));
+    header.version = ARPPACK_VERSION;
+    header.entryCount = entries.size();
+    header.entryOffset = sizeof(ArpPackHeader);
+    std::uint64_t offset = header.entryOffset + sizeof(ArpPackEntry) * entries.size();
+    offset = (offset + ARPPACK_ALIGNMENT - 1) / ARPPACK_ALIGNMENT * ARPPACK_ALIGNMENT;
+    header.dataOffset = offset;
+    for(ArpPackEntry& entry : entries) {
+        entry.offset = offset;
+        offset += (entry.size + ARPPACK_ALIGNMENT - 1) / ARPPACK_ALIGNMENT * ARPPACK_ALIGNMENT;
+    }
+
+    std::vector<std::size_t> order(entries.size());
+    for(std::size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+        return entries[a].hash != entries[b].hash ? entries[a].hash < entries[b].hash
+                                                  : strcmp(entries[a].name, entries[b].name) < 0;
+    });
+    for(std::size_t i = 1; i < order.size(); i++) {
+        if(strcmp(entries[order[i - 1]].name, entries[order[i]].name) == 0) {
+            std::cout << "Error: More than one file named " << entries[order[i]].name << std::endl;
+            return false;
+        }
+    }
+
+    FILE* file = fopen(fileName, "wb");
+    if(!file) {
+        std::cout << "Error: Unable to write " << fileName << std::endl;
+        return false;
+    }
+    fwrite(&header, sizeof(header), 1, file);
+    for(std::size_t i : order)
+        fwrite(&entries[i], sizeof(ArpPackEntry), 1, file);
+    static const char padding[ARPPACK_ALIGNMENT] = {};
+    std::uint64_t written = header.entryOffset + sizeof(ArpPackEntry) * entries.size();
+    for(std::size_t i = 0; i < entries.size(); i++) {
+        fwrite(padding, 1, entries[i].offset - written, file);
+        fwrite(contents[i].data(), 1, contents[i].size(), file);
+        written = entries[i].offset + contents[i].size();
+    }
+    bool success = !ferror(file);
+    fclose(file);
+    if(!success)
+        std::cout << "Error: Unable to write " << fileName << std::endl;
+    return success;
+}
+
+bool MappedArpPack::open(const char* fileName)
+{
+    if(!file.open(fileName))
+        return false;
+
+    const ArpPackHeader& h = header();
+    std::size_t size = file.size();
+    bool valid = size >= sizeof(ArpPackHeader) &&
+        memcmp(h.magic, ARPPACK_MAGIC, sizeof(h.magic)) == 0 &&
+        h.version == ARPPACK_VERSION &&
+        h.entryOffset % alignof(ArpPackEntry) == 0 &&
+        h.entryOffset + (std::uint64_t)sizeof(ArpPackEntry) * h.entryCount <= size;
+    for(std::uint32_t i = 0; valid && i < h.entryCount; i++) {
+        const ArpPackEntry& entry = entries()[i];
+        valid = entry.offset % ARPPACK_ALIGNMENT == 0 && entry.offset <= size && entry.size <= size - entry.offset &&
+            memchr(entry.name, '\0', sizeof(entry.name)) && (i == 0 || entries()[i - 1].hash <= entry.hash);
+    }
+    if(!valid) {
+        std::cout << "Error: " << fileName << " is not a valid version " << ARPPACK_VERSION << " .arppack" << std::endl;
+        close();
+        return false;
+    }
+
+    // the whole pack is wanted at startup, one read ahead beats a page
+    // fault per file
+    file.prefetch(0, size);
+    return true;
+}
+
+void MappedArpPack::close()
+{
+    file.close();
+}
+
+bool MappedArpPack::find(const char* path, const unsigned char*& data, std::size_t& size) const
+{
+    if(!isOpen())
+        return false;
+    std::string name = entryName(path);
+    std::uint64_t hash = arpPackHash(name.c_str());
+    const ArpPackEntry* first = entries();
+    const ArpPackEntry* last = first + header().entryCount;
+    const ArpPackEntry* entry = std::lower_bound(first, last, hash, [](const ArpPackEntry& entry, std::uint64_t hash) {
+        return entry.hash < hash;
+    });
+    for(; entry != last && entry->hash == hash; entry++) {
+        if(name == entry->name) {
+            data = file.data() + entry->offset;
+            size = entry->size;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,92 @@
+#ifndef arppack_h
+#define arppack_h
+
+#include "arpmesh.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * .arppack bundles the files an app loads at startup, like baked meshes,
+ * baked textures and shader sources, into one file that is memory mapped
+ * and read in one sequential pass instead of a seek per file. The file is
+ * laid out as
+ *
+ *   ArpPackHeader
+ *   ArpPackEntry[entryCount], sorted by hash
+ *   file contents, each starting on ARPPACK_ALIGNMENT
+ *
+ * Entries are named by file name without directories, so a pack is one flat
+ * directory. All values are little endian.
+ */
+
+static const char ARPPACK_MAGIC[8] = { 'A', 'R', 'P', 'P', 'A', 'C', 'K', '\0' };
+static const std::uint32_t ARPPACK_VERSION = 1;
+// of every entry's contents, so they can be used in place like their files
+static const std::size_t ARPPACK_ALIGNMENT = 64;
+
+struct ArpPackHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t entryCount;
+    // byte offsets from the start of the file
+    std::uint64_t entryOffset;
+    std::uint64_t dataOffset;
+};
+
+struct ArpPackEntry {
+    // arpPackHash of the name
+    std::uint64_t hash;
+    // byte offset from the start of the file
+    std::uint64_t offset;
+    std::uint64_t size;
+    char name[104];
+};
+
+/**
+ * 64 bit FNV-1a of the name, what the directory is sorted and searched by
+ */
+std::uint64_t arpPackHash(const char* name);
+
+/**
+ * Writes the files into a pack, named by their file names. Returns false
+ * and prints an error if a file can't be read, two have the same name or
+ * the pack can't be written
+ */
+bool writeArpPack(const char* fileName, const std::vector<std::string>& files);
+
+/**
+ * Read-only memory mapping of an .arppack. The contents of its entries stay
+ * valid until the pack is closed or destroyed
+ */
+class MappedArpPack {
+private:
+    MappedFile file;
+
+    const ArpPackEntry* entries() const { return (const ArpPackEntry*)(file.data() + header().entryOffset); }
+
+public:
+    MappedArpPack() = default;
+    MappedArpPack(const MappedArpPack&) = delete;
+    MappedArpPack& operator=(const MappedArpPack&) = delete;
+
+    /**
+     * Maps the pack, validates its directory and asks the OS to read all of
+     * it ahead. Returns false and prints an error if the pack can't be used
+     */
+    bool open(const char* fileName);
+    void close();
+    bool isOpen() const { return file.data() != nullptr; }
+
+    const ArpPackHeader& header() const { return *(const ArpPackHeader*)file.data(); }
+
+    /**
+     * Looks up the entry for the file name of path, ignoring its
+     * directories. Returns false if the pack has none
+     */
+    bool find(const char* path, const unsigned char*& data, std::size_t& size) const;
+};
+
+#endif /* arppack_h */
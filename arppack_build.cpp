@@ -0,0 +1,29 @@
+/**
+ * Bundles files into an .arppack, named by their file names. Bake meshes and
+ * textures first and pack the .arpmesh and .dds files, apps then find them
+ * in the pack where they would have looked next to their sources
+ *
+ * Usage: arppack_build <output.arppack> <file>...
+ */
+
+#include "arppack.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+int main(int argc, char *argv[]) {
+    if(argc < 3) {
+        std::cout << "Usage: arppack_build <output.arppack> <file>..." << std::endl;
+        return -1;
+    }
+    std::vector<std::string> files(argv + 2, argv + argc);
+    if(!writeArpPack(argv[1], files))
+        return 1;
+
+    MappedArpPack pack;
+    if(!pack.open(argv[1]))
+        return 1;
+    std::cout << argv[1] << ": " << pack.header().entryCount << " files" << std::endl;
+    return 0;
+}
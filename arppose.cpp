@@ -0,0 +1,143 @@
+#include "arppose.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace arp {
+
+TrackerPoseSource::TrackerPoseSource(double maxExtrapolation) : maxExtrapolation(maxExtrapolation) {}
+
+void TrackerPoseSource::push(const PoseSample& sample) {
+    samples.push(sample);
+}
+
+void TrackerPoseSource::clear() {
+    samples.clear();
+}
+
+/**
+ * Rotation vector of a unit quaternion, axis times angle, the shorter way
+ * around
+ */
+static glm::vec3 rotationLog(glm::quat q) {
+    if(q.w < 0)
+        q = -q;
+    glm::vec3 axis(q.x, q.y, q.z);
+    float sine = glm::length(axis);
+    if(sine < 1e-7f)
+        return axis * 2.0f;
+    return axis * (2.0f * std::atan2(sine, q.w) / sine);
+}
+
+static glm::quat rotationExp(const glm::vec3& rotation) {
+    float angle = glm::length(rotation);
+    if(angle < 1e-7f)
+        return glm::normalize(glm::quat(1, rotation.x * 0.5f, rotation.y * 0.5f, rotation.z * 0.5f));
+    return glm::angleAxis(angle, rotation / angle);
+}
+
+/**
+ * Squad's control point at q between its neighbours
+ */
+static glm::quat squadControl(const glm::quat& previous, const glm::quat& q, const glm::quat& next) {
+    glm::quat inverse = glm::inverse(q);
+    glm::vec3 sum = rotationLog(inverse * previous) + rotationLog(inverse * next);
+    return q * rotationExp(sum * -0.25f);
+}
+
+Pose interpolatePoses(const Pose& a, const Pose& b, float t) {
+    Pose result = t < 0.5f ? a : b;
+    result.position = glm::mix(a.position, b.position, t);
+    // the shorter way around
+    glm::quat to = glm::dot(a.orientation, b.orientation) < 0 ? -b.orientation : b.orientation;
+    result.orientation = glm::normalize(glm::slerp(a.orientation, to, t));
+    return result;
+}
+
+Pose interpolatePoses(const Pose& a, const Pose& b, const Pose& c, const Pose& d, float t) {
+    Pose result = t < 0.5f ? b : c;
+    float t2 = t * t;
+    float t3 = t2 * t;
+    result.position = 0.5f * (2.0f * b.position + (c.position - a.position) * t
+                              + (2.0f * a.position - 5.0f * b.position + 4.0f * c.position - d.position) * t2
+                              + (3.0f * b.position - a.position - 3.0f * c.position + d.position) * t3);
+
+    // each neighbour on the hemisphere of the one before, so no segment
+    // takes the long way around
+    glm::quat q0 = a.orientation;
+    glm::quat q1 = glm::dot(q0, b.orientation) < 0 ? -b.orientation : b.orientation;
+    glm::quat q2 = glm::dot(q1, c.orientation) < 0 ? -c.orientation : c.orientation;
+    glm::quat q3 = glm::dot(q2, d.orientation) < 0 ? -d.orientation : d.orientation;
+    glm::quat s1 = squadControl(q0, q1, q2);
+    glm::quat s2 = squadControl(q1, q2, q3);
+    glm::quat outer = glm::slerp(q1, q2, t);
+    glm::quat inner = glm::slerp(s1, s2, t);
+    result.orientation = glm::normalize(glm::slerp(outer, inner, 2.0f * t * (1.0f - t)));
+    return result;
+}
+
+PoseVelocity estimatePoseVelocity(const PoseSample* samples, int count) {
+    PoseVelocity velocity;
+    if(count < 2)
+        return velocity;
+    const PoseSample& newest = samples[count - 1];
+    glm::quat inverse = glm::inverse(newest.pose.orientation);
+    // lines through the newest sample, fitted to the others
+    double squares = 0;
+    glm::dvec3 linear(0);
+    glm::dvec3 angular(0);
+    for(int i = 0; i < count - 1; i++) {
+        double dt = samples[i].time - newest.time;
+        squares += dt * dt;
+        linear += dt * glm::dvec3(samples[i].pose.position - newest.pose.position);
+        angular += dt * glm::dvec3(rotationLog(samples[i].pose.orientation * inverse));
+    }
+    if(squares <= 0)
+        return velocity;
+    velocity.linear = glm::vec3(linear / squares);
+    velocity.angular = glm::vec3(angular / squares);
+    return velocity;
+}
+
+Pose extrapolatePose(const Pose& pose, const PoseVelocity& velocity, double dt) {
+    Pose result = pose;
+    result.position += velocity.linear * (float)dt;
+    result.orientation = glm::normalize(rotationExp(velocity.angular * (float)dt) * pose.orientation);
+    return result;
+}
+
+bool TrackerPoseSource::getPose(double time, Pose& pose) {
+    PoseSample history[CAPACITY];
+    int count = samples.snapshot(history, CAPACITY);
+    if(count == 0)
+        return false;
+    const PoseSample& newest = history[count - 1];
+    if(count == 1 || time <= history[0].time) {
+        pose = count == 1 || time > history[0].time ? newest.pose : history[0].pose;
+        return true;
+    }
+
+    if(time >= newest.time) {
+        const PoseSample& previous = history[count - 2];
+        double span = newest.time - previous.time;
+        if(span <= 0) {
+            pose = newest.pose;
+            return true;
+        }
+        double ahead = std::min(time - newest.time, maxExtrapolation);
+        pose = interpolatePoses(previous.pose, newest.pose, (float)(1 + ahead / span));
+        return true;
+    }
+
+    // the first sample after time, the one before it brackets it
+    int after = (int)(std::upper_bound(history, history + count, time,
+                                       [](double t, const PoseSample& sample) { return t < sample.time; })
+                      - history);
+    const PoseSample& before = history[after - 1];
+    const PoseSample& next = history[after];
+    double span = next.time - before.time;
+    pose = interpolatePoses(before.pose, next.pose, span > 0 ? (float)((time - before.time) / span) : 1.0f);
+    return true;
+}
+
+};
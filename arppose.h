@@ -0,0 +1,81 @@
+#ifndef ARPPOSE_H
+#define ARPPOSE_H
+
+#include "arp.h"
+#include "arpring.h"
+
+namespace arp {
+
+/**
+ * Linear velocity in units per second and angular velocity as a world space
+ * rotation vector, axis times radians per second
+ */
+struct PoseVelocity {
+    glm::vec3 linear = glm::vec3(0);
+    glm::vec3 angular = glm::vec3(0);
+};
+
+/**
+ * Pose a fraction t of the way from a to b, past b for t above 1, with the
+ * orientation slerped the shorter way around. Data other than position and
+ * orientation is taken from the nearer pose
+ */
+Pose interpolatePoses(const Pose& a, const Pose& b, float t);
+
+/**
+ * Pose a fraction t of the way from b to c on a smooth curve through a, b, c
+ * and d, with a and d the poses before and after: Catmull-Rom for the
+ * position and squad for the orientation, so the rate of turn doesn't jump
+ * at b and c the way slerping one pair after another does
+ */
+Pose interpolatePoses(const Pose& a, const Pose& b, const Pose& c, const Pose& d, float t);
+
+/**
+ * Least squares velocity of count samples, oldest first, as the motion from
+ * the newest back to the others. Rotations are compared through the
+ * logarithm of the rotation between them, so turns of any axis and rate fit
+ * alike. Zero with fewer than two samples
+ */
+PoseVelocity estimatePoseVelocity(const PoseSample* samples, int count);
+
+/**
+ * Moves pose on at velocity for dt seconds, turning it through the
+ * exponential map of the angular velocity
+ */
+Pose extrapolatePose(const Pose& pose, const PoseVelocity& velocity, double dt);
+
+/**
+ * Pose source fed with timestamped samples, for trackers running at a
+ * higher rate than the display. push is called by one thread, usually the
+ * tracker's own, and never blocks; reads copy the samples they need from a
+ * lock free ring. A pose between two samples is interpolated, one past the
+ * newest extrapolated from the last two, for at most maxExtrapolation
+ * seconds
+ */
+class TrackerPoseSource : public PoseSource {
+private:
+    static const int CAPACITY = 64;
+
+    HistoryRing<PoseSample, CAPACITY> samples;
+    double maxExtrapolation;
+
+public:
+    explicit TrackerPoseSource(double maxExtrapolation = 0.05);
+
+    /**
+     * Adds a sample, newer than the ones before it. One thread at a time
+     */
+    void push(const PoseSample& sample);
+
+    /**
+     * Drops all samples, for example after the tracker lost tracking. Same
+     * thread as push
+     */
+    void clear();
+
+    bool getPose(double time, Pose& pose) override;
+};
+
+};
+
+#endif // ARPPOSE_H
@@ -0,0 +1,118 @@
+#include "arppower.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <dirent.h>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#endif
+
+namespace arp {
+
+#if defined(_WIN32)
+
+PowerReading readPowerState() {
+    PowerReading reading;
+    SYSTEM_POWER_STATUS status;
+    if(!GetSystemPowerStatus(&status))
+        return reading;
+    reading.onBattery = status.ACLineStatus == 0;
+    if(status.BatteryLifePercent != 255)
+        reading.batteryPercent = status.BatteryLifePercent;
+    reading.batterySaver = status.SystemStatusFlag != 0;
+    // thermal zones need WMI and usually administrator rights, so Windows
+    // goes by the battery alone
+    return reading;
+}
+
+#elif defined(__linux__)
+
+static bool readLine(const std::string& path, std::string& line) {
+    std::ifstream file(path);
+    return file && std::getline(file, line);
+}
+
+static bool readNumber(const std::string& path, long long& value) {
+    std::string line;
+    if(!readLine(path, line))
+        return false;
+    try {
+        value = std::stoll(line);
+    }
+    catch(...) {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Calls f with the path of every entry of directory starting with prefix
+ */
+template<class F>
+static void forEachEntry(const char* directory, const char* prefix, F f) {
+    DIR* dir = opendir(directory);
+    if(!dir)
+        return;
+    std::string prefixString = prefix;
+    while(dirent* entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if(name.compare(0, prefixString.size(), prefixString) == 0 && name != "." && name != "..")
+            f(std::string(directory) + "/" + name);
+    }
+    closedir(dir);
+}
+
+PowerReading readPowerState() {
+    PowerReading reading;
+    forEachEntry("/sys/class/power_supply", "", [&](const std::string& supply) {
+        std::string type, status;
+        long long capacity;
+        if(!readLine(supply + "/type", type) || type != "Battery")
+            return;
+        if(readLine(supply + "/status", status) && status == "Discharging")
+            reading.onBattery = true;
+        if(readNumber(supply + "/capacity", capacity))
+            reading.batteryPercent = reading.batteryPercent < 0 ? (int)capacity
+                                                                : std::min(reading.batteryPercent, (int)capacity);
+    });
+    // zones and their trip points report millidegrees
+    forEachEntry("/sys/class/thermal", "thermal_zone", [&](const std::string& zone) {
+        long long milli;
+        if(!readNumber(zone + "/temp", milli) || milli <= 0)
+            return;
+        double temperature = milli / 1000.0;
+        reading.temperature = std::max(reading.temperature, temperature);
+        for(int trip = 0;; trip++) {
+            std::string prefix = zone + "/trip_point_" + std::to_string(trip);
+            std::string type;
+            long long tripMilli;
+            if(!readLine(prefix + "_type", type) || !readNumber(prefix + "_temp", tripMilli))
+                break;
+            if((type != "passive" && type != "hot" && type != "critical") || tripMilli <= 0)
+                continue;
+            double headroom = tripMilli / 1000.0 - temperature;
+            if(reading.tripHeadroom < 0 || headroom < reading.tripHeadroom)
+                reading.tripHeadroom = std::max(headroom, 0.0);
+        }
+    });
+    // the ACPI platform profile, which power-profiles-daemon switches to
+    // low-power in power saver mode
+    std::string profile;
+    if(readLine("/sys/firmware/acpi/platform_profile", profile))
+        reading.batterySaver = profile == "low-power" || profile == "quiet";
+    return reading;
+}
+
+#else
+
+PowerReading readPowerState() {
+    return PowerReading();
+}
+
+#endif
+
+};
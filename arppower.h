@@ -0,0 +1,29 @@
+#ifndef ARPPOWER_H
+#define ARPPOWER_H
+
+namespace arp {
+
+/**
+ * What the OS reports about the power supply and temperature, -1 where it
+ * doesn't report a value
+ */
+struct PowerReading {
+    bool onBattery = false;
+    int batteryPercent = -1;
+    // the OS's own battery saver is on
+    bool batterySaver = false;
+    // hottest thermal zone in degrees Celsius
+    double temperature = -1;
+    // degrees left before the nearest throttling trip point of any zone
+    double tripHeadroom = -1;
+};
+
+/**
+ * Reads the power supply and thermal zones. Reads files or asks the OS, so
+ * it is called every few seconds, not every refresh
+ */
+PowerReading readPowerState();
+
+};
+
+#endif // ARPPOWER_H
@@ -0,0 +1,153 @@
+#include "arppresent.h"
+
+#include <GL/glew.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <dwmapi.h>
+#elif defined(__linux__)
+#include <GL/glxew.h>
+#include <chrono>
+#endif
+
+#include <algorithm>
+#include <cmath>
+
+namespace arp {
+
+// timestamps further than this from now are from a different clock
+static const double MAX_CLOCK_SKEW = 1.0;
+
+double RefreshModel::nextVblank(double time) const {
+    return phase + std::ceil((time - phase) / period) * period;
+}
+
+double RefreshModel::nearestVblank(double time) const {
+    return phase + std::round((time - phase) / period) * period;
+}
+
+RefreshClock::RefreshClock(double nominalPeriod) {
+    reset(nominalPeriod);
+}
+
+void RefreshClock::reset(double nominalPeriod) {
+    this->nominalPeriod = nominalPeriod;
+    sampleCount = 0;
+    newest = -1;
+    fitted.phase = 0;
+    fitted.period = nominalPeriod;
+}
+
+void RefreshClock::addSample(double time, std::int64_t count) {
+    if(sampleCount > 0) {
+        const Sample& last = samples[newest];
+        double gap = time - last.time;
+        if(count < 0)
+            count = last.count + std::max<std::int64_t>(1, std::llround(gap / fitted.period));
+        // the same vblank reported again, for example after a skipped swap
+        if(count == last.count)
+            return;
+        // the counter went backwards or the display was asleep, older
+        // samples say nothing about the current timing
+        if(count < last.count || gap <= 0 || gap > 1.0)
+            reset(nominalPeriod);
+    }
+    newest = (newest + 1) % MAX_SAMPLES;
+    samples[newest] = { time, std::max<std::int64_t>(count, 0) };
+    if(sampleCount < MAX_SAMPLES)
+        sampleCount++;
+    fit();
+}
+
+void RefreshClock::addVariableSample(double time) {
+    reset(nominalPeriod);
+    fitted.phase = time;
+}
+
+/**
+ * Least squares line through time against vblank count. Times and counts are
+ * relative to the newest sample to keep the fit well conditioned, so the
+ * intercept is the fitted time of the newest vblank
+ */
+void RefreshClock::fit() {
+    const Sample& last = samples[newest];
+    double sumX = 0, sumY = 0, sumXX = 0, sumXY = 0;
+    for(int i = 0; i < sampleCount; i++) {
+        double x = (double)(samples[i].count - last.count);
+        double y = samples[i].time - last.time;
+        sumX += x;
+        sumY += y;
+        sumXX += x * x;
+        sumXY += x * y;
+    }
+    double n = sampleCount;
+    double denominator = n * sumXX - sumX * sumX;
+
+    double period = nominalPeriod;
+    // a handful of samples would let jitter dominate the slope
+    if(sampleCount >= 8 && denominator > 0)
+        period = (n * sumXY - sumX * sumY) / denominator;
+    // reject fits nowhere near the display's mode
+    if(!(period > nominalPeriod * 0.5 && period < nominalPeriod * 1.5))
+        period = nominalPeriod;
+
+    fitted.period = period;
+    fitted.phase = last.time + (sumY - period * sumX) / n;
+}
+
+#if defined(_WIN32)
+
+bool queryLastVblank(GLFWwindow* window, double& time, std::int64_t& count) {
+    DWM_TIMING_INFO info = {};
+    info.cbSize = sizeof(info);
+    if(FAILED(DwmGetCompositionTimingInfo(nullptr, &info)))
+        return false;
+
+    LARGE_INTEGER frequency, now;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&now);
+    double glfwNow = glfwGetTime();
+
+    time = glfwNow - (double)(now.QuadPart - (LONGLONG)info.qpcVBlank) / frequency.QuadPart;
+    count = (std::int64_t)info.cRefresh;
+    return std::abs(time - glfwNow) < MAX_CLOCK_SKEW;
+}
+
+#elif defined(__linux__)
+
+bool queryLastVblank(GLFWwindow* window, double& time, std::int64_t& count) {
+    // the window's context is current wherever it is swapped, and GLX can
+    // tell its drawable without GLFW's native access
+    if(!GLXEW_OML_sync_control || glfwGetCurrentContext() != window)
+        return false;
+    Display* display = glXGetCurrentDisplay();
+    GLXDrawable drawable = glXGetCurrentDrawable();
+    if(!display || !drawable)
+        return false;
+
+    int64_t ust, msc, sbc;
+    if(!glXGetSyncValuesOML(display, drawable, &ust, &msc, &sbc) || ust == 0)
+        return false;
+
+    // ust is in microseconds of CLOCK_MONOTONIC, the clock steady_clock and
+    // glfwGetTime use on Linux, but with a different origin
+    double monotonicNow = std::chrono::duration<double>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    double glfwNow = glfwGetTime();
+
+    time = glfwNow - (monotonicNow - ust * 1e-6);
+    count = msc;
+    return std::abs(time - glfwNow) < MAX_CLOCK_SKEW;
+}
+
+#else
+
+bool queryLastVblank(GLFWwindow* window, double& time, std::int64_t& count) {
+    return false;
+}
+
+#endif
+
+};
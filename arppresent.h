@@ -0,0 +1,88 @@
+#ifndef ARPPRESENT_H
+#define ARPPRESENT_H
+
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include <cstdint>
+
+namespace arp {
+
+/**
+ * Vblank times of a display, as a phase and a period. All times are
+ * glfwGetTime() values in seconds
+ */
+struct RefreshModel {
+    // time of a vblank
+    double phase;
+    double period;
+
+    /**
+     * Returns the first vblank at or after time
+     */
+    double nextVblank(double time) const;
+
+    /**
+     * Returns the vblank closest to time
+     */
+    double nearestVblank(double time) const;
+};
+
+/**
+ * Fits a RefreshModel to present timestamps. Timestamps come with the
+ * display's vblank counter when the platform reports one, otherwise the
+ * count is derived from the gap to the previous timestamp
+ */
+class RefreshClock {
+private:
+    static const int MAX_SAMPLES = 64;
+
+    struct Sample {
+        double time;
+        std::int64_t count;
+    };
+
+    Sample samples[MAX_SAMPLES];
+    int sampleCount = 0;
+    int newest = -1;
+    double nominalPeriod;
+    RefreshModel fitted;
+
+    void fit();
+
+public:
+    explicit RefreshClock(double nominalPeriod = 1.0 / 60.0);
+
+    /**
+     * Restarts the fit, for example when the display changes
+     */
+    void reset(double nominalPeriod);
+
+    /**
+     * Adds the time of a vblank. count is the display's vblank counter, or
+     * negative if it is unknown
+     */
+    void addSample(double time, std::int64_t count = -1);
+
+    /**
+     * Restarts the fit at a present on a variable refresh display, which
+     * has no vblank grid to fit. The model then has the present as its
+     * phase and the nominal period, the shortest the display refreshes in
+     */
+    void addVariableSample(double time);
+
+    const RefreshModel& model() const { return fitted; }
+};
+
+/**
+ * Reads when the window's display last started scanning out a new image,
+ * and the display's vblank counter at that time, from the platform's swap
+ * statistics (GLX_OML_sync_control, DWM composition timing). Returns false
+ * if the platform does not expose them, the time of swap completion is the
+ * best estimate then
+ */
+bool queryLastVblank(GLFWwindow* window, double& time, std::int64_t& count);
+
+};
+
+#endif // ARPPRESENT_H
@@ -0,0 +1,1362 @@
+#include "arpremote.h"
+#include "arpshm.h"
+#include "arpstate.h"
+
+#include <GL/glew.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+namespace arp {
+
+// largest message either end accepts, a few 4K layers
+static const std::uint32_t MAX_REMOTE_MESSAGE = 512u << 20;
+// rings of a local compositor's channel, poses to the app and frames back,
+// a few 1080p frames unpacked
+static const std::size_t LOCAL_POSE_RING = 64u << 10;
+static const std::size_t LOCAL_FRAME_RING = 64u << 20;
+// weight of a new round trip in the smoothed one, also used for display
+// latency, jitter and frame interval
+static const double ROUND_TRIP_SMOOTHING = 0.1;
+// display latency samples are clamped to this many jitters from the mean
+static const double LATENCY_OUTLIER_JITTERS = 3;
+// transfers are timed as at least this long, shorter ones only measure the
+// socket's buffers and give a lower bound of the receive rate
+static const double MIN_TRANSFER_TIME = 0.002;
+// network delay past its base that counts as congestion
+static const double STREAM_QUEUE_DELAY = 0.02;
+// weight of a new network delay in its base when above it, so the base
+// follows a route that got longer
+static const double BASE_DELAY_DRIFT = 0.01;
+// raw frames come back after packing once they fit this many times over
+static const double RAW_ENCODING_HEADROOM = 1.25;
+// how often a broadcast server's accept thread checks for stop, and its
+// receiveViews for poses
+static const double ACCEPT_POLL_INTERVAL = 0.1;
+static const double VIEW_POLL_INTERVAL = 0.001;
+
+static double smooth(double value, double sample) {
+    return value == 0 ? sample : value + (sample - value) * ROUND_TRIP_SMOOTHING;
+}
+
+#ifdef _WIN32
+typedef SOCKET NativeSocket;
+static const NativeSocket invalidSocket = INVALID_SOCKET;
+
+static bool startSockets() {
+    static bool started = false;
+    if(!started) {
+        WSADATA data;
+        started = WSAStartup(MAKEWORD(2, 2), &data) == 0;
+    }
+    return started;
+}
+
+static void closeSocket(NativeSocket s) {
+    closesocket(s);
+}
+#else
+typedef int NativeSocket;
+static const NativeSocket invalidSocket = -1;
+
+static bool startSockets() {
+    return true;
+}
+
+static void closeSocket(NativeSocket s) {
+    ::close(s);
+}
+#endif
+
+/**
+ * Sends all of data, returns false once the connection is gone
+ */
+static bool sendAll(NativeSocket s, const void* data, std::size_t size) {
+    const char* bytes = (const char*)data;
+    while(size > 0) {
+        int chunk = (int)std::min(size, (std::size_t)1 << 30);
+#ifdef MSG_NOSIGNAL
+        int sent = ::send(s, bytes, chunk, MSG_NOSIGNAL);
+#else
+        int sent = ::send(s, bytes, chunk, 0);
+#endif
+        if(sent <= 0)
+            return false;
+        bytes += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+/**
+ * Receives exactly size bytes, returns false once the connection is gone
+ */
+static bool receiveAll(NativeSocket s, void* data, std::size_t size) {
+    char* bytes = (char*)data;
+    while(size > 0) {
+        int chunk = (int)std::min(size, (std::size_t)1 << 30);
+        int received = ::recv(s, bytes, chunk, 0);
+        if(received <= 0)
+            return false;
+        bytes += received;
+        size -= received;
+    }
+    return true;
+}
+
+/**
+ * Sends over the shared channel of a local connection, or else the socket
+ */
+static bool sendAll(std::intptr_t s, SharedChannel* channel, const void* data, std::size_t size) {
+    return channel ? channel->send(data, size) : sendAll((NativeSocket)s, data, size);
+}
+
+static bool receiveAll(std::intptr_t s, SharedChannel* channel, void* data, std::size_t size) {
+    return channel ? channel->receive(data, size) : receiveAll((NativeSocket)s, data, size);
+}
+
+/**
+ * Receives the next message into payload, returns false once the
+ * connection is gone or the message is too large to be one of ours
+ */
+static bool receiveMessage(std::intptr_t s, SharedChannel* channel, RemoteMessageHeader& header,
+                           std::vector<char>& payload, double* headerTime = nullptr) {
+    if(!receiveAll(s, channel, &header, sizeof(header)) || header.size > MAX_REMOTE_MESSAGE)
+        return false;
+    if(headerTime)
+        *headerTime = glfwGetTime();
+    payload.resize(header.size);
+    return receiveAll(s, channel, payload.data(), payload.size());
+}
+
+/**
+ * Poses and frames are small or sent whole, so Nagle's delay only adds
+ * latency
+ */
+static void setNoDelay(NativeSocket s) {
+    int enabled = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&enabled, sizeof(enabled));
+}
+
+/**
+ * Wakes threads blocked on the socket so they can be joined
+ */
+static void shutdownSocket(std::intptr_t s) {
+    if(s == (std::intptr_t)invalidSocket)
+        return;
+#ifdef _WIN32
+    shutdown((NativeSocket)s, SD_BOTH);
+#else
+    shutdown((NativeSocket)s, SHUT_RDWR);
+#endif
+}
+
+static const char* packVertSrc =
+    "#version 150\n"
+    "void main() {\n"
+    "    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);\n"
+    "    gl_Position = vec4(corner * 2.0 - 1.0, 0, 1);\n"
+    "}\n"
+    ;
+
+// distance along the view direction from window depth and back, for each
+// DepthMapping
+#define PACK_DEPTH_SRC \
+    "uniform int depthMapping;\n" \
+    "uniform vec2 depthRange;\n" \
+    "\n" \
+    "float depthDistance(float depth) {\n" \
+    "    float n = depthRange.x;\n" \
+    "    float f = depthRange.y;\n" \
+    "    if(depthMapping == 1)\n" \
+    "        return n * f / (n + depth * (f - n));\n" \
+    "    if(depthMapping == 2)\n" \
+    "        return n + depth * (f - n);\n" \
+    "    return n * f / (f - depth * (f - n));\n" \
+    "}\n" \
+    "\n" \
+    "float windowDepth(float distance) {\n" \
+    "    float n = depthRange.x;\n" \
+    "    float f = depthRange.y;\n" \
+    "    if(depthMapping == 1)\n" \
+    "        return n * (f - distance) / (distance * (f - n));\n" \
+    "    if(depthMapping == 2)\n" \
+    "        return (distance - n) / (f - n);\n" \
+    "    return (1.0 / n - 1.0 / distance) / (1.0 / n - 1.0 / f);\n" \
+    "}\n"
+
+/**
+ * Packs the viewport of a color image into the YCoCg 4:2:0 plane of
+ * REMOTE_ENCODING_PACKED, drawn over the whole plane
+ */
+static const char* packColorFragSrc =
+    "#version 150\n"
+    "uniform sampler2D image;\n"
+    "// x, y, width and height in the image\n"
+    "uniform ivec4 viewport;\n"
+    "out vec4 color;\n"
+    "\n"
+    "vec3 pixel(ivec2 p) {\n"
+    "    return texelFetch(image, viewport.xy + min(p, viewport.zw - 1), 0).rgb;\n"
+    "}\n"
+    "\n"
+    "void main() {\n"
+    "    ivec2 p = ivec2(gl_FragCoord.xy);\n"
+    "    if(p.y < viewport.w) {\n"
+    "        color = vec4(dot(pixel(p), vec3(0.25, 0.5, 0.25)));\n"
+    "        return;\n"
+    "    }\n"
+    "    int chromaWidth = (viewport.z + 1) / 2;\n"
+    "    bool green = p.x >= chromaWidth;\n"
+    "    ivec2 q = ivec2(green ? p.x - chromaWidth : p.x, p.y - viewport.w) * 2;\n"
+    "    vec3 average = (pixel(q) + pixel(q + ivec2(1, 0)) + pixel(q + ivec2(0, 1)) + pixel(q + ivec2(1, 1))) * 0.25;\n"
+    "    float chroma = green ? dot(average, vec3(-0.25, 0.5, -0.25)) : dot(average, vec3(0.5, 0, -0.5));\n"
+    "    color = vec4(chroma + 0.5);\n"
+    "}\n"
+    ;
+
+/**
+ * Packs the viewport of a depth image into the 16 bit log distance plane of
+ * REMOTE_ENCODING_PACKED
+ */
+static const char* packDepthFragSrc =
+    "#version 150\n"
+    "uniform sampler2D image;\n"
+    "uniform ivec4 viewport;\n"
+    PACK_DEPTH_SRC
+    "out vec4 color;\n"
+    "\n"
+    "void main() {\n"
+    "    float depth = texelFetch(image, viewport.xy + ivec2(gl_FragCoord.xy), 0).r;\n"
+    "    float distance = clamp(depthDistance(depth), depthRange.x, depthRange.y);\n"
+    "    color = vec4(log(distance / depthRange.x) / log(depthRange.y / depthRange.x));\n"
+    "}\n"
+    ;
+
+/**
+ * Unpacks REMOTE_ENCODING_PACKED planes into a swapchain image, drawn over
+ * its whole framebuffer. Raw depth is uploaded straight into the image and
+ * kept by the depth test
+ */
+static const char* unpackFragSrc =
+    "#version 150\n"
+    "uniform sampler2D colorPlane;\n"
+    "uniform sampler2D depthPlane;\n"
+    "// width and height of the layer\n"
+    "uniform ivec2 size;\n"
+    "uniform bool packedDepth;\n"
+    "// alpha 0 at the far plane\n"
+    "uniform bool alphaFromDepth;\n"
+    PACK_DEPTH_SRC
+    "out vec4 color;\n"
+    "\n"
+    "void main() {\n"
+    "    ivec2 p = ivec2(gl_FragCoord.xy);\n"
+    "    float luma = texelFetch(colorPlane, p, 0).r;\n"
+    "    ivec2 q = ivec2(p.x / 2, size.y + p.y / 2);\n"
+    "    float orange = texelFetch(colorPlane, q, 0).r - 0.5;\n"
+    "    float green = texelFetch(colorPlane, q + ivec2((size.x + 1) / 2, 0), 0).r - 0.5;\n"
+    "    float t = luma - green;\n"
+    "    color = vec4(t + orange, luma + green, t - orange, 1);\n"
+    "    if(!packedDepth) {\n"
+    "        gl_FragDepth = gl_FragCoord.z;\n"
+    "        return;\n"
+    "    }\n"
+    "    float encoded = texelFetch(depthPlane, p, 0).r;\n"
+    "    // the far plane exactly, which empty pixels are compared with\n"
+    "    if(encoded >= 1.0) {\n"
+    "        gl_FragDepth = depthMapping == 1 ? 0.0 : 1.0;\n"
+    "        if(alphaFromDepth)\n"
+    "            color.a = 0.0;\n"
+    "        return;\n"
+    "    }\n"
+    "    float distance = depthRange.x * pow(depthRange.y / depthRange.x, encoded);\n"
+    "    gl_FragDepth = windowDepth(distance);\n"
+    "}\n"
+    ;
+
+/**
+ * The GL objects packing and unpacking REMOTE_ENCODING_PACKED layers
+ */
+class RemotePacker {
+private:
+    GLuint vertexArray = 0;
+    GLuint framebuffer = 0;
+    GLuint colorProgram = 0;
+    GLuint depthProgram = 0;
+    GLuint unpackProgram = 0;
+    // plane textures, resized to the largest layer
+    GLuint colorPlane = 0;
+    GLuint depthPlane = 0;
+    int colorPlaneSize[2] = { 0, 0 };
+    int depthPlaneSize[2] = { 0, 0 };
+
+    GLint colorViewportLoc;
+    GLint depthViewportLoc;
+    GLint depthMappingLoc;
+    GLint depthRangeLoc;
+    GLint unpackSizeLoc;
+    GLint unpackPackedDepthLoc;
+    GLint unpackAlphaFromDepthLoc;
+    GLint unpackDepthMappingLoc;
+    GLint unpackDepthRangeLoc;
+
+    static GLuint buildProgram(const char* fragSrc);
+    static void resizePlane(GLuint& plane, int size[2], GLenum internalFormat, int width, int height);
+    void drawPlane(GLuint plane, int width, int height);
+
+public:
+    RemotePacker();
+    ~RemotePacker();
+
+    /**
+     * Size of the color plane of a width by height layer
+     */
+    static void colorPlaneExtent(int width, int height, int& planeWidth, int& planeHeight);
+
+    /**
+     * Packs a layer's viewport and reads its planes into the bound pixel
+     * pack buffer at offset, the color plane first. Depth is packed only
+     * if header.depthEncoding is REMOTE_ENCODING_PACKED
+     */
+    void pack(const FrameLayer& layer, const RemoteLayerHeader& header, int x, int y, std::size_t offset);
+
+    /**
+     * Unpacks a layer into an acquired swapchain image. depth is raw float
+     * depth uploaded as it is unless header.depthEncoding is packed
+     */
+    void unpack(const RemoteLayerHeader& header, const char* color, const char* depth,
+                Swapchain& swapchain, int index);
+};
+
+RemotePacker::RemotePacker() {
+    glGenVertexArrays(1, &vertexArray);
+    glGenFramebuffers(1, &framebuffer);
+    colorProgram = buildProgram(packColorFragSrc);
+    depthProgram = buildProgram(packDepthFragSrc);
+    unpackProgram = buildProgram(unpackFragSrc);
+    colorViewportLoc = glGetUniformLocation(colorProgram, "viewport");
+    depthViewportLoc = glGetUniformLocation(depthProgram, "viewport");
+    depthMappingLoc = glGetUniformLocation(depthProgram, "depthMapping");
+    depthRangeLoc = glGetUniformLocation(depthProgram, "depthRange");
+    unpackSizeLoc = glGetUniformLocation(unpackProgram, "size");
+    unpackPackedDepthLoc = glGetUniformLocation(unpackProgram, "packedDepth");
+    unpackAlphaFromDepthLoc = glGetUniformLocation(unpackProgram, "alphaFromDepth");
+    unpackDepthMappingLoc = glGetUniformLocation(unpackProgram, "depthMapping");
+    unpackDepthRangeLoc = glGetUniformLocation(unpackProgram, "depthRange");
+    glState().useProgram(unpackProgram);
+    glUniform1i(glGetUniformLocation(unpackProgram, "colorPlane"), 0);
+    glUniform1i(glGetUniformLocation(unpackProgram, "depthPlane"), 1);
+}
+
+RemotePacker::~RemotePacker() {
+    glState().forgetVertexArray(vertexArray);
+    glDeleteVertexArrays(1, &vertexArray);
+    glState().forgetFramebuffer(framebuffer);
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteProgram(colorProgram);
+    glDeleteProgram(depthProgram);
+    glDeleteProgram(unpackProgram);
+    for(GLuint* plane : { &colorPlane, &depthPlane }) {
+        glState().forgetTexture(*plane);
+        glDeleteTextures(1, plane);
+    }
+}
+
+GLuint RemotePacker::buildProgram(const char* fragSrc) {
+    GLuint program = glCreateProgram();
+    const char* sources[] = { packVertSrc, fragSrc };
+    GLenum types[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+    for(int i = 0; i < 2; i++) {
+        GLuint shader = glCreateShader(types[i]);
+        glShaderSource(shader, 1, &sources[i], nullptr);
+        glCompileShader(shader);
+        GLint compiled = GL_FALSE;
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+        if(!compiled) {
+            char log[1024];
+            glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+            std::cout << "Error compiling remote packing shader: " << log << std::endl;
+        }
+        glAttachShader(program, shader);
+        glDeleteShader(shader);
+    }
+    glLinkProgram(program);
+    return program;
+}
+
+void RemotePacker::resizePlane(GLuint& plane, int size[2], GLenum internalFormat, int width, int height) {
+    if(plane && size[0] >= width && size[1] >= height)
+        return;
+    width = std::max(width, size[0]);
+    height = std::max(height, size[1]);
+    if(!plane)
+        glGenTextures(1, &plane);
+    glState().bindTexture(0, GL_TEXTURE_2D, plane);
+    GLenum type = internalFormat == GL_R16 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE;
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, GL_RED, type, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    size[0] = width;
+    size[1] = height;
+}
+
+void RemotePacker::colorPlaneExtent(int width, int height, int& planeWidth, int& planeHeight) {
+    planeWidth = (width + 1) / 2 * 2;
+    planeHeight = height + (height + 1) / 2;
+}
+
+/**
+ * Draws the bound program into the corner of a plane and leaves it bound
+ * for reading
+ */
+void RemotePacker::drawPlane(GLuint plane, int width, int height) {
+    glState().bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, plane, 0);
+    glState().viewport(0, 0, width, height);
+    glState().bindVertexArray(vertexArray);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+}
+
+void RemotePacker::pack(const FrameLayer& layer, const RemoteLayerHeader& header, int x, int y,
+                        std::size_t offset) {
+    bool depthTest = glIsEnabled(GL_DEPTH_TEST);
+    bool blend = glIsEnabled(GL_BLEND);
+    glState().setEnabled(GL_DEPTH_TEST, false);
+    glState().setEnabled(GL_BLEND, false);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+    int planeWidth, planeHeight;
+    colorPlaneExtent(header.width, header.height, planeWidth, planeHeight);
+    resizePlane(colorPlane, colorPlaneSize, GL_R8, planeWidth, planeHeight);
+    glState().useProgram(colorProgram);
+    glUniform4i(colorViewportLoc, x, y, header.width, header.height);
+    glState().bindTexture(0, GL_TEXTURE_2D, layer.swapchain->images[layer.swapchainIndex]);
+    drawPlane(colorPlane, planeWidth, planeHeight);
+    glReadPixels(0, 0, planeWidth, planeHeight, GL_RED, GL_UNSIGNED_BYTE, (GLvoid*)offset);
+    offset += header.colorBytes;
+
+    if(header.depthEncoding == REMOTE_ENCODING_PACKED) {
+        resizePlane(depthPlane, depthPlaneSize, GL_R16, header.width, header.height);
+        glState().useProgram(depthProgram);
+        glUniform4i(depthViewportLoc, x, y, header.width, header.height);
+        glUniform1i(depthMappingLoc, layer.projection.depthMapping);
+        glUniform2f(depthRangeLoc, layer.projection.nearPlane, layer.projection.farPlane);
+        glState().bindTexture(0, GL_TEXTURE_2D, layer.swapchain->depthImages[layer.swapchainIndex]);
+        drawPlane(depthPlane, header.width, header.height);
+        glReadPixels(0, 0, header.width, header.height, GL_RED, GL_UNSIGNED_SHORT, (GLvoid*)offset);
+    }
+    else if(header.depthBytes) {
+        layer.swapchain->bindFramebuffer(layer.swapchainIndex);
+        glReadPixels(x, y, header.width, header.height, GL_DEPTH_COMPONENT, GL_FLOAT, (GLvoid*)offset);
+    }
+
+    glState().setEnabled(GL_DEPTH_TEST, depthTest);
+    glState().setEnabled(GL_BLEND, blend);
+}
+
+void RemotePacker::unpack(const RemoteLayerHeader& header, const char* color, const char* depth,
+                          Swapchain& swapchain, int index) {
+    int planeWidth, planeHeight;
+    colorPlaneExtent(header.width, header.height, planeWidth, planeHeight);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    resizePlane(colorPlane, colorPlaneSize, GL_R8, planeWidth, planeHeight);
+    glState().bindTexture(0, GL_TEXTURE_2D, colorPlane);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, planeWidth, planeHeight, GL_RED, GL_UNSIGNED_BYTE, color);
+    bool packedDepth = header.depthEncoding == REMOTE_ENCODING_PACKED && header.depthBytes;
+    if(packedDepth) {
+        resizePlane(depthPlane, depthPlaneSize, GL_R16, header.width, header.height);
+        glState().bindTexture(1, GL_TEXTURE_2D, depthPlane);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, header.width, header.height, GL_RED, GL_UNSIGNED_SHORT, depth);
+    }
+    else if(header.depthBytes) {
+        glState().bindTexture(0, GL_TEXTURE_2D, swapchain.depthImages[index]);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, header.width, header.height, GL_DEPTH_COMPONENT, GL_FLOAT, depth);
+        glState().bindTexture(0, GL_TEXTURE_2D, colorPlane);
+    }
+
+    // raw depth is already in the image, with the depth test off it stays
+    bool depthTest = glIsEnabled(GL_DEPTH_TEST);
+    bool blend = glIsEnabled(GL_BLEND);
+    GLint depthFunc;
+    glGetIntegerv(GL_DEPTH_FUNC, &depthFunc);
+    glState().setEnabled(GL_DEPTH_TEST, packedDepth);
+    glState().setEnabled(GL_BLEND, false);
+    glDepthFunc(GL_ALWAYS);
+
+    glState().useProgram(unpackProgram);
+    glUniform2i(unpackSizeLoc, header.width, header.height);
+    glUniform1i(unpackPackedDepthLoc, packedDepth);
+    glUniform1i(unpackAlphaFromDepthLoc, packedDepth && (header.flags & ALPHA_MASKED));
+    glUniform1i(unpackDepthMappingLoc, header.projection.depthMapping);
+    glUniform2f(unpackDepthRangeLoc, header.projection.nearPlane, header.projection.farPlane);
+    swapchain.bindFramebuffer(index);
+    glState().viewport(0, 0, header.width, header.height);
+    glState().bindVertexArray(vertexArray);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glDepthFunc(depthFunc);
+    glState().setEnabled(GL_DEPTH_TEST, depthTest);
+    glState().setEnabled(GL_BLEND, blend);
+}
+
+RemoteServer::RemoteServer() = default;
+
+RemoteServer::~RemoteServer() {
+    close();
+}
+
+bool RemoteServer::listen(int port) {
+    close();
+    if(!startSockets()) {
+        std::cout << "Error: could not start sockets" << std::endl;
+        return false;
+    }
+    NativeSocket listener = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if(listener == invalidSocket) {
+        std::cout << "Error: could not create a socket" << std::endl;
+        return false;
+    }
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons((unsigned short)port);
+    if(bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || ::listen(listener, 1) != 0) {
+        std::cout << "Error: could not listen on port " << port << std::endl;
+        closeSocket(listener);
+        return false;
+    }
+    NativeSocket client = accept(listener, nullptr, nullptr);
+    closeSocket(listener);
+    if(client == invalidSocket) {
+        std::cout << "Error: could not accept a client on port " << port << std::endl;
+        return false;
+    }
+    attach((std::intptr_t)client);
+    return true;
+}
+
+/**
+ * Serves a client that already connected
+ */
+void RemoteServer::attach(std::intptr_t client) {
+    setNoDelay((NativeSocket)client);
+    socket = client;
+    startThreads();
+}
+
+bool RemoteServer::connectLocal(const char* name) {
+    close();
+    channel = SharedChannel::open(name);
+    if(!channel) {
+        std::cout << "Error: no compositor is waiting as " << name << std::endl;
+        return false;
+    }
+    startThreads();
+    return true;
+}
+
+void RemoteServer::startThreads() {
+    closing = false;
+    hasPose = false;
+    outgoing.clear();
+    connected = true;
+    receiveThread = std::thread(&RemoteServer::receiveLoop, this);
+    sendThread = std::thread(&RemoteServer::sendLoop, this);
+}
+
+void RemoteServer::receiveLoop() {
+    RemoteMessageHeader header;
+    std::vector<char> payload;
+    while(receiveMessage(socket, channel.get(), header, payload)) {
+        if(header.type != REMOTE_MESSAGE_POSE || payload.size() != sizeof(RemotePoseMessage))
+            continue;
+        std::lock_guard<std::mutex> lock(mutex);
+        std::memcpy(&latestPose, payload.data(), sizeof(latestPose));
+        latestPoseTime = glfwGetTime();
+        hasPose = true;
+        cond.notify_all();
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    connected = false;
+    cond.notify_all();
+}
+
+void RemoteServer::sendLoop() {
+    std::vector<char> message;
+    while(true) {
+        double poseTime;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [&]() { return closing || !connected || !outgoing.empty(); });
+            if(closing || !connected)
+                return;
+            message.swap(outgoing);
+            outgoing.clear();
+            poseTime = outgoingPoseTime;
+        }
+        // only known once the frame leaves, after any wait for the network
+        double serverDelay = glfwGetTime() - poseTime;
+        std::memcpy(message.data() + sizeof(RemoteMessageHeader) + offsetof(RemoteFrameHeader, serverDelay),
+                    &serverDelay, sizeof(serverDelay));
+        if(!sendAll(socket, channel.get(), message.data(), message.size())) {
+            std::lock_guard<std::mutex> lock(mutex);
+            connected = false;
+            cond.notify_all();
+            return;
+        }
+    }
+}
+
+bool RemoteServer::receivePose(Pose& pose, PoseInfo& poseInfo, double timeout) {
+    std::unique_lock<std::mutex> lock(mutex);
+    auto ready = [&]() { return hasPose || !connected; };
+    if(timeout < 0)
+        cond.wait(lock, ready);
+    else if(!cond.wait_for(lock, std::chrono::duration<double>(timeout), ready))
+        return false;
+    if(!hasPose)
+        return false;
+    if(adaptive && streamStats.framerate > 0) {
+        // poses arriving meanwhile replace the one waiting
+        double wait = lastPoseReturned + 1.0 / streamStats.framerate - glfwGetTime();
+        if(wait > 0)
+            cond.wait_for(lock, std::chrono::duration<double>(wait), [&]() { return closing || !connected; });
+        if(closing || !connected)
+            return false;
+    }
+    hasPose = false;
+    pose = latestPose.pose;
+    poseInfo = latestPose.poseInfo;
+    poseSendTime = latestPose.sendTime;
+    poseDisplayTime = latestPose.displayTime;
+    poseReceiveTime = latestPoseTime;
+    lastPoseReturned = glfwGetTime();
+    return true;
+}
+
+void RemoteServer::setAdaptiveStreaming(const RemoteStreamSettings& settings) {
+    adaptive = true;
+    streamSettings = settings;
+    streamSettings.maxFramerate = std::max(settings.maxFramerate, 1.0);
+    streamSettings.minFramerate = std::min(std::max(settings.minFramerate, 1.0), streamSettings.maxFramerate);
+    streamSettings.utilization = std::min(std::max(settings.utilization, 0.05), 1.0);
+    streamScaler = ResolutionScaler(settings.minScale, settings.maxScale);
+    streamStats.framerate = streamSettings.maxFramerate;
+    streamStats.scale = streamScaler.getScale();
+}
+
+void RemoteServer::getViewport(int width, int height, int viewport[4]) const {
+    if(adaptive) {
+        streamScaler.getViewport(width, height, viewport);
+        return;
+    }
+    viewport[0] = 0;
+    viewport[1] = 0;
+    viewport[2] = width;
+    viewport[3] = height;
+}
+
+/**
+ * Sets a layer header's encodings and byte counts for its size
+ */
+static void encodeLayer(RemoteLayerHeader& header, RemoteEncoding encoding, bool hasDepth) {
+    header.colorEncoding = encoding;
+    // packed depth needs the depth range, which only a projection has
+    header.depthEncoding = header.hasProjection ? encoding : REMOTE_ENCODING_RAW;
+    std::uint32_t pixels = header.width * header.height;
+    if(header.colorEncoding == REMOTE_ENCODING_PACKED) {
+        int planeWidth, planeHeight;
+        RemotePacker::colorPlaneExtent(header.width, header.height, planeWidth, planeHeight);
+        // depth after it stays aligned to its type
+        header.colorBytes = (planeWidth * planeHeight + 3) / 4 * 4;
+    }
+    else {
+        header.colorBytes = pixels * 4;
+        // raw depth is read with the color, packed color needs it packed
+        header.depthEncoding = REMOTE_ENCODING_RAW;
+    }
+    header.depthBytes = 0;
+    if(hasDepth)
+        header.depthBytes = header.depthEncoding == REMOTE_ENCODING_PACKED ? pixels * 2 : pixels * 4;
+}
+
+/**
+ * Updates the stream's framerate, scale and encoding from the client's
+ * latest measurements and a frame of frameBytes, rawBytes unpacked
+ */
+void RemoteServer::adaptStream(std::size_t frameBytes, std::size_t rawBytes) {
+    RemoteStreamStats& stats = streamStats;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.bandwidth = latestPose.receiveRate;
+        stats.networkDelay = latestPose.networkDelay;
+    }
+    if(stats.networkDelay > 0) {
+        double base = stats.baseNetworkDelay;
+        stats.baseNetworkDelay = base == 0 ? stats.networkDelay
+                                           : std::min(stats.networkDelay,
+                                                      base + (stats.networkDelay - base) * BASE_DELAY_DRIFT);
+        stats.congested = stats.networkDelay > stats.baseNetworkDelay + STREAM_QUEUE_DELAY;
+    }
+    if(!adaptive || stats.bandwidth <= 0 || frameBytes == 0)
+        return;
+
+    double share = stats.bandwidth * streamSettings.utilization * (stats.congested ? 0.5 : 1);
+    // bytes go with the square of the scale
+    double scale = streamScaler.getScale();
+    double fullSize = streamSettings.maxScale * streamSettings.maxScale / (scale * scale);
+    stats.framerate = std::min(std::max(share / (frameBytes * fullSize), streamSettings.minFramerate),
+                               streamSettings.maxFramerate);
+    stats.scale = streamScaler.update(frameBytes / share, 1.0 / stats.framerate);
+
+    if(preferredEncoding == REMOTE_ENCODING_RAW) {
+        double rawFramerate = share / (rawBytes * fullSize);
+        if(rawFramerate < streamSettings.maxFramerate)
+            encoding = REMOTE_ENCODING_PACKED;
+        else if(rawFramerate > streamSettings.maxFramerate * RAW_ENCODING_HEADROOM)
+            encoding = REMOTE_ENCODING_RAW;
+    }
+    stats.encoding = encoding;
+}
+
+void RemoteServer::sendFrame(const FrameSubmitInfo& frame, bool releaseImages) {
+    finishReadbacks(false);
+    if(readbacks.size() >= maxReadbacks)
+        finishReadbacks(true);
+
+    Readback readback;
+    if(!freeReadbacks.empty()) {
+        readback = std::move(freeReadbacks.back());
+        freeReadbacks.pop_back();
+    }
+    readback.poseSendTime = poseSendTime;
+    readback.poseDisplayTime = poseDisplayTime;
+    readback.poseReceiveTime = poseReceiveTime;
+    readback.pose = frame.pose;
+    readback.poseInfo = frame.poseInfo;
+    readback.layers.clear();
+
+    std::size_t size = 0;
+    std::size_t rawSize = 0;
+    for(const FrameLayer& layer : frame.layers) {
+        if(!(layer.flags & KEEP_PREVIOUS_IMAGE) && layer.swapchain->isCubeMap())
+            continue;
+        RemoteLayerHeader header = {};
+        header.flags = layer.flags & ~(MOTION_EXTRAPOLATION_ENABLED | TEMPORAL_ACCUMULATION_ENABLED
+                                       | CHECKERBOARD_ENABLED);
+        if(!(layer.flags & KEEP_PREVIOUS_IMAGE)) {
+            header.eye = layer.eye;
+            header.fov = layer.fov;
+            header.time = layer.time;
+            header.hasPose = layer.hasPose;
+            header.pose = layer.pose;
+            header.hasProjection = layer.hasProjection;
+            header.projection = layer.projection;
+            header.width = layer.hasViewport ? layer.viewport[2] : layer.swapchain->getImageWidth(layer.swapchainIndex);
+            header.height = layer.hasViewport ? layer.viewport[3] : layer.swapchain->getImageHeight(layer.swapchainIndex);
+            RemoteLayerHeader raw = header;
+            encodeLayer(raw, REMOTE_ENCODING_RAW, layer.swapchain->hasDepth());
+            rawSize += raw.colorBytes + raw.depthBytes;
+            encodeLayer(header, encoding, layer.swapchain->hasDepth());
+        }
+        readback.layers.push_back(header);
+        size += header.colorBytes + header.depthBytes;
+    }
+    adaptStream(size, rawSize);
+
+    if(readback.buffer == 0)
+        glGenBuffers(1, &readback.buffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    if(readback.capacity < size) {
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+        readback.capacity = size;
+    }
+    std::size_t offset = 0;
+    std::size_t sent = 0;
+    for(const FrameLayer& layer : frame.layers) {
+        if(!(layer.flags & KEEP_PREVIOUS_IMAGE) && layer.swapchain->isCubeMap())
+            continue;
+        const RemoteLayerHeader& header = readback.layers[sent++];
+        if(layer.flags & KEEP_PREVIOUS_IMAGE)
+            continue;
+        int x = layer.hasViewport ? layer.viewport[0] : 0;
+        int y = layer.hasViewport ? layer.viewport[1] : 0;
+        if(header.colorEncoding == REMOTE_ENCODING_PACKED) {
+            if(!packer)
+                packer.reset(new RemotePacker());
+            packer->pack(layer, header, x, y, offset);
+            offset += header.colorBytes + header.depthBytes;
+            continue;
+        }
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        layer.swapchain->bindFramebuffer(layer.swapchainIndex);
+        glReadPixels(x, y, header.width, header.height, GL_RGBA, GL_UNSIGNED_BYTE, (GLvoid*)offset);
+        offset += header.colorBytes;
+        if(header.depthBytes) {
+            glReadPixels(x, y, header.width, header.height, GL_DEPTH_COMPONENT, GL_FLOAT, (GLvoid*)offset);
+            offset += header.depthBytes;
+        }
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    readbacks.push_back(std::move(readback));
+
+    // the readbacks are ordered before anything the app renders into the
+    // images next, so they can go back right away
+    for(const FrameLayer& layer : frame.layers) {
+        if(releaseImages && !(layer.flags & KEEP_PREVIOUS_IMAGE))
+            layer.swapchain->releaseImage(layer.swapchainIndex);
+    }
+}
+
+/**
+ * Copies the finished readbacks into messages, oldest first, waiting for
+ * the oldest one if wait is set. Only the newest message is kept for the
+ * send thread
+ */
+void RemoteServer::finishReadbacks(bool wait) {
+    std::vector<char> message;
+    double poseTime = 0;
+    std::size_t finished = 0;
+    for(Readback& readback : readbacks) {
+        GLuint64 timeout = wait && finished == 0 ? GL_TIMEOUT_IGNORED : 0;
+        GLenum status = glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+        if(status == GL_TIMEOUT_EXPIRED)
+            break;
+        glDeleteSync(readback.fence);
+        readback.fence = 0;
+        finished++;
+
+        std::size_t pixelBytes = 0;
+        for(const RemoteLayerHeader& layer : readback.layers)
+            pixelBytes += layer.colorBytes + layer.depthBytes;
+        RemoteMessageHeader header;
+        header.type = REMOTE_MESSAGE_FRAME;
+        header.size = sizeof(RemoteFrameHeader) + readback.layers.size() * sizeof(RemoteLayerHeader) + pixelBytes;
+        RemoteFrameHeader frameHeader;
+        frameHeader.poseSendTime = readback.poseSendTime;
+        frameHeader.poseDisplayTime = readback.poseDisplayTime;
+        // the send thread fills it in
+        frameHeader.serverDelay = 0;
+        poseTime = readback.poseReceiveTime;
+        frameHeader.pose = readback.pose;
+        frameHeader.poseInfo = readback.poseInfo;
+        frameHeader.layerCount = readback.layers.size();
+
+        message.resize(sizeof(header) + header.size);
+        char* out = message.data();
+        std::memcpy(out, &header, sizeof(header));
+        out += sizeof(header);
+        std::memcpy(out, &frameHeader, sizeof(frameHeader));
+        out += sizeof(frameHeader);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        const char* pixels = pixelBytes ? (const char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, pixelBytes,
+                                                                        GL_MAP_READ_BIT) : nullptr;
+        for(const RemoteLayerHeader& layer : readback.layers) {
+            std::memcpy(out, &layer, sizeof(layer));
+            out += sizeof(layer);
+            std::size_t bytes = layer.colorBytes + layer.depthBytes;
+            if(pixels && bytes) {
+                std::memcpy(out, pixels, bytes);
+                pixels += bytes;
+            }
+            out += bytes;
+        }
+        if(pixelBytes)
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+    for(std::size_t i = 0; i < finished; i++)
+        freeReadbacks.push_back(std::move(readbacks[i]));
+    readbacks.erase(readbacks.begin(), readbacks.begin() + finished);
+
+    if(finished == 0)
+        return;
+    std::lock_guard<std::mutex> lock(mutex);
+    // a frame the send thread hasn't taken yet is stale now
+    outgoing.swap(message);
+    outgoingPoseTime = poseTime;
+    cond.notify_all();
+}
+
+void RemoteServer::close() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+        cond.notify_all();
+    }
+    shutdownSocket(socket);
+    if(channel)
+        channel->shutdown();
+    if(receiveThread.joinable())
+        receiveThread.join();
+    if(sendThread.joinable())
+        sendThread.join();
+    if(socket != (std::intptr_t)invalidSocket) {
+        closeSocket((NativeSocket)socket);
+        socket = (std::intptr_t)invalidSocket;
+    }
+    channel.reset();
+    connected = false;
+
+    for(std::vector<Readback>* list : { &readbacks, &freeReadbacks }) {
+        for(Readback& readback : *list) {
+            if(readback.fence)
+                glDeleteSync(readback.fence);
+            glDeleteBuffers(1, &readback.buffer);
+        }
+        list->clear();
+    }
+    packer.reset();
+}
+
+RemoteBroadcastServer::~RemoteBroadcastServer() {
+    close();
+}
+
+bool RemoteBroadcastServer::listen(int port) {
+    close();
+    if(!startSockets()) {
+        std::cout << "Error: could not start sockets" << std::endl;
+        return false;
+    }
+    NativeSocket s = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if(s == invalidSocket) {
+        std::cout << "Error: could not create a socket" << std::endl;
+        return false;
+    }
+    int reuse = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons((unsigned short)port);
+    if(bind(s, (sockaddr*)&address, sizeof(address)) != 0 || ::listen(s, 16) != 0) {
+        std::cout << "Error: could not listen on port " << port << std::endl;
+        closeSocket(s);
+        return false;
+    }
+    listener = (std::intptr_t)s;
+    stopping = false;
+    acceptThread = std::thread(&RemoteBroadcastServer::acceptLoop, this);
+    return true;
+}
+
+void RemoteBroadcastServer::acceptLoop() {
+    NativeSocket s = (NativeSocket)listener;
+    while(!stopping) {
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(s, &readable);
+        timeval timeout;
+        timeout.tv_sec = 0;
+        timeout.tv_usec = (long)(ACCEPT_POLL_INTERVAL * 1e6);
+        if(select((int)s + 1, &readable, nullptr, nullptr, &timeout) <= 0)
+            continue;
+        NativeSocket client = accept(s, nullptr, nullptr);
+        if(client == invalidSocket)
+            continue;
+        std::lock_guard<std::mutex> lock(mutex);
+        accepted.push_back((std::intptr_t)client);
+    }
+}
+
+void RemoteBroadcastServer::setEncoding(RemoteEncoding encoding) {
+    this->encoding = encoding;
+    for(Client& client : clients)
+        client.server->setEncoding(encoding);
+}
+
+int RemoteBroadcastServer::receiveViews(std::vector<BroadcastView>& views, float maxDistance, float maxAngle,
+                                        double timeout) {
+    views.clear();
+    double start = glfwGetTime();
+    while(true) {
+        std::vector<std::intptr_t> newClients;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            newClients.swap(accepted);
+        }
+        for(std::intptr_t socket : newClients) {
+            Client client;
+            client.server.reset(new RemoteServer());
+            client.server->setEncoding(encoding);
+            client.server->attach(socket);
+            clients.push_back(std::move(client));
+        }
+        for(std::size_t i = 0; i < clients.size();) {
+            if(clients[i].server->isConnected()) {
+                i++;
+                continue;
+            }
+            clients[i].server->close();
+            clients.erase(clients.begin() + i);
+        }
+
+        for(int i = 0; i < (int)clients.size(); i++) {
+            Client& client = clients[i];
+            if(!client.server->receivePose(client.pose, client.poseInfo, 0))
+                continue;
+            BroadcastView* joined = nullptr;
+            for(BroadcastView& view : views) {
+                float angle = 2 * std::acos(std::min(std::abs(glm::dot(view.pose.orientation,
+                                                                       client.pose.orientation)), 1.0f));
+                if(glm::distance(view.pose.position, client.pose.position) <= maxDistance && angle <= maxAngle) {
+                    joined = &view;
+                    break;
+                }
+            }
+            if(!joined) {
+                views.emplace_back();
+                joined = &views.back();
+                joined->pose = client.pose;
+                joined->poseInfo = client.poseInfo;
+            }
+            joined->clients.push_back(i);
+        }
+        if(!views.empty() || (timeout >= 0 && glfwGetTime() - start >= timeout))
+            return (int)views.size();
+        std::this_thread::sleep_for(std::chrono::duration<double>(VIEW_POLL_INTERVAL));
+    }
+}
+
+void RemoteBroadcastServer::releaseSharedLayers() {
+    for(const FrameLayer& layer : sharedLayers) {
+        if(!(layer.flags & KEEP_PREVIOUS_IMAGE))
+            layer.swapchain->releaseImage(layer.swapchainIndex);
+    }
+    sharedLayers.clear();
+}
+
+void RemoteBroadcastServer::shareLayers(const FrameLayers& layers) {
+    releaseSharedLayers();
+    sharedLayers = layers;
+    sharedVersion++;
+}
+
+void RemoteBroadcastServer::sendView(const BroadcastView& view, const FrameSubmitInfo& frame) {
+    for(int index : view.clients) {
+        Client& client = clients[index];
+        FrameSubmitInfo clientFrame = frame;
+        for(const FrameLayer& layer : sharedLayers) {
+            FrameLayer shared = layer;
+            if(client.sharedVersion == sharedVersion) {
+                shared = FrameLayer();
+                shared.flags = KEEP_PREVIOUS_IMAGE;
+            }
+            clientFrame.layers.push_back(shared);
+        }
+        client.sharedVersion = sharedVersion;
+        client.server->sendFrame(clientFrame, false);
+    }
+    for(const FrameLayer& layer : frame.layers) {
+        if(!(layer.flags & KEEP_PREVIOUS_IMAGE))
+            layer.swapchain->releaseImage(layer.swapchainIndex);
+    }
+}
+
+void RemoteBroadcastServer::close() {
+    stopping = true;
+    if(acceptThread.joinable())
+        acceptThread.join();
+    if(listener != (std::intptr_t)invalidSocket) {
+        closeSocket((NativeSocket)listener);
+        listener = (std::intptr_t)invalidSocket;
+    }
+    for(std::intptr_t socket : accepted)
+        closeSocket((NativeSocket)socket);
+    accepted.clear();
+    for(Client& client : clients)
+        client.server->close();
+    clients.clear();
+    releaseSharedLayers();
+    sharedVersion = 0;
+}
+
+RemoteClient::RemoteClient() = default;
+
+RemoteClient::~RemoteClient() {
+    close();
+}
+
+bool RemoteClient::connect(const char* host, int port, int imagesPerLayer) {
+    disconnect();
+    if(!startSockets()) {
+        std::cout << "Error: could not start sockets" << std::endl;
+        return false;
+    }
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addresses = nullptr;
+    std::string service = std::to_string(port);
+    if(getaddrinfo(host, service.c_str(), &hints, &addresses) != 0) {
+        std::cout << "Error: could not resolve " << host << std::endl;
+        return false;
+    }
+    NativeSocket server = invalidSocket;
+    for(addrinfo* address = addresses; address; address = address->ai_next) {
+        server = ::socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if(server == invalidSocket)
+            continue;
+        if(::connect(server, address->ai_addr, (int)address->ai_addrlen) == 0)
+            break;
+        closeSocket(server);
+        server = invalidSocket;
+    }
+    freeaddrinfo(addresses);
+    if(server == invalidSocket) {
+        std::cout << "Error: could not connect to " << host << ":" << port << std::endl;
+        return false;
+    }
+    setNoDelay(server);
+
+    socket = (std::intptr_t)server;
+    startReceiving(imagesPerLayer);
+    return true;
+}
+
+bool RemoteClient::listenLocal(const char* name, int imagesPerLayer, double timeout) {
+    // keep waiting on the rings a timed out call made
+    if(connected || !channel || channel->hasPeer() || channel->getName() != name) {
+        disconnect();
+        channel = SharedChannel::create(name, LOCAL_POSE_RING, LOCAL_FRAME_RING);
+        if(!channel)
+            return false;
+    }
+    if(!channel->waitForPeer(timeout))
+        return false;
+    startReceiving(imagesPerLayer);
+    return true;
+}
+
+void RemoteClient::startReceiving(int imagesPerLayer) {
+    this->imagesPerLayer = imagesPerLayer;
+    roundTrip = 0;
+    displayLatency = 0;
+    displayJitter = 0;
+    frameInterval = 0;
+    lastFrameTime = 0;
+    predictionError = 0;
+    networkDelay = 0;
+    receiveRate = 0;
+    incoming.clear();
+    connected = true;
+    receiveThread = std::thread(&RemoteClient::receiveLoop, this);
+}
+
+void RemoteClient::receiveLoop() {
+    RemoteMessageHeader header;
+    std::vector<char> payload;
+    double start;
+    while(receiveMessage(socket, channel.get(), header, payload, &start)) {
+        if(header.type != REMOTE_MESSAGE_FRAME || payload.size() < sizeof(RemoteFrameHeader))
+            continue;
+        double end = glfwGetTime();
+        std::lock_guard<std::mutex> lock(mutex);
+        // a frame receiveFrame hasn't taken yet is stale now
+        incoming.swap(payload);
+        incomingStart = start;
+        incomingTransfer = end - start;
+    }
+    connected = false;
+}
+
+void RemoteClient::sendPose(const Pose& pose, const PoseInfo& poseInfo, double displayTime) {
+    if(!connected)
+        return;
+    struct {
+        RemoteMessageHeader header;
+        RemotePoseMessage pose;
+    } message;
+    message.header.type = REMOTE_MESSAGE_POSE;
+    message.header.size = sizeof(RemotePoseMessage);
+    message.pose.sendTime = glfwGetTime();
+    message.pose.displayTime = displayTime;
+    message.pose.pose = pose;
+    message.pose.poseInfo = poseInfo;
+    message.pose.networkDelay = networkDelay;
+    message.pose.receiveRate = receiveRate;
+    if(!sendAll(socket, channel.get(), &message, sizeof(message)))
+        connected = false;
+}
+
+void RemoteClient::sendPredictedPose() {
+    // before the first frame there's no latency to go by
+    double displayTime = lastFrameTime == 0 ? getPredictedDisplayTime() : glfwGetTime() + getPredictionLead();
+    Pose pose;
+    PoseInfo poseInfo;
+    getPredictedCameraPose(displayTime, pose, poseInfo);
+    sendPose(pose, poseInfo, displayTime);
+}
+
+bool RemoteClient::receiveFrame(FrameSubmitInfo& frame) {
+    double start, transfer;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(incoming.empty())
+            return false;
+        frameMessage.swap(incoming);
+        incoming.clear();
+        start = incomingStart;
+        transfer = incomingTransfer;
+    }
+
+    RemoteFrameHeader frameHeader;
+    std::memcpy(&frameHeader, frameMessage.data(), sizeof(frameHeader));
+    double now = glfwGetTime();
+    roundTrip = smooth(roundTrip, now - frameHeader.poseSendTime);
+    if(lastFrameTime != 0)
+        frameInterval = smooth(frameInterval, now - lastFrameTime);
+    lastFrameTime = now;
+
+    // the frame is submitted right away, so it is first shown on the next
+    // display
+    double shown = std::max(getPredictedDisplayTime(), now);
+    double latency = shown - frameHeader.poseSendTime;
+    if(displayLatency == 0) {
+        displayLatency = latency;
+    } else {
+        double limit = LATENCY_OUTLIER_JITTERS * displayJitter;
+        if(displayJitter > 0)
+            latency = std::min(std::max(latency, displayLatency - limit), displayLatency + limit);
+        displayJitter = smooth(displayJitter, std::abs(latency - displayLatency));
+        displayLatency = smooth(displayLatency, latency);
+    }
+    predictionError = smooth(predictionError, shown - frameHeader.poseDisplayTime);
+    networkDelay = smooth(networkDelay, std::max(start - frameHeader.poseSendTime - frameHeader.serverDelay, 1e-6));
+    receiveRate = smooth(receiveRate, frameMessage.size() / std::max(transfer, MIN_TRANSFER_TIME));
+
+    frame.pose = frameHeader.pose;
+    frame.poseInfo = frameHeader.poseInfo;
+    frame.layers.clear();
+    const char* in = frameMessage.data() + sizeof(frameHeader);
+    const char* end = frameMessage.data() + frameMessage.size();
+    for(std::uint32_t i = 0; i < frameHeader.layerCount && !frame.layers.full(); i++) {
+        RemoteLayerHeader header;
+        if(end - in < (std::ptrdiff_t)sizeof(header))
+            break;
+        std::memcpy(&header, in, sizeof(header));
+        in += sizeof(header);
+        if(end - in < (std::ptrdiff_t)header.colorBytes + header.depthBytes)
+            break;
+        const char* color = in;
+        const char* depth = in + header.colorBytes;
+        in += header.colorBytes + header.depthBytes;
+
+        FrameLayer layer;
+        layer.flags = (FrameLayerFlags)header.flags;
+        if(header.flags & KEEP_PREVIOUS_IMAGE) {
+            frame.layers.push_back(layer);
+            continue;
+        }
+        // a layer with less than its pixels isn't from a matching server
+        std::size_t pixels = (std::size_t)std::max(header.width, 0) * std::max(header.height, 0);
+        int planeWidth, planeHeight;
+        RemotePacker::colorPlaneExtent(header.width, header.height, planeWidth, planeHeight);
+        bool packedColor = header.colorEncoding == REMOTE_ENCODING_PACKED;
+        std::size_t colorNeeded = packedColor ? (std::size_t)planeWidth * planeHeight : pixels * 4;
+        std::size_t depthNeeded = packedColor && header.depthEncoding == REMOTE_ENCODING_PACKED ? pixels * 2 : pixels * 4;
+        if(pixels == 0 || header.colorBytes < colorNeeded || (header.depthBytes && header.depthBytes < depthNeeded))
+            break;
+        if(swapchains.size() <= i)
+            swapchains.resize(i + 1);
+        std::unique_ptr<Swapchain>& swapchain = swapchains[i];
+        bool hasDepth = header.depthBytes != 0;
+        if(!swapchain || swapchain->hasDepth() != hasDepth) {
+            SwapchainCreateInfo createInfo;
+            createInfo.width = header.width;
+            createInfo.height = header.height;
+            createInfo.numImages = imagesPerLayer;
+            createInfo.depthFormat = hasDepth ? DEPTH_FORMAT_32F : DEPTH_FORMAT_NONE;
+            // reprojection may still hold images of the old one
+            if(swapchain)
+                retiredSwapchains.push_back(std::move(swapchain));
+            swapchain.reset(new Swapchain(createInfo));
+        }
+        else if(header.width > swapchain->width || header.height > swapchain->height) {
+            // smaller layers, as adaptive streaming sends, go in a corner
+            // of the images as they are rather than reallocating them
+            swapchain->resize(std::max(header.width, swapchain->width), std::max(header.height, swapchain->height));
+        }
+        int index = swapchain->acquireImage();
+        if(header.colorEncoding == REMOTE_ENCODING_PACKED) {
+            if(!packer)
+                packer.reset(new RemotePacker());
+            packer->unpack(header, color, depth, *swapchain, index);
+        }
+        else {
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            glState().bindTexture(0, GL_TEXTURE_2D, swapchain->images[index]);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, header.width, header.height, GL_RGBA, GL_UNSIGNED_BYTE, color);
+            if(hasDepth) {
+                glState().bindTexture(0, GL_TEXTURE_2D, swapchain->depthImages[index]);
+                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, header.width, header.height, GL_DEPTH_COMPONENT, GL_FLOAT,
+                                depth);
+            }
+        }
+
+        layer.fov = header.fov;
+        layer.eye = header.eye;
+        layer.time = header.time;
+        layer.hasPose = header.hasPose;
+        layer.pose = header.pose;
+        layer.hasProjection = header.hasProjection;
+        layer.projection = header.projection;
+        layer.swapchain = swapchain.get();
+        layer.swapchainIndex = index;
+        layer.hasViewport = header.width != swapchain->getImageWidth(index)
+                            || header.height != swapchain->getImageHeight(index);
+        layer.viewport[0] = 0;
+        layer.viewport[1] = 0;
+        layer.viewport[2] = header.width;
+        layer.viewport[3] = header.height;
+        frame.layers.push_back(layer);
+    }
+    return true;
+}
+
+void RemoteClient::disconnect() {
+    shutdownSocket(socket);
+    if(channel)
+        channel->shutdown();
+    if(receiveThread.joinable())
+        receiveThread.join();
+    if(socket != (std::intptr_t)invalidSocket) {
+        closeSocket((NativeSocket)socket);
+        socket = (std::intptr_t)invalidSocket;
+    }
+    channel.reset();
+    connected = false;
+}
+
+void RemoteClient::close() {
+    disconnect();
+    packer.reset();
+    swapchains.clear();
+    retiredSwapchains.clear();
+}
+
+};
@@ -0,0 +1,553 @@
+#ifndef ARPREMOTE_H
+#define ARPREMOTE_H
+
+#include "arp.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace arp {
+
+/**
+ * Messages of the remote rendering protocol, sent over TCP. Each message is
+ * a RemoteMessageHeader followed by size bytes. Like input logs, the
+ * structs are in the sender's layout, so both ends have to be built for
+ * the same architecture. Times are glfwGetTime() values of the client.
+ */
+enum RemoteMessageType : std::uint32_t {
+    // RemotePoseMessage, client to server
+    REMOTE_MESSAGE_POSE = 1,
+    // RemoteFrameHeader, then per layer a RemoteLayerHeader, its color and
+    // its depth, server to client
+    REMOTE_MESSAGE_FRAME = 2,
+};
+
+/**
+ * How a layer's pixels are sent
+ */
+enum RemoteEncoding : std::uint32_t {
+    // RGBA8 color and 32 bit float depth as rendered, both rows bottom to
+    // top with no padding
+    REMOTE_ENCODING_RAW = 0,
+    // Packed on the GPU into the planes video encoders take, 3.5 bytes a
+    // pixel instead of 8. Color is YCoCg 4:2:0 in one 8 bit plane twice
+    // the chroma width wide: luma in the first height rows, then the
+    // orange chroma left of the green one, each at half resolution. Alpha
+    // isn't sent, ALPHA_MASKED layers with depth get alpha 0 where it is at
+    // the far plane. Depth is the log of the distance between the near and
+    // far plane in 16 bits, under 0.02% off for a far plane 1000 times the
+    // near one. Only layers with a projection have their depth packed,
+    // others send it raw
+    REMOTE_ENCODING_PACKED = 1,
+};
+
+struct RemoteMessageHeader {
+    std::uint32_t type;
+    std::uint32_t size;
+};
+
+/**
+ * Pose the client wants the next frame rendered with
+ */
+struct RemotePoseMessage {
+    // client time the message was sent at, echoed back with the frame
+    double sendTime;
+    // client time the pose was predicted for, echoed back with the frame
+    double displayTime;
+    Pose pose;
+    PoseInfo poseInfo;
+    // the client's measurements of the link for adaptive streaming, see
+    // RemoteClient::getNetworkDelay and getReceiveRate. 0 until measured
+    double networkDelay;
+    double receiveRate;
+};
+
+struct RemoteFrameHeader {
+    // sendTime and displayTime of the pose the frame was rendered with
+    double poseSendTime;
+    double poseDisplayTime;
+    // seconds from the server receiving the pose to sending the frame
+    double serverDelay;
+    Pose pose;
+    PoseInfo poseInfo;
+    std::uint32_t layerCount;
+};
+
+/**
+ * A layer of a frame, as in FrameLayer. The layer's viewport is sent as the
+ * whole image, with color and depth encoded as in colorEncoding and
+ * depthEncoding. KEEP_PREVIOUS_IMAGE layers have no pixels
+ */
+struct RemoteLayerHeader {
+    std::uint32_t flags;
+    std::int32_t eye;
+    double fov;
+    double time;
+    std::uint8_t hasPose;
+    std::uint8_t hasProjection;
+    Pose pose;
+    LayerProjection projection;
+    std::int32_t width;
+    std::int32_t height;
+    std::uint32_t colorEncoding;
+    std::uint32_t depthEncoding;
+    std::uint32_t colorBytes;
+    std::uint32_t depthBytes;
+};
+
+/**
+ * How a RemoteServer adapts its frames to the link, see
+ * RemoteServer::setAdaptiveStreaming
+ */
+struct RemoteStreamSettings {
+    // poses are taken at most this often, and at least this often before
+    // the resolution drops
+    double minFramerate = 10;
+    double maxFramerate = 60;
+    // scales of the width and height of the viewports getViewport gives
+    double minScale = 0.5;
+    double maxScale = 1;
+    // fraction of the measured bandwidth frames may take, halved while the
+    // link is congested
+    double utilization = 0.8;
+};
+
+struct RemoteStreamStats {
+    // bytes per second and seconds, as the client last measured them
+    double bandwidth = 0;
+    double networkDelay = 0;
+    // lowest network delay seen, what it is without queueing
+    double baseNetworkDelay = 0;
+    // the network delay is well over its base, so the link's queues fill
+    bool congested = false;
+    double framerate = 0;
+    double scale = 1;
+    RemoteEncoding encoding = REMOTE_ENCODING_PACKED;
+};
+
+class RemotePacker;
+class SharedChannel;
+class RemoteBroadcastServer;
+
+/**
+ * Renders for a RemoteClient. The app renders frames with the poses the
+ * client sends and passes them to sendFrame in place of submitFrame, so
+ * the server needs a GL context but no window of its own or
+ * startReprojection. Frames are read back asynchronously through pixel
+ * buffers and sent by a thread of their own. When the network falls
+ * behind, frames waiting to be sent are replaced by newer ones.
+ *
+ * Used from one thread with the app's context current
+ */
+class RemoteServer {
+private:
+    struct Readback {
+        std::uint32_t buffer = 0;
+        std::size_t capacity = 0;
+        GLsync fence = 0;
+        double poseSendTime;
+        double poseDisplayTime;
+        double poseReceiveTime;
+        Pose pose;
+        PoseInfo poseInfo;
+        std::vector<RemoteLayerHeader> layers;
+    };
+
+    std::intptr_t socket = -1;
+    // used in place of the socket when connected to a local compositor
+    std::unique_ptr<SharedChannel> channel;
+    std::atomic<bool> connected{false};
+    std::thread receiveThread;
+    std::thread sendThread;
+
+    // guards the fields below, cond signals new poses, new frames and
+    // disconnects
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool hasPose = false;
+    RemotePoseMessage latestPose;
+    // glfwGetTime() latestPose arrived at
+    double latestPoseTime = 0;
+    // message waiting for the send thread, empty if none, and when the
+    // pose it was rendered with arrived
+    std::vector<char> outgoing;
+    double outgoingPoseTime = 0;
+    bool closing = false;
+
+    // what setEncoding asked for, and what frames are sent with
+    RemoteEncoding preferredEncoding = REMOTE_ENCODING_PACKED;
+    RemoteEncoding encoding = REMOTE_ENCODING_PACKED;
+    bool adaptive = false;
+    RemoteStreamSettings streamSettings;
+    RemoteStreamStats streamStats;
+    ResolutionScaler streamScaler;
+    // glfwGetTime() receivePose last returned a pose at
+    double lastPoseReturned = 0;
+    // made on the first packed frame
+    std::unique_ptr<RemotePacker> packer;
+
+    // sendTime and displayTime of the pose last returned by receivePose,
+    // and when it arrived
+    double poseSendTime = 0;
+    double poseDisplayTime = 0;
+    double poseReceiveTime = 0;
+    // oldest first, at most maxReadbacks
+    std::vector<Readback> readbacks;
+    std::vector<Readback> freeReadbacks;
+    static const std::size_t maxReadbacks = 2;
+
+    void receiveLoop();
+    void sendLoop();
+    void startThreads();
+    void finishReadbacks(bool wait);
+    void adaptStream(std::size_t frameBytes, std::size_t rawBytes);
+    void attach(std::intptr_t socket);
+
+    friend class RemoteBroadcastServer;
+
+public:
+    RemoteServer();
+    RemoteServer(const RemoteServer&) = delete;
+    RemoteServer& operator=(const RemoteServer&) = delete;
+    ~RemoteServer();
+
+    /**
+     * Waits for a client to connect on the given port. Returns false and
+     * prints an error if the port can't be listened on
+     */
+    bool listen(int port);
+
+    /**
+     * Connects to a RemoteClient on this machine waiting in listenLocal
+     * under the given name, through shared memory instead of a socket.
+     * Returns false if there is none
+     */
+    bool connectLocal(const char* name);
+
+    bool isConnected() const { return connected; }
+
+    /**
+     * Sets how the following frames are encoded, REMOTE_ENCODING_PACKED by
+     * default
+     */
+    void setEncoding(RemoteEncoding encoding) { preferredEncoding = this->encoding = encoding; }
+
+    /**
+     * Adapts the following frames to the bandwidth and network delay the
+     * client measures. The framerate goes first: receivePose holds poses
+     * back so frames at full resolution take at most utilization of the
+     * bandwidth, down to minFramerate, and the client's reprojection hides
+     * the lower rate. Past that the scale of getViewport drops, as
+     * ResolutionScaler does for GPU time. Frames set to
+     * REMOTE_ENCODING_RAW are packed while raw ones wouldn't fit at
+     * maxFramerate. A network delay well over the lowest seen means the
+     * link's queues are filling, which halves the share of the bandwidth
+     * until they drain
+     */
+    void setAdaptiveStreaming(const RemoteStreamSettings& settings);
+
+    RemoteStreamStats getStreamStats() const { return streamStats; }
+
+    /**
+     * Viewport to render a width by height layer into and submit it with,
+     * the whole image unless adaptive streaming lowered the scale
+     */
+    void getViewport(int width, int height, int viewport[4]) const;
+
+    /**
+     * Waits at most timeout seconds, or forever if negative, for a pose
+     * newer than the one last returned and returns the newest one. With
+     * adaptive streaming it also waits out the adapted frame interval
+     * since the last one. Returns false on timeout or once the client has
+     * disconnected
+     */
+    bool receivePose(Pose& pose, PoseInfo& poseInfo, double timeout = -1);
+
+    /**
+     * Sends a frame rendered with the pose last returned by receivePose, in
+     * place of submitFrame. Reads back the layers' color and depth, only
+     * their viewport if they have one, and releases their images, so the
+     * app must not use them afterwards. Waits for the oldest readback if
+     * too many are in flight, sending it with any other finished ones.
+     * Changes the bound framebuffer, and when packing the viewport,
+     * program, vertex array and texture unit 0 as well. Cube map layers
+     * aren't sent, and motion extrapolation, temporal accumulation and
+     * checkerboard flags are dropped since the client has neither the
+     * velocities nor the jitter and parity the app rendered with. Without
+     * releaseImages the images stay with the app, which can send them to
+     * other servers too and releases them itself
+     */
+    void sendFrame(const FrameSubmitInfo& frame, bool releaseImages = true);
+
+    /**
+     * Disconnects and deletes the readback buffers
+     */
+    void close();
+};
+
+/**
+ * Clients of a RemoteBroadcastServer whose poses are close enough to share
+ * layers rendered with pose, that of the first of them
+ */
+struct BroadcastView {
+    Pose pose;
+    PoseInfo poseInfo;
+    // indices of the clients, valid until the next receiveViews
+    std::vector<int> clients;
+};
+
+/**
+ * Renders one scene for any number of RemoteClients, as for spectators
+ * watching from nearby viewpoints. Each frame the app takes the clients
+ * that asked for one, grouped into views of similar poses, renders its
+ * near layers once per view and sends them with sendView. Layers every
+ * client shares, like a wide background, are rendered once and passed to
+ * shareLayers; each client gets them only once per shareLayers and keeps
+ * reprojecting them to its own pose in between. Server GPU time grows with
+ * the number of views, not clients, though each client's layers are still
+ * read back and sent on its own.
+ *
+ * Used from one thread with the app's context current, clients are
+ * accepted by a thread of their own
+ */
+class RemoteBroadcastServer {
+private:
+    struct Client {
+        std::unique_ptr<RemoteServer> server;
+        // shareLayers call the client last got the shared layers of, 0 for
+        // none
+        std::uint64_t sharedVersion = 0;
+        Pose pose;
+        PoseInfo poseInfo;
+    };
+
+    std::intptr_t listener = -1;
+    std::thread acceptThread;
+    std::atomic<bool> stopping{false};
+    // guards accepted, sockets the accept thread hands over
+    std::mutex mutex;
+    std::vector<std::intptr_t> accepted;
+
+    std::vector<Client> clients;
+    FrameLayers sharedLayers;
+    std::uint64_t sharedVersion = 0;
+    RemoteEncoding encoding = REMOTE_ENCODING_PACKED;
+
+    void acceptLoop();
+    void releaseSharedLayers();
+
+public:
+    RemoteBroadcastServer() = default;
+    RemoteBroadcastServer(const RemoteBroadcastServer&) = delete;
+    RemoteBroadcastServer& operator=(const RemoteBroadcastServer&) = delete;
+    ~RemoteBroadcastServer();
+
+    /**
+     * Starts accepting clients on the given port and returns. Returns false
+     * and prints an error if the port can't be listened on
+     */
+    bool listen(int port);
+
+    /**
+     * Sets how frames to the clients are encoded, REMOTE_ENCODING_PACKED by
+     * default
+     */
+    void setEncoding(RemoteEncoding encoding);
+
+    int getClientCount() const { return (int)clients.size(); }
+
+    /**
+     * Takes the newest pose of every client that sent one since its last
+     * frame, waiting at most timeout seconds, or forever if negative, for
+     * at least one. A client joins the first view whose pose is within
+     * maxDistance and maxAngle radians of its own, or starts a view.
+     * Clients that connected are added and the ones that disconnected
+     * dropped first. Returns the number of views, 0 on timeout
+     */
+    int receiveViews(std::vector<BroadcastView>& views, float maxDistance, float maxAngle, double timeout = -1);
+
+    /**
+     * Makes layers the ones sent after every view's own from now on, with
+     * poses of their own so each client reprojects them. Each client gets
+     * their images with its next frame and KEEP_PREVIOUS_IMAGE after that.
+     * Their images stay acquired until the next shareLayers or close
+     */
+    void shareLayers(const FrameLayers& layers);
+
+    /**
+     * Sends frame, rendered with the view's pose, and the shared layers to
+     * each client of the view, then releases the frame's images
+     */
+    void sendView(const BroadcastView& view, const FrameSubmitInfo& frame);
+
+    /**
+     * Stops accepting, disconnects every client and releases the shared
+     * layers
+     */
+    void close();
+};
+
+/**
+ * Shows frames a RemoteServer renders with arp's reprojection. The app
+ * callback sends the pose it wants rendered with sendPredictedPose each app
+ * frame, predicted for when the frame rendered with it will be shown, and
+ * submits whatever receiveFrame returns. Received layers are uploaded into swapchains of the client's
+ * own, made and grown to fit each layer index, with smaller layers in a
+ * viewport of their images, so reprojection hides the network latency
+ * like it hides the app's.
+ *
+ * Used from the app thread, frames are received by a thread of their own
+ */
+class RemoteClient {
+private:
+    std::intptr_t socket = -1;
+    // used in place of the socket when serving as a local compositor
+    std::unique_ptr<SharedChannel> channel;
+    std::atomic<bool> connected{false};
+    std::thread receiveThread;
+    int imagesPerLayer = 3;
+
+    // guards incoming and the times below
+    std::mutex mutex;
+    // newest received frame message not taken by receiveFrame, empty if none
+    std::vector<char> incoming;
+    // glfwGetTime() its first byte arrived at, and seconds the rest took
+    double incomingStart = 0;
+    double incomingTransfer = 0;
+    std::vector<char> frameMessage;
+
+    // made on the first packed frame
+    std::unique_ptr<RemotePacker> packer;
+    std::vector<std::unique_ptr<Swapchain>> swapchains;
+    // replaced when a layer gained or lost depth, kept until close
+    std::vector<std::unique_ptr<Swapchain>> retiredSwapchains;
+    // smoothed seconds from sending a pose to receiving its frame
+    double roundTrip = 0;
+    // smoothed seconds from sending a pose to showing its frame, and the
+    // mean deviation of samples from it
+    double displayLatency = 0;
+    double displayJitter = 0;
+    // smoothed seconds between received frames
+    double frameInterval = 0;
+    double lastFrameTime = 0;
+    // smoothed seconds frames were shown after the time their pose was
+    // predicted for
+    double predictionError = 0;
+    // smoothed, see getNetworkDelay and getReceiveRate
+    double networkDelay = 0;
+    double receiveRate = 0;
+
+    void receiveLoop();
+    void startReceiving(int imagesPerLayer);
+    void disconnect();
+
+public:
+    RemoteClient();
+    RemoteClient(const RemoteClient&) = delete;
+    RemoteClient& operator=(const RemoteClient&) = delete;
+    ~RemoteClient();
+
+    /**
+     * Connects to a server. imagesPerLayer is the size of the swapchains
+     * layers are uploaded into: one being uploaded, one submitted and one
+     * per retained frame (setFrameHistoryLength). Returns false and prints
+     * an error if the server can't be reached
+     */
+    bool connect(const char* host, int port, int imagesPerLayer = 3);
+
+    /**
+     * Makes this a compositor for apps on this machine: waits at most
+     * timeout seconds, or forever if negative, for a RemoteServer to
+     * connectLocal under the given name. Poses and frames go through shared
+     * memory rings instead of a socket. Returns false on timeout, after
+     * which the next call with the same name keeps waiting on the same
+     * rings. Once an app has disconnected or exited, the next call waits
+     * for another
+     */
+    bool listenLocal(const char* name, int imagesPerLayer = 3, double timeout = -1);
+
+    bool isConnected() const { return connected; }
+
+    /**
+     * Asks the server to render the next frame with the given pose,
+     * predicted for displayTime
+     */
+    void sendPose(const Pose& pose, const PoseInfo& poseInfo, double displayTime);
+
+    /**
+     * Sends the camera pose predicted getPredictionLead seconds from now,
+     * or for the next display before the first frame arrived. Call once per
+     * app frame
+     */
+    void sendPredictedPose();
+
+    /**
+     * If a frame arrived since the last call, uploads its layers and fills
+     * frame with them for submitFrame, replacing its layers, pose and pose
+     * info. Frames that arrived in between are skipped. Returns false if
+     * no new frame arrived. Packed layers are unpacked with a draw into
+     * their image, which changes the bound framebuffer, viewport, program,
+     * vertex array and texture units 0 and 1. Needs the app's context
+     * current
+     */
+    bool receiveFrame(FrameSubmitInfo& frame);
+
+    /**
+     * Smoothed seconds from sending a pose to receiving the frame rendered
+     * with it, 0 until the first frame
+     */
+    double getRoundTrip() const { return roundTrip; }
+
+    /**
+     * Smoothed seconds from sending a pose to the display the frame rendered
+     * with it was first shown on, and the mean deviation from it. Samples
+     * further than 3 deviations off are clamped, so a single late frame
+     * doesn't throw off the prediction. 0 until the first frame
+     */
+    double getDisplayLatency() const { return displayLatency; }
+    double getDisplayJitter() const { return displayJitter; }
+
+    /**
+     * Seconds ahead sendPredictedPose predicts: the display latency plus
+     * half the interval between received frames, so a frame's pose is
+     * right for the middle of the time it is shown rather than its first
+     * display
+     */
+    double getPredictionLead() const { return displayLatency + frameInterval / 2; }
+
+    /**
+     * Smoothed seconds frames were first shown after the time their pose was
+     * predicted for, near 0 once the lead has settled
+     */
+    double getPredictionError() const { return predictionError; }
+
+    /**
+     * Smoothed seconds from sending a pose to the first byte of its frame,
+     * less the time the server held the pose. Grows as the link queues up.
+     * 0 until the first frame
+     */
+    double getNetworkDelay() const { return networkDelay; }
+
+    /**
+     * Smoothed bytes per second frames arrive at once they start arriving,
+     * what the link carries. 0 until a frame took long enough to measure
+     */
+    double getReceiveRate() const { return receiveRate; }
+
+    /**
+     * Disconnects and deletes the swapchains. Needs the app's context
+     * current, after reprojection has let go of their images. connect and
+     * listenLocal only disconnect, so frames from the next server are
+     * uploaded into the same swapchains
+     */
+    void close();
+};
+
+};
+
+#endif // ARPREMOTE_H
@@ -0,0 +1,116 @@
+#include "arpreplay.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+namespace arp {
+
+static const char INPUT_LOG_MAGIC[8] = {'A', 'R', 'P', 'I', 'N', 'P', 'U', 'T'};
+// changes whenever a record struct does, poses with the size of their
+// payload
+static const std::uint32_t INPUT_LOG_VERSION = 2 | ARP_POSE_DATA_SIZE << 8;
+
+bool InputLogWriter::open(const char* path) {
+    std::lock_guard<std::mutex> fileLock(fileMutex);
+    std::lock_guard<std::mutex> lock(mutex);
+    if(opened)
+        file.close();
+    file.open(path, std::ios::binary | std::ios::trunc);
+    if(!file) {
+        std::cout << "Error: could not write input log " << path << std::endl;
+        return false;
+    }
+    file.write(INPUT_LOG_MAGIC, sizeof(INPUT_LOG_MAGIC));
+    file.write((const char*)&INPUT_LOG_VERSION, sizeof(INPUT_LOG_VERSION));
+    buffer.clear();
+    opened = true;
+    return true;
+}
+
+void InputLogWriter::write(InputRecordType type, const void* record, std::size_t size) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(!opened)
+        return;
+    buffer.push_back((char)type);
+    buffer.insert(buffer.end(), (const char*)record, (const char*)record + size);
+}
+
+void InputLogWriter::flush(std::size_t minBytes) {
+    std::lock_guard<std::mutex> fileLock(fileMutex);
+    std::vector<char> pending;
+    {
+        // writers only wait for the swap, not for the file
+        std::lock_guard<std::mutex> lock(mutex);
+        if(!opened || buffer.empty() || buffer.size() < minBytes)
+            return;
+        pending.swap(buffer);
+    }
+    file.write(pending.data(), pending.size());
+    file.flush();
+}
+
+void InputLogWriter::close() {
+    flush();
+    std::lock_guard<std::mutex> fileLock(fileMutex);
+    std::lock_guard<std::mutex> lock(mutex);
+    if(!opened)
+        return;
+    opened = false;
+    file.close();
+}
+
+template<typename T>
+static bool readRecord(std::ifstream& file, std::vector<T>& records) {
+    T record;
+    if(!file.read((char*)&record, sizeof(record)))
+        return false;
+    records.push_back(record);
+    return true;
+}
+
+bool InputLog::load(const char* path) {
+    std::ifstream file(path, std::ios::binary);
+    if(!file) {
+        std::cout << "Error: could not read input log " << path << std::endl;
+        return false;
+    }
+    char magic[sizeof(INPUT_LOG_MAGIC)];
+    std::uint32_t version = 0;
+    file.read(magic, sizeof(magic));
+    file.read((char*)&version, sizeof(version));
+    if(!file || std::memcmp(magic, INPUT_LOG_MAGIC, sizeof(magic)) != 0 || version != INPUT_LOG_VERSION) {
+        std::cout << "Error: " << path << " is not an input log of this version" << std::endl;
+        return false;
+    }
+
+    events.clear();
+    refreshes.clear();
+    submits.clear();
+    char type;
+    while(file.get(type)) {
+        bool complete = false;
+        switch(type) {
+            case INPUT_RECORD_EVENT: complete = readRecord(file, events); break;
+            case INPUT_RECORD_REFRESH: complete = readRecord(file, refreshes); break;
+            case INPUT_RECORD_SUBMIT: complete = readRecord(file, submits); break;
+        }
+        if(!complete) {
+            // a session that didn't shut down cleanly can leave a partial
+            // record behind, everything before it is still usable
+            std::cout << "Error: input log " << path << " is truncated" << std::endl;
+            break;
+        }
+    }
+    return true;
+}
+
+int InputLog::findSubmit(std::uint64_t submission) const {
+    auto it = std::lower_bound(submits.begin(), submits.end(), submission,
+        [](const SubmitRecord& record, std::uint64_t value) { return record.submission < value; });
+    if(it == submits.end() || it->submission != submission)
+        return -1;
+    return (int)(it - submits.begin());
+}
+
+};
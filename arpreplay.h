@@ -0,0 +1,121 @@
+#ifndef ARPREPLAY_H
+#define ARPREPLAY_H
+
+#include "arp.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+namespace arp {
+
+/**
+ * Records of an input log. A log is a header followed by records, each a
+ * type byte and the record's struct in the recording machine's layout.
+ * Times are glfwGetTime() values of the recording session.
+ */
+enum InputRecordType : std::uint8_t {
+    INPUT_RECORD_EVENT = 1,
+    INPUT_RECORD_REFRESH = 2,
+    INPUT_RECORD_SUBMIT = 3,
+};
+
+/**
+ * Window input event, in the order reprojection handled them
+ */
+struct EventRecord {
+    double time;
+    // 0 for key events, 1 for cursor events
+    std::int32_t type;
+    std::int32_t key;
+    std::int32_t action;
+    double x;
+    double y;
+};
+
+/**
+ * Input a reprojection refresh evaluated the pose function with. It handled
+ * the events received before its time
+ */
+struct RefreshRecord {
+    double time;
+    double mouseX;
+    double mouseY;
+    // whether key times started over for a new frame, see keyTimes
+    std::uint8_t keyTimesRestarted;
+    // whether mouse motion moved the camera
+    std::uint8_t mouseActive;
+    // FrameSubmitInfo::submission of the frame latched by the refresh, 0 if
+    // it latched none
+    std::uint64_t latchedSubmission;
+};
+
+/**
+ * A submitted frame and the pose it was rendered with
+ */
+struct SubmitRecord {
+    double time;
+    std::uint64_t submission;
+    Pose pose;
+    PoseInfo poseInfo;
+};
+
+/**
+ * Appends records to a log file. Records are buffered in memory, so writing
+ * one never touches the file, and flush writes them out. Can be used from
+ * any thread
+ */
+class InputLogWriter {
+private:
+    // guards buffer and opened, fileMutex the file
+    std::mutex mutex;
+    std::mutex fileMutex;
+    std::ofstream file;
+    std::vector<char> buffer;
+    bool opened = false;
+
+public:
+    bool open(const char* path);
+
+    void write(InputRecordType type, const void* record, std::size_t size);
+
+    template<typename T>
+    void write(InputRecordType type, const T& record) {
+        write(type, &record, sizeof(record));
+    }
+
+    /**
+     * Writes the buffered records to the file once there are at least
+     * minBytes of them
+     */
+    void flush(std::size_t minBytes = 0);
+
+    void close();
+};
+
+/**
+ * Every record of a log, read into memory
+ */
+struct InputLog {
+    std::vector<EventRecord> events;
+    std::vector<RefreshRecord> refreshes;
+    std::vector<SubmitRecord> submits;
+
+    /**
+     * Reads the log at path. Returns false if it can't be read or isn't an
+     * input log of this version
+     */
+    bool load(const char* path);
+
+    /**
+     * Index into submits of the frame with the given submission number, -1
+     * if it isn't in the log
+     */
+    int findSubmit(std::uint64_t submission) const;
+};
+
+};
+
+#endif // ARPREPLAY_H
@@ -0,0 +1,160 @@
+#ifndef ARPRING_H
+#define ARPRING_H
+
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+
+namespace arp {
+
+/**
+ * Fixed capacity history with a single producer and any number of readers.
+ * Readers copy the newest samples out, samples overwritten while being read
+ * are dropped. T must be trivially copyable.
+ */
+template<typename T, int N>
+class HistoryRing {
+private:
+    struct Slot {
+        // 2 * position + 2 once written, odd while being written
+        std::atomic<std::uint64_t> sequence{0};
+        T value;
+    };
+
+    Slot slots[N];
+    std::atomic<std::uint64_t> written{0};
+
+public:
+    void push(const T& value) {
+        std::uint64_t position = written.load(std::memory_order_relaxed);
+        Slot& slot = slots[position % N];
+        slot.sequence.store(2 * position + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.value = value;
+        slot.sequence.store(2 * position + 2, std::memory_order_release);
+        written.store(position + 1, std::memory_order_release);
+    }
+
+    /**
+     * Copies up to max of the newest samples into out, oldest first.
+     * Returns the number copied
+     */
+    int snapshot(T* out, int max) const {
+        std::uint64_t end = written.load(std::memory_order_acquire);
+        std::uint64_t count = std::min<std::uint64_t>(end, std::min(max, N));
+        return copyRange(end - count, end, out);
+    }
+
+    /**
+     * Copies up to max samples pushed since position into out, oldest first,
+     * and advances position past them. Samples overwritten before they were
+     * read are skipped. Returns the number copied
+     */
+    int readSince(std::uint64_t& position, T* out, int max) const {
+        std::uint64_t end = written.load(std::memory_order_acquire);
+        std::uint64_t begin = std::max(position, end >= (std::uint64_t)N ? end - N : 0);
+        end = std::min(end, begin + std::min(max, N));
+        position = end;
+        return copyRange(begin, end, out);
+    }
+
+    void clear() {
+        written.store(0, std::memory_order_release);
+    }
+
+private:
+    int copyRange(std::uint64_t begin, std::uint64_t end, T* out) const {
+        int copied = 0;
+        for(std::uint64_t position = begin; position < end; position++) {
+            const Slot& slot = slots[position % N];
+            std::uint64_t before = slot.sequence.load(std::memory_order_acquire);
+            T value = slot.value;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            std::uint64_t after = slot.sequence.load(std::memory_order_relaxed);
+            if(before != 2 * position + 2 || after != before) {
+                continue;
+            }
+            out[copied++] = value;
+        }
+        return copied;
+    }
+};
+
+/**
+ * Fixed capacity FIFO queue any number of threads push to and pop from
+ * without locks. A push to a full queue fails rather than waits, so
+ * producers never block on a slow consumer. T must be trivially copyable
+ */
+template<typename T, int N>
+class BoundedQueue {
+private:
+    struct Cell {
+        // position + 1 once written at position, position + N once read
+        std::atomic<std::uint64_t> sequence;
+        T value;
+    };
+
+    Cell cells[N];
+    std::atomic<std::uint64_t> pushPosition{0};
+    std::atomic<std::uint64_t> popPosition{0};
+
+public:
+    BoundedQueue() {
+        for(int i = 0; i < N; i++)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    /**
+     * Returns false if the queue is full
+     */
+    bool push(const T& value) {
+        std::uint64_t position = pushPosition.load(std::memory_order_relaxed);
+        Cell* cell;
+        while(true) {
+            cell = &cells[position % N];
+            std::int64_t lag = (std::int64_t)(cell->sequence.load(std::memory_order_acquire) - position);
+            if(lag == 0) {
+                if(pushPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if(lag < 0) {
+                return false;
+            }
+            else {
+                position = pushPosition.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = value;
+        cell->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Returns false if the queue is empty
+     */
+    bool pop(T& value) {
+        std::uint64_t position = popPosition.load(std::memory_order_relaxed);
+        Cell* cell;
+        while(true) {
+            cell = &cells[position % N];
+            std::int64_t lag = (std::int64_t)(cell->sequence.load(std::memory_order_acquire) - (position + 1));
+            if(lag == 0) {
+                if(popPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if(lag < 0) {
+                return false;
+            }
+            else {
+                position = popPosition.load(std::memory_order_relaxed);
+            }
+        }
+        value = cell->value;
+        cell->sequence.store(position + N, std::memory_order_release);
+        return true;
+    }
+};
+
+};
+
+#endif // ARPRING_H
@@ -0,0 +1,322 @@
+#include "arpshm.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+namespace arp {
+
+static const std::uint32_t SHARED_CHANNEL_MAGIC = 0x43505241; // "ARPC"
+static const std::uint32_t SHARED_CHANNEL_VERSION = 1;
+// waits yield this many times before they start sleeping
+static const int SPIN_WAITS = 256;
+static const auto POLL_INTERVAL = std::chrono::microseconds(200);
+// sleeping waits check the other process is still there every this many
+static const int LIVENESS_WAITS = 50;
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free,
+              "shared channels need lock free 64 bit atomics");
+
+struct SharedRing {
+    // bytes written and read since the channel was created, the ring holds
+    // written - read of them
+    std::atomic<std::uint64_t> written;
+    std::atomic<std::uint64_t> read;
+    // from the start of the region
+    std::uint64_t offset;
+    std::uint64_t size;
+};
+
+struct SharedChannelHeader {
+    // set last by the creator, once the rest is ready
+    std::atomic<std::uint32_t> magic;
+    std::uint32_t version;
+    std::int64_t creatorProcess;
+    // 0 until a process opens the channel
+    std::atomic<std::int64_t> openerProcess;
+    std::atomic<std::uint32_t> shutDown;
+    // 0 from the creator to the opener, 1 the other way
+    SharedRing rings[2];
+};
+
+#ifdef _WIN32
+static std::string regionName(const std::string& name) {
+    return "Local\\arp-" + name;
+}
+
+static std::int64_t currentProcess() {
+    return (std::int64_t)GetCurrentProcessId();
+}
+#else
+static std::string regionName(const std::string& name) {
+    return "/arp-" + name;
+}
+
+static std::int64_t currentProcess() {
+    return (std::int64_t)getpid();
+}
+#endif
+
+SharedChannel::~SharedChannel() {
+#ifdef _WIN32
+    if(mapping)
+        UnmapViewOfFile(mapping);
+    if(file)
+        CloseHandle((HANDLE)file);
+    if(peerProcess)
+        CloseHandle((HANDLE)peerProcess);
+#else
+    if(mapping)
+        munmap(mapping, mappingSize);
+    if(named)
+        shm_unlink(regionName(name).c_str());
+#endif
+}
+
+/**
+ * Creates or opens the region and maps it whole. Opening takes the size
+ * from the region
+ */
+bool SharedChannel::map(std::size_t size, bool create) {
+    std::string region = regionName(name);
+#ifdef _WIN32
+    if(create) {
+        file = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, (DWORD)((std::uint64_t)size >> 32),
+                                  (DWORD)size, region.c_str());
+        // the region of a session whose processes are still there
+        if(file && GetLastError() == ERROR_ALREADY_EXISTS) {
+            CloseHandle((HANDLE)file);
+            file = nullptr;
+        }
+    }
+    else {
+        file = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, region.c_str());
+    }
+    if(!file)
+        return false;
+    mapping = MapViewOfFile((HANDLE)file, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    if(!mapping)
+        return false;
+    MEMORY_BASIC_INFORMATION info;
+    VirtualQuery(mapping, &info, sizeof(info));
+    mappingSize = info.RegionSize;
+#else
+    int fd;
+    if(create) {
+        // a crashed creator leaves its region behind
+        shm_unlink(region.c_str());
+        fd = shm_open(region.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if(fd >= 0 && ftruncate(fd, (off_t)size) != 0) {
+            ::close(fd);
+            shm_unlink(region.c_str());
+            return false;
+        }
+    }
+    else {
+        fd = shm_open(region.c_str(), O_RDWR, 0600);
+        struct stat status;
+        if(fd >= 0 && fstat(fd, &status) == 0)
+            size = (std::size_t)status.st_size;
+    }
+    if(fd < 0)
+        return false;
+    if(size < sizeof(SharedChannelHeader)) {
+        ::close(fd);
+        return false;
+    }
+    void* address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(address == MAP_FAILED) {
+        if(create)
+            shm_unlink(region.c_str());
+        return false;
+    }
+    mapping = address;
+    mappingSize = size;
+    named = create;
+#endif
+    header = (SharedChannelHeader*)mapping;
+    return true;
+}
+
+std::unique_ptr<SharedChannel> SharedChannel::create(const char* name, std::size_t toOpenerSize,
+                                                     std::size_t toCreatorSize) {
+    std::unique_ptr<SharedChannel> channel(new SharedChannel());
+    channel->name = name;
+    channel->creator = true;
+    // rings start on cache lines of their own
+    std::size_t headerSize = (sizeof(SharedChannelHeader) + 63) / 64 * 64;
+    toOpenerSize = (toOpenerSize + 63) / 64 * 64;
+    toCreatorSize = (toCreatorSize + 63) / 64 * 64;
+    if(!channel->map(headerSize + toOpenerSize + toCreatorSize, true)) {
+        std::cout << "Error: could not create the shared memory for " << name << std::endl;
+        return nullptr;
+    }
+
+    SharedChannelHeader* header = channel->header;
+    header->version = SHARED_CHANNEL_VERSION;
+    header->creatorProcess = currentProcess();
+    header->openerProcess = 0;
+    header->shutDown = 0;
+    header->rings[0].offset = headerSize;
+    header->rings[0].size = toOpenerSize;
+    header->rings[1].offset = headerSize + toOpenerSize;
+    header->rings[1].size = toCreatorSize;
+    for(SharedRing& ring : header->rings) {
+        ring.written = 0;
+        ring.read = 0;
+    }
+    header->magic.store(SHARED_CHANNEL_MAGIC, std::memory_order_release);
+    return channel;
+}
+
+std::unique_ptr<SharedChannel> SharedChannel::open(const char* name) {
+    std::unique_ptr<SharedChannel> channel(new SharedChannel());
+    channel->name = name;
+    if(!channel->map(0, false))
+        return nullptr;
+    SharedChannelHeader* header = channel->header;
+    if(header->magic.load(std::memory_order_acquire) != SHARED_CHANNEL_MAGIC
+       || header->version != SHARED_CHANNEL_VERSION || header->shutDown)
+        return nullptr;
+    for(const SharedRing& ring : header->rings) {
+        if(ring.offset + ring.size > channel->mappingSize)
+            return nullptr;
+    }
+    std::int64_t none = 0;
+    if(!header->openerProcess.compare_exchange_strong(none, currentProcess()))
+        return nullptr;
+    channel->watchPeer();
+    return channel;
+}
+
+bool SharedChannel::waitForPeer(double timeout) {
+    auto start = std::chrono::steady_clock::now();
+    while(!hasPeer()) {
+        if(timeout >= 0 && std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() >= timeout)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    watchPeer();
+#ifndef _WIN32
+    // the peer has it mapped, so the name can go to the next creator
+    if(named)
+        shm_unlink(regionName(name).c_str());
+    named = false;
+#endif
+    return true;
+}
+
+bool SharedChannel::hasPeer() const {
+    return header->openerProcess.load(std::memory_order_acquire) != 0;
+}
+
+/**
+ * Keeps a handle to the other process, to see it exit without having shut
+ * the channel down
+ */
+void SharedChannel::watchPeer() {
+#ifdef _WIN32
+    if(peerProcess)
+        return;
+    DWORD peer = (DWORD)(creator ? header->openerProcess.load() : header->creatorProcess);
+    peerProcess = OpenProcess(SYNCHRONIZE, FALSE, peer);
+#endif
+}
+
+bool SharedChannel::peerAlive() const {
+#ifdef _WIN32
+    return !peerProcess || WaitForSingleObject((HANDLE)peerProcess, 0) == WAIT_TIMEOUT;
+#else
+    pid_t peer = (pid_t)(creator ? header->openerProcess.load() : header->creatorProcess);
+    return kill(peer, 0) == 0 || errno == EPERM;
+#endif
+}
+
+/**
+ * Backs off once while a ring is full or empty, returns false if the
+ * stream has ended
+ */
+bool SharedChannel::wait(int& idle) const {
+    if(header->shutDown.load(std::memory_order_acquire))
+        return false;
+    if(idle < SPIN_WAITS) {
+        std::this_thread::yield();
+    }
+    else {
+        if((idle - SPIN_WAITS) % LIVENESS_WAITS == 0 && !peerAlive())
+            return false;
+        std::this_thread::sleep_for(POLL_INTERVAL);
+    }
+    idle++;
+    return true;
+}
+
+bool SharedChannel::send(const void* data, std::size_t size) {
+    SharedRing& ring = header->rings[creator ? 0 : 1];
+    char* buffer = (char*)mapping + ring.offset;
+    const char* bytes = (const char*)data;
+    std::uint64_t written = ring.written.load(std::memory_order_relaxed);
+    int idle = 0;
+    while(size > 0) {
+        std::uint64_t space = ring.size - (written - ring.read.load(std::memory_order_acquire));
+        if(space == 0) {
+            if(!wait(idle))
+                return false;
+            continue;
+        }
+        std::size_t chunk = (std::size_t)std::min<std::uint64_t>({ size, space, ring.size - written % ring.size });
+        std::memcpy(buffer + written % ring.size, bytes, chunk);
+        written += chunk;
+        ring.written.store(written, std::memory_order_release);
+        bytes += chunk;
+        size -= chunk;
+        idle = 0;
+    }
+    return !header->shutDown.load(std::memory_order_acquire);
+}
+
+bool SharedChannel::receive(void* data, std::size_t size) {
+    SharedRing& ring = header->rings[creator ? 1 : 0];
+    const char* buffer = (const char*)mapping + ring.offset;
+    char* bytes = (char*)data;
+    std::uint64_t read = ring.read.load(std::memory_order_relaxed);
+    int idle = 0;
+    while(size > 0) {
+        std::uint64_t available = ring.written.load(std::memory_order_acquire) - read;
+        if(available == 0) {
+            if(!wait(idle))
+                return false;
+            continue;
+        }
+        std::size_t chunk = (std::size_t)std::min<std::uint64_t>({ size, available, ring.size - read % ring.size });
+        std::memcpy(bytes, buffer + read % ring.size, chunk);
+        read += chunk;
+        ring.read.store(read, std::memory_order_release);
+        bytes += chunk;
+        size -= chunk;
+        idle = 0;
+    }
+    return true;
+}
+
+void SharedChannel::shutdown() {
+    header->shutDown.store(1, std::memory_order_release);
+}
+
+};
@@ -0,0 +1,97 @@
+#ifndef ARPSHM_H
+#define ARPSHM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace arp {
+
+struct SharedChannelHeader;
+
+/**
+ * A byte stream in each direction between two processes on the same
+ * machine, through a ring per direction in a named shared memory region.
+ * One process creates the channel and waits for another to open it, after
+ * which the name is free to be created again. Either end sees the other
+ * shut the channel down or exit. Blocked calls spin for a while, then poll
+ * a few times a millisecond, so a stream that's busy costs no system calls.
+ *
+ * Each direction may be used by one thread at a time
+ */
+class SharedChannel {
+private:
+    std::string name;
+    bool creator = false;
+    // the creator holds the name until the peer has opened the region
+    bool named = false;
+    void* mapping = nullptr;
+    std::size_t mappingSize = 0;
+#ifdef _WIN32
+    void* file = nullptr;
+    void* peerProcess = nullptr;
+#endif
+    SharedChannelHeader* header = nullptr;
+
+    SharedChannel() = default;
+    bool map(std::size_t size, bool create);
+    void watchPeer();
+    bool peerAlive() const;
+    bool wait(int& idle) const;
+
+public:
+    SharedChannel(const SharedChannel&) = delete;
+    SharedChannel& operator=(const SharedChannel&) = delete;
+    ~SharedChannel();
+
+    /**
+     * Creates the channel with rings of the given sizes, replacing one of
+     * the same name a crashed process left behind. Returns null and prints
+     * an error if the region can't be made
+     */
+    static std::unique_ptr<SharedChannel> create(const char* name, std::size_t toOpenerSize,
+                                                 std::size_t toCreatorSize);
+
+    /**
+     * Opens a channel another process created and is waiting on. Returns
+     * null if there is none or another process opened it first
+     */
+    static std::unique_ptr<SharedChannel> open(const char* name);
+
+    /**
+     * On the creating end, waits at most timeout seconds, or forever if
+     * negative, for another process to open the channel. Returns true
+     * right away once it has
+     */
+    bool waitForPeer(double timeout = -1);
+
+    /**
+     * True once another process has opened the channel
+     */
+    bool hasPeer() const;
+
+    const std::string& getName() const { return name; }
+
+    /**
+     * Sends all of data, waiting for the other end to make room. Returns
+     * false once either end has shut the channel down or the other has
+     * exited
+     */
+    bool send(const void* data, std::size_t size);
+
+    /**
+     * Receives exactly size bytes, returns false like send
+     */
+    bool receive(void* data, std::size_t size);
+
+    /**
+     * Ends the stream in both directions, waking threads of either end
+     * blocked on it. Can be called from any thread
+     */
+    void shutdown();
+};
+
+};
+
+#endif // ARPSHM_H
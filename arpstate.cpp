@@ -0,0 +1,206 @@
+#include "arpstate.h"
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+namespace arp {
+
+// every live cache, and the counts of the ones whose threads have exited
+static std::mutex cachesMutex;
+static std::vector<GLStateCache*> caches;
+static GLStateCounters retiredCounters;
+
+GLStateCache::GLStateCache() {
+    invalidate();
+    std::lock_guard<std::mutex> lock(cachesMutex);
+    caches.push_back(this);
+}
+
+GLStateCache::~GLStateCache() {
+    std::lock_guard<std::mutex> lock(cachesMutex);
+    caches.erase(std::find(caches.begin(), caches.end(), this));
+    GLStateCounters counters = getCounters();
+    retiredCounters.issued += counters.issued;
+    retiredCounters.elided += counters.elided;
+}
+
+void GLStateCache::invalidate() {
+    program = -1;
+    invalidateTextures();
+    vertexArray = -1;
+    drawFramebuffer = -1;
+    readFramebuffer = -1;
+    viewportKnown = false;
+    std::fill(capabilities, capabilities + CAPABILITY_COUNT, -1);
+    blendKnown = false;
+}
+
+void GLStateCache::invalidateTextures() {
+    activeUnit = -1;
+    for(auto& unit : textures)
+        std::fill(unit, unit + TARGET_COUNT, -1);
+}
+
+void GLStateCache::useProgram(GLuint id) {
+    if(program == id) {
+        countElided();
+        return;
+    }
+    program = id;
+    glUseProgram(id);
+    countIssued();
+}
+
+void GLStateCache::activateUnit(int unit) {
+    if(activeUnit == unit)
+        return;
+    activeUnit = unit;
+    glActiveTexture(GL_TEXTURE0 + unit);
+    countIssued();
+}
+
+void GLStateCache::bindTexture(int unit, GLenum target, GLuint texture) {
+    int index = target == GL_TEXTURE_2D ? TARGET_2D : target == GL_TEXTURE_CUBE_MAP ? TARGET_CUBE_MAP : -1;
+    if(index < 0 || unit >= MAX_TEXTURE_UNITS) {
+        activateUnit(unit);
+        glBindTexture(target, texture);
+        countIssued();
+        return;
+    }
+    activateUnit(unit);
+    if(textures[unit][index] == texture) {
+        countElided();
+        return;
+    }
+    textures[unit][index] = texture;
+    glBindTexture(target, texture);
+    countIssued();
+}
+
+void GLStateCache::bindVertexArray(GLuint id) {
+    if(vertexArray == id) {
+        countElided();
+        return;
+    }
+    vertexArray = id;
+    glBindVertexArray(id);
+    countIssued();
+}
+
+void GLStateCache::bindFramebuffer(GLenum target, GLuint framebuffer) {
+    bool draw = target != GL_READ_FRAMEBUFFER;
+    bool read = target != GL_DRAW_FRAMEBUFFER;
+    if((!draw || drawFramebuffer == framebuffer) && (!read || readFramebuffer == framebuffer)) {
+        countElided();
+        return;
+    }
+    if(draw)
+        drawFramebuffer = framebuffer;
+    if(read)
+        readFramebuffer = framebuffer;
+    glBindFramebuffer(target, framebuffer);
+    countIssued();
+}
+
+void GLStateCache::viewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+    if(viewportKnown && viewportRect[0] == x && viewportRect[1] == y
+       && viewportRect[2] == width && viewportRect[3] == height) {
+        countElided();
+        return;
+    }
+    viewportKnown = true;
+    viewportRect[0] = x;
+    viewportRect[1] = y;
+    viewportRect[2] = width;
+    viewportRect[3] = height;
+    glViewport(x, y, width, height);
+    countIssued();
+}
+
+void GLStateCache::setEnabled(GLenum capability, bool enabled) {
+    int index;
+    switch(capability) {
+    case GL_BLEND: index = CAPABILITY_BLEND; break;
+    case GL_DEPTH_TEST: index = CAPABILITY_DEPTH_TEST; break;
+    case GL_STENCIL_TEST: index = CAPABILITY_STENCIL_TEST; break;
+    case GL_SCISSOR_TEST: index = CAPABILITY_SCISSOR_TEST; break;
+    default: index = -1; break;
+    }
+    if(index >= 0 && capabilities[index] == enabled) {
+        countElided();
+        return;
+    }
+    if(index >= 0)
+        capabilities[index] = enabled;
+    if(enabled)
+        glEnable(capability);
+    else
+        glDisable(capability);
+    countIssued();
+}
+
+void GLStateCache::blendFunc(GLenum source, GLenum destination) {
+    if(blendKnown && blendSource == source && blendDestination == destination) {
+        countElided();
+        return;
+    }
+    blendKnown = true;
+    blendSource = source;
+    blendDestination = destination;
+    glBlendFunc(source, destination);
+    countIssued();
+}
+
+bool GLStateCache::getViewport(GLint viewport[4]) const {
+    if(!viewportKnown)
+        return false;
+    std::copy(viewportRect, viewportRect + 4, viewport);
+    return true;
+}
+
+void GLStateCache::forgetTexture(GLuint texture) {
+    for(auto& unit : textures) {
+        for(std::int64_t& bound : unit) {
+            if(bound == texture)
+                bound = -1;
+        }
+    }
+}
+
+void GLStateCache::forgetVertexArray(GLuint id) {
+    if(vertexArray == id)
+        vertexArray = -1;
+}
+
+void GLStateCache::forgetFramebuffer(GLuint framebuffer) {
+    if(drawFramebuffer == framebuffer)
+        drawFramebuffer = -1;
+    if(readFramebuffer == framebuffer)
+        readFramebuffer = -1;
+}
+
+GLStateCounters GLStateCache::getCounters() const {
+    GLStateCounters counters;
+    counters.issued = issued.load(std::memory_order_relaxed);
+    counters.elided = elided.load(std::memory_order_relaxed);
+    return counters;
+}
+
+GLStateCache& glState() {
+    static thread_local GLStateCache cache;
+    return cache;
+}
+
+GLStateCounters getGLStateCounters() {
+    std::lock_guard<std::mutex> lock(cachesMutex);
+    GLStateCounters total = retiredCounters;
+    for(const GLStateCache* cache : caches) {
+        GLStateCounters counters = cache->getCounters();
+        total.issued += counters.issued;
+        total.elided += counters.elided;
+    }
+    return total;
+}
+
+};
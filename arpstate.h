@@ -0,0 +1,146 @@
+#ifndef ARPSTATE_H
+#define ARPSTATE_H
+
+#include <GL/glew.h>
+
+#include <atomic>
+#include <cstdint>
+
+namespace arp {
+
+/**
+ * State changing calls made to GL, and ones skipped because the state was
+ * already set
+ */
+struct GLStateCounters {
+    std::uint64_t issued = 0;
+    std::uint64_t elided = 0;
+};
+
+/**
+ * Shadow of the GL state that draws change most: program, textures, vertex
+ * array, framebuffers, viewport and the blend, depth, stencil and scissor
+ * tests. Calls that would set what is already set are skipped.
+ *
+ * Every thread has its own cache, for the context current on it. State
+ * changed without going through the cache, by direct GL calls or other
+ * libraries, has to be forgotten with invalidate. Code that restores what it
+ * read back with glGet, like the ImGui backend, is fine
+ */
+class GLStateCache {
+public:
+    static const int MAX_TEXTURE_UNITS = 8;
+
+    GLStateCache();
+    ~GLStateCache();
+    GLStateCache(const GLStateCache&) = delete;
+    GLStateCache& operator=(const GLStateCache&) = delete;
+
+    void useProgram(GLuint program);
+
+    /**
+     * Makes unit the active unit and binds texture to target on it, so
+     * calls editing the bound texture can follow. GL_TEXTURE_2D and
+     * GL_TEXTURE_CUBE_MAP on the first MAX_TEXTURE_UNITS units are cached,
+     * others always issued
+     */
+    void bindTexture(int unit, GLenum target, GLuint texture);
+
+    void bindVertexArray(GLuint vertexArray);
+
+    /**
+     * GL_FRAMEBUFFER sets both the draw and read framebuffer
+     */
+    void bindFramebuffer(GLenum target, GLuint framebuffer);
+
+    void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+
+    /**
+     * glEnable or glDisable of GL_BLEND, GL_DEPTH_TEST, GL_STENCIL_TEST or
+     * GL_SCISSOR_TEST. Other capabilities are always issued
+     */
+    void setEnabled(GLenum capability, bool enabled);
+
+    void blendFunc(GLenum source, GLenum destination);
+
+    /**
+     * The current viewport, false if it isn't known. Saves a glGet
+     */
+    bool getViewport(GLint viewport[4]) const;
+
+    /**
+     * Forget an object's bindings, call when deleting it. Its name can be
+     * handed out again, and a new object under it would otherwise seem bound
+     */
+    void forgetTexture(GLuint texture);
+    void forgetVertexArray(GLuint vertexArray);
+    void forgetFramebuffer(GLuint framebuffer);
+
+    /**
+     * Forgets all cached state, so the next call of each kind is issued
+     */
+    void invalidate();
+
+    /**
+     * Forgets the texture bindings and active unit, for code that binds
+     * textures to create or upload them
+     */
+    void invalidateTextures();
+
+    /**
+     * Can be called from any thread
+     */
+    GLStateCounters getCounters() const;
+
+private:
+    enum TextureTarget {
+        TARGET_2D,
+        TARGET_CUBE_MAP,
+        TARGET_COUNT,
+    };
+
+    enum Capability {
+        CAPABILITY_BLEND,
+        CAPABILITY_DEPTH_TEST,
+        CAPABILITY_STENCIL_TEST,
+        CAPABILITY_SCISSOR_TEST,
+        CAPABILITY_COUNT,
+    };
+
+    // -1 while unknown
+    std::int64_t program;
+    std::int64_t activeUnit;
+    std::int64_t textures[MAX_TEXTURE_UNITS][TARGET_COUNT];
+    std::int64_t vertexArray;
+    std::int64_t drawFramebuffer;
+    std::int64_t readFramebuffer;
+    bool viewportKnown;
+    GLint viewportRect[4];
+    std::int8_t capabilities[CAPABILITY_COUNT];
+    bool blendKnown;
+    GLenum blendSource;
+    GLenum blendDestination;
+
+    // only written by the owning thread, so no read-modify-write is needed
+    std::atomic<std::uint64_t> issued{ 0 };
+    std::atomic<std::uint64_t> elided{ 0 };
+
+    void countIssued() { issued.store(issued.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }
+    void countElided() { elided.store(elided.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }
+    void activateUnit(int unit);
+};
+
+/**
+ * Returns the calling thread's cache
+ */
+GLStateCache& glState();
+
+/**
+ * Counters of every thread's cache added up, including threads that have
+ * exited. Can be called from any thread
+ */
+GLStateCounters getGLStateCounters();
+
+};
+
+#endif // ARPSTATE_H
@@ -0,0 +1,321 @@
+#include "arpstats.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+namespace arp {
+
+// how often a Prometheus exporter checks for scrapes and for stop
+static const double SCRAPE_POLL_INTERVAL = 0.1;
+// a scraper that hasn't sent its request by then is dropped
+static const double SCRAPE_REQUEST_TIMEOUT = 1.0;
+
+#ifdef _WIN32
+typedef SOCKET NativeSocket;
+static const NativeSocket invalidSocket = INVALID_SOCKET;
+
+static bool startSockets() {
+    static bool started = false;
+    if(!started) {
+        WSADATA data;
+        started = WSAStartup(MAKEWORD(2, 2), &data) == 0;
+    }
+    return started;
+}
+
+static void closeSocket(NativeSocket s) {
+    closesocket(s);
+}
+#else
+typedef int NativeSocket;
+static const NativeSocket invalidSocket = -1;
+
+static bool startSockets() {
+    return true;
+}
+
+static void closeSocket(NativeSocket s) {
+    ::close(s);
+}
+#endif
+
+/**
+ * Plain copy of StatsCounters at one time
+ */
+struct StatsSnapshot {
+    double time = 0;
+    std::uint64_t refreshes = 0;
+    std::uint64_t missedRefreshes = 0;
+    std::uint64_t tornRefreshes = 0;
+    std::uint64_t gpuTimeBins[StatsCounters::GPU_TIME_BIN_COUNT] = {};
+    std::uint64_t appFrames = 0;
+    std::uint64_t swapchainWaitMicros = 0;
+    std::uint64_t predictedFrames = 0;
+    std::uint64_t predictionErrorMicrodegrees = 0;
+    std::uint64_t predictionErrorMicrounits = 0;
+    double refreshPeriod = 0;
+    std::int64_t trackedGpuBytes = 0;
+    std::int64_t deviceAvailableBytes = -1;
+};
+
+static double now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static timeval toTimeval(double seconds) {
+    timeval t;
+    t.tv_sec = (long)seconds;
+    t.tv_usec = (long)((seconds - t.tv_sec) * 1e6);
+    return t;
+}
+
+static StatsSnapshot snapshot(const StatsCounters& counters) {
+    StatsSnapshot s;
+    s.time = now();
+    s.refreshes = counters.refreshes.load(std::memory_order_relaxed);
+    s.missedRefreshes = counters.missedRefreshes.load(std::memory_order_relaxed);
+    s.tornRefreshes = counters.tornRefreshes.load(std::memory_order_relaxed);
+    for(int i = 0; i < StatsCounters::GPU_TIME_BIN_COUNT; i++)
+        s.gpuTimeBins[i] = counters.gpuTimeBins[i].load(std::memory_order_relaxed);
+    s.appFrames = counters.appFrames.load(std::memory_order_relaxed);
+    s.swapchainWaitMicros = counters.swapchainWaitMicros.load(std::memory_order_relaxed);
+    s.predictedFrames = counters.predictedFrames.load(std::memory_order_relaxed);
+    s.predictionErrorMicrodegrees = counters.predictionErrorMicrodegrees.load(std::memory_order_relaxed);
+    s.predictionErrorMicrounits = counters.predictionErrorMicrounits.load(std::memory_order_relaxed);
+    s.refreshPeriod = counters.refreshPeriod.load(std::memory_order_relaxed);
+    s.trackedGpuBytes = counters.trackedGpuBytes.load(std::memory_order_relaxed);
+    s.deviceAvailableBytes = counters.deviceAvailableBytes.load(std::memory_order_relaxed);
+    return s;
+}
+
+/**
+ * Upper edge in ms of the bin holding the given fraction of the GPU times
+ * between the snapshots, 0 without any
+ */
+static double gpuTimePercentile(const StatsSnapshot& previous, const StatsSnapshot& current, double fraction) {
+    std::uint64_t count = 0;
+    for(int i = 0; i < StatsCounters::GPU_TIME_BIN_COUNT; i++)
+        count += current.gpuTimeBins[i] - previous.gpuTimeBins[i];
+    if(count == 0)
+        return 0;
+    std::uint64_t target = std::max<std::uint64_t>(1, (std::uint64_t)std::ceil(count * fraction));
+    std::uint64_t seen = 0;
+    int bin = 0;
+    for(; bin < StatsCounters::GPU_TIME_BIN_COUNT - 1; bin++) {
+        seen += current.gpuTimeBins[bin] - previous.gpuTimeBins[bin];
+        if(seen >= target)
+            break;
+    }
+    return (bin + 1) * StatsCounters::GPU_TIME_BIN_WIDTH * 1000.0;
+}
+
+void StatsCounters::addGpuTime(double seconds) {
+    int bin = std::min((int)(std::max(seconds, 0.0) / GPU_TIME_BIN_WIDTH), GPU_TIME_BIN_COUNT - 1);
+    gpuTimeBins[bin].fetch_add(1, std::memory_order_relaxed);
+}
+
+StatsExporter::~StatsExporter() {
+    stop();
+}
+
+bool StatsExporter::start(const StatsExportSettings& newSettings, const StatsCounters& newCounters) {
+    stop();
+    if(!startSockets()) {
+        std::cout << "Error: could not start sockets" << std::endl;
+        return false;
+    }
+    settings = newSettings;
+    settings.interval = std::max(settings.interval, SCRAPE_POLL_INTERVAL);
+    host = newSettings.host ? newSettings.host : "127.0.0.1";
+    prefix = newSettings.prefix ? newSettings.prefix : "";
+    settings.host = host.c_str();
+    settings.prefix = prefix.c_str();
+    counters = &newCounters;
+
+    NativeSocket s = invalidSocket;
+    if(settings.target == STATS_EXPORT_PROMETHEUS) {
+        s = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        int reuse = 1;
+        if(s != invalidSocket)
+            setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        address.sin_port = htons((unsigned short)settings.port);
+        if(s != invalidSocket
+           && (bind(s, (sockaddr*)&address, sizeof(address)) != 0 || ::listen(s, 4) != 0)) {
+            closeSocket(s);
+            s = invalidSocket;
+        }
+        if(s == invalidSocket) {
+            std::cout << "Error: could not listen for stats scrapes on port " << settings.port << std::endl;
+            return false;
+        }
+    }
+    else {
+        // connected, so each update is a plain send
+        addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_DGRAM;
+        addrinfo* addresses = nullptr;
+        std::string service = std::to_string(settings.port);
+        if(getaddrinfo(host.c_str(), service.c_str(), &hints, &addresses) != 0) {
+            std::cout << "Error: could not resolve " << host << std::endl;
+            return false;
+        }
+        for(addrinfo* address = addresses; address; address = address->ai_next) {
+            s = ::socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+            if(s == invalidSocket)
+                continue;
+            if(::connect(s, address->ai_addr, (int)address->ai_addrlen) == 0)
+                break;
+            closeSocket(s);
+            s = invalidSocket;
+        }
+        freeaddrinfo(addresses);
+        if(s == invalidSocket) {
+            std::cout << "Error: could not reach StatsD at " << host << ":" << settings.port << std::endl;
+            return false;
+        }
+    }
+
+    socket = (std::intptr_t)s;
+    stopping = false;
+    thread = std::thread(&StatsExporter::run, this);
+    return true;
+}
+
+void StatsExporter::stop() {
+    if(!thread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cond.notify_all();
+    thread.join();
+    closeSocket((NativeSocket)socket);
+    socket = -1;
+}
+
+/**
+ * The metrics measured between the snapshots, as StatsD lines or the
+ * Prometheus text format
+ */
+std::string StatsExporter::format(const StatsSnapshot& previous, const StatsSnapshot& current,
+                                  double elapsed) const {
+    std::uint64_t appFrames = current.appFrames - previous.appFrames;
+    std::uint64_t predicted = current.predictedFrames - previous.predictedFrames;
+    std::uint64_t predictionError = current.predictionErrorMicrodegrees - previous.predictionErrorMicrodegrees;
+    std::uint64_t positionError = current.predictionErrorMicrounits - previous.predictionErrorMicrounits;
+    std::uint64_t swapchainWait = current.swapchainWaitMicros - previous.swapchainWaitMicros;
+    std::vector<std::pair<const char*, double>> metrics = {
+        { "refresh_rate", (current.refreshes - previous.refreshes) / elapsed },
+        { "display_rate", current.refreshPeriod > 0 ? 1.0 / current.refreshPeriod : 0 },
+        { "missed_refreshes", (double)(current.missedRefreshes - previous.missedRefreshes) },
+        { "torn_refreshes", (double)(current.tornRefreshes - previous.tornRefreshes) },
+        { "reprojection_gpu_ms_p50", gpuTimePercentile(previous, current, 0.5) },
+        { "reprojection_gpu_ms_p99", gpuTimePercentile(previous, current, 0.99) },
+        { "reprojection_gpu_ms_max", gpuTimePercentile(previous, current, 1.0) },
+        { "app_fps", appFrames / elapsed },
+        { "swapchain_wait_ms", appFrames ? swapchainWait / 1000.0 / appFrames : 0 },
+        { "prediction_error_degrees", predicted ? predictionError / 1e6 / predicted : 0 },
+        { "prediction_error_units", predicted ? positionError / 1e6 / predicted : 0 },
+        { "gpu_memory_tracked_bytes", (double)current.trackedGpuBytes },
+        { "gpu_memory_available_bytes", (double)current.deviceAvailableBytes },
+    };
+
+    std::string text;
+    char line[256];
+    for(const auto& metric : metrics) {
+        if(settings.target == STATS_EXPORT_PROMETHEUS) {
+            snprintf(line, sizeof(line), "# TYPE %s_%s gauge\n%s_%s %.9g\n", prefix.c_str(), metric.first,
+                     prefix.c_str(), metric.first, metric.second);
+        }
+        else {
+            snprintf(line, sizeof(line), "%s.%s:%.9g|g\n", prefix.c_str(), metric.first, metric.second);
+        }
+        text += line;
+    }
+    return text;
+}
+
+/**
+ * Measures the counters every interval. StatsD gets each measurement sent,
+ * Prometheus scrapes get the latest one
+ */
+void StatsExporter::run() {
+    NativeSocket s = (NativeSocket)socket;
+    StatsSnapshot previous = snapshot(*counters);
+    double next = previous.time + settings.interval;
+    std::string text;
+    while(true) {
+        if(settings.target == STATS_EXPORT_STATSD) {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait_for(lock, std::chrono::duration<double>(std::max(next - now(), 0.0)),
+                          [this]() { return stopping; });
+            if(stopping)
+                break;
+        }
+        else {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if(stopping)
+                    break;
+            }
+            fd_set readable;
+            FD_ZERO(&readable);
+            FD_SET(s, &readable);
+            timeval timeout = toTimeval(SCRAPE_POLL_INTERVAL);
+            if(select((int)s + 1, &readable, nullptr, nullptr, &timeout) > 0) {
+                NativeSocket client = accept(s, nullptr, nullptr);
+                if(client != invalidSocket) {
+                    // whatever was asked for, the request only has to arrive
+                    FD_ZERO(&readable);
+                    FD_SET(client, &readable);
+                    timeval requestTimeout = toTimeval(SCRAPE_REQUEST_TIMEOUT);
+                    char request[1024];
+                    if(select((int)client + 1, &readable, nullptr, nullptr, &requestTimeout) > 0
+                       && ::recv(client, request, sizeof(request), 0) > 0) {
+                        std::string response = "HTTP/1.0 200 OK\r\n"
+                                               "Content-Type: text/plain; version=0.0.4\r\n"
+                                               "Content-Length: " + std::to_string(text.size()) + "\r\n\r\n"
+                                               + text;
+                        ::send(client, response.data(), (int)response.size(), 0);
+                    }
+                    closeSocket(client);
+                }
+            }
+        }
+
+        if(now() < next)
+            continue;
+        StatsSnapshot current = snapshot(*counters);
+        text = format(previous, current, current.time - previous.time);
+        previous = current;
+        // after a late wake the intervals start over rather than catch up
+        next += settings.interval;
+        if(next < current.time)
+            next = current.time + settings.interval;
+        if(settings.target == STATS_EXPORT_STATSD)
+            ::send(s, text.data(), (int)text.size(), 0);
+    }
+}
+
+};
@@ -0,0 +1,97 @@
+#ifndef ARPSTATS_H
+#define ARPSTATS_H
+
+#include "arp.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace arp {
+
+struct StatsSnapshot;
+
+/**
+ * Running totals the reprojection and application threads add to as they
+ * go, for StatsExporter. Only relaxed atomic adds and stores, so the hot
+ * loop takes no lock for them. Totals only grow, the exporter turns the
+ * difference between two reads into rates, means and percentiles
+ */
+struct StatsCounters {
+    static const int GPU_TIME_BIN_COUNT = 200;
+    // the last bin also counts every longer time
+    static constexpr double GPU_TIME_BIN_WIDTH = 0.0001;
+
+    // presented refreshes and the ones that missed their vblank
+    std::atomic<std::uint64_t> refreshes{0};
+    std::atomic<std::uint64_t> missedRefreshes{0};
+    // late refreshes adaptive vsync showed at once, tearing
+    std::atomic<std::uint64_t> tornRefreshes{0};
+    // histogram of reprojection GPU times
+    std::atomic<std::uint64_t> gpuTimeBins[GPU_TIME_BIN_COUNT] = {};
+    std::atomic<std::uint64_t> appFrames{0};
+    // in microseconds so they add without a compare-exchange loop
+    std::atomic<std::uint64_t> swapchainWaitMicros{0};
+    // rotation reprojection corrected on each new frame's first refresh, in
+    // millionths of a degree
+    std::atomic<std::uint64_t> predictedFrames{0};
+    std::atomic<std::uint64_t> predictionErrorMicrodegrees{0};
+    // and in millionths of a unit of position
+    std::atomic<std::uint64_t> predictionErrorMicrounits{0};
+    // latest values rather than totals
+    std::atomic<double> refreshPeriod{0};
+    std::atomic<std::int64_t> trackedGpuBytes{0};
+    std::atomic<std::int64_t> deviceAvailableBytes{-1};
+
+    void addGpuTime(double seconds);
+};
+
+/**
+ * Publishes StatsCounters every interval from a thread of its own, which
+ * sleeps between updates, as StatsD gauges over UDP or as the Prometheus
+ * text format on an HTTP port. The exporter only ever reads the counters.
+ *
+ * start and stop are called from any thread
+ */
+class StatsExporter {
+private:
+    const StatsCounters* counters = nullptr;
+    StatsExportSettings settings;
+    std::string host;
+    std::string prefix;
+
+    // guards stopping, cond wakes the thread to stop
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool stopping = false;
+    std::thread thread;
+    std::intptr_t socket = -1;
+
+    void run();
+    std::string format(const StatsSnapshot& previous, const StatsSnapshot& current, double elapsed) const;
+
+public:
+    ~StatsExporter();
+
+    /**
+     * Opens the socket, a UDP one for StatsD or an HTTP listener for
+     * Prometheus, and starts publishing the counters, replacing an export
+     * in progress. Returns false and prints an error if the socket can't be
+     * made
+     */
+    bool start(const StatsExportSettings& settings, const StatsCounters& counters);
+
+    /**
+     * Stops the thread and closes the socket
+     */
+    void stop();
+
+    bool isActive() const { return thread.joinable(); }
+};
+
+};
+
+#endif // ARPSTATS_H
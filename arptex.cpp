@@ -0,0 +1,486 @@
+#include "arptex.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+const char DDS_MAGIC[4] = { 'D', 'D', 'S', ' ' };
+
+const std::uint32_t DDSD_CAPS = 0x1;
+const std::uint32_t DDSD_HEIGHT = 0x2;
+const std::uint32_t DDSD_WIDTH = 0x4;
+const std::uint32_t DDSD_PITCH = 0x8;
+const std::uint32_t DDSD_PIXELFORMAT = 0x1000;
+const std::uint32_t DDSD_MIPMAPCOUNT = 0x20000;
+const std::uint32_t DDSD_LINEARSIZE = 0x80000;
+
+const std::uint32_t DDPF_ALPHAPIXELS = 0x1;
+const std::uint32_t DDPF_FOURCC = 0x4;
+const std::uint32_t DDPF_RGB = 0x40;
+
+const std::uint32_t DDSCAPS_COMPLEX = 0x8;
+const std::uint32_t DDSCAPS_TEXTURE = 0x1000;
+const std::uint32_t DDSCAPS_MIPMAP = 0x400000;
+
+constexpr std::uint32_t fourCC(char a, char b, char c, char d)
+{
+    return (std::uint32_t)a | (std::uint32_t)b << 8 | (std::uint32_t)c << 16 | (std::uint32_t)d << 24;
+}
+
+std::size_t blockSize(TextureFormat format)
+{
+    return format == TEXTURE_BC1 ? 8 : 16;
+}
+
+std::uint16_t packRgb565(const float color[3])
+{
+    int r = std::min(31, std::max(0, (int)std::lround(color[0] * 31 / 255)));
+    int g = std::min(63, std::max(0, (int)std::lround(color[1] * 63 / 255)));
+    int b = std::min(31, std::max(0, (int)std::lround(color[2] * 31 / 255)));
+    return (std::uint16_t)(r << 11 | g << 5 | b);
+}
+
+void unpackRgb565(std::uint16_t packed, int color[3])
+{
+    int r = packed >> 11 & 31, g = packed >> 5 & 63, b = packed & 31;
+    color[0] = r << 3 | r >> 2;
+    color[1] = g << 2 | g >> 4;
+    color[2] = b << 3 | b >> 2;
+}
+
+/**
+ * The four colors of an opaque BC1 block, color0 must be the larger
+ */
+void bc1Palette(std::uint16_t color0, std::uint16_t color1, int palette[4][3])
+{
+    unpackRgb565(color0, palette[0]);
+    unpackRgb565(color1, palette[1]);
+    for(int k = 0; k < 3; k++) {
+        palette[2][k] = (2 * palette[0][k] + palette[1][k]) / 3;
+        palette[3][k] = (palette[0][k] + 2 * palette[1][k]) / 3;
+    }
+}
+
+/**
+ * Picks the nearest palette color for every texel, returns the squared error
+ */
+int assignBC1Indices(const unsigned char rgba[64], std::uint16_t color0, std::uint16_t color1, std::uint32_t& indices)
+{
+    int palette[4][3];
+    bc1Palette(color0, color1, palette);
+    indices = 0;
+    int error = 0;
+    for(int i = 0; i < 16; i++) {
+        int best = 0, bestDistance = INT32_MAX;
+        for(int p = 0; p < 4; p++) {
+            int distance = 0;
+            for(int k = 0; k < 3; k++) {
+                int d = rgba[i * 4 + k] - palette[p][k];
+                distance += d * d;
+            }
+            if(distance < bestDistance) {
+                bestDistance = distance;
+                best = p;
+            }
+        }
+        indices |= (std::uint32_t)best << (i * 2);
+        error += bestDistance;
+    }
+    return error;
+}
+
+/**
+ * Orders the endpoints for four color mode. Returns false if they are the
+ * same color, which only has the one
+ */
+bool orderEndpoints(std::uint16_t& color0, std::uint16_t& color1)
+{
+    if(color0 < color1)
+        std::swap(color0, color1);
+    return color0 != color1;
+}
+
+void writeBC1(unsigned char block[8], std::uint16_t color0, std::uint16_t color1, std::uint32_t indices)
+{
+    memcpy(block, &color0, 2);
+    memcpy(block + 2, &color1, 2);
+    memcpy(block + 4, &indices, 4);
+}
+
+}
+
+std::size_t textureLevelSize(TextureFormat format, int width, int height)
+{
+    if(format == TEXTURE_RGBA8)
+        return (std::size_t)width * height * 4;
+    return (std::size_t)((width + 3) / 4) * ((height + 3) / 4) * blockSize(format);
+}
+
+void buildMipChain(const unsigned char* rgba, int width, int height, std::vector<TextureLevel>& levels)
+{
+    levels.clear();
+    levels.push_back({ width, height, std::vector<unsigned char>(rgba, rgba + (std::size_t)width * height * 4) });
+    while(width > 1 || height > 1) {
+        const TextureLevel& source = levels.back();
+        int w = std::max(1, width / 2), h = std::max(1, height / 2);
+        TextureLevel level = { w, h, std::vector<unsigned char>((std::size_t)w * h * 4) };
+        for(int y = 0; y < h; y++) {
+            int y0 = std::min(y * 2, height - 1), y1 = std::min(y * 2 + 1, height - 1);
+            for(int x = 0; x < w; x++) {
+                int x0 = std::min(x * 2, width - 1), x1 = std::min(x * 2 + 1, width - 1);
+                for(int k = 0; k < 4; k++) {
+                    int sum = source.data[((std::size_t)y0 * width + x0) * 4 + k] + source.data[((std::size_t)y0 * width + x1) * 4 + k]
+                            + source.data[((std::size_t)y1 * width + x0) * 4 + k] + source.data[((std::size_t)y1 * width + x1) * 4 + k];
+                    level.data[((std::size_t)y * w + x) * 4 + k] = (unsigned char)((sum + 2) / 4);
+                }
+            }
+        }
+        levels.push_back(std::move(level));
+        width = w;
+        height = h;
+    }
+}
+
+void compressBC1Block(const unsigned char rgba[64], unsigned char block[8])
+{
+    float mean[3] = {};
+    for(int i = 0; i < 16; i++)
+        for(int k = 0; k < 3; k++)
+            mean[k] += rgba[i * 4 + k] / 16.0f;
+
+    float covariance[6] = {};
+    for(int i = 0; i < 16; i++) {
+        float d[3] = { rgba[i * 4] - mean[0], rgba[i * 4 + 1] - mean[1], rgba[i * 4 + 2] - mean[2] };
+        covariance[0] += d[0] * d[0];
+        covariance[1] += d[0] * d[1];
+        covariance[2] += d[0] * d[2];
+        covariance[3] += d[1] * d[1];
+        covariance[4] += d[1] * d[2];
+        covariance[5] += d[2] * d[2];
+    }
+
+    // power iteration for the principal axis
+    float axis[3] = { 1, 1, 1 };
+    for(int iteration = 0; iteration < 8; iteration++) {
+        float next[3] = {
+            covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2],
+            covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2],
+            covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2],
+        };
+        float length = std::max(std::max(std::fabs(next[0]), std::fabs(next[1])), std::fabs(next[2]));
+        if(length < 1e-6f)
+            break;
+        for(int k = 0; k < 3; k++)
+            axis[k] = next[k] / length;
+    }
+
+    float minProjection = 0, maxProjection = 0;
+    for(int i = 0; i < 16; i++) {
+        float projection = 0;
+        for(int k = 0; k < 3; k++)
+            projection += (rgba[i * 4 + k] - mean[k]) * axis[k];
+        minProjection = std::min(minProjection, projection);
+        maxProjection = std::max(maxProjection, projection);
+    }
+    float axisLength = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+    float high[3], low[3];
+    for(int k = 0; k < 3; k++) {
+        high[k] = mean[k] + axis[k] * maxProjection / axisLength;
+        low[k] = mean[k] + axis[k] * minProjection / axisLength;
+    }
+
+    std::uint16_t color0 = packRgb565(high), color1 = packRgb565(low);
+    if(!orderEndpoints(color0, color1)) {
+        writeBC1(block, color0, color1, 0);
+        return;
+    }
+    std::uint32_t indices;
+    int error = assignBC1Indices(rgba, color0, color1, indices);
+
+    // least squares endpoints for the chosen indices, texel = w * c0 + (1 - w) * c1
+    static const float weights[4] = { 1, 0, 2 / 3.0f, 1 / 3.0f };
+    float aa = 0, bb = 0, ab = 0, ax[3] = {}, bx[3] = {};
+    for(int i = 0; i < 16; i++) {
+        float w = weights[indices >> (i * 2) & 3];
+        aa += w * w;
+        bb += (1 - w) * (1 - w);
+        ab += w * (1 - w);
+        for(int k = 0; k < 3; k++) {
+            ax[k] += w * rgba[i * 4 + k];
+            bx[k] += (1 - w) * rgba[i * 4 + k];
+        }
+    }
+    float determinant = aa * bb - ab * ab;
+    if(std::fabs(determinant) > 1e-6f) {
+        for(int k = 0; k < 3; k++) {
+            high[k] = (ax[k] * bb - bx[k] * ab) / determinant;
+            low[k] = (bx[k] * aa - ax[k] * ab) / determinant;
+        }
+        std::uint16_t refined0 = packRgb565(high), refined1 = packRgb565(low);
+        if(orderEndpoints(refined0, refined1)) {
+            std::uint32_t refinedIndices;
+            int refinedError = assignBC1Indices(rgba, refined0, refined1, refinedIndices);
+            if(refinedError < error) {
+                color0 = refined0;
+                color1 = refined1;
+                indices = refinedIndices;
+            }
+        }
+    }
+    writeBC1(block, color0, color1, indices);
+}
+
+void compressBC3Block(const unsigned char rgba[64], unsigned char block[16])
+{
+    int alpha0 = 0, alpha1 = 255;
+    for(int i = 0; i < 16; i++) {
+        alpha0 = std::max(alpha0, (int)rgba[i * 4 + 3]);
+        alpha1 = std::min(alpha1, (int)rgba[i * 4 + 3]);
+    }
+
+    // alpha0 > alpha1 selects six interpolated values between them
+    std::uint64_t indices = 0;
+    if(alpha0 > alpha1) {
+        int palette[8] = { alpha0, alpha1 };
+        for(int p = 1; p < 7; p++)
+            palette[p + 1] = ((7 - p) * alpha0 + p * alpha1) / 7;
+        for(int i = 0; i < 16; i++) {
+            int best = 0, bestDistance = INT32_MAX;
+            for(int p = 0; p < 8; p++) {
+                int distance = std::abs(rgba[i * 4 + 3] - palette[p]);
+                if(distance < bestDistance) {
+                    bestDistance = distance;
+                    best = p;
+                }
+            }
+            indices |= (std::uint64_t)best << (i * 3);
+        }
+    }
+    block[0] = (unsigned char)alpha0;
+    block[1] = (unsigned char)alpha1;
+    for(int i = 0; i < 6; i++)
+        block[2 + i] = (unsigned char)(indices >> (i * 8));
+    compressBC1Block(rgba, block + 8);
+}
+
+void decompressBC1Block(const unsigned char block[8], unsigned char rgba[64])
+{
+    std::uint16_t color0, color1;
+    std::uint32_t indices;
+    memcpy(&color0, block, 2);
+    memcpy(&color1, block + 2, 2);
+    memcpy(&indices, block + 4, 4);
+    int palette[4][3];
+    bc1Palette(color0, color1, palette);
+    if(color0 <= color1) {
+        // three color mode, which the compressor doesn't write
+        for(int k = 0; k < 3; k++) {
+            palette[2][k] = (palette[0][k] + palette[1][k]) / 2;
+            palette[3][k] = 0;
+        }
+    }
+    for(int i = 0; i < 16; i++) {
+        int p = indices >> (i * 2) & 3;
+        for(int k = 0; k < 3; k++)
+            rgba[i * 4 + k] = (unsigned char)palette[p][k];
+        rgba[i * 4 + 3] = 255;
+    }
+}
+
+void decompressBC3Block(const unsigned char block[16], unsigned char rgba[64])
+{
+    // the color half of BC3 is always in four color mode
+    std::uint16_t color0, color1;
+    std::uint32_t colorIndices;
+    memcpy(&color0, block + 8, 2);
+    memcpy(&color1, block + 10, 2);
+    memcpy(&colorIndices, block + 12, 4);
+    int colors[4][3];
+    bc1Palette(color0, color1, colors);
+
+    int alpha0 = block[0], alpha1 = block[1];
+    int alphas[8] = { alpha0, alpha1 };
+    if(alpha0 > alpha1) {
+        for(int p = 1; p < 7; p++)
+            alphas[p + 1] = ((7 - p) * alpha0 + p * alpha1) / 7;
+    } else {
+        for(int p = 1; p < 5; p++)
+            alphas[p + 1] = ((5 - p) * alpha0 + p * alpha1) / 5;
+        alphas[6] = 0;
+        alphas[7] = 255;
+    }
+    std::uint64_t alphaIndices = 0;
+    for(int i = 0; i < 6; i++)
+        alphaIndices |= (std::uint64_t)block[2 + i] << (i * 8);
+
+    for(int i = 0; i < 16; i++) {
+        int p = colorIndices >> (i * 2) & 3;
+        for(int k = 0; k < 3; k++)
+            rgba[i * 4 + k] = (unsigned char)colors[p][k];
+        rgba[i * 4 + 3] = (unsigned char)alphas[alphaIndices >> (i * 3) & 7];
+    }
+}
+
+void compressLevel(const TextureLevel& rgba, TextureFormat format, TextureLevel& compressed)
+{
+    compressed.width = rgba.width;
+    compressed.height = rgba.height;
+    if(format == TEXTURE_RGBA8) {
+        compressed.data = rgba.data;
+        return;
+    }
+
+    compressed.data.resize(textureLevelSize(format, rgba.width, rgba.height));
+    int blocksX = (rgba.width + 3) / 4, blocksY = (rgba.height + 3) / 4;
+    unsigned char* block = compressed.data.data();
+    for(int by = 0; by < blocksY; by++) {
+        for(int bx = 0; bx < blocksX; bx++) {
+            // partial blocks repeat the edge texels
+            unsigned char texels[64];
+            for(int i = 0; i < 16; i++) {
+                int x = std::min(bx * 4 + i % 4, rgba.width - 1);
+                int y = std::min(by * 4 + i / 4, rgba.height - 1);
+                memcpy(&texels[i * 4], &rgba.data[((std::size_t)y * rgba.width + x) * 4], 4);
+            }
+            if(format == TEXTURE_BC1)
+                compressBC1Block(texels, block);
+            else
+                compressBC3Block(texels, block);
+            block += blockSize(format);
+        }
+    }
+}
+
+void decompressLevel(const TextureLevel& compressed, TextureFormat format, TextureLevel& rgba)
+{
+    rgba.width = compressed.width;
+    rgba.height = compressed.height;
+    if(format == TEXTURE_RGBA8) {
+        rgba.data = compressed.data;
+        return;
+    }
+
+    rgba.data.resize((std::size_t)rgba.width * rgba.height * 4);
+    int blocksX = (rgba.width + 3) / 4, blocksY = (rgba.height + 3) / 4;
+    const unsigned char* block = compressed.data.data();
+    for(int by = 0; by < blocksY; by++) {
+        for(int bx = 0; bx < blocksX; bx++) {
+            unsigned char texels[64];
+            if(format == TEXTURE_BC1)
+                decompressBC1Block(block, texels);
+            else
+                decompressBC3Block(block, texels);
+            block += blockSize(format);
+            for(int i = 0; i < 16; i++) {
+                int x = bx * 4 + i % 4, y = by * 4 + i / 4;
+                if(x < rgba.width && y < rgba.height)
+                    memcpy(&rgba.data[((std::size_t)y * rgba.width + x) * 4], &texels[i * 4], 4);
+            }
+        }
+    }
+}
+
+bool writeDds(const char* fileName, const TextureData& data)
+{
+    if(data.levels.empty())
+        return false;
+    const TextureLevel& top = data.levels[0];
+
+    DdsHeader header = {};
+    header.size = sizeof(DdsHeader);
+    header.flags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_MIPMAPCOUNT;
+    header.height = top.height;
+    header.width = top.width;
+    header.mipMapCount = data.levels.size();
+    header.pixelFormat.size = sizeof(DdsPixelFormat);
+    header.caps = DDSCAPS_TEXTURE;
+    if(data.levels.size() > 1)
+        header.caps |= DDSCAPS_COMPLEX | DDSCAPS_MIPMAP;
+    if(data.format == TEXTURE_RGBA8) {
+        header.flags |= DDSD_PITCH;
+        header.pitchOrLinearSize = top.width * 4;
+        header.pixelFormat.flags = DDPF_RGB | DDPF_ALPHAPIXELS;
+        header.pixelFormat.rgbBitCount = 32;
+        header.pixelFormat.rBitMask = 0x000000FF;
+        header.pixelFormat.gBitMask = 0x0000FF00;
+        header.pixelFormat.bBitMask = 0x00FF0000;
+        header.pixelFormat.aBitMask = 0xFF000000;
+    } else {
+        header.flags |= DDSD_LINEARSIZE;
+        header.pitchOrLinearSize = top.data.size();
+        header.pixelFormat.flags = DDPF_FOURCC;
+        header.pixelFormat.fourCC = data.format == TEXTURE_BC1 ? fourCC('D', 'X', 'T', '1') : fourCC('D', 'X', 'T', '5');
+    }
+
+    FILE* file = fopen(fileName, "wb");
+    if(!file) {
+        std::cout << "Error: Unable to write " << fileName << std::endl;
+        return false;
+    }
+    fwrite(DDS_MAGIC, sizeof(DDS_MAGIC), 1, file);
+    fwrite(&header, sizeof(header), 1, file);
+    for(const TextureLevel& level : data.levels)
+        fwrite(level.data.data(), 1, level.data.size(), file);
+    bool success = !ferror(file);
+    fclose(file);
+    return success;
+}
+
+bool MappedDds::open(const char* fileName)
+{
+    if(!file.open(fileName))
+        return false;
+    return validate(fileName);
+}
+
+bool MappedDds::open(const char* fileName, const unsigned char* data, std::size_t size)
+{
+    file.view(data, size);
+    return validate(fileName);
+}
+
+bool MappedDds::validate(const char* fileName)
+{
+    bool valid = file.size() >= sizeof(DDS_MAGIC) + sizeof(DdsHeader) &&
+        memcmp(file.data(), DDS_MAGIC, sizeof(DDS_MAGIC)) == 0 &&
+        header().size == sizeof(DdsHeader) && header().width > 0 && header().height > 0;
+    if(valid) {
+        const DdsPixelFormat& pixelFormat = header().pixelFormat;
+        if(pixelFormat.flags & DDPF_FOURCC) {
+            if(pixelFormat.fourCC == fourCC('D', 'X', 'T', '1'))
+                textureFormat = TEXTURE_BC1;
+            else if(pixelFormat.fourCC == fourCC('D', 'X', 'T', '5'))
+                textureFormat = TEXTURE_BC3;
+            else
+                valid = false;
+        } else {
+            textureFormat = TEXTURE_RGBA8;
+            valid = (pixelFormat.flags & DDPF_RGB) && pixelFormat.rgbBitCount == 32 &&
+                pixelFormat.rBitMask == 0x000000FF && pixelFormat.gBitMask == 0x0000FF00 &&
+                pixelFormat.bBitMask == 0x00FF0000;
+        }
+    }
+    if(valid) {
+        mipLevels = (header().flags & DDSD_MIPMAPCOUNT) ? std::max(1u, header().mipMapCount) : 1;
+        std::size_t size = 0;
+        for(int i = 0; i < mipLevels; i++)
+            size += textureLevelSize(textureFormat, std::max(1, width() >> i), std::max(1, height() >> i));
+        valid = size <= levelsSize();
+    }
+    if(!valid) {
+        std::cout << "Error: " << fileName << " is not an RGBA8, BC1 or BC3 .dds" << std::endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+void MappedDds::close()
+{
+    file.close();
+    mipLevels = 0;
+}
@@ -0,0 +1,142 @@
+#ifndef arptex_h
+#define arptex_h
+
+#include "arpmesh.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Baked textures are DDS files holding a full mip chain, so loading one is
+ * a memory mapping and an upload with no decoding or mipmap generation. The
+ * file is laid out as
+ *
+ *   "DDS "
+ *   DdsHeader
+ *   level 0, level 1, ... down to 1x1, tightly packed
+ *
+ * Block compressed levels store 4x4 blocks in rows, partial blocks at the
+ * right and bottom edges are padded. Rows are in the order stb_image decodes
+ * them, like the textures renderobject uploads from PNGs.
+ */
+
+enum TextureFormat {
+    // uncompressed, 4 bytes per texel in R, G, B, A order
+    TEXTURE_RGBA8,
+    // 8 bytes per 4x4 block, opaque
+    TEXTURE_BC1,
+    // 16 bytes per 4x4 block, BC1 color with interpolated alpha
+    TEXTURE_BC3,
+};
+
+struct DdsPixelFormat {
+    std::uint32_t size;
+    std::uint32_t flags;
+    std::uint32_t fourCC;
+    std::uint32_t rgbBitCount;
+    std::uint32_t rBitMask;
+    std::uint32_t gBitMask;
+    std::uint32_t bBitMask;
+    std::uint32_t aBitMask;
+};
+
+struct DdsHeader {
+    std::uint32_t size;
+    std::uint32_t flags;
+    std::uint32_t height;
+    std::uint32_t width;
+    std::uint32_t pitchOrLinearSize;
+    std::uint32_t depth;
+    std::uint32_t mipMapCount;
+    std::uint32_t reserved1[11];
+    DdsPixelFormat pixelFormat;
+    std::uint32_t caps;
+    std::uint32_t caps2;
+    std::uint32_t caps3;
+    std::uint32_t caps4;
+    std::uint32_t reserved2;
+};
+
+/**
+ * One level of a texture in the given format
+ */
+struct TextureLevel {
+    int width;
+    int height;
+    std::vector<unsigned char> data;
+};
+
+struct TextureData {
+    TextureFormat format = TEXTURE_RGBA8;
+    std::vector<TextureLevel> levels;
+};
+
+/**
+ * Size in bytes of a level in the given format
+ */
+std::size_t textureLevelSize(TextureFormat format, int width, int height);
+
+/**
+ * Builds RGBA8 levels from the image down to 1x1 with a box filter. Odd
+ * sizes repeat their last row or column
+ */
+void buildMipChain(const unsigned char* rgba, int width, int height, std::vector<TextureLevel>& levels);
+
+/**
+ * Compresses 16 RGBA8 texels in row order into a block. The endpoints are
+ * fit to the principal axis of the colors and refined by least squares
+ */
+void compressBC1Block(const unsigned char rgba[64], unsigned char block[8]);
+void compressBC3Block(const unsigned char rgba[64], unsigned char block[16]);
+
+void decompressBC1Block(const unsigned char block[8], unsigned char rgba[64]);
+void decompressBC3Block(const unsigned char block[16], unsigned char rgba[64]);
+
+/**
+ * Converts an RGBA8 level to format, or back to RGBA8 from it
+ */
+void compressLevel(const TextureLevel& rgba, TextureFormat format, TextureLevel& compressed);
+void decompressLevel(const TextureLevel& compressed, TextureFormat format, TextureLevel& rgba);
+
+/**
+ * Writes data as a DDS file. Returns false if the file can't be written
+ */
+bool writeDds(const char* fileName, const TextureData& data);
+
+/**
+ * Read-only memory mapping of a DDS in one of the TextureFormats. The
+ * pointers stay valid until the mapping is closed or destroyed
+ */
+class MappedDds {
+private:
+    MappedFile file;
+    TextureFormat textureFormat = TEXTURE_RGBA8;
+    int mipLevels = 0;
+
+    bool validate(const char* fileName);
+
+public:
+    /**
+     * Maps the file and validates its header. Returns false and prints an
+     * error if the file can't be used
+     */
+    bool open(const char* fileName);
+    /**
+     * Validates a .dds already in memory, named fileName in errors. The
+     * memory must outlive the mapping
+     */
+    bool open(const char* fileName, const unsigned char* data, std::size_t size);
+    void close();
+
+    const DdsHeader& header() const { return *(const DdsHeader*)(file.data() + 4); }
+    TextureFormat format() const { return textureFormat; }
+    int width() const { return header().width; }
+    int height() const { return header().height; }
+    int levelCount() const { return mipLevels; }
+    // every level, starting with level 0
+    const unsigned char* levels() const { return file.data() + 4 + sizeof(DdsHeader); }
+    std::size_t levelsSize() const { return file.size() - 4 - sizeof(DdsHeader); }
+};
+
+#endif /* arptex_h */
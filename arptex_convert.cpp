@@ -0,0 +1,110 @@
+/**
+ * Bakes images into .dds files with a full mip chain next to them. Images
+ * with transparent texels become BC3, others BC1, unless --format says
+ * otherwise. Images less than a block high or wide, like the demo's palette
+ * strips, stay RGBA8: padding their blocks would grow them
+ *
+ * Usage: arptex_convert [--format bc1|bc3|rgba8] <image.png>...
+ */
+
+#include "arptex.h"
+#include "stb_image.h"
+
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/**
+ * Peak signal to noise ratio of b against a in dB, higher is better
+ */
+static double psnr(const TextureLevel& a, const TextureLevel& b) {
+    double error = 0;
+    for(std::size_t i = 0; i < a.data.size(); i++) {
+        double d = (double)a.data[i] - b.data[i];
+        error += d * d;
+    }
+    if(error == 0)
+        return INFINITY;
+    return 10 * std::log10(255.0 * 255.0 * a.data.size() / error);
+}
+
+int main(int argc, char *argv[]) {
+    const char* usage = "Usage: arptex_convert [--format bc1|bc3|rgba8] <image.png>...";
+    bool forceFormat = false;
+    TextureFormat forcedFormat = TEXTURE_BC1;
+    std::vector<std::string> inputs;
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(arg == "--format" && i + 1 < argc) {
+            std::string name = argv[++i];
+            forceFormat = true;
+            if(name == "bc1")
+                forcedFormat = TEXTURE_BC1;
+            else if(name == "bc3")
+                forcedFormat = TEXTURE_BC3;
+            else if(name == "rgba8")
+                forcedFormat = TEXTURE_RGBA8;
+            else {
+                std::cout << usage << std::endl;
+                return -1;
+            }
+        } else {
+            inputs.push_back(arg);
+        }
+    }
+    if(inputs.empty()) {
+        std::cout << usage << std::endl;
+        return -1;
+    }
+
+    static const char* formatNames[] = { "RGBA8", "BC1", "BC3" };
+    int failures = 0;
+    for(const std::string& input : inputs) {
+        std::string output = input.substr(0, input.find_last_of('.')) + ".dds";
+
+        int width, height, channels;
+        unsigned char* pixels = stbi_load(input.c_str(), &width, &height, &channels, 4);
+        if(!pixels) {
+            std::cout << "Error: Unable to load " << input << ": " << stbi_failure_reason() << std::endl;
+            failures++;
+            continue;
+        }
+
+        TextureData data;
+        data.format = forcedFormat;
+        if(!forceFormat && (width < 4 || height < 4)) {
+            data.format = TEXTURE_RGBA8;
+        } else if(!forceFormat) {
+            data.format = TEXTURE_BC1;
+            for(std::size_t i = 0; i < (std::size_t)width * height; i++) {
+                if(pixels[i * 4 + 3] != 255)
+                    data.format = TEXTURE_BC3;
+            }
+        }
+
+        std::vector<TextureLevel> mips;
+        buildMipChain(pixels, width, height, mips);
+        stbi_image_free(pixels);
+        data.levels.resize(mips.size());
+        for(std::size_t i = 0; i < mips.size(); i++)
+            compressLevel(mips[i], data.format, data.levels[i]);
+
+        if(!writeDds(output.c_str(), data)) {
+            failures++;
+            continue;
+        }
+
+        TextureLevel decoded;
+        decompressLevel(data.levels[0], data.format, decoded);
+        std::size_t size = 0, uncompressed = 0;
+        for(std::size_t i = 0; i < mips.size(); i++) {
+            size += data.levels[i].data.size();
+            uncompressed += mips[i].data.size();
+        }
+        std::cout << output << ": " << formatNames[data.format] << ", " << data.levels.size() << " levels, "
+                  << size << " bytes (" << uncompressed / (double)size << "x smaller), "
+                  << psnr(mips[0], decoded) << " dB" << std::endl;
+    }
+    return failures == 0 ? 0 : 1;
+}
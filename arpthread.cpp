@@ -0,0 +1,80 @@
+#include "arpthread.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <avrt.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#if defined(__linux__)
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#endif
+
+namespace arp {
+
+#if defined(_WIN32)
+
+ThreadPriority setCurrentThreadPriority(ThreadPriority priority) {
+    if(priority == PRIORITY_TIME_CRITICAL) {
+        // MMCSS boosts the thread above normal time-critical threads without
+        // needing administrator rights
+        DWORD taskIndex = 0;
+        HANDLE task = AvSetMmThreadCharacteristicsW(L"Games", &taskIndex);
+        if(task && AvSetMmThreadPriority(task, AVRT_PRIORITY_CRITICAL)
+           && SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL))
+            return PRIORITY_TIME_CRITICAL;
+        if(task)
+            AvRevertMmThreadCharacteristics(task);
+    }
+    if(priority >= PRIORITY_HIGH && SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST))
+        return PRIORITY_HIGH;
+    return PRIORITY_DEFAULT;
+}
+
+bool pinCurrentThread(int core) {
+    if(core < 0 || core >= (int)(sizeof(DWORD_PTR) * 8))
+        return false;
+    return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << core) != 0;
+}
+
+#else
+
+ThreadPriority setCurrentThreadPriority(ThreadPriority priority) {
+    if(priority == PRIORITY_TIME_CRITICAL) {
+        // halfway up the FIFO range, leaving the top to audio and the kernel
+        sched_param param = {};
+        int lowest = sched_get_priority_min(SCHED_FIFO);
+        param.sched_priority = lowest + (sched_get_priority_max(SCHED_FIFO) - lowest) / 2;
+        if(pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0)
+            return PRIORITY_TIME_CRITICAL;
+    }
+#if defined(__linux__)
+    // Linux threads have their own nice value
+    if(priority >= PRIORITY_HIGH && setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), -10) == 0)
+        return PRIORITY_HIGH;
+#endif
+    return PRIORITY_DEFAULT;
+}
+
+bool pinCurrentThread(int core) {
+#if defined(__linux__)
+    if(core < 0 || core >= CPU_SETSIZE)
+        return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    // macOS only takes affinity hints, which don't pin anything
+    return false;
+#endif
+}
+
+#endif
+
+};
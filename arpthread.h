@@ -0,0 +1,22 @@
+#ifndef ARPTHREAD_H
+#define ARPTHREAD_H
+
+#include "arp.h"
+
+namespace arp {
+
+/**
+ * Raises the calling thread to priority, falling back to lower priorities
+ * the platform allows. Returns the priority the thread ended up with
+ */
+ThreadPriority setCurrentThreadPriority(ThreadPriority priority);
+
+/**
+ * Restricts the calling thread to one logical core. Returns false if the
+ * platform can't pin threads or the core doesn't exist
+ */
+bool pinCurrentThread(int core);
+
+};
+
+#endif // ARPTHREAD_H
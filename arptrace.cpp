@@ -0,0 +1,394 @@
+#include "arptrace.h"
+#include "arpring.h"
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+namespace arp {
+
+#ifdef ARP_TRACE
+
+/**
+ * A finished scope. Times are glfwGetTime() seconds, GPU events are
+ * converted from the GPU clock
+ */
+struct TraceEvent {
+    const char* name;
+    int index;
+    bool gpu;
+    double begin;
+    double end;
+};
+
+static const int TRACE_EVENTS = 4096;
+static const int MAX_TRACE_THREADS = 16;
+// GPU scopes of a thread that can wait for their queries at once, newer
+// ones are not timed on the GPU while all are taken
+static const int GPU_SLOTS = 64;
+// how often the offset between the GPU clock and glfwGetTime() is measured
+static const double GPU_CLOCK_RESYNC = 1.0;
+
+enum GpuSlotState {
+    GPU_SLOT_FREE,
+    GPU_SLOT_OPEN,
+    GPU_SLOT_ENDED,
+};
+
+/**
+ * Events recorded by one thread, the newest TRACE_EVENTS of them. Everything
+ * but events and name is only touched by the thread itself
+ */
+struct ThreadTrace {
+    HistoryRing<TraceEvent, TRACE_EVENTS> events;
+    std::atomic<const char*> name{nullptr};
+
+    // context the queries belong to, GPU scopes in other contexts aren't
+    // timed on the GPU
+    GLFWwindow* context = nullptr;
+    GLuint queries[GPU_SLOTS][2];
+    GpuSlotState slotStates[GPU_SLOTS];
+    const char* slotNames[GPU_SLOTS];
+    int slotIndices[GPU_SLOTS];
+    // slots are taken in order and resolved oldest first
+    int oldestSlot = 0;
+    int nextSlot = 0;
+    int slotsInUse = 0;
+    // glfwGetTime() minus the GPU clock, in seconds
+    double gpuClockOffset = 0;
+    double gpuClockSynced = -GPU_CLOCK_RESYNC;
+};
+
+static ThreadTrace traceThreads[MAX_TRACE_THREADS];
+static std::atomic<int> traceThreadCount{0};
+static thread_local ThreadTrace* currentTrace = nullptr;
+static thread_local bool traceUnavailable = false;
+
+/**
+ * Returns the calling thread's trace, claiming one on first use. Returns
+ * nullptr once MAX_TRACE_THREADS threads have one
+ */
+static ThreadTrace* threadTrace() {
+    if(currentTrace || traceUnavailable)
+        return currentTrace;
+    int i = traceThreadCount.fetch_add(1, std::memory_order_acq_rel);
+    if(i >= MAX_TRACE_THREADS) {
+        traceUnavailable = true;
+        return nullptr;
+    }
+    currentTrace = &traceThreads[i];
+    return currentTrace;
+}
+
+static void syncGpuClock(ThreadTrace& trace, double now) {
+    GLint64 gpuTime = 0;
+    glGetInteger64v(GL_TIMESTAMP, &gpuTime);
+    trace.gpuClockOffset = now - gpuTime * 1e-9;
+    trace.gpuClockSynced = now;
+}
+
+/**
+ * Moves the GPU scopes whose queries have results into the event ring,
+ * oldest first, stopping at one that is still open or in flight
+ */
+static void resolveGpuScopes(ThreadTrace& trace) {
+    while(trace.slotsInUse > 0) {
+        int slot = trace.oldestSlot;
+        if(trace.slotStates[slot] != GPU_SLOT_ENDED)
+            return;
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv(trace.queries[slot][1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if(!available)
+            return;
+
+        GLuint64 begin = 0, end = 0;
+        glGetQueryObjectui64v(trace.queries[slot][0], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(trace.queries[slot][1], GL_QUERY_RESULT, &end);
+        trace.events.push({ trace.slotNames[slot], trace.slotIndices[slot], true,
+                            begin * 1e-9 + trace.gpuClockOffset, end * 1e-9 + trace.gpuClockOffset });
+        trace.slotStates[slot] = GPU_SLOT_FREE;
+        trace.oldestSlot = (slot + 1) % GPU_SLOTS;
+        trace.slotsInUse--;
+    }
+}
+
+TraceScope::TraceScope(const char* name, bool gpu, int index)
+  : name(name),
+    index(index),
+    gpuSlot(-1)
+{
+    begin = glfwGetTime();
+    ThreadTrace* trace = threadTrace();
+    if(!gpu || !trace || !(GLEW_VERSION_3_3 || GLEW_ARB_timer_query))
+        return;
+
+    GLFWwindow* context = glfwGetCurrentContext();
+    if(!context)
+        return;
+    if(!trace->context) {
+        trace->context = context;
+        glGenQueries(GPU_SLOTS * 2, &trace->queries[0][0]);
+        std::fill(trace->slotStates, trace->slotStates + GPU_SLOTS, GPU_SLOT_FREE);
+    }
+    if(context != trace->context || trace->slotsInUse == GPU_SLOTS)
+        return;
+    if(begin - trace->gpuClockSynced >= GPU_CLOCK_RESYNC)
+        syncGpuClock(*trace, begin);
+
+    gpuSlot = trace->nextSlot;
+    trace->nextSlot = (gpuSlot + 1) % GPU_SLOTS;
+    trace->slotsInUse++;
+    trace->slotStates[gpuSlot] = GPU_SLOT_OPEN;
+    trace->slotNames[gpuSlot] = name;
+    trace->slotIndices[gpuSlot] = index;
+    glQueryCounter(trace->queries[gpuSlot][0], GL_TIMESTAMP);
+}
+
+TraceScope::~TraceScope() {
+    double end = glfwGetTime();
+    ThreadTrace* trace = threadTrace();
+    if(!trace)
+        return;
+    trace->events.push({ name, index, false, begin, end });
+    if(gpuSlot < 0)
+        return;
+
+    glQueryCounter(trace->queries[gpuSlot][1], GL_TIMESTAMP);
+    trace->slotStates[gpuSlot] = GPU_SLOT_ENDED;
+    resolveGpuScopes(*trace);
+}
+
+void setTraceThreadName(const char* name) {
+    ThreadTrace* trace = threadTrace();
+    if(trace)
+        trace->name.store(name, std::memory_order_release);
+}
+
+/**
+ * Records a resolved GpuZone on the calling thread's GPU track
+ */
+static void traceGpuZone(const char* name, double begin, double end) {
+    ThreadTrace* trace = threadTrace();
+    if(trace)
+        trace->events.push({ name, -1, true, begin, end });
+}
+
+/**
+ * Chrome trace metadata event naming a track
+ */
+static void writeThreadName(std::ostream& out, int tid, const char* prefix, const char* name, int index) {
+    out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid << ",\"args\":{\"name\":\"" << prefix;
+    if(name)
+        out << name;
+    else
+        out << "thread " << index;
+    out << "\"}},\n";
+}
+
+bool writeTrace(const char* path) {
+    std::ofstream out(path);
+    if(!out) {
+        std::cout << "Error: could not write trace " << path << std::endl;
+        return false;
+    }
+
+    // every thread's CPU events get a track, and its GPU events the one
+    // after it
+    std::vector<TraceEvent> events(TRACE_EVENTS);
+    int threads = std::min(traceThreadCount.load(std::memory_order_acquire), MAX_TRACE_THREADS);
+    out << "{\"traceEvents\":[\n" << std::fixed << std::setprecision(3);
+    for(int t = 0; t < threads; t++) {
+        const ThreadTrace& trace = traceThreads[t];
+        const char* name = trace.name.load(std::memory_order_acquire);
+        int cpuTid = 2 * t + 1;
+        int gpuTid = 2 * t + 2;
+        writeThreadName(out, cpuTid, "", name, t);
+        writeThreadName(out, gpuTid, "GPU ", name, t);
+
+        int count = trace.events.snapshot(events.data(), TRACE_EVENTS);
+        for(int i = 0; i < count; i++) {
+            const TraceEvent& event = events[i];
+            out << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+                << (event.gpu ? gpuTid : cpuTid) << ",\"ts\":" << event.begin * 1e6
+                << ",\"dur\":" << std::max(event.end - event.begin, 0.0) * 1e6;
+            if(event.index >= 0)
+                out << ",\"args\":{\"index\":" << event.index << "}";
+            out << "},\n";
+        }
+    }
+    // the trailing comma above needs an element after it
+    out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"ARP\"}}\n";
+    out << "],\"displayTimeUnit\":\"ms\"}\n";
+    return (bool)out;
+}
+
+#else
+
+bool writeTrace(const char* path) {
+    std::cout << "Error: ARP was built without tracing, not writing " << path << std::endl;
+    return false;
+}
+
+#endif
+
+// GpuZones of a thread that can wait for their queries at once, newer ones
+// are not timed while all are taken
+static const int GPU_ZONE_SLOTS = 64;
+// most zone names getGpuZoneTimings keeps times for
+static const int MAX_GPU_ZONES = 32;
+// weight of each frame in a zone's mean
+static const double GPU_ZONE_SMOOTHING = 0.1;
+// how often a pool measures the offset between the GPU clock and
+// glfwGetTime(), for the trace
+static const double GPU_ZONE_CLOCK_RESYNC = 1.0;
+
+/**
+ * Timestamp queries of one thread's GpuZones, taken in order and resolved
+ * oldest first. Only touched by the thread itself
+ */
+struct GpuZonePool {
+    GLFWwindow* context = nullptr;
+    GLuint queries[GPU_ZONE_SLOTS][2];
+    bool ended[GPU_ZONE_SLOTS];
+    const char* names[GPU_ZONE_SLOTS];
+    std::uint64_t frames[GPU_ZONE_SLOTS];
+    int oldestSlot = 0;
+    int nextSlot = 0;
+    int slotsInUse = 0;
+    // glfwGetTime() minus the GPU clock, in seconds
+    double gpuClockOffset = 0;
+    double gpuClockSynced = -GPU_ZONE_CLOCK_RESYNC;
+};
+
+/**
+ * Times of one zone name. frameTime sums the zones of frame, the newest
+ * frame with results, and is moved into lastFrame when a newer one's come in
+ */
+struct GpuZoneStats {
+    const char* name;
+    std::uint64_t frame = 0;
+    double frameTime = 0;
+    double lastFrame = 0;
+    double mean = -1;
+};
+
+static thread_local GpuZonePool gpuZonePool;
+static std::mutex gpuZoneMutex;
+static GpuZoneStats gpuZoneStats[MAX_GPU_ZONES];
+static int gpuZoneCount = 0;
+// app frame new zones count toward, from 1
+static std::atomic<std::uint64_t> gpuZoneFrame{1};
+
+static void addGpuZoneTime(const char* name, std::uint64_t frame, double seconds) {
+    std::lock_guard<std::mutex> lock(gpuZoneMutex);
+    GpuZoneStats* stats = std::find_if(gpuZoneStats, gpuZoneStats + gpuZoneCount,
+                                       [name](const GpuZoneStats& zone) { return zone.name == name; });
+    if(stats == gpuZoneStats + gpuZoneCount) {
+        if(gpuZoneCount == MAX_GPU_ZONES)
+            return;
+        gpuZoneStats[gpuZoneCount++].name = name;
+    }
+    if(frame > stats->frame) {
+        if(stats->frame) {
+            stats->lastFrame = stats->frameTime;
+            stats->mean = stats->mean < 0 ? stats->frameTime
+                                          : stats->mean + (stats->frameTime - stats->mean) * GPU_ZONE_SMOOTHING;
+        }
+        stats->frame = frame;
+        stats->frameTime = 0;
+    }
+    if(frame == stats->frame)
+        stats->frameTime += seconds;
+}
+
+/**
+ * Hands the zones whose queries have results to the stats and the trace,
+ * oldest first, stopping at one that is still open or in flight
+ */
+static void resolveGpuZones(GpuZonePool& pool) {
+    while(pool.slotsInUse > 0) {
+        int slot = pool.oldestSlot;
+        if(!pool.ended[slot])
+            return;
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv(pool.queries[slot][1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if(!available)
+            return;
+
+        GLuint64 begin = 0, end = 0;
+        glGetQueryObjectui64v(pool.queries[slot][0], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(pool.queries[slot][1], GL_QUERY_RESULT, &end);
+        addGpuZoneTime(pool.names[slot], pool.frames[slot], end > begin ? (end - begin) * 1e-9 : 0);
+        #ifdef ARP_TRACE
+        traceGpuZone(pool.names[slot], begin * 1e-9 + pool.gpuClockOffset, end * 1e-9 + pool.gpuClockOffset);
+        #endif
+        pool.oldestSlot = (slot + 1) % GPU_ZONE_SLOTS;
+        pool.slotsInUse--;
+    }
+}
+
+GpuZone::GpuZone(const char* name)
+  : slot(-1),
+    debugGroup(GLEW_KHR_debug)
+{
+    if(debugGroup)
+        glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0, -1, name);
+    GLFWwindow* context = glfwGetCurrentContext();
+    if(!context || !(GLEW_VERSION_3_3 || GLEW_ARB_timer_query))
+        return;
+
+    GpuZonePool& pool = gpuZonePool;
+    if(!pool.context) {
+        pool.context = context;
+        glGenQueries(GPU_ZONE_SLOTS * 2, &pool.queries[0][0]);
+    }
+    if(context != pool.context || pool.slotsInUse == GPU_ZONE_SLOTS)
+        return;
+    double now = glfwGetTime();
+    if(now - pool.gpuClockSynced >= GPU_ZONE_CLOCK_RESYNC) {
+        GLint64 gpuTime = 0;
+        glGetInteger64v(GL_TIMESTAMP, &gpuTime);
+        pool.gpuClockOffset = now - gpuTime * 1e-9;
+        pool.gpuClockSynced = now;
+    }
+
+    slot = pool.nextSlot;
+    pool.nextSlot = (slot + 1) % GPU_ZONE_SLOTS;
+    pool.slotsInUse++;
+    pool.ended[slot] = false;
+    pool.names[slot] = name;
+    pool.frames[slot] = gpuZoneFrame.load(std::memory_order_relaxed);
+    glQueryCounter(pool.queries[slot][0], GL_TIMESTAMP);
+}
+
+GpuZone::~GpuZone() {
+    if(slot >= 0) {
+        GpuZonePool& pool = gpuZonePool;
+        glQueryCounter(pool.queries[slot][1], GL_TIMESTAMP);
+        pool.ended[slot] = true;
+        resolveGpuZones(pool);
+    }
+    if(debugGroup)
+        glPopDebugGroup();
+}
+
+void markGpuZoneFrame() {
+    gpuZoneFrame.fetch_add(1, std::memory_order_relaxed);
+}
+
+int getGpuZoneTimings(GpuZoneTiming* timings, int max) {
+    std::lock_guard<std::mutex> lock(gpuZoneMutex);
+    int count = std::min(gpuZoneCount, max);
+    for(int i = 0; i < count; i++)
+        timings[i] = { gpuZoneStats[i].name, gpuZoneStats[i].lastFrame, std::max(gpuZoneStats[i].mean, 0.0) };
+    return count;
+}
+
+};
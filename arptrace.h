@@ -0,0 +1,74 @@
+#ifndef ARPTRACE_H
+#define ARPTRACE_H
+
+#include "arp.h"
+
+namespace arp {
+
+/**
+ * Scoped trace markers for writeTrace. Each thread records into its own
+ * ring of recent events, so marking a scope takes no lock. Without
+ * ARP_TRACE defined the macros expand to nothing.
+ *
+ * ARP_TRACE_SCOPE(name) - times the rest of the enclosing scope on the CPU
+ * ARP_TRACE_GPU_SCOPE(name) - also times the GL commands issued in it with
+ *                             timestamp queries of the current context
+ * ARP_TRACE_INDEXED_SCOPE(name, index) - GPU scope tagged with an index,
+ *                                        such as the layer being drawn
+ * ARP_TRACE_THREAD(name) - names the calling thread in the trace
+ *
+ * Names must be string literals, only their pointers are recorded.
+ */
+#ifdef ARP_TRACE
+
+#define ARP_TRACE_CONCAT_(a, b) a##b
+#define ARP_TRACE_CONCAT(a, b) ARP_TRACE_CONCAT_(a, b)
+#define ARP_TRACE_SCOPE(name) ::arp::TraceScope ARP_TRACE_CONCAT(arpTraceScope, __LINE__)(name, false)
+#define ARP_TRACE_GPU_SCOPE(name) ::arp::TraceScope ARP_TRACE_CONCAT(arpTraceScope, __LINE__)(name, true)
+#define ARP_TRACE_INDEXED_SCOPE(name, index) \
+    ::arp::TraceScope ARP_TRACE_CONCAT(arpTraceScope, __LINE__)(name, true, index)
+#define ARP_TRACE_THREAD(name) ::arp::setTraceThreadName(name)
+
+/**
+ * Records the time between its construction and destruction on the calling
+ * thread
+ */
+class TraceScope {
+private:
+    const char* name;
+    int index;
+    double begin;
+    // timestamp queries of GPU scopes, -1 when the scope isn't timed on the GPU
+    int gpuSlot;
+
+public:
+    TraceScope(const char* name, bool gpu, int index = -1);
+    ~TraceScope();
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+};
+
+/**
+ * Sets the name the calling thread's events are shown under
+ */
+void setTraceThreadName(const char* name);
+
+#else
+
+#define ARP_TRACE_SCOPE(name)
+#define ARP_TRACE_GPU_SCOPE(name)
+#define ARP_TRACE_INDEXED_SCOPE(name, index)
+#define ARP_TRACE_THREAD(name)
+
+#endif
+
+/**
+ * Attributes the GpuZones begun from now on to the next app frame. Called
+ * by submitFrame
+ */
+void markGpuZoneFrame();
+
+};
+
+#endif // ARPTRACE_H
@@ -0,0 +1,263 @@
+#include "arpupload.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+namespace arp {
+
+// pixel buffer offsets must be a multiple of the pixel size, this covers all
+static const std::size_t STAGE_ALIGNMENT = 256;
+
+void UploadRing::initialize(std::size_t size) {
+    destroy();
+    capacity = (size + STAGE_ALIGNMENT - 1) / STAGE_ALIGNMENT * STAGE_ALIGNMENT;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    if(GLEW_ARB_buffer_storage) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_COPY_READ_BUFFER, capacity, nullptr, flags);
+        mapping = (unsigned char*)glMapBufferRange(GL_COPY_READ_BUFFER, 0, capacity, flags);
+        if(!mapping) {
+            // storage is immutable, filling it needs a buffer of its own
+            std::cout << "Error: could not map the upload ring, filling it with glBufferSubData" << std::endl;
+            glDeleteBuffers(1, &buffer);
+            glGenBuffers(1, &buffer);
+            glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        }
+    }
+    if(!mapping)
+        glBufferData(GL_COPY_READ_BUFFER, capacity, nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    head = 0;
+}
+
+void UploadRing::destroy() {
+    if(!buffer)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        while(!regions.empty())
+            retire(true);
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    if(mapping)
+        glUnmapBuffer(GL_COPY_READ_BUFFER);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glDeleteBuffers(1, &buffer);
+    buffer = 0;
+    mapping = nullptr;
+    capacity = 0;
+}
+
+void UploadRing::retire(bool wait) {
+    while(!regions.empty()) {
+        Region& region = regions.front();
+        GLenum status = glClientWaitSync(region.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? 1000000000 : 0);
+        if(status == GL_TIMEOUT_EXPIRED) {
+            if(wait)
+                continue;
+            return;
+        }
+        glDeleteSync(region.fence);
+        completedHandle = region.handle;
+        regions.pop_front();
+        // one is enough to make room
+        wait = false;
+    }
+}
+
+std::size_t UploadRing::stage(const void* data, std::size_t size) {
+    std::size_t aligned = (size + STAGE_ALIGNMENT - 1) / STAGE_ALIGNMENT * STAGE_ALIGNMENT;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        while(true) {
+            // copies don't wrap, skip the end of the ring if it's too short
+            std::uint64_t begin = head;
+            std::size_t offset = begin % capacity;
+            if(offset + aligned > capacity)
+                begin += capacity - offset;
+            std::uint64_t tail = regions.empty() ? begin : regions.front().begin;
+            if(begin + aligned - tail <= capacity) {
+                stagedBegin = begin;
+                head = begin + aligned;
+                break;
+            }
+            retire(true);
+        }
+    }
+
+    std::size_t offset = stagedBegin % capacity;
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+    if(mapping)
+        memcpy(mapping + offset, data, size);
+    else
+        glBufferSubData(GL_COPY_READ_BUFFER, offset, size, data);
+    return offset;
+}
+
+UploadHandle UploadRing::finish() {
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // completion is checked from other contexts, which can't flush this one
+    glFlush();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    UploadHandle handle = nextHandle++;
+    regions.push_back({ stagedBegin, head, handle, fence });
+    return handle;
+}
+
+UploadHandle UploadRing::fenceDirect() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stagedBegin = head;
+    }
+    return finish();
+}
+
+UploadHandle UploadRing::uploadBuffer(GLuint destination, std::size_t offset, const void* data, std::size_t size) {
+    UploadHandle handle = 0;
+    // halves, so one part can be copied while the other is filled
+    std::size_t partSize = std::max(STAGE_ALIGNMENT, capacity / 2);
+    for(std::size_t done = 0; done < size; done += partSize) {
+        std::size_t part = std::min(partSize, size - done);
+        std::size_t staged = stage((const unsigned char*)data + done, part);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, destination);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, staged, offset + done, part);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        handle = finish();
+    }
+    return handle;
+}
+
+UploadHandle UploadRing::uploadTexture2D(GLuint texture, int level, int width, int height, GLenum format,
+                                         GLenum type, const void* data, std::size_t size) {
+    if(size > capacity) {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, width, height, format, type, data);
+        return fenceDirect();
+    }
+    std::size_t staged = stage(data, size);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, width, height, format, type, (const GLvoid*)staged);
+    return finish();
+}
+
+bool UploadRing::isComplete(UploadHandle handle) {
+    if(handle <= completedHandle)
+        return true;
+    std::lock_guard<std::mutex> lock(mutex);
+    retire(false);
+    return handle <= completedHandle;
+}
+
+void UploadRing::wait(UploadHandle handle) {
+    std::lock_guard<std::mutex> lock(mutex);
+    while(handle > completedHandle && !regions.empty())
+        retire(true);
+}
+
+static void waitAndDelete(GLsync& fence) {
+    if(!fence)
+        return;
+    while(glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {}
+    glDeleteSync(fence);
+    fence = nullptr;
+}
+
+void FrameArena::createBuffer() {
+    std::size_t size = regionSize * fences.size();
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    if(GLEW_ARB_buffer_storage) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, flags);
+        mapping = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags);
+        if(!mapping) {
+            std::cout << "Error: could not map the frame arena, filling it with glBufferSubData" << std::endl;
+            glDeleteBuffers(1, &buffer);
+            glGenBuffers(1, &buffer);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        }
+    }
+    if(!mapping)
+        glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    generation++;
+}
+
+void FrameArena::deleteBuffer() {
+    for(GLsync& fence : fences)
+        waitAndDelete(fence);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    if(mapping)
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    glDeleteBuffers(1, &buffer);
+    buffer = 0;
+    mapping = nullptr;
+}
+
+void FrameArena::initialize(std::size_t size, int framesInFlight) {
+    destroy();
+    regionSize = size;
+    fences.assign(std::max(1, framesInFlight), nullptr);
+    region = 0;
+    createBuffer();
+}
+
+void FrameArena::destroy() {
+    if(!buffer)
+        return;
+    deleteBuffer();
+    fences.clear();
+    inFrame = false;
+}
+
+void FrameArena::beginFrame() {
+    if(!buffer)
+        return;
+    if(inFrame) {
+        fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        region = (region + 1) % fences.size();
+    }
+    inFrame = true;
+
+    if(wanted > regionSize) {
+        // with room to spare, so a slowly growing scene doesn't grow it often
+        while(regionSize < wanted + wanted / 2)
+            regionSize *= 2;
+        deleteBuffer();
+        createBuffer();
+        region = 0;
+    }
+    waitAndDelete(fences[region]);
+    used = 0;
+    wanted = 0;
+}
+
+bool FrameArena::write(const void* data, std::size_t size, std::size_t alignment, std::size_t& offset) {
+    wanted = (wanted + alignment - 1) / alignment * alignment + size;
+    if(!inFrame)
+        return false;
+    std::size_t base = regionSize * region;
+    std::size_t begin = (base + used + alignment - 1) / alignment * alignment;
+    if(begin + size > base + regionSize)
+        return false;
+
+    if(mapping) {
+        memcpy(mapping + begin, data, size);
+    } else {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, begin, size, data);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+    used = begin + size - base;
+    offset = begin;
+    return true;
+}
+
+};
@@ -0,0 +1,189 @@
+#ifndef ARPUPLOAD_H
+#define ARPUPLOAD_H
+
+#include <GL/glew.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace arp {
+
+/**
+ * Identifies an upload. Handles grow in the order uploads are issued, 0 is
+ * never issued and always complete
+ */
+typedef std::uint64_t UploadHandle;
+
+/**
+ * Staging ring for texture and buffer uploads. CPU data is copied into a
+ * persistently mapped buffer and the GPU copies it on from there, so an
+ * upload neither allocates a staging buffer nor waits on the GPU. Every
+ * upload is fenced and its part of the ring is reused once the fence has
+ * signaled. Without ARB_buffer_storage the ring is filled with
+ * glBufferSubData instead.
+ *
+ * Uploads are issued from one thread with the ring's context current.
+ * Completion can be checked from any context sharing objects with it
+ */
+class UploadRing {
+private:
+    struct Region {
+        // positions in bytes ever staged, the ring offset is begin % capacity
+        std::uint64_t begin;
+        std::uint64_t end;
+        UploadHandle handle;
+        GLsync fence;
+    };
+
+    GLuint buffer = 0;
+    // null when filled with glBufferSubData
+    unsigned char* mapping = nullptr;
+    std::size_t capacity = 0;
+    std::uint64_t head = 0;
+    std::uint64_t stagedBegin = 0;
+    UploadHandle nextHandle = 1;
+    std::atomic<UploadHandle> completedHandle{ 0 };
+    // guards regions, which completion checks retire from other threads
+    std::mutex mutex;
+    std::deque<Region> regions;
+
+    /**
+     * Retires the regions whose uploads have completed, waiting for at
+     * least the oldest one if wait is set. Needs mutex held
+     */
+    void retire(bool wait);
+
+public:
+    UploadRing() = default;
+    UploadRing(const UploadRing&) = delete;
+    UploadRing& operator=(const UploadRing&) = delete;
+
+    /**
+     * Creates the ring with room for size bytes of uploads in flight
+     */
+    void initialize(std::size_t size);
+
+    /**
+     * Waits for every upload and deletes the ring. Their handles stay
+     * complete
+     */
+    void destroy();
+
+    bool isInitialized() const { return buffer != 0; }
+    std::size_t size() const { return capacity; }
+
+    /**
+     * Copies data into the ring, waiting for old uploads if it's full, and
+     * binds the ring to GL_PIXEL_UNPACK_BUFFER and GL_COPY_READ_BUFFER.
+     * Returns the offset of the copy for the commands reading it, which are
+     * then fenced by finish. size must not exceed the ring's
+     */
+    std::size_t stage(const void* data, std::size_t size);
+
+    /**
+     * Fences the commands reading the data of the last stage and unbinds
+     * the ring. Returns the handle of the upload
+     */
+    UploadHandle finish();
+
+    /**
+     * Fences commands that upload straight from client memory, for data
+     * larger than the ring, so their completion is tracked in order with
+     * the ring's uploads
+     */
+    UploadHandle fenceDirect();
+
+    /**
+     * Copies data into the buffer at offset. The buffer must have storage
+     * for it. Data larger than the ring goes in several uploads, the handle
+     * returned is the last one
+     */
+    UploadHandle uploadBuffer(GLuint destination, std::size_t offset, const void* data, std::size_t size);
+
+    /**
+     * Copies pixels into a level of a 2D texture with storage for it.
+     * Images larger than the ring are uploaded from data directly
+     */
+    UploadHandle uploadTexture2D(GLuint texture, int level, int width, int height, GLenum format,
+                                 GLenum type, const void* data, std::size_t size);
+
+    /**
+     * Returns true once the GPU has executed the upload's commands. Can be
+     * called from any thread with a sharing context current
+     */
+    bool isComplete(UploadHandle handle);
+
+    /**
+     * Blocks until the upload is complete
+     */
+    void wait(UploadHandle handle);
+};
+
+/**
+ * Arena for the constants of a frame, such as camera uniforms and instance
+ * data. A persistently mapped buffer is split into one region per frame in
+ * flight, a frame's constants are written into its region one after another
+ * and bound by range. A region is reused once the fence of the frame that
+ * last wrote it has signaled, so the CPU can write a frame while the GPU
+ * draws the previous one. Regions grow at the start of a frame to what the
+ * last one asked for. Without ARB_buffer_storage regions are filled with
+ * glBufferSubData.
+ *
+ * Used from one thread with the arena's context current
+ */
+class FrameArena {
+private:
+    GLuint buffer = 0;
+    // null when filled with glBufferSubData
+    unsigned char* mapping = nullptr;
+    std::size_t regionSize = 0;
+    std::vector<GLsync> fences;
+    int region = 0;
+    std::size_t used = 0;
+    // bytes the frame would have used without running out
+    std::size_t wanted = 0;
+    bool inFrame = false;
+    int generation = 0;
+
+    void createBuffer();
+    void deleteBuffer();
+
+public:
+    FrameArena() = default;
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    void initialize(std::size_t regionSize, int framesInFlight = 3);
+    void destroy();
+
+    bool isInitialized() const { return buffer != 0; }
+
+    /**
+     * Fences the previous frame's region and starts writing the next one,
+     * waiting if the GPU still reads it
+     */
+    void beginFrame();
+
+    /**
+     * Copies data into the frame's region at a multiple of alignment from
+     * the start of the buffer and sets offset to it. Returns false outside
+     * a frame or when the region is full, the data then has to go elsewhere
+     */
+    bool write(const void* data, std::size_t size, std::size_t alignment, std::size_t& offset);
+
+    GLuint getBuffer() const { return buffer; }
+
+    /**
+     * Changes whenever the buffer is replaced, state referencing the old one
+     * has to be set up again
+     */
+    int getGeneration() const { return generation; }
+};
+
+};
+
+#endif // ARPUPLOAD_H
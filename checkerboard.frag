@@ -0,0 +1,17 @@
+#version 330 core
+
+// keeps the 2x2 quads a checkerboard frame renders and puts the others on
+// the near plane, so the depth test rejects everything drawn over them. See
+// arp::getCheckerboardParity for the pattern
+uniform ivec2 origin;
+uniform int parity;
+// depth of the near plane, 1 with reversed depth
+uniform float nearDepth;
+
+void main()
+{
+    ivec2 coord = ivec2(gl_FragCoord.xy) - origin;
+    if((((coord.x >> 1) + (coord.y >> 1)) & 1) == parity)
+        discard;
+    gl_FragDepth = nearDepth;
+}
@@ -0,0 +1,15 @@
+#version 330 core
+
+// depth pre-pass of shader4.vert's meshes, see renderbatch::setDepthPrePass.
+// Writes no color, only discards what shader4.frag would discard
+uniform sampler2D peelDepth;
+uniform int peel;
+
+// matches shader4.frag's, so both passes keep the same fragments
+const float peelBias = 0.00001;
+
+void main()
+{
+    if(peel != 0 && float(peel) * (gl_FragCoord.z - texelFetch(peelDepth, ivec2(gl_FragCoord.xy), 0).r) <= peelBias)
+        discard;
+}
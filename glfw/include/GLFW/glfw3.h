@@ -1011,6 +1011,12 @@ extern "C" {
  *  [window hint](@ref GLFW_SCALE_TO_MONITOR).
  */
 #define GLFW_SCALE_TO_MONITOR       0x0002200C
+/*! @brief Context GPU priority hint.
+ *
+ *  Priority the GPU schedules the context's work with. Only honored by EGL
+ *  contexts on drivers with `EGL_IMG_context_priority`.
+ */
+#define GLFW_CONTEXT_PRIORITY       0x00022010
 /*! @brief macOS specific
  *  [window hint](@ref GLFW_COCOA_RETINA_FRAMEBUFFER_hint).
  */
@@ -1063,6 +1069,11 @@ extern "C" {
 #define GLFW_EGL_CONTEXT_API        0x00036002
 #define GLFW_OSMESA_CONTEXT_API     0x00036003
 
+#define GLFW_ANY_PRIORITY                    0
+#define GLFW_PRIORITY_LOW           0x00037001
+#define GLFW_PRIORITY_MEDIUM        0x00037002
+#define GLFW_PRIORITY_HIGH          0x00037003
+
 /*! @defgroup shapes Standard cursor shapes
  *  @brief Standard system cursor shapes.
  *
@@ -436,6 +436,8 @@ GLFWbool _glfwInitEGL(void)
         extensionSupportedEGL("EGL_KHR_context_flush_control");
     _glfw.egl.EXT_present_opaque =
         extensionSupportedEGL("EGL_EXT_present_opaque");
+    _glfw.egl.IMG_context_priority =
+        extensionSupportedEGL("EGL_IMG_context_priority");
 
     return GLFW_TRUE;
 }
@@ -584,6 +586,16 @@ GLFWbool _glfwCreateContextEGL(_GLFWwindow* window,
         }
     }
 
+    if (_glfw.egl.IMG_context_priority)
+    {
+        if (ctxconfig->priority == GLFW_PRIORITY_HIGH)
+            setAttrib(EGL_CONTEXT_PRIORITY_LEVEL_IMG, EGL_CONTEXT_PRIORITY_HIGH_IMG);
+        else if (ctxconfig->priority == GLFW_PRIORITY_MEDIUM)
+            setAttrib(EGL_CONTEXT_PRIORITY_LEVEL_IMG, EGL_CONTEXT_PRIORITY_MEDIUM_IMG);
+        else if (ctxconfig->priority == GLFW_PRIORITY_LOW)
+            setAttrib(EGL_CONTEXT_PRIORITY_LEVEL_IMG, EGL_CONTEXT_PRIORITY_LOW_IMG);
+    }
+
     setAttrib(EGL_NONE, EGL_NONE);
 
     window->context.egl.handle = eglCreateContext(_glfw.egl.display,
@@ -109,6 +109,10 @@ typedef struct wl_egl_window* EGLNativeWindowType;
 #define EGL_CONTEXT_RELEASE_BEHAVIOR_NONE_KHR 0
 #define EGL_CONTEXT_RELEASE_BEHAVIOR_FLUSH_KHR 0x2098
 #define EGL_PRESENT_OPAQUE_EXT 0x31df
+#define EGL_CONTEXT_PRIORITY_LEVEL_IMG 0x3100
+#define EGL_CONTEXT_PRIORITY_HIGH_IMG 0x3101
+#define EGL_CONTEXT_PRIORITY_MEDIUM_IMG 0x3102
+#define EGL_CONTEXT_PRIORITY_LOW_IMG 0x3103
 
 typedef int EGLint;
 typedef unsigned int EGLBoolean;
@@ -181,6 +185,7 @@ typedef struct _GLFWlibraryEGL
     GLFWbool        KHR_get_all_proc_addresses;
     GLFWbool        KHR_context_flush_control;
     GLFWbool        EXT_present_opaque;
+    GLFWbool        IMG_context_priority;
 
     void*           handle;
 
@@ -295,6 +295,7 @@ struct _GLFWctxconfig
     int           profile;
     int           robustness;
     int           release;
+    int           priority;
     _GLFWwindow*  share;
     struct {
         GLFWbool  offline;
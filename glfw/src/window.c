@@ -383,6 +383,9 @@ GLFWAPI void glfwWindowHint(int hint, int value)
         case GLFW_CONTEXT_RELEASE_BEHAVIOR:
             _glfw.hints.context.release = value;
             return;
+        case GLFW_CONTEXT_PRIORITY:
+            _glfw.hints.context.priority = value;
+            return;
         case GLFW_REFRESH_RATE:
             _glfw.hints.refreshRate = value;
             return;
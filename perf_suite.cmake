@@ -0,0 +1,56 @@
+# Runs the demo's performance scenarios headless, one after another, and
+# fails when a run's metrics go over its budget file or regress from its
+# baseline in perf_baselines/. Each run writes perf_results/<run>.json for
+# trend graphs. Run from the source directory through the perf_suite
+# target, or as
+#
+#   cmake -DARP_DEMO=<path to test> [-DSAVE_BASELINES=ON] [-DTOLERANCE=0.1] -P perf_suite.cmake
+#
+# SAVE_BASELINES replaces the baselines with this run's metrics
+
+if(NOT ARP_DEMO)
+    message(FATAL_ERROR "Set ARP_DEMO to the demo executable")
+endif()
+if(NOT DEFINED TOLERANCE)
+    set(TOLERANCE 0.1)
+endif()
+
+set(RUNS rotation translation background objects_1k objects_100k)
+set(rotation_ARGS --benchmark-scenario rotation)
+set(translation_ARGS --benchmark-scenario translation)
+set(background_ARGS --benchmark-scenario background)
+set(objects_1k_ARGS --benchmark-scenario rotation --scene-objects 1000 --scene-random 1)
+set(objects_100k_ARGS --benchmark-scenario rotation --scene-objects 100000 --scene-random 1)
+# generated scenes load far more than the sample one
+set(rotation_BUDGET perf_budgets.txt)
+set(translation_BUDGET perf_budgets.txt)
+set(background_BUDGET perf_budgets.txt)
+set(objects_1k_BUDGET perf_budgets_large.txt)
+set(objects_100k_BUDGET perf_budgets_large.txt)
+
+file(MAKE_DIRECTORY perf_results)
+if(SAVE_BASELINES)
+    file(MAKE_DIRECTORY perf_baselines)
+endif()
+
+set(FAILED "")
+foreach(RUN ${RUNS})
+    set(ARGS ${${RUN}_ARGS} --headless
+        --benchmark perf_results/${RUN}.csv
+        --benchmark-json perf_results/${RUN}.json
+        --benchmark-budget ${${RUN}_BUDGET})
+    if(SAVE_BASELINES)
+        list(APPEND ARGS --benchmark-save-baseline perf_baselines/${RUN}.txt)
+    elseif(EXISTS ${CMAKE_CURRENT_LIST_DIR}/perf_baselines/${RUN}.txt)
+        list(APPEND ARGS --benchmark-baseline perf_baselines/${RUN}.txt --benchmark-tolerance ${TOLERANCE})
+    endif()
+    message(STATUS "perf run ${RUN}")
+    execute_process(COMMAND ${ARP_DEMO} ${ARGS} RESULT_VARIABLE RESULT)
+    if(NOT RESULT EQUAL 0)
+        list(APPEND FAILED ${RUN})
+    endif()
+endforeach()
+
+if(FAILED)
+    message(FATAL_ERROR "perf runs over budget or regressed: ${FAILED}")
+endif()
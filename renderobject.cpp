@@ -1,155 +1,3141 @@
 #include "renderobject.h"
 
 #include "stb_image.h"
+#include "arpmesh.h"
+#include "arptex.h"
+#include "arppack.h"
+#include "arpupload.h"
+#include "arpstate.h"
+#include "arpjobs.h"
+#include "arpgl.h"
 
-void renderobject::updateMatrices(arp::Pose pose, double aspectRatio, double fovY)
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+// 4 objects' transforms per iteration where there are 4 wide vectors
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TRANSFORM_SSE
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define TRANSFORM_NEON
+#endif
+
+// binding point of the CameraUniforms block in shader4.vert
+static const GLuint CAMERA_UNIFORMS_BINDING = 0;
+// binding point of the EnvironmentUniforms block in shader4.frag
+static const GLuint ENVIRONMENT_UNIFORMS_BINDING = 1;
+// whether draws write reversed depth, see renderbatch::setReversedZ
+static bool reversedZ = false;
+// whether draws lay down depth before shading, see renderbatch::setDepthPrePass
+static bool depthPrePass = false;
+
+// the light cluster grid of a layer: tiles across and up the viewport and
+// slices of distance, see renderbatch::setLights
+static const int CLUSTER_TILES_X = 16;
+static const int CLUSTER_TILES_Y = 9;
+static const int CLUSTER_SLICES = 24;
+// texture units of shader4.frag's light, cluster and light index buffers
+static const int LIGHTS_UNIT = 2;
+
+/**
+ * std140 layout of the CameraUniforms block
+ */
+struct CameraUniforms {
+    float view[16];
+    float projection[16];
+    float viewProjection[16];
+    // origin and size of the viewport the tiles divide
+    float clusterViewport[4];
+    // near plane distance and slices per unit of log distance
+    float clusterDepth[4];
+    // tiles, slices and lights, all 0 without lights
+    std::int32_t clusterGrid[4];
+};
+
+/**
+ * Buffer textures shader4.frag reads the layer's lights from: two RGBA32F
+ * texels per light, view space position and radius then color, an RG32UI
+ * offset and count per cluster into the R32UI light indices, and those.
+ * Refilled for every layer drawn with lights
+ */
+struct LightClusters {
+    arp::GLBuffer buffers[3];
+    arp::GLTexture textures[3];
+    std::vector<glm::vec4> lights;
+    std::vector<GLuint> ranges;
+    std::vector<GLuint> indices;
+    // first and last tile and slice each listed light reaches
+    std::vector<glm::ivec3> first;
+    std::vector<glm::ivec3> last;
+};
+static LightClusters lightClusters;
+
+/**
+ * Assets loaded in the background are handed out while loading and are
+ * only drawn once ready. Only the app thread reads or changes the state
+ */
+enum AssetState {
+    ASSET_LOADING,
+    ASSET_READY,
+    ASSET_FAILED,
+};
+
+struct TextureSource;
+
+// bytes of the uploaded levels of every texture
+static std::atomic<std::int64_t> textureBytes{ 0 };
+
+/**
+ * Texture decoded from an image file or mapped from its baked .dds, and
+ * uploaded with mipmaps. Baked textures stream: they start with their
+ * coarse levels, and finer ones are uploaded from the mapped file as draws
+ * ask for them and dropped again to stay within the texture budget
+ */
+struct TextureAsset {
+    cyGLTexture2D texture;
+    AssetState state = ASSET_LOADING;
+    // reported to arp's GPU memory stats
+    std::int64_t gpuBytes = 0;
+
+    // the mapped .dds levels stream from, null if the texture was uploaded
+    // whole. The fields below are the app thread's
+    std::shared_ptr<TextureSource> source;
+    int levelCount = 1;
+    // finest level the texture samples, the GL_TEXTURE_BASE_LEVEL
+    int residentLevel = 0;
+    // finest level a draw asked for since the last beginFrame, and in which
+    // frame one last did
+    int wantedLevel = 0;
+    std::uint64_t lastWanted = 0;
+    // finest level renderbatch::prefetch asked for since the last
+    // beginFrame, streamed after what draws want
+    int prefetchLevel = 0;
+    // bytes of finer levels uploading, 0 if none are
+    std::int64_t streamingBytes = 0;
+    // resident bindless handle, 0 until a draw samples the texture through
+    // one. A handle freezes the texture, so streaming textures have none
+    GLuint64 handle = 0;
+
+    ~TextureAsset() {
+        if(handle)
+            glMakeTextureHandleNonResidentARB(handle);
+        arp::trackGpuMemory(arp::GPU_MEMORY_APP, -gpuBytes);
+        textureBytes -= gpuBytes;
+        arp::glState().forgetTexture(texture.GetID());
+        texture.Delete();
+    }
+};
+
+/**
+ * Interleaved vertex buffer, index buffer and diffuse texture of a mesh.
+ * The VAO also sources per-instance matrices, from the frame arena or from
+ * instanceBuffer when that is out of room
+ */
+struct MeshAsset {
+    AssetState state = ASSET_LOADING;
+    // program the VAO's attribute locations come from
+    cy::GLSLProgram* program = nullptr;
+    arp::GLVertexArray vao;
+    arp::GLBuffer buffer;
+    arp::GLBuffer indexBuffer;
+    arp::GLBuffer instanceBuffer;
+    // first location of each per-instance matrix, -1 if the program lacks it
+    GLint modelLocation = -1;
+    GLint normalMatrixLocation = -1;
+    // where the VAO's per-instance attributes point at
+    GLuint instanceSource = 0;
+    std::size_t instanceOffset = 0;
+    int instanceGeneration = 0;
+    int vertexCount = 0;
+    int indexCount = 0;
+    GLenum indexType = GL_UNSIGNED_INT;
+    // index ranges of the levels of detail, the full mesh first
+    std::vector<ArpMeshLod> lods;
+    // partition of the full level, empty for small meshes
+    std::vector<ArpMeshMeshlet> meshlets;
+    // object space bounds
+    arp::AABB bounds = { glm::vec3(0), glm::vec3(0) };
+    std::shared_ptr<TextureAsset> texture;
+    // vertices and indices, reported to arp's GPU memory stats
+    std::int64_t gpuBytes = 0;
+
+    ~MeshAsset() {
+        arp::trackGpuMemory(arp::GPU_MEMORY_APP, -gpuBytes);
+    }
+};
+
+static std::unordered_map<std::string, std::unique_ptr<cy::GLSLProgram>> programCache;
+/**
+ * Uniforms of a cached program set per mesh, and what they were last set
+ * to: the tex uniform's bindless handle, 0 while it samples texture unit 0,
+ * and the bounds packed positions are quantized within
+ */
+struct ProgramUniforms {
+    GLint texture = -1;
+    GLuint64 handle = 0;
+    GLint positionMin = -1;
+    GLint positionExtent = -1;
+    glm::vec3 boundsMin = glm::vec3(0);
+    glm::vec3 boundsExtent = glm::vec3(0);
+};
+static std::unordered_map<GLuint, ProgramUniforms> programUniforms;
+// see renderbatch::setBindlessTextures
+static std::atomic<bool> bindlessEnabled{ true };
+// assets are owned by the objects using them, the caches only observe
+static std::unordered_map<std::string, std::weak_ptr<MeshAsset>> meshCache;
+static std::unordered_map<std::string, std::weak_ptr<TextureAsset>> textureCache;
+// loader workers look up textures too, the other caches are app thread only
+static std::mutex textureCacheMutex;
+// camera of the layer being drawn, bound to the CameraUniforms block
+static GLuint cameraUniformBuffer = 0;
+// see setEnvironmentLighting, bound to the EnvironmentUniforms block
+static GLuint environmentUniformBuffer = 0;
+// room for uploads in flight on the loader's upload thread
+static const std::size_t UPLOAD_RING_SIZE = 32 << 20;
+// camera uniforms and instances of the app's frames, see beginFrame
+static arp::FrameArena frameArena;
+// starting room per frame, the arena grows if a frame needs more
+static const std::size_t FRAME_ARENA_REGION_SIZE = 1 << 20;
+// see setAssetPack, read-only once assets load so workers share it
+static MappedArpPack assetPack;
+
+static std::string readFile(const char* fileName)
 {
-    glm::mat4 projection = glm::perspective((float)fovY, (float)aspectRatio, 0.1f, 100.f);
-    glm::mat4 camera = glm::translate(glm::mat4(1), pose.position) * glm::mat4(pose.orientation);
-    
-    glm::mat4 m4( 1.0f );
-    m4[ 3 ] = glm::vec4( glm::vec3( xPos, yPos, -translateZ ), 1.0f );
-    
-    
-    glm::mat4 view = glm::inverse(camera) * m4;
-    
+    const unsigned char* packed;
+    std::size_t size;
+    if(assetPack.find(fileName, packed, size))
+        return std::string((const char*)packed, size);
+    std::ifstream file(fileName);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+cy::GLSLProgram* renderobject::getProgram(const char* vertFile, const char* fragFile)
+{
+    std::string vertSource = readFile(vertFile);
+    std::string fragSource = readFile(fragFile);
+    std::string key = vertSource + '\0' + fragSource;
+
+    auto it = programCache.find(key);
+    if(it != programCache.end())
+        return it->second.get();
+
+    std::unique_ptr<cy::GLSLProgram> program(new cy::GLSLProgram());
+    program->BuildSources(vertSource.c_str(), fragSource.c_str());
+    GLuint blockIndex = glGetUniformBlockIndex(program->GetID(), "CameraUniforms");
+    if(blockIndex != GL_INVALID_INDEX)
+        glUniformBlockBinding(program->GetID(), blockIndex, CAMERA_UNIFORMS_BINDING);
+    blockIndex = glGetUniformBlockIndex(program->GetID(), "EnvironmentUniforms");
+    if(blockIndex != GL_INVALID_INDEX) {
+        glUniformBlockBinding(program->GetID(), blockIndex, ENVIRONMENT_UNIFORMS_BINDING);
+        // zeros until setEnvironmentLighting, which is the flat ambient term
+        if(!environmentUniformBuffer)
+            renderbatch::setEnvironmentLighting(nullptr);
+    }
+    // meshes' textures go to unit 0 unless they're bindless
+    ProgramUniforms& uniforms = programUniforms[program->GetID()];
+    uniforms.texture = glGetUniformLocation(program->GetID(), "tex");
+    if(uniforms.texture != -1) {
+        arp::glState().useProgram(program->GetID());
+        glUniform1i(uniforms.texture, 0);
+    }
+    // the light lists of renderbatch::setLights, on units 2 to 4
+    const char* lightSamplers[3] = { "lights", "clusters", "lightIndices" };
+    for(int i = 0; i < 3; i++) {
+        GLint location = glGetUniformLocation(program->GetID(), lightSamplers[i]);
+        if(location == -1)
+            continue;
+        arp::glState().useProgram(program->GetID());
+        glUniform1i(location, LIGHTS_UNIT + i);
+    }
+    uniforms.positionMin = glGetUniformLocation(program->GetID(), "positionMin");
+    uniforms.positionExtent = glGetUniformLocation(program->GetID(), "positionExtent");
+    cy::GLSLProgram* result = program.get();
+    programCache[key] = std::move(program);
+    return result;
+}
+
+/**
+ * Jobs of a job system parse and decode assets, and one upload thread with
+ * its own shared context creates their buffers and textures. Finished
+ * uploads are handed back to the app thread by pollAssets, so assets are
+ * never released on a thread without a context
+ */
+class AssetLoader {
+private:
+    /**
+     * Upload waiting for the upload thread, bytes is what it stages
+     */
+    struct PendingUpload {
+        int priority;
+        std::uint64_t order;
+        std::size_t bytes;
+        std::function<void()> task;
+
+        // the highest priority first, in the order queued within one
+        bool operator<(const PendingUpload& other) const {
+            if(priority != other.priority)
+                return priority < other.priority;
+            return order > other.order;
+        }
+    };
+
+    /**
+     * Timer query of an issued upload, for the cost estimate
+     */
+    struct TimedUpload {
+        GLuint query;
+        std::size_t bytes;
+        double cpuTime;
+    };
 
-    glm::mat4 mvNorms = glm::inverse(view);
-    mvNorms = glm::transpose(mvNorms);
+    std::unique_ptr<arp::JobSystem> jobs;
+    arp::JobGroup work;
+    std::thread uploader;
+    std::mutex mutex;
+    std::condition_variable uploadAvailable;
+    // heap of PendingUpload
+    std::vector<PendingUpload> uploads;
+    std::uint64_t uploadsQueued = 0;
+    // seconds of uploads the frame's slice has left, negative for no limit,
+    // and whether none were issued in it yet, see beginSlice
+    double sliceLeft = -1;
+    bool sliceFresh = true;
+    // smoothed seconds an uploaded byte takes, the longer of its CPU and GPU
+    // time. Written by the upload thread under mutex
+    double secondsPerByte = 1e-9;
+    // upload thread only
+    std::deque<TimedUpload> timers;
+    // work that stop kept from starting
+    std::vector<std::function<void()>> cancelled;
+    bool stopping = false;
 
-    glm::mat4 mvp = projection * view;
+    void runUploader(GLFWwindow* uploadContext);
+    bool uploadFits() const;
+    void readTimers();
 
-    prog.SetUniformMatrix4("mvp", &mvp[0][0]);
-    prog.SetUniformMatrix4("mv", &view[0][0]);
-    prog.SetUniformMatrix3("mvNorms", &mvNorms[0][0]);
-   
-    
-    cy::Matrix3f rotMatrixY = cy::Matrix3f::RotationY(yRot);
-    cy::Matrix3f rotMatrixX = cy::Matrix3f::RotationX(xRot);
-    cy::Matrix3f rotMatrix = rotMatrixY * rotMatrixX;
+public:
+    std::atomic<bool> active{ false };
+    // staging for the upload thread, completion is checked by pollAssets
+    arp::UploadRing ring;
 
-    cy::Matrix4f translationMatrix = cy::Matrix4f::Identity();
-    translationMatrix.SetColumn(3, xPos, yPos, -translateZ, 1);
+    void start(GLFWwindow* uploadContext, int threads);
+    void stop();
+    void enqueueWork(std::function<void()> task);
+    void enqueueUpload(std::function<void()> task, std::size_t bytes, int priority);
+    void beginSlice(double seconds);
+};
 
-    cy::Matrix4f projMatrix = cy::Matrix4f::Perspective(2, (float)aspectRatio, 0.1f, 200.0f);
-    cy::Matrix4f view2 = cy::Matrix4f::View(cy::Vec3f(0,0,-25), cy::Vec3f(0,0,0), cy::Vec3f(0,1,0));
-    cy::Matrix4f mv = view2 * translationMatrix;
+// priority of a new asset's upload, above every streamed level's, which is
+// how many levels coarser than asked for the texture shows
+static const int UPLOAD_PRIORITY_ASSET = 1 << 16;
 
-    cy::Matrix3f mvNorms2 = mv.GetSubMatrix3();
-    mvNorms2.Invert();
-    mvNorms2.Transpose();
+/**
+ * Upload waiting to complete on the GPU before the app thread marks it ready
+ */
+struct CompletedUpload {
+    std::shared_ptr<MeshAsset> mesh;
+    std::shared_ptr<TextureAsset> texture;
+    bool success;
+    arp::UploadHandle upload;
+    // finest level of a texture's finer levels streaming in, -1 for the
+    // upload of a new asset
+    int streamLevel;
+};
 
-   // cy::Matrix4f mvp2 = projMatrix * mv;
+static AssetLoader loader;
+static std::mutex completedMutex;
+static std::vector<CompletedUpload> completedUploads;
+// assets queued on the loader that pollAssets hasn't finished yet
+static std::atomic<int> pendingAssets{ 0 };
 
-    //prog.SetUniformMatrix4("mvp", mvp.cell);
-    prog.SetUniformMatrix4("mv", mv.cell);
-    prog.SetUniformMatrix3("mvNorms", mvNorms2.cell);
+// see renderobject::setTextureStreaming and setTextureBudget
+static std::atomic<bool> textureStreaming{ true };
+static std::atomic<std::int64_t> textureBudget{ 0 };
+// textures start with the levels no larger than this on either side
+static const int STREAM_START_SIZE = 64;
+// bytes of finer levels beginFrame starts uploading per frame at most, so
+// a camera cut doesn't queue the whole scene at once
+static const std::int64_t STREAM_BYTES_PER_FRAME = 8 << 20;
+// ready textures with levels to stream, app thread only
+static std::vector<std::weak_ptr<TextureAsset>> streamedTextures;
+static std::uint64_t streamFrame = 1;
+// see renderobject::setUploadBudget
+static std::atomic<double> uploadBudget{ 0 };
+// weight of each measured upload in AssetLoader's cost estimate
+static const double UPLOAD_COST_SMOOTHING = 0.1;
+
+void AssetLoader::start(GLFWwindow* uploadContext, int threads)
+{
+    stopping = false;
+    active = true;
+    uploader = std::thread(&AssetLoader::runUploader, this, uploadContext);
+    arp::JobSystemSettings settings;
+    settings.workers = threads;
+    jobs.reset(new arp::JobSystem(settings));
 }
 
-void renderobject::render()
+void AssetLoader::stop()
 {
-    glBindBuffer( GL_ARRAY_BUFFER, buffer);
-    glEnableVertexAttribArray( pos );
-    glVertexAttribPointer(pos, 3, GL_FLOAT, GL_FALSE, 0, (GLvoid*) 0);
-    glBindBuffer( GL_ARRAY_BUFFER, normalBuffer);
-    glEnableVertexAttribArray( norm );
-    glVertexAttribPointer(norm, 3, GL_FLOAT, GL_FALSE, 0, (GLvoid*) 0);
-    glBindBuffer( GL_ARRAY_BUFFER, txcBuffer);
-    glEnableVertexAttribArray( txc );
-    glVertexAttribPointer(txc, 3, GL_FLOAT, GL_FALSE, 0, (GLvoid*) 0);
-    
-    glUseProgram(prog.GetID());
-    glDrawArrays(GL_TRIANGLES, 0, mesh.NF() * 3);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    uploadAvailable.notify_all();
+    // unstarted jobs return at once, the job system runs them as it exits
+    jobs.reset();
+    uploader.join();
+    active = false;
+
+    // unstarted tasks hold assets, release them here where there's a context
+    uploads.clear();
+    cancelled.clear();
+    sliceLeft = -1;
+    sliceFresh = true;
 }
 
-renderobject::renderobject(char *fileName, double startingX, double startingY, double startingZ)
+void AssetLoader::enqueueWork(std::function<void()> task)
 {
-    xPos = startingX;
-    yPos = startingY;
-    translateZ = startingZ;
+    jobs->run(work, [this, task]() mutable {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(stopping) {
+                cancelled.push_back(std::move(task));
+                return;
+            }
+        }
+        task();
+    });
+}
 
-    bool success = mesh.LoadFromFileObj(fileName);
-    if(!success)
-        return;
+void AssetLoader::enqueueUpload(std::function<void()> task, std::size_t bytes, int priority)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        uploads.push_back({ priority, uploadsQueued++, bytes, std::move(task) });
+        std::push_heap(uploads.begin(), uploads.end());
+    }
+    uploadAvailable.notify_one();
+}
+
+/**
+ * Starts an app frame's slice of seconds of uploads, 0 for no limit. An
+ * upload the estimate says won't fit in what's left waits for the next
+ * slice, unless it's the slice's first, so one larger than any slice still
+ * goes
+ */
+void AssetLoader::beginSlice(double seconds)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        sliceLeft = seconds > 0 ? seconds : -1;
+        sliceFresh = true;
+    }
+    uploadAvailable.notify_one();
+}
 
-    std::vector<cy::Vec3f> vertexData;
-    std::vector<cy::Vec3f> normalData;
-    std::vector<cy::Vec3f> textureData;
-    for(int i = 0; i < mesh.NF(); i++) {
-        cy::TriMesh::TriFace vertexFace = mesh.F(i);
-        cy::TriMesh::TriFace normalFace = mesh.FN(i);
-        cy::TriMesh::TriFace textureFace = mesh.FT(i);
-        for(int j = 0; j < 3; j++) {
-            vertexData.push_back(mesh.V(vertexFace.v[j]));
-            normalData.push_back(mesh.VN(normalFace.v[j]));
-            textureData.push_back(mesh.VT(textureFace.v[j]));
+/**
+ * Whether the most urgent upload may go in the current slice. Needs mutex
+ * held
+ */
+bool AssetLoader::uploadFits() const
+{
+    if(uploads.empty())
+        return false;
+    return sliceLeft < 0 || sliceFresh || uploads.front().bytes * secondsPerByte <= sliceLeft;
+}
+
+/**
+ * Folds the uploads whose GPU times are in into the cost estimate, taking
+ * the longer of each one's CPU and GPU time
+ */
+void AssetLoader::readTimers()
+{
+    while(!timers.empty()) {
+        TimedUpload& timed = timers.front();
+        GLint available = 0;
+        glGetQueryObjectiv(timed.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if(!available)
+            break;
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(timed.query, GL_QUERY_RESULT, &nanoseconds);
+        glDeleteQueries(1, &timed.query);
+        if(timed.bytes > 0) {
+            double cost = std::max(timed.cpuTime, nanoseconds * 1e-9) / timed.bytes;
+            std::lock_guard<std::mutex> lock(mutex);
+            secondsPerByte += (cost - secondsPerByte) * UPLOAD_COST_SMOOTHING;
         }
+        timers.pop_front();
     }
+}
 
-    /* Load and decode the texture data*/
-    cy::TriMesh::Mtl mtl = mesh.M(0);
-    int width, height, numChannels;
+void AssetLoader::runUploader(GLFWwindow* uploadContext)
+{
+    glfwMakeContextCurrent(uploadContext);
+    ring.initialize(UPLOAD_RING_SIZE);
+    while(true) {
+        PendingUpload upload;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            uploadAvailable.wait(lock, [this]() { return stopping || uploadFits(); });
+            if(stopping)
+                break;
+            std::pop_heap(uploads.begin(), uploads.end());
+            upload = std::move(uploads.back());
+            uploads.pop_back();
+            if(sliceLeft >= 0)
+                sliceLeft = std::max(sliceLeft - upload.bytes * secondsPerByte, 0.0);
+            sliceFresh = false;
+        }
 
-    //decode
-    const char* filename = mtl.map_Kd;
-    unsigned char* imageData = stbi_load(filename, &width, &height, &numChannels, 0);
+        TimedUpload timed = { 0, upload.bytes, 0 };
+        glGenQueries(1, &timed.query);
+        glBeginQuery(GL_TIME_ELAPSED, timed.query);
+        auto start = std::chrono::steady_clock::now();
+        upload.task();
+        timed.cpuTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        glEndQuery(GL_TIME_ELAPSED);
+        timers.push_back(timed);
+        readTimers();
+    }
+    for(TimedUpload& timed : timers)
+        glDeleteQueries(1, &timed.query);
+    timers.clear();
+    ring.destroy();
+    glfwMakeContextCurrent(nullptr);
+}
+
+/**
+ * Hands an upload from the upload thread to pollAssets. The handle makes
+ * sure the app context only uses it once the upload commands have executed
+ */
+static void completeUpload(std::shared_ptr<MeshAsset> mesh, std::shared_ptr<TextureAsset> texture, bool success,
+                           arp::UploadHandle upload, int streamLevel = -1)
+{
+    std::lock_guard<std::mutex> lock(completedMutex);
+    completedUploads.push_back({ std::move(mesh), std::move(texture), success, upload, streamLevel });
+}
+
+/**
+ * Data staged for upload commands, in the upload ring when there is one and
+ * the data fits, otherwise in a pixel buffer of its own. Either way it's
+ * bound to GL_PIXEL_UNPACK_BUFFER and GL_COPY_READ_BUFFER at offset
+ */
+struct StagedData {
+    arp::UploadRing* ring = nullptr;
+    GLuint buffer = 0;
+    std::size_t offset = 0;
+
+    const GLvoid* pointer(std::size_t at = 0) const { return (const GLvoid*)(offset + at); }
+};
+
+static StagedData stageData(arp::UploadRing* ring, const void* data, std::size_t size)
+{
+    StagedData staged;
+    staged.ring = ring;
+    if(ring && size <= ring->size()) {
+        staged.offset = ring->stage(data, size);
+        return staged;
+    }
+    // the driver can copy from a pixel buffer without blocking the caller
+    glGenBuffers(1, &staged.buffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staged.buffer);
+    glBindBuffer(GL_COPY_READ_BUFFER, staged.buffer);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, data, GL_STREAM_DRAW);
+    return staged;
+}
+
+/**
+ * Releases the staged data once the commands reading it are issued. Returns
+ * the handle of the upload, 0 without a ring
+ */
+static arp::UploadHandle finishStaged(const StagedData& staged)
+{
+    if(staged.ring && !staged.buffer)
+        return staged.ring->finish();
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glDeleteBuffers(1, &staged.buffer);
+    return staged.ring ? staged.ring->fenceDirect() : 0;
+}
+
+bool renderobject::setAssetPack(const char* fileName)
+{
+    assetPack.close();
+    return assetPack.open(fileName);
+}
+
+/**
+ * Looks up the baked file with the given extension for an asset in the
+ * asset pack. Returns false if there is no pack or it doesn't have one
+ */
+static bool findPacked(const std::string& fileName, const char* extension, const unsigned char*& data,
+                       std::size_t& size)
+{
+    std::filesystem::path baked(fileName);
+    baked.replace_extension(extension);
+    return assetPack.find(baked.string().c_str(), data, size);
+}
+
+/**
+ * Returns the baked file with the given extension for an asset if there is
+ * one that is up to date
+ */
+static std::string bakedPath(const std::string& fileName, const char* extension)
+{
+    std::filesystem::path source(fileName);
+    if(source.extension() == extension)
+        return fileName;
+
+    std::filesystem::path baked = source;
+    baked.replace_extension(extension);
+    std::error_code error;
+    if(!std::filesystem::exists(baked, error))
+        return "";
+    if(std::filesystem::last_write_time(baked, error) < std::filesystem::last_write_time(source, error))
+        return "";
+    return baked.string();
+}
+
+/**
+ * Image decoded by stb_image
+ */
+struct DecodedImage {
+    int width = 0;
+    int height = 0;
+    int numChannels = 0;
+    std::unique_ptr<unsigned char, void(*)(void*)> pixels{ nullptr, stbi_image_free };
+};
+
+static bool decodeImage(const std::string& fileName, DecodedImage& image)
+{
+    /* Load and decode the texture data*/
+    image.pixels.reset(stbi_load(fileName.c_str(), &image.width, &image.height, &image.numChannels, 0));
 
     //if there's an error, display it
-    if(!imageData) {
+    if(!image.pixels) {
         std::cout << "decoder error: " << stbi_failure_reason() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * CPU side of a texture, either decoded from an image or mapped from a
+ * baked .dds with its mip chain
+ */
+struct TextureSource {
+    DecodedImage image;
+    MappedDds baked;
+    bool isBaked = false;
+};
+
+/**
+ * Maps the baked texture for the file if the context can sample its format,
+ * otherwise decodes the image. Doesn't touch GL, so it can run on loader
+ * workers
+ */
+static bool loadTextureSource(const std::string& fileName, TextureSource& source)
+{
+    const unsigned char* packed;
+    std::size_t packedSize;
+    bool mapped;
+    if(findPacked(fileName, ".dds", packed, packedSize)) {
+        mapped = source.baked.open(fileName.c_str(), packed, packedSize);
+    } else {
+        std::string baked = bakedPath(fileName, ".dds");
+        mapped = !baked.empty() && source.baked.open(baked.c_str());
+    }
+    if(mapped) {
+        if(source.baked.format() == TEXTURE_RGBA8 || GLEW_EXT_texture_compression_s3tc) {
+            source.isBaked = true;
+            return true;
+        }
+        source.baked.close();
+    }
+    return decodeImage(fileName, source.image);
+}
+
+static int levelWidth(const MappedDds& baked, int level)
+{
+    return std::max(1, baked.width() >> level);
+}
+
+static int levelHeight(const MappedDds& baked, int level)
+{
+    return std::max(1, baked.height() >> level);
+}
+
+/**
+ * Bytes of the levels first to last, not including last, which is also
+ * where level first starts in the file's levels when first is 0
+ */
+static std::size_t levelsSize(const MappedDds& baked, int first, int last)
+{
+    std::size_t size = 0;
+    for(int i = first; i < last; i++)
+        size += textureLevelSize(baked.format(), levelWidth(baked, i), levelHeight(baked, i));
+    return size;
+}
+
+/**
+ * Adds bytes to what a texture's uploaded levels take
+ */
+static void addTextureBytes(TextureAsset& asset, std::int64_t bytes)
+{
+    asset.gpuBytes += bytes;
+    textureBytes += bytes;
+    arp::trackGpuMemory(arp::GPU_MEMORY_APP, bytes);
+}
+
+/**
+ * Uploads the levels first to last, not including last, of a baked texture
+ * into the bound texture from one staging copy
+ */
+static arp::UploadHandle uploadBakedLevels(const MappedDds& baked, int first, int last, arp::UploadRing* ring)
+{
+    std::size_t start = levelsSize(baked, 0, first);
+    StagedData staged = stageData(ring, baked.levels() + start, levelsSize(baked, first, last));
+
+    std::size_t offset = 0;
+    for(int i = first; i < last; i++) {
+        int width = levelWidth(baked, i);
+        int height = levelHeight(baked, i);
+        std::size_t size = textureLevelSize(baked.format(), width, height);
+        if(baked.format() == TEXTURE_RGBA8) {
+            glTexImage2D(GL_TEXTURE_2D, i, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, staged.pointer(offset));
+        } else {
+            GLenum format = baked.format() == TEXTURE_BC1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+            glCompressedTexImage2D(GL_TEXTURE_2D, i, format, width, height, 0, (GLsizei)size, staged.pointer(offset));
+        }
+        offset += size;
+    }
+    return finishStaged(staged);
+}
+
+/**
+ * Level a baked texture starts with: every level while streaming is off,
+ * otherwise the coarse ones
+ */
+static int streamStartLevel(const MappedDds& baked)
+{
+    if(!textureStreaming)
+        return 0;
+    int level = 0;
+    while(level < baked.levelCount() - 1
+          && std::max(levelWidth(baked, level), levelHeight(baked, level)) > STREAM_START_SIZE)
+        level++;
+    return level;
+}
+
+/**
+ * Uploads the levels of a baked texture it starts with
+ */
+static arp::UploadHandle uploadBakedTexture(TextureAsset& asset, const MappedDds& baked, arp::UploadRing* ring)
+{
+    int first = streamStartLevel(baked);
+    asset.texture.Initialize();
+    arp::UploadHandle upload = uploadBakedLevels(baked, first, baked.levelCount(), ring);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, first);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, baked.levelCount() - 1);
+    asset.levelCount = baked.levelCount();
+    asset.residentLevel = first;
+    asset.wantedLevel = first;
+    asset.prefetchLevel = first;
+    addTextureBytes(asset, (std::int64_t)levelsSize(baked, first, baked.levelCount()));
+    return upload;
+}
+
+/**
+ * Uploads the image from a staging copy, so the driver can copy it to the
+ * texture without blocking the caller, and builds mipmaps. Baked textures
+ * bring their own. ring is the upload thread's, null on the app thread
+ */
+static arp::UploadHandle uploadTexture(TextureAsset& asset, const TextureSource& source, arp::UploadRing* ring)
+{
+    // on the app thread this binds textures behind the cache's back
+    if(!ring)
+        arp::glState().invalidateTextures();
+    if(source.isBaked)
+        return uploadBakedTexture(asset, source.baked, ring);
+
+    const DecodedImage& image = source.image;
+    StagedData staged = stageData(ring, image.pixels.get(), (std::size_t)image.width * image.height * image.numChannels);
+
+    // with a pixel unpack buffer bound the data pointer is an offset into it
+    asset.texture.Initialize();
+    asset.texture.SetImage( (const unsigned char*)staged.pointer(), image.numChannels, image.width, image.height );
+    asset.texture.BuildMipmaps();
+    // rgba8 with a third more for the mipmaps
+    addTextureBytes(asset, (std::int64_t)image.width * image.height * 4 * 4 / 3);
+
+    return finishStaged(staged);
+}
+
+/**
+ * Bytes uploadTexture stages for the texture
+ */
+static std::size_t textureUploadSize(const TextureSource& source)
+{
+    if(source.isBaked)
+        return levelsSize(source.baked, streamStartLevel(source.baked), source.baked.levelCount());
+    const DecodedImage& image = source.image;
+    return (std::size_t)image.width * image.height * image.numChannels;
+}
+
+/**
+ * Returns the cached texture for the image file, loading it if needed. Safe
+ * to call from loader workers
+ */
+static std::shared_ptr<TextureAsset> getTexture(const char* fileName)
+{
+    std::shared_ptr<TextureAsset> asset;
+    {
+        std::lock_guard<std::mutex> lock(textureCacheMutex);
+        asset = textureCache[fileName].lock();
+        if(asset)
+            return asset;
+        asset = std::make_shared<TextureAsset>();
+        textureCache[fileName] = asset;
+    }
+
+    if(loader.active) {
+        pendingAssets++;
+        std::string name = fileName;
+        loader.enqueueWork([asset, name]() {
+            std::shared_ptr<TextureSource> source = std::make_shared<TextureSource>();
+            bool success = loadTextureSource(name, *source);
+            std::size_t bytes = success ? textureUploadSize(*source) : 0;
+            loader.enqueueUpload([asset, source, success]() {
+                arp::UploadHandle upload = 0;
+                if(success)
+                    upload = uploadTexture(*asset, *source, &loader.ring);
+                if(success && asset->residentLevel > 0)
+                    asset->source = source;
+                completeUpload(nullptr, asset, success, upload);
+            }, bytes, UPLOAD_PRIORITY_ASSET);
+        });
+        return asset;
+    }
+
+    std::shared_ptr<TextureSource> source = std::make_shared<TextureSource>();
+    if(!loadTextureSource(fileName, *source)) {
+        std::lock_guard<std::mutex> lock(textureCacheMutex);
+        textureCache.erase(fileName);
+        return nullptr;
+    }
+    uploadTexture(*asset, *source, nullptr);
+    if(asset->residentLevel > 0) {
+        asset->source = source;
+        streamedTextures.push_back(asset);
+    }
+    asset->state = ASSET_READY;
+    return asset;
+}
+
+/**
+ * Uploads the levels of a texture from level down to the ones it has. On
+ * the upload thread with its ring, on the app thread without
+ */
+static arp::UploadHandle uploadStreamedLevels(TextureAsset& asset, int level, int resident, arp::UploadRing* ring)
+{
+    glBindTexture(GL_TEXTURE_2D, asset.texture.GetID());
+    return uploadBakedLevels(asset.source->baked, level, resident, ring);
+}
+
+/**
+ * Has the texture sample the levels from level on, once they're uploaded.
+ * App thread only
+ */
+static void showStreamedLevels(TextureAsset& asset, int level)
+{
+    arp::glState().bindTexture(0, GL_TEXTURE_2D, asset.texture.GetID());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+    addTextureBytes(asset, asset.streamingBytes);
+    asset.residentLevel = level;
+    asset.streamingBytes = 0;
+}
+
+/**
+ * Starts uploading a texture's levels from level down to the ones it has
+ */
+static void streamIn(const std::shared_ptr<TextureAsset>& asset, int level, std::int64_t bytes)
+{
+    asset->streamingBytes = bytes;
+    int resident = asset->residentLevel;
+    if(loader.active) {
+        loader.enqueueUpload([asset, level, resident]() {
+            arp::UploadHandle upload = uploadStreamedLevels(*asset, level, resident, &loader.ring);
+            completeUpload(nullptr, asset, true, upload, level);
+        }, (std::size_t)bytes, resident - level);
+        return;
+    }
+    // this binds textures behind the cache's back
+    arp::glState().invalidateTextures();
+    uploadStreamedLevels(*asset, level, resident, nullptr);
+    showStreamedLevels(*asset, level);
+}
+
+/**
+ * Drops a texture's finest level. A level of size 0 frees its storage
+ */
+static void evictLevel(TextureAsset& asset)
+{
+    const MappedDds& baked = asset.source->baked;
+    int level = asset.residentLevel;
+    arp::glState().bindTexture(0, GL_TEXTURE_2D, asset.texture.GetID());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level + 1);
+    glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    addTextureBytes(asset, -(std::int64_t)levelsSize(baked, level, level + 1));
+    asset.residentLevel = level + 1;
+}
+
+/**
+ * Asks for a level of the mesh's texture fine enough for an object with
+ * the given world space bounds, seen from camera with pixelsPerUnit pixels
+ * per unit at distance 1. The texture is taken to span the object's
+ * largest side once, as the demo's assets do. A prefetch only asks for
+ * the level once draws have what they want
+ */
+static void requestTextureLevel(const MeshAsset& mesh, const arp::AABB& bounds, const glm::vec3& camera,
+                                float pixelsPerUnit, bool prefetch = false)
+{
+    TextureAsset* texture = mesh.texture.get();
+    if(!texture || texture->state != ASSET_READY || !texture->source)
+        return;
+    const MappedDds& baked = texture->source->baked;
+    float distance = glm::length(glm::clamp(camera, bounds.min, bounds.max) - camera);
+    glm::vec3 extent = bounds.max - bounds.min;
+    float side = std::max(std::max(extent.x, extent.y), extent.z);
+    int level = 0;
+    // inside the bounds the object may cover the whole view
+    if(distance > 0) {
+        float pixels = side * pixelsPerUnit / distance;
+        float texels = (float)std::max(baked.width(), baked.height());
+        if(pixels < texels)
+            level = pixels > 0 ? (int)std::log2(texels / pixels) : texture->levelCount - 1;
     }
+    level = std::min(level, texture->levelCount - 1);
+    if(prefetch) {
+        texture->prefetchLevel = std::min(texture->prefetchLevel, level);
+        return;
+    }
+    texture->wantedLevel = std::min(texture->wantedLevel, level);
+    texture->lastWanted = streamFrame;
+}
+
+/**
+ * Streams finer levels of the textures draws asked for since the last
+ * call, and drops levels of the textures not needed as fine, least recently
+ * needed first, to make room within the budget. Prefetched levels stream
+ * last, only into room the budget has without dropping anything
+ */
+static void updateStreaming()
+{
+    std::vector<std::shared_ptr<TextureAsset>> textures;
+    std::vector<std::weak_ptr<TextureAsset>> alive;
+    for(const std::weak_ptr<TextureAsset>& weak : streamedTextures) {
+        std::shared_ptr<TextureAsset> texture = weak.lock();
+        if(!texture)
+            continue;
+        textures.push_back(texture);
+        alive.push_back(weak);
+    }
+    streamedTextures.swap(alive);
+
+    // finer levels than wanted, the least recently wanted first
+    std::vector<TextureAsset*> evictable;
+    // coarser levels than wanted, the furthest off first
+    std::vector<std::shared_ptr<TextureAsset>> wanting;
+    // coarser levels than prefetched, though as fine as draws want
+    std::vector<std::shared_ptr<TextureAsset>> prefetching;
+    std::int64_t streaming = 0;
+    for(const std::shared_ptr<TextureAsset>& texture : textures) {
+        streaming += texture->streamingBytes;
+        if(texture->streamingBytes)
+            continue;
+        if(texture->residentLevel < texture->wantedLevel && texture->residentLevel < texture->levelCount - 1)
+            evictable.push_back(texture.get());
+        if(texture->wantedLevel < texture->residentLevel)
+            wanting.push_back(texture);
+        else if(texture->prefetchLevel < texture->residentLevel)
+            prefetching.push_back(texture);
+    }
+    // levels still prefetched go after every other
+    std::sort(evictable.begin(), evictable.end(), [](const TextureAsset* a, const TextureAsset* b) {
+        bool aPrefetched = a->residentLevel >= a->prefetchLevel;
+        bool bPrefetched = b->residentLevel >= b->prefetchLevel;
+        if(aPrefetched != bPrefetched)
+            return bPrefetched;
+        return a->lastWanted < b->lastWanted;
+    });
+    std::sort(wanting.begin(), wanting.end(), [](const std::shared_ptr<TextureAsset>& a,
+                                                 const std::shared_ptr<TextureAsset>& b) {
+        return a->residentLevel - a->wantedLevel > b->residentLevel - b->wantedLevel;
+    });
+
+    std::int64_t budget = textureBudget;
+    std::size_t nextEvicted = 0;
+    // frees levels until bytes more fit, returns false if they can't
+    auto makeRoom = [&](std::int64_t bytes) {
+        if(budget <= 0)
+            return true;
+        while(textureBytes + streaming + bytes > budget && nextEvicted < evictable.size()) {
+            TextureAsset& texture = *evictable[nextEvicted];
+            evictLevel(texture);
+            if(texture.residentLevel >= texture.wantedLevel || texture.residentLevel >= texture.levelCount - 1)
+                nextEvicted++;
+        }
+        return textureBytes + streaming + bytes <= budget;
+    };
+    makeRoom(0);
+
+    std::int64_t started = 0;
+    for(const std::shared_ptr<TextureAsset>& texture : wanting) {
+        if(started >= STREAM_BYTES_PER_FRAME)
+            break;
+        const MappedDds& baked = texture->source->baked;
+        // the finest level wanted that fits
+        for(int level = texture->wantedLevel; level < texture->residentLevel; level++) {
+            std::int64_t bytes = (std::int64_t)levelsSize(baked, level, texture->residentLevel);
+            if(!makeRoom(bytes))
+                continue;
+            streamIn(texture, level, bytes);
+            if(texture->streamingBytes)
+                streaming += bytes;
+            started += bytes;
+            break;
+        }
+    }
+
+    // the furthest off first, like the levels draws want
+    std::sort(prefetching.begin(), prefetching.end(), [](const std::shared_ptr<TextureAsset>& a,
+                                                         const std::shared_ptr<TextureAsset>& b) {
+        return a->residentLevel - a->prefetchLevel > b->residentLevel - b->prefetchLevel;
+    });
+    for(const std::shared_ptr<TextureAsset>& texture : prefetching) {
+        if(started >= STREAM_BYTES_PER_FRAME)
+            break;
+        const MappedDds& baked = texture->source->baked;
+        for(int level = texture->prefetchLevel; level < texture->residentLevel; level++) {
+            std::int64_t bytes = (std::int64_t)levelsSize(baked, level, texture->residentLevel);
+            if(budget > 0 && textureBytes + streaming + bytes > budget)
+                continue;
+            streamIn(texture, level, bytes);
+            if(texture->streamingBytes)
+                streaming += bytes;
+            started += bytes;
+            break;
+        }
+    }
+
+    for(const std::shared_ptr<TextureAsset>& texture : textures) {
+        texture->wantedLevel = texture->levelCount - 1;
+        texture->prefetchLevel = texture->levelCount - 1;
+    }
+    streamFrame++;
+}
+
+/**
+ * CPU side of a mesh, either parsed from an OBJ or mapped from an .arpmesh
+ */
+struct MeshSource {
+    MeshData data;
+    std::vector<PackedMeshVertex> packedVertices;
+    std::vector<unsigned char> packedIndices;
+    MappedArpMesh mapped;
+
+    const PackedMeshVertex* vertices = nullptr;
+    std::uint32_t vertexCount = 0;
+    const void* indices = nullptr;
+    std::uint32_t indexCount = 0;
+    std::uint32_t indexSize = 4;
+    std::vector<ArpMeshLod> lods;
+    std::vector<ArpMeshMeshlet> meshlets;
+    std::string diffuseMap;
+    arp::AABB bounds;
+};
+
+/**
+ * Maps the baked mesh for the file, or parses, indexes and simplifies the
+ * OBJ if there is none. Doesn't touch GL, so it can run on loader workers
+ */
+static bool loadMeshSource(const std::string& fileName, MeshSource& source)
+{
+    const unsigned char* packed;
+    std::size_t packedSize;
+    bool mapped;
+    if(findPacked(fileName, ".arpmesh", packed, packedSize)) {
+        mapped = source.mapped.open(fileName.c_str(), packed, packedSize);
+    } else {
+        std::string baked = bakedPath(fileName, ".arpmesh");
+        mapped = !baked.empty() && source.mapped.open(baked.c_str());
+    }
+    if(mapped) {
+        const ArpMeshHeader& header = source.mapped.header();
+        source.vertices = source.mapped.vertices();
+        source.vertexCount = header.vertexCount;
+        source.indices = source.mapped.indices();
+        source.indexCount = header.indexCount;
+        source.indexSize = header.indexSize;
+        source.lods.assign(source.mapped.lods(), source.mapped.lods() + header.lodCount);
+        source.meshlets.assign(source.mapped.meshlets(), source.mapped.meshlets() + header.meshletCount);
+        if(header.materialCount > 0)
+            source.diffuseMap = source.mapped.materials()[0].diffuseMap;
+        source.bounds = { glm::make_vec3(header.boundsMin), glm::make_vec3(header.boundsMax) };
+        return true;
+    }
+
+    cy::TriMesh mesh;
+    bool success = loadObj(fileName.c_str(), mesh);
+    if(!success)
+        return false;
+
+    MeshData& data = source.data;
+    buildMeshData(mesh, data);
+    buildMeshLods(data);
+    buildMeshlets(data);
+    source.indexSize = packIndices(data.indices, data.vertices.size(), source.packedIndices);
+    packVertices(data, source.packedVertices);
+    source.vertices = source.packedVertices.data();
+    source.vertexCount = source.packedVertices.size();
+    source.indices = source.packedIndices.data();
+    source.indexCount = data.indices.size();
+    source.lods = data.lods;
+    source.meshlets = data.meshlets;
+    if(!data.materials.empty())
+        source.diffuseMap = data.materials[0].diffuseMap;
+    source.bounds = { glm::make_vec3(data.boundsMin), glm::make_vec3(data.boundsMax) };
+    return true;
+}
+
+/**
+ * Uploads an interleaved vertex buffer and an index buffer of 16 or 32 bit
+ * indices into the asset. Buffers are shared between contexts, so this can
+ * run on the upload thread
+ */
+static arp::UploadHandle uploadMesh(MeshAsset& asset, const MeshSource& source, arp::UploadRing* ring)
+{
+    asset.vertexCount = source.vertexCount;
+    asset.indexCount = source.indexCount;
+    asset.indexType = source.indexSize == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    asset.lods = source.lods;
+    asset.meshlets = source.meshlets;
+    asset.bounds = source.bounds;
+    std::size_t vertexSize = sizeof(PackedMeshVertex) * source.vertexCount;
+    std::size_t indexSize = (std::size_t)source.indexSize * source.indexCount;
+
+    /* Create the vertex, index and instance buffers, filled from the ring if there is one */
+    asset.buffer = arp::GLBuffer::create();
+    glBindBuffer( GL_ARRAY_BUFFER, asset.buffer.get());
+    glBufferData( GL_ARRAY_BUFFER, vertexSize, ring ? nullptr : source.vertices, GL_STATIC_DRAW);
+    asset.indexBuffer = arp::GLBuffer::create();
+    glBindBuffer( GL_ARRAY_BUFFER, asset.indexBuffer.get());
+    glBufferData( GL_ARRAY_BUFFER, indexSize, ring ? nullptr : source.indices, GL_STATIC_DRAW);
+    asset.instanceBuffer = arp::GLBuffer::create();
+    glBindBuffer( GL_ARRAY_BUFFER, 0);
+    asset.gpuBytes = (std::int64_t)(vertexSize + indexSize);
+    arp::trackGpuMemory(arp::GPU_MEMORY_APP, asset.gpuBytes);
 
-    /* Create a vertex array object from the .obj data */
-    glGenVertexArrays( 1, &vao);
-    glBindVertexArray( vao );
+    if(!ring)
+        return 0;
+    // uploads complete in order, so the last one covers both
+    ring->uploadBuffer(asset.buffer.get(), 0, source.vertices, vertexSize);
+    return ring->uploadBuffer(asset.indexBuffer.get(), 0, source.indices, indexSize);
+}
+
+/**
+ * Per-instance matrices, one column per attribute location
+ */
+struct InstanceMatrix {
+    GLint MeshAsset::*location;
+    int columns;
+    int rows;
+    std::size_t offset;
+};
 
-    /* Compile the shaders */
-    prog.BuildFiles( "shader4.vert", "shader4.frag" );
-    prog.Bind();
+static const InstanceMatrix INSTANCE_MATRICES[] = {
+    { &MeshAsset::modelLocation, 4, 4, offsetof(InstanceData, model) },
+    { &MeshAsset::normalMatrixLocation, 3, 3, offsetof(InstanceData, normalMatrix) },
+};
 
-    /* Setup the texture */
-    cyGLTexture2D cyTex;
-    cyTex.Initialize();
-    cyTex.SetImage( imageData, numChannels, width, height );
-    cyTex.BuildMipmaps();
-    cyTex.Bind(0);
-    prog["tex"] = 0;
-    stbi_image_free(imageData);
+/**
+ * Points the per-instance attributes of the bound VAO at instances starting
+ * at offset in buffer. generation tells apart arena buffers reusing a name
+ */
+static void pointInstances(MeshAsset& asset, GLuint buffer, std::size_t offset, int generation)
+{
+    if(asset.instanceSource == buffer && asset.instanceOffset == offset && asset.instanceGeneration == generation)
+        return;
+    asset.instanceSource = buffer;
+    asset.instanceOffset = offset;
+    asset.instanceGeneration = generation;
 
-    /* Create a vertex buffer object from the .obj data */
-    glGenBuffers( 1, &buffer);
     glBindBuffer( GL_ARRAY_BUFFER, buffer);
-    glBufferData( GL_ARRAY_BUFFER, sizeof(cy::Vec3f) * vertexData.size(), vertexData.data(), GL_STATIC_DRAW);
+    for(const InstanceMatrix& matrix : INSTANCE_MATRICES) {
+        GLint location = asset.*matrix.location;
+        if(location < 0)
+            continue;
+        for(int column = 0; column < matrix.columns; column++) {
+            std::size_t attribOffset = offset + matrix.offset + sizeof(float) * matrix.rows * column;
+            glVertexAttribPointer(location + column, matrix.rows, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (GLvoid*) attribOffset);
+        }
+    }
+}
 
-    /* Connect the buffer to the vertex shader */
-    pos = glGetAttribLocation( prog.GetID(), "pos" );
-    glEnableVertexAttribArray( pos );
-    glVertexAttribPointer(
-         pos, 3, GL_FLOAT,
-         GL_FALSE, 0, (GLvoid*) 0);
+/**
+ * Creates the mesh's vertex array object. VAOs are not shared between
+ * contexts, so this has to run on the app thread
+ */
+static void createVertexArray(MeshAsset& asset)
+{
+    cy::GLSLProgram* program = asset.program;
 
-    /* Create a normal Buffer */
-    glGenBuffers( 1, &normalBuffer);
-    glBindBuffer( GL_ARRAY_BUFFER, normalBuffer);
-    glBufferData( GL_ARRAY_BUFFER, sizeof(cy::Vec3f) * normalData.size(), normalData.data(), GL_STATIC_DRAW);
+    /* Create a vertex array object for the mesh */
+    asset.vao = arp::GLVertexArray::create();
+    arp::glState().bindVertexArray( asset.vao.get() );
+    glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, asset.indexBuffer.get());
 
-    /* Connect the normal buffer to the vertex shader */
-    norm = glGetAttribLocation( prog.GetID(), "norm" );
+    /* Connect the packed attributes to the vertex shader, which decodes them. The VAO keeps them */
+    glBindBuffer( GL_ARRAY_BUFFER, asset.buffer.get());
+    GLuint pos = glGetAttribLocation( program->GetID(), "pos" );
+    glEnableVertexAttribArray( pos );
+    glVertexAttribPointer(pos, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedMeshVertex), (GLvoid*) offsetof(PackedMeshVertex, position));
+    GLuint norm = glGetAttribLocation( program->GetID(), "norm" );
     glEnableVertexAttribArray( norm );
-    glVertexAttribPointer(
-         norm, 3, GL_FLOAT,
-         GL_FALSE, 0, (GLvoid*) 0);
+    glVertexAttribPointer(norm, 2, GL_SHORT, GL_TRUE, sizeof(PackedMeshVertex), (GLvoid*) offsetof(PackedMeshVertex, normal));
+    GLuint txc = glGetAttribLocation( program->GetID(), "txc" );
+    glEnableVertexAttribArray( txc );
+    glVertexAttribPointer(txc, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedMeshVertex), (GLvoid*) offsetof(PackedMeshVertex, uv));
 
-    /* Create a texture Buffer */
-    glGenBuffers( 1, &txcBuffer);
-    glBindBuffer( GL_ARRAY_BUFFER, txcBuffer);
-    glBufferData( GL_ARRAY_BUFFER, sizeof(cy::Vec3f) * textureData.size(), textureData.data(), GL_STATIC_DRAW);
+    /* Connect the per-instance matrices, one column per attribute location */
+    asset.modelLocation = glGetAttribLocation( program->GetID(), "model" );
+    asset.normalMatrixLocation = glGetAttribLocation( program->GetID(), "normalMatrix" );
+    for(const InstanceMatrix& matrix : INSTANCE_MATRICES) {
+        GLint location = asset.*matrix.location;
+        if(location < 0)
+            continue;
+        for(int column = 0; column < matrix.columns; column++) {
+            glEnableVertexAttribArray( location + column );
+            glVertexAttribDivisor( location + column, 1 );
+        }
+    }
+    pointInstances(asset, asset.instanceBuffer.get(), 0, 0);
+}
+
+/**
+ * Returns true once the mesh can be drawn. A texture that failed to load
+ * doesn't hold the mesh back
+ */
+static bool meshReady(const MeshAsset& mesh)
+{
+    return mesh.state == ASSET_READY && (!mesh.texture || mesh.texture->state != ASSET_LOADING);
+}
+
+/**
+ * Lists the lights reaching each cluster of a layer drawn into the bound
+ * viewport, uploads the lists and fills in the uniforms locating them.
+ * projection has default depth. A light's clusters are those its sphere's
+ * box covers on screen, or all tiles when it reaches past the near plane
+ */
+static void buildLightClusters(const std::vector<PointLight>& lights, const glm::mat4& view,
+                               const glm::mat4& projection, CameraUniforms& uniforms)
+{
+    LightClusters& clusters = lightClusters;
+    float nearPlane = projection[3][2] / (projection[2][2] - 1);
+    float farPlane = projection[3][2] / (projection[2][2] + 1);
+    float sliceScale = CLUSTER_SLICES / std::log(farPlane / nearPlane);
+    auto slice = [&](float distance) {
+        return std::min(std::max((int)(std::log(distance / nearPlane) * sliceScale), 0), CLUSTER_SLICES - 1);
+    };
+    auto tile = [](float ndc, int tiles) {
+        return std::min(std::max((int)std::floor((ndc * 0.5f + 0.5f) * tiles), 0), tiles - 1);
+    };
+
+    const int clusterCount = CLUSTER_TILES_X * CLUSTER_TILES_Y * CLUSTER_SLICES;
+    clusters.lights.clear();
+    clusters.first.clear();
+    clusters.last.clear();
+    clusters.ranges.assign(clusterCount * 2, 0);
+    for(const PointLight& light : lights) {
+        glm::vec3 center = glm::vec3(view * glm::vec4(light.position, 1));
+        float nearest = -center.z - light.radius;
+        float farthest = -center.z + light.radius;
+        if(farthest <= nearPlane || nearest >= farPlane)
+            continue;
+        glm::vec2 lo(-1), hi(1);
+        if(nearest > nearPlane) {
+            lo = glm::vec2(INFINITY);
+            hi = glm::vec2(-INFINITY);
+            for(int corner = 0; corner < 8; corner++) {
+                glm::vec3 offset(corner & 1 ? 1 : -1, corner & 2 ? 1 : -1, corner & 4 ? 1 : -1);
+                glm::vec4 clip = projection * glm::vec4(center + offset * light.radius, 1);
+                lo = glm::min(lo, glm::vec2(clip) / clip.w);
+                hi = glm::max(hi, glm::vec2(clip) / clip.w);
+            }
+            if(lo.x >= 1 || lo.y >= 1 || hi.x <= -1 || hi.y <= -1)
+                continue;
+        }
+        glm::ivec3 first(tile(lo.x, CLUSTER_TILES_X), tile(lo.y, CLUSTER_TILES_Y),
+                         slice(std::max(nearest, nearPlane)));
+        glm::ivec3 last(tile(hi.x, CLUSTER_TILES_X), tile(hi.y, CLUSTER_TILES_Y), slice(std::min(farthest, farPlane)));
+        clusters.lights.push_back(glm::vec4(center, light.radius));
+        clusters.lights.push_back(glm::vec4(light.color, 0));
+        clusters.first.push_back(first);
+        clusters.last.push_back(last);
+        for(int z = first.z; z <= last.z; z++)
+            for(int y = first.y; y <= last.y; y++)
+                for(int x = first.x; x <= last.x; x++)
+                    clusters.ranges[((z * CLUSTER_TILES_Y + y) * CLUSTER_TILES_X + x) * 2 + 1]++;
+    }
+
+    // offsets from the counts, which then count the indices written
+    GLuint offset = 0;
+    for(int i = 0; i < clusterCount; i++) {
+        clusters.ranges[i * 2] = offset;
+        offset += clusters.ranges[i * 2 + 1];
+        clusters.ranges[i * 2 + 1] = 0;
+    }
+    clusters.indices.resize(offset);
+    for(std::size_t light = 0; light < clusters.first.size(); light++) {
+        glm::ivec3 first = clusters.first[light];
+        glm::ivec3 last = clusters.last[light];
+        for(int z = first.z; z <= last.z; z++) {
+            for(int y = first.y; y <= last.y; y++) {
+                for(int x = first.x; x <= last.x; x++) {
+                    GLuint* range = &clusters.ranges[((z * CLUSTER_TILES_Y + y) * CLUSTER_TILES_X + x) * 2];
+                    clusters.indices[range[0] + range[1]++] = light;
+                }
+            }
+        }
+    }
+
+    static const GLenum formats[3] = { GL_RGBA32F, GL_RG32UI, GL_R32UI };
+    const void* data[3] = { clusters.lights.data(), clusters.ranges.data(), clusters.indices.data() };
+    std::size_t sizes[3] = { clusters.lights.size() * sizeof(glm::vec4), clusters.ranges.size() * sizeof(GLuint),
+                             clusters.indices.size() * sizeof(GLuint) };
+    for(int i = 0; i < 3; i++) {
+        bool created = !clusters.buffers[i];
+        if(created) {
+            clusters.buffers[i] = arp::GLBuffer::create();
+            clusters.textures[i] = arp::GLTexture::create();
+        }
+        // orphaned, so the earlier layer's draws keep theirs
+        glBindBuffer(GL_TEXTURE_BUFFER, clusters.buffers[i].get());
+        glBufferData(GL_TEXTURE_BUFFER, sizes[i], data[i], GL_STREAM_DRAW);
+        arp::glState().bindTexture(LIGHTS_UNIT + i, GL_TEXTURE_BUFFER, clusters.textures[i].get());
+        if(created)
+            glTexBuffer(GL_TEXTURE_BUFFER, formats[i], clusters.buffers[i].get());
+    }
+
+    GLint viewport[4];
+    if(!arp::glState().getViewport(viewport))
+        glGetIntegerv(GL_VIEWPORT, viewport);
+    for(int i = 0; i < 4; i++)
+        uniforms.clusterViewport[i] = viewport[i];
+    uniforms.clusterDepth[0] = nearPlane;
+    uniforms.clusterDepth[1] = sliceScale;
+    uniforms.clusterGrid[0] = CLUSTER_TILES_X;
+    uniforms.clusterGrid[1] = CLUSTER_TILES_Y;
+    uniforms.clusterGrid[2] = CLUSTER_SLICES;
+    uniforms.clusterGrid[3] = clusters.first.size();
+}
+
+/**
+ * Sets the camera used by the following draws, and the clusters of lights
+ * when there are any
+ */
+static void setCamera(const glm::mat4& view, const glm::mat4& cullProjection,
+                      const std::vector<PointLight>* lights = nullptr)
+{
+    // culling and levels of detail keep the default depth, only the draws
+    // are reversed: z' = (w - z) / 2 takes depth d to 1 - d
+    glm::mat4 projection = cullProjection;
+    if(reversedZ) {
+        glm::mat4 reverse(1);
+        reverse[2][2] = -0.5f;
+        reverse[3][2] = 0.5f;
+        projection = reverse * projection;
+    }
+    CameraUniforms uniforms = {};
+    if(lights && !lights->empty())
+        buildLightClusters(*lights, view, cullProjection, uniforms);
+    glm::mat4 viewProjection = projection * view;
+    memcpy(uniforms.view, &view[0][0], sizeof(uniforms.view));
+    memcpy(uniforms.projection, &projection[0][0], sizeof(uniforms.projection));
+    memcpy(uniforms.viewProjection, &viewProjection[0][0], sizeof(uniforms.viewProjection));
+
+    static GLint alignment = 0;
+    if(!alignment)
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    std::size_t offset;
+    if(frameArena.write(&uniforms, sizeof(uniforms), alignment, offset)) {
+        glBindBufferRange(GL_UNIFORM_BUFFER, CAMERA_UNIFORMS_BINDING, frameArena.getBuffer(), offset, sizeof(uniforms));
+        return;
+    }
+
+    if(!cameraUniformBuffer)
+        glGenBuffers(1, &cameraUniformBuffer);
+
+    // orphan the previous contents so the earlier layer's draws keep theirs
+    glBindBuffer(GL_UNIFORM_BUFFER, cameraUniformBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(uniforms), &uniforms, GL_STREAM_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, CAMERA_UNIFORMS_BINDING, cameraUniformBuffer);
+}
+
+/**
+ * Returns the view matrix of a camera at the pose
+ */
+static glm::mat4 viewMatrix(const arp::Pose& pose)
+{
+    glm::mat4 camera = glm::translate(glm::mat4(1), pose.position) * glm::mat4(pose.orientation);
+    return glm::inverse(camera);
+}
+
+static glm::mat4 projectionMatrix(double aspectRatio, double fovY)
+{
+    return glm::perspective((float)fovY, (float)aspectRatio, 0.1f, 100.f);
+}
+
+// pixels a level of detail's error may cover, see setLodThreshold
+static std::atomic<float> lodThreshold{ 1.f };
+
+/**
+ * Height of the bound viewport, which is what draw renders into
+ */
+static int viewportHeight()
+{
+    GLint viewport[4];
+    if(!arp::glState().getViewport(viewport))
+        glGetIntegerv(GL_VIEWPORT, viewport);
+    return viewport[3];
+}
+
+/**
+ * Vertical pixels per unit at distance 1
+ */
+static float pixelsPerUnit(const glm::mat4& projection, int height)
+{
+    return projection[1][1] * height * 0.5f;
+}
+
+/**
+ * Scale from an error at some distance to the share of the threshold it
+ * covers: a level is fine when error * scale <= distance. Vertical pixels
+ * per unit at distance 1, over the threshold
+ */
+static float lodScale(const glm::mat4& projection, int height)
+{
+    float threshold = lodThreshold;
+    if(threshold <= 0)
+        return std::numeric_limits<float>::max();
+    return pixelsPerUnit(projection, height) / threshold;
+}
+
+/**
+ * Coarsest level of detail of the mesh fine enough for an object with the
+ * given world space bounds, seen from camera. The distance is to the
+ * nearest point of the bounds, so large objects aren't coarsened up close
+ */
+static int selectLod(const MeshAsset& mesh, const arp::AABB& bounds, const glm::vec3& camera, float scale)
+{
+    float distance = glm::length(glm::clamp(camera, bounds.min, bounds.max) - camera);
+    int lod = 0;
+    for(int i = 1; i < (int)mesh.lods.size(); i++) {
+        if(mesh.lods[i].error * scale <= distance)
+            lod = i;
+    }
+    return lod;
+}
+
+/**
+ * Whether draws sample the texture through a bindless handle instead of
+ * binding it
+ */
+static bool usesBindless(const TextureAsset& texture)
+{
+    return bindlessEnabled && GLEW_ARB_bindless_texture && texture.state == ASSET_READY && !texture.source;
+}
+
+/**
+ * Sort key of a draw, ordering draws by the state they bind and then front
+ * to back:
+ *
+ *   bits 48-63  program
+ *   bits 32-47  texture, 0 for bindless ones
+ *   bits 16-31  vertex array
+ *   bits 0-15   depth
+ *
+ * GL names are small integers, names past 16 bits only sort less well. The
+ * depth is the top bits of the float, which orders like the float for
+ * positive depths and is finer near the camera
+ */
+static std::uint64_t drawKey(const MeshAsset& mesh, const cy::GLSLProgram* program, float depth)
+{
+    GLuint texture = mesh.texture && mesh.texture->state == ASSET_READY && !usesBindless(*mesh.texture)
+                         ? mesh.texture->texture.GetID() : 0;
+    std::uint32_t depthBits;
+    depth = std::max(depth, 0.f);
+    memcpy(&depthBits, &depth, sizeof(depthBits));
+    return (std::uint64_t)(program->GetID() & 0xffff) << 48 | (std::uint64_t)(texture & 0xffff) << 32
+         | (std::uint64_t)(mesh.vao.get() & 0xffff) << 16 | depthBits >> 16;
+}
+
+/**
+ * Binds the program, VAO and texture of a mesh through the state cache, so
+ * binds matching the last draw's are skipped. Bindless textures are handed
+ * to the program as a handle, which binds nothing
+ */
+static void bindMesh(MeshAsset& mesh, cy::GLSLProgram* program)
+{
+    arp::GLStateCache& state = arp::glState();
+    state.useProgram(program->GetID());
+    state.bindVertexArray(mesh.vao.get());
+    ProgramUniforms& uniforms = programUniforms[program->GetID()];
+    // packed positions are quantized within the mesh's bounds
+    glm::vec3 extent = mesh.bounds.max - mesh.bounds.min;
+    if(uniforms.boundsMin != mesh.bounds.min || uniforms.boundsExtent != extent) {
+        glUniform3fv(uniforms.positionMin, 1, glm::value_ptr(mesh.bounds.min));
+        glUniform3fv(uniforms.positionExtent, 1, glm::value_ptr(extent));
+        uniforms.boundsMin = mesh.bounds.min;
+        uniforms.boundsExtent = extent;
+    }
+    // meshes without a ready texture sample whatever the last one bound
+    if(!mesh.texture || mesh.texture->state != ASSET_READY)
+        return;
+    TextureAsset& texture = *mesh.texture;
+    if(uniforms.texture != -1 && usesBindless(texture)) {
+        if(!texture.handle) {
+            texture.handle = glGetTextureHandleARB(texture.texture.GetID());
+            glMakeTextureHandleResidentARB(texture.handle);
+        }
+        if(uniforms.handle != texture.handle) {
+            glUniformHandleui64ARB(uniforms.texture, texture.handle);
+            uniforms.handle = texture.handle;
+        }
+        return;
+    }
+    if(uniforms.handle) {
+        glUniform1i(uniforms.texture, 0);
+        uniforms.handle = 0;
+    }
+    state.bindTexture(0, GL_TEXTURE_2D, texture.texture.GetID());
+}
+
+/**
+ * The program of the depth pre-pass, looked up once
+ */
+static cy::GLSLProgram* depthPrePassProgram()
+{
+    static cy::GLSLProgram* program = nullptr;
+    if(!program)
+        program = renderobject::getProgram("shader4.vert", "depth.frag");
+    return program;
+}
+
+/**
+ * Switches from the depth pre-pass, drawn without color, to the shading
+ * pass, which only shades the fragments that laid down the depth
+ */
+static void beginShadingPass()
+{
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDepthMask(GL_FALSE);
+    glDepthFunc(GL_EQUAL);
+}
+
+/**
+ * Restores the depth test the app draws with after the shading pass
+ */
+static void endShadingPass()
+{
+    glDepthMask(GL_TRUE);
+    glDepthFunc(reversedZ ? GL_GREATER : GL_LESS);
+}
+
+/**
+ * Byte offset of a level of detail's first index in the index buffer
+ */
+static GLvoid* lodIndexOffset(const MeshAsset& mesh, int lod)
+{
+    std::size_t indexSize = mesh.indexType == GL_UNSIGNED_SHORT ? 2 : 4;
+    return (GLvoid*)(mesh.lods[lod].firstIndex * indexSize);
+}
+
+/**
+ * Draws count instances of a level of detail of the mesh
+ */
+static void drawInstances(MeshAsset& mesh, cy::GLSLProgram* program, const InstanceData* instances, int count,
+                          int lod = 0)
+{
+    bindMesh(mesh, program);
+    GLsizei indexCount = mesh.lods[lod].indexCount;
+    GLvoid* indices = lodIndexOffset(mesh, lod);
+
+    std::size_t size = sizeof(InstanceData) * count;
+    std::size_t offset;
+    // with base instances the attributes keep pointing at the arena's start
+    bool baseInstance = GLEW_ARB_base_instance;
+    if(frameArena.write(instances, size, baseInstance ? sizeof(InstanceData) : sizeof(float), offset)) {
+        if(baseInstance) {
+            pointInstances(mesh, frameArena.getBuffer(), 0, frameArena.getGeneration());
+            glDrawElementsInstancedBaseInstance(GL_TRIANGLES, indexCount, mesh.indexType, indices, count,
+                                                offset / sizeof(InstanceData));
+            return;
+        }
+        pointInstances(mesh, frameArena.getBuffer(), offset, frameArena.getGeneration());
+    } else {
+        // orphan the previous contents so this never waits on an earlier draw
+        glBindBuffer(GL_ARRAY_BUFFER, mesh.instanceBuffer.get());
+        glBufferData(GL_ARRAY_BUFFER, size, instances, GL_STREAM_DRAW);
+        pointInstances(mesh, mesh.instanceBuffer.get(), 0, 0);
+    }
+    glDrawElementsInstanced(GL_TRIANGLES, indexCount, mesh.indexType, indices, count);
+}
+
+std::shared_ptr<MeshAsset> renderobject::getMesh(const char* fileName, cy::GLSLProgram* program)
+{
+    std::shared_ptr<MeshAsset> cached = meshCache[fileName].lock();
+    if(cached)
+        return cached;
+
+    std::shared_ptr<MeshAsset> asset = std::make_shared<MeshAsset>();
+    asset->program = program;
+    meshCache[fileName] = asset;
+
+    if(loader.active) {
+        pendingAssets++;
+        std::string name = fileName;
+        loader.enqueueWork([asset, name]() {
+            std::shared_ptr<MeshSource> source = std::make_shared<MeshSource>();
+            bool success = loadMeshSource(name, *source);
+            if(success && !source->diffuseMap.empty())
+                asset->texture = getTexture(source->diffuseMap.c_str());
+            std::size_t bytes = success ? (std::size_t)source->vertexCount * sizeof(PackedMeshVertex)
+                                              + (std::size_t)source->indexCount * source->indexSize : 0;
+            loader.enqueueUpload([asset, source, success]() {
+                arp::UploadHandle upload = 0;
+                if(success)
+                    upload = uploadMesh(*asset, *source, &loader.ring);
+                completeUpload(asset, nullptr, success, upload);
+            }, bytes, UPLOAD_PRIORITY_ASSET);
+        });
+        return asset;
+    }
+
+    MeshSource source;
+    if(!loadMeshSource(fileName, source)) {
+        meshCache.erase(fileName);
+        return nullptr;
+    }
+    if(!source.diffuseMap.empty())
+        asset->texture = getTexture(source.diffuseMap.c_str());
+    uploadMesh(*asset, source, nullptr);
+    createVertexArray(*asset);
+    asset->state = ASSET_READY;
+    return asset;
+}
+
+void renderobject::startAssetLoader(GLFWwindow* uploadContext, int threads)
+{
+    if(loader.active || !uploadContext)
+        return;
+
+    if(threads <= 0)
+        threads = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+    loader.start(uploadContext, threads);
+}
+
+void renderobject::stopAssetLoader()
+{
+    if(!loader.active)
+        return;
+
+    loader.stop();
+    // stopping the upload thread waited for its uploads, their fences are gone
+    std::lock_guard<std::mutex> lock(completedMutex);
+    completedUploads.clear();
+    pendingAssets = 0;
+    // levels that were streaming in are uploaded again if still wanted
+    for(const std::weak_ptr<TextureAsset>& weak : streamedTextures) {
+        std::shared_ptr<TextureAsset> texture = weak.lock();
+        if(texture)
+            texture->streamingBytes = 0;
+    }
+}
+
+void renderobject::pollAssets()
+{
+    std::vector<CompletedUpload> uploads;
+    {
+        std::lock_guard<std::mutex> lock(completedMutex);
+        if(completedUploads.empty())
+            return;
+        uploads.swap(completedUploads);
+    }
+
+    std::vector<CompletedUpload> waiting;
+    for(CompletedUpload& upload : uploads) {
+        if(!loader.ring.isComplete(upload.upload)) {
+            waiting.push_back(std::move(upload));
+            continue;
+        }
+
+        if(upload.streamLevel >= 0) {
+            showStreamedLevels(*upload.texture, upload.streamLevel);
+            continue;
+        }
+        AssetState state = upload.success ? ASSET_READY : ASSET_FAILED;
+        if(upload.texture && upload.texture->source)
+            streamedTextures.push_back(upload.texture);
+        if(upload.mesh) {
+            if(upload.success)
+                createVertexArray(*upload.mesh);
+            upload.mesh->state = state;
+        }
+        if(upload.texture)
+            upload.texture->state = state;
+        pendingAssets--;
+    }
+
+    if(!waiting.empty()) {
+        std::lock_guard<std::mutex> lock(completedMutex);
+        completedUploads.insert(completedUploads.end(), waiting.begin(), waiting.end());
+    }
+}
+
+void renderobject::beginFrame()
+{
+    if(!frameArena.isInitialized())
+        frameArena.initialize(FRAME_ARENA_REGION_SIZE);
+    frameArena.beginFrame();
+    pollAssets();
+    if(loader.active) {
+        int framerate = arp::getTargetFramerate();
+        loader.beginSlice(framerate > 0 ? uploadBudget / framerate : 0);
+    }
+    updateStreaming();
+}
+
+void renderobject::setTextureStreaming(bool enabled)
+{
+    textureStreaming = enabled;
+}
+
+void renderobject::setTextureBudget(std::int64_t bytes)
+{
+    textureBudget = std::max<std::int64_t>(bytes, 0);
+}
+
+void renderobject::setUploadBudget(double fraction)
+{
+    uploadBudget = std::max(fraction, 0.0);
+}
+
+std::int64_t renderobject::getTextureBytes()
+{
+    return textureBytes;
+}
+
+int renderobject::getPendingAssets()
+{
+    return pendingAssets;
+}
+
+bool renderobject::isLoaded() const
+{
+    return mesh && meshReady(*mesh);
+}
+
+void renderobject::updateMatrices(arp::Pose pose, double aspectRatio, double fovY)
+{
+    view = viewMatrix(pose);
+    projection = projectionMatrix(aspectRatio, fovY);
+}
+
+void renderobject::render()
+{
+    pollAssets();
+    if(!isLoaded())
+        return;
+
+    setCamera(view, projection);
+    requestTextureLevel(*mesh, getBounds(), glm::inverse(view)[3], pixelsPerUnit(projection, viewportHeight()));
+    // textures deleted on other threads can leave their names bound here
+    arp::glState().invalidateTextures();
+    drawInstances(*mesh, prog, &instance, 1);
+}
+
+/**
+ * Model data of an object placed at position, unrotated
+ */
+static void placeInstance(InstanceData& instance, const glm::vec3& position)
+{
+    glm::mat4 model = glm::translate(glm::mat4(1), position);
+    glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
+    memcpy(instance.model, &model[0][0], sizeof(instance.model));
+    memcpy(instance.normalMatrix, &normalMatrix[0][0], sizeof(instance.normalMatrix));
+}
+
+/**
+ * The program objects draw with unless they bring their own, looked up
+ * once instead of reading its sources for every object
+ */
+static cy::GLSLProgram* defaultProgram()
+{
+    static cy::GLSLProgram* program = nullptr;
+    if(!program)
+        program = renderobject::getProgram("shader4.vert", "shader4.frag");
+    return program;
+}
+
+/**
+ * World space bounds of object space bounds under a rigid model matrix
+ */
+static arp::AABB transformBounds(const arp::AABB& bounds, const float* model)
+{
+    glm::mat4 matrix = glm::make_mat4(model);
+    glm::vec3 center = glm::vec3(matrix * glm::vec4((bounds.min + bounds.max) * 0.5f, 1));
+    glm::vec3 extent = (bounds.max - bounds.min) * 0.5f;
+    glm::mat3 rotation(matrix);
+    glm::vec3 worldExtent(0);
+    for(int axis = 0; axis < 3; axis++)
+        worldExtent += glm::abs(rotation[axis]) * extent[axis];
+    return { center - worldExtent, center + worldExtent };
+}
+
+arp::AABB renderobject::getBounds() const
+{
+    if(!isLoaded())
+        return { glm::vec3(0), glm::vec3(0) };
+    return transformBounds(mesh->bounds, instance.model);
+}
+
+glm::vec3 renderobject::getPosition() const
+{
+    return glm::vec3(xPos, yPos, -translateZ);
+}
+
+void ObjectTransforms::resize(std::size_t count)
+{
+    for(std::vector<float>* array : { &x, &y, &z, &qx, &qy, &qz })
+        array->resize(count, 0.f);
+    qw.resize(count, 1.f);
+}
+
+void renderbatch::add(renderobject& object)
+{
+    if(object.mesh)
+        addInstance(object.mesh, object.prog, object.instance);
+}
+
+int renderbatch::add(const char* fileName, double x, double y, double z)
+{
+    cy::GLSLProgram* program = defaultProgram();
+    std::shared_ptr<MeshAsset> mesh = renderobject::getMesh(fileName, program);
+    if(!mesh)
+        return -1;
+    InstanceData instance;
+    placeInstance(instance, glm::vec3(x, y, -z));
+    return addInstance(mesh, program, instance);
+}
+
+/**
+ * Adds an object to the group of its mesh and program, returning its index
+ */
+int renderbatch::addInstance(const std::shared_ptr<MeshAsset>& mesh, cy::GLSLProgram* program,
+                             const InstanceData& instance)
+{
+    boundsDirty = true;
+    int object = entries.size();
+    for(int i = 0; i < (int)groups.size(); i++) {
+        if(groups[i].mesh == mesh && groups[i].program == program) {
+            entries.push_back({ i, (int)groups[i].instances.size() });
+            groups[i].instances.push_back(instance);
+            return object;
+        }
+    }
+    entries.push_back({ (int)groups.size(), 0 });
+    groups.push_back({ mesh, program, { instance } });
+    return object;
+}
+
+void renderbatch::addStatic(const char* fileName, double x, double y, double z)
+{
+    staticObjects.push_back({ fileName, glm::vec3(x, y, -z) });
+}
+
+int renderbatch::mergeStatic(float cellSize)
+{
+    // each file is loaded once, however many objects place it. A file that
+    // fails to load is left with no vertices
+    std::unordered_map<std::string, std::unique_ptr<MeshSource>> sources;
+    // objects by texture and cell, ordered so every run merges alike
+    std::map<std::pair<std::string, std::array<int, 3>>, std::vector<const StaticObject*>> cells;
+    for(const StaticObject& object : staticObjects) {
+        std::unique_ptr<MeshSource>& source = sources[object.fileName];
+        if(!source) {
+            source.reset(new MeshSource());
+            if(!loadMeshSource(object.fileName, *source))
+                std::cout << "Error: could not load " << object.fileName << " to merge" << std::endl;
+            else if(source->lods.empty())
+                source->lods.push_back({ 0, source->indexCount, 0 });
+        }
+        if(source->vertexCount == 0)
+            continue;
+        glm::vec3 center = object.position + (source->bounds.min + source->bounds.max) * 0.5f;
+        glm::ivec3 cell = glm::ivec3(glm::floor(center / cellSize));
+        cells[{ source->diffuseMap, { cell.x, cell.y, cell.z } }].push_back(&object);
+    }
+    staticObjects.clear();
+
+    cy::GLSLProgram* program = defaultProgram();
+    for(const auto& cell : cells) {
+        const std::vector<const StaticObject*>& objects = cell.second;
+        arp::AABB bounds = { glm::vec3(std::numeric_limits<float>::max()),
+                             glm::vec3(-std::numeric_limits<float>::max()) };
+        int lodCount = 1;
+        for(const StaticObject* object : objects) {
+            const MeshSource& source = *sources[object->fileName];
+            bounds.min = glm::min(bounds.min, object->position + source.bounds.min);
+            bounds.max = glm::max(bounds.max, object->position + source.bounds.max);
+            lodCount = std::max(lodCount, (int)source.lods.size());
+        }
+        glm::vec3 origin = (bounds.min + bounds.max) * 0.5f;
+
+        // positions are requantized within the merged bounds, normals and
+        // texture coordinates carry over as objects are only translated
+        MeshSource merged;
+        merged.bounds = { bounds.min - origin, bounds.max - origin };
+        glm::vec3 extent = merged.bounds.max - merged.bounds.min;
+        std::vector<std::uint32_t> firstVertices;
+        for(const StaticObject* object : objects) {
+            const MeshSource& source = *sources[object->fileName];
+            glm::vec3 sourceExtent = source.bounds.max - source.bounds.min;
+            glm::vec3 offset = object->position - origin;
+            firstVertices.push_back(merged.packedVertices.size());
+            for(std::uint32_t v = 0; v < source.vertexCount; v++) {
+                PackedMeshVertex vertex = source.vertices[v];
+                for(int axis = 0; axis < 3; axis++) {
+                    float position = source.bounds.min[axis] + vertex.position[axis] / 65535.f * sourceExtent[axis]
+                                   + offset[axis];
+                    float unit = extent[axis] > 0 ? (position - merged.bounds.min[axis]) / extent[axis] : 0;
+                    vertex.position[axis] = (std::uint16_t)std::lround(glm::clamp(unit, 0.f, 1.f) * 65535);
+                }
+                merged.packedVertices.push_back(vertex);
+            }
+        }
+
+        std::vector<std::uint32_t> indices;
+        for(int lod = 0; lod < lodCount; lod++) {
+            ArpMeshLod range = { (std::uint32_t)indices.size(), 0, 0 };
+            for(std::size_t i = 0; i < objects.size(); i++) {
+                const MeshSource& source = *sources[objects[i]->fileName];
+                // objects with fewer levels repeat their coarsest
+                const ArpMeshLod& sourceLod = source.lods[std::min(lod, (int)source.lods.size() - 1)];
+                for(std::uint32_t k = sourceLod.firstIndex; k < sourceLod.firstIndex + sourceLod.indexCount; k++) {
+                    std::uint32_t index = source.indexSize == 2 ? ((const std::uint16_t*)source.indices)[k]
+                                                                : ((const std::uint32_t*)source.indices)[k];
+                    indices.push_back(firstVertices[i] + index);
+                }
+                range.error = std::max(range.error, sourceLod.error);
+            }
+            range.indexCount = indices.size() - range.firstIndex;
+            merged.lods.push_back(range);
+        }
+        merged.indexSize = packIndices(indices, merged.packedVertices.size(), merged.packedIndices);
+        merged.vertices = merged.packedVertices.data();
+        merged.vertexCount = merged.packedVertices.size();
+        merged.indices = merged.packedIndices.data();
+        merged.indexCount = indices.size();
+
+        std::shared_ptr<MeshAsset> asset = std::make_shared<MeshAsset>();
+        asset->program = program;
+        if(!cell.first.first.empty())
+            asset->texture = getTexture(cell.first.first.c_str());
+        uploadMesh(*asset, merged, nullptr);
+        createVertexArray(*asset);
+        asset->state = ASSET_READY;
+        InstanceData instance;
+        placeInstance(instance, origin);
+        addInstance(asset, program, instance);
+    }
+    return (int)cells.size();
+}
+
+glm::vec3 renderbatch::getPosition(int object) const
+{
+    const Entry& entry = entries[object];
+    const float* model = groups[entry.group].instances[entry.index].model;
+    return glm::vec3(model[12], model[13], model[14]);
+}
+
+void renderbatch::clear()
+{
+    groups.clear();
+    entries.clear();
+    staticObjects.clear();
+    transformNodes.clear();
+    dirtyTransforms.clear();
+    boundsDirty = true;
+}
+
+/**
+ * World space bounds of an object as the batch draws it, empty until its
+ * mesh has loaded
+ */
+arp::AABB renderbatch::entryBounds(const Entry& entry) const
+{
+    const Group& group = groups[entry.group];
+    if(!group.ready)
+        return { glm::vec3(0), glm::vec3(0) };
+    return transformBounds(group.mesh->bounds, group.instances[entry.index].model);
+}
+
+void renderbatch::setLights(const PointLight* lights, int count)
+{
+    this->lights.assign(lights, lights + count);
+}
+
+void renderbatch::update(arp::Pose pose)
+{
+    view = viewMatrix(pose);
+
+    // loaded meshes bring their bounds, so the culling tree is rebuilt
+    renderobject::pollAssets();
+    for(Group& group : groups) {
+        if(!group.ready && meshReady(*group.mesh)) {
+            group.ready = true;
+            boundsDirty = true;
+        }
+    }
+
+    updateBounds();
+    updateTransforms();
+    if(cullingTreeDirty) {
+        cullingTree.build(bounds.data(), bounds.size());
+        cullingTreeDirty = false;
+    }
+}
+
+bool renderbatch::isLoaded() const
+{
+    for(const Group& group : groups) {
+        if(!group.ready)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Recomputes every object's bounds after objects were added or meshes
+ * loaded, which also changes what the GPU culls
+ */
+void renderbatch::updateBounds()
+{
+    if(!boundsDirty)
+        return;
+    bounds.resize(entries.size());
+    for(std::size_t i = 0; i < entries.size(); i++)
+        bounds[i] = entryBounds(entries[i]);
+    boundsDirty = false;
+    cullingTreeDirty = true;
+    gpuObjectsDirty = true;
+}
+
+void renderbatch::draw(double aspectRatio, double fovY)
+{
+    drawWithProjection(projectionMatrix(aspectRatio, fovY), viewportHeight());
+}
+
+void renderbatch::draw(const arp::LayerProjection& projection)
+{
+    float n = projection.nearPlane;
+    drawWithProjection(glm::frustum(projection.left * n, projection.right * n,
+                                    projection.bottom * n, projection.top * n, n, projection.farPlane),
+                       viewportHeight());
+}
+
+void renderbatch::drawWithProjection(const glm::mat4& projection, int height)
+{
+    setCamera(view, projection, &lights);
+    glm::vec3 camera = glm::inverse(view)[3];
+    float scale = lodScale(projection, height);
+    float pixels = pixelsPerUnit(projection, height);
+
+    visible.clear();
+    cullingTree.cull(arp::extractFrustum(projection * view), visible);
+
+    // front to back, so the depth test rejects hidden fragments early. Ties
+    // keep the order objects were added in so draws are deterministic
+    sortedVisible.clear();
+    for(int object : visible) {
+        const Entry& entry = entries[object];
+        const float* model = groups[entry.group].instances[entry.index].model;
+        glm::vec4 position = view * glm::vec4(model[12], model[13], model[14], 1);
+        sortedVisible.push_back({ -position.z, object });
+    }
+    std::sort(sortedVisible.begin(), sortedVisible.end(), [](const VisibleObject& a, const VisibleObject& b) {
+        return a.depth != b.depth ? a.depth < b.depth : a.object < b.object;
+    });
+    for(Group& group : groups) {
+        for(std::vector<InstanceData>& lodVisible : group.visible)
+            lodVisible.clear();
+    }
+    queue.clear();
+    for(const VisibleObject& object : sortedVisible) {
+        const Entry& entry = entries[object.object];
+        Group& group = groups[entry.group];
+        if(!group.ready)
+            continue;
+        const arp::AABB& objectBounds = bounds[object.object];
+        int lod = selectLod(*group.mesh, objectBounds, camera, scale);
+        requestTextureLevel(*group.mesh, objectBounds, camera, pixels);
+        // a draw is as near as its nearest instance
+        if(group.visible[lod].empty())
+            queue.push_back({ drawKey(*group.mesh, group.program, object.depth), entry.group, lod });
+        group.visible[lod].push_back(group.instances[entry.index]);
+    }
+
+    std::sort(queue.begin(), queue.end(), [](const DrawItem& a, const DrawItem& b) {
+        if(a.key != b.key)
+            return a.key < b.key;
+        return a.group != b.group ? a.group < b.group : a.lod < b.lod;
+    });
+    // textures deleted on other threads can leave their names bound here
+    arp::glState().invalidateTextures();
+    drawCount = queue.size();
+    if(depthPrePass) {
+        // only the vertex array changes between depth draws, so they go
+        // front to back by the depth in the low bits of their keys
+        prePassQueue = queue;
+        std::stable_sort(prePassQueue.begin(), prePassQueue.end(), [](const DrawItem& a, const DrawItem& b) {
+            return (a.key & 0xffff) < (b.key & 0xffff);
+        });
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        for(const DrawItem& item : prePassQueue) {
+            Group& group = groups[item.group];
+            std::vector<InstanceData>& lodVisible = group.visible[item.lod];
+            drawInstances(*group.mesh, depthPrePassProgram(), lodVisible.data(), lodVisible.size(), item.lod);
+        }
+        beginShadingPass();
+        drawCount *= 2;
+    }
+    for(const DrawItem& item : queue) {
+        Group& group = groups[item.group];
+        std::vector<InstanceData>& lodVisible = group.visible[item.lod];
+        drawInstances(*group.mesh, group.program, lodVisible.data(), lodVisible.size(), item.lod);
+    }
+    if(depthPrePass)
+        endShadingPass();
+}
+
+/**
+ * std430 layout of an Object in cull.comp
+ */
+struct GpuObject {
+    float boundsMin[3];
+    GLuint group;
+    float boundsMax[3];
+    GLuint instance;
+};
+
+/**
+ * DrawElementsIndirectCommand, also the DrawCommand of cull.comp
+ */
+struct DrawCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// layers one dispatch culls for, MAX_LAYERS of cull.comp
+static const int MAX_GPU_CULL_LAYERS = 8;
+static const int CULL_GROUP_SIZE = 64;
+
+static const int HIZ_GROUP_SIZE = 8;
+
+static const int MESHLET_GROUP_SIZE = 64;
+// groups whose objects times meshlets are more than this draw whole meshes,
+// a draw command per meshlet and object costs more than it saves by then
+static const int MAX_GROUP_MESHLET_SLOTS = 16384;
+
+static std::atomic<bool> gpuCullingEnabled{ true };
+static std::atomic<bool> occlusionCullingEnabled{ true };
+static std::atomic<bool> meshletCullingEnabled{ false };
+
+/**
+ * std430 layout of meshlet.comp's Meshlet
+ */
+struct GpuMeshlet {
+    float center[3];
+    float radius;
+    float coneAxis[3];
+    float coneCutoff;
+    GLuint firstIndex;
+    GLuint indexCount;
+    GLuint padding[2];
+};
+
+/**
+ * std430 layout of meshlet.comp's MeshletGroup
+ */
+struct GpuMeshletGroup {
+    // first of the group's meshlet commands within a layer's
+    GLuint firstSlot;
+    GLuint group;
+    GLuint firstMeshlet;
+    GLuint meshletCount;
+};
+
+/**
+ * Buffers of a renderbatch for culling on the GPU. Objects, their model data
+ * and their meshes' level of detail errors are copied when the batch
+ * changes. Each culled layer has room in visible for all objects at every
+ * level of detail of their mesh. The pass writes a layer's visible instances
+ * of a group at a level from that level's baseInstance on and counts them in
+ * its command. Commands are ARPMESH_MAX_LODS per group and layer
+ */
+struct GpuCulling {
+    arp::GLBuffer objects = arp::GLBuffer::create();
+    arp::GLBuffer instances = arp::GLBuffer::create();
+    arp::GLBuffer visible = arp::GLBuffer::create();
+    arp::GLBuffer commands = arp::GLBuffer::create();
+    arp::GLBuffer lodErrors = arp::GLBuffer::create();
+    int objectCount = 0;
+    // slots of a layer in visible
+    int layerSlots = 0;
+    // layers visible has room for
+    int layerCapacity = 0;
+    // layers the last dispatch culled
+    int layerCount = 0;
+    // first slot of every group and level of detail within a layer
+    std::vector<GLuint> lodFirst;
+    std::vector<DrawCommand> commandData;
+
+    // with setMeshletCulling, meshlet.comp culls the meshlets of the objects
+    // drawn at their full level into a command per meshlet and object slot
+    // of meshletCommands, which the full level's draw replaces its own with
+    arp::GLBuffer meshlets = arp::GLBuffer::create();
+    arp::GLBuffer meshletGroups = arp::GLBuffer::create();
+    arp::GLBuffer meshletCommands = arp::GLBuffer::create();
+    // groups drawn by meshlet, and the index into it of every group or -1
+    std::vector<GpuMeshletGroup> meshletGroupData;
+    std::vector<int> meshletGroupOf;
+    // meshlet commands of a layer
+    int meshletSlots = 0;
+    // whether the upload was made for meshlet culling
+    bool meshletCulling = false;
+
+    // farthest depth pyramid of layer 0 from buildOcclusion, R32F with a
+    // full mip chain, and the camera the depth was drawn with
+    arp::GLTexture pyramid;
+    int pyramidWidth = 0;
+    int pyramidHeight = 0;
+    int pyramidLevels = 0;
+    glm::mat4 pyramidViewProjection;
+    // false until buildOcclusion and after the objects change
+    bool pyramidValid = false;
+};
+
+/**
+ * Compiles and links a compute shader file. Returns 0 if it doesn't compile
+ */
+static GLuint compileComputeProgram(const char* fileName)
+{
+    std::string source = readFile(fileName);
+    cy::GLSLShader shader;
+    if(!shader.Compile(source.c_str(), GL_COMPUTE_SHADER))
+        return 0;
+    GLuint program = glCreateProgram();
+    glAttachShader(program, shader.GetID());
+    glLinkProgram(program);
+    GLint linked;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if(!linked) {
+        std::cout << "Error: Unable to link " << fileName << std::endl;
+        glDeleteProgram(program);
+        program = 0;
+    }
+    return program;
+}
+
+/**
+ * Compiles cull.comp once. Returns 0 if it doesn't compile
+ */
+static GLuint cullProgram()
+{
+    static GLuint program = compileComputeProgram("cull.comp");
+    return program;
+}
+
+/**
+ * Compiles hiz.comp once. Returns 0 if it doesn't compile
+ */
+static GLuint hizProgram()
+{
+    static GLuint program = compileComputeProgram("hiz.comp");
+    return program;
+}
+
+/**
+ * Compiles meshlet.comp once. Returns 0 if it doesn't compile
+ */
+static GLuint meshletProgram()
+{
+    static GLuint program = compileComputeProgram("meshlet.comp");
+    return program;
+}
+
+void renderbatch::setGpuCulling(bool enabled)
+{
+    gpuCullingEnabled = enabled;
+}
+
+void renderbatch::setLodThreshold(float pixels)
+{
+    lodThreshold = pixels;
+}
+
+void renderbatch::setBindlessTextures(bool enabled)
+{
+    bindlessEnabled = enabled;
+}
+
+bool renderbatch::isBindlessSupported()
+{
+    return GLEW_ARB_bindless_texture;
+}
+
+bool renderbatch::isGpuCullingSupported()
+{
+    return GLEW_VERSION_4_3 && cullProgram() != 0;
+}
+
+void renderbatch::setOcclusionCulling(bool enabled)
+{
+    occlusionCullingEnabled = enabled;
+}
+
+void renderbatch::setMeshletCulling(bool enabled)
+{
+    meshletCullingEnabled = enabled;
+}
+
+void renderbatch::setReversedZ(bool enabled)
+{
+    reversedZ = enabled;
+}
+
+/**
+ * std140 layout of the EnvironmentUniforms block
+ */
+struct EnvironmentUniforms {
+    // EnvironmentLighting::coefficients, w of the first is 1 when set
+    float coefficients[9][4];
+};
+
+void renderbatch::setEnvironmentLighting(const EnvironmentLighting* environment)
+{
+    EnvironmentUniforms uniforms = {};
+    if(environment) {
+        for(int i = 0; i < 9; i++)
+            memcpy(uniforms.coefficients[i], &environment->coefficients[i][0], sizeof(glm::vec3));
+        uniforms.coefficients[0][3] = 1;
+    }
+    if(!environmentUniformBuffer)
+        glGenBuffers(1, &environmentUniformBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, environmentUniformBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(uniforms), &uniforms, GL_STATIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, ENVIRONMENT_UNIFORMS_BINDING, environmentUniformBuffer);
+}
+
+/**
+ * Adds light of the given color arriving from direction, a unit vector, to
+ * the environment. Folds in each band's cosine convolution, pi, 2 pi / 3
+ * and pi / 4, the constants of its basis function, and the division by pi
+ */
+static void addEnvironmentLight(EnvironmentLighting& environment, const glm::vec3& direction,
+                                const glm::vec3& color)
+{
+    const float x = direction.x, y = direction.y, z = direction.z;
+    // Y_lm(direction) * Y_lm's constant * A_l / pi, for the basis
+    // 1, y, z, x, xy, yz, 3z^2 - 1, xz and x^2 - y^2 of shader4.frag
+    const float weights[9] = {
+        0.282095f * 0.282095f,
+        0.488603f * 0.488603f * (2.0f / 3.0f) * y,
+        0.488603f * 0.488603f * (2.0f / 3.0f) * z,
+        0.488603f * 0.488603f * (2.0f / 3.0f) * x,
+        1.092548f * 1.092548f * 0.25f * x * y,
+        1.092548f * 1.092548f * 0.25f * y * z,
+        0.315392f * 0.315392f * 0.25f * (3 * z * z - 1),
+        1.092548f * 1.092548f * 0.25f * x * z,
+        0.546274f * 0.546274f * 0.25f * (x * x - y * y),
+    };
+    for(int i = 0; i < 9; i++)
+        environment.coefficients[i] += weights[i] * color;
+}
+
+EnvironmentLighting bakeEnvironment(const std::function<glm::vec3(const glm::vec3&)>& radiance, int resolution)
+{
+    EnvironmentLighting environment;
+    resolution = std::max(resolution, 1);
+    const float pi = glm::pi<float>();
+    float step = pi / resolution;
+    for(int i = 0; i < resolution; i++) {
+        float theta = (i + 0.5f) * step;
+        // the solid angle of the grid cells shrinks toward the poles
+        float solidAngle = std::sin(theta) * step * step;
+        for(int j = 0; j < 2 * resolution; j++) {
+            float phi = (j + 0.5f) * step;
+            glm::vec3 direction(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+            addEnvironmentLight(environment, direction, radiance(direction) * solidAngle);
+        }
+    }
+    return environment;
+}
+
+EnvironmentLighting bakeEnvironment(const PointLight* lights, int count, const glm::vec3& center)
+{
+    EnvironmentLighting environment;
+    for(int i = 0; i < count; i++) {
+        glm::vec3 toLight = lights[i].position - center;
+        float distance = glm::length(toLight);
+        if(distance <= 0)
+            continue;
+        float falloff = std::min(1.0f, lights[i].radius * lights[i].radius / (distance * distance));
+        addEnvironmentLight(environment, toLight / distance, lights[i].color * falloff);
+    }
+    return environment;
+}
+
+void renderbatch::setDepthPrePass(bool enabled)
+{
+    depthPrePass = enabled;
+    // built now so setPeelDepth finds it among the programs
+    if(enabled)
+        depthPrePassProgram();
+}
+
+void renderbatch::setPeelDepth(GLuint depthTexture)
+{
+    int peel = depthTexture == 0 ? 0 : reversedZ ? -1 : 1;
+    if(depthTexture != 0)
+        arp::glState().bindTexture(1, GL_TEXTURE_2D, depthTexture);
+    // every program gets it, whichever objects draw with
+    for(auto& entry : programCache) {
+        GLuint id = entry.second->GetID();
+        GLint peelLoc = glGetUniformLocation(id, "peel");
+        if(peelLoc == -1)
+            continue;
+        arp::glState().useProgram(id);
+        glUniform1i(glGetUniformLocation(id, "peelDepth"), 1);
+        glUniform1i(peelLoc, peel);
+    }
+}
+
+void renderbatch::drawCheckerboardMask(int parity)
+{
+    static cy::GLSLProgram* program = renderobject::getProgram("checkerboard.vert", "checkerboard.frag");
+    // the triangle comes from gl_VertexID, but core profiles need a VAO bound
+    static GLuint emptyVao = 0;
+    if(emptyVao == 0)
+        glGenVertexArrays(1, &emptyVao);
+
+    GLint viewport[4];
+    if(!arp::glState().getViewport(viewport))
+        glGetIntegerv(GL_VIEWPORT, viewport);
+
+    GLuint id = program->GetID();
+    arp::glState().useProgram(id);
+    glUniform2i(glGetUniformLocation(id, "origin"), viewport[0], viewport[1]);
+    glUniform1i(glGetUniformLocation(id, "parity"), parity);
+    glUniform1f(glGetUniformLocation(id, "nearDepth"), reversedZ ? 1.f : 0.f);
+    arp::glState().bindVertexArray(emptyVao);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+renderbatch::renderbatch() = default;
+
+renderbatch::~renderbatch()
+{
+    if(!gpu)
+        return;
+    // the buffer's name can be handed out again, so the VAOs have to notice
+    for(Group& group : groups) {
+        if(group.mesh->instanceSource == gpu->visible.get())
+            group.mesh->instanceSource = 0;
+    }
+}
+
+void renderbatch::uploadGpuObjects()
+{
+    GpuCulling& culling = *gpu;
+    culling.objectCount = entries.size();
+    // levels a group can't be drawn at have no slots and are never picked
+    culling.lodFirst.assign(groups.size() * ARPMESH_MAX_LODS, 0);
+    std::vector<float> lodErrors(groups.size() * ARPMESH_MAX_LODS, std::numeric_limits<float>::max());
+    GLuint first = 0;
+    for(std::size_t i = 0; i < groups.size(); i++) {
+        const Group& group = groups[i];
+        int lodCount = group.ready ? group.mesh->lods.size() : 1;
+        for(int lod = 0; lod < lodCount; lod++) {
+            culling.lodFirst[i * ARPMESH_MAX_LODS + lod] = first;
+            first += group.instances.size();
+            if(group.ready)
+                lodErrors[i * ARPMESH_MAX_LODS + lod] = group.mesh->lods[lod].error;
+        }
+    }
+    culling.layerSlots = first;
+
+    // meshlet commands of a group go object by object, meshlet by meshlet
+    culling.meshletCulling = meshletCullingEnabled && meshletProgram() != 0;
+    culling.meshletGroupData.clear();
+    culling.meshletGroupOf.assign(groups.size(), -1);
+    std::vector<GpuMeshlet> meshlets;
+    GLuint firstMeshletSlot = 0;
+    for(std::size_t i = 0; culling.meshletCulling && i < groups.size(); i++) {
+        const Group& group = groups[i];
+        if(!group.ready || group.mesh->meshlets.empty()
+           || group.instances.size() * group.mesh->meshlets.size() > (std::size_t)MAX_GROUP_MESHLET_SLOTS)
+            continue;
+        culling.meshletGroupOf[i] = culling.meshletGroupData.size();
+        culling.meshletGroupData.push_back({ firstMeshletSlot, (GLuint)i, (GLuint)meshlets.size(),
+                                             (GLuint)group.mesh->meshlets.size() });
+        firstMeshletSlot += group.instances.size() * group.mesh->meshlets.size();
+        for(const ArpMeshMeshlet& meshlet : group.mesh->meshlets) {
+            GpuMeshlet packed = {};
+            memcpy(packed.center, meshlet.center, sizeof(packed.center));
+            packed.radius = meshlet.radius;
+            memcpy(packed.coneAxis, meshlet.coneAxis, sizeof(packed.coneAxis));
+            packed.coneCutoff = meshlet.coneCutoff;
+            packed.firstIndex = meshlet.firstIndex;
+            packed.indexCount = meshlet.indexCount;
+            meshlets.push_back(packed);
+        }
+    }
+    culling.meshletSlots = firstMeshletSlot;
+
+    std::vector<GpuObject> objects(entries.size());
+    std::vector<InstanceData> instances(entries.size());
+    for(std::size_t i = 0; i < entries.size(); i++) {
+        const Entry& entry = entries[i];
+        GpuObject& object = objects[i];
+        memcpy(object.boundsMin, &bounds[i].min[0], sizeof(object.boundsMin));
+        memcpy(object.boundsMax, &bounds[i].max[0], sizeof(object.boundsMax));
+        object.group = entry.group;
+        object.instance = i;
+        instances[i] = groups[entry.group].instances[entry.index];
+    }
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling.objects.get());
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GpuObject) * objects.size(), objects.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling.instances.get());
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(InstanceData) * instances.size(), instances.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling.lodErrors.get());
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(float) * lodErrors.size(), lodErrors.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling.meshlets.get());
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GpuMeshlet) * meshlets.size(), meshlets.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling.meshletGroups.get());
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GpuMeshletGroup) * culling.meshletGroupData.size(),
+                 culling.meshletGroupData.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    // visible is sized by objects, so it is resized on the next dispatch
+    culling.layerCapacity = 0;
+    // the last frame's depth doesn't show what was added or moved since
+    culling.pyramidValid = false;
+    gpuObjectsDirty = false;
+}
+
+#if defined(TRANSFORM_SSE)
+typedef __m128 Lanes;
+static inline Lanes loadLanes(const float* values) { return _mm_loadu_ps(values); }
+static inline Lanes splatLanes(float value) { return _mm_set1_ps(value); }
+static inline Lanes addLanes(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+static inline Lanes subLanes(Lanes a, Lanes b) { return _mm_sub_ps(a, b); }
+static inline Lanes mulLanes(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+static inline void storeLanes(float* values, Lanes lanes) { _mm_storeu_ps(values, lanes); }
+static inline void transposeLanes(Lanes& a, Lanes& b, Lanes& c, Lanes& d) { _MM_TRANSPOSE4_PS(a, b, c, d); }
+#elif defined(TRANSFORM_NEON)
+typedef float32x4_t Lanes;
+static inline Lanes loadLanes(const float* values) { return vld1q_f32(values); }
+static inline Lanes splatLanes(float value) { return vdupq_n_f32(value); }
+static inline Lanes addLanes(Lanes a, Lanes b) { return vaddq_f32(a, b); }
+static inline Lanes subLanes(Lanes a, Lanes b) { return vsubq_f32(a, b); }
+static inline Lanes mulLanes(Lanes a, Lanes b) { return vmulq_f32(a, b); }
+static inline void storeLanes(float* values, Lanes lanes) { vst1q_f32(values, lanes); }
+static inline void transposeLanes(Lanes& a, Lanes& b, Lanes& c, Lanes& d)
+{
+    float32x4x2_t ab = vtrnq_f32(a, b);
+    float32x4x2_t cd = vtrnq_f32(c, d);
+    a = vcombine_f32(vget_low_f32(ab.val[0]), vget_low_f32(cd.val[0]));
+    b = vcombine_f32(vget_low_f32(ab.val[1]), vget_low_f32(cd.val[1]));
+    c = vcombine_f32(vget_high_f32(ab.val[0]), vget_high_f32(cd.val[0]));
+    d = vcombine_f32(vget_high_f32(ab.val[1]), vget_high_f32(cd.val[1]));
+}
+#endif
+
+/**
+ * Model and normal matrices of one object. Transforms are rigid, so the
+ * normal matrix is the rotation itself
+ */
+static void transformInstance(const ObjectTransforms& transforms, std::size_t i, InstanceData& instance)
+{
+    glm::quat orientation(transforms.qw[i], transforms.qx[i], transforms.qy[i], transforms.qz[i]);
+    glm::mat3 rotation = glm::mat3_cast(orientation);
+    glm::mat4 model(rotation);
+    model[3] = glm::vec4(transforms.x[i], transforms.y[i], transforms.z[i], 1);
+    memcpy(instance.model, &model[0][0], sizeof(instance.model));
+    memcpy(instance.normalMatrix, &rotation[0][0], sizeof(instance.normalMatrix));
+}
+
+/**
+ * Model and normal matrices of objects first to first + 3, computed four
+ * at a time across the vector lanes and transposed into the instances
+ */
+static void transformInstances4(const ObjectTransforms& transforms, std::size_t first, InstanceData* instances)
+{
+#if defined(TRANSFORM_SSE) || defined(TRANSFORM_NEON)
+    Lanes x = loadLanes(&transforms.qx[first]);
+    Lanes y = loadLanes(&transforms.qy[first]);
+    Lanes z = loadLanes(&transforms.qz[first]);
+    Lanes w = loadLanes(&transforms.qw[first]);
+    Lanes one = splatLanes(1.f);
+    Lanes two = splatLanes(2.f);
+    Lanes zero = splatLanes(0.f);
+    Lanes xx = mulLanes(x, x), yy = mulLanes(y, y), zz = mulLanes(z, z);
+    Lanes xy = mulLanes(x, y), xz = mulLanes(x, z), yz = mulLanes(y, z);
+    Lanes wx = mulLanes(w, x), wy = mulLanes(w, y), wz = mulLanes(w, z);
+
+    // the rotation's columns, a component of four objects each
+    Lanes c0x = subLanes(one, mulLanes(two, addLanes(yy, zz)));
+    Lanes c0y = mulLanes(two, addLanes(xy, wz));
+    Lanes c0z = mulLanes(two, subLanes(xz, wy));
+    Lanes c1x = mulLanes(two, subLanes(xy, wz));
+    Lanes c1y = subLanes(one, mulLanes(two, addLanes(xx, zz)));
+    Lanes c1z = mulLanes(two, addLanes(yz, wx));
+    Lanes c2x = mulLanes(two, addLanes(xz, wy));
+    Lanes c2y = mulLanes(two, subLanes(yz, wx));
+    Lanes c2z = subLanes(one, mulLanes(two, addLanes(xx, yy)));
+    Lanes c0w = zero, c1w = zero, c2w = zero;
+    Lanes c3x = loadLanes(&transforms.x[first]), c3y = loadLanes(&transforms.y[first]);
+    Lanes c3z = loadLanes(&transforms.z[first]), c3w = one;
+    // after transposing, each holds one object's column
+    transposeLanes(c0x, c0y, c0z, c0w);
+    transposeLanes(c1x, c1y, c1z, c1w);
+    transposeLanes(c2x, c2y, c2z, c2w);
+    transposeLanes(c3x, c3y, c3z, c3w);
+    Lanes columns[4][4] = {
+        { c0x, c1x, c2x, c3x }, { c0y, c1y, c2y, c3y }, { c0z, c1z, c2z, c3z }, { c0w, c1w, c2w, c3w },
+    };
+    for(int object = 0; object < 4; object++) {
+        InstanceData& instance = instances[object];
+        for(int column = 0; column < 4; column++)
+            storeLanes(instance.model + column * 4, columns[object][column]);
+        // columns of the 3x3 normal matrix overlap the next one's first
+        // float, which the next store overwrites
+        storeLanes(instance.normalMatrix, columns[object][0]);
+        storeLanes(instance.normalMatrix + 3, columns[object][1]);
+        float last[4];
+        storeLanes(last, columns[object][2]);
+        memcpy(instance.normalMatrix + 6, last, sizeof(float) * 3);
+    }
+#else
+    for(int object = 0; object < 4; object++)
+        transformInstance(transforms, first + object, instances[object]);
+#endif
+}
+
+void renderbatch::setTransforms(const ObjectTransforms& transforms)
+{
+    // the nodes are made again from the new transforms if needed
+    transformNodes.clear();
+    dirtyTransforms.clear();
+    updateBounds();
+    std::size_t count = std::min(transforms.size(), entries.size());
+    if(count == 0)
+        return;
+
+    // with every object moved, the GPU's copies are replaced in place
+    InstanceData* gpuInstances = nullptr;
+    GpuObject* gpuObjects = nullptr;
+    if(gpu && !gpuObjectsDirty && count == entries.size()) {
+        GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpu->instances.get());
+        gpuInstances = (InstanceData*)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, sizeof(InstanceData) * count, access);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpu->objects.get());
+        gpuObjects = (GpuObject*)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GpuObject) * count, access);
+    }
+
+    const std::size_t grain = 1024;
+    arp::getJobSystem().parallelFor((int)((count + grain - 1) / grain), 1, [&](int begin, int end) {
+        for(std::size_t block = begin; block < (std::size_t)end; block++) {
+            std::size_t last = std::min((block + 1) * grain, count);
+            for(std::size_t first = block * grain; first < last; first += 4) {
+                InstanceData computed[4];
+                std::size_t lanes = std::min<std::size_t>(4, last - first);
+                if(lanes == 4) {
+                    transformInstances4(transforms, first, computed);
+                }
+                else {
+                    for(std::size_t lane = 0; lane < lanes; lane++)
+                        transformInstance(transforms, first + lane, computed[lane]);
+                }
+                for(std::size_t lane = 0; lane < lanes; lane++) {
+                    std::size_t i = first + lane;
+                    const Entry& entry = entries[i];
+                    groups[entry.group].instances[entry.index] = computed[lane];
+                    bounds[i] = entryBounds(entry);
+                    if(gpuInstances) {
+                        gpuInstances[i] = computed[lane];
+                        GpuObject& object = gpuObjects[i];
+                        memcpy(object.boundsMin, &bounds[i].min[0], sizeof(object.boundsMin));
+                        memcpy(object.boundsMax, &bounds[i].max[0], sizeof(object.boundsMax));
+                        object.group = entry.group;
+                        object.instance = i;
+                    }
+                }
+            }
+        }
+    });
+
+    if(gpuInstances || gpuObjects) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpu->instances.get());
+        bool unmapped = gpuInstances && glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpu->objects.get());
+        unmapped = gpuObjects && glUnmapBuffer(GL_SHADER_STORAGE_BUFFER) && unmapped;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        // a buffer whose contents were lost is uploaded again
+        if(!unmapped)
+            gpuObjectsDirty = true;
+    }
+    else if(gpu) {
+        gpuObjectsDirty = true;
+    }
+    // occlusion keeps testing against the last frame's depth, a frame
+    // behind the objects that moved
+    cullingTreeDirty = true;
+}
+
+/**
+ * Gives the objects added since the hierarchy was last extended nodes of
+ * their own, without a parent, at the transforms they were placed with
+ */
+void renderbatch::extendTransformNodes()
+{
+    for(std::size_t i = transformNodes.size(); i < entries.size(); i++) {
+        const Entry& entry = entries[i];
+        glm::mat4 model = glm::make_mat4(groups[entry.group].instances[entry.index].model);
+        TransformNode node;
+        node.parent = -1;
+        node.firstChild = -1;
+        node.nextSibling = -1;
+        node.position = glm::vec3(model[3]);
+        node.orientation = glm::quat_cast(glm::mat3(model));
+        node.worldPosition = node.position;
+        node.worldOrientation = node.orientation;
+        node.dirty = false;
+        transformNodes.push_back(node);
+    }
+}
+
+void renderbatch::setParent(int object, int parent)
+{
+    extendTransformNodes();
+    TransformNode& node = transformNodes[object];
+    if(node.parent >= 0) {
+        int* link = &transformNodes[node.parent].firstChild;
+        while(*link != object)
+            link = &transformNodes[*link].nextSibling;
+        *link = node.nextSibling;
+    }
+    node.parent = parent;
+    node.nextSibling = -1;
+    if(parent < 0) {
+        node.position = node.worldPosition;
+        node.orientation = node.worldOrientation;
+        return;
+    }
+    TransformNode& parentNode = transformNodes[parent];
+    node.nextSibling = parentNode.firstChild;
+    parentNode.firstChild = object;
+    glm::quat inverse = glm::conjugate(parentNode.worldOrientation);
+    node.position = inverse * (node.worldPosition - parentNode.worldPosition);
+    node.orientation = inverse * node.worldOrientation;
+}
+
+void renderbatch::setLocalTransform(int object, const glm::vec3& position, const glm::quat& orientation)
+{
+    extendTransformNodes();
+    TransformNode& node = transformNodes[object];
+    node.position = position;
+    node.orientation = orientation;
+    if(!node.dirty) {
+        node.dirty = true;
+        dirtyTransforms.push_back(object);
+    }
+}
+
+/**
+ * Recomputes the world transforms, instances and bounds of the subtrees
+ * under the objects set since the last update, each object after its
+ * parent, and brings the GPU's copies and the culling tree up to date for
+ * just those objects. Costs nothing while nothing was set
+ */
+void renderbatch::updateTransforms()
+{
+    if(dirtyTransforms.empty())
+        return;
+    movedObjects.clear();
+    for(int root : dirtyTransforms) {
+        // done already, or to be done, as part of a dirty ancestor's subtree
+        bool covered = !transformNodes[root].dirty;
+        for(int ancestor = transformNodes[root].parent; ancestor >= 0 && !covered;
+            ancestor = transformNodes[ancestor].parent)
+            covered = transformNodes[ancestor].dirty;
+        if(covered)
+            continue;
+        // breadth first, so parents are computed before their children
+        std::size_t next = movedObjects.size();
+        movedObjects.push_back(root);
+        while(next < movedObjects.size()) {
+            TransformNode& node = transformNodes[movedObjects[next++]];
+            node.dirty = false;
+            node.worldPosition = node.position;
+            node.worldOrientation = node.orientation;
+            if(node.parent >= 0) {
+                const TransformNode& parent = transformNodes[node.parent];
+                node.worldPosition = parent.worldPosition + parent.worldOrientation * node.position;
+                node.worldOrientation = parent.worldOrientation * node.orientation;
+            }
+            for(int child = node.firstChild; child >= 0; child = transformNodes[child].nextSibling)
+                movedObjects.push_back(child);
+        }
+    }
+    dirtyTransforms.clear();
+
+    for(int object : movedObjects) {
+        const TransformNode& node = transformNodes[object];
+        const Entry& entry = entries[object];
+        InstanceData& instance = groups[entry.group].instances[entry.index];
+        glm::mat3 rotation = glm::mat3_cast(node.worldOrientation);
+        glm::mat4 model(rotation);
+        model[3] = glm::vec4(node.worldPosition, 1);
+        memcpy(instance.model, &model[0][0], sizeof(instance.model));
+        memcpy(instance.normalMatrix, &rotation[0][0], sizeof(instance.normalMatrix));
+        bounds[object] = entryBounds(entry);
+    }
+
+    // a few objects are written in place, many replace the copies whole
+    if(gpu && !gpuObjectsDirty && movedObjects.size() * 8 > entries.size()) {
+        gpuObjectsDirty = true;
+    }
+    else if(gpu && !gpuObjectsDirty) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpu->instances.get());
+        for(int object : movedObjects) {
+            const Entry& entry = entries[object];
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(InstanceData) * object, sizeof(InstanceData),
+                            &groups[entry.group].instances[entry.index]);
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpu->objects.get());
+        for(int object : movedObjects) {
+            GpuObject gpuObject;
+            memcpy(gpuObject.boundsMin, &bounds[object].min[0], sizeof(gpuObject.boundsMin));
+            memcpy(gpuObject.boundsMax, &bounds[object].max[0], sizeof(gpuObject.boundsMax));
+            gpuObject.group = entries[object].group;
+            gpuObject.instance = object;
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(GpuObject) * object, sizeof(GpuObject), &gpuObject);
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    if(!cullingTreeDirty && cullingTree.size() == (int)bounds.size())
+        cullingTree.refit(movedObjects.data(), movedObjects.size(), bounds.data());
+    else
+        cullingTreeDirty = true;
+}
+
+void renderbatch::cullLayers(const arp::Pose* poses, const arp::LayerProjection* projections, const int* heights,
+                             int count)
+{
+    layerViews.resize(count);
+    layerProjections.resize(count);
+    layerHeights.assign(heights, heights + count);
+    for(int i = 0; i < count; i++) {
+        const arp::LayerProjection& projection = projections[i];
+        float n = projection.nearPlane;
+        layerViews[i] = viewMatrix(poses[i]);
+        layerProjections[i] = glm::frustum(projection.left * n, projection.right * n,
+                                           projection.bottom * n, projection.top * n, n, projection.farPlane);
+    }
+
+    if(!gpuCullingEnabled || !isGpuCullingSupported() || entries.empty()) {
+        // drawLayer culls each layer on the CPU instead
+        if(gpu)
+            gpu->layerCount = 0;
+        return;
+    }
+    if(!gpu) {
+        gpu.reset(new GpuCulling());
+        gpuObjectsDirty = true;
+    }
+    if(gpuObjectsDirty || gpu->meshletCulling != (meshletCullingEnabled && meshletProgram() != 0))
+        uploadGpuObjects();
+
+    GpuCulling& culling = *gpu;
+    culling.layerCount = std::min(count, MAX_GPU_CULL_LAYERS);
+    for(int layer = 0; layer < culling.layerCount; layer++)
+        requestTextures(layerViews[layer], layerProjections[layer], layerHeights[layer]);
+    if(culling.layerCapacity < culling.layerCount) {
+        culling.layerCapacity = culling.layerCount;
+        // VAOs point at this buffer, so it keeps its name when it grows
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling.visible.get());
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(InstanceData) * culling.layerSlots * culling.layerCapacity,
+                     nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling.meshletCommands.get());
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(DrawCommand) * culling.meshletSlots * culling.layerCapacity,
+                     nullptr, GL_DYNAMIC_DRAW);
+    }
+
+    // unloaded meshes and missing levels get empty commands, their objects
+    // are culled or never sorted into them anyway
+    culling.commandData.clear();
+    for(int layer = 0; layer < culling.layerCount; layer++) {
+        for(std::size_t i = 0; i < groups.size(); i++) {
+            const Group& group = groups[i];
+            for(int lod = 0; lod < ARPMESH_MAX_LODS; lod++) {
+                bool drawn = group.ready && lod < (int)group.mesh->lods.size();
+                GLuint indexCount = drawn ? group.mesh->lods[lod].indexCount : 0;
+                GLuint firstIndex = drawn ? group.mesh->lods[lod].firstIndex : 0;
+                GLuint baseInstance = layer * culling.layerSlots + culling.lodFirst[i * ARPMESH_MAX_LODS + lod];
+                culling.commandData.push_back({ indexCount, 0, firstIndex, 0, baseInstance });
+            }
+        }
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling.commands.get());
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(DrawCommand) * culling.commandData.size(),
+                 culling.commandData.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glm::vec4 planes[MAX_GPU_CULL_LAYERS * 6];
+    // camera position and lodScale of each layer
+    glm::vec4 lodCameras[MAX_GPU_CULL_LAYERS];
+    for(int layer = 0; layer < culling.layerCount; layer++) {
+        arp::Frustum frustum = arp::extractFrustum(layerProjections[layer] * layerViews[layer]);
+        std::copy(frustum.planes, frustum.planes + 6, planes + layer * 6);
+        lodCameras[layer] = glm::vec4(glm::vec3(glm::inverse(layerViews[layer])[3]),
+                                      lodScale(layerProjections[layer], layerHeights[layer]));
+    }
+
+    GLuint program = cullProgram();
+    arp::glState().useProgram(program);
+    glUniform1ui(glGetUniformLocation(program, "objectCount"), culling.objectCount);
+    glUniform1ui(glGetUniformLocation(program, "groupCount"), groups.size());
+    glUniform4fv(glGetUniformLocation(program, "planes"), culling.layerCount * 6, &planes[0][0]);
+    glUniform4fv(glGetUniformLocation(program, "lodCameras"), culling.layerCount, &lodCameras[0][0]);
+    bool occlusion = occlusionCullingEnabled && culling.pyramidValid;
+    glUniform1i(glGetUniformLocation(program, "occlusion"), occlusion);
+    if(occlusion) {
+        glUniformMatrix4fv(glGetUniformLocation(program, "occlusionViewProjection"), 1, GL_FALSE,
+                           &culling.pyramidViewProjection[0][0]);
+        glUniform1i(glGetUniformLocation(program, "occlusionLevels"), culling.pyramidLevels);
+        glUniform1i(glGetUniformLocation(program, "occlusionDepth"), 1);
+        arp::glState().bindTexture(1, GL_TEXTURE_2D, culling.pyramid.get());
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, culling.objects.get());
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, culling.instances.get());
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, culling.visible.get());
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, culling.commands.get());
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, culling.lodErrors.get());
+    glDispatchCompute((culling.objectCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, culling.layerCount, 1);
+
+    if(culling.meshletSlots > 0) {
+        // the meshlet pass reads the full levels' commands and instances
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        program = meshletProgram();
+        arp::glState().useProgram(program);
+        glUniform1ui(glGetUniformLocation(program, "meshletGroupCount"), culling.meshletGroupData.size());
+        glUniform1ui(glGetUniformLocation(program, "layerSlots"), culling.meshletSlots);
+        glUniform1ui(glGetUniformLocation(program, "groupCount"), groups.size());
+        glUniform4fv(glGetUniformLocation(program, "planes"), culling.layerCount * 6, &planes[0][0]);
+        glUniform4fv(glGetUniformLocation(program, "lodCameras"), culling.layerCount, &lodCameras[0][0]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, culling.meshlets.get());
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, culling.meshletGroups.get());
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, culling.visible.get());
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, culling.commands.get());
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, culling.meshletCommands.get());
+        glDispatchCompute((culling.meshletSlots + MESHLET_GROUP_SIZE - 1) / MESHLET_GROUP_SIZE, culling.layerCount, 1);
+    }
+    // the draws read the commands and the instances the passes wrote
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+}
+
+/**
+ * Asks for the texture levels of the objects in a frustum, which drawing
+ * with drawWithProjection does as it goes
+ */
+void renderbatch::requestTextures(const glm::mat4& layerView, const glm::mat4& projection, int height, bool prefetch)
+{
+    glm::vec3 camera = glm::inverse(layerView)[3];
+    float pixels = pixelsPerUnit(projection, height);
+    visible.clear();
+    cullingTree.cull(arp::extractFrustum(projection * layerView), visible);
+    for(int object : visible) {
+        const Entry& entry = entries[object];
+        const Group& group = groups[entry.group];
+        if(group.ready)
+            requestTextureLevel(*group.mesh, bounds[object], camera, pixels, prefetch);
+    }
+}
+
+void renderbatch::prefetch(const arp::Pose* poses, int count, const arp::LayerProjection& projection, int height)
+{
+    float n = projection.nearPlane;
+    glm::mat4 frustum = glm::frustum(projection.left * n, projection.right * n, projection.bottom * n,
+                                     projection.top * n, n, projection.farPlane);
+    for(int i = 0; i < count; i++)
+        requestTextures(viewMatrix(poses[i]), frustum, height, true);
+}
+
+void renderbatch::drawLayer(int layer)
+{
+    if(!gpu || layer >= gpu->layerCount) {
+        view = layerViews[layer];
+        drawWithProjection(layerProjections[layer], layerHeights[layer]);
+        return;
+    }
+
+    setCamera(layerViews[layer], layerProjections[layer], &lights);
+    // textures deleted on other threads can leave their names bound here
+    arp::glState().invalidateTextures();
+
+    // meshes don't share vertex buffers, so every group is a draw of its own,
+    // and one per level of detail since which are used isn't known here
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, gpu->commands.get());
+    drawCount = 0;
+    if(depthPrePass)
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    for(int pass = depthPrePass ? 0 : 1; pass < 2; pass++) {
+        if(pass == 1 && depthPrePass)
+            beginShadingPass();
+        for(std::size_t i = 0; i < groups.size(); i++) {
+            Group& group = groups[i];
+            if(!group.ready)
+                continue;
+            bindMesh(*group.mesh, pass == 0 ? depthPrePassProgram() : group.program);
+            pointInstances(*group.mesh, gpu->visible.get(), 0, 0);
+            for(std::size_t lod = 0; lod < group.mesh->lods.size(); lod++) {
+                int meshletGroup = gpu->meshletGroupOf.empty() ? -1 : gpu->meshletGroupOf[i];
+                if(lod == 0 && meshletGroup != -1) {
+                    const GpuMeshletGroup& meshlets = gpu->meshletGroupData[meshletGroup];
+                    std::size_t first = (std::size_t)layer * gpu->meshletSlots + meshlets.firstSlot;
+                    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, gpu->meshletCommands.get());
+                    glMultiDrawElementsIndirect(GL_TRIANGLES, group.mesh->indexType,
+                                                (GLvoid*)(sizeof(DrawCommand) * first),
+                                                group.instances.size() * meshlets.meshletCount, 0);
+                    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, gpu->commands.get());
+                    drawCount++;
+                    continue;
+                }
+                std::size_t command = (layer * groups.size() + i) * ARPMESH_MAX_LODS + lod;
+                glDrawElementsIndirect(GL_TRIANGLES, group.mesh->indexType,
+                                       (GLvoid*)(sizeof(DrawCommand) * command));
+                drawCount++;
+            }
+        }
+    }
+    if(depthPrePass)
+        endShadingPass();
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void renderbatch::buildOcclusion(GLuint depthTexture, int width, int height)
+{
+    if(!gpu || gpu->layerCount == 0 || !occlusionCullingEnabled || hizProgram() == 0)
+        return;
+
+    GpuCulling& culling = *gpu;
+    if(culling.pyramidWidth != width || culling.pyramidHeight != height) {
+        culling.pyramidLevels = 1;
+        while((std::max(width, height) >> culling.pyramidLevels) > 0)
+            culling.pyramidLevels++;
+        culling.pyramid = arp::GLTexture::create();
+        arp::glState().bindTexture(0, GL_TEXTURE_2D, culling.pyramid.get());
+        glTexStorage2D(GL_TEXTURE_2D, culling.pyramidLevels, GL_R32F, width, height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        culling.pyramidWidth = width;
+        culling.pyramidHeight = height;
+    }
+
+    // level 0 copies the depth, every level after it reduces the one above
+    GLuint program = hizProgram();
+    arp::glState().useProgram(program);
+    GLint sourceLevelLoc = glGetUniformLocation(program, "sourceLevel");
+    GLint copyDepthLoc = glGetUniformLocation(program, "copyDepth");
+    glUniform1i(glGetUniformLocation(program, "source"), 0);
+    for(int level = 0; level < culling.pyramidLevels; level++) {
+        int levelWidth = std::max(width >> level, 1);
+        int levelHeight = std::max(height >> level, 1);
+        arp::glState().bindTexture(0, GL_TEXTURE_2D, level == 0 ? depthTexture : culling.pyramid.get());
+        glUniform1i(sourceLevelLoc, level - 1);
+        glUniform1i(copyDepthLoc, level == 0);
+        glBindImageTexture(0, culling.pyramid.get(), level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        glDispatchCompute((levelWidth + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE,
+                          (levelHeight + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, 1);
+        // the next level and the cull pass fetch what this one wrote
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    }
+    glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+
+    culling.pyramidViewProjection = layerProjections[0] * layerViews[0];
+    culling.pyramidValid = true;
+}
+
+void renderbatch::render(arp::Pose pose, double aspectRatio, double fovY)
+{
+    update(pose);
+    draw(aspectRatio, fovY);
+}
+
+renderobject::renderobject(char *fileName, double startingX, double startingY, double startingZ)
+{
+    xPos = startingX;
+    yPos = startingY;
+    translateZ = startingZ;
+
+    /* Objects don't move, so the model data is computed once */
+    placeInstance(instance, getPosition());
+
+    /* Compile the shaders, or reuse them from another object */
+    prog = defaultProgram();
+
+    /* Load the mesh and texture, or reuse them from another object */
+    mesh = getMesh( fileName, prog );
 
-    /* Connect the texture buffer to the vertex shader */
-    txc = glGetAttribLocation( prog.GetID(), "txc" );
-    glEnableVertexAttribArray( txc );
-    glVertexAttribPointer(
-         txc, 3, GL_FLOAT,
-         GL_FALSE, 0, (GLvoid*) 0);
     return;
 }
@@ -5,11 +5,80 @@
 #include <GLFW/glfw3.h>
 #include "cyTriMesh.h"
 #include "cyGL.h"
-#include "cyMatrix.h"
-#include "cyVector.h"
 #include "glm/glm.hpp"
 #include "glm/ext.hpp"
 #include "arp.h"
+#include "arpcull.h"
+#include "arpmesh.h"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct MeshAsset;
+struct GpuCulling;
+
+/**
+ * Per-instance model data, read by shader4.vert as instanced vertex
+ * attributes. The camera comes from a uniform block set once per layer, so
+ * this only changes when the object moves
+ */
+struct InstanceData {
+    float model[16];
+    // inverse transpose of the model matrix's upper 3x3
+    float normalMatrix[9];
+};
+
+/**
+ * Point light of a renderbatch, see renderbatch::setLights
+ */
+struct PointLight {
+    glm::vec3 position;
+    // distance at which its light has faded to nothing
+    float radius;
+    glm::vec3 color;
+};
+
+/**
+ * Light arriving from every direction, as order 2 spherical harmonics of
+ * the irradiance, see renderbatch::setEnvironmentLighting
+ */
+struct EnvironmentLighting {
+    // world space, already convolved with the cosine lobe and divided by
+    // pi, so a diffuse surface reflects its color times their sum over the
+    // basis polynomials of its normal
+    glm::vec3 coefficients[9] = {};
+};
+
+/**
+ * Projects a radiance function of world space direction, like a cube map
+ * lookup or a sky model, sampled at resolution by 2 * resolution directions
+ */
+EnvironmentLighting bakeEnvironment(const std::function<glm::vec3(const glm::vec3&)>& radiance,
+                                    int resolution = 64);
+
+/**
+ * Projects point lights as seen from center, as if they were distant. Each
+ * gives its full color at its radius, falling off with the inverse square
+ * of the distance beyond it
+ */
+EnvironmentLighting bakeEnvironment(const PointLight* lights, int count, const glm::vec3& center);
+
+/**
+ * Rigid transforms of the objects of a renderbatch, in structure of arrays
+ * form so they're transformed several at a time. Orientations are unit
+ * quaternions
+ */
+struct ObjectTransforms {
+    std::vector<float> x, y, z;
+    std::vector<float> qx, qy, qz, qw;
+
+    // new objects are at the origin, unrotated
+    void resize(std::size_t count);
+    std::size_t size() const { return x.size(); }
+};
 
 class renderobject
 {
@@ -20,23 +89,498 @@ private:
     double yPos = 0;
     double translateZ = 0;
     
-    const int SCALE_FACTOR = 150;
+    static const int SCALE_FACTOR = 150;
     
-    cy::GLSLProgram prog;
-    GLuint buffer;
-    GLuint vao;
-    GLuint pos;
-    GLuint normalBuffer;
-    GLuint norm;
-    GLuint txc;
-    GLuint txcBuffer;
-    cy::TriMesh mesh;
+    // shared with every other renderobject using the same shaders
+    cy::GLSLProgram* prog = nullptr;
+    InstanceData instance;
+    // camera from the last updateMatrices, used by render
+    glm::mat4 view;
+    glm::mat4 projection;
+    // GPU mesh and texture, shared with every object loaded from the same file
+    std::shared_ptr<MeshAsset> mesh;
     
 public:
+    /**
+     * Returns the program built from the given shader files. Programs are
+     * cached by shader source, so objects using the same shaders share one
+     */
+    static cy::GLSLProgram* getProgram(const char* vertFile, const char* fragFile);
+
+    /**
+     * Returns the GPU mesh and texture for the given OBJ file. Assets are
+     * cached by path and freed once no object references them. While the
+     * asset loader runs, this returns at once and the mesh loads in the
+     * background
+     */
+    static std::shared_ptr<MeshAsset> getMesh(const char* fileName, cy::GLSLProgram* program);
+
+    /**
+     * Opens an .arppack to load from before any loose file. Meshes and
+     * textures use the pack's .arpmesh and .dds of the same name, and
+     * shaders its sources, regardless of what is on disk. Call before
+     * loading anything. Returns false and prints an error if the pack
+     * can't be used
+     */
+    static bool setAssetPack(const char* fileName);
+
+    /**
+     * Starts loading meshes and textures in the background: threads workers
+     * parse and decode them, and a thread using uploadContext uploads them.
+     * uploadContext must share objects with the app's context and not be
+     * current anywhere else. threads <= 0 uses one less than the number of
+     * cores
+     */
+    static void startAssetLoader(GLFWwindow* uploadContext, int threads = 0);
+
+    /**
+     * Stops the loader threads. Assets still loading never become ready.
+     * Call from the app thread before its context is destroyed
+     */
+    static void stopAssetLoader();
+
+    /**
+     * Marks assets whose background upload has finished as ready. Called by
+     * render and renderbatch::update
+     */
+    static void pollAssets();
+
+    /**
+     * Number of assets queued on the loader that are not ready yet
+     */
+    static int getPendingAssets();
+
+    /**
+     * Starts a frame. Camera uniforms and instances of the draws until the
+     * next call are written into a persistently mapped arena instead of
+     * buffers of their own, which the GPU may still be reading from while
+     * the next frame is written. Call once per frame on the app thread,
+     * draws before the first call orphan buffers of their own
+     */
+    static void beginFrame();
+
+    /**
+     * Turns texture streaming on or off for textures loaded afterwards, on
+     * by default. Baked .dds textures then load their levels of 64 pixels
+     * and less first. Draws ask for the level each object's size on screen
+     * needs, in every layer they're drawn into, and beginFrame uploads the
+     * finer levels asked for through the asset loader's ring. Images
+     * without a baked .dds have no levels to stream and load whole
+     */
+    static void setTextureStreaming(bool enabled);
+
+    /**
+     * Limits the bytes of textures' uploaded levels. beginFrame drops the
+     * finest levels of textures that drew coarser, least recently drawn
+     * first, to make room for the levels draws ask for, and streams in no
+     * finer levels than fit. 0, the default, is no limit
+     */
+    static void setTextureBudget(std::int64_t bytes);
+
+    /**
+     * Bytes of every texture's uploaded levels
+     */
+    static std::int64_t getTextureBytes();
+
+    /**
+     * Limits the asset loader's uploads to fraction of each app frame at
+     * the target framerate, so a burst of loads doesn't stretch a frame.
+     * beginFrame opens each frame's slice, the upload thread then issues the
+     * most urgent uploads its estimate of their cost says fit: new assets
+     * before streamed levels, and levels by how much coarser than asked for
+     * their texture shows. The estimate is measured from each upload's CPU
+     * and GPU time per byte. 0, the default, is no limit
+     */
+    static void setUploadBudget(double fraction);
+
+    /**
+     * Returns true once the object's mesh has loaded. Objects that haven't
+     * loaded are skipped when drawing
+     */
+    bool isLoaded() const;
+
+    /**
+     * Sets the camera used by render
+     */
     void updateMatrices(arp::Pose pose, double aspectRatio, double fovY);
     void render();
+
+    /**
+     * World space bounds of the object, empty until it has loaded
+     */
+    arp::AABB getBounds() const;
+
+    /**
+     * Where the object was placed
+     */
+    glm::vec3 getPosition() const;
+
     renderobject(char *fileName, double startingX, double startingY, double startingZ);
-    
+
+    friend class renderbatch;
+};
+
+/**
+ * Draws many objects with one instanced draw call per unique mesh. Objects
+ * are grouped by mesh as they are added, either copied from a renderobject
+ * or placed straight into the batch, which keeps only their model data:
+ * instances in one dense array per mesh, bounds in one array indexed by
+ * object, and the mesh once per group.
+ * Draws are queued and sorted by the program, texture and mesh they bind,
+ * then front to back, so each bind is only made once per layer and
+ * instances are drawn nearest first.
+ *
+ * To draw the same frame into several layers, call update once and draw
+ * once per layer. Only the camera changes between frames and layers, so no
+ * per-object work is done apart from culling. Each layer only draws the
+ * objects inside its frustum.
+ *
+ * Each object is drawn at the coarsest level of detail of its mesh whose
+ * error covers less than a pixel (setLodThreshold) of the layer it is drawn
+ * into. Layers with fewer pixels per degree, like the background's faces,
+ * get coarser levels without any setting of their own
+ */
+class renderbatch
+{
+private:
+    struct Group {
+        std::shared_ptr<MeshAsset> mesh;
+        // every object in the group draws with it
+        cy::GLSLProgram* program;
+        // model data of every object in the group
+        std::vector<InstanceData> instances;
+        // instances of the objects visible in the layer being drawn, by the
+        // level of detail they're drawn at
+        std::vector<InstanceData> visible[ARPMESH_MAX_LODS];
+        // set by update once the mesh has loaded
+        bool ready = false;
+    };
+
+    // group and index within the group of every object, in the order added
+    struct Entry {
+        int group;
+        int index;
+    };
+
+    // placed by addStatic, waiting for mergeStatic
+    struct StaticObject {
+        std::string fileName;
+        glm::vec3 position;
+    };
+
+    std::vector<Group> groups;
+    std::vector<Entry> entries;
+    std::vector<StaticObject> staticObjects;
+    glm::mat4 view;
+    int drawCount = 0;
+
+    // world space bounds of every object, in the order added
+    std::vector<arp::AABB> bounds;
+    // set when objects are added or removed, or meshes load
+    bool boundsDirty = true;
+    // rebuilt by update after objects are added, removed or moved
+    arp::CullingTree cullingTree;
+    bool cullingTreeDirty = true;
+    std::vector<int> visible;
+
+    struct VisibleObject {
+        // distance along the view direction
+        float depth;
+        int object;
+    };
+
+    // one per group and level of detail with visible objects, see drawKey
+    // in renderobject.cpp
+    struct DrawItem {
+        std::uint64_t key;
+        int group;
+        int lod;
+    };
+
+    std::vector<VisibleObject> sortedVisible;
+    std::vector<DrawItem> queue;
+    // world space, see setLights
+    std::vector<PointLight> lights;
+    // queue in the order of the depth pre-pass, see setDepthPrePass
+    std::vector<DrawItem> prePassQueue;
+
+    // cameras of the layers of the last cullLayers
+    std::vector<glm::mat4> layerViews;
+    std::vector<glm::mat4> layerProjections;
+    std::vector<int> layerHeights;
+    // null until the batch is first culled on the GPU
+    std::unique_ptr<GpuCulling> gpu;
+    // objects changed since they were copied for the GPU
+    bool gpuObjectsDirty = true;
+
+    // hierarchy of setParent and setLocalTransform, by object. Empty until
+    // either is first called, objects added later join it when they are
+    struct TransformNode {
+        int parent;
+        int firstChild;
+        int nextSibling;
+        // relative to the parent, or to the world without one
+        glm::vec3 position;
+        glm::quat orientation;
+        // as of the last update
+        glm::vec3 worldPosition;
+        glm::quat worldOrientation;
+        // set since the last update, so its subtree is recomputed
+        bool dirty;
+    };
+    std::vector<TransformNode> transformNodes;
+    std::vector<int> dirtyTransforms;
+    // objects the last update moved, parents before children
+    std::vector<int> movedObjects;
+
+    int addInstance(const std::shared_ptr<MeshAsset>& mesh, cy::GLSLProgram* program, const InstanceData& instance);
+    arp::AABB entryBounds(const Entry& entry) const;
+    void updateBounds();
+    void extendTransformNodes();
+    void updateTransforms();
+    void drawWithProjection(const glm::mat4& projection, int height);
+    void requestTextures(const glm::mat4& layerView, const glm::mat4& projection, int height, bool prefetch = false);
+    void uploadGpuObjects();
+
+public:
+    renderbatch();
+    ~renderbatch();
+    renderbatch(const renderbatch&) = delete;
+    renderbatch& operator=(const renderbatch&) = delete;
+
+    /**
+     * Adds a copy of the object, which needn't outlive the batch. Later
+     * changes to it aren't seen
+     */
+    void add(renderobject& object);
+
+    /**
+     * Adds an object placed like renderobject's constructor places one,
+     * without making a renderobject. Returns its index among the objects
+     * added, or -1 if its mesh can't be loaded
+     */
+    int add(const char* fileName, double x, double y, double z);
+
+    /**
+     * Queues an object that never moves, placed like add places one, for
+     * mergeStatic. It isn't drawn until merged
+     */
+    void addStatic(const char* fileName, double x, double y, double z);
+
+    /**
+     * Merges the objects queued by addStatic into a few large meshes. The
+     * objects are grouped by texture and by the cell of a cellSize grid
+     * their centers fall in. Each group's vertices are moved into world
+     * space and its indices appended into one mesh per group, one level of
+     * detail after another, so the levels still apply. Each merged mesh
+     * is added as one object at the center of its bounds. Static content
+     * then costs one draw per texture and cell, however many pieces it is
+     * built from, and the cells are culled like any other object.
+     *
+     * Loads the meshes on the calling thread, even while the asset loader
+     * runs, and keeps no copy of their vertices. Merged meshes have no
+     * meshlets. Returns the number of objects added
+     */
+    int mergeStatic(float cellSize = 32);
+    void clear();
+
+    int getObjectCount() const { return (int)entries.size(); }
+
+    /**
+     * World position of an object, by the index add returned
+     */
+    glm::vec3 getPosition(int object) const;
+
+    /**
+     * Moves the objects, transforms[i] being the i-th object added. The
+     * model and normal matrices are computed four objects at a time with
+     * SSE or NEON, split over arp's job system, and written straight into
+     * the instances culled on the GPU when every object moves. Only the
+     * batch's copies move, renderobject::getBounds keeps the placed
+     * position. Call before update, which rebuilds the culling tree
+     */
+    void setTransforms(const ObjectTransforms& transforms);
+
+    /**
+     * Makes parent carry the object, -1 for the world, so the object moves
+     * with parent from then on. The object keeps the world transform it had
+     * as of the last update, which becomes relative to parent's. parent
+     * must not be the object or one it carries. setTransforms drops the
+     * hierarchy
+     */
+    void setParent(int object, int parent);
+
+    /**
+     * Places the object relative to its parent, or to the world without
+     * one. The next update recomputes the model matrices and bounds of just
+     * the objects changed and those they carry, writes only theirs into the
+     * GPU's copies and refits the culling tree around them, so a mostly
+     * static scene costs next to nothing however large it is
+     */
+    void setLocalTransform(int object, const glm::vec3& position, const glm::quat& orientation);
+
+    /**
+     * Replaces the batch's point lights, which light shader4.frag's objects
+     * on top of its headlight. Every layer drawn divides its frustum into a
+     * grid of clusters, tiles of the viewport by exponential slices of
+     * distance, and lists the lights whose spheres reach each one, so a
+     * fragment only loops over the lights of its cluster. The lists are
+     * built on the CPU per layer, the background's cube faces included
+     */
+    void setLights(const PointLight* lights, int count);
+
+    /**
+     * Sets the camera for the following draws, and applies the transforms
+     * set since the last update
+     */
+    void update(arp::Pose pose);
+
+    /**
+     * Whether update has seen the mesh of every object load
+     */
+    bool isLoaded() const;
+
+    /**
+     * Draws the objects inside the frustum as of the last update into the
+     * bound framebuffer
+     */
+    void draw(double aspectRatio, double fovY);
+
+    /**
+     * Same as draw, with the frustum of a layer, which may be off center
+     */
+    void draw(const arp::LayerProjection& projection);
+
+    /**
+     * Culls the objects against the frusta of several layers at once, to
+     * draw them with drawLayer. With GL 4.3 this is one compute dispatch that
+     * writes the instances and indirect draw commands of every layer, so
+     * drawing a layer is one indirect draw per mesh with no CPU work per
+     * object. Up to 8 layers are culled on the GPU, the rest and all of them
+     * without GL 4.3 are culled on the CPU as they're drawn. Call after
+     * update, which still loads assets. Instances within a mesh are drawn in
+     * no particular order. heights are the layers' image heights in pixels,
+     * which levels of detail are chosen by
+     */
+    void cullLayers(const arp::Pose* poses, const arp::LayerProjection* projections, const int* heights, int count);
+
+    /**
+     * Draws a layer of the last cullLayers into the bound framebuffer
+     */
+    void drawLayer(int layer);
+
+    /**
+     * Asks for the texture levels of the objects a view with the given
+     * projection and image height would see from each pose, like the
+     * poses of arp::getPredictedTrajectory, so they stream in before the
+     * camera gets there. Prefetched levels stream after the ones draws ask
+     * for and only into room the texture budget has free, and are the last
+     * dropped to make room while they're still asked for. Call after
+     * update, every frame the prefetch should last
+     */
+    void prefetch(const arp::Pose* poses, int count, const arp::LayerProjection& projection, int height);
+
+    /**
+     * Builds a farthest depth pyramid from layer 0's depth, drawn with
+     * drawLayer(0) into a width by height depth texture. The next cullLayers
+     * also culls layer 0's objects hidden behind it, testing their bounds as
+     * seen from this frame's camera. Does nothing without GPU culling
+     */
+    void buildOcclusion(GLuint depthTexture, int width, int height);
+
+    /**
+     * Puts the 2x2 quads a checkerboard frame skips (arp::getCheckerboardParity)
+     * on the near plane of the bound depth buffer, so the following draws
+     * only shade the other half of the viewport. Call after clearing the
+     * depth. The skipped quads' depth makes the image useless for
+     * buildOcclusion
+     */
+    static void drawCheckerboardMask(int parity);
+
+    /**
+     * Turns GPU culling in cullLayers on or off, on by default
+     */
+    static void setGpuCulling(bool enabled);
+    static bool isGpuCullingSupported();
+
+    /**
+     * Turns bindless textures on or off, on by default where
+     * ARB_bindless_texture is supported. Draws then hand the program a
+     * resident handle of their mesh's texture instead of binding it, and
+     * draws are no longer sorted by texture. Streaming textures change
+     * their levels, which a handle forbids, so they're bound either way
+     */
+    static void setBindlessTextures(bool enabled);
+    static bool isBindlessSupported();
+
+    /**
+     * Turns occlusion culling against buildOcclusion's pyramid on or off, on
+     * by default
+     */
+    static void setOcclusionCulling(bool enabled);
+
+    /**
+     * Turns culling of meshlets (see buildMeshlets) on or off in cullLayers,
+     * off by default. Objects GPU culling draws at their full level of
+     * detail then only draw the meshlets inside the layer's frustum and
+     * facing the camera, so meshes have to be closed, or only ever seen from
+     * the side their faces wind counterclockwise on. Meshes of one meshlet
+     * and groups with too many objects draw whole
+     */
+    static void setMeshletCulling(bool enabled);
+
+    /**
+     * Makes the following draws write reversed depth, 1 at the near plane,
+     * for a context set up with glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE)
+     * and a GL_GREATER depth test (arp::DEPTH_REVERSED). Culling is the same
+     * either way, but buildOcclusion reads default depth and mustn't be
+     * used. Off by default
+     */
+    static void setReversedZ(bool enabled);
+
+    /**
+     * Draws the following draws' depth first, front to back with a program
+     * that shades nothing, then shades them with a GL_EQUAL depth test, so
+     * each pixel runs shader4.frag once however many objects overlap it.
+     * Objects have to draw with shader4.vert. Draws issued on the GPU by
+     * drawLayer aren't sorted, their pre-pass goes in no particular order.
+     * Off by default
+     */
+    static void setDepthPrePass(bool enabled);
+
+    /**
+     * Lights shader4.frag's objects with the environment, in place of the
+     * flat ambient term, on top of the headlight and point lights. The
+     * coefficients go into a uniform block once, so a fragment only
+     * evaluates nine basis polynomials however much light was baked into
+     * them. Null goes back to the flat ambient term
+     */
+    static void setEnvironmentLighting(const EnvironmentLighting* environment);
+
+    /**
+     * Depth peels the following draws: fragments no farther than the
+     * depth texture, a layer of the same view drawn before, are discarded,
+     * so only the surfaces behind it are drawn (arp::DEPTH_PEELED). The
+     * texture is bound to texture unit 1. 0 stops peeling. Occlusion culling
+     * skips objects behind the layer in front, so turn it off while peeling
+     */
+    static void setPeelDepth(GLuint depthTexture);
+
+    /**
+     * Sets how many pixels a level of detail's error may cover before a
+     * finer level is drawn, 1 by default. 0 always draws the full meshes
+     */
+    static void setLodThreshold(float pixels);
+
+    /**
+     * Updates the camera and draws the objects
+     */
+    void render(arp::Pose pose, double aspectRatio, double fovY);
+
+    /**
+     * Number of draw calls issued by the last draw
+     */
+    int getDrawCount() const { return drawCount; }
 };
 
 #endif /* renderobject_h */
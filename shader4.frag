@@ -1,10 +1,46 @@
 #version 330 core
+#extension GL_ARB_bindless_texture : enable
 
 layout(location=0) out vec4 color;
+// surface for reprojection to add the specular term with, see
+// arp::SwapchainMaterialFormat. Dropped when the swapchain has no material
+layout(location=2) out vec4 material;
 
+// a texture unit or, where supported, a bindless handle
+#ifdef GL_ARB_bindless_texture
+layout(bindless_sampler) uniform sampler2D tex;
+#else
 uniform sampler2D tex;
+#endif
+// depth of the layer in front when depth peeling, see renderbatch::setPeelDepth.
+// peel is 0 when not peeling, 1 for default depth and -1 for reversed
+uniform sampler2D peelDepth;
+uniform int peel;
 in vec2 texCoord;
 
+// per layer, see shader4.vert
+layout(std140) uniform CameraUniforms {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    // origin and size of the viewport the grid's tiles divide
+    vec4 clusterViewport;
+    // near plane distance, then slices per unit of log distance
+    vec4 clusterDepth;
+    // tiles across and up, slices and lights, 0 without lights
+    ivec4 clusterGrid;
+};
+// lights of the layer, see renderbatch::setLights: two texels per light,
+// camera space position and radius then color
+uniform samplerBuffer lights;
+// offset into lightIndices and count of each cluster's lights
+uniform usamplerBuffer clusters;
+uniform usamplerBuffer lightIndices;
+// see renderbatch::setEnvironmentLighting, w of the first is 0 without it
+layout(std140) uniform EnvironmentUniforms {
+    vec4 environment[9];
+};
+
 in vec3 interpolatedNormal;
 in vec3 vertPos;
 
@@ -12,17 +48,65 @@ const float Ka = 1;
 const float Kd = 1; 
 const float Ks = 1;  
 const float shininess = 200;
+// of the material reprojection reshades
+const float roughness = 0.4;
+const float specularIntensity = 0.5;
 
 const vec3 lightPos = vec3(0.0, -1.0, -1.0);
 const vec3 specularColor = vec3(0.0, 0.0, 0.0);
 const vec3 lightColor = vec3(1.0, 1.0, 1.0);
 
 
+// how far behind the layer in front a fragment has to be, so the front
+// surfaces themselves are peeled despite depth quantization
+const float peelBias = 0.00001;
+
+// world space normal folded onto an octahedron, in [0, 1]
+vec2 encodeOctahedral(vec3 n) {
+  n /= abs(n.x) + abs(n.y) + abs(n.z);
+  vec2 encoded = n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+  return encoded * 0.5 + 0.5;
+}
+
+// diffuse light of the point lights in the fragment's cluster
+vec3 pointLighting(vec3 normal) {
+  if(clusterGrid.x == 0)
+    return vec3(0);
+  ivec2 tile = ivec2((gl_FragCoord.xy - clusterViewport.xy) / clusterViewport.zw * vec2(clusterGrid.xy));
+  int slice = int(log(max(-vertPos.z, clusterDepth.x) / clusterDepth.x) * clusterDepth.y);
+  ivec3 cluster = clamp(ivec3(tile, slice), ivec3(0), clusterGrid.xyz - 1);
+  uvec2 range = texelFetch(clusters, (cluster.z * clusterGrid.y + cluster.y) * clusterGrid.x + cluster.x).rg;
+  vec3 light = vec3(0);
+  for(uint i = range.x; i < range.x + range.y; i++) {
+    int index = int(texelFetch(lightIndices, int(i)).r);
+    vec4 positionRadius = texelFetch(lights, index * 2);
+    vec3 toLight = positionRadius.xyz - vertPos;
+    float distanceSquared = max(dot(toLight, toLight), 1e-8);
+    float falloff = max(1.0 - distanceSquared / (positionRadius.w * positionRadius.w), 0.0);
+    float geometry = max(dot(normal, toLight * inversesqrt(distanceSquared)), 0.0);
+    light += texelFetch(lights, index * 2 + 1).rgb * (falloff * falloff * geometry);
+  }
+  return light;
+}
+
+// diffuse light of the environment over pi, from its spherical harmonics
+vec3 environmentLighting(vec3 n) {
+  vec3 light = environment[0].rgb
+             + environment[1].rgb * n.y + environment[2].rgb * n.z + environment[3].rgb * n.x
+             + environment[4].rgb * (n.x * n.y) + environment[5].rgb * (n.y * n.z)
+             + environment[6].rgb * (3.0 * n.z * n.z - 1.0) + environment[7].rgb * (n.x * n.z)
+             + environment[8].rgb * (n.x * n.x - n.y * n.y);
+  return max(light, vec3(0));
+}
+
 void main() {
+  if(peel != 0 && float(peel) * (gl_FragCoord.z - texelFetch(peelDepth, ivec2(gl_FragCoord.xy), 0).r) <= peelBias)
+    discard;
   vec4 texColor = texture( tex, texCoord );
   vec3 diffuseColor = vec3( texColor );
-  vec3 ambientColor = diffuseColor * 0.1;
   vec3 norms = normalize(interpolatedNormal);
+  vec3 worldNormal = transpose(mat3(view)) * norms;
+  vec3 ambientColor = diffuseColor * (environment[0].w > 0.0 ? environmentLighting(worldNormal) : vec3(0.1));
   vec3 lightDirection = normalize(lightPos - vertPos);
 
   float geometryTerm = max(dot(norms, lightDirection), 0.0);
@@ -33,5 +117,7 @@ void main() {
   float halfAngle = max(dot(reflectedLightVector, viewVector), 0.0);
   float specular = pow(halfAngle, shininess);
     //color = texture( tex, texCoord );
-    color = vec4(Ka * ambientColor + Kd * max(geometryTerm, 0) * diffuseColor + Ks * max(specular, 0) * specularColor, 1.0);
+    color = vec4(Ka * ambientColor + Kd * (max(geometryTerm, 0) + pointLighting(norms)) * diffuseColor
+                 + Ks * max(specular, 0) * specularColor, 1.0);
+    material = vec4(encodeOctahedral(worldNormal), roughness, specularIntensity);
 } 
\ No newline at end of file
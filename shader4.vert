@@ -1,22 +1,54 @@
 #version 330 core
 
+// packed vertex, see PackedMeshVertex in arpmesh.h: position normalized
+// within the mesh's bounds, octahedral normal, half float coordinates
 layout(location=0) in vec3 pos;
-layout(location=1) in vec3 norm;
+layout(location=1) in vec2 norm;
 layout(location=2) in vec2 txc;
 
 out vec2 texCoord;
 out vec3 interpolatedNormal;
 out vec3 vertPos;
+// the shading pass after a depth pre-pass tests for equal depth, see
+// renderbatch::setDepthPrePass
+invariant gl_Position;
 
-uniform mat4 mvp;
-uniform mat4 mv;
-uniform mat3 mvNorms;
+// per layer, the cluster fields are read by shader4.frag
+layout(std140) uniform CameraUniforms {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec4 clusterViewport;
+    vec4 clusterDepth;
+    ivec4 clusterGrid;
+};
+
+// per mesh, the bounds positions are quantized within
+uniform vec3 positionMin;
+uniform vec3 positionExtent;
+
+// per instance
+layout(location=3) in mat4 model;
+layout(location=7) in mat3 normalMatrix;
+
+vec3 decodeOctahedral(vec2 encoded)
+{
+    vec3 n = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    // the lower half is folded over the upper one
+    if(n.z < 0.0) {
+        vec2 signs = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+        n.xy = (1.0 - abs(n.yx)) * signs;
+    }
+    return normalize(n);
+}
 
 void main()
 {
     texCoord = txc;
-    interpolatedNormal = normalize(vec3(mvNorms * norm));
-    vec4 vertPos4 = mv * vec4(pos, 1);
+    // lighting is done in camera space
+    interpolatedNormal = normalize(mat3(view) * (normalMatrix * decodeOctahedral(norm)));
+    vec4 worldPos = model * vec4(positionMin + pos * positionExtent, 1);
+    vec4 vertPos4 = view * worldPos;
     vertPos = vec3(vertPos4) / vertPos4.w;
-    gl_Position = mvp * vec4 (pos, 1);
+    gl_Position = viewProjection * worldPos;
 }
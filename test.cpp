@@ -1,6 +1,7 @@
 #include <GL/glew.h>
 #include "cyGL.h"
 #include "cyTriMesh.h"
+#include "cyPointCloud.h"
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
@@ -9,15 +10,33 @@ struct PoseData {
     double rotationX;
     double rotationY;
 };
-#define ARP_CUSTOM_POSE_DATA
 #include "arp.h"
+#include "arpcamera.h"
+#include "arpremote.h"
+#include "arpstate.h"
 #include "renderobject.h"
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <fstream>
+#include <map>
+#include <sstream>
 #include <string>
+#include <vector>
 #include <chrono>
 #include <thread>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
 #include <cmath>
+#include <random>
+
+#ifndef _WIN32
+#include <spawn.h>
+#include <unistd.h>
+extern char** environ;
+#endif
 
 #ifndef M_PI
     #define M_PI 3.14159265358979323846
@@ -65,7 +84,749 @@ static bool shouldPredict = false;
 static bool shouldBackground = false;
 static bool shouldParallax = false;
 
+// the background is a cube map that covers every direction, so it only has
+// to be rendered again once the camera has moved, at most this often
+static const double backgroundRate = 10;
+static const double backgroundRefreshDistance = 1;
+
+// frames parallax can fall back on where the newest one is disoccluded
+static const int frameHistoryLength = 2;
+
+/**
+ * One combination of settings measured by the benchmark
+ */
+struct BenchmarkConfig {
+    int targetFPS;
+    bool reproject;
+    bool parallax;
+    bool background;
+    bool gridWarp;
+};
+
+static bool benchmarking = false;
+static double benchmarkSeconds = 2.0;
+static std::ofstream benchmarkOutput;
+static std::vector<BenchmarkConfig> benchmarkConfigs;
+static int benchmarkConfigIndex = 0;
+static double benchmarkConfigStart = 0;
+static double benchmarkStartTime = 0;
+static std::uint64_t benchmarkFrame = 0;
+static std::uint64_t benchmarkMissedRefreshes = 0;
+// motion-to-photon latency histogram of each config, when requested
+static std::ofstream latencyOutput;
+static bool latencyMarker = false;
+// reprojection quality of each config against a ground truth rendered at
+// the display rate, when requested
+static std::ofstream qualityOutput;
+static arp::Swapchain* groundTruthSwapchain = nullptr;
+static double benchmarkGpuTotal = 0;
+static std::uint64_t benchmarkGpuSamples = 0;
+
+/**
+ * Standardized camera motions and configs of the performance suite, see
+ * perf_suite.cmake. ALL is the full sweep with the scripted path
+ */
+enum BenchmarkScenario {
+    SCENARIO_ALL,
+    SCENARIO_ROTATION,
+    SCENARIO_TRANSLATION,
+    SCENARIO_BACKGROUND,
+};
+static const char* const benchmarkScenarioNames[] = { "all", "rotation", "translation", "background" };
+static BenchmarkScenario benchmarkScenario = SCENARIO_ALL;
+
+/**
+ * What the benchmark measured in one config, for the JSON results and the
+ * budget and baseline checks
+ */
+struct BenchmarkSummary {
+    std::uint64_t frames;
+    double reprojectionGpuMean;
+    double reprojectionGpuP99;
+    double appFrameP99;
+    double latencyP99;
+    double missedRefreshesPerSecond;
+};
+
+// frame times of the current config, in ms
+static std::vector<double> benchmarkGpuTimes;
+static std::vector<double> benchmarkAppTimes;
+static std::vector<double> benchmarkLatencies;
+static std::uint64_t benchmarkConfigMissed = 0;
+static std::vector<BenchmarkSummary> benchmarkSummaries;
+static std::string benchmarkJsonPath;
+// files of "<metric> <value>" lines
+static std::string benchmarkBudgetPath;
+static std::string benchmarkBaselinePath;
+static std::string benchmarkSaveBaselinePath;
+// how far over its baseline a metric may get
+static double benchmarkTolerance = 0.1;
+// from the start of main to the first frame with every mesh loaded
+static std::chrono::steady_clock::time_point processStart;
+static double coldStartTime = -1;
+// main's, non-zero when a metric went over its budget or baseline
+static int benchmarkExitCode = 0;
+
+// generated scene in place of the sample one, when sceneObjects > 0
+static long sceneObjects = 0;
+static bool sceneRandom = false;
+static unsigned sceneSeed = 1;
+// turns every object about its vertical axis each frame
+static bool sceneSpin = false;
+// turns the first object, carrying the objects around it, and leaves the
+// rest of the scene still
+static bool sceneCarousel = false;
+static const float CAROUSEL_RADIUS = 12;
+// merges the floor and rocks, which never move, into a mesh per texture and
+// cell at load time
+static bool staticBatching = false;
+// point lights scattered over the scene, lit through clusters
+static int sceneLights = 0;
+// lights the scene with spherical harmonics baked at load time
+enum EnvironmentSource { ENVIRONMENT_NONE, ENVIRONMENT_SKY, ENVIRONMENT_LIGHTS };
+static EnvironmentSource environmentSource = ENVIRONMENT_NONE;
+// renders the main layer at a scale that keeps the GPU time in budget
+static bool dynamicResolution = false;
+// renders as often as the camera's movement needs, up to the target framerate
+static bool adaptiveFramerate = false;
+// jitters the main layer and lets reprojection accumulate it
+static bool temporalUpsampling = false;
+// renders half the main layer's quads per frame, reprojection fills in the rest
+static bool checkerboard = false;
+// fixed foveation in the middle of the window
+static bool foveation = false;
+// renders a main layer per eye, shown side by side
+static bool stereo = false;
+static bool sideWindows = false;
+// corrects the distortion of a typical headset lens
+static bool lensDistortion = false;
+// renders with reversed float depth
+static bool reversedZ = false;
+// lays down the scene's depth before shading it
+static bool depthPrePass = false;
+// culls the meshlets of GPU culled meshes
+static bool meshletCulling = false;
+// resubmits the last frame's images while the camera stays close to where
+// they were rendered and nothing in the scene changes
+static bool idleReuse = false;
+// the frame cache is used for a static scene, and a new version of the
+// scene starts whenever a frame is rendered while assets are still loading
+static bool frameCache = false;
+static std::uint64_t sceneVersion = 0;
+// fits the predicted camera motion to how the camera actually moved
+static bool tunePrediction = false;
+// has reprojection draw a crosshair pointer at the display rate
+static bool cursorSprite = false;
+// retained frames keep half resolution copies and hand their images back
+static bool compactHistory = false;
+// the background cube map only holds and renders the parts of its faces
+// the view can reach before the next frame
+static bool sparseBackground = false;
+// the background is rendered every frame, with what the main layer keeps
+// covering masked out of its depth so only the ring around it is shaded
+static bool maskBackground = false;
+// fits the main layer's near and far planes to the depth reprojection saw
+// in it, within the default 0.1 to 100
+static bool fitDepthRange = false;
+static float fittedNear = 0.1f;
+static float fittedFar = 100;
+// seconds of the predicted path whose textures stream in ahead of the
+// camera, 0 for none
+static double prefetchHorizon = 0;
+static const int PREFETCH_STEPS = 8;
+// how far the camera may move and turn, in radians, from the pose the
+// resubmitted images were rendered with
+static const float IDLE_REUSE_DISTANCE = 0.01f;
+static const float IDLE_REUSE_ANGLE = 0.002f;
+// the right eye's main layer, the left one's is swapchain
+static arp::Swapchain* rightSwapchain = nullptr;
+// depth peels a layer behind each main layer
+static bool depthPeeling = false;
+// the peeled layer of each eye
+static arp::Swapchain* peelSwapchains[2] = { nullptr, nullptr };
+// splits the main layer by depth into a near layer and a far one, shared by
+// both eyes and rendered at half resolution when the camera has moved
+static bool depthSplit = false;
+static arp::Swapchain* farSwapchain = nullptr;
+static const double farRate = 15;
+// plays a generated video in a corner through a CPU swapchain, written by a
+// thread of its own at the video's rate and shown as the top layer
+static bool videoLayer = false;
+static arp::CpuSwapchain* videoSwapchain = nullptr;
+static std::atomic<bool> videoDone{ false };
+static const double VIDEO_RATE = 24;
+// HUD panels along the top of the view, regions of one layer atlas drawn
+// by reprojection in a single instanced draw, shown under the video
+static int panelCount = 0;
+static const int MAX_PANELS = 3;
+static arp::LayerAtlas* panelAtlas = nullptr;
+static int panelRegions[MAX_PANELS];
+// renders the far layer at a quarter of the resolution instead, upsampled
+// through its depth
+static bool depthUpsampling = false;
+// how many times smaller than the window the far layer is
+static int farScale() {
+    return depthUpsampling ? 4 : 2;
+}
+// saves power on battery or when hot, or always. The far layer follows the
+// recommended background scale
+static arp::PowerMode powerMode = arp::POWER_MODE_NORMAL;
+// lets the main swapchains shrink to the images they need and grow again
+static bool adaptiveSwapchain = false;
+// samples per pixel of the main layers, resolved by reprojection
+static int msaaSamples = 1;
+// gives the layers' images mip chains, for when reprojection shows them
+// smaller than they were rendered
+static bool mipmaps = false;
+// lets reprojection add the specular highlights for each refresh's camera
+static bool reshading = false;
+// draws every reprojection program once before the first frame
+static bool warmUp = false;
+// built-in controller in place of poseFunction, empty for poseFunction
+static std::string cameraController;
+
+struct FlyCameraSettings : arp::FirstPersonCameraSettings {
+    static constexpr bool fly = true;
+};
+// fills disocclusions from a voxel cache of what earlier frames saw
+static bool voxelCache = false;
+// F11 asked for the cached voxel nearest the camera
+static bool voxelLookupPending = false;
+// traces the sample scene's triangles into disocclusions
+static bool sceneTrace = false;
+// world space triangles of the sample scene for --scene-trace
+static std::vector<glm::vec3> tracedPositions;
+static std::vector<std::uint32_t> tracedIndices;
+static std::vector<std::uint32_t> tracedColors;
+// renders for a remote client on this port instead of showing anything,
+// 0 when not serving
+static int remoteServerPort = 0;
+// sends the server's frames unpacked, to compare
+static bool remoteRaw = false;
+// adapts the server's framerate and resolution to the link
+static bool remoteAdaptive = false;
+// renders for any number of remote clients on this port, 0 when not
+// broadcasting
+static int broadcastPort = 0;
+// shows what a remote server renders instead of rendering, empty host when
+// not a client
+static std::string remoteHost;
+static int remotePort = 0;
+// where reprojection health is published, see arp::startStatsExport.
+// Not exported with statsPort 0
+static arp::StatsExportTarget statsTarget = arp::STATS_EXPORT_STATSD;
+static std::string statsHost;
+static int statsPort = 0;
+// prints every stutter arp detects, with its cause
+static bool jankLog = false;
+// prints when and how old each app frame was first shown
+static bool frameIdLog = false;
+// reprojects what apps on this machine render, connected through shared
+// memory under this name, empty when not a compositor
+static std::string compositorName;
+// renders for a local compositor under this name instead of showing
+// anything, empty when not an app of one
+static std::string compositorAppName;
+// runs as a compositor on the GPU driving the display and starts the app as
+// another process on the discrete GPU, see startCrossAdapterApp
+static bool crossAdapter = false;
+// offloads the app with NVIDIA's PRIME variables rather than Mesa's
+static bool crossAdapterNvidia = false;
+// the arguments the app process is started with
+static std::vector<std::string> crossAdapterArguments;
+
+static int benchmarkInput(double time, double& mouseX, double& mouseY, int* heldKeys, int maxHeldKeys);
+static bool recordBenchmarkFrame(const arp::PoseInfo& poseInfo);
+static void recordBenchmarkSummary(double seconds);
+static void finishBenchmark();
+static void recordBenchmarkLatency();
+static void recordBenchmarkQuality();
+static void renderGroundTruth(renderbatch& scene);
+static void runVideo();
+static void addSampleScene(renderbatch& scene);
+static void addGeneratedScene(renderbatch& scene);
+static void addSceneLights(renderbatch& scene);
+static void addTracedObject(const char* fileName, double x, double y, double z);
+static void lookUpVoxel(const arp::Pose& pose);
+static void runRemoteServer(GLFWwindow* window);
+static void runBroadcastServer(GLFWwindow* window);
+static void remoteClientCallback(GLFWwindow* window);
+static void compositorCallback(GLFWwindow* window);
+static bool startCrossAdapterApp();
+static void printJankEvents();
+static void printPresentedFrames();
+
+// settings come from the overlay, or from the current config when benchmarking
+static bool reprojectionEnabled() {
+    return benchmarking ? benchmarkConfigs[benchmarkConfigIndex].reproject : arp::getReprojectionToggle();
+}
+static bool parallaxEnabled() {
+    return benchmarking ? benchmarkConfigs[benchmarkConfigIndex].parallax : arp::getParallaxToggle();
+}
+static bool gridWarpEnabled() {
+    return benchmarking ? benchmarkConfigs[benchmarkConfigIndex].gridWarp : arp::getGridWarpToggle();
+}
+static bool backgroundEnabled() {
+    return benchmarking ? benchmarkConfigs[benchmarkConfigIndex].background : arp::getBackgroundToggle();
+}
+static int targetFramerate() {
+    return benchmarking ? benchmarkConfigs[benchmarkConfigIndex].targetFPS : arp::getTargetFramerate();
+}
+
 int main(int argc, char *argv[]) {
+    // --benchmark <output.csv> runs a scripted camera path through every
+    // config and writes one row per frame, --benchmark-seconds sets the
+    // time spent in each config. --benchmark-latency <latency.csv> adds a
+    // latency histogram per config, --latency-marker flashes a corner on
+    // each simulated key press for a photodiode. --benchmark-quality
+    // <quality.csv> sweeps the reprojection modes instead, comparing each
+    // with a ground truth rendered at the display rate.
+    // --benchmark-scenario <rotation|translation|background> runs one of the
+    // performance suite's scenarios instead, --benchmark-json <file> writes
+    // a summary of each config, --benchmark-budget <file> fails the run when
+    // a metric goes over its budget and --benchmark-baseline <file> when it
+    // goes more than --benchmark-tolerance <fraction> over a baseline saved
+    // with --benchmark-save-baseline <file>. --record <log>
+    // records the session's input, --replay <log> replays a recorded one,
+    // in place of the scripted path when benchmarking. --scene-objects <n>
+    // replaces the sample scene with n copies of the assets on a grid, or
+    // scattered with --scene-random [seed], --scene-spin turns them every
+    // frame, --scene-carousel only turns the first with those near it. --static-batching merges the objects that never move into a
+    // few meshes at load time. --scene-lights <n> scatters n point lights over the scene.
+    // --environment sky lights it with a baked sky, --environment lights
+    // bakes the scene lights into the environment instead of clustering them.
+    // --power auto saves power on battery or when the CPU runs hot,
+    // --power saving always does. --adaptive-swapchain lets the main
+    // swapchains drop to two images while that doesn't block rendering.
+    // --dynamic-resolution lowers the
+    // main layer's resolution when the GPU falls behind,
+    // --adaptive-framerate renders it only as often as the camera's
+    // movement needs, up to the target framerate,
+    // --temporal-upsampling accumulates it over jittered frames and
+    // --checkerboard renders half of it per frame. --foveation reprojects
+    // the edges of the window at a quarter of the quality, --stereo renders
+    // and reprojects a view per eye side by side and --lens-distortion
+    // distorts them for a headset's lenses. --reversed-z renders with
+    // reversed 32 bit float depth, --depth-prepass draws the scene's depth
+    // before shading it, --meshlet-culling culls the parts of GPU culled
+    // meshes facing away or off screen, --half-res-march marches parallax rays
+    // through half resolution depth and --depth-peeling adds a layer of the
+    // surfaces behind the main layer's, for parallax to reveal.
+    // --depth-split renders distant objects into a layer of their own,
+    // updated only as the camera moves, at a quarter of the resolution with
+    // --depth-upsampling, which upsamples it through its depth. --mipmaps
+    // gives the layers mip chains for reprojection to minify them with.
+    // --msaa <n> renders the main layers with n samples per pixel, which
+    // reprojection resolves. --reshading has reprojection add the main
+    // layers' specular highlights for where the camera is when it shows them.
+    // --warm-up draws every reprojection program before the first frame, so
+    // toggling features doesn't stutter. --camera <fps|fly|orbit|vehicle>
+    // moves the camera with one of arp's built-in controllers.
+    // --voxel-cache fills disocclusions
+    // from what earlier frames saw, F11 prints the voxel nearest the camera.
+    // --scene-trace ray traces the sample scene into disocclusions.
+    // --idle-reuse resubmits the last frame instead of rendering while the
+    // camera is nearly still. --tune-prediction scales predicted camera
+    // motion to how far the camera actually moved by each new frame.
+    // --cursor replaces the system cursor with a crosshair reprojection
+    // draws every refresh. --video-layer plays a video decoded on the CPU
+    // in a corner at its own rate. --panels <n> shows up to 3 HUD panels
+    // from one layer atlas. --fit-depth-range narrows the main
+    // layer's near and far planes to the depth its last frames had.
+    // --beam-racing <slices> draws each refresh straight to the screen in
+    // that many slices, each just ahead of the raster. --compact-history
+    // keeps the frame history as half resolution copies.
+    // --sparse-background commits memory for and renders only the parts of
+    // the background the view can turn to. --mask-background renders the
+    // background every frame, skipping what the main layer covers.
+    // --remote-server <port> renders the main layer for a client and
+    // --remote-client <host:port> reprojects what a server renders.
+    // --remote-raw sends the server's frames without packing them,
+    // --remote-adaptive lowers their rate and resolution to fit the link.
+    // --broadcast-server <port> renders for any number of clients, the main
+    // layer once per group of nearby clients and a wide background for all.
+    // --compositor <name> reprojects in a process of its own what apps
+    // started with --compositor-app <name> render, one at a time.
+    // --cross-adapter [nvidia] reprojects on the GPU driving the display and
+    // renders in an app process on the discrete GPU of a PRIME laptop.
+    // --statsd <host:port> sends reprojection health to a StatsD server
+    // every 10 seconds, --prometheus <port> serves it for Prometheus.
+    // --jank prints each missed vblank, stale frame and long swapchain wait
+    // with its cause.
+    // --frame-ids prints the refresh that first showed each app frame, and
+    // how old the frame and its pose were by then.
+    // --capture <path> saves the presented frames, as one raw video if the
+    // path ends in .raw and as PNG files starting with path otherwise.
+    // --headless [WxH] reprojects offscreen at 60 Hz, showing nothing.
+    // --variable-refresh presents frames as they arrive on a G-Sync or
+    // FreeSync display. --side-windows adds a window on each side looking
+    // left and right of the camera. --texture-budget <MB> streams texture
+    // levels within that much memory. --prefetch <seconds> streams them in
+    // along the camera's predicted path that far ahead. --interpolate shows
+    // frames one frame late, interpolated between the two newest, until
+    // input arrives. --adaptive-vsync tears late refreshes instead of
+    // holding them back a refresh. --frame-cache <MB> keeps that much of
+    // submitted frames to resubmit when the camera returns to their pose.
+    // --upload-budget <percent> limits asset uploads to that share of each
+    // frame. --asset-pack <pack> loads baked
+    // meshes, textures and shaders from an .arppack. --pose-budget <ms> runs the pose
+    // function on a helper thread, extrapolating when it takes longer.
+    // --frames-in-flight <n> lets the GPU render up to n frames while the
+    // next one is built. --render-thread reprojects on a thread of its own
+    // and leaves this one to window events
+    processStart = std::chrono::steady_clock::now();
+    std::string recordPath, replayPath, capturePath;
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(arg == "--benchmark" && i + 1 < argc) {
+            benchmarking = true;
+            benchmarkOutput.open(argv[++i]);
+            if(!benchmarkOutput) {
+                std::cout << "Unable to open benchmark output " << argv[i] << std::endl;
+                return -1;
+            }
+        }
+        else if(arg == "--benchmark-seconds" && i + 1 < argc) {
+            benchmarkSeconds = std::stod(argv[++i]);
+        }
+        else if(arg == "--benchmark-latency" && i + 1 < argc) {
+            latencyOutput.open(argv[++i]);
+            if(!latencyOutput) {
+                std::cout << "Unable to open latency output " << argv[i] << std::endl;
+                return -1;
+            }
+            latencyOutput << "config,target_fps,reproject,parallax,background,bin_ms,refreshes\n";
+        }
+        else if(arg == "--benchmark-quality" && i + 1 < argc) {
+            qualityOutput.open(argv[++i]);
+            if(!qualityOutput) {
+                std::cout << "Unable to open quality output " << argv[i] << std::endl;
+                return -1;
+            }
+            qualityOutput << "config,target_fps,reproject,parallax,grid_warp,background,comparisons,"
+                             "psnr_db,min_psnr_db,ssim,disoccluded_percent,reprojection_gpu_ms\n";
+        }
+        else if(arg == "--benchmark-scenario" && i + 1 < argc) {
+            std::string name = argv[++i];
+            auto found = std::find(std::begin(benchmarkScenarioNames), std::end(benchmarkScenarioNames), name);
+            if(found == std::end(benchmarkScenarioNames)) {
+                std::cout << "Unknown benchmark scenario " << name << std::endl;
+                return -1;
+            }
+            benchmarkScenario = (BenchmarkScenario)(found - std::begin(benchmarkScenarioNames));
+        }
+        else if(arg == "--benchmark-json" && i + 1 < argc) {
+            benchmarkJsonPath = argv[++i];
+        }
+        else if(arg == "--benchmark-budget" && i + 1 < argc) {
+            benchmarkBudgetPath = argv[++i];
+        }
+        else if(arg == "--benchmark-baseline" && i + 1 < argc) {
+            benchmarkBaselinePath = argv[++i];
+        }
+        else if(arg == "--benchmark-tolerance" && i + 1 < argc) {
+            benchmarkTolerance = std::stod(argv[++i]);
+        }
+        else if(arg == "--benchmark-save-baseline" && i + 1 < argc) {
+            benchmarkSaveBaselinePath = argv[++i];
+        }
+        else if(arg == "--latency-marker") {
+            latencyMarker = true;
+        }
+        else if(arg == "--record" && i + 1 < argc) {
+            recordPath = argv[++i];
+        }
+        else if(arg == "--replay" && i + 1 < argc) {
+            replayPath = argv[++i];
+        }
+        else if(arg == "--scene-objects" && i + 1 < argc) {
+            sceneObjects = std::stol(argv[++i]);
+        }
+        else if(arg == "--scene-random") {
+            sceneRandom = true;
+            if(i + 1 < argc && std::isdigit((unsigned char)argv[i + 1][0]))
+                sceneSeed = std::stoul(argv[++i]);
+        }
+        else if(arg == "--scene-spin") {
+            sceneSpin = true;
+        }
+        else if(arg == "--scene-carousel") {
+            sceneCarousel = true;
+        }
+        else if(arg == "--static-batching") {
+            staticBatching = true;
+        }
+        else if(arg == "--scene-lights" && i + 1 < argc) {
+            sceneLights = std::stoi(argv[++i]);
+        }
+        else if(arg == "--power" && i + 1 < argc) {
+            std::string mode = argv[++i];
+            powerMode = mode == "saving" ? arp::POWER_MODE_SAVING : arp::POWER_MODE_AUTO;
+        }
+        else if(arg == "--adaptive-swapchain") {
+            adaptiveSwapchain = true;
+        }
+        else if(arg == "--environment" && i + 1 < argc) {
+            std::string source = argv[++i];
+            environmentSource = source == "lights" ? ENVIRONMENT_LIGHTS : ENVIRONMENT_SKY;
+        }
+        else if(arg == "--dynamic-resolution") {
+            dynamicResolution = true;
+        }
+        else if(arg == "--adaptive-framerate") {
+            adaptiveFramerate = true;
+        }
+        else if(arg == "--temporal-upsampling") {
+            temporalUpsampling = true;
+        }
+        else if(arg == "--checkerboard") {
+            checkerboard = true;
+        }
+        else if(arg == "--foveation") {
+            foveation = true;
+        }
+        else if(arg == "--stereo") {
+            stereo = true;
+        }
+        else if(arg == "--lens-distortion") {
+            lensDistortion = true;
+        }
+        else if(arg == "--reversed-z") {
+            reversedZ = true;
+        }
+        else if(arg == "--meshlet-culling") {
+            meshletCulling = true;
+        }
+        else if(arg == "--idle-reuse") {
+            idleReuse = true;
+        }
+        else if(arg == "--tune-prediction") {
+            tunePrediction = true;
+        }
+        else if(arg == "--cursor") {
+            cursorSprite = true;
+        }
+        else if(arg == "--fit-depth-range") {
+            fitDepthRange = true;
+        }
+        else if(arg == "--compact-history") {
+            compactHistory = true;
+        }
+        else if(arg == "--sparse-background") {
+            sparseBackground = true;
+        }
+        else if(arg == "--mask-background") {
+            maskBackground = true;
+        }
+        else if(arg == "--beam-racing" && i + 1 < argc) {
+            arp::setReprojectionSchedule(arp::SCHEDULE_BEAM_RACING);
+            arp::setBeamRacingSlices(std::stoi(argv[++i]));
+        }
+        else if(arg == "--video-layer") {
+            videoLayer = true;
+        }
+        else if(arg == "--panels" && i + 1 < argc) {
+            panelCount = glm::clamp(std::stoi(argv[++i]), 0, MAX_PANELS);
+        }
+        else if(arg == "--depth-prepass") {
+            depthPrePass = true;
+        }
+        else if(arg == "--depth-split") {
+            depthSplit = true;
+        }
+        else if(arg == "--depth-upsampling") {
+            depthUpsampling = true;
+        }
+        else if(arg == "--mipmaps") {
+            mipmaps = true;
+        }
+        else if(arg == "--warm-up") {
+            warmUp = true;
+        }
+        else if(arg == "--camera" && i + 1 < argc) {
+            cameraController = argv[++i];
+        }
+        else if(arg == "--reshading") {
+            reshading = true;
+        }
+        else if(arg == "--msaa" && i + 1 < argc) {
+            msaaSamples = std::stoi(argv[++i]);
+        }
+        else if(arg == "--voxel-cache") {
+            voxelCache = true;
+        }
+        else if(arg == "--scene-trace") {
+            sceneTrace = true;
+        }
+        else if(arg == "--remote-server" && i + 1 < argc) {
+            remoteServerPort = std::stoi(argv[++i]);
+        }
+        else if(arg == "--remote-raw") {
+            remoteRaw = true;
+        }
+        else if(arg == "--remote-adaptive") {
+            remoteAdaptive = true;
+        }
+        else if(arg == "--broadcast-server" && i + 1 < argc) {
+            broadcastPort = std::stoi(argv[++i]);
+        }
+        else if(arg == "--remote-client" && i + 1 < argc) {
+            std::string address = argv[++i];
+            std::size_t colon = address.rfind(':');
+            if(colon == std::string::npos) {
+                std::cout << "--remote-client takes host:port" << std::endl;
+                return -1;
+            }
+            remoteHost = address.substr(0, colon);
+            remotePort = std::stoi(address.substr(colon + 1));
+        }
+        else if(arg == "--statsd" && i + 1 < argc) {
+            std::string address = argv[++i];
+            std::size_t colon = address.rfind(':');
+            if(colon == std::string::npos) {
+                std::cout << "--statsd takes host:port" << std::endl;
+                return -1;
+            }
+            statsTarget = arp::STATS_EXPORT_STATSD;
+            statsHost = address.substr(0, colon);
+            statsPort = std::stoi(address.substr(colon + 1));
+        }
+        else if(arg == "--prometheus" && i + 1 < argc) {
+            statsTarget = arp::STATS_EXPORT_PROMETHEUS;
+            statsPort = std::stoi(argv[++i]);
+        }
+        else if(arg == "--jank") {
+            jankLog = true;
+        }
+        else if(arg == "--frame-ids") {
+            frameIdLog = true;
+        }
+        else if(arg == "--compositor" && i + 1 < argc) {
+            compositorName = argv[++i];
+        }
+        else if(arg == "--compositor-app" && i + 1 < argc) {
+            compositorAppName = argv[++i];
+        }
+        else if(arg == "--cross-adapter") {
+            crossAdapter = true;
+            if(i + 1 < argc && std::string(argv[i + 1]) == "nvidia") {
+                crossAdapterNvidia = true;
+                i++;
+            }
+        }
+        else if(arg == "--capture" && i + 1 < argc) {
+            capturePath = argv[++i];
+        }
+        else if(arg == "--side-windows") {
+            sideWindows = true;
+        }
+        else if(arg == "--variable-refresh") {
+            arp::setVariableRefresh(true);
+        }
+        else if(arg == "--headless") {
+            arp::HeadlessOutput output;
+            output.enabled = true;
+            int width, height;
+            if(i + 1 < argc && std::sscanf(argv[i + 1], "%dx%d", &width, &height) == 2) {
+                output.width = width;
+                output.height = height;
+                i++;
+            }
+            arp::setHeadless(output);
+        }
+        else if(arg == "--texture-budget" && i + 1 < argc) {
+            renderobject::setTextureBudget((std::int64_t)(std::stod(argv[++i]) * 1024 * 1024));
+        }
+        else if(arg == "--prefetch" && i + 1 < argc) {
+            prefetchHorizon = std::stod(argv[++i]);
+        }
+        else if(arg == "--interpolate") {
+            arp::setFrameInterpolation(true);
+        }
+        else if(arg == "--adaptive-vsync") {
+            arp::setAdaptiveVsync(true);
+        }
+        else if(arg == "--frame-cache" && i + 1 < argc) {
+            arp::FrameCacheSettings settings;
+            settings.budgetBytes = (std::int64_t)(std::stod(argv[++i]) * 1024 * 1024);
+            arp::setFrameCache(settings);
+            frameCache = true;
+        }
+        else if(arg == "--upload-budget" && i + 1 < argc) {
+            renderobject::setUploadBudget(std::stod(argv[++i]) / 100.0);
+        }
+        else if(arg == "--asset-pack" && i + 1 < argc) {
+            if(!renderobject::setAssetPack(argv[++i]))
+                return -1;
+        }
+        else if(arg == "--pose-budget" && i + 1 < argc) {
+            arp::setPoseFunctionBudget(std::stod(argv[++i]) / 1000.0);
+        }
+        else if(arg == "--frames-in-flight" && i + 1 < argc) {
+            arp::setFramesInFlight(std::stoi(argv[++i]));
+        }
+        else if(arg == "--render-thread") {
+            arp::ThreadConfig config;
+            config.renderThread = true;
+            arp::setThreadConfig(config);
+        }
+        else if(arg == "--depth-peeling") {
+            depthPeeling = true;
+        }
+        else if(arg == "--half-res-march") {
+            arp::setHalfResolutionMarch(true);
+        }
+    }
+    if(crossAdapter) {
+#ifdef _WIN32
+        std::cout << "Cross-adapter mode needs PRIME render offload, which Windows doesn't have" << std::endl;
+        return -1;
+#else
+        // the app gets the same arguments minus this mode's, and renders for
+        // this process
+        compositorName = "arp-cross-adapter-" + std::to_string(getpid());
+        for(int i = 0; i < argc; i++) {
+            std::string arg = argv[i];
+            if(arg == "--cross-adapter") {
+                i += crossAdapterNvidia ? 1 : 0;
+                continue;
+            }
+            crossAdapterArguments.push_back(arg);
+        }
+        crossAdapterArguments.push_back("--compositor-app");
+        crossAdapterArguments.push_back(compositorName);
+#endif
+    }
+    if(benchmarking && benchmarkScenario == SCENARIO_BACKGROUND) {
+        benchmarkConfigs.push_back({30, true, true, false, false});
+        benchmarkConfigs.push_back({30, true, true, true, false});
+    }
+    else if(benchmarking && benchmarkScenario != SCENARIO_ALL) {
+        // rotation only and parallax, what the motion costs each
+        benchmarkConfigs.push_back({30, true, false, false, false});
+        benchmarkConfigs.push_back({30, true, true, false, false});
+    }
+    else if(benchmarking && qualityOutput.is_open()) {
+        // rotation only, parallax (the Hi-Z trace) and grid warp
+        for(int fps : {15, 30}) {
+            benchmarkConfigs.push_back({fps, true, false, false, false});
+            benchmarkConfigs.push_back({fps, true, true, false, false});
+            benchmarkConfigs.push_back({fps, true, false, false, true});
+        }
+    }
+    else if(benchmarking) {
+        for(int fps : {15, 30, 60}) {
+            for(int flags = 0; flags < 8; flags++) {
+                benchmarkConfigs.push_back({fps, (flags & 1) != 0, (flags & 2) != 0, (flags & 4) != 0, false});
+            }
+        }
+    }
+    if(benchmarking) {
+        benchmarkOutput << "config,target_fps,reproject,parallax,background,frame,time,"
+                           "app_cpu_ms,app_gpu_ms,swapchain_wait_ms,reprojection_cpu_ms,"
+                           "reprojection_gpu_ms,dropped_refreshes,latency_ms\n";
+    }
+
     if (!glfwInit()) {
         std::cout << "Unable to initialize GLFW" << std::endl;
         return -1;
@@ -76,6 +837,7 @@ int main(int argc, char *argv[]) {
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    arp::hintContextPriority();
     
     GLFWwindow* window = glfwCreateWindow(1920, 1080, "ARP Demo", NULL, NULL);
     if (!window) {
@@ -99,202 +861,1263 @@ int main(int argc, char *argv[]) {
         return -1;
     }
 
-    arp::registerPoseFunction(poseFunction);
-    aspectRatio = 1920.0 / 1080.0;
+    // the server renders with the client's poses and shows nothing itself
+    if(remoteServerPort || !compositorAppName.empty()) {
+        glfwHideWindow(window);
+        runRemoteServer(window);
+        return 0;
+    }
+    if(broadcastPort) {
+        glfwHideWindow(window);
+        runBroadcastServer(window);
+        return 0;
+    }
+
+    if(cameraController == "fps")
+        arp::registerPoseFunction(arp::cameraPoseFunction<arp::FirstPersonCamera<>>);
+    else if(cameraController == "fly")
+        arp::registerPoseFunction(arp::cameraPoseFunction<arp::FirstPersonCamera<FlyCameraSettings>>);
+    else if(cameraController == "orbit")
+        arp::registerPoseFunction(arp::cameraPoseFunction<arp::OrbitCamera<>>);
+    else if(cameraController == "vehicle")
+        arp::registerPoseFunction(arp::cameraPoseFunction<arp::VehicleCamera<>>);
+    else if(cameraController.empty())
+        arp::registerPoseFunction(poseFunction);
+    else {
+        std::cout << "Unknown camera " << cameraController << std::endl;
+        return -1;
+    }
+    // spinning turns every object, merged ones would turn whole cells
+    if(staticBatching && sceneSpin) {
+        std::cout << "Spinning objects can't be merged, not batching static objects" << std::endl;
+        staticBatching = false;
+    }
+    // setting every transform replaces the hierarchy
+    if(sceneSpin && sceneCarousel) {
+        std::cout << "Spinning turns every object, not turning a carousel" << std::endl;
+        sceneCarousel = false;
+    }
+    if(benchmarking) {
+        arp::setInputOverride(benchmarkInput);
+        benchmarkStartTime = glfwGetTime();
+        if(latencyOutput.is_open())
+            arp::setLatencyMeasurement(true, latencyMarker);
+    }
+    if(!replayPath.empty() && !arp::startInputReplay(replayPath.c_str())) {
+        std::cout << "Unable to replay " << replayPath << std::endl;
+        return -1;
+    }
+    if(!recordPath.empty() && !arp::startInputRecording(recordPath.c_str())) {
+        std::cout << "Unable to record to " << recordPath << std::endl;
+        return -1;
+    }
+    if(!capturePath.empty()) {
+        arp::CaptureSettings settings;
+        bool raw = capturePath.size() > 4 && capturePath.compare(capturePath.size() - 4, 4, ".raw") == 0;
+        settings.format = raw ? arp::CAPTURE_FORMAT_RAW : arp::CAPTURE_FORMAT_PNG;
+        if(!arp::startCapture(capturePath.c_str(), settings))
+            return -1;
+    }
+    // with stereo the projection is that of one eye, half the window
+    aspectRatio = (stereo ? 960.0 : 1920.0) / 1080.0;
     arp::updateProjection(0.1, 100, fovY, aspectRatio);
-    arp::startReprojection(appCallback);
+    if(sideWindows) {
+        // each side window continues the view where the main one ends
+        const int sideWidth = 960;
+        double halfTan = std::tan(fovY / 2);
+        double yaw = std::atan(halfTan * aspectRatio) + std::atan(halfTan * sideWidth / 1080.0);
+        for(int side : {1, -1}) {
+            GLFWwindow* sideWindow = glfwCreateWindow(sideWidth, 1080, "ARP Demo side", NULL, window);
+            if(!sideWindow) {
+                std::cout << "Unable to create side window" << std::endl;
+                return -1;
+            }
+            arp::OutputView view;
+            view.orientation = glm::angleAxis((float)(side * yaw), glm::vec3(0, 1, 0));
+            arp::addOutputWindow(sideWindow, view);
+        }
+    }
+    if(stereo) {
+        arp::StereoConfig config;
+        config.enabled = true;
+        arp::setStereo(config);
+    }
+    if(lensDistortion) {
+        arp::LensDistortion distortion;
+        distortion.enabled = true;
+        arp::setLensDistortion(distortion);
+    }
+    if(voxelCache) {
+        arp::VoxelCache cache;
+        cache.enabled = true;
+        arp::setVoxelCache(cache);
+    }
+    arp::setShaderCacheDirectory("shadercache");
+    arp::setPipelineWarmUp(warmUp);
+    arp::setPredictionTuning(tunePrediction);
+    if(cursorSprite) {
+        // white lines with a dark outline, visible on any background
+        const int size = 17, center = size / 2;
+        std::vector<unsigned char> pixels(size * size * 4, 0);
+        for(int y = 0; y < size; y++) {
+            for(int x = 0; x < size; x++) {
+                int dx = std::abs(x - center), dy = std::abs(y - center);
+                unsigned char* pixel = &pixels[(y * size + x) * 4];
+                if((dx == 0 || dy == 0) && dx + dy > 1) {
+                    pixel[0] = pixel[1] = pixel[2] = pixel[3] = 255;
+                }
+                else if((dx <= 1 || dy <= 1) && dx + dy > 1 && std::max(dx, dy) <= center) {
+                    pixel[3] = 160;
+                }
+            }
+        }
+        arp::CursorSprite sprite;
+        sprite.width = sprite.height = size;
+        sprite.pixels = pixels.data();
+        sprite.hotspotX = sprite.hotspotY = center;
+        arp::setCursorSprite(&sprite);
+    }
+    if(powerMode != arp::POWER_MODE_NORMAL) {
+        arp::PowerSettings power;
+        power.mode = powerMode;
+        arp::setPowerMode(power);
+    }
+    if(statsPort) {
+        arp::StatsExportSettings stats;
+        stats.target = statsTarget;
+        stats.host = statsHost.c_str();
+        stats.port = statsPort;
+        arp::startStatsExport(stats);
+    }
+    if(jankLog) {
+        arp::JankDetection detection;
+        detection.enabled = true;
+        arp::setJankDetection(detection);
+    }
+    arp::setFrameHistoryLength(frameHistoryLength);
+    arp::setCompactFrameHistory(compactHistory);
+    if(foveation) {
+        arp::Foveation settings;
+        settings.enabled = true;
+        arp::setFoveation(settings);
+    }
+    if(!remoteHost.empty())
+        arp::startReprojection(remoteClientCallback);
+    else if(!compositorName.empty())
+        arp::startReprojection(compositorCallback);
+    else
+        arp::startReprojection(appCallback);
 
     // arp has taken over this thread and blocks until program is over
+    return benchmarkExitCode;
 }
 
 static void appCallback(GLFWwindow* window) {
-    swapchain = new arp::Swapchain(1920, 1080, 3);
-    backgroundSwapchain = new arp::Swapchain(swapchain->width / 2, swapchain->height / 2, 3);
-    
-    std::vector<renderobject> tiles;
-    
-    double x = -12.4 * 5;
-    double y = -12.4 * 3;
-    int counter = 0;
+    arp::SwapchainCreateInfo swapchainInfo;
+    swapchainInfo.width = stereo ? 960 : 1920;
+    swapchainInfo.height = 1080;
+    // one image for rendering, one in flight and one per retained frame
+    swapchainInfo.numImages = 2 + frameHistoryLength;
+    if(adaptiveSwapchain) {
+        swapchainInfo.numImages++;
+        swapchainInfo.minImages = 2;
+    }
+    swapchainInfo.mipmaps = mipmaps;
+    swapchainInfo.samples = msaaSamples;
+    if(reshading)
+        swapchainInfo.materialFormat = arp::MATERIAL_FORMAT_RGBA8;
+    // reversed depth is 1 at the near plane and shrinks toward the far one,
+    // where floats are densest
+    if(reversedZ && !(GLEW_VERSION_4_5 || GLEW_ARB_clip_control)) {
+        std::cout << "Reversed depth needs glClipControl, using the default depth" << std::endl;
+        reversedZ = false;
+    }
+    if(reversedZ) {
+        swapchainInfo.depthFormat = arp::DEPTH_FORMAT_32F;
+        glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE);
+        glClearDepth(0);
+        glDepthFunc(GL_GREATER);
+        renderbatch::setReversedZ(true);
+    }
+    renderbatch::setDepthPrePass(depthPrePass);
+    renderbatch::setMeshletCulling(meshletCulling);
+    swapchain = new arp::Swapchain(swapchainInfo);
+    if(stereo)
+        rightSwapchain = new arp::Swapchain(swapchainInfo);
+    // the checkerboard mask's near depth would leave nothing to peel in the
+    // skipped quads
+    if(depthPeeling && checkerboard) {
+        std::cout << "Depth peeling doesn't work with the checkerboard, not peeling" << std::endl;
+        depthPeeling = false;
+    }
+    // peeling reads the main layer's depth before reprojection resolves it
+    if(depthPeeling && msaaSamples > 1) {
+        std::cout << "Depth peeling doesn't work with MSAA, not peeling" << std::endl;
+        depthPeeling = false;
+    }
+    if(depthPeeling) {
+        for(int eye = 0; eye < (stereo ? 2 : 1); eye++)
+            peelSwapchains[eye] = new arp::Swapchain(swapchainInfo);
+        // occlusion culling would skip the objects behind the main layer
+        renderbatch::setOcclusionCulling(false);
+    }
+
+    if(depthSplit) {
+        arp::SwapchainCreateInfo farInfo = swapchainInfo;
+        farInfo.width = swapchainInfo.width / farScale();
+        farInfo.height = swapchainInfo.height / farScale();
+        farInfo.materialFormat = arp::MATERIAL_FORMAT_NONE;
+        farSwapchain = new arp::Swapchain(farInfo);
+    }
+
+    // the background is never parallax mapped, it only needs depth testing.
+    // A 90 degree face at half the main layer's resolution
+    arp::SwapchainCreateInfo backgroundInfo = swapchainInfo;
+    backgroundInfo.width = swapchainInfo.height / 2;
+    backgroundInfo.height = swapchainInfo.height / 2;
+    backgroundInfo.depthFormat = arp::DEPTH_FORMAT_16;
+    backgroundInfo.imageType = arp::IMAGE_TYPE_CUBE_MAP;
+    backgroundInfo.samples = 1;
+    backgroundInfo.materialFormat = arp::MATERIAL_FORMAT_NONE;
+    backgroundInfo.sparse = sparseBackground;
+    backgroundSwapchain = new arp::Swapchain(backgroundInfo);
+
+    if(videoLayer)
+        videoSwapchain = new arp::CpuSwapchain(0, swapchainInfo.width / 2, swapchainInfo.height / 2);
+
+    // one image being cleared, one waiting for reprojection and one shown
+    if(panelCount > 0) {
+        arp::SwapchainCreateInfo atlasInfo{ 512, 512, 3 };
+        atlasInfo.depthFormat = arp::DEPTH_FORMAT_NONE;
+        panelAtlas = new arp::LayerAtlas(atlasInfo);
+        for(int i = 0; i < panelCount; i++)
+            panelRegions[i] = panelAtlas->allocateRegion(240, 135);
+    }
+
+    // one image being rendered, one waiting for reprojection and one being
+    // compared
+    if(benchmarking && qualityOutput.is_open()) {
+        arp::SwapchainCreateInfo groundTruthInfo = swapchainInfo;
+        groundTruthInfo.numImages = 3;
+        groundTruthInfo.mipmaps = false;
+        groundTruthInfo.samples = 1;
+        groundTruthInfo.materialFormat = arp::MATERIAL_FORMAT_NONE;
+        groundTruthSwapchain = new arp::Swapchain(groundTruthInfo);
+    }
+
+    // objects show up as their assets finish loading
+    renderobject::startAssetLoader(arp::getUploadContext());
     
-    for(int i = 0; i < 10; i++)
-    {
-        for(int j = 0; j < 10; j++)
-        {
-            if(counter == 0) tiles.push_back(renderobject("tileFloor1W1.obj", x, -10, y));
-            if(counter == 1) tiles.push_back(renderobject("tileFloor2W1.obj", x, -10, y));
-            if(counter == 2) tiles.push_back(renderobject("tileFloor3W1.obj", x, -10, y));
-            if(counter == 3) tiles.push_back(renderobject("tileFloor4W1.obj", x, -10, y));
-            
-            counter = ++counter % 4;
-            x += 6.2;
+    // objects sharing a mesh are drawn with one instanced draw call
+    renderbatch scene;
+    if(sceneObjects > 0)
+        addGeneratedScene(scene);
+    else
+        addSampleScene(scene);
+    if(sceneLights > 0)
+        addSceneLights(scene);
+    if(environmentSource == ENVIRONMENT_SKY) {
+        // blue above the horizon, brighter toward a sun, dim brown ground
+        glm::vec3 sun = glm::normalize(glm::vec3(0.3f, 0.8f, 0.5f));
+        EnvironmentLighting environment = bakeEnvironment([sun](const glm::vec3& direction) {
+            if(direction.y < 0)
+                return glm::vec3(0.15f, 0.12f, 0.1f);
+            glm::vec3 sky = glm::mix(glm::vec3(0.6f, 0.7f, 0.8f), glm::vec3(0.25f, 0.4f, 0.75f), direction.y);
+            return sky + glm::vec3(3.0f, 2.8f, 2.5f) * std::pow(std::max(glm::dot(direction, sun), 0.0f), 64.0f);
+        });
+        renderbatch::setEnvironmentLighting(&environment);
+    }
+    if(!tracedIndices.empty()) {
+        arp::SceneGeometry geometry;
+        geometry.positions = tracedPositions.data();
+        geometry.vertexCount = tracedPositions.size();
+        geometry.indices = tracedIndices.data();
+        geometry.triangleCount = tracedIndices.size() / 3;
+        geometry.colors = tracedColors.data();
+        arp::setSceneGeometry(geometry);
+    }
+    // the scene's own lighting has no specular term, so a light from above
+    // is all the highlights there are
+    if(reshading) {
+        arp::ReshadingLight light;
+        light.position = glm::vec4(glm::normalize(glm::vec3(0.3, 1, 0.5)), 0);
+        arp::setReshadingLights(&light, 1);
+    }
+    arp::glState().setEnabled(GL_DEPTH_TEST, true);
+    ObjectTransforms sceneTransforms;
+    if(sceneSpin) {
+        sceneTransforms.resize(scene.getObjectCount());
+        for(int i = 0; i < scene.getObjectCount(); i++) {
+            glm::vec3 position = scene.getPosition(i);
+            sceneTransforms.x[i] = position.x;
+            sceneTransforms.y[i] = position.y;
+            sceneTransforms.z[i] = position.z;
+        }
+    }
+    glm::vec3 carouselCenter;
+    if(sceneCarousel && scene.getObjectCount() > 0) {
+        carouselCenter = scene.getPosition(0);
+        for(int i = 1; i < scene.getObjectCount(); i++) {
+            if(glm::distance(scene.getPosition(i), carouselCenter) < CAROUSEL_RADIUS)
+                scene.setParent(i, 0);
         }
-        x -= 62;
-        y += 12.4;
     }
-    
-    // renderobject rock1 = renderobject("pileStone4.obj", -12.4, -10, 0);
-    renderobject minecart = renderobject("minecartTipW1.obj", -18.4, -10, -12.4);
-    renderobject rock1 = renderobject("pileStone4.obj", -20.4, -14.4, 0.4);
-    renderobject rock2 = renderobject("pileStone1.obj", -6.4, -14.4, 10.4);
-    renderobject rock3 = renderobject("pileStone3.obj", -40.4, -14.4, -20.4);
-    renderobject rock4 = renderobject("pileStone2.obj", -40, -14.4, -30);
-    renderobject rock5 = renderobject("pileStone4.obj", -30, -14.4, -20);
-    renderobject rock6 = renderobject("pileStone2.obj", -40, -14.4, 30);
-    renderobject rock7 = renderobject("pileStone1.obj", -30, -14.4, 20);
-    renderobject rock8 = renderobject("pileStone3.obj", -40, -14.4, 30);
-    renderobject rock9 = renderobject("pileStone4.obj", -30, -14.4, 20);
-    renderobject crate1 = renderobject("crate.obj", -30, -10.5, 20);
-    renderobject crate2 = renderobject("crate.obj", -10, -10.5, 40);
-    renderobject crate3 = renderobject("crate.obj", -20, -10.5, 10);
-    renderobject crate4 = renderobject("crate.obj", -30, -10.5, 60);
-    glEnable(GL_DEPTH_TEST);
+
+    arp::LayerScheduler layerScheduler;
+    // the main layer is rendered every frame, once per eye with stereo
+    layerScheduler.addLayer();
+    if(stereo)
+        layerScheduler.addLayer();
+    if(depthPeeling) {
+        for(int eye = 0; eye < (stereo ? 2 : 1); eye++)
+            layerScheduler.addLayer();
+    }
+    int farLayerIndex = depthSplit ? layerScheduler.addLayer(farRate) : -1;
+    bool farSubmitted = false;
+    arp::DepthSplit split;
+    int backgroundLayerIndex = layerScheduler.addLayer(backgroundRate);
+    bool backgroundSubmitted = false;
+    glm::vec3 backgroundPosition;
+    // what the last background image rendered, with --sparse-background
+    arp::CubeMapRegions backgroundRendered;
+    arp::ResolutionScaler resolutionScaler;
+    arp::FramerateController framerateController;
+    // pose the main layer was last rendered with
+    arp::Pose renderedPose;
+    bool mainSubmitted = false;
+
+    std::thread videoThread;
+    if(videoSwapchain)
+        videoThread = std::thread(runVideo);
 
     arp::captureCursor();
     
     while(!glfwWindowShouldClose(window)) {
-        if(arp::getFrozen())
+        arp::RuntimeSettings settings = arp::getRuntimeSettings();
+        if(settings.frozen) {
+            arp::waitForStateChange(settings.version);
             continue;
+        }
+        // the rate is from the poses of the frames before, this one's comes
+        // after waiting
+        int framerate = targetFramerate();
+        if(adaptiveFramerate)
+            framerate = std::min(framerateController.getFramerate(), framerate);
+        double displayTime = arp::waitForNextAppFrame(framerate);
+        renderobject::beginFrame();
         arp::Pose pose;
         arp::PoseInfo poseInfo;
         if(arp::getPredictionToggle()) {
-            double predictedDisplayTime = arp::getPredictedDisplayTime();
-            arp::getPredictedCameraPose(predictedDisplayTime, pose, poseInfo);
+            arp::getPredictedCameraPose(displayTime, pose, poseInfo);
         }
         else {
             arp::getCameraPose(pose, poseInfo);
         }
+        if(voxelLookupPending)
+            lookUpVoxel(pose);
+        if(adaptiveFramerate) {
+            framerateController.update(pose, displayTime, arp::LayerProjection::perspective(fovY, aspectRatio, 0.1, 100),
+                                       swapchain->height, arp::getFrameStats().appGpuTime, targetFramerate());
+        }
 
-        arp::FrameSubmitInfo submitInfo;
+        // filled in place, so submitting neither copies nor allocates
+        arp::FrameSubmitInfo& submitInfo = arp::acquireFrameSubmitInfo();
         submitInfo.pose = pose;
         submitInfo.poseInfo = poseInfo;
 
+        // the video thread's newest buffer goes on top
+        if(videoSwapchain) {
+            arp::FrameLayer video;
+            video.flags = arp::SUBMITTED_BY_THREAD;
+            submitInfo.layers.push_back(video);
+        }
+
+        // the panels are only cleared to pulsing colors, standing in for HUD
+        // drawing, all into the same atlas image
+        if(panelAtlas) {
+            int image = panelAtlas->getSwapchain()->acquireImage();
+            arp::LayerProjection view = arp::LayerProjection::perspective(fovY, aspectRatio, 0.1, 100);
+            for(int i = 0; i < panelCount; i++) {
+                panelAtlas->bindFramebuffer(image, panelRegions[i]);
+                float pulse = 0.5f + 0.5f * std::sin((float)displayTime * 2 + i);
+                glClearColor(0.2f + 0.6f * pulse, 0.3f, 0.8f - 0.6f * pulse, 1);
+                glClear(GL_COLOR_BUFFER_BIT);
+                arp::FrameLayer panel = panelAtlas->layer(panelRegions[i], image, arp::CAMERA_LOCKED);
+                panel.fov = fovY;
+                panel.hasProjection = true;
+                panel.projection = view.inset(glm::vec2((i + 0.5f) / MAX_PANELS, 0.9f), glm::vec2(0.2f, 0.1f));
+                submitInfo.layers.push_back(panel);
+            }
+            arp::glState().setEnabled(GL_SCISSOR_TEST, false);
+        }
+
         ///// Main image /////
 
-        int swapchainIndex = swapchain->acquireImage();
-        swapchain->bindFramebuffer(swapchainIndex);
+        // the GPU time is a frame behind, which the scaler allows for
+        if(dynamicResolution)
+            resolutionScaler.update(arp::getFrameStats().appGpuTime, 1.0 / targetFramerate());
+        int viewport[4];
+        resolutionScaler.getViewport(swapchain->width, swapchain->height, viewport);
 
-        glViewport(0, 0, swapchain->width, swapchain->height);
-        glClearColor(0.1, 0.1, 0.1, 1);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        
-        minecart.updateMatrices(pose, aspectRatio, fovY);
-        minecart.render();
-        
-        // minecart.updateMatrices();
-        for(int i = 0; i < tiles.size(); i++)
-        {
-            tiles[i].updateMatrices(pose, aspectRatio, fovY);
-            tiles[i].render();
-        }
-        
-        rock1.updateMatrices(pose, aspectRatio, fovY);
-        rock1.render();
-        rock2.updateMatrices(pose, aspectRatio, fovY);
-        rock2.render();
-        rock3.updateMatrices(pose, aspectRatio, fovY);
-        rock3.render();
-        rock4.updateMatrices(pose, aspectRatio, fovY);
-        rock4.render();
-        rock5.updateMatrices(pose, aspectRatio, fovY);
-        rock5.render();
-        rock6.updateMatrices(pose, aspectRatio, fovY);
-        rock6.render();
-        rock7.updateMatrices(pose, aspectRatio, fovY);
-        rock7.render();
-        rock8.updateMatrices(pose, aspectRatio, fovY);
-        rock8.render();
-        rock9.updateMatrices(pose, aspectRatio, fovY);
-        rock9.render();
-        
-        crate1.updateMatrices(pose, aspectRatio, fovY);
-        crate1.render();
-        crate2.updateMatrices(pose, aspectRatio, fovY);
-        crate2.render();
-        crate3.updateMatrices(pose, aspectRatio, fovY);
-        crate3.render();
-        crate4.updateMatrices(pose, aspectRatio, fovY);
-        crate4.render();
+        // with stereo each eye's main layer is rendered from its own pose
+        // into its own swapchain
+        int eyeCount = stereo ? 2 : 1;
+        arp::Swapchain* eyeSwapchains[2] = { swapchain, rightSwapchain };
+        // the main layer comes after the video's and the panels'
+        float fitNear, fitFar;
+        if(fitDepthRange && arp::getRecommendedDepthRange((videoSwapchain ? 1 : 0) + panelCount, fitNear, fitFar)) {
+            fittedNear = glm::clamp(fitNear, 0.1f, 100.f);
+            fittedFar = glm::clamp(fitFar, fittedNear * 2, 100.f);
+        }
+        arp::Pose eyePoses[2] = { pose, pose };
+        arp::LayerProjection eyeProjections[2];
+        for(int eye = 0; eye < eyeCount; eye++) {
+            if(stereo)
+                eyePoses[eye] = arp::getEyePose(pose, eye);
+            // while turning, the frustum grows towards where the view is
+            // going so reprojection has something to show there
+            arp::LayerProjection projection = arp::LayerProjection::perspective(fovY, aspectRatio, fittedNear, fittedFar);
+            if(reprojectionEnabled())
+                projection = arp::getGuardBandProjection(eyePoses[eye], displayTime, projection);
+            if(temporalUpsampling)
+                projection = projection.jittered(arp::getJitterOffset(), viewport[2], viewport[3]);
+            if(reversedZ)
+                projection.depthMapping = arp::DEPTH_REVERSED;
+            eyeProjections[eye] = projection;
+        }
 
-        arp::FrameLayer layer;
-        layer.flags = arp::NONE;
-        layer.fov = fovY;
-        layer.swapchain = swapchain;
-        layer.swapchainIndex = swapchainIndex;
-        if(arp::getParallaxToggle())
-            layer.flags = arp::PARALLAX_ENABLED;
-        if(!arp::getReprojectionToggle())
-            layer.flags = arp::CAMERA_LOCKED;
-        submitInfo.layers.push_back(layer);
+        // the eyes only render what is nearer than the split, the far layer
+        // the rest from the head
+        arp::LayerProjection farProjection;
+        bool renderFar = false;
+        if(depthSplit) {
+            split.update(eyeProjections[0], swapchain->height);
+            farProjection = split.farProjection(eyeProjections[0]);
+            for(int eye = 0; eye < eyeCount; eye++)
+                eyeProjections[eye] = split.nearProjection(eyeProjections[eye]);
+            renderFar = !farSubmitted
+                        || (split.isFarDue(pose.position) && layerScheduler.isDue(farLayerIndex, displayTime));
+        }
 
-        ///// Background image /////
+        // faces are rendered from the camera position with the cube aligned
+        // to the world axes
+        arp::Pose backgroundPose;
+        backgroundPose.position = pose.position;
+        backgroundPose.orientation = glm::quat(1, 0, 0, 0);
 
-        if(arp::getBackgroundToggle()) {
-            double backgroundFovFactor = 1.5;
-            double bgFov = fovY * backgroundFovFactor;
-            int backgroundSwapchainIndex = backgroundSwapchain->acquireImage();
-            backgroundSwapchain->bindFramebuffer(backgroundSwapchainIndex);
-    
-            glViewport(0, 0, backgroundSwapchain->width, backgroundSwapchain->height);
-            glClearColor(0.1, 0.1, 0.1, 1);
+        // a sparse background only has what either eye's guard band reaches,
+        // so it is rendered again as soon as the view reaches past that
+        arp::CubeMapRegions backgroundRegions;
+        bool backgroundUncovered = false;
+        if(sparseBackground && backgroundEnabled()) {
+            arp::LayerProjection view = arp::LayerProjection::perspective(fovY, aspectRatio, fittedNear, fittedFar);
+            for(int eye = 0; eye < eyeCount; eye++)
+                backgroundRegions.merge(arp::getCubeMapRegions(backgroundPose, eyePoses[eye], displayTime, view,
+                                                               backgroundSwapchain->width));
+            backgroundUncovered = !backgroundRendered.contains(backgroundRegions);
+        }
+
+        // the background is culled in the same pass as the main layer, so
+        // whether it is rendered this frame is decided up front
+        bool backgroundMoved = glm::distance(pose.position, backgroundPosition) > backgroundRefreshDistance;
+        if(!backgroundEnabled())
+            backgroundSubmitted = false;
+        // a masked background has a hole where this frame's main layer is,
+        // so it can't outlive the frame
+        bool renderBackground = backgroundEnabled()
+                                && (!backgroundSubmitted || backgroundUncovered || maskBackground
+                                    || (backgroundMoved && layerScheduler.isDue(backgroundLayerIndex, displayTime)));
+
+        // nothing would look different from the last frame's images, so
+        // reprojection keeps showing them and the GPU does nothing. Layers
+        // due for other reasons, loading assets and jittered or
+        // checkerboarded frames need new images
+        if(idleReuse && mainSubmitted && !renderFar && !renderBackground && !sceneSpin && !sceneCarousel
+           && !temporalUpsampling && !checkerboard && !benchmarking) {
+            renderobject::pollAssets();
+            float cosHalf = std::min(std::abs(glm::dot(pose.orientation, renderedPose.orientation)), 1.f);
+            float turned = 2 * std::acos(cosHalf);
+            if(renderobject::getPendingAssets() == 0
+               && glm::distance(pose.position, renderedPose.position) < IDLE_REUSE_DISTANCE
+               && turned < IDLE_REUSE_ANGLE) {
+                arp::resubmitFrame(pose, poseInfo);
+                continue;
+            }
+        }
+        // the same frame can also come back from the cache when the camera
+        // returns to where it was rendered
+        bool cacheable = frameCache && !renderFar && !renderBackground && !sceneSpin && !sceneCarousel
+                         && !temporalUpsampling && !checkerboard && !benchmarking;
+        if(cacheable) {
+            renderobject::pollAssets();
+            if(renderobject::getPendingAssets() != 0) {
+                sceneVersion++;
+                cacheable = false;
+            }
+            else if(arp::submitCachedFrame(pose, poseInfo, sceneVersion)) {
+                renderedPose = pose;
+                continue;
+            }
+        }
+        renderedPose = pose;
+        mainSubmitted = true;
+
+        // the main image's layers come first, one per eye, then the far
+        // layer and the background's faces
+        arp::Pose layerPoses[8];
+        arp::LayerProjection layerProjections[8];
+        // levels of detail follow each layer's pixels per degree
+        int layerHeights[8];
+        int layerCount = 0;
+        for(int eye = 0; eye < eyeCount; eye++) {
+            layerPoses[layerCount] = eyePoses[eye];
+            layerProjections[layerCount] = eyeProjections[eye];
+            layerHeights[layerCount] = viewport[3];
+            layerCount++;
+        }
+        int farCullIndex = layerCount;
+        if(renderFar) {
+            layerPoses[layerCount] = pose;
+            layerProjections[layerCount] = farProjection;
+            layerHeights[layerCount] = farSwapchain->height;
+            layerCount++;
+        }
+        int backgroundCullIndex = layerCount;
+        if(renderBackground) {
+            for(int face = 0; face < 6; face++) {
+                layerPoses[layerCount] = backgroundPose;
+                layerPoses[layerCount].orientation = arp::cubeMapFaceOrientation(face);
+                layerProjections[layerCount] = arp::LayerProjection::perspective(M_PI / 2, 1, 0.1, 100);
+                if(reversedZ)
+                    layerProjections[layerCount].depthMapping = arp::DEPTH_REVERSED;
+                layerHeights[layerCount] = backgroundSwapchain->height;
+                layerCount++;
+            }
+        }
+
+        if(sceneSpin) {
+            // a quarter turn a second, each object a little ahead of the last
+            for(std::size_t i = 0; i < sceneTransforms.size(); i++) {
+                double angle = displayTime * M_PI / 2 + i * 0.1;
+                sceneTransforms.qy[i] = (float)std::sin(angle / 2);
+                sceneTransforms.qw[i] = (float)std::cos(angle / 2);
+            }
+            scene.setTransforms(sceneTransforms);
+        }
+        // only the carousel's subtree is recomputed by update
+        if(sceneCarousel && scene.getObjectCount() > 0) {
+            float angle = (float)(displayTime * M_PI / 2);
+            scene.setLocalTransform(0, carouselCenter, glm::angleAxis(angle, glm::vec3(0, 1, 0)));
+        }
+        // traversed once, then drawn into each layer with its own projection
+        scene.update(pose);
+        scene.cullLayers(layerPoses, layerProjections, layerHeights, layerCount);
+        if(prefetchHorizon > 0) {
+            arp::Pose trajectory[PREFETCH_STEPS];
+            arp::getPredictedTrajectory(displayTime, prefetchHorizon, trajectory, PREFETCH_STEPS);
+            scene.prefetch(trajectory, PREFETCH_STEPS, arp::LayerProjection::perspective(fovY, aspectRatio, 0.1, 100),
+                           viewport[3]);
+        }
+        for(int eye = 0; eye < eyeCount; eye++) {
+            arp::Swapchain* eyeSwapchain = eyeSwapchains[eye];
+            int swapchainIndex = eyeSwapchain->acquireImage();
+            eyeSwapchain->bindFramebuffer(swapchainIndex);
+            arp::glState().viewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+            // with the split, the far layer shows where nothing near is drawn
+            glClearColor(0.1, 0.1, 0.1, depthSplit ? 0 : 1);
             glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-            
-            minecart.updateMatrices(pose, aspectRatio, bgFov);
-            minecart.render();
-            
-            // minecart.updateMatrices();
-            for(int i = 0; i < tiles.size(); i++)
+            if(checkerboard)
+                renderbatch::drawCheckerboardMask(arp::getCheckerboardParity());
+
             {
-                tiles[i].updateMatrices(pose, aspectRatio, bgFov);
-                tiles[i].render();
+                arp::GpuZone zone("main layer");
+                scene.drawLayer(eye);
+            }
+            // next frame's main layer skips what this one's depth hides. The
+            // checkerboard mask's near depth would hide objects that aren't.
+            // Only layer 0 is occlusion culled, so the right eye has nothing
+            // to build. The pyramid is built from default, single sampled
+            // depth
+            if(eye == 0 && !checkerboard && !reversedZ && msaaSamples == 1)
+                scene.buildOcclusion(eyeSwapchain->depthImages[swapchainIndex], viewport[2], viewport[3]);
+            // lets reprojection onto the GPU between passes if it is due
+            arp::yieldPoint();
+
+            arp::FrameLayer layer;
+            layer.flags = arp::NONE;
+            layer.fov = fovY;
+            layer.swapchain = eyeSwapchain;
+            layer.swapchainIndex = swapchainIndex;
+            layer.hasProjection = true;
+            layer.projection = eyeProjections[eye];
+            layer.hasViewport = true;
+            std::copy(viewport, viewport + 4, layer.viewport);
+            if(stereo) {
+                layer.hasPose = true;
+                layer.pose = eyePoses[eye];
+                layer.time = poseInfo.time;
+                layer.eye = eye;
+            }
+            if(parallaxEnabled())
+                layer.flags = arp::PARALLAX_ENABLED;
+            if(gridWarpEnabled())
+                layer.flags = arp::GRID_WARP_ENABLED;
+            if(!reprojectionEnabled())
+                layer.flags = arp::CAMERA_LOCKED;
+            if(temporalUpsampling)
+                layer.flags = arp::FrameLayerFlags(layer.flags | arp::TEMPORAL_ACCUMULATION_ENABLED);
+            if(checkerboard)
+                layer.flags = arp::FrameLayerFlags(layer.flags | arp::CHECKERBOARD_ENABLED);
+            if(depthSplit)
+                layer.flags = arp::FrameLayerFlags(layer.flags | arp::ALPHA_MASKED);
+            if(reshading)
+                layer.flags = arp::FrameLayerFlags(layer.flags | arp::VIEW_DEPENDENT_RESHADING);
+            submitInfo.layers.push_back(layer);
+
+            // the surfaces right behind the ones just drawn, seen from the
+            // same view, which parallax shows where it reveals them
+            if(depthPeeling) {
+                arp::Swapchain* peelSwapchain = peelSwapchains[eye];
+                int peelIndex = peelSwapchain->acquireImage();
+                peelSwapchain->bindFramebuffer(peelIndex);
+                arp::glState().viewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                renderbatch::setPeelDepth(eyeSwapchain->depthImages[swapchainIndex]);
+                {
+                    arp::GpuZone zone("peeled layer");
+                    scene.drawLayer(eye);
+                }
+                renderbatch::setPeelDepth(0);
+                arp::yieldPoint();
+
+                arp::FrameLayer peeled = layer;
+                peeled.flags = arp::FrameLayerFlags(arp::DEPTH_PEELED
+                                                    | (layer.flags & (arp::PARALLAX_ENABLED | arp::CAMERA_LOCKED
+                                                                      | arp::ALPHA_MASKED)));
+                peeled.swapchain = peelSwapchain;
+                peeled.swapchainIndex = peelIndex;
+                submitInfo.layers.push_back(peeled);
+            }
+        }
+
+        ///// Far image /////
+
+        // reprojected by rotation only, which is off by less than the
+        // split's pixels until the camera has moved far enough to render it
+        // again. Cleared like the eyes, so the background shows through
+        if(renderFar) {
+            int farIndex = farSwapchain->acquireImage();
+            farSwapchain->bindFramebuffer(farIndex);
+            // saving power, only part of the image is rendered and stretched
+            // over the layer
+            float farResolution = arp::getPowerState().backgroundScale;
+            int farViewport[4] = { 0, 0, std::max(1, (int)(farSwapchain->width * farResolution)),
+                                   std::max(1, (int)(farSwapchain->height * farResolution)) };
+            arp::glState().viewport(farViewport[0], farViewport[1], farViewport[2], farViewport[3]);
+            glClearColor(0.1, 0.1, 0.1, 0);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            {
+                arp::GpuZone zone("far layer");
+                scene.drawLayer(farCullIndex);
+            }
+            arp::yieldPoint();
+
+            arp::FrameLayer farLayer;
+            farLayer.flags = arp::ALPHA_MASKED;
+            if(depthUpsampling)
+                farLayer.flags = arp::FrameLayerFlags(farLayer.flags | arp::DEPTH_AWARE_UPSAMPLING);
+            if(!reprojectionEnabled())
+                farLayer.flags = arp::FrameLayerFlags(farLayer.flags | arp::CAMERA_LOCKED);
+            farLayer.fov = fovY;
+            farLayer.swapchain = farSwapchain;
+            farLayer.swapchainIndex = farIndex;
+            farLayer.hasPose = true;
+            farLayer.pose = pose;
+            farLayer.time = poseInfo.time;
+            farLayer.hasProjection = true;
+            farLayer.projection = farProjection;
+            farLayer.hasViewport = true;
+            std::copy(farViewport, farViewport + 4, farLayer.viewport);
+            submitInfo.layers.push_back(farLayer);
+            layerScheduler.markSubmitted(farLayerIndex, displayTime);
+            split.markFarRendered(pose.position);
+            farSubmitted = true;
+        }
+        else if(farSubmitted) {
+            arp::FrameLayer farLayer;
+            farLayer.flags = arp::KEEP_PREVIOUS_IMAGE;
+            submitInfo.layers.push_back(farLayer);
+        }
+
+        ///// Background image /////
+
+        if(renderBackground) {
+            // the background is shared, so only what every eye's layer
+            // covers is masked. The split near layer has holes, so nothing is
+            arp::LayerProjection backgroundMask;
+            bool maskingBackground = maskBackground && !depthSplit;
+            for(int eye = 0; maskingBackground && eye < eyeCount; eye++) {
+                arp::LayerProjection covered = arp::getCoveredProjection(eyePoses[eye], displayTime,
+                                                                         eyeProjections[eye]);
+                if(eye == 0) {
+                    backgroundMask = covered;
+                    continue;
+                }
+                backgroundMask.left = std::max(backgroundMask.left, covered.left);
+                backgroundMask.right = std::min(backgroundMask.right, covered.right);
+                backgroundMask.bottom = std::max(backgroundMask.bottom, covered.bottom);
+                backgroundMask.top = std::min(backgroundMask.top, covered.top);
+            }
+
+            int backgroundSwapchainIndex = backgroundSwapchain->acquireImage();
+            if(sparseBackground) {
+                backgroundSwapchain->commitRegions(backgroundSwapchainIndex, backgroundRegions);
+                backgroundRendered = backgroundRegions;
+            }
+
+            for(int face = 0; face < 6; face++) {
+                if(sparseBackground && backgroundRegions.isEmpty(face))
+                    continue;
+                backgroundSwapchain->bindFramebuffer(backgroundSwapchainIndex, face);
+                arp::glState().viewport(0, 0, backgroundSwapchain->width, backgroundSwapchain->height);
+                if(sparseBackground) {
+                    const int* rect = backgroundRegions.rects[face];
+                    arp::glState().setEnabled(GL_SCISSOR_TEST, true);
+                    glScissor(rect[0], rect[1], rect[2], rect[3]);
+                }
+                glClearColor(0.1, 0.1, 0.1, 1);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                if(maskingBackground)
+                    arp::maskCoveredDepth(layerPoses[backgroundCullIndex + face],
+                                          layerProjections[backgroundCullIndex + face], eyePoses[0], backgroundMask);
+
+                {
+                    arp::GpuZone zone("background");
+                    scene.drawLayer(backgroundCullIndex + face);
+                }
+                arp::glState().setEnabled(GL_SCISSOR_TEST, false);
+                arp::yieldPoint();
             }
-            
-            rock1.updateMatrices(pose, aspectRatio, bgFov);
-            rock1.render();
-            rock2.updateMatrices(pose, aspectRatio, bgFov);
-            rock2.render();
-            rock3.updateMatrices(pose, aspectRatio, bgFov);
-            rock3.render();
-            rock4.updateMatrices(pose, aspectRatio, bgFov);
-            rock4.render();
-            rock5.updateMatrices(pose, aspectRatio, bgFov);
-            rock5.render();
-            rock6.updateMatrices(pose, aspectRatio, bgFov);
-            rock6.render();
-            rock7.updateMatrices(pose, aspectRatio, bgFov);
-            rock7.render();
-            rock8.updateMatrices(pose, aspectRatio, bgFov);
-            rock8.render();
-            rock9.updateMatrices(pose, aspectRatio, bgFov);
-            rock9.render();
-            
-            crate1.updateMatrices(pose, aspectRatio, bgFov);
-            crate1.render();
-            crate2.updateMatrices(pose, aspectRatio, bgFov);
-            crate2.render();
-            crate3.updateMatrices(pose, aspectRatio, bgFov);
-            crate3.render();
-            crate4.updateMatrices(pose, aspectRatio, bgFov);
-            crate4.render();
 
             arp::FrameLayer backgroundLayer;
             backgroundLayer.flags = arp::NONE;
-            backgroundLayer.fov = bgFov;
+            backgroundLayer.fov = M_PI / 2;
             backgroundLayer.swapchain = backgroundSwapchain;
             backgroundLayer.swapchainIndex = backgroundSwapchainIndex;
-            if(!arp::getReprojectionToggle())
-                backgroundLayer.flags = arp::CAMERA_LOCKED;
+            backgroundLayer.hasPose = true;
+            backgroundLayer.pose = backgroundPose;
+            submitInfo.layers.push_back(backgroundLayer);
+            layerScheduler.markSubmitted(backgroundLayerIndex, displayTime);
+            backgroundSubmitted = true;
+            backgroundPosition = pose.position;
+        }
+        else if(backgroundSubmitted) {
+            arp::FrameLayer backgroundLayer;
+            backgroundLayer.flags = arp::KEEP_PREVIOUS_IMAGE;
             submitInfo.layers.push_back(backgroundLayer);
         }
 
-        arp::submitFrame(submitInfo);
-        double fps = arp::getTargetFramerate();
-        std::this_thread::sleep_for(std::chrono::milliseconds((int)(1000 / fps)));
+        arp::submitFrame();
+        if(cacheable)
+            arp::cacheSubmittedFrame(sceneVersion);
+        if(jankLog)
+            printJankEvents();
+        if(frameIdLog)
+            printPresentedFrames();
+        if(benchmarking && coldStartTime < 0 && scene.isLoaded())
+            coldStartTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - processStart).count();
+        if(benchmarking && !recordBenchmarkFrame(poseInfo))
+            break;
+        if(groundTruthSwapchain)
+            renderGroundTruth(scene);
     }
 
+    renderobject::stopAssetLoader();
+    videoDone = true;
+    if(videoThread.joinable())
+        videoThread.join();
     arp::releaseCursor();
 }
 
+/**
+ * Stands in for a video decoder: writes moving color bars into a panel in
+ * the bottom left of the video swapchain's buffers, leaving the rest clear
+ * for ALPHA_MASKED, and submits each with the time it is to be shown at
+ */
+static void runVideo() {
+    int width = videoSwapchain->width, height = videoSwapchain->height;
+    int panelWidth = width / 2, panelHeight = height / 2;
+    double start = glfwGetTime();
+    for(std::uint64_t frame = 0; !videoDone; frame++) {
+        int index = videoSwapchain->acquireBuffer(0.1);
+        if(index < 0)
+            continue;
+        unsigned char* pixels = videoSwapchain->getPixels(index);
+        std::memset(pixels, 0, (std::size_t)width * height * 4);
+        for(int y = 0; y < panelHeight; y++) {
+            for(int x = 0; x < panelWidth; x++) {
+                int bar = ((x + (int)frame * 4) / 32) % 6;
+                unsigned char* pixel = &pixels[((std::size_t)y * width + x) * 4];
+                pixel[0] = (bar == 0 || bar == 1 || bar == 5) ? 230 : 30;
+                pixel[1] = (bar >= 1 && bar <= 3) ? 230 : 30;
+                pixel[2] = (bar >= 3) ? 230 : 30;
+                pixel[3] = 255;
+            }
+        }
+
+        double presentationTime = start + frame / VIDEO_RATE;
+        arp::FrameLayer layer;
+        layer.flags = arp::FrameLayerFlags(arp::CAMERA_LOCKED | arp::ALPHA_MASKED);
+        layer.fov = fovY;
+        layer.hasPose = true;
+        layer.pose.position = glm::vec3(0);
+        layer.pose.orientation = glm::quat(1, 0, 0, 0);
+        layer.time = presentationTime;
+        videoSwapchain->submitBuffer(index, layer, presentationTime);
+    }
+}
+
+/**
+ * Deterministic camera path: the view sweeps side to side while walking
+ * back and forth, so both rotation and translation get reprojected. The
+ * rotation and translation scenarios keep only their half of it
+ */
+static int benchmarkInput(double time, double& mouseX, double& mouseY, int* heldKeys, int maxHeldKeys) {
+    double t = time - benchmarkStartTime;
+    bool rotate = benchmarkScenario != SCENARIO_TRANSLATION;
+    bool translate = benchmarkScenario != SCENARIO_ROTATION;
+    mouseX = rotate ? 600 * std::sin(t * 0.7) : 0;
+    mouseY = rotate ? 150 * std::sin(t * 1.3) : 0;
+
+    int count = 0;
+    if(translate && maxHeldKeys >= 2) {
+        heldKeys[count++] = std::fmod(t, 4.0) < 2.0 ? GLFW_KEY_W : GLFW_KEY_S;
+        heldKeys[count++] = std::fmod(t, 3.0) < 1.5 ? GLFW_KEY_D : GLFW_KEY_A;
+    }
+    return count;
+}
+
+/**
+ * Writes a row for the submitted frame and advances through the configs.
+ * Returns false once every config has been measured
+ */
+static bool recordBenchmarkFrame(const arp::PoseInfo& poseInfo) {
+    double time = glfwGetTime();
+    if(benchmarkFrame == 0) {
+        benchmarkConfigStart = time;
+        arp::resetLatencyHistogram();
+        arp::resetQualityStats();
+    }
+
+    arp::FrameStats stats = arp::getFrameStats();
+    const BenchmarkConfig& config = benchmarkConfigs[benchmarkConfigIndex];
+    benchmarkOutput << benchmarkConfigIndex << ',' << config.targetFPS << ','
+                    << config.reproject << ',' << config.parallax << ',' << config.background << ','
+                    << benchmarkFrame << ',' << time << ','
+                    << stats.appFrameTime * 1000.0 << ',' << stats.appGpuTime * 1000.0 << ','
+                    << stats.swapchainWaitTime * 1000.0 << ','
+                    << stats.reprojectionCpuTime * 1000.0 << ',' << stats.reprojectionGpuTime * 1000.0 << ','
+                    << stats.missedRefreshes - benchmarkMissedRefreshes << ','
+                    << (time - poseInfo.time) * 1000.0 << '\n';
+    benchmarkConfigMissed += stats.missedRefreshes - benchmarkMissedRefreshes;
+    benchmarkMissedRefreshes = stats.missedRefreshes;
+    benchmarkGpuTotal += stats.reprojectionGpuTime;
+    benchmarkGpuSamples++;
+    benchmarkGpuTimes.push_back(stats.reprojectionGpuTime * 1000.0);
+    benchmarkAppTimes.push_back(stats.appFrameTime * 1000.0);
+    benchmarkLatencies.push_back((time - poseInfo.time) * 1000.0);
+    benchmarkFrame++;
+
+    if(time - benchmarkConfigStart >= benchmarkSeconds) {
+        recordBenchmarkSummary(time - benchmarkConfigStart);
+        benchmarkConfigStart = time;
+        recordBenchmarkLatency();
+        recordBenchmarkQuality();
+        if(++benchmarkConfigIndex == (int)benchmarkConfigs.size()) {
+            benchmarkOutput.close();
+            latencyOutput.close();
+            qualityOutput.close();
+            finishBenchmark();
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Value below which the fraction of the samples lie, 0 without any
+ */
+static double percentile(std::vector<double> samples, double fraction) {
+    if(samples.empty())
+        return 0;
+    std::size_t index = std::min(samples.size() - 1, (std::size_t)std::ceil(fraction * samples.size()) - 1);
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index];
+}
+
+/**
+ * Summarizes the frames of the config that just finished, which took the
+ * given seconds, and starts the next one
+ */
+static void recordBenchmarkSummary(double seconds) {
+    BenchmarkSummary summary;
+    summary.frames = benchmarkGpuTimes.size();
+    summary.reprojectionGpuMean = 0;
+    for(double gpuTime : benchmarkGpuTimes)
+        summary.reprojectionGpuMean += gpuTime;
+    if(!benchmarkGpuTimes.empty())
+        summary.reprojectionGpuMean /= benchmarkGpuTimes.size();
+    summary.reprojectionGpuP99 = percentile(benchmarkGpuTimes, 0.99);
+    summary.appFrameP99 = percentile(benchmarkAppTimes, 0.99);
+    summary.latencyP99 = percentile(benchmarkLatencies, 0.99);
+    summary.missedRefreshesPerSecond = seconds > 0 ? benchmarkConfigMissed / seconds : 0;
+    benchmarkSummaries.push_back(summary);
+
+    benchmarkGpuTimes.clear();
+    benchmarkAppTimes.clear();
+    benchmarkLatencies.clear();
+    benchmarkConfigMissed = 0;
+}
+
+typedef std::vector<std::pair<std::string, double>> BenchmarkMetrics;
+
+/**
+ * The run's metrics, each the worst of its configs, by the names budget and
+ * baseline files use
+ */
+static BenchmarkMetrics benchmarkMetrics() {
+    BenchmarkMetrics metrics = {
+        { "cold_start_s", coldStartTime },
+        { "reprojection_gpu_ms_mean", 0 },
+        { "reprojection_gpu_ms_p99", 0 },
+        { "app_frame_ms_p99", 0 },
+        { "latency_ms_p99", 0 },
+        { "missed_refreshes_per_s", 0 },
+    };
+    for(const BenchmarkSummary& summary : benchmarkSummaries) {
+        metrics[1].second = std::max(metrics[1].second, summary.reprojectionGpuMean);
+        metrics[2].second = std::max(metrics[2].second, summary.reprojectionGpuP99);
+        metrics[3].second = std::max(metrics[3].second, summary.appFrameP99);
+        metrics[4].second = std::max(metrics[4].second, summary.latencyP99);
+        metrics[5].second = std::max(metrics[5].second, summary.missedRefreshesPerSecond);
+    }
+    return metrics;
+}
+
+/**
+ * Reads "<metric> <value>" lines, skipping blank ones and # comments.
+ * Returns false if the file can't be opened
+ */
+static bool readBenchmarkMetrics(const std::string& path, BenchmarkMetrics& metrics) {
+    std::ifstream file(path);
+    if(!file)
+        return false;
+    std::string line;
+    while(std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string name;
+        double value;
+        if(!(fields >> name) || name[0] == '#')
+            continue;
+        if(fields >> value)
+            metrics.push_back({ name, value });
+    }
+    return true;
+}
+
+/**
+ * Fails the run for every metric over its limit times scale, printing it
+ */
+static void checkBenchmarkLimits(const BenchmarkMetrics& metrics, const std::string& path, double scale,
+                                 const char* kind) {
+    BenchmarkMetrics limits;
+    if(!readBenchmarkMetrics(path, limits)) {
+        std::cout << "Unable to read " << kind << " " << path << std::endl;
+        benchmarkExitCode = 1;
+        return;
+    }
+    for(const auto& limit : limits) {
+        auto metric = std::find_if(metrics.begin(), metrics.end(),
+                                   [&](const std::pair<std::string, double>& m) { return m.first == limit.first; });
+        if(metric == metrics.end()) {
+            std::cout << "Unknown metric " << limit.first << " in " << path << std::endl;
+            benchmarkExitCode = 1;
+        }
+        else if(metric->second > limit.second * scale) {
+            std::cout << metric->first << " " << metric->second << " is over its " << kind << " of "
+                      << limit.second * scale << std::endl;
+            benchmarkExitCode = 1;
+        }
+    }
+}
+
+/**
+ * Writes the JSON results and the baseline and checks the budget and
+ * baseline, once every config has been measured
+ */
+static void finishBenchmark() {
+    // a scene that never finished loading counts the whole run, so it
+    // can't pass a budget
+    if(coldStartTime < 0)
+        coldStartTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - processStart).count();
+    BenchmarkMetrics metrics = benchmarkMetrics();
+
+    if(!benchmarkBudgetPath.empty())
+        checkBenchmarkLimits(metrics, benchmarkBudgetPath, 1, "budget");
+    if(!benchmarkBaselinePath.empty())
+        checkBenchmarkLimits(metrics, benchmarkBaselinePath, 1 + benchmarkTolerance, "baseline");
+
+    if(!benchmarkSaveBaselinePath.empty()) {
+        std::ofstream baseline(benchmarkSaveBaselinePath);
+        for(const auto& metric : metrics)
+            baseline << metric.first << ' ' << metric.second << '\n';
+        if(!baseline) {
+            std::cout << "Unable to write baseline " << benchmarkSaveBaselinePath << std::endl;
+            benchmarkExitCode = 1;
+        }
+    }
+
+    if(!benchmarkJsonPath.empty()) {
+        std::ofstream json(benchmarkJsonPath);
+        json << "{\n  \"scenario\": \"" << benchmarkScenarioNames[benchmarkScenario] << "\",\n"
+             << "  \"scene_objects\": " << sceneObjects << ",\n"
+             << "  \"seconds_per_config\": " << benchmarkSeconds << ",\n"
+             << "  \"passed\": " << (benchmarkExitCode == 0 ? "true" : "false") << ",\n"
+             << "  \"metrics\": {";
+        for(std::size_t i = 0; i < metrics.size(); i++)
+            json << (i ? "," : "") << "\n    \"" << metrics[i].first << "\": " << metrics[i].second;
+        json << "\n  },\n  \"configs\": [";
+        for(std::size_t i = 0; i < benchmarkSummaries.size(); i++) {
+            const BenchmarkConfig& config = benchmarkConfigs[i];
+            const BenchmarkSummary& summary = benchmarkSummaries[i];
+            json << (i ? "," : "") << "\n    { \"target_fps\": " << config.targetFPS
+                 << ", \"reproject\": " << (config.reproject ? "true" : "false")
+                 << ", \"parallax\": " << (config.parallax ? "true" : "false")
+                 << ", \"background\": " << (config.background ? "true" : "false")
+                 << ", \"grid_warp\": " << (config.gridWarp ? "true" : "false")
+                 << ", \"frames\": " << summary.frames
+                 << ", \"reprojection_gpu_ms_mean\": " << summary.reprojectionGpuMean
+                 << ", \"reprojection_gpu_ms_p99\": " << summary.reprojectionGpuP99
+                 << ", \"app_frame_ms_p99\": " << summary.appFrameP99
+                 << ", \"latency_ms_p99\": " << summary.latencyP99
+                 << ", \"missed_refreshes_per_s\": " << summary.missedRefreshesPerSecond << " }";
+        }
+        json << "\n  ]\n}\n";
+        if(!json) {
+            std::cout << "Unable to write benchmark results " << benchmarkJsonPath << std::endl;
+            benchmarkExitCode = 1;
+        }
+    }
+
+    std::cout << "benchmark " << (benchmarkExitCode == 0 ? "passed" : "failed") << std::endl;
+}
+
+/**
+ * Writes the latency histogram of the config that just finished, one row
+ * per non-empty bin, and starts the next one
+ */
+static void recordBenchmarkLatency() {
+    if(!latencyOutput.is_open())
+        return;
+    arp::LatencyHistogram histogram = arp::getLatencyHistogram();
+    arp::resetLatencyHistogram();
+    const BenchmarkConfig& config = benchmarkConfigs[benchmarkConfigIndex];
+    for(int i = 0; i < arp::LatencyHistogram::BIN_COUNT; i++) {
+        if(histogram.bins[i] == 0)
+            continue;
+        latencyOutput << benchmarkConfigIndex << ',' << config.targetFPS << ','
+                      << config.reproject << ',' << config.parallax << ',' << config.background << ','
+                      << i * arp::LatencyHistogram::BIN_WIDTH * 1000.0 << ',' << histogram.bins[i] << '\n';
+    }
+    std::cout << "config " << benchmarkConfigIndex << " latency mean " << histogram.mean() * 1000.0
+              << " ms, p99 " << histogram.percentile(0.99) * 1000.0 << " ms" << std::endl;
+}
+
+/**
+ * Writes the reprojection quality of the config that just finished next to
+ * its GPU time, and starts the next one
+ */
+static void recordBenchmarkQuality() {
+    double gpuTime = benchmarkGpuSamples ? benchmarkGpuTotal / benchmarkGpuSamples : 0;
+    benchmarkGpuTotal = 0;
+    benchmarkGpuSamples = 0;
+    if(!qualityOutput.is_open())
+        return;
+    arp::QualityStats quality = arp::getQualityStats();
+    arp::resetQualityStats();
+    const BenchmarkConfig& config = benchmarkConfigs[benchmarkConfigIndex];
+    qualityOutput << benchmarkConfigIndex << ',' << config.targetFPS << ','
+                  << config.reproject << ',' << config.parallax << ',' << config.gridWarp << ','
+                  << config.background << ',' << quality.count << ','
+                  << quality.meanPsnr() << ',' << quality.minPsnr << ',' << quality.meanSsim() << ','
+                  << quality.meanDisocclusion() * 100.0 << ',' << gpuTime * 1000.0 << '\n';
+    std::cout << "config " << benchmarkConfigIndex << " PSNR " << quality.meanPsnr() << " dB, SSIM "
+              << quality.meanSsim() << ", reprojection " << gpuTime * 1000.0 << " ms" << std::endl;
+}
+
+/**
+ * Renders the scene at reprojection's newest pose once per refresh until
+ * the next frame is due, for arp to compare with what it reprojects
+ */
+static void renderGroundTruth(renderbatch& scene) {
+    double refreshPeriod = arp::getFrameStats().refreshPeriod;
+    if(!(refreshPeriod > 0))
+        return;
+    int refreshes = (int)std::round(1.0 / (targetFramerate() * refreshPeriod)) - 1;
+    arp::LayerProjection projection = arp::LayerProjection::perspective(fovY, aspectRatio, 0.1, 100);
+    for(int i = 0; i < refreshes; i++) {
+        int index = groundTruthSwapchain->acquireImage();
+        arp::Pose pose;
+        arp::PoseInfo poseInfo;
+        arp::getCameraPose(pose, poseInfo);
+
+        groundTruthSwapchain->bindFramebuffer(index);
+        arp::glState().viewport(0, 0, groundTruthSwapchain->width, groundTruthSwapchain->height);
+        glClearColor(0.1, 0.1, 0.1, 1);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        scene.update(pose);
+        scene.draw(projection);
+        arp::submitGroundTruth(groundTruthSwapchain, index, pose);
+        // reprojection takes at most one per refresh
+        std::this_thread::sleep_for(std::chrono::duration<double>(refreshPeriod));
+    }
+}
+
+/**
+ * The hand placed scene: a tile floor with rocks, crates and a minecart
+ */
+static void addSampleScene(renderbatch& scene) {
+    auto add = [&](const char* fileName, double x, double y, double z) {
+        scene.add(fileName, x, y, z);
+        if(sceneTrace)
+            addTracedObject(fileName, x, y, z);
+    };
+    // the floor and rocks never move
+    auto addStatic = [&](const char* fileName, double x, double y, double z) {
+        if(!staticBatching) {
+            add(fileName, x, y, z);
+            return;
+        }
+        scene.addStatic(fileName, x, y, z);
+        if(sceneTrace)
+            addTracedObject(fileName, x, y, z);
+    };
+    add("minecartTipW1.obj", -18.4, -10, -12.4);
+
+    double x = -12.4 * 5;
+    double y = -12.4 * 3;
+    int counter = 0;
+    
+    for(int i = 0; i < 10; i++)
+    {
+        for(int j = 0; j < 10; j++)
+        {
+            if(counter == 0) addStatic("tileFloor1W1.obj", x, -10, y);
+            if(counter == 1) addStatic("tileFloor2W1.obj", x, -10, y);
+            if(counter == 2) addStatic("tileFloor3W1.obj", x, -10, y);
+            if(counter == 3) addStatic("tileFloor4W1.obj", x, -10, y);
+            
+            counter = ++counter % 4;
+            x += 6.2;
+        }
+        x -= 62;
+        y += 12.4;
+    }
+    
+    addStatic("pileStone4.obj", -20.4, -14.4, 0.4);
+    addStatic("pileStone1.obj", -6.4, -14.4, 10.4);
+    addStatic("pileStone3.obj", -40.4, -14.4, -20.4);
+    addStatic("pileStone2.obj", -40, -14.4, -30);
+    addStatic("pileStone4.obj", -30, -14.4, -20);
+    addStatic("pileStone2.obj", -40, -14.4, 30);
+    addStatic("pileStone1.obj", -30, -14.4, 20);
+    addStatic("pileStone3.obj", -40, -14.4, 30);
+    addStatic("pileStone4.obj", -30, -14.4, 20);
+    add("crate.obj", -30, -10.5, 20);
+    add("crate.obj", -10, -10.5, 40);
+    add("crate.obj", -20, -10.5, 10);
+    add("crate.obj", -30, -10.5, 60);
+    if(staticBatching)
+        std::cout << "merged static objects into " << scene.mergeStatic() << " meshes" << std::endl;
+}
+
+/**
+ * sceneObjects copies of the shipped assets for scaling tests, cycling
+ * through them on a grid centered on the start position, or picked and
+ * placed at random over the same area with sceneRandom
+ */
+static void addGeneratedScene(renderbatch& scene) {
+    // assets and the height that puts them on the floor
+    struct SceneAsset {
+        const char* fileName;
+        double y;
+    };
+    static const SceneAsset assets[] = {
+        { "tileFloor1W1.obj", -10 }, { "tileFloor2W1.obj", -10 }, { "tileFloor3W1.obj", -10 },
+        { "tileFloor4W1.obj", -10 }, { "pileStone1.obj", -14.4 }, { "pileStone2.obj", -14.4 },
+        { "pileStone3.obj", -14.4 }, { "pileStone4.obj", -14.4 }, { "crate.obj", -10.5 },
+        { "minecartTipW1.obj", -10 }, { "teapot.obj", -10 },
+    };
+    const int assetCount = sizeof(assets) / sizeof(assets[0]);
+    const double spacing = 8;
+
+    long columns = (long)std::ceil(std::sqrt((double)sceneObjects));
+    double extent = columns * spacing;
+    std::mt19937 random(sceneSeed);
+    std::uniform_real_distribution<double> position(-extent / 2, extent / 2);
+    std::uniform_int_distribution<int> asset(0, assetCount - 1);
+
+    for(long i = 0; i < sceneObjects; i++) {
+        const SceneAsset& chosen = sceneRandom ? assets[asset(random)] : assets[i % assetCount];
+        double x, z;
+        if(sceneRandom) {
+            x = position(random);
+            z = position(random);
+        }
+        else {
+            x = (i % columns - columns / 2) * spacing;
+            z = (i / columns - columns / 2) * spacing;
+        }
+        if(staticBatching)
+            scene.addStatic(chosen.fileName, x, chosen.y, z);
+        else
+            scene.add(chosen.fileName, x, chosen.y, z);
+    }
+    std::cout << "generated scene of " << sceneObjects << " objects" << std::endl;
+    if(staticBatching)
+        std::cout << "merged static objects into " << scene.mergeStatic() << " meshes" << std::endl;
+}
+
+/**
+ * Scatters sceneLights colored point lights a little above the floor of the
+ * sample or generated scene
+ */
+static void addSceneLights(renderbatch& scene) {
+    glm::vec2 lo(-62, -75), hi(0, 38);
+    if(sceneObjects > 0) {
+        double extent = std::ceil(std::sqrt((double)sceneObjects)) * 8;
+        lo = glm::vec2(-extent / 2);
+        hi = glm::vec2(extent / 2);
+    }
+    std::mt19937 random(sceneSeed);
+    std::uniform_real_distribution<float> x(lo.x, hi.x), z(lo.y, hi.y), unit(0, 1);
+    std::vector<PointLight> lights(sceneLights);
+    for(PointLight& light : lights) {
+        light.position = glm::vec3(x(random), -8, z(random));
+        light.radius = 6;
+        light.color = glm::vec3(unit(random), unit(random), unit(random));
+    }
+    if(environmentSource != ENVIRONMENT_LIGHTS) {
+        scene.setLights(lights.data(), lights.size());
+        return;
+    }
+    // seen from above the middle of the floor, a fragment pays the same
+    // however many lights there are
+    glm::vec2 middle = (lo + hi) / 2.0f;
+    EnvironmentLighting environment = bakeEnvironment(lights.data(), lights.size(), glm::vec3(middle.x, 0, middle.y));
+    renderbatch::setEnvironmentLighting(&environment);
+}
+
 static double positionSpeed = 10;
 static double rotationSpeed = -0.001;
 
@@ -303,10 +2126,12 @@ static arp::Pose poseFunction(
     arp::KeyTimeFunction keyTime) {
 
     arp::Pose result;
+    PoseData& angles = result.payload<PoseData>();
+    const PoseData& last = lastPose.payload<PoseData>();
 
-    result.data.rotationX = lastPose.data.rotationX + rotationSpeed * dy;
-    result.data.rotationY = lastPose.data.rotationY + rotationSpeed * dx;
-    result.orientation = glm::quat(glm::vec3(0, result.data.rotationY, 0)) * glm::quat(glm::vec3(result.data.rotationX, 0, 0));
+    angles.rotationX = last.rotationX + rotationSpeed * dy;
+    angles.rotationY = last.rotationY + rotationSpeed * dx;
+    result.orientation = glm::quat(glm::vec3(0, angles.rotationY, 0)) * glm::quat(glm::vec3(angles.rotationX, 0, 0));
 
     result.position = lastPose.position;
     
@@ -316,7 +2141,7 @@ static arp::Pose poseFunction(
     movement.z += positionSpeed * keyTime(GLFW_KEY_S);
     movement.z -= positionSpeed * keyTime(GLFW_KEY_W);
     
-    movement = glm::rotate(glm::mat4(1), (float)result.data.rotationY, glm::vec3(0.f, 1.f, 0.f)) * glm::vec4(movement, 1);
+    movement = glm::rotate(glm::mat4(1), (float)angles.rotationY, glm::vec3(0.f, 1.f, 0.f)) * glm::vec4(movement, 1);
     result.position += movement;
 
     result.position.y += positionSpeed * keyTime(GLFW_KEY_SPACE);
@@ -329,11 +2154,395 @@ static void keyCallback(GLFWwindow* window, int key, int scancode, int action, i
     if(key == GLFW_KEY_ESCAPE && action == GLFW_PRESS) {
         arp::releaseCursor();
     }
+    if(key == GLFW_KEY_F12 && action == GLFW_PRESS) {
+        arp::writeTrace("arp_trace.json");
+    }
+    if(key == GLFW_KEY_F11 && action == GLFW_PRESS && voxelCache) {
+        voxelLookupPending = true;
+    }
+}
+
+/**
+ * Renders the main layer with the poses of a remote client or local
+ * compositor until it disconnects
+ */
+static void runRemoteServer(GLFWwindow* window) {
+    arp::SwapchainCreateInfo swapchainInfo;
+    swapchainInfo.width = 1920;
+    swapchainInfo.height = 1080;
+    // one being rendered and one being read back
+    swapchainInfo.numImages = 2;
+    swapchain = new arp::Swapchain(swapchainInfo);
+    aspectRatio = 1920.0 / 1080.0;
+
+    renderbatch scene;
+    if(sceneObjects > 0)
+        addGeneratedScene(scene);
+    else
+        addSampleScene(scene);
+    arp::glState().setEnabled(GL_DEPTH_TEST, true);
+
+    arp::RemoteServer server;
+    // a local compositor's memory is fast enough for frames as rendered
+    if(remoteRaw || !compositorAppName.empty())
+        server.setEncoding(arp::REMOTE_ENCODING_RAW);
+    if(remoteAdaptive)
+        server.setAdaptiveStreaming(arp::RemoteStreamSettings());
+    if(!compositorAppName.empty()) {
+        if(!server.connectLocal(compositorAppName.c_str()))
+            return;
+        std::cout << "Rendering on " << glGetString(GL_RENDERER) << std::endl;
+    }
+    else {
+        std::cout << "Waiting for a client on port " << remoteServerPort << std::endl;
+        if(!server.listen(remoteServerPort))
+            return;
+    }
+    while(server.isConnected()) {
+        arp::Pose pose;
+        arp::PoseInfo poseInfo;
+        if(!server.receivePose(pose, poseInfo, 0.1))
+            continue;
+        renderobject::beginFrame();
+        arp::LayerProjection projection = arp::LayerProjection::perspective(fovY, aspectRatio, 0.1, 100);
+        int swapchainIndex = swapchain->acquireImage();
+        swapchain->bindFramebuffer(swapchainIndex);
+        int viewport[4];
+        server.getViewport(swapchain->width, swapchain->height, viewport);
+        arp::glState().viewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        glClearColor(0.1, 0.1, 0.1, 1);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        scene.update(pose);
+        scene.draw(projection);
+
+        arp::FrameSubmitInfo frame;
+        frame.pose = pose;
+        frame.poseInfo = poseInfo;
+        arp::FrameLayer layer;
+        layer.flags = arp::PARALLAX_ENABLED;
+        layer.fov = fovY;
+        layer.swapchain = swapchain;
+        layer.swapchainIndex = swapchainIndex;
+        layer.hasProjection = true;
+        layer.projection = projection;
+        layer.hasViewport = true;
+        std::copy(viewport, viewport + 4, layer.viewport);
+        frame.layers.push_back(layer);
+        server.sendFrame(frame);
+    }
+    std::cout << "Client disconnected" << std::endl;
+    server.close();
+}
+
+/**
+ * Renders for every client that connects until the window closes: the main
+ * layer once per view of clients within half a unit and 10 degrees of each
+ * other, and twice a second a background twice as wide for all of them
+ */
+static void runBroadcastServer(GLFWwindow* window) {
+    const float viewDistance = 0.5f;
+    const float viewAngle = glm::radians(10.0f);
+    const double backgroundInterval = 0.5;
+
+    arp::SwapchainCreateInfo swapchainInfo;
+    swapchainInfo.width = 1920;
+    swapchainInfo.height = 1080;
+    swapchainInfo.numImages = 2;
+    swapchain = new arp::Swapchain(swapchainInfo);
+    aspectRatio = 1920.0 / 1080.0;
+    // one shared, one being rendered
+    arp::SwapchainCreateInfo backgroundInfo = swapchainInfo;
+    backgroundInfo.width = 1024;
+    backgroundInfo.height = 1024;
+    arp::Swapchain* background = new arp::Swapchain(backgroundInfo);
+
+    renderbatch scene;
+    if(sceneObjects > 0)
+        addGeneratedScene(scene);
+    else
+        addSampleScene(scene);
+    arp::glState().setEnabled(GL_DEPTH_TEST, true);
+
+    arp::RemoteBroadcastServer server;
+    if(remoteRaw)
+        server.setEncoding(arp::REMOTE_ENCODING_RAW);
+    if(!server.listen(broadcastPort))
+        return;
+    std::cout << "Broadcasting on port " << broadcastPort << std::endl;
+    std::vector<arp::BroadcastView> views;
+    double lastBackground = -backgroundInterval;
+    while(!glfwWindowShouldClose(window)) {
+        glfwPollEvents();
+        if(server.receiveViews(views, viewDistance, viewAngle, 0.1) == 0)
+            continue;
+        renderobject::beginFrame();
+
+        double now = glfwGetTime();
+        if(now - lastBackground >= backgroundInterval) {
+            float backgroundFov = std::min(2 * (float)fovY, glm::radians(150.0f));
+            arp::LayerProjection projection = arp::LayerProjection::perspective(backgroundFov, 1, 0.1, 100);
+            int index = background->acquireImage();
+            background->bindFramebuffer(index);
+            arp::glState().viewport(0, 0, background->width, background->height);
+            glClearColor(0.1, 0.1, 0.1, 1);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            scene.update(views[0].pose);
+            scene.draw(projection);
+
+            arp::FrameLayers shared;
+            arp::FrameLayer layer;
+            layer.flags = arp::NONE;
+            layer.fov = backgroundFov;
+            layer.swapchain = background;
+            layer.swapchainIndex = index;
+            layer.hasPose = true;
+            layer.pose = views[0].pose;
+            layer.time = views[0].poseInfo.time;
+            layer.hasProjection = true;
+            layer.projection = projection;
+            shared.push_back(layer);
+            server.shareLayers(shared);
+            lastBackground = now;
+        }
+
+        arp::LayerProjection projection = arp::LayerProjection::perspective(fovY, aspectRatio, 0.1, 100);
+        for(const arp::BroadcastView& view : views) {
+            int swapchainIndex = swapchain->acquireImage();
+            swapchain->bindFramebuffer(swapchainIndex);
+            arp::glState().viewport(0, 0, swapchain->width, swapchain->height);
+            glClearColor(0.1, 0.1, 0.1, 1);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            scene.update(view.pose);
+            scene.draw(projection);
+
+            arp::FrameSubmitInfo frame;
+            frame.pose = view.pose;
+            frame.poseInfo = view.poseInfo;
+            arp::FrameLayer layer;
+            layer.flags = arp::PARALLAX_ENABLED;
+            layer.fov = fovY;
+            layer.swapchain = swapchain;
+            layer.swapchainIndex = swapchainIndex;
+            layer.hasProjection = true;
+            layer.projection = projection;
+            frame.layers.push_back(layer);
+            server.sendView(view, frame);
+        }
+    }
+    server.close();
+}
+
+/**
+ * Sends poses to a remote server each app frame, predicted for when the
+ * frames rendered with them will be shown, and submits the frames it sends
+ * back
+ */
+static void remoteClientCallback(GLFWwindow* window) {
+    // like the other swapchains, the client's live as long as the program,
+    // reprojection may still draw them after this returns
+    arp::RemoteClient* client = new arp::RemoteClient();
+    if(!client->connect(remoteHost.c_str(), remotePort, 2 + frameHistoryLength))
+        return;
+    arp::captureCursor();
+    arp::FrameSubmitInfo frame;
+    while(!glfwWindowShouldClose(window) && client->isConnected()) {
+        arp::waitForNextAppFrame(targetFramerate());
+        client->sendPredictedPose();
+        if(client->receiveFrame(frame))
+            arp::submitFrame(frame);
+    }
+    if(!client->isConnected())
+        std::cout << "Lost the connection to " << remoteHost << std::endl;
+    arp::releaseCursor();
+}
+
+/**
+ * Reprojects the frames of local apps, one at a time. When an app exits or
+ * crashes the last frame it sent keeps being reprojected until the next one
+ * connects
+ */
+static void compositorCallback(GLFWwindow* window) {
+    // reprojection may still draw the client's swapchains after this returns
+    arp::RemoteClient* client = new arp::RemoteClient();
+    std::cout << "Waiting for apps as " << compositorName << std::endl;
+    if(crossAdapter)
+        std::cout << "Reprojecting on " << glGetString(GL_RENDERER) << std::endl;
+    bool appStarted = false;
+    arp::captureCursor();
+    arp::FrameSubmitInfo frame;
+    while(!glfwWindowShouldClose(window)) {
+        if(!client->isConnected()) {
+            bool connected = client->listenLocal(compositorName.c_str(), 2 + frameHistoryLength, 0.1);
+            // the first wait made the channel, which the app opens
+            if(crossAdapter && !appStarted) {
+                if(!startCrossAdapterApp())
+                    break;
+                appStarted = true;
+            }
+            if(!connected)
+                continue;
+            std::cout << "App connected" << std::endl;
+        }
+        arp::waitForNextAppFrame(targetFramerate());
+        client->sendPredictedPose();
+        if(client->receiveFrame(frame))
+            arp::submitFrame(frame);
+        if(!client->isConnected())
+            std::cout << "App disconnected" << std::endl;
+    }
+    arp::releaseCursor();
+}
+
+/**
+ * Prints the stutters arp detected since the last call
+ */
+static void printJankEvents() {
+    static const char* const types[] = { "missed vblank", "stale frame", "swapchain wait" };
+    static const char* const causes[] = { "unknown", "late pose function", "GPU contention", "swap blocking",
+                                          "app late" };
+    arp::JankEvent events[16];
+    int count;
+    while((count = arp::readJankEvents(events, 16)) > 0) {
+        for(int i = 0; i < count; i++) {
+            const arp::JankEvent& event = events[i];
+            std::cout << "jank at " << event.time << ": " << types[event.type] << " of "
+                      << event.duration * 1000.0 << " ms, " << causes[event.cause] << std::endl;
+        }
+    }
+}
+
+/**
+ * Prints the refreshes presented since the last call that showed a new app
+ * frame
+ */
+static void printPresentedFrames() {
+    static std::uint64_t position = 0;
+    arp::PresentedRefresh refreshes[32];
+    int count;
+    while((count = arp::readPresentedRefreshes(refreshes, 32, position)) > 0) {
+        for(int i = 0; i < count; i++) {
+            const arp::PresentedRefresh& refresh = refreshes[i];
+            if(refresh.frame == 0 || refresh.staleRefreshes > 0)
+                continue;
+            std::cout << "frame " << refresh.frame << " shown at refresh " << refresh.refresh << ", "
+                      << refresh.frameAge * 1000.0 << " ms after submit, pose " << refresh.poseAge * 1000.0
+                      << " ms old" << (refresh.missed ? ", missed vblank" : "") << std::endl;
+        }
+    }
+}
+
+/**
+ * Starts the app of a cross-adapter compositor, this program again with
+ * crossAdapterArguments, on the discrete GPU through PRIME render offload.
+ * Frames still go through the compositor's shared memory, read back on the
+ * discrete GPU while the next frame renders and uploaded to the one driving
+ * the display. Returns false and prints an error if it can't be started
+ */
+static bool startCrossAdapterApp() {
+#ifdef _WIN32
+    return false;
+#else
+    std::vector<char*> arguments;
+    for(std::string& argument : crossAdapterArguments)
+        arguments.push_back(&argument[0]);
+    arguments.push_back(nullptr);
+
+    // the offload variables replace any this process was started with
+    std::vector<std::string> variables = { "DRI_PRIME=1" };
+    if(crossAdapterNvidia) {
+        variables.push_back("__NV_PRIME_RENDER_OFFLOAD=1");
+        variables.push_back("__GLX_VENDOR_LIBRARY_NAME=nvidia");
+    }
+    std::vector<char*> environment;
+    for(char** variable = environ; *variable; variable++) {
+        std::string name(*variable, std::strcspn(*variable, "="));
+        bool replaced = std::any_of(variables.begin(), variables.end(), [&](const std::string& v) {
+            return v.compare(0, name.size() + 1, name + "=") == 0;
+        });
+        if(!replaced)
+            environment.push_back(*variable);
+    }
+    for(std::string& variable : variables)
+        environment.push_back(&variable[0]);
+    environment.push_back(nullptr);
+
+    pid_t pid;
+    if(posix_spawnp(&pid, arguments[0], nullptr, nullptr, arguments.data(), environment.data()) != 0) {
+        std::cout << "Unable to start the app process " << arguments[0] << std::endl;
+        return false;
+    }
+    return true;
+#endif
+}
+
+/**
+ * Adds the triangles of an object of the sample scene to the geometry
+ * --scene-trace hands arp, placed like renderbatch::add places it and
+ * colored by the diffuse color of their materials
+ */
+static void addTracedObject(const char* fileName, double x, double y, double z) {
+    static std::map<std::string, cy::TriMesh> meshes;
+    auto found = meshes.find(fileName);
+    if(found == meshes.end()) {
+        found = meshes.emplace(fileName, cy::TriMesh()).first;
+        if(!loadObj(fileName, found->second))
+            std::cout << "Error: Unable to load " << fileName << std::endl;
+    }
+    const cy::TriMesh& mesh = found->second;
+    std::uint32_t base = tracedPositions.size();
+    glm::vec3 position(x, y, -z);
+    for(unsigned int i = 0; i < mesh.NV(); i++)
+        tracedPositions.push_back(position + glm::vec3(mesh.V(i).x, mesh.V(i).y, mesh.V(i).z));
+    for(unsigned int i = 0; i < mesh.NF(); i++) {
+        for(int j = 0; j < 3; j++)
+            tracedIndices.push_back(base + mesh.F(i).v[j]);
+        int material = mesh.GetMaterialIndex(i);
+        glm::vec3 kd = material >= 0 ? glm::make_vec3(mesh.M(material).Kd) : glm::vec3(1);
+        glm::uvec3 rgb = glm::uvec3(glm::clamp(kd, 0.f, 1.f) * 255.f + 0.5f);
+        tracedColors.push_back(rgb.r | rgb.g << 8 | rgb.b << 16 | 0xFF000000u);
+    }
+}
+
+/**
+ * Prints the cached voxel nearest the camera once arp has copied the cache
+ */
+static void lookUpVoxel(const arp::Pose& pose) {
+    std::vector<arp::VoxelCachePoint> points;
+    if(!arp::getVoxelCachePoints(points))
+        return;
+    voxelLookupPending = false;
+    if(points.empty()) {
+        std::cout << "Voxel cache is empty" << std::endl;
+        return;
+    }
+    std::vector<cy::Vec3f> positions(points.size());
+    for(size_t i = 0; i < points.size(); i++)
+        positions[i] = cy::Vec3f(points[i].position.x, points[i].position.y, points[i].position.z);
+    cy::PointCloud<cy::Vec3f, float, 3> cloud(positions.size(), positions.data());
+    cy::Vec3f camera(pose.position.x, pose.position.y, pose.position.z);
+    uint32_t index;
+    cy::Vec3f closest;
+    float distanceSquared;
+    cloud.GetClosest(camera, index, closest, distanceSquared);
+    std::uint32_t color = points[index].color;
+    std::cout << points.size() << " voxels, nearest at " << closest.x << " " << closest.y << " " << closest.z
+              << ", " << std::sqrt(distanceSquared) << " away, color " << (color & 0xFF) << " "
+              << ((color >> 8) & 0xFF) << " " << ((color >> 16) & 0xFF) << std::endl;
 }
 
 static void framebufferSizeCallback(GLFWwindow* window, int width, int height) {
+    if(stereo) {
+        width /= 2;
+        rightSwapchain->resize(width, height);
+    }
+    for(arp::Swapchain* peelSwapchain : peelSwapchains) {
+        if(peelSwapchain)
+            peelSwapchain->resize(width, height);
+    }
+    if(farSwapchain)
+        farSwapchain->resize(width / farScale(), height / farScale());
     swapchain->resize(width, height);
-    backgroundSwapchain->resize(width / 2, height / 2);
+    backgroundSwapchain->resize(height / 2, height / 2);
     aspectRatio = (double)width / (double)height;
     arp::updateProjection(0.1, 100, fovY, aspectRatio);
 }
@@ -345,9 +2554,11 @@ static void windowFocusCallback(GLFWwindow* window, int focused) {
 }
 
 static void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods) {
+#ifndef ARP_NO_OVERLAY
     ImGuiIO& io = ImGui::GetIO();
     if(io.WantCaptureMouse)
         return;
+#endif
     
     if(action == GLFW_PRESS) {
         arp::captureCursor();